@@ -31,8 +31,10 @@
 #include "ba-transport.h"
 #include "ba-transport-pcm.h"
 #include "bluealsa-dbus.h"
+#include "codec-lib.h"
 #include "io.h"
 #include "rtp.h"
+#include "trace.h"
 #include "utils.h"
 #include "shared/a2dp-codecs.h"
 #include "shared/defs.h"
@@ -40,6 +42,45 @@
 #include "shared/log.h"
 #include "shared/rt.h"
 
+#ifndef FDK_AAC_SONAME
+# define FDK_AAC_SONAME "libfdk-aac.so.2"
+#endif
+
+#define FDK_AAC_SYMBOLS(X) \
+	X(aacDecoder_Close) \
+	X(aacDecoder_DecodeFrame) \
+	X(aacDecoder_Fill) \
+	X(aacDecoder_GetLibInfo) \
+	X(aacDecoder_GetStreamInfo) \
+	X(aacDecoder_Open) \
+	X(aacDecoder_SetParam) \
+	X(aacEncClose) \
+	X(aacEncEncode) \
+	X(aacEncGetLibInfo) \
+	X(aacEncInfo) \
+	X(aacEncOpen) \
+	X(aacEncoder_SetParam)
+
+CODEC_LIB_DEFINE(codec_lib_fdk_aac, "FDK-AAC", FDK_AAC_SONAME, FDK_AAC_SYMBOLS);
+
+#if ENABLE_CODEC_DLOPEN
+# define aacDecoder_Close CODEC_LIB_SYM(codec_lib_fdk_aac, aacDecoder_Close)
+# define aacDecoder_DecodeFrame CODEC_LIB_SYM(codec_lib_fdk_aac, aacDecoder_DecodeFrame)
+# define aacDecoder_Fill CODEC_LIB_SYM(codec_lib_fdk_aac, aacDecoder_Fill)
+# define aacDecoder_GetLibInfo CODEC_LIB_SYM(codec_lib_fdk_aac, aacDecoder_GetLibInfo)
+# define aacDecoder_GetStreamInfo CODEC_LIB_SYM(codec_lib_fdk_aac, aacDecoder_GetStreamInfo)
+# define aacDecoder_Open CODEC_LIB_SYM(codec_lib_fdk_aac, aacDecoder_Open)
+# define aacDecoder_SetParam CODEC_LIB_SYM(codec_lib_fdk_aac, aacDecoder_SetParam)
+# define aacEncClose CODEC_LIB_SYM(codec_lib_fdk_aac, aacEncClose)
+# define aacEncEncode CODEC_LIB_SYM(codec_lib_fdk_aac, aacEncEncode)
+# define aacEncGetLibInfo CODEC_LIB_SYM(codec_lib_fdk_aac, aacEncGetLibInfo)
+# define aacEncInfo CODEC_LIB_SYM(codec_lib_fdk_aac, aacEncInfo)
+# define aacEncOpen CODEC_LIB_SYM(codec_lib_fdk_aac, aacEncOpen)
+# define aacEncoder_SetParam CODEC_LIB_SYM(codec_lib_fdk_aac, aacEncoder_SetParam)
+#endif
+
+static struct codec_lib * const a2dp_aac_libs[] = { &codec_lib_fdk_aac, NULL };
+
 static const struct a2dp_bit_mapping a2dp_aac_channels[] = {
 	{ AAC_CHANNEL_MODE_MONO, .ch = { 1, a2dp_channel_map_mono } },
 	{ AAC_CHANNEL_MODE_STEREO, .ch = { 2, a2dp_channel_map_stereo } },
@@ -346,8 +387,10 @@ void *a2dp_aac_enc_thread(struct ba_transport_pcm *t_pcm) {
 
 		while ((in_args.numInSamples = ffb_len_out(&pcm)) > (int)info.inputChannels) {
 
+			trace_event(BA_TRACE_EVENT_ENCODE_BEGIN, in_args.numInSamples, 0);
 			if ((err = aacEncEncode(handle, &in_buf, &out_buf, &in_args, &out_args)) != AACENC_OK)
 				error("AAC encoding error: %s", aacenc_strerror(err));
+			trace_event(BA_TRACE_EVENT_ENCODE_END, out_args.numOutBytes, out_args.numOutBytes > 0);
 
 			if (out_args.numOutBytes > 0) {
 
@@ -540,6 +583,7 @@ void *a2dp_aac_dec_thread(struct ba_transport_pcm *t_pcm) {
 		unsigned int valid = ffb_len_out(&latm);
 		CStreamInfo *info;
 
+		trace_event(BA_TRACE_EVENT_DECODE_BEGIN, data_len, 0);
 		if ((err = aacDecoder_Fill(handle, (uint8_t **)&latm.data, &data_len, &valid)) != AAC_DEC_OK)
 			error("AAC buffer fill error: %s", aacdec_strerror(err));
 		else if ((err = aacDecoder_DecodeFrame(handle, pcm.tail, ffb_blen_in(&pcm), 0)) != AAC_DEC_OK)
@@ -552,7 +596,8 @@ void *a2dp_aac_dec_thread(struct ba_transport_pcm *t_pcm) {
 				warn("AAC channels mismatch: %u != %u", info->numChannels, channels);
 
 			const size_t samples = (size_t)info->frameSize * channels;
-			io_pcm_scale(t_pcm, pcm.data, samples);
+			trace_event(BA_TRACE_EVENT_DECODE_END, samples, 0);
+
 			if (io_pcm_write(t_pcm, pcm.data, samples) == -1)
 				error("PCM write error: %s", strerror(errno));
 
@@ -718,6 +763,11 @@ static int a2dp_aac_transport_init(struct ba_transport *t) {
 
 static int a2dp_aac_source_init(struct a2dp_sep *sep) {
 
+	/* Codec capabilities depend on the library build,
+	 * so the library has to be loaded right away. */
+	if (codec_lib_load_all(sep->libs) != 0)
+		return -1;
+
 	LIB_INFO info[FDK_MODULE_LAST];
 	FDKinitLibInfo(info);
 	aacEncGetLibInfo(info);
@@ -800,11 +850,17 @@ struct a2dp_sep a2dp_aac_source = {
 	.transport_init = a2dp_aac_transport_init,
 	.transport_start = a2dp_aac_source_transport_start,
 	.caps_helpers = &a2dp_aac_caps_helpers,
+	.libs = a2dp_aac_libs,
 	.enabled = true,
 };
 
 static int a2dp_aac_sink_init(struct a2dp_sep *sep) {
 
+	/* Codec capabilities depend on the library build,
+	 * so the library has to be loaded right away. */
+	if (codec_lib_load_all(sep->libs) != 0)
+		return -1;
+
 	LIB_INFO info[FDK_MODULE_LAST];
 	FDKinitLibInfo(info);
 	aacDecoder_GetLibInfo(info);
@@ -885,5 +941,6 @@ struct a2dp_sep a2dp_aac_sink = {
 	.transport_init = a2dp_aac_transport_init,
 	.transport_start = a2dp_aac_sink_transport_start,
 	.caps_helpers = &a2dp_aac_caps_helpers,
+	.libs = a2dp_aac_libs,
 	.enabled = true,
 };
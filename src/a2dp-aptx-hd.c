@@ -30,6 +30,7 @@
 #include "codec-aptx.h"
 #include "io.h"
 #include "rtp.h"
+#include "trace.h"
 #include "shared/a2dp-codecs.h"
 #include "shared/defs.h"
 #include "shared/ffb.h"
@@ -174,6 +175,8 @@ void *a2dp_aptx_hd_enc_thread(struct ba_transport_pcm *t_pcm) {
 			size_t output_len = ffb_len_in(&bt);
 			size_t pcm_samples = 0;
 
+			trace_event(BA_TRACE_EVENT_ENCODE_BEGIN, input_samples, 0);
+
 			/* Generate as many apt-X frames as possible to fill the output buffer
 			 * without overflowing it. The size of the output buffer is based on
 			 * the socket MTU, so such a transfer should be most efficient. */
@@ -195,6 +198,8 @@ void *a2dp_aptx_hd_enc_thread(struct ba_transport_pcm *t_pcm) {
 
 			}
 
+			trace_event(BA_TRACE_EVENT_ENCODE_END, ffb_blen_out(&bt), 0);
+
 			rtp_state_new_frame(&rtp, rtp_header);
 
 			ssize_t len = ffb_blen_out(&bt);
@@ -304,13 +309,14 @@ void *a2dp_aptx_hd_dec_thread(struct ba_transport_pcm *t_pcm) {
 
 		size_t rtp_payload_len = len - (rtp_payload - (uint8_t *)bt.data);
 
+		trace_event(BA_TRACE_EVENT_DECODE_BEGIN, rtp_payload_len, 0);
 		ffb_rewind(&pcm);
 		while (rtp_payload_len >= 6) {
 
 			size_t decoded = ffb_len_in(&pcm);
 			if ((len = aptxhddec_decode(handle, rtp_payload, rtp_payload_len, pcm.tail, &decoded)) <= 0) {
 				error("Apt-X decoding error: %s", strerror(errno));
-				continue;
+				break;
 			}
 
 			rtp_payload += len;
@@ -319,8 +325,9 @@ void *a2dp_aptx_hd_dec_thread(struct ba_transport_pcm *t_pcm) {
 
 		}
 
+		trace_event(BA_TRACE_EVENT_DECODE_END, ffb_len_out(&pcm), 0);
+
 		const size_t samples = ffb_len_out(&pcm);
-		io_pcm_scale(t_pcm, pcm.data, samples);
 		if (io_pcm_write(t_pcm, pcm.data, samples) == -1)
 			error("PCM write error: %s", strerror(errno));
 
@@ -429,6 +436,8 @@ static int a2dp_aptx_hd_source_transport_start(struct ba_transport *t) {
 	return ba_transport_pcm_start(&t->media.pcm, a2dp_aptx_hd_enc_thread, "ba-a2dp-aptx-hd");
 }
 
+static struct codec_lib * const a2dp_aptx_hd_libs[] = { &codec_lib_aptx, NULL };
+
 struct a2dp_sep a2dp_aptx_hd_source = {
 	.name = "A2DP Source (apt-X HD)",
 	.config = {
@@ -454,6 +463,7 @@ struct a2dp_sep a2dp_aptx_hd_source = {
 	.transport_init = a2dp_aptx_hd_transport_init,
 	.transport_start = a2dp_aptx_hd_source_transport_start,
 	.caps_helpers = &a2dp_aptx_hd_caps_helpers,
+	.libs = a2dp_aptx_hd_libs,
 };
 
 #if HAVE_APTX_HD_DECODE
@@ -486,6 +496,7 @@ struct a2dp_sep a2dp_aptx_hd_sink = {
 	.transport_init = a2dp_aptx_hd_transport_init,
 	.transport_start = a2dp_aptx_hd_sink_transport_start,
 	.caps_helpers = &a2dp_aptx_hd_caps_helpers,
+	.libs = a2dp_aptx_hd_libs,
 };
 
 #endif
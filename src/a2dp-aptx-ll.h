@@ -0,0 +1,24 @@
+/*
+ * BlueALSA - a2dp-aptx-ll.h
+ * Copyright (c) 2016-2025 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#pragma once
+#ifndef BLUEALSA_A2DPAPTXLL_H_
+#define BLUEALSA_A2DPAPTXLL_H_
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "a2dp.h"
+
+extern struct a2dp_sep a2dp_aptx_ll_source;
+extern struct a2dp_sep a2dp_aptx_ll_sink;
+
+#endif
@@ -29,6 +29,7 @@
 #include "bluealsa-dbus.h"
 #include "codec-aptx.h"
 #include "io.h"
+#include "trace.h"
 #include "shared/a2dp-codecs.h"
 #include "shared/defs.h"
 #include "shared/ffb.h"
@@ -161,6 +162,8 @@ void *a2dp_aptx_enc_thread(struct ba_transport_pcm *t_pcm) {
 			size_t output_len = ffb_len_in(&bt);
 			size_t pcm_samples = 0;
 
+			trace_event(BA_TRACE_EVENT_ENCODE_BEGIN, input_samples, 0);
+
 			/* Generate as many apt-X frames as possible to fill the output buffer
 			 * without overflowing it. The size of the output buffer is based on
 			 * the socket MTU, so such a transfer should be most efficient. */
@@ -182,6 +185,8 @@ void *a2dp_aptx_enc_thread(struct ba_transport_pcm *t_pcm) {
 
 			}
 
+			trace_event(BA_TRACE_EVENT_ENCODE_END, ffb_blen_out(&bt), 0);
+
 			ssize_t len = ffb_blen_out(&bt);
 			if ((len = io_bt_write(t_pcm, bt.data, len)) <= 0) {
 				if (len == -1)
@@ -270,13 +275,14 @@ void *a2dp_aptx_dec_thread(struct ba_transport_pcm *t_pcm) {
 		uint8_t *input = bt.data;
 		size_t input_len = len;
 
+		trace_event(BA_TRACE_EVENT_DECODE_BEGIN, input_len, 0);
 		ffb_rewind(&pcm);
 		while (input_len >= 4) {
 
 			size_t decoded = ffb_len_in(&pcm);
 			if ((len = aptxdec_decode(handle, input, input_len, pcm.tail, &decoded)) <= 0) {
 				error("Apt-X decoding error: %s", strerror(errno));
-				continue;
+				break;
 			}
 
 			input += len;
@@ -285,8 +291,9 @@ void *a2dp_aptx_dec_thread(struct ba_transport_pcm *t_pcm) {
 
 		}
 
+		trace_event(BA_TRACE_EVENT_DECODE_END, ffb_len_out(&pcm), 0);
+
 		const size_t samples = ffb_len_out(&pcm);
-		io_pcm_scale(t_pcm, pcm.data, samples);
 		if (io_pcm_write(t_pcm, pcm.data, samples) == -1)
 			error("PCM write error: %s", strerror(errno));
 
@@ -392,6 +399,8 @@ static int a2dp_aptx_source_transport_start(struct ba_transport *t) {
 	return ba_transport_pcm_start(&t->media.pcm, a2dp_aptx_enc_thread, "ba-a2dp-aptx");
 }
 
+static struct codec_lib * const a2dp_aptx_libs[] = { &codec_lib_aptx, NULL };
+
 struct a2dp_sep a2dp_aptx_source = {
 	.name = "A2DP Source (apt-X)",
 	.config = {
@@ -417,6 +426,7 @@ struct a2dp_sep a2dp_aptx_source = {
 	.transport_init = a2dp_aptx_transport_init,
 	.transport_start = a2dp_aptx_source_transport_start,
 	.caps_helpers = &a2dp_aptx_caps_helpers,
+	.libs = a2dp_aptx_libs,
 };
 
 #if HAVE_APTX_DECODE
@@ -449,6 +459,7 @@ struct a2dp_sep a2dp_aptx_sink = {
 	.transport_init = a2dp_aptx_transport_init,
 	.transport_start = a2dp_aptx_sink_transport_start,
 	.caps_helpers = &a2dp_aptx_caps_helpers,
+	.libs = a2dp_aptx_libs,
 };
 
 #endif
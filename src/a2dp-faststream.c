@@ -27,6 +27,7 @@
 #include "bluealsa-dbus.h"
 #include "codec-sbc.h"
 #include "io.h"
+#include "trace.h"
 #include "shared/a2dp-codecs.h"
 #include "shared/defs.h"
 #include "shared/ffb.h"
@@ -183,6 +184,8 @@ void *a2dp_fs_enc_thread(struct ba_transport_pcm *t_pcm) {
 		size_t pcm_frames = 0;
 		size_t sbc_frames = 0;
 
+		trace_event(BA_TRACE_EVENT_ENCODE_BEGIN, input_len, 0);
+
 		while (input_len >= sbc_frame_samples &&
 				output_len >= sbc_frame_len &&
 				sbc_frames < 3) {
@@ -206,6 +209,8 @@ void *a2dp_fs_enc_thread(struct ba_transport_pcm *t_pcm) {
 
 		}
 
+		trace_event(BA_TRACE_EVENT_ENCODE_END, ffb_blen_out(&bt), sbc_frames);
+
 		if (sbc_frames > 0) {
 
 			ssize_t len = ffb_blen_out(&bt);
@@ -225,8 +230,12 @@ void *a2dp_fs_enc_thread(struct ba_transport_pcm *t_pcm) {
 			/* make room for new FastStream frames */
 			ffb_rewind(&bt);
 
-			/* Keep data transfer at a constant bit rate. */
-			asrsync_sync(&io.asrs, pcm_frames);
+			if (is_voice)
+				/* Keep data transfer in sync with the music stream. */
+				io_bc_sync(&io, t_pcm, pcm_frames);
+			else
+				/* Keep data transfer at a constant bit rate. */
+				asrsync_sync(&io.asrs, pcm_frames);
 
 			/* If the input buffer was not consumed (due to codesize limit), we
 			 * have to append new data to the existing one. Since we do not use
@@ -299,27 +308,35 @@ void *a2dp_fs_dec_thread(struct ba_transport_pcm *t_pcm) {
 
 		uint8_t *input = bt.data;
 		size_t input_len = len;
+		size_t pcm_frames = 0;
 
 		/* decode retrieved SBC frames */
 		while (input_len >= sbc_frame_len) {
 
 			size_t decoded;
+			trace_event(BA_TRACE_EVENT_DECODE_BEGIN, input_len, 0);
 			if ((len = sbc_decode(&sbc, input, input_len,
 							pcm.data, ffb_blen_in(&pcm), &decoded)) < 0) {
 				error("FastStream SBC decoding error: %s", sbc_strerror(len));
 				break;
 			}
+			trace_event(BA_TRACE_EVENT_DECODE_END, decoded / sizeof(int16_t), 0);
 
 			input += len;
 			input_len -= len;
 
 			const size_t samples = decoded / sizeof(int16_t);
-			io_pcm_scale(t_pcm, pcm.data, samples);
 			if (io_pcm_write(t_pcm, pcm.data, samples) == -1)
 				error("PCM write error: %s", strerror(errno));
 
+			pcm_frames += samples / t_pcm->channels;
+
 		}
 
+		if (!is_voice)
+			/* music stream clock paces the voice back-channel */
+			io_bc_clock_update(t, pcm_frames);
+
 	}
 
 fail:
@@ -426,12 +443,8 @@ static int a2dp_fs_transport_init(struct ba_transport *t) {
 						t->media.configuration.faststream.sampling_freq_voice)) == -1)
 			return -1;
 
-		t->media.pcm_bc.format = BA_TRANSPORT_PCM_FORMAT_S16_2LE;
-		t->media.pcm_bc.channels = 1;
-		t->media.pcm_bc.rate = a2dp_fs_rates_voice[rate_i].value;
-
-		memcpy(t->media.pcm_bc.channel_map, a2dp_channel_map_mono,
-				1 * sizeof(*a2dp_channel_map_stereo));
+		ba_transport_media_bc_init(t, BA_TRANSPORT_PCM_FORMAT_S16_2LE,
+				a2dp_fs_rates_voice[rate_i].value);
 
 	}
 
@@ -449,13 +462,11 @@ static int a2dp_fs_source_init(struct a2dp_sep *sep) {
 static int a2dp_fs_source_transport_start(struct ba_transport *t) {
 
 	struct ba_transport_pcm *pcm = &t->media.pcm;
-	struct ba_transport_pcm *pcm_bc = &t->media.pcm_bc;
 	int rv = 0;
 
 	if (t->media.configuration.faststream.direction & FASTSTREAM_DIRECTION_MUSIC)
 		rv |= ba_transport_pcm_start(pcm, a2dp_fs_enc_thread, "ba-a2dp-fs-m");
-	if (t->media.configuration.faststream.direction & FASTSTREAM_DIRECTION_VOICE)
-		rv |= ba_transport_pcm_start(pcm_bc, a2dp_fs_dec_thread, "ba-a2dp-fs-v");
+	rv |= ba_transport_media_bc_start(t, a2dp_fs_dec_thread, "ba-a2dp-fs-v");
 
 	return rv;
 }
@@ -487,13 +498,11 @@ struct a2dp_sep a2dp_faststream_source = {
 static int a2dp_fs_sink_transport_start(struct ba_transport *t) {
 
 	struct ba_transport_pcm *pcm = &t->media.pcm;
-	struct ba_transport_pcm *pcm_bc = &t->media.pcm_bc;
 	int rv = 0;
 
 	if (t->media.configuration.faststream.direction & FASTSTREAM_DIRECTION_MUSIC)
 		rv |= ba_transport_pcm_start(pcm, a2dp_fs_dec_thread, "ba-a2dp-fs-m");
-	if (t->media.configuration.faststream.direction & FASTSTREAM_DIRECTION_VOICE)
-		rv |= ba_transport_pcm_start(pcm_bc, a2dp_fs_enc_thread, "ba-a2dp-fs-v");
+	rv |= ba_transport_media_bc_start(t, a2dp_fs_enc_thread, "ba-a2dp-fs-v");
 
 	return rv;
 }
@@ -16,6 +16,7 @@
 
 #include <errno.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -31,8 +32,10 @@
 #include "ba-transport.h"
 #include "ba-transport-pcm.h"
 #include "bluealsa-dbus.h"
+#include "codec-lib.h"
 #include "io.h"
 #include "rtp.h"
+#include "trace.h"
 #include "utils.h"
 #include "shared/a2dp-codecs.h"
 #include "shared/defs.h"
@@ -40,6 +43,53 @@
 #include "shared/log.h"
 #include "shared/rt.h"
 
+#ifndef LC3PLUS_SONAME
+# define LC3PLUS_SONAME "libLC3plus.so"
+#endif
+
+#define LC3PLUS_SYMBOLS(X) \
+	X(lc3plus_channels_supported) \
+	X(lc3plus_dec24) \
+	X(lc3plus_dec_get_output_samples) \
+	X(lc3plus_dec_get_size) \
+	X(lc3plus_dec_init) \
+	X(lc3plus_dec_set_frame_dms) \
+	X(lc3plus_enc24) \
+	X(lc3plus_enc_get_delay) \
+	X(lc3plus_enc_get_input_samples) \
+	X(lc3plus_enc_get_num_bytes) \
+	X(lc3plus_enc_get_size) \
+	X(lc3plus_enc_init) \
+	X(lc3plus_enc_set_bitrate) \
+	X(lc3plus_enc_set_frame_dms) \
+	X(lc3plus_free_decoder_structs) \
+	X(lc3plus_free_encoder_structs) \
+	X(lc3plus_samplerate_supported)
+
+CODEC_LIB_DEFINE(codec_lib_lc3plus, "LC3plus", LC3PLUS_SONAME, LC3PLUS_SYMBOLS);
+
+#if ENABLE_CODEC_DLOPEN
+# define lc3plus_channels_supported CODEC_LIB_SYM(codec_lib_lc3plus, lc3plus_channels_supported)
+# define lc3plus_dec24 CODEC_LIB_SYM(codec_lib_lc3plus, lc3plus_dec24)
+# define lc3plus_dec_get_output_samples CODEC_LIB_SYM(codec_lib_lc3plus, lc3plus_dec_get_output_samples)
+# define lc3plus_dec_get_size CODEC_LIB_SYM(codec_lib_lc3plus, lc3plus_dec_get_size)
+# define lc3plus_dec_init CODEC_LIB_SYM(codec_lib_lc3plus, lc3plus_dec_init)
+# define lc3plus_dec_set_frame_dms CODEC_LIB_SYM(codec_lib_lc3plus, lc3plus_dec_set_frame_dms)
+# define lc3plus_enc24 CODEC_LIB_SYM(codec_lib_lc3plus, lc3plus_enc24)
+# define lc3plus_enc_get_delay CODEC_LIB_SYM(codec_lib_lc3plus, lc3plus_enc_get_delay)
+# define lc3plus_enc_get_input_samples CODEC_LIB_SYM(codec_lib_lc3plus, lc3plus_enc_get_input_samples)
+# define lc3plus_enc_get_num_bytes CODEC_LIB_SYM(codec_lib_lc3plus, lc3plus_enc_get_num_bytes)
+# define lc3plus_enc_get_size CODEC_LIB_SYM(codec_lib_lc3plus, lc3plus_enc_get_size)
+# define lc3plus_enc_init CODEC_LIB_SYM(codec_lib_lc3plus, lc3plus_enc_init)
+# define lc3plus_enc_set_bitrate CODEC_LIB_SYM(codec_lib_lc3plus, lc3plus_enc_set_bitrate)
+# define lc3plus_enc_set_frame_dms CODEC_LIB_SYM(codec_lib_lc3plus, lc3plus_enc_set_frame_dms)
+# define lc3plus_free_decoder_structs CODEC_LIB_SYM(codec_lib_lc3plus, lc3plus_free_decoder_structs)
+# define lc3plus_free_encoder_structs CODEC_LIB_SYM(codec_lib_lc3plus, lc3plus_free_encoder_structs)
+# define lc3plus_samplerate_supported CODEC_LIB_SYM(codec_lib_lc3plus, lc3plus_samplerate_supported)
+#endif
+
+static struct codec_lib * const a2dp_lc3plus_libs[] = { &codec_lib_lc3plus, NULL };
+
 static const struct a2dp_bit_mapping a2dp_lc3plus_channels[] = {
 	{ LC3PLUS_CHANNEL_MODE_MONO, .ch = { 1, a2dp_channel_map_mono } },
 	{ LC3PLUS_CHANNEL_MODE_STEREO, .ch = { 2, a2dp_channel_map_stereo } },
@@ -174,6 +224,27 @@ static int a2dp_lc3plus_get_frame_dms(const a2dp_lc3plus_t *conf) {
 	}
 }
 
+/**
+ * Get the number of LC3plus frames packed into a single RTP packet.
+ *
+ * The number of frames is selected to cover the target packet interval. It
+ * is limited by the writing MTU (if frame length is given) and by the RTP
+ * frame counter. Frames which do not fit in the MTU will be fragmented. */
+static unsigned int a2dp_lc3plus_get_packet_frames(int frame_dms,
+		size_t frame_len, size_t mtu_payload_len) {
+
+	unsigned int packet_dms = config.lc3plus_packet_dms;
+	if (packet_dms == 0)
+		packet_dms = config.lc3plus_low_latency ? 50 : 100;
+
+	unsigned int frames = MAX(1, packet_dms / frame_dms);
+	if (frame_len > 0)
+		frames = MIN(frames, MAX(1, mtu_payload_len / frame_len));
+
+	/* do not overflow RTP frame counter */
+	return MIN(frames, (1 << 4) - 1);
+}
+
 void *a2dp_lc3plus_enc_thread(struct ba_transport_pcm *t_pcm) {
 
 	/* Cancellation should be possible only in the carefully selected place
@@ -209,7 +280,8 @@ void *a2dp_lc3plus_enc_thread(struct ba_transport_pcm *t_pcm) {
 		error("Couldn't set frame length: %s", lc3plus_strerror(err));
 		goto fail_setup;
 	}
-	if ((err = lc3plus_enc_set_bitrate(handle, config.lc3plus_bitrate)) != LC3PLUS_OK) {
+	unsigned int lc3plus_bitrate = t_pcm->bitrate;
+	if ((err = lc3plus_enc_set_bitrate(handle, lc3plus_bitrate)) != LC3PLUS_OK) {
 		error("Couldn't set bitrate: %s", lc3plus_strerror(err));
 		goto fail_setup;
 	}
@@ -221,20 +293,21 @@ void *a2dp_lc3plus_enc_thread(struct ba_transport_pcm *t_pcm) {
 
 	const size_t lc3plus_ch_samples = lc3plus_enc_get_input_samples(handle);
 	const size_t lc3plus_frame_samples = lc3plus_ch_samples * channels;
-	const size_t lc3plus_frame_len = lc3plus_enc_get_num_bytes(handle);
+	size_t lc3plus_frame_len = lc3plus_enc_get_num_bytes(handle);
 
 	const size_t rtp_headers_len = RTP_HEADER_LEN + sizeof(rtp_media_header_t);
 	const size_t mtu_write_payload_len = t->mtu_write - rtp_headers_len;
 
-	size_t ffb_pcm_len = lc3plus_frame_samples;
-	if (mtu_write_payload_len / lc3plus_frame_len > 1)
-		/* account for possible LC3plus frames packing */
-		ffb_pcm_len *= mtu_write_payload_len / lc3plus_frame_len;
+	/* In case of short frame durations, packing several LC3plus frames into
+	 * a single RTP packet reduces the number of BT writes. However, every
+	 * additional frame increases the latency. */
+	unsigned int lc3plus_packet_frames = a2dp_lc3plus_get_packet_frames(
+			lc3plus_frame_dms, lc3plus_frame_len, mtu_write_payload_len);
 
-	size_t ffb_bt_len = t->mtu_write;
-	if (ffb_bt_len < rtp_headers_len + lc3plus_frame_len)
-		/* bigger than MTU buffer will be fragmented later */
-		ffb_bt_len = rtp_headers_len + lc3plus_frame_len;
+	/* The PCM buffer shall hold audio for the whole RTP packet regardless
+	 * of the frame length, which depends on the bitrate. */
+	const size_t ffb_pcm_len = lc3plus_frame_samples *
+		a2dp_lc3plus_get_packet_frames(lc3plus_frame_dms, 0, 0);
 
 	int32_t *pcm_ch1 = malloc(lc3plus_ch_samples * sizeof(int32_t));
 	int32_t *pcm_ch2 = malloc(lc3plus_ch_samples * sizeof(int32_t));
@@ -243,7 +316,8 @@ void *a2dp_lc3plus_enc_thread(struct ba_transport_pcm *t_pcm) {
 	pthread_cleanup_push(PTHREAD_CLEANUP(free), pcm_ch2);
 
 	if (ffb_init_int32_t(&pcm, ffb_pcm_len) == -1 ||
-			ffb_init_uint8_t(&bt, ffb_bt_len) == -1 ||
+			/* bigger than MTU buffer will be fragmented later */
+			ffb_init_uint8_t(&bt, rtp_headers_len + lc3plus_packet_frames * lc3plus_frame_len) == -1 ||
 			pcm_ch1 == NULL || pcm_ch2 == NULL) {
 		error("Couldn't create data buffers: %s", strerror(errno));
 		goto fail_ffb;
@@ -252,9 +326,13 @@ void *a2dp_lc3plus_enc_thread(struct ba_transport_pcm *t_pcm) {
 	/* Get the total delay introduced by the codec. The LC3plus library
 	 * reports total codec delay in case of both encoder and decoder API.
 	 * In order not to overestimate the delay, we are not going to report
-	 * delay in the decoder thread. */
+	 * delay in the decoder thread. On top of that, the first frame of the
+	 * RTP packet has to wait until all other frames of that packet are
+	 * encoded, which adds the packetization delay. */
 	const int lc3plus_delay_frames = lc3plus_enc_get_delay(handle);
-	t_pcm->codec_delay_dms = lc3plus_delay_frames * 10000 / rate;
+	const unsigned int lc3plus_delay_dms = lc3plus_delay_frames * 10000 / rate;
+	t_pcm->codec_delay_dms = lc3plus_delay_dms +
+		(lc3plus_packet_frames - 1) * lc3plus_frame_dms;
 	ba_transport_pcm_delay_sync(t_pcm, BA_DBUS_PCM_UPDATE_DELAY);
 
 	rtp_header_t *rtp_header;
@@ -288,94 +366,136 @@ void *a2dp_lc3plus_enc_thread(struct ba_transport_pcm *t_pcm) {
 			continue;
 		}
 
-		/* anchor for RTP payload */
-		bt.tail = rtp_payload;
+		/* Apply the bitrate requested via the D-Bus API. Since the bitrate
+		 * determines the LC3plus frame length, the number of frames per
+		 * RTP packet has to be updated as well. */
+		const unsigned int bitrate = atomic_exchange_explicit(
+				&t_pcm->bitrate_request, 0, memory_order_relaxed);
+		if (bitrate != 0 && bitrate != lc3plus_bitrate) {
+
+			if ((err = lc3plus_enc_set_bitrate(handle, bitrate)) != LC3PLUS_OK)
+				error("Couldn't set bitrate: %u: %s", bitrate, lc3plus_strerror(err));
+			else {
+
+				debug("LC3plus bitrate: %u -> %u", lc3plus_bitrate, bitrate);
+				lc3plus_bitrate = bitrate;
+
+				/* publish the bitrate accepted by the encoder */
+				t_pcm->bitrate = bitrate;
+				bluealsa_dbus_pcm_update(t_pcm, BA_DBUS_PCM_UPDATE_BITRATE);
+
+				lc3plus_frame_len = lc3plus_enc_get_num_bytes(handle);
+				lc3plus_packet_frames = a2dp_lc3plus_get_packet_frames(
+						lc3plus_frame_dms, lc3plus_frame_len, mtu_write_payload_len);
+
+				if (ffb_init_uint8_t(&bt, rtp_headers_len + lc3plus_packet_frames * lc3plus_frame_len) == -1) {
+					error("Couldn't resize BT buffer: %s", strerror(errno));
+					goto fail;
+				}
+
+				rtp_payload = rtp_a2dp_init(bt.data, &rtp_header,
+						(void **)&rtp_media_header, sizeof(*rtp_media_header));
+
+				t_pcm->codec_delay_dms = lc3plus_delay_dms +
+					(lc3plus_packet_frames - 1) * lc3plus_frame_dms;
+				ba_transport_pcm_delay_sync(t_pcm, BA_DBUS_PCM_UPDATE_DELAY);
+
+			}
+
+		}
 
 		const int32_t *input = pcm.data;
 		size_t input_samples = ffb_len_out(&pcm);
-		size_t output_len = ffb_len_in(&bt);
-		size_t pcm_frames = 0;
-		size_t lc3plus_frames = 0;
-
-		/* pack as many LC3plus frames as possible */
-		while (input_samples >= lc3plus_frame_samples &&
-				output_len >= lc3plus_frame_len &&
-				/* RTP packet shall not exceed 20.0 ms of audio */
-				lc3plus_frames * lc3plus_frame_dms <= 200 &&
-				/* do not overflow RTP frame counter */
-				lc3plus_frames < ((1 << 4) - 1)) {
-
-			int encoded = 0;
-			void *scratch = NULL;
-			audio_deinterleave_s24_4le(pcm_ch_buffers, input, channels, lc3plus_ch_samples);
-			if ((err = lc3plus_enc24(handle, pcm_ch_buffers, bt.tail, &encoded, scratch)) != LC3PLUS_OK) {
-				error("LC3plus encoding error: %s", lc3plus_strerror(err));
-				break;
-			}
 
-			input += lc3plus_frame_samples;
-			input_samples -= lc3plus_frame_samples;
-			ffb_seek(&bt, encoded);
-			output_len -= encoded;
-			pcm_frames += lc3plus_ch_samples;
-			lc3plus_frames++;
+		/* encode and send audio one RTP packet at a time */
+		while (input_samples >= lc3plus_packet_frames * lc3plus_frame_samples) {
 
-		}
+			/* anchor for RTP payload */
+			bt.tail = rtp_payload;
+
+			size_t pcm_frames = 0;
+			size_t lc3plus_frames = 0;
+
+			trace_event(BA_TRACE_EVENT_ENCODE_BEGIN, input_samples, 0);
+
+			for (size_t i = 0; i < lc3plus_packet_frames; i++) {
+
+				int encoded = 0;
+				void *scratch = NULL;
+				audio_deinterleave_s24_4le(pcm_ch_buffers, input, channels, lc3plus_ch_samples);
 
-		if (lc3plus_frames > 0) {
+				input += lc3plus_frame_samples;
+				input_samples -= lc3plus_frame_samples;
+				pcm_frames += lc3plus_ch_samples;
 
-			size_t payload_len_max = t->mtu_write - rtp_headers_len;
-			size_t payload_len = ffb_blen_out(&bt) - rtp_headers_len;
-			memset(rtp_media_header, 0, sizeof(*rtp_media_header));
-			rtp_media_header->frame_count = lc3plus_frames;
+				if ((err = lc3plus_enc24(handle, pcm_ch_buffers, bt.tail, &encoded, scratch)) != LC3PLUS_OK) {
+					error("LC3plus encoding error: %s", lc3plus_strerror(err));
+					continue;
+				}
 
-			/* If the size of the RTP packet exceeds writing MTU, the RTP payload
-			 * should be fragmented. The fragmentation scheme is defined by the
-			 * vendor specific LC3plus Bluetooth A2DP specification. */
+				ffb_seek(&bt, encoded);
+				lc3plus_frames++;
 
-			if (payload_len > payload_len_max) {
-				rtp_media_header->fragmented = 1;
-				rtp_media_header->first_fragment = 1;
-				rtp_media_header->frame_count = DIV_ROUND_UP(payload_len, payload_len_max);
 			}
 
-			for (;;) {
+			trace_event(BA_TRACE_EVENT_ENCODE_END, ffb_blen_out(&bt), lc3plus_frames);
 
-				size_t chunk_len;
-				chunk_len = payload_len > payload_len_max ? payload_len_max : payload_len;
-				rtp_state_new_frame(&rtp, rtp_header);
+			if (lc3plus_frames > 0) {
 
-				ffb_rewind(&bt);
-				ffb_seek(&bt, rtp_headers_len + chunk_len);
+				size_t payload_len_max = mtu_write_payload_len;
+				size_t payload_len = ffb_blen_out(&bt) - rtp_headers_len;
+				memset(rtp_media_header, 0, sizeof(*rtp_media_header));
+				rtp_media_header->frame_count = lc3plus_frames;
 
-				ssize_t len = ffb_blen_out(&bt);
-				if ((len = io_bt_write(t_pcm, bt.data, len)) <= 0) {
-					if (len == -1)
-						error("BT write error: %s", strerror(errno));
-					goto fail;
-				}
+				/* If the size of the RTP packet exceeds writing MTU, the RTP payload
+				 * should be fragmented. The fragmentation scheme is defined by the
+				 * vendor specific LC3plus Bluetooth A2DP specification. */
 
-				if (!io.initiated) {
-					/* Get the delay due to codec processing. */
-					t_pcm->processing_delay_dms = asrsync_get_dms_since_last_sync(&io.asrs);
-					ba_transport_pcm_delay_sync(t_pcm, BA_DBUS_PCM_UPDATE_DELAY);
-					io.initiated = true;
+				if (payload_len > payload_len_max) {
+					rtp_media_header->fragmented = 1;
+					rtp_media_header->first_fragment = 1;
+					rtp_media_header->frame_count = DIV_ROUND_UP(payload_len, payload_len_max);
 				}
 
-				/* resend RTP headers */
-				len -= rtp_headers_len;
+				for (;;) {
+
+					size_t chunk_len;
+					chunk_len = payload_len > payload_len_max ? payload_len_max : payload_len;
+					rtp_state_new_frame(&rtp, rtp_header);
 
-				/* break if there is no more payload data */
-				if ((payload_len -= len) == 0)
-					break;
+					ffb_rewind(&bt);
+					ffb_seek(&bt, rtp_headers_len + chunk_len);
 
-				/* move the rest of data to the beginning of payload */
-				debug("LC3plus payload fragmentation: extra %zu bytes", payload_len);
-				memmove(rtp_payload, rtp_payload + len, payload_len);
+					ssize_t len = ffb_blen_out(&bt);
+					if ((len = io_bt_write(t_pcm, bt.data, len)) <= 0) {
+						if (len == -1)
+							error("BT write error: %s", strerror(errno));
+						goto fail;
+					}
 
-				rtp_media_header->first_fragment = 0;
-				rtp_media_header->last_fragment = payload_len <= payload_len_max;
-				rtp_media_header->frame_count--;
+					if (!io.initiated) {
+						/* Get the delay due to codec processing. */
+						t_pcm->processing_delay_dms = asrsync_get_dms_since_last_sync(&io.asrs);
+						ba_transport_pcm_delay_sync(t_pcm, BA_DBUS_PCM_UPDATE_DELAY);
+						io.initiated = true;
+					}
+
+					/* resend RTP headers */
+					len -= rtp_headers_len;
+
+					/* break if there is no more payload data */
+					if ((payload_len -= len) == 0)
+						break;
+
+					/* move the rest of data to the beginning of payload */
+					debug("LC3plus payload fragmentation: extra %zu bytes", payload_len);
+					memmove(rtp_payload, rtp_payload + len, payload_len);
+
+					rtp_media_header->first_fragment = 0;
+					rtp_media_header->last_fragment = payload_len <= payload_len_max;
+					rtp_media_header->frame_count--;
+
+				}
 
 			}
 
@@ -384,14 +504,14 @@ void *a2dp_lc3plus_enc_thread(struct ba_transport_pcm *t_pcm) {
 			/* move forward RTP timestamp clock */
 			rtp_state_update(&rtp, pcm_frames);
 
-			/* If the input buffer was not consumed (due to codesize limit), we
-			 * have to append new data to the existing one. Since we do not use
-			 * ring buffer, we will simply move unprocessed data to the front
-			 * of our linear buffer. */
-			ffb_shift(&pcm, pcm_frames * channels);
-
 		}
 
+		/* If the input buffer was not consumed (not enough data for the whole
+		 * RTP packet), we have to append new data to the existing one. Since
+		 * we do not use ring buffer, we will simply move unprocessed data to
+		 * the front of our linear buffer. */
+		ffb_shift(&pcm, input - (const int32_t *)pcm.data);
+
 	}
 
 fail:
@@ -528,7 +648,6 @@ void *a2dp_lc3plus_dec_thread(struct ba_transport_pcm *t_pcm) {
 			warn("Missing LC3plus data, loss concealment applied");
 
 			const size_t samples = lc3plus_frame_samples;
-			io_pcm_scale(t_pcm, pcm.data, samples);
 			if (io_pcm_write(t_pcm, pcm.data, samples) == -1)
 				error("PCM write error: %s", strerror(errno));
 
@@ -577,9 +696,11 @@ void *a2dp_lc3plus_dec_thread(struct ba_transport_pcm *t_pcm) {
 		while (lc3plus_frames--) {
 
 			void *scratch = NULL;
+			trace_event(BA_TRACE_EVENT_DECODE_BEGIN, lc3plus_frame_len, 0);
 			err = lc3plus_dec24(handle, lc3plus_payload, lc3plus_frame_len, pcm_ch_buffers, scratch, 0);
 			audio_interleave_s24_4le(pcm.data, (const int32_t **)pcm_ch_buffers,
 					channels, lc3plus_ch_samples);
+			trace_event(BA_TRACE_EVENT_DECODE_END, lc3plus_frame_samples, 0);
 
 			if (err == LC3PLUS_DECODE_ERROR)
 				warn("Corrupted LC3plus data, loss concealment applied");
@@ -591,7 +712,6 @@ void *a2dp_lc3plus_dec_thread(struct ba_transport_pcm *t_pcm) {
 			lc3plus_payload += lc3plus_frame_len;
 
 			const size_t samples = lc3plus_frame_samples;
-			io_pcm_scale(t_pcm, pcm.data, samples);
 			if (io_pcm_write(t_pcm, pcm.data, samples) == -1)
 				error("PCM write error: %s", strerror(errno));
 
@@ -630,12 +750,24 @@ static int a2dp_lc3plus_configuration_select(
 	/* Narrow capabilities to values supported by BlueALSA. */
 	a2dp_lc3plus_caps_intersect(caps, &sep->config.capabilities);
 
-	if (caps->frame_duration & LC3PLUS_FRAME_DURATION_100)
-		caps->frame_duration = LC3PLUS_FRAME_DURATION_100;
-	else if (caps->frame_duration & LC3PLUS_FRAME_DURATION_050)
-		caps->frame_duration = LC3PLUS_FRAME_DURATION_050;
-	else if (caps->frame_duration & LC3PLUS_FRAME_DURATION_025)
-		caps->frame_duration = LC3PLUS_FRAME_DURATION_025;
+	/* In the low-latency mode prefer the shortest frame duration, otherwise
+	 * prefer the longest one which gives better quality at given bitrate. */
+	static const uint8_t durations[] = {
+		LC3PLUS_FRAME_DURATION_100,
+		LC3PLUS_FRAME_DURATION_050,
+		LC3PLUS_FRAME_DURATION_025 };
+	uint8_t frame_duration = 0;
+	for (size_t i = 0; i < ARRAYSIZE(durations); i++) {
+		const uint8_t duration = durations[config.lc3plus_low_latency ?
+			ARRAYSIZE(durations) - 1 - i : i];
+		if (caps->frame_duration & duration) {
+			frame_duration = duration;
+			break;
+		}
+	}
+
+	if (frame_duration != 0)
+		caps->frame_duration = frame_duration;
 	else {
 		error("LC3plus: No supported frame durations: %#x", saved.frame_duration);
 		return errno = ENOTSUP, -1;
@@ -711,6 +843,9 @@ static int a2dp_lc3plus_transport_init(struct ba_transport *t) {
 	t->media.pcm.format = BA_TRANSPORT_PCM_FORMAT_S24_4LE;
 	t->media.pcm.channels = a2dp_lc3plus_channels[channels_i].value;
 	t->media.pcm.rate = a2dp_lc3plus_rates[rate_i].value;
+	/* initial encoder bitrate which might be changed via D-Bus */
+	if (t->profile == BA_TRANSPORT_PROFILE_A2DP_SOURCE)
+		t->media.pcm.bitrate = config.lc3plus_bitrate;
 
 	memcpy(t->media.pcm.channel_map, a2dp_lc3plus_channels[channels_i].ch.map,
 			t->media.pcm.channels * sizeof(*t->media.pcm.channel_map));
@@ -756,6 +891,7 @@ struct a2dp_sep a2dp_lc3plus_source = {
 	.transport_init = a2dp_lc3plus_transport_init,
 	.transport_start = a2dp_lc3plus_source_transport_start,
 	.caps_helpers = &a2dp_lc3plus_caps_helpers,
+	.libs = a2dp_lc3plus_libs,
 };
 
 static int a2dp_lc3plus_sink_transport_start(struct ba_transport *t) {
@@ -787,4 +923,5 @@ struct a2dp_sep a2dp_lc3plus_sink = {
 	.transport_init = a2dp_lc3plus_transport_init,
 	.transport_start = a2dp_lc3plus_sink_transport_start,
 	.caps_helpers = &a2dp_lc3plus_caps_helpers,
+	.libs = a2dp_lc3plus_libs,
 };
@@ -28,8 +28,10 @@
 #include "ba-transport-pcm.h"
 #include "ba-config.h"
 #include "bluealsa-dbus.h"
+#include "codec-lib.h"
 #include "io.h"
 #include "rtp.h"
+#include "trace.h"
 #include "utils.h"
 #include "shared/a2dp-codecs.h"
 #include "shared/defs.h"
@@ -37,6 +39,68 @@
 #include "shared/log.h"
 #include "shared/rt.h"
 
+#if HAVE_LDAC_DECODE
+
+#ifndef LDAC_DEC_SONAME
+# define LDAC_DEC_SONAME "libldacBT_dec.so.2"
+#endif
+
+#define LDAC_DEC_SYMBOLS(X) \
+	X(ldacBT_decode) \
+	X(ldacBT_free_handle) \
+	X(ldacBT_get_error_code) \
+	X(ldacBT_get_handle) \
+	X(ldacBT_init_handle_decode)
+
+CODEC_LIB_DEFINE(codec_lib_ldac_dec, "LDAC decoder", LDAC_DEC_SONAME, LDAC_DEC_SYMBOLS);
+
+#endif
+
+#ifndef LDAC_ENC_SONAME
+# define LDAC_ENC_SONAME "libldacBT_enc.so.2"
+#endif
+
+#define LDAC_ENC_SYMBOLS(X) \
+	X(ldacBT_encode) \
+	X(ldacBT_free_handle) \
+	X(ldacBT_get_error_code) \
+	X(ldacBT_get_handle) \
+	X(ldacBT_init_handle_encode)
+
+CODEC_LIB_DEFINE(codec_lib_ldac_enc, "LDAC encoder", LDAC_ENC_SONAME, LDAC_ENC_SYMBOLS);
+
+#if ENABLE_CODEC_DLOPEN
+# define ldacBT_encode CODEC_LIB_SYM(codec_lib_ldac_enc, ldacBT_encode)
+# define ldacBT_free_handle CODEC_LIB_SYM(codec_lib_ldac_enc, ldacBT_free_handle)
+# define ldacBT_get_error_code CODEC_LIB_SYM(codec_lib_ldac_enc, ldacBT_get_error_code)
+# define ldacBT_get_handle CODEC_LIB_SYM(codec_lib_ldac_enc, ldacBT_get_handle)
+# define ldacBT_init_handle_encode CODEC_LIB_SYM(codec_lib_ldac_enc, ldacBT_init_handle_encode)
+#endif
+
+#ifndef LDAC_ABR_SONAME
+# define LDAC_ABR_SONAME "libldacBT_abr.so.2"
+#endif
+
+#define LDAC_ABR_SYMBOLS(X) \
+	X(ldac_ABR_Init) \
+	X(ldac_ABR_Proc) \
+	X(ldac_ABR_free_handle) \
+	X(ldac_ABR_get_handle) \
+	X(ldac_ABR_set_thresholds)
+
+CODEC_LIB_DEFINE(codec_lib_ldac_abr, "LDAC ABR", LDAC_ABR_SONAME, LDAC_ABR_SYMBOLS);
+
+#if ENABLE_CODEC_DLOPEN
+# define ldac_ABR_Init CODEC_LIB_SYM(codec_lib_ldac_abr, ldac_ABR_Init)
+# define ldac_ABR_Proc CODEC_LIB_SYM(codec_lib_ldac_abr, ldac_ABR_Proc)
+# define ldac_ABR_free_handle CODEC_LIB_SYM(codec_lib_ldac_abr, ldac_ABR_free_handle)
+# define ldac_ABR_get_handle CODEC_LIB_SYM(codec_lib_ldac_abr, ldac_ABR_get_handle)
+# define ldac_ABR_set_thresholds CODEC_LIB_SYM(codec_lib_ldac_abr, ldac_ABR_set_thresholds)
+#endif
+
+static struct codec_lib * const a2dp_ldac_source_libs[] = {
+	&codec_lib_ldac_enc, &codec_lib_ldac_abr, NULL };
+
 static const struct a2dp_bit_mapping a2dp_ldac_channels[] = {
 	{ LDAC_CHANNEL_MODE_MONO, .ch = { 1, a2dp_channel_map_mono } },
 	{ LDAC_CHANNEL_MODE_DUAL, .ch = { 2, a2dp_channel_map_stereo } },
@@ -214,10 +278,12 @@ void *a2dp_ldac_enc_thread(struct ba_transport_pcm *t_pcm) {
 			int encoded;
 			int frames;
 
+			trace_event(BA_TRACE_EVENT_ENCODE_BEGIN, input_len, 0);
 			if (ldacBT_encode(handle, input, &used, bt.tail, &encoded, &frames) != 0) {
 				error("LDAC encoding error: %s", ldacBT_strerror(ldacBT_get_error_code(handle)));
 				break;
 			}
+			trace_event(BA_TRACE_EVENT_ENCODE_END, encoded, frames);
 
 			rtp_media_header->frame_count = frames;
 
@@ -294,6 +360,22 @@ fail_open_ldac:
 }
 
 #if HAVE_LDAC_DECODE
+
+#if ENABLE_CODEC_DLOPEN
+/* LDAC decoder library provides its own implementation
+ * of the LDAC handle management functions. */
+# define ldacBT_decode CODEC_LIB_SYM(codec_lib_ldac_dec, ldacBT_decode)
+# undef ldacBT_free_handle
+# define ldacBT_free_handle CODEC_LIB_SYM(codec_lib_ldac_dec, ldacBT_free_handle)
+# undef ldacBT_get_error_code
+# define ldacBT_get_error_code CODEC_LIB_SYM(codec_lib_ldac_dec, ldacBT_get_error_code)
+# undef ldacBT_get_handle
+# define ldacBT_get_handle CODEC_LIB_SYM(codec_lib_ldac_dec, ldacBT_get_handle)
+# define ldacBT_init_handle_decode CODEC_LIB_SYM(codec_lib_ldac_dec, ldacBT_init_handle_decode)
+#endif
+
+static struct codec_lib * const a2dp_ldac_sink_libs[] = { &codec_lib_ldac_dec, NULL };
+
 __attribute__ ((weak))
 void *a2dp_ldac_dec_thread(struct ba_transport_pcm *t_pcm) {
 
@@ -369,17 +451,18 @@ void *a2dp_ldac_dec_thread(struct ba_transport_pcm *t_pcm) {
 			int used;
 			int decoded;
 
+			trace_event(BA_TRACE_EVENT_DECODE_BEGIN, rtp_payload_len, 0);
 			if (ldacBT_decode(handle, (void *)rtp_payload, pcm.data,
 						LDACBT_SMPL_FMT_S32, rtp_payload_len, &used, &decoded) != 0) {
 				error("LDAC decoding error: %s", ldacBT_strerror(ldacBT_get_error_code(handle)));
 				break;
 			}
+			trace_event(BA_TRACE_EVENT_DECODE_END, decoded / sample_size, 0);
 
 			rtp_payload += used;
 			rtp_payload_len -= used;
 
 			const size_t samples = decoded / sample_size;
-			io_pcm_scale(t_pcm, pcm.data, samples);
 			if (io_pcm_write(t_pcm, pcm.data, samples) == -1)
 				error("PCM write error: %s", strerror(errno));
 
@@ -520,6 +603,7 @@ struct a2dp_sep a2dp_ldac_source = {
 	.transport_init = a2dp_ldac_transport_init,
 	.transport_start = a2dp_ldac_source_transport_start,
 	.caps_helpers = &a2dp_ldac_caps_helpers,
+	.libs = a2dp_ldac_source_libs,
 };
 
 #if HAVE_LDAC_DECODE
@@ -554,6 +638,7 @@ struct a2dp_sep a2dp_ldac_sink = {
 	.transport_init = a2dp_ldac_transport_init,
 	.transport_start = a2dp_ldac_sink_transport_start,
 	.caps_helpers = &a2dp_ldac_caps_helpers,
+	.libs = a2dp_ldac_sink_libs,
 };
 
 #endif
@@ -30,8 +30,10 @@
 #include "ba-transport-pcm.h"
 #include "ba-config.h"
 #include "bluealsa-dbus.h"
+#include "codec-lib.h"
 #include "io.h"
 #include "rtp.h"
+#include "trace.h"
 #include "utils.h"
 #include "shared/a2dp-codecs.h"
 #include "shared/defs.h"
@@ -39,6 +41,53 @@
 #include "shared/log.h"
 #include "shared/rt.h"
 
+#ifndef LHDC_ENC_SONAME
+# define LHDC_ENC_SONAME "liblhdcBT_enc.so.4"
+#endif
+
+#define LHDC_ENC_SYMBOLS(X) \
+	X(lhdcBT_adjust_bitrate) \
+	X(lhdcBT_encode_stereo) \
+	X(lhdcBT_free_handle) \
+	X(lhdcBT_get_block_Size) \
+	X(lhdcBT_get_handle) \
+	X(lhdcBT_init_encoder) \
+	X(lhdcBT_set_hasMinBitrateLimit) \
+	X(lhdcBT_set_max_bitrate)
+
+CODEC_LIB_DEFINE(codec_lib_lhdc_enc, "LHDC encoder", LHDC_ENC_SONAME, LHDC_ENC_SYMBOLS);
+
+#if ENABLE_CODEC_DLOPEN
+# define lhdcBT_adjust_bitrate CODEC_LIB_SYM(codec_lib_lhdc_enc, lhdcBT_adjust_bitrate)
+# define lhdcBT_encode_stereo CODEC_LIB_SYM(codec_lib_lhdc_enc, lhdcBT_encode_stereo)
+# define lhdcBT_free_handle CODEC_LIB_SYM(codec_lib_lhdc_enc, lhdcBT_free_handle)
+# define lhdcBT_get_block_Size CODEC_LIB_SYM(codec_lib_lhdc_enc, lhdcBT_get_block_Size)
+# define lhdcBT_get_handle CODEC_LIB_SYM(codec_lib_lhdc_enc, lhdcBT_get_handle)
+# define lhdcBT_init_encoder CODEC_LIB_SYM(codec_lib_lhdc_enc, lhdcBT_init_encoder)
+# define lhdcBT_set_hasMinBitrateLimit CODEC_LIB_SYM(codec_lib_lhdc_enc, lhdcBT_set_hasMinBitrateLimit)
+# define lhdcBT_set_max_bitrate CODEC_LIB_SYM(codec_lib_lhdc_enc, lhdcBT_set_max_bitrate)
+#endif
+
+#ifndef LHDC_DEC_SONAME
+# define LHDC_DEC_SONAME "liblhdcBT_dec.so.4"
+#endif
+
+#define LHDC_DEC_SYMBOLS(X) \
+	X(lhdcBT_dec_decode) \
+	X(lhdcBT_dec_deinit_decoder) \
+	X(lhdcBT_dec_init_decoder)
+
+CODEC_LIB_DEFINE(codec_lib_lhdc_dec, "LHDC decoder", LHDC_DEC_SONAME, LHDC_DEC_SYMBOLS);
+
+#if ENABLE_CODEC_DLOPEN
+# define lhdcBT_dec_decode CODEC_LIB_SYM(codec_lib_lhdc_dec, lhdcBT_dec_decode)
+# define lhdcBT_dec_deinit_decoder CODEC_LIB_SYM(codec_lib_lhdc_dec, lhdcBT_dec_deinit_decoder)
+# define lhdcBT_dec_init_decoder CODEC_LIB_SYM(codec_lib_lhdc_dec, lhdcBT_dec_init_decoder)
+#endif
+
+static struct codec_lib * const a2dp_lhdc_source_libs[] = { &codec_lib_lhdc_enc, NULL };
+static struct codec_lib * const a2dp_lhdc_sink_libs[] = { &codec_lib_lhdc_dec, NULL };
+
 static const struct a2dp_bit_mapping a2dp_lhdc_rates[] = {
 	{ LHDC_SAMPLING_FREQ_44100, { 44100 } },
 	{ LHDC_SAMPLING_FREQ_48000, { 48000 } },
@@ -337,10 +386,12 @@ void *a2dp_lhdc_enc_thread(struct ba_transport_pcm *t_pcm) {
 			uint32_t frames;
 
 			int rv;
+			trace_event(BA_TRACE_EVENT_ENCODE_BEGIN, input_len, 0);
 			if ((rv = lhdcBT_encode_stereo(handle, pcm_ch1, pcm_ch2, bt.tail, &encoded, &frames)) < 0) {
 				error("LHDC encoding error: %d", rv);
 				break;
 			}
+			trace_event(BA_TRACE_EVENT_ENCODE_END, encoded, frames);
 
 			input += lhdc_pcm_samples;
 			input_len -= lhdc_pcm_samples;
@@ -495,18 +546,19 @@ void *a2dp_lhdc_dec_thread(struct ba_transport_pcm *t_pcm) {
 
 		int rv;
 		uint32_t decoded = ffb_blen_in(&pcm);
+		trace_event(BA_TRACE_EVENT_DECODE_BEGIN, rtp_payload_len, 0);
 		if ((rv = lhdcBT_dec_decode(rtp_payload, rtp_payload_len, pcm.data, &decoded, 24)) != 0) {
 			error("LHDC decoding error: %s", lhdcBT_dec_strerror(rv));
 			continue;
 		}
 
 		const size_t samples = decoded / sample_size;
+		trace_event(BA_TRACE_EVENT_DECODE_END, samples, 0);
 
 		/* Upscale decoded 24-bit PCM samples to 32-bit. */
 		for (size_t i = 0; i < samples; i++)
 			((int32_t *)pcm.data)[i] <<= 8;
 
-		io_pcm_scale(t_pcm, pcm.data, samples);
 		if (io_pcm_write(t_pcm, pcm.data, samples) == -1)
 			error("PCM write error: %s", strerror(errno));
 
@@ -760,6 +812,7 @@ struct a2dp_sep a2dp_lhdc_v2_source = {
 	.transport_init = a2dp_lhdc_transport_init,
 	.transport_start = a2dp_lhdc_source_transport_start,
 	.caps_helpers = &a2dp_lhdc_v2_caps_helpers,
+	.libs = a2dp_lhdc_source_libs,
 };
 
 struct a2dp_sep a2dp_lhdc_v2_sink = {
@@ -786,6 +839,7 @@ struct a2dp_sep a2dp_lhdc_v2_sink = {
 	.transport_init = a2dp_lhdc_transport_init,
 	.transport_start = a2dp_lhdc_sink_transport_start,
 	.caps_helpers = &a2dp_lhdc_v2_caps_helpers,
+	.libs = a2dp_lhdc_sink_libs,
 };
 
 struct a2dp_sep a2dp_lhdc_v3_source = {
@@ -817,6 +871,7 @@ struct a2dp_sep a2dp_lhdc_v3_source = {
 	.transport_init = a2dp_lhdc_transport_init,
 	.transport_start = a2dp_lhdc_source_transport_start,
 	.caps_helpers = &a2dp_lhdc_v3_caps_helpers,
+	.libs = a2dp_lhdc_source_libs,
 };
 
 struct a2dp_sep a2dp_lhdc_v3_sink = {
@@ -847,6 +902,7 @@ struct a2dp_sep a2dp_lhdc_v3_sink = {
 	.transport_init = a2dp_lhdc_transport_init,
 	.transport_start = a2dp_lhdc_sink_transport_start,
 	.caps_helpers = &a2dp_lhdc_v3_caps_helpers,
+	.libs = a2dp_lhdc_sink_libs,
 };
 
 struct a2dp_sep a2dp_lhdc_v5_source = {
@@ -875,6 +931,7 @@ struct a2dp_sep a2dp_lhdc_v5_source = {
 	.transport_init = a2dp_lhdc_transport_init,
 	.transport_start = a2dp_lhdc_source_transport_start,
 	.caps_helpers = &a2dp_lhdc_v5_caps_helpers,
+	.libs = a2dp_lhdc_source_libs,
 };
 
 struct a2dp_sep a2dp_lhdc_v5_sink = {
@@ -902,4 +959,5 @@ struct a2dp_sep a2dp_lhdc_v5_sink = {
 	.transport_init = a2dp_lhdc_transport_init,
 	.transport_start = a2dp_lhdc_sink_transport_start,
 	.caps_helpers = &a2dp_lhdc_v5_caps_helpers,
+	.libs = a2dp_lhdc_sink_libs,
 };
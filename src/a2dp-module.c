@@ -0,0 +1,620 @@
+/*
+ * BlueALSA - a2dp-module.c
+ * Copyright (c) 2016-2025 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include "a2dp-module.h"
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <dirent.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "a2dp.h"
+#include "ba-config.h"
+#include "ba-transport.h"
+#include "ba-transport-pcm.h"
+#include "bluealsa-codec.h"
+#include "bluealsa-dbus.h"
+#include "io.h"
+#include "rtp.h"
+#include "trace.h"
+#include "shared/a2dp-codecs.h"
+#include "shared/defs.h"
+#include "shared/ffb.h"
+#include "shared/log.h"
+#include "shared/rt.h"
+
+/**
+ * Size of the module structure defined by the ABI version 1.0. */
+#define A2DP_MODULE_SIZE_V1_0 \
+	(offsetof(struct bluealsa_codec_module, set_bitrate) + \
+	 sizeof(((struct bluealsa_codec_module *)0)->set_bitrate))
+
+/**
+ * Check whether the module provides given optional callback. Callbacks which
+ * were appended by a newer minor ABI version are not available in modules
+ * built against an older version of the ABI. */
+#define A2DP_MODULE_HAS(module, cb) \
+	((module)->size >= offsetof(struct bluealsa_codec_module, cb) + \
+	 sizeof((module)->cb) && (module)->cb != NULL)
+
+/**
+ * Codec instance created by the external module. */
+struct a2dp_module_codec {
+	const struct bluealsa_codec_module *module;
+	struct bluealsa_codec_params params;
+	struct bluealsa_codec_info info;
+	enum bluealsa_codec_direction direction;
+	/* encoder bit rate or 0 if not set */
+	unsigned int bitrate;
+	void *ctx;
+};
+
+/* handles of all loaded modules */
+static GPtrArray *a2dp_modules_handles = NULL;
+
+/**
+ * Load A2DP codec module.
+ *
+ * @param path Path to the shared library with the codec module.
+ * @return On success, this function returns the codec module definition.
+ *   On failure, NULL is returned and the errno is set to indicate the
+ *   error. The loaded module is kept in memory until the call to the
+ *   a2dp_modules_unload() function. */
+const struct bluealsa_codec_module *a2dp_module_load(const char *path) {
+
+	void *handle;
+	if ((handle = dlopen(path, RTLD_NOW | RTLD_LOCAL)) == NULL) {
+		error("Couldn't load codec module: %s", dlerror());
+		return errno = ENOENT, NULL;
+	}
+
+	const struct bluealsa_codec_module *module;
+	if ((module = dlsym(handle, BLUEALSA_CODEC_MODULE_SYMBOL)) == NULL) {
+		error("Invalid codec module: %s: Missing %s symbol",
+				path, BLUEALSA_CODEC_MODULE_SYMBOL);
+		errno = ENOEXEC;
+		goto fail;
+	}
+
+	if (module->abi_version >> 16 != BLUEALSA_CODEC_ABI_VERSION_MAJOR) {
+		error("Unsupported codec module ABI version: %s: %u.%u != %u.%u", path,
+				module->abi_version >> 16, module->abi_version & 0xFFFF,
+				BLUEALSA_CODEC_ABI_VERSION_MAJOR, BLUEALSA_CODEC_ABI_VERSION_MINOR);
+		errno = ENOEXEC;
+		goto fail;
+	}
+
+	/* Minor ABI updates might only append new fields, so the module built
+	 * against an older minor version has to be at least as big as the first
+	 * version of this structure. */
+	if (module->size < A2DP_MODULE_SIZE_V1_0 ||
+			module->name == NULL ||
+			module->init == NULL ||
+			module->free == NULL ||
+			(module->directions & BLUEALSA_CODEC_ENCODER && module->encode_batch == NULL) ||
+			(module->directions & BLUEALSA_CODEC_DECODER && module->decode_batch == NULL)) {
+		error("Invalid codec module: %s: Incomplete module definition", path);
+		errno = ENOEXEC;
+		goto fail;
+	}
+
+	if (a2dp_modules_handles == NULL)
+		a2dp_modules_handles = g_ptr_array_new();
+	g_ptr_array_add(a2dp_modules_handles, handle);
+
+	debug("Loaded codec module: %s: %s [ABI %u.%u]", path, module->name,
+			module->abi_version >> 16, module->abi_version & 0xFFFF);
+	return module;
+
+fail:
+	dlclose(handle);
+	return NULL;
+}
+
+static int a2dp_module_transport_start(struct ba_transport *t) {
+	if (t->profile & BA_TRANSPORT_PROFILE_A2DP_SOURCE)
+		return ba_transport_pcm_start(&t->media.pcm, a2dp_module_enc_thread, "ba-a2dp-mod");
+	return ba_transport_pcm_start(&t->media.pcm, a2dp_module_dec_thread, "ba-a2dp-mod");
+}
+
+/**
+ * Attach codec module to the A2DP Stream End-Point.
+ *
+ * @param sep The A2DP SEP which shall use codec module.
+ * @param module The codec module definition.
+ * @return On success, this function returns 0. If the codec module does not
+ *   match the SEP codec or direction, -1 is returned and errno is set to
+ *   EINVAL. */
+int a2dp_module_attach(struct a2dp_sep *sep, const struct bluealsa_codec_module *module) {
+
+	const unsigned int direction = sep->config.type == A2DP_SOURCE ?
+		BLUEALSA_CODEC_ENCODER : BLUEALSA_CODEC_DECODER;
+
+	if (sep->config.codec_id != module->codec_id ||
+			!(module->directions & direction))
+		return errno = EINVAL, -1;
+
+	if (sep->module != NULL)
+		warn("Replacing codec module for %s: %s -> %s",
+				sep->name, sep->module->name, module->name);
+
+	debug("Using codec module for %s: %s", sep->name, module->name);
+	sep->transport_start = a2dp_module_transport_start;
+	sep->module = module;
+
+	return 0;
+}
+
+/**
+ * Load all A2DP codec modules from the given directory.
+ *
+ * Every loaded module is attached to all available A2DP SEPs with the
+ * matching codec ID and direction.
+ *
+ * @param dir Directory with codec modules.
+ * @return On success, this function returns the number of loaded modules.
+ *   On failure, -1 is returned and errno is set to indicate the error. */
+int a2dp_modules_load(const char *dir) {
+
+	DIR *d;
+	if ((d = opendir(dir)) == NULL)
+		return -1;
+
+	struct dirent *entry;
+	int count = 0;
+
+	while ((entry = readdir(d)) != NULL) {
+
+		if (!g_str_has_suffix(entry->d_name, ".so"))
+			continue;
+
+		char path[PATH_MAX];
+		snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+
+		const struct bluealsa_codec_module *module;
+		if ((module = a2dp_module_load(path)) == NULL)
+			continue;
+
+		bool attached = false;
+		for (size_t i = 0; a2dp_seps[i] != NULL; i++)
+			if (a2dp_module_attach(a2dp_seps[i], module) == 0)
+				attached = true;
+
+		if (!attached)
+			warn("Codec module without matching A2DP SEP: %s", module->name);
+
+		count++;
+	}
+
+	closedir(d);
+	return count;
+}
+
+/**
+ * Unload all A2DP codec modules.
+ *
+ * Attached A2DP SEPs are not restored, so this function shall be called
+ * only at the very end, when no transport exists anymore. */
+void a2dp_modules_unload(void) {
+
+	if (a2dp_modules_handles == NULL)
+		return;
+
+	for (size_t i = 0; i < a2dp_modules_handles->len; i++)
+		dlclose(g_ptr_array_index(a2dp_modules_handles, i));
+
+	g_ptr_array_free(a2dp_modules_handles, TRUE);
+	a2dp_modules_handles = NULL;
+
+}
+
+static int a2dp_module_codec_set_bitrate(
+		struct a2dp_module_codec *codec,
+		unsigned int bitrate) {
+
+	if (!A2DP_MODULE_HAS(codec->module, set_bitrate))
+		return errno = ENOTSUP, -1;
+
+	int err;
+	if ((err = codec->module->set_bitrate(codec->ctx, bitrate)) < 0)
+		return errno = -err, -1;
+
+	codec->bitrate = bitrate;
+	return 0;
+}
+
+static int a2dp_module_codec_init(
+		struct a2dp_module_codec *codec,
+		const struct ba_transport_pcm *t_pcm,
+		enum bluealsa_codec_direction direction,
+		size_t payload_size) {
+
+	const struct ba_transport *t = t_pcm->t;
+	const struct a2dp_sep *sep = t->media.sep;
+
+	codec->module = sep->module;
+	codec->direction = direction;
+	codec->params.codec_id = sep->config.codec_id;
+	codec->params.configuration = &t->media.configuration;
+	codec->params.configuration_size = sep->config.caps_size;
+	codec->params.channels = t_pcm->channels;
+	codec->params.rate = t_pcm->rate;
+	codec->params.sample_size = BA_TRANSPORT_PCM_FORMAT_BYTES(t_pcm->format);
+	codec->params.sample_bits = BA_TRANSPORT_PCM_FORMAT_WIDTH(t_pcm->format);
+	codec->params.payload_size = payload_size;
+
+	memset(&codec->info, 0, sizeof(codec->info));
+	if ((codec->ctx = codec->module->init(&codec->params, direction, &codec->info)) == NULL)
+		return -1;
+
+	if (codec->info.block_samples == 0) {
+		error("Invalid %s codec block size", codec->module->name);
+		codec->module->free(codec->ctx);
+		codec->ctx = NULL;
+		return errno = EINVAL, -1;
+	}
+
+	/* Use per-device bit rate if the PCM provides one. */
+	unsigned int bitrate = t_pcm->bitrate;
+	if (bitrate == 0)
+		switch (codec->params.codec_id) {
+#if ENABLE_AAC
+		case A2DP_CODEC_MPEG24:
+			bitrate = config.aac_bitrate;
+			break;
+#endif
+#if ENABLE_LC3PLUS
+		case A2DP_CODEC_VENDOR_ID(LC3PLUS_VENDOR_ID, LC3PLUS_CODEC_ID):
+			bitrate = config.lc3plus_bitrate;
+			break;
+#endif
+		}
+
+	codec->bitrate = 0;
+	if (direction == BLUEALSA_CODEC_ENCODER && bitrate != 0 &&
+			a2dp_module_codec_set_bitrate(codec, bitrate) == -1)
+		warn("Couldn't set %s encoder bit rate: %s", codec->module->name, strerror(errno));
+
+	return 0;
+}
+
+static void a2dp_module_codec_free(struct a2dp_module_codec *codec) {
+	if (codec->ctx != NULL)
+		codec->module->free(codec->ctx);
+	codec->ctx = NULL;
+}
+
+static int a2dp_module_codec_reinit(struct a2dp_module_codec *codec,
+		const struct ba_transport_pcm *t_pcm) {
+	a2dp_module_codec_free(codec);
+	return a2dp_module_codec_init(codec, t_pcm, codec->direction,
+			codec->params.payload_size);
+}
+
+static unsigned int a2dp_module_codec_get_delay_dms(const struct a2dp_module_codec *codec) {
+	if (codec->module->get_delay == NULL)
+		return 0;
+	return codec->module->get_delay(codec->ctx) * 10000 / codec->params.rate;
+}
+
+void *a2dp_module_enc_thread(struct ba_transport_pcm *t_pcm) {
+
+	/* Cancellation should be possible only in the carefully selected place
+	 * in order to prevent memory leaks and resources not being released. */
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	pthread_cleanup_push(PTHREAD_CLEANUP(ba_transport_pcm_thread_cleanup), t_pcm);
+
+	struct ba_transport *t = t_pcm->t;
+	struct io_poll io = { .timeout = -1 };
+
+	const struct bluealsa_codec_module *module = t->media.sep->module;
+	const bool media_header = module->flags & BLUEALSA_CODEC_FLAG_RTP_MEDIA_HEADER;
+	const size_t rtp_headers_len = RTP_HEADER_LEN +
+		(media_header ? sizeof(rtp_media_header_t) : 0);
+
+	if (t->mtu_write <= rtp_headers_len) {
+		error("Writing MTU too small for RTP headers: %zu <= %zu",
+				t->mtu_write, rtp_headers_len);
+		goto fail_init;
+	}
+
+	struct a2dp_module_codec codec = { 0 };
+	if (a2dp_module_codec_init(&codec, t_pcm, BLUEALSA_CODEC_ENCODER,
+				t->mtu_write - rtp_headers_len) == -1) {
+		error("Couldn't initialize %s codec: %s", module->name, strerror(errno));
+		goto fail_init;
+	}
+
+	ffb_t bt = { 0 };
+	ffb_t pcm = { 0 };
+	pthread_cleanup_push(PTHREAD_CLEANUP(a2dp_module_codec_free), &codec);
+	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &bt);
+	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &pcm);
+
+	const unsigned int channels = t_pcm->channels;
+	const unsigned int rate = t_pcm->rate;
+
+	size_t ffb_pcm_len = codec.info.block_samples;
+	if (codec.info.frame_size > 0) {
+		/* account for possible codec frames packing */
+		size_t frames = codec.params.payload_size / codec.info.frame_size;
+		ffb_pcm_len *= MAX(1, MIN(frames, BLUEALSA_CODEC_RTP_FRAMES_MAX));
+	}
+
+	if (ffb_init(&pcm, ffb_pcm_len, codec.params.sample_size) == -1 ||
+			ffb_init_uint8_t(&bt, t->mtu_write) == -1) {
+		error("Couldn't create data buffers: %s", strerror(errno));
+		goto fail_ffb;
+	}
+
+	/* Get the total delay introduced by the codec. */
+	t_pcm->codec_delay_dms = a2dp_module_codec_get_delay_dms(&codec);
+	ba_transport_pcm_delay_sync(t_pcm, BA_DBUS_PCM_UPDATE_DELAY);
+
+	rtp_header_t *rtp_header;
+	rtp_media_header_t *rtp_media_header = NULL;
+
+	/* initialize RTP headers and get anchor for payload */
+	uint8_t *rtp_payload = rtp_a2dp_init(bt.data, &rtp_header,
+			media_header ? (void **)&rtp_media_header : NULL,
+			media_header ? sizeof(*rtp_media_header) : 0);
+
+	struct rtp_state rtp = { .synced = false };
+	rtp_state_init(&rtp, rate, module->rtp_clock_rate != 0 ? module->rtp_clock_rate : rate);
+
+	debug_transport_pcm_thread_loop(t_pcm, "START");
+	for (ba_transport_pcm_state_set_running(t_pcm);;) {
+
+		switch (io_poll_and_read_pcm(&io, t_pcm, &pcm)) {
+		case -1:
+			if (errno == ESTALE) {
+				if (a2dp_module_codec_reinit(&codec, t_pcm) == -1) {
+					error("Couldn't reinitialize %s codec: %s", module->name, strerror(errno));
+					goto fail;
+				}
+				continue;
+			}
+			error("PCM poll and read error: %s", strerror(errno));
+			/* fall-through */
+		case 0:
+			ba_transport_stop_if_no_clients(t);
+			continue;
+		}
+
+		/* Apply the bit rate requested via the D-Bus API. */
+		const unsigned int bitrate = atomic_exchange_explicit(
+				&t_pcm->bitrate_request, 0, memory_order_relaxed);
+		if (bitrate != 0 && bitrate != codec.bitrate) {
+			const unsigned int bitrate_prev = codec.bitrate;
+			if (a2dp_module_codec_set_bitrate(&codec, bitrate) == -1)
+				error("Couldn't set %s bitrate: %u: %s", module->name, bitrate, strerror(errno));
+			else {
+				debug("%s bitrate: %u -> %u", module->name, bitrate_prev, bitrate);
+				/* publish the bit rate accepted by the encoder */
+				t_pcm->bitrate = bitrate;
+				bluealsa_dbus_pcm_update(t_pcm, BA_DBUS_PCM_UPDATE_BITRATE);
+			}
+		}
+
+		/* anchor for RTP payload */
+		bt.tail = rtp_payload;
+
+		unsigned int frames = BLUEALSA_CODEC_RTP_FRAMES_MAX;
+		size_t samples = 0;
+		ssize_t len;
+
+		trace_event(BA_TRACE_EVENT_ENCODE_BEGIN, ffb_len_out(&pcm), 0);
+		if ((len = module->encode_batch(codec.ctx, pcm.data, ffb_len_out(&pcm),
+						&samples, bt.tail, ffb_len_in(&bt), &frames)) < 0) {
+			error("%s encoding error: %s", module->name, strerror(-len));
+			ffb_rewind(&pcm);
+			continue;
+		}
+		trace_event(BA_TRACE_EVENT_ENCODE_END, len, len > 0 ? frames : 0);
+
+		const size_t pcm_frames = samples / channels;
+
+		if (len > 0) {
+
+			ffb_seek(&bt, len);
+
+			rtp_state_new_frame(&rtp, rtp_header);
+			if (rtp_media_header != NULL)
+				rtp_media_header->frame_count = frames;
+
+			if ((len = io_bt_write(t_pcm, bt.data, ffb_blen_out(&bt))) <= 0) {
+				if (len == -1)
+					error("BT write error: %s", strerror(errno));
+				goto fail;
+			}
+
+			if (!io.initiated) {
+				/* Get the codec processing delay, which is a time spent in the
+				 * processing loop between reading PCM data and writing the first
+				 * encoded frame. */
+				t_pcm->processing_delay_dms = asrsync_get_dms_since_last_sync(&io.asrs);
+				ba_transport_pcm_delay_sync(t_pcm, BA_DBUS_PCM_UPDATE_DELAY);
+				io.initiated = true;
+			}
+
+		}
+
+		if (pcm_frames > 0) {
+			/* Keep data transfer at a constant bit rate. */
+			asrsync_sync(&io.asrs, pcm_frames);
+			/* move forward RTP timestamp clock */
+			rtp_state_update(&rtp, pcm_frames);
+			/* move unprocessed data to the front of our linear buffer */
+			ffb_shift(&pcm, samples);
+		}
+		else if (ffb_len_in(&pcm) == 0) {
+			/* The codec did not consume any samples even though the buffer
+			 * is full. Without dropping the data we would loop forever. */
+			error("%s encoder stalled: Dropping PCM data", module->name);
+			ffb_rewind(&pcm);
+		}
+
+	}
+
+fail:
+	debug_transport_pcm_thread_loop(t_pcm, "EXIT");
+fail_ffb:
+	pthread_cleanup_pop(1);
+	pthread_cleanup_pop(1);
+	pthread_cleanup_pop(1);
+fail_init:
+	pthread_cleanup_pop(1);
+	return NULL;
+}
+
+void *a2dp_module_dec_thread(struct ba_transport_pcm *t_pcm) {
+
+	/* Cancellation should be possible only in the carefully selected place
+	 * in order to prevent memory leaks and resources not being released. */
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	pthread_cleanup_push(PTHREAD_CLEANUP(ba_transport_pcm_thread_cleanup), t_pcm);
+
+	struct ba_transport *t = t_pcm->t;
+	struct io_poll io = { .timeout = -1 };
+
+	const struct bluealsa_codec_module *module = t->media.sep->module;
+	const bool media_header = module->flags & BLUEALSA_CODEC_FLAG_RTP_MEDIA_HEADER;
+
+	struct a2dp_module_codec codec = { 0 };
+	if (a2dp_module_codec_init(&codec, t_pcm, BLUEALSA_CODEC_DECODER,
+				t->mtu_read) == -1) {
+		error("Couldn't initialize %s codec: %s", module->name, strerror(errno));
+		goto fail_init;
+	}
+
+	ffb_t bt = { 0 };
+	ffb_t pcm = { 0 };
+	pthread_cleanup_push(PTHREAD_CLEANUP(a2dp_module_codec_free), &codec);
+	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &bt);
+	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &pcm);
+
+	const unsigned int channels = t_pcm->channels;
+	const unsigned int rate = t_pcm->rate;
+	const bool conceal = A2DP_MODULE_HAS(module, conceal);
+
+	const size_t ffb_pcm_len = codec.info.block_samples *
+		(media_header ? BLUEALSA_CODEC_RTP_FRAMES_MAX : 1);
+	if (ffb_init(&pcm, ffb_pcm_len, codec.params.sample_size) == -1 ||
+			ffb_init_uint8_t(&bt, t->mtu_read) == -1) {
+		error("Couldn't create data buffers: %s", strerror(errno));
+		goto fail_ffb;
+	}
+
+	/* Get the total delay introduced by the codec. */
+	t_pcm->codec_delay_dms = a2dp_module_codec_get_delay_dms(&codec);
+	ba_transport_pcm_delay_sync(t_pcm, BA_DBUS_PCM_UPDATE_DELAY);
+
+	struct rtp_state rtp = { .synced = false };
+	rtp_state_init(&rtp, rate, module->rtp_clock_rate != 0 ? module->rtp_clock_rate : rate);
+
+	debug_transport_pcm_thread_loop(t_pcm, "START");
+	for (ba_transport_pcm_state_set_running(t_pcm);;) {
+
+		ssize_t len;
+		ffb_rewind(&bt);
+		if ((len = io_poll_and_read_bt(&io, t_pcm, &bt)) <= 0) {
+			if (len == -1)
+				error("BT poll and read error: %s", strerror(errno));
+			goto fail;
+		}
+
+		const rtp_header_t *rtp_header = bt.data;
+		const uint8_t *rtp_payload;
+		if ((rtp_payload = rtp_a2dp_get_payload(rtp_header)) == NULL)
+			continue;
+
+		int missing_pcm_frames = 0;
+		rtp_state_sync_stream(&rtp, rtp_header, NULL, &missing_pcm_frames);
+
+		if (!ba_transport_pcm_is_active(t_pcm)) {
+			rtp.synced = false;
+			continue;
+		}
+
+		if (missing_pcm_frames > 0 && conceal)
+			warn("Missing %s data, loss concealment applied", module->name);
+
+		/* Let the codec module generate audio for lost packets. Concealed
+		 * frames are already accounted for by the RTP stream sync. */
+		while (missing_pcm_frames > 0 && conceal) {
+
+			const size_t missing = MIN(missing_pcm_frames * channels, ffb_len_in(&pcm));
+
+			ssize_t samples;
+			if ((samples = module->conceal(codec.ctx, pcm.data, missing)) <= 0) {
+				if (samples < 0)
+					error("%s loss concealment error: %s", module->name, strerror(-samples));
+				break;
+			}
+
+			if (io_pcm_write(t_pcm, pcm.data, samples) == -1)
+				error("PCM write error: %s", strerror(errno));
+
+			missing_pcm_frames -= samples / channels;
+
+		}
+
+		unsigned int frames = 1;
+		if (media_header) {
+			const rtp_media_header_t *rtp_media_header = (void *)rtp_payload;
+			frames = rtp_media_header->frame_count;
+			rtp_payload += sizeof(*rtp_media_header);
+		}
+
+		if (rtp_payload - (uint8_t *)bt.data > len)
+			continue;
+		const size_t rtp_payload_len = len - (rtp_payload - (uint8_t *)bt.data);
+
+		ssize_t samples;
+		trace_event(BA_TRACE_EVENT_DECODE_BEGIN, rtp_payload_len, 0);
+		if ((samples = module->decode_batch(codec.ctx, rtp_payload, rtp_payload_len,
+						frames, pcm.data, ffb_len_in(&pcm))) < 0) {
+			error("%s decoding error: %s", module->name, strerror(-samples));
+			continue;
+		}
+		trace_event(BA_TRACE_EVENT_DECODE_END, samples, 0);
+
+		if (io_pcm_write(t_pcm, pcm.data, samples) == -1)
+			error("PCM write error: %s", strerror(errno));
+
+		/* update local state with decoded PCM frames */
+		rtp_state_update(&rtp, samples / channels);
+
+	}
+
+fail:
+	debug_transport_pcm_thread_loop(t_pcm, "EXIT");
+fail_ffb:
+	pthread_cleanup_pop(1);
+	pthread_cleanup_pop(1);
+	pthread_cleanup_pop(1);
+fail_init:
+	pthread_cleanup_pop(1);
+	return NULL;
+}
@@ -0,0 +1,37 @@
+/*
+ * BlueALSA - a2dp-module.h
+ * Copyright (c) 2016-2025 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#pragma once
+#ifndef BLUEALSA_A2DPMODULE_H_
+#define BLUEALSA_A2DPMODULE_H_
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "a2dp.h"
+#include "ba-transport-pcm.h"
+#include "bluealsa-codec.h"
+
+const struct bluealsa_codec_module *a2dp_module_load(
+		const char *path);
+
+int a2dp_module_attach(
+		struct a2dp_sep *sep,
+		const struct bluealsa_codec_module *module);
+
+int a2dp_modules_load(
+		const char *dir);
+void a2dp_modules_unload(void);
+
+void *a2dp_module_enc_thread(struct ba_transport_pcm *t_pcm);
+void *a2dp_module_dec_thread(struct ba_transport_pcm *t_pcm);
+
+#endif
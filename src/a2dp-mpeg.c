@@ -36,8 +36,10 @@
 #include "ba-transport.h"
 #include "ba-transport-pcm.h"
 #include "bluealsa-dbus.h"
+#include "codec-lib.h"
 #include "io.h"
 #include "rtp.h"
+#include "trace.h"
 #include "utils.h"
 #include "shared/a2dp-codecs.h"
 #include "shared/defs.h"
@@ -45,6 +47,107 @@
 #include "shared/log.h"
 #include "shared/rt.h"
 
+#if ENABLE_MP3LAME
+
+#ifndef LAME_SONAME
+# define LAME_SONAME "libmp3lame.so.0"
+#endif
+
+#if ENABLE_MPG123
+# define LAME_DECODER_SYMBOLS(X)
+#else
+# define LAME_DECODER_SYMBOLS(X) \
+	X(hip_decode) \
+	X(hip_decode_exit) \
+	X(hip_decode_init)
+#endif
+
+#define LAME_SYMBOLS(X) \
+	LAME_DECODER_SYMBOLS(X) \
+	X(lame_close) \
+	X(lame_encode_buffer) \
+	X(lame_encode_buffer_interleaved) \
+	X(lame_encode_flush) \
+	X(lame_get_encoder_delay) \
+	X(lame_get_framesize) \
+	X(lame_init) \
+	X(lame_init_params) \
+	X(lame_set_VBR) \
+	X(lame_set_VBR_q) \
+	X(lame_set_bWriteVbrTag) \
+	X(lame_set_brate) \
+	X(lame_set_error_protection) \
+	X(lame_set_free_format) \
+	X(lame_set_in_samplerate) \
+	X(lame_set_mode) \
+	X(lame_set_num_channels) \
+	X(lame_set_quality)
+
+CODEC_LIB_DEFINE(codec_lib_lame, "LAME", LAME_SONAME, LAME_SYMBOLS);
+
+#if ENABLE_CODEC_DLOPEN
+# define hip_decode CODEC_LIB_SYM(codec_lib_lame, hip_decode)
+# define hip_decode_exit CODEC_LIB_SYM(codec_lib_lame, hip_decode_exit)
+# define hip_decode_init CODEC_LIB_SYM(codec_lib_lame, hip_decode_init)
+# define lame_close CODEC_LIB_SYM(codec_lib_lame, lame_close)
+# define lame_encode_buffer CODEC_LIB_SYM(codec_lib_lame, lame_encode_buffer)
+# define lame_encode_buffer_interleaved CODEC_LIB_SYM(codec_lib_lame, lame_encode_buffer_interleaved)
+# define lame_encode_flush CODEC_LIB_SYM(codec_lib_lame, lame_encode_flush)
+# define lame_get_encoder_delay CODEC_LIB_SYM(codec_lib_lame, lame_get_encoder_delay)
+# define lame_get_framesize CODEC_LIB_SYM(codec_lib_lame, lame_get_framesize)
+# define lame_init CODEC_LIB_SYM(codec_lib_lame, lame_init)
+# define lame_init_params CODEC_LIB_SYM(codec_lib_lame, lame_init_params)
+# define lame_set_VBR CODEC_LIB_SYM(codec_lib_lame, lame_set_VBR)
+# define lame_set_VBR_q CODEC_LIB_SYM(codec_lib_lame, lame_set_VBR_q)
+# define lame_set_bWriteVbrTag CODEC_LIB_SYM(codec_lib_lame, lame_set_bWriteVbrTag)
+# define lame_set_brate CODEC_LIB_SYM(codec_lib_lame, lame_set_brate)
+# define lame_set_error_protection CODEC_LIB_SYM(codec_lib_lame, lame_set_error_protection)
+# define lame_set_free_format CODEC_LIB_SYM(codec_lib_lame, lame_set_free_format)
+# define lame_set_in_samplerate CODEC_LIB_SYM(codec_lib_lame, lame_set_in_samplerate)
+# define lame_set_mode CODEC_LIB_SYM(codec_lib_lame, lame_set_mode)
+# define lame_set_num_channels CODEC_LIB_SYM(codec_lib_lame, lame_set_num_channels)
+# define lame_set_quality CODEC_LIB_SYM(codec_lib_lame, lame_set_quality)
+#endif
+
+#endif
+
+#if ENABLE_MPG123
+
+#ifndef MPG123_SONAME
+# define MPG123_SONAME "libmpg123.so.0"
+#endif
+
+#define MPG123_SYMBOLS(X) \
+	X(mpg123_decode) \
+	X(mpg123_delete) \
+	X(mpg123_format) \
+	X(mpg123_format_none) \
+	X(mpg123_getformat) \
+	X(mpg123_init) \
+	X(mpg123_new) \
+	X(mpg123_open_feed) \
+	X(mpg123_param) \
+	X(mpg123_plain_strerror) \
+	X(mpg123_strerror)
+
+CODEC_LIB_DEFINE(codec_lib_mpg123, "MPG123", MPG123_SONAME, MPG123_SYMBOLS);
+
+#if ENABLE_CODEC_DLOPEN
+# define mpg123_decode CODEC_LIB_SYM(codec_lib_mpg123, mpg123_decode)
+# define mpg123_delete CODEC_LIB_SYM(codec_lib_mpg123, mpg123_delete)
+# define mpg123_format CODEC_LIB_SYM(codec_lib_mpg123, mpg123_format)
+# define mpg123_format_none CODEC_LIB_SYM(codec_lib_mpg123, mpg123_format_none)
+# define mpg123_getformat CODEC_LIB_SYM(codec_lib_mpg123, mpg123_getformat)
+# define mpg123_init CODEC_LIB_SYM(codec_lib_mpg123, mpg123_init)
+# define mpg123_new CODEC_LIB_SYM(codec_lib_mpg123, mpg123_new)
+# define mpg123_open_feed CODEC_LIB_SYM(codec_lib_mpg123, mpg123_open_feed)
+# define mpg123_param CODEC_LIB_SYM(codec_lib_mpg123, mpg123_param)
+# define mpg123_plain_strerror CODEC_LIB_SYM(codec_lib_mpg123, mpg123_plain_strerror)
+# define mpg123_strerror CODEC_LIB_SYM(codec_lib_mpg123, mpg123_strerror)
+#endif
+
+#endif
+
 static const struct a2dp_bit_mapping a2dp_mpeg_channels[] = {
 	{ MPEG_CHANNEL_MODE_MONO, .ch = { 1, a2dp_channel_map_mono } },
 	{ MPEG_CHANNEL_MODE_DUAL_CHANNEL, .ch = { 2, a2dp_channel_map_stereo } },
@@ -264,12 +367,14 @@ void *a2dp_mp3_enc_thread(struct ba_transport_pcm *t_pcm) {
 		size_t pcm_frames = ffb_len_out(&pcm) / channels;
 		ssize_t len;
 
+		trace_event(BA_TRACE_EVENT_ENCODE_BEGIN, ffb_len_out(&pcm), 0);
 		if ((len = channels == 1 ?
 					lame_encode_buffer(handle, pcm.data, NULL, pcm_frames, bt.tail, ffb_len_in(&bt)) :
 					lame_encode_buffer_interleaved(handle, pcm.data, pcm_frames, bt.tail, ffb_len_in(&bt))) < 0) {
 			error("LAME encoding error: %s", lame_encode_strerror(len));
 			continue;
 		}
+		trace_event(BA_TRACE_EVENT_ENCODE_END, len, 0);
 
 		if (len > 0) {
 
@@ -458,6 +563,7 @@ void *a2dp_mpeg_dec_thread(struct ba_transport_pcm *t_pcm) {
 		int encoding;
 
 decode:
+		trace_event(BA_TRACE_EVENT_DECODE_BEGIN, rtp_mpeg_len, 0);
 		switch (mpg123_decode(handle, rtp_mpeg, rtp_mpeg_len,
 					(uint8_t *)pcm.data, ffb_blen_in(&pcm), (size_t *)&len)) {
 		case MPG123_DONE:
@@ -474,7 +580,8 @@ decode:
 		}
 
 		const size_t samples = len / sizeof(int16_t);
-		io_pcm_scale(t_pcm, pcm.data, samples);
+		trace_event(BA_TRACE_EVENT_DECODE_END, samples, 0);
+
 		if (io_pcm_write(t_pcm, pcm.data, samples) == -1)
 			error("PCM write error: %s", strerror(errno));
 
@@ -492,13 +599,14 @@ decode:
 		int16_t pcm_r[MPEG_PCM_DECODE_SAMPLES];
 		ssize_t samples;
 
+		trace_event(BA_TRACE_EVENT_DECODE_BEGIN, rtp_mpeg_len, 0);
 		if ((samples = hip_decode(handle, rtp_mpeg, rtp_mpeg_len, pcm_l, pcm_r)) < 0) {
 			error("LAME decoding error: %zd", samples);
 			continue;
 		}
+		trace_event(BA_TRACE_EVENT_DECODE_END, samples, 0);
 
 		if (channels == 1) {
-			io_pcm_scale(t_pcm, pcm_l, samples);
 			if (io_pcm_write(t_pcm, pcm_l, samples) == -1)
 				error("PCM write error: %s", strerror(errno));
 		}
@@ -509,7 +617,6 @@ decode:
 				((int16_t *)pcm.data)[i * 2 + 1] = pcm_r[i];
 			}
 
-			io_pcm_scale(t_pcm, pcm.data, samples);
 			if (io_pcm_write(t_pcm, pcm.data, samples) == -1)
 				error("PCM write error: %s", strerror(errno));
 
@@ -649,6 +756,8 @@ static int a2dp_mpeg_source_init(struct a2dp_sep *sep) {
 	return 0;
 }
 
+static struct codec_lib * const a2dp_mpeg_source_libs[] = { &codec_lib_lame, NULL };
+
 static int a2dp_mpeg_source_transport_start(struct ba_transport *t) {
 	if (t->media.configuration.mpeg.layer == MPEG_LAYER_MP3)
 		return ba_transport_pcm_start(&t->media.pcm, a2dp_mp3_enc_thread, "ba-a2dp-mp3");
@@ -707,6 +816,7 @@ struct a2dp_sep a2dp_mpeg_source = {
 	.transport_init = a2dp_mpeg_transport_init,
 	.transport_start = a2dp_mpeg_source_transport_start,
 	.caps_helpers = &a2dp_mpeg_caps_helpers,
+	.libs = a2dp_mpeg_source_libs,
 	/* TODO: This is an optional but covered by the A2DP spec codec,
 	 *       so it could be enabled by default. However, it does not
 	 *       work reliably enough (for now)... */
@@ -717,6 +827,14 @@ struct a2dp_sep a2dp_mpeg_source = {
 
 #if ENABLE_MPG123 || ENABLE_MP3LAME
 
+static struct codec_lib * const a2dp_mpeg_sink_libs[] = {
+#if ENABLE_MPG123
+	&codec_lib_mpg123,
+#else
+	&codec_lib_lame,
+#endif
+	NULL };
+
 static int a2dp_mpeg_sink_transport_start(struct ba_transport *t) {
 #if ENABLE_MPG123
 	return ba_transport_pcm_start(&t->media.pcm, a2dp_mpeg_dec_thread, "ba-a2dp-mpeg");
@@ -786,6 +904,7 @@ struct a2dp_sep a2dp_mpeg_sink = {
 	.transport_init = a2dp_mpeg_transport_init,
 	.transport_start = a2dp_mpeg_sink_transport_start,
 	.caps_helpers = &a2dp_mpeg_caps_helpers,
+	.libs = a2dp_mpeg_sink_libs,
 	.enabled = false,
 };
 
@@ -15,28 +15,70 @@
 #endif
 
 #include <errno.h>
+#include <limits.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <unistd.h>
 
 #include <opus.h>
+#include <opus_multistream.h>
 
 #include "a2dp.h"
 #include "ba-config.h"
 #include "ba-transport.h"
 #include "ba-transport-pcm.h"
 #include "bluealsa-dbus.h"
+#include "codec-lib.h"
 #include "io.h"
 #include "rtp.h"
+#include "trace.h"
 #include "shared/a2dp-codecs.h"
 #include "shared/defs.h"
 #include "shared/ffb.h"
 #include "shared/log.h"
 #include "shared/rt.h"
 
+#ifndef OPUS_SONAME
+# define OPUS_SONAME "libopus.so.0"
+#endif
+
+#define OPUS_SYMBOLS(X) \
+	X(opus_multistream_decode) \
+	X(opus_multistream_decoder_create) \
+	X(opus_multistream_decoder_ctl) \
+	X(opus_multistream_decoder_destroy) \
+	X(opus_multistream_decoder_init) \
+	X(opus_multistream_encode) \
+	X(opus_multistream_encoder_create) \
+	X(opus_multistream_encoder_ctl) \
+	X(opus_multistream_encoder_destroy) \
+	X(opus_multistream_encoder_init) \
+	X(opus_strerror)
+
+CODEC_LIB_DEFINE(codec_lib_opus, "Opus", OPUS_SONAME, OPUS_SYMBOLS);
+
+#if ENABLE_CODEC_DLOPEN
+# define opus_multistream_decode CODEC_LIB_SYM(codec_lib_opus, opus_multistream_decode)
+# define opus_multistream_decoder_create CODEC_LIB_SYM(codec_lib_opus, opus_multistream_decoder_create)
+# define opus_multistream_decoder_ctl CODEC_LIB_SYM(codec_lib_opus, opus_multistream_decoder_ctl)
+# define opus_multistream_decoder_destroy CODEC_LIB_SYM(codec_lib_opus, opus_multistream_decoder_destroy)
+# define opus_multistream_decoder_init CODEC_LIB_SYM(codec_lib_opus, opus_multistream_decoder_init)
+# define opus_multistream_encode CODEC_LIB_SYM(codec_lib_opus, opus_multistream_encode)
+# define opus_multistream_encoder_create CODEC_LIB_SYM(codec_lib_opus, opus_multistream_encoder_create)
+# define opus_multistream_encoder_ctl CODEC_LIB_SYM(codec_lib_opus, opus_multistream_encoder_ctl)
+# define opus_multistream_encoder_destroy CODEC_LIB_SYM(codec_lib_opus, opus_multistream_encoder_destroy)
+# define opus_multistream_encoder_init CODEC_LIB_SYM(codec_lib_opus, opus_multistream_encoder_init)
+# define opus_strerror CODEC_LIB_SYM(codec_lib_opus, opus_strerror)
+#endif
+
+static struct codec_lib * const a2dp_opus_libs[] = { &codec_lib_opus, NULL };
+
 static const struct a2dp_bit_mapping a2dp_opus_channels[] = {
 	{ OPUS_CHANNEL_MODE_MONO, .ch = { 1, a2dp_channel_map_mono } },
 	{ OPUS_CHANNEL_MODE_DUAL, .ch = { 2, a2dp_channel_map_stereo } },
@@ -108,6 +150,227 @@ static struct a2dp_caps_helpers a2dp_opus_caps_helpers = {
 	.select_sample_rate = a2dp_opus_caps_select_sample_rate,
 };
 
+static const enum ba_transport_pcm_channel a2dp_opus_pw_channel_map_5_1[] = {
+	BA_TRANSPORT_PCM_CHANNEL_FL, BA_TRANSPORT_PCM_CHANNEL_FR,
+	BA_TRANSPORT_PCM_CHANNEL_FC, BA_TRANSPORT_PCM_CHANNEL_LFE,
+	BA_TRANSPORT_PCM_CHANNEL_RL, BA_TRANSPORT_PCM_CHANNEL_RR,
+};
+
+static const enum ba_transport_pcm_channel a2dp_opus_pw_channel_map_7_1[] = {
+	BA_TRANSPORT_PCM_CHANNEL_FL, BA_TRANSPORT_PCM_CHANNEL_FR,
+	BA_TRANSPORT_PCM_CHANNEL_FC, BA_TRANSPORT_PCM_CHANNEL_LFE,
+	BA_TRANSPORT_PCM_CHANNEL_RL, BA_TRANSPORT_PCM_CHANNEL_RR,
+	BA_TRANSPORT_PCM_CHANNEL_SL, BA_TRANSPORT_PCM_CHANNEL_SR,
+};
+
+/**
+ * Channel layouts supported by the PipeWire Opus codec.
+ *
+ * The Opus-PW codec does not have a channel mode bit-field. Instead, the
+ * channel layout is given by the audio location bitmask. The bit-value of
+ * this mapping is an index into the a2dp_opus_pw_locations[] array. Note,
+ * that channels in the channel map are ordered by the location bit. */
+static const struct a2dp_bit_mapping a2dp_opus_pw_channels[] = {
+	{ 1 << 0, .ch = { 1, a2dp_channel_map_mono } },
+	{ 1 << 1, .ch = { 2, a2dp_channel_map_stereo } },
+	{ 1 << 2, .ch = { 6, a2dp_opus_pw_channel_map_5_1 } },
+	{ 1 << 3, .ch = { 8, a2dp_opus_pw_channel_map_7_1 } },
+	{ 0 }
+};
+
+static const uint32_t a2dp_opus_pw_locations[] = {
+	0,
+	OPUS_PW_LOCATION_FL | OPUS_PW_LOCATION_FR,
+	OPUS_PW_LOCATION_FL | OPUS_PW_LOCATION_FR |
+		OPUS_PW_LOCATION_FC | OPUS_PW_LOCATION_LFE |
+		OPUS_PW_LOCATION_BL | OPUS_PW_LOCATION_BR,
+	OPUS_PW_LOCATION_FL | OPUS_PW_LOCATION_FR |
+		OPUS_PW_LOCATION_FC | OPUS_PW_LOCATION_LFE |
+		OPUS_PW_LOCATION_BL | OPUS_PW_LOCATION_BR |
+		OPUS_PW_LOCATION_SL | OPUS_PW_LOCATION_SR,
+};
+
+static const struct a2dp_bit_mapping a2dp_opus_pw_rates[] = {
+	{ 1 << 0, { 48000 } },
+	{ 0 }
+};
+
+/**
+ * Get the Opus multistream mapping for the given channel map.
+ *
+ * Channel pairs (front, rear and side) are encoded as coupled streams,
+ * all other channels are encoded as uncoupled (mono) streams.
+ *
+ * @return This function returns the number of coupled streams. */
+static unsigned int a2dp_opus_pw_get_mapping(
+		const enum ba_transport_pcm_channel *channel_map,
+		unsigned int channels,
+		unsigned char mapping[8]) {
+
+	static const enum ba_transport_pcm_channel pairs[][2] = {
+		{ BA_TRANSPORT_PCM_CHANNEL_FL, BA_TRANSPORT_PCM_CHANNEL_FR },
+		{ BA_TRANSPORT_PCM_CHANNEL_RL, BA_TRANSPORT_PCM_CHANNEL_RR },
+		{ BA_TRANSPORT_PCM_CHANNEL_SL, BA_TRANSPORT_PCM_CHANNEL_SR },
+	};
+
+	unsigned int coupled = 0;
+	unsigned int stream_channel = 0;
+	bool mapped[8] = { 0 };
+
+	for (size_t i = 0; i < ARRAYSIZE(pairs); i++) {
+		ssize_t l = -1, r = -1;
+		for (size_t ch = 0; ch < channels; ch++) {
+			if (channel_map[ch] == pairs[i][0])
+				l = ch;
+			if (channel_map[ch] == pairs[i][1])
+				r = ch;
+		}
+		if (l == -1 || r == -1)
+			continue;
+		mapping[l] = stream_channel++;
+		mapping[r] = stream_channel++;
+		mapped[l] = mapped[r] = true;
+		coupled++;
+	}
+
+	for (size_t ch = 0; ch < channels; ch++)
+		if (!mapped[ch])
+			mapping[ch] = stream_channel++;
+
+	return coupled;
+}
+
+/**
+ * Get the bitmask of channel layouts supported by the given stream. */
+static uint32_t a2dp_opus_pw_get_layouts(const a2dp_opus_pw_stream_t *stream) {
+
+	const uint32_t location = A2DP_OPUS_PW_GET_LOCATION(*stream);
+	uint32_t layouts = 0;
+
+	for (size_t i = 0; a2dp_opus_pw_channels[i].bit_value != 0; i++) {
+		const struct a2dp_bit_mapping *m = &a2dp_opus_pw_channels[i];
+		unsigned char mapping[8];
+		if (m->ch.channels > stream->channels ||
+				(a2dp_opus_pw_locations[i] & location) != a2dp_opus_pw_locations[i] ||
+				a2dp_opus_pw_get_mapping(m->ch.map, m->ch.channels, mapping) > stream->coupled_streams)
+			continue;
+		layouts |= m->bit_value;
+	}
+
+	return layouts;
+}
+
+/**
+ * Lookup for the channel layout of the given stream configuration.
+ *
+ * @return This function returns the index of the layout, or -1 if the
+ *   stream configuration does not match any supported layout. */
+static ssize_t a2dp_opus_pw_lookup_layout(const a2dp_opus_pw_stream_t *stream) {
+
+	uint32_t location = A2DP_OPUS_PW_GET_LOCATION(*stream);
+	/* Mono stream might be advertised without any location. */
+	if (stream->channels == 1 && location == OPUS_PW_LOCATION_FC)
+		location = 0;
+
+	for (size_t i = 0; a2dp_opus_pw_channels[i].bit_value != 0; i++)
+		if (a2dp_opus_pw_channels[i].ch.channels == stream->channels &&
+				a2dp_opus_pw_locations[i] == location)
+			return i;
+
+	return -1;
+}
+
+static void a2dp_opus_pw_stream_intersect(
+		a2dp_opus_pw_stream_t *stream,
+		const a2dp_opus_pw_stream_t *mask) {
+	stream->channels = MIN(stream->channels, mask->channels);
+	stream->coupled_streams = MIN(stream->coupled_streams, mask->coupled_streams);
+	A2DP_OPUS_PW_SET_LOCATION(*stream,
+			A2DP_OPUS_PW_GET_LOCATION(*stream) & A2DP_OPUS_PW_GET_LOCATION(*mask));
+	stream->frame_duration &= mask->frame_duration;
+	A2DP_OPUS_PW_SET_BITRATE(*stream,
+			MIN(A2DP_OPUS_PW_GET_BITRATE(*stream), A2DP_OPUS_PW_GET_BITRATE(*mask)));
+}
+
+static void a2dp_opus_pw_caps_intersect(
+		void *capabilities,
+		const void *mask) {
+	a2dp_opus_pw_t *caps = capabilities;
+	const a2dp_opus_pw_t *caps_mask = mask;
+	a2dp_opus_pw_stream_intersect(&caps->music, &caps_mask->music);
+	a2dp_opus_pw_stream_intersect(&caps->voice, &caps_mask->voice);
+}
+
+static int a2dp_opus_pw_caps_foreach_channel_mode(
+		const void *capabilities,
+		enum a2dp_stream stream,
+		a2dp_bit_mapping_foreach_func func,
+		void *userdata) {
+	const a2dp_opus_pw_t *caps = capabilities;
+	if (stream == A2DP_MAIN)
+		return a2dp_bit_mapping_foreach(a2dp_opus_pw_channels,
+				a2dp_opus_pw_get_layouts(&caps->music), func, userdata);
+	return -1;
+}
+
+static int a2dp_opus_pw_caps_foreach_sample_rate(
+		const void *capabilities,
+		enum a2dp_stream stream,
+		a2dp_bit_mapping_foreach_func func,
+		void *userdata) {
+	const a2dp_opus_pw_t *caps = capabilities;
+	if (stream == A2DP_MAIN && caps->music.channels > 0)
+		return a2dp_bit_mapping_foreach(a2dp_opus_pw_rates, 1 << 0, func, userdata);
+	return -1;
+}
+
+static void a2dp_opus_pw_stream_select_layout(
+		a2dp_opus_pw_stream_t *stream,
+		uint32_t layout) {
+
+	ssize_t i;
+	if ((i = a2dp_bit_mapping_lookup(a2dp_opus_pw_channels, layout)) == -1)
+		return;
+
+	const struct a2dp_bit_mapping *m = &a2dp_opus_pw_channels[i];
+	unsigned char mapping[8];
+
+	stream->channels = m->ch.channels;
+	stream->coupled_streams = a2dp_opus_pw_get_mapping(m->ch.map, m->ch.channels, mapping);
+	A2DP_OPUS_PW_SET_LOCATION(*stream, a2dp_opus_pw_locations[i]);
+
+}
+
+static void a2dp_opus_pw_caps_select_channel_mode(
+		void *capabilities,
+		enum a2dp_stream stream,
+		unsigned int channels) {
+	a2dp_opus_pw_t *caps = capabilities;
+	if (stream == A2DP_MAIN)
+		a2dp_opus_pw_stream_select_layout(&caps->music,
+				a2dp_bit_mapping_lookup_value(a2dp_opus_pw_channels,
+					a2dp_opus_pw_get_layouts(&caps->music), channels));
+}
+
+static void a2dp_opus_pw_caps_select_sample_rate(
+		void *capabilities,
+		enum a2dp_stream stream,
+		unsigned int rate) {
+	/* Opus-PW codec always uses 48 kHz sample rate. */
+	(void)capabilities;
+	(void)stream;
+	(void)rate;
+}
+
+static struct a2dp_caps_helpers a2dp_opus_pw_caps_helpers = {
+	.intersect = a2dp_opus_pw_caps_intersect,
+	.has_stream = a2dp_caps_has_main_stream_only,
+	.foreach_channel_mode = a2dp_opus_pw_caps_foreach_channel_mode,
+	.foreach_sample_rate = a2dp_opus_pw_caps_foreach_sample_rate,
+	.select_channel_mode = a2dp_opus_pw_caps_select_channel_mode,
+	.select_sample_rate = a2dp_opus_pw_caps_select_sample_rate,
+};
+
 static unsigned int a2dp_opus_get_frame_dms(const a2dp_opus_t *conf) {
 	switch (conf->frame_duration) {
 	default:
@@ -119,8 +382,153 @@ static unsigned int a2dp_opus_get_frame_dms(const a2dp_opus_t *conf) {
 	}
 }
 
-static void opus_encoder_destroy_ptr(OpusEncoder **p_st) {
-	opus_encoder_destroy(*p_st);
+static unsigned int a2dp_opus_pw_get_frame_dms(const a2dp_opus_pw_stream_t *conf) {
+	switch (conf->frame_duration) {
+	default:
+		return 0;
+	case OPUS_PW_FRAME_DURATION_100:
+		return 100;
+	case OPUS_PW_FRAME_DURATION_200:
+		return 200;
+	}
+}
+
+/**
+ * Opus multistream parameters of the transport PCM. */
+/**
+ * Per-channel Opus encoder bitrate limits. */
+#define A2DP_OPUS_BITRATE_MIN 6000
+#define A2DP_OPUS_BITRATE_MAX 256000
+
+struct a2dp_opus_stream {
+	unsigned int frame_dms;
+	unsigned int bitrate;
+	/* bitrate limits for all streams */
+	unsigned int bitrate_min;
+	unsigned int bitrate_max;
+	int streams;
+	int coupled_streams;
+	unsigned char mapping[8];
+};
+
+/**
+ * Get Opus multistream parameters for the given transport PCM.
+ *
+ * The Google Opus codec uses a single Opus stream, so the multistream API
+ * produces exactly the same bitstream as the single stream API. For the
+ * PipeWire Opus codec, channel pairs are encoded as coupled streams. Such
+ * streams benefit from the joint stereo coding, so their bitrate is lower
+ * than the bitrate of two uncoupled channels. The LFE channel carries only
+ * low frequencies, so it gets a small fraction of the per-channel bitrate.
+ *
+ * The bitrate set via the D-Bus API (if any) overrides the default bitrate
+ * taken from the BlueALSA service configuration. */
+static void a2dp_opus_get_stream(
+		const struct ba_transport_pcm *t_pcm,
+		struct a2dp_opus_stream *stream) {
+
+	const struct ba_transport *t = t_pcm->t;
+	const unsigned int channels = t_pcm->channels;
+
+	/* Per-channel limits are the same as for the --opus-bitrate option. */
+	stream->bitrate_min = A2DP_OPUS_BITRATE_MIN * channels;
+	stream->bitrate_max = A2DP_OPUS_BITRATE_MAX * channels;
+
+	if (t->codec_id == A2DP_CODEC_VENDOR_ID(OPUS_PW_VENDOR_ID, OPUS_PW_CODEC_ID)) {
+
+		const a2dp_opus_pw_stream_t *conf = &t->media.configuration.opus_pw.music;
+		stream->frame_dms = a2dp_opus_pw_get_frame_dms(conf);
+		stream->coupled_streams = a2dp_opus_pw_get_mapping(t_pcm->channel_map,
+				channels, stream->mapping);
+		stream->streams = channels - stream->coupled_streams;
+
+		stream->bitrate = 0;
+		for (size_t ch = 0; ch < channels; ch++) {
+			if (t_pcm->channel_map[ch] == BA_TRANSPORT_PCM_CHANNEL_LFE)
+				stream->bitrate += config.opus_bitrate / 4;
+			else if (stream->mapping[ch] < 2 * stream->coupled_streams)
+				stream->bitrate += config.opus_bitrate * 3 / 4;
+			else
+				stream->bitrate += config.opus_bitrate;
+		}
+
+		/* Limit bitrate to the value negotiated with the remote device. */
+		const unsigned int bitrate = A2DP_OPUS_PW_GET_BITRATE(*conf) * 1024;
+		if (bitrate != 0 && stream->bitrate_max > bitrate)
+			stream->bitrate_max = bitrate;
+
+	}
+	else {
+
+		stream->frame_dms = a2dp_opus_get_frame_dms(&t->media.configuration.opus);
+		stream->bitrate = config.opus_bitrate * channels;
+		stream->coupled_streams = channels == 2 ? 1 : 0;
+		stream->streams = 1;
+		stream->mapping[0] = 0;
+		stream->mapping[1] = 1;
+
+	}
+
+	if (t_pcm->bitrate != 0)
+		stream->bitrate = t_pcm->bitrate;
+	stream->bitrate = MIN(stream->bitrate, stream->bitrate_max);
+
+}
+
+/**
+ * Period of the packet loss estimation. */
+#define A2DP_OPUS_LOSS_PERIOD_DMS 10000
+
+/**
+ * Maximum duration of a gap in the stream, which will be filled with
+ * the packet loss concealment. Longer gaps are treated as stream breaks. */
+#define A2DP_OPUS_PLC_MAX_DMS 10000
+
+/**
+ * Set initial encoder bitrate which might be changed via D-Bus. */
+static void a2dp_opus_transport_init_bitrate(struct ba_transport *t) {
+	if (t->profile != BA_TRANSPORT_PROFILE_A2DP_SOURCE)
+		return;
+	struct a2dp_opus_stream stream;
+	a2dp_opus_get_stream(&t->media.pcm, &stream);
+	t->media.pcm.bitrate = stream.bitrate;
+}
+
+static void opus_multistream_encoder_destroy_ptr(OpusMSEncoder **p_st) {
+	opus_multistream_encoder_destroy(*p_st);
+}
+
+static int a2dp_opus_enc_setup(OpusMSEncoder *opus, unsigned int bitrate,
+		unsigned int loss_perc) {
+
+	int err;
+	if ((err = opus_multistream_encoder_ctl(opus, OPUS_SET_COMPLEXITY(config.opus_complexity))) != OPUS_OK) {
+		error("Couldn't set computational complexity: %s", opus_strerror(err));
+		return err;
+	}
+
+	if ((err = opus_multistream_encoder_ctl(opus, OPUS_SET_BITRATE(bitrate))) != OPUS_OK) {
+		error("Couldn't set bitrate: %s", opus_strerror(err));
+		return err;
+	}
+
+	if ((err = opus_multistream_encoder_ctl(opus, OPUS_SET_DTX(config.opus_dtx))) != OPUS_OK) {
+		error("Couldn't set DTX mode: %s", opus_strerror(err));
+		return err;
+	}
+
+	if ((err = opus_multistream_encoder_ctl(opus, OPUS_SET_INBAND_FEC(config.opus_fec))) != OPUS_OK) {
+		error("Couldn't set in-band FEC mode: %s", opus_strerror(err));
+		return err;
+	}
+
+	if (config.opus_fec &&
+			(err = opus_multistream_encoder_ctl(opus, OPUS_SET_PACKET_LOSS_PERC(loss_perc))) != OPUS_OK) {
+		error("Couldn't set expected packet loss: %s", opus_strerror(err));
+		return err;
+	}
+
+	return OPUS_OK;
 }
 
 void *a2dp_opus_enc_thread(struct ba_transport_pcm *t_pcm) {
@@ -131,31 +539,50 @@ void *a2dp_opus_enc_thread(struct ba_transport_pcm *t_pcm) {
 	struct ba_transport *t = t_pcm->t;
 	struct io_poll io = { .timeout = -1 };
 
-	OpusEncoder *opus = NULL;
-	pthread_cleanup_push(PTHREAD_CLEANUP(opus_encoder_destroy_ptr), &opus);
+	OpusMSEncoder *opus = NULL;
+	pthread_cleanup_push(PTHREAD_CLEANUP(opus_multistream_encoder_destroy_ptr), &opus);
+
+	struct a2dp_opus_stream stream;
+	a2dp_opus_get_stream(t_pcm, &stream);
 
-	const a2dp_opus_t *configuration = &t->media.configuration.opus;
 	const unsigned int channels = t_pcm->channels;
 	const unsigned int rate = t_pcm->rate;
-	const unsigned int opus_frame_dms = a2dp_opus_get_frame_dms(configuration);
-	const size_t opus_frame_pcm_samples = opus_frame_dms * rate / 10000;
-	const size_t opus_frame_pcm_frames = opus_frame_pcm_samples / channels;
+	const unsigned int opus_frame_dms = stream.frame_dms;
+	const size_t opus_frame_pcm_frames = opus_frame_dms * rate / 10000;
+	const size_t opus_frame_pcm_samples = opus_frame_pcm_frames * channels;
+
+	/* Every Opus frame has to fit into a single BT packet. */
+	const size_t mtu_payload = t->mtu_write - RTP_HEADER_LEN - sizeof(rtp_media_header_t);
+	stream.bitrate_max = MIN(stream.bitrate_max, mtu_payload * 8 * 10000 / opus_frame_dms);
+	stream.bitrate = MIN(stream.bitrate, stream.bitrate_max);
+
+	/* The expected packet loss is estimated from the number of packets
+	 * which were queued in the BT socket for longer than two frames. Such
+	 * packets are likely to be flushed by the BT controller. */
+	const unsigned int loss_period_frames = A2DP_OPUS_LOSS_PERIOD_DMS / opus_frame_dms;
+	unsigned int loss_perc = config.opus_packet_loss;
+	unsigned int loss_packets = 0;
+	unsigned int loss_congested = 0;
 
 	int err;
-	if ((opus = opus_encoder_create(rate, channels, OPUS_APPLICATION_AUDIO, &err)) == NULL ||
-			(err = opus_encoder_init(opus, rate, channels, OPUS_APPLICATION_AUDIO)) != OPUS_OK) {
+	if ((opus = opus_multistream_encoder_create(rate, channels, stream.streams,
+					stream.coupled_streams, stream.mapping, OPUS_APPLICATION_AUDIO, &err)) == NULL ||
+			(err = opus_multistream_encoder_init(opus, rate, channels, stream.streams,
+					stream.coupled_streams, stream.mapping, OPUS_APPLICATION_AUDIO)) != OPUS_OK) {
 		error("Couldn't initialize Opus encoder: %s", opus_strerror(err));
 		goto fail_init;
 	}
 
-	if ((err = opus_encoder_ctl(opus, OPUS_SET_COMPLEXITY(5))) != OPUS_OK) {
-		error("Couldn't set computational complexity: %s", opus_strerror(err));
-		goto fail_init;
-	}
+	debug("Opus streams: %d (coupled: %d), bitrate: %u",
+			stream.streams, stream.coupled_streams, stream.bitrate);
 
-	if ((err = opus_encoder_ctl(opus, OPUS_SET_BITRATE(128000 * channels))) != OPUS_OK) {
-		error("Couldn't set bitrate: %s", opus_strerror(err));
+	if (a2dp_opus_enc_setup(opus, stream.bitrate, loss_perc) != OPUS_OK)
 		goto fail_init;
+
+	/* publish the bitrate used by the encoder */
+	if (t_pcm->bitrate != stream.bitrate) {
+		t_pcm->bitrate = stream.bitrate;
+		bluealsa_dbus_pcm_update(t_pcm, BA_DBUS_PCM_UPDATE_BITRATE);
 	}
 
 	ffb_t bt = { 0 };
@@ -171,7 +598,7 @@ void *a2dp_opus_enc_thread(struct ba_transport_pcm *t_pcm) {
 
 	int32_t opus_delay_frames = 0;
 	/* Get the delay introduced by the encoder. */
-	opus_encoder_ctl(opus, OPUS_GET_LOOKAHEAD(&opus_delay_frames));
+	opus_multistream_encoder_ctl(opus, OPUS_GET_LOOKAHEAD(&opus_delay_frames));
 	t_pcm->codec_delay_dms = opus_delay_frames * 10000 / rate;
 	ba_transport_pcm_delay_sync(t_pcm, BA_DBUS_PCM_UPDATE_DELAY);
 
@@ -191,7 +618,9 @@ void *a2dp_opus_enc_thread(struct ba_transport_pcm *t_pcm) {
 		switch (io_poll_and_read_pcm(&io, t_pcm, &pcm)) {
 		case -1:
 			if (errno == ESTALE) {
-				opus_encoder_init(opus, rate, channels, OPUS_APPLICATION_AUDIO);
+				opus_multistream_encoder_init(opus, rate, channels, stream.streams,
+						stream.coupled_streams, stream.mapping, OPUS_APPLICATION_AUDIO);
+				a2dp_opus_enc_setup(opus, stream.bitrate, loss_perc);
 				continue;
 			}
 			error("PCM poll and read error: %s", strerror(errno));
@@ -201,6 +630,24 @@ void *a2dp_opus_enc_thread(struct ba_transport_pcm *t_pcm) {
 			continue;
 		}
 
+		/* Apply the bitrate requested via the D-Bus API. */
+		const unsigned int bitrate = atomic_exchange_explicit(
+				&t_pcm->bitrate_request, 0, memory_order_relaxed);
+		if (bitrate != 0 && bitrate != stream.bitrate) {
+			if (bitrate < stream.bitrate_min || bitrate > stream.bitrate_max)
+				error("Couldn't set bitrate: %u: Out of range [%u, %u]",
+						bitrate, stream.bitrate_min, stream.bitrate_max);
+			else if ((err = opus_multistream_encoder_ctl(opus, OPUS_SET_BITRATE(bitrate))) != OPUS_OK)
+				error("Couldn't set bitrate: %u: %s", bitrate, opus_strerror(err));
+			else {
+				debug("Opus bitrate: %u -> %u", stream.bitrate, bitrate);
+				stream.bitrate = bitrate;
+				/* publish the bitrate accepted by the encoder */
+				t_pcm->bitrate = bitrate;
+				bluealsa_dbus_pcm_update(t_pcm, BA_DBUS_PCM_UPDATE_BITRATE);
+			}
+		}
+
 		/* anchor for RTP payload */
 		bt.tail = rtp_payload;
 
@@ -211,19 +658,30 @@ void *a2dp_opus_enc_thread(struct ba_transport_pcm *t_pcm) {
 		while (input_samples >= opus_frame_pcm_samples) {
 
 			ssize_t len;
-			if ((len = opus_encode(opus, input, opus_frame_pcm_frames,
+			trace_event(BA_TRACE_EVENT_ENCODE_BEGIN, input_samples, 0);
+			if ((len = opus_multistream_encode(opus, input, opus_frame_pcm_frames,
 							bt.tail, ffb_len_in(&bt))) < 0) {
 				error("Opus encoding error: %s", opus_strerror(len));
 				break;
 			}
+			trace_event(BA_TRACE_EVENT_ENCODE_END, len, 1);
 
 			input += opus_frame_pcm_samples;
 			input_samples -= opus_frame_pcm_samples;
+
+			/* In the DTX mode, packets with 2 bytes or less do not have to be
+			 * transmitted. The receiver will detect the gap in RTP timestamps
+			 * and fill it with the comfort noise. */
+			if (config.opus_dtx && len <= 2)
+				goto skip;
+
 			ffb_seek(&bt, len);
 
 			rtp_state_new_frame(&rtp, rtp_header);
 			rtp_media_header->frame_count = 1;
 
+			errno = 0;
+
 			len = ffb_blen_out(&bt);
 			if ((len = io_bt_write(t_pcm, bt.data, len)) <= 0) {
 				if (len == -1)
@@ -238,6 +696,41 @@ void *a2dp_opus_enc_thread(struct ba_transport_pcm *t_pcm) {
 				io.initiated = true;
 			}
 
+			if (config.opus_fec) {
+
+				/* Try to get the number of bytes queued in the
+				 * socket output buffer. */
+				int queued_bytes = 0;
+				if (errno == EAGAIN)
+					queued_bytes = INT_MAX;
+				else if (ioctl(t->bt_fd, TIOCOUTQ, &queued_bytes) != -1)
+					queued_bytes = abs(t->media.bt_fd_coutq_init - queued_bytes);
+
+				if (queued_bytes > 2 * len)
+					loss_congested++;
+
+				if (++loss_packets == loss_period_frames) {
+
+					const unsigned int congested_perc = 100 * loss_congested / loss_packets;
+					unsigned int perc = MAX((loss_perc + congested_perc) / 2, config.opus_packet_loss);
+
+					if (perc != loss_perc) {
+						debug("Opus expected packet loss: %u%%", perc);
+						opus_multistream_encoder_ctl(opus, OPUS_SET_PACKET_LOSS_PERC(perc));
+						loss_perc = perc;
+					}
+
+					loss_packets = 0;
+					loss_congested = 0;
+
+				}
+
+			}
+
+skip:
+			/* reinitialize output buffer */
+			bt.tail = rtp_payload;
+
 			/* Keep data transfer at a constant bit rate. */
 			asrsync_sync(&io.asrs, opus_frame_pcm_frames);
 			/* move forward RTP timestamp clock */
@@ -264,8 +757,8 @@ fail_init:
 	return NULL;
 }
 
-static void opus_decoder_destroy_ptr(OpusDecoder **p_st) {
-	opus_decoder_destroy(*p_st);
+static void opus_multistream_decoder_destroy_ptr(OpusMSDecoder **p_st) {
+	opus_multistream_decoder_destroy(*p_st);
 }
 
 __attribute__ ((weak))
@@ -277,18 +770,24 @@ void *a2dp_opus_dec_thread(struct ba_transport_pcm *t_pcm) {
 	struct ba_transport *t = t_pcm->t;
 	struct io_poll io = { .timeout = -1 };
 
-	OpusDecoder *opus = NULL;
-	pthread_cleanup_push(PTHREAD_CLEANUP(opus_decoder_destroy_ptr), &opus);
+	OpusMSDecoder *opus = NULL;
+	pthread_cleanup_push(PTHREAD_CLEANUP(opus_multistream_decoder_destroy_ptr), &opus);
+
+	struct a2dp_opus_stream stream;
+	a2dp_opus_get_stream(t_pcm, &stream);
 
-	const a2dp_opus_t *configuration = &t->media.configuration.opus;
 	const unsigned int channels = t_pcm->channels;
 	const unsigned int rate = t_pcm->rate;
-	const unsigned int opus_frame_dms = a2dp_opus_get_frame_dms(configuration);
-	const size_t opus_frame_pcm_samples = opus_frame_dms * rate / 10000;
+	const unsigned int opus_frame_dms = stream.frame_dms;
+	const size_t opus_frame_pcm_frames = opus_frame_dms * rate / 10000;
+	const size_t opus_frame_pcm_samples = opus_frame_pcm_frames * channels;
+	const size_t opus_plc_pcm_frames = A2DP_OPUS_PLC_MAX_DMS * rate / 10000;
 
 	int err;
-	if ((opus = opus_decoder_create(rate, channels, &err)) == NULL ||
-			(err = opus_decoder_init(opus, rate, channels)) != OPUS_OK) {
+	if ((opus = opus_multistream_decoder_create(rate, channels, stream.streams,
+					stream.coupled_streams, stream.mapping, &err)) == NULL ||
+			(err = opus_multistream_decoder_init(opus, rate, channels, stream.streams,
+					stream.coupled_streams, stream.mapping)) != OPUS_OK) {
 		error("Couldn't initialize Opus decoder: %s", opus_strerror(err));
 		goto fail_init;
 	}
@@ -306,7 +805,7 @@ void *a2dp_opus_dec_thread(struct ba_transport_pcm *t_pcm) {
 
 	int32_t opus_delay_frames = 0;
 	/* Get the delay introduced by the decoder. */
-	opus_decoder_ctl(opus, OPUS_GET_LOOKAHEAD(&opus_delay_frames));
+	opus_multistream_decoder_ctl(opus, OPUS_GET_LOOKAHEAD(&opus_delay_frames));
 	t_pcm->codec_delay_dms = opus_delay_frames * 10000 / rate;
 	ba_transport_pcm_delay_sync(t_pcm, BA_DBUS_PCM_UPDATE_DELAY);
 
@@ -331,7 +830,8 @@ void *a2dp_opus_dec_thread(struct ba_transport_pcm *t_pcm) {
 			continue;
 
 		int missing_rtp_frames = 0;
-		rtp_state_sync_stream(&rtp, rtp_header, &missing_rtp_frames, NULL);
+		int missing_pcm_frames = 0;
+		rtp_state_sync_stream(&rtp, rtp_header, &missing_rtp_frames, &missing_pcm_frames);
 
 		if (!ba_transport_pcm_is_active(t_pcm)) {
 			rtp.synced = false;
@@ -341,14 +841,45 @@ void *a2dp_opus_dec_thread(struct ba_transport_pcm *t_pcm) {
 		const uint8_t *rtp_payload = (uint8_t *)(rtp_media_header + 1);
 		size_t rtp_payload_len = len - (rtp_payload - (uint8_t *)bt.data);
 
-		if ((len = opus_decode(opus, rtp_payload, rtp_payload_len,
-						pcm.data, ffb_blen_in(&pcm), 0)) < 0) {
+		/* Gaps in the stream are caused either by lost packets or by the
+		 * discontinuous transmission. In both cases, fill the gap with the
+		 * packet loss concealment. If packets were lost, try to recover
+		 * the last missing frame with the FEC data from the current packet. */
+		if (missing_pcm_frames > 0 && (size_t)missing_pcm_frames <= opus_plc_pcm_frames) {
+
+			debug("Missing Opus frames: %zu", DIV_ROUND_UP(missing_pcm_frames, opus_frame_pcm_frames));
+
+			while (missing_pcm_frames > 0) {
+
+				const bool fec = missing_rtp_frames > 0 &&
+					(size_t)missing_pcm_frames <= opus_frame_pcm_frames;
+
+				if ((len = opus_multistream_decode(opus,
+								fec ? rtp_payload : NULL, fec ? rtp_payload_len : 0,
+								pcm.data, opus_frame_pcm_frames, fec)) < 0) {
+					error("Opus loss concealment error: %s", opus_strerror(len));
+					break;
+				}
+
+				const size_t samples = len * channels;
+				if (io_pcm_write(t_pcm, pcm.data, samples) == -1)
+					error("PCM write error: %s", strerror(errno));
+
+				missing_pcm_frames -= len;
+
+			}
+
+		}
+
+		trace_event(BA_TRACE_EVENT_DECODE_BEGIN, rtp_payload_len, 0);
+		if ((len = opus_multistream_decode(opus, rtp_payload, rtp_payload_len,
+						pcm.data, opus_frame_pcm_frames, 0)) < 0) {
 			error("Opus decoding error: %s", opus_strerror(len));
-			break;
+			continue;
 		}
 
 		const size_t samples = len * channels;
-		io_pcm_scale(t_pcm, pcm.data, samples);
+		trace_event(BA_TRACE_EVENT_DECODE_END, samples, 0);
 		if (io_pcm_write(t_pcm, pcm.data, samples) == -1)
 			error("PCM write error: %s", strerror(errno));
 
@@ -459,6 +990,8 @@ static int a2dp_opus_transport_init(struct ba_transport *t) {
 	memcpy(t->media.pcm.channel_map, a2dp_opus_channels[channels_i].ch.map,
 			t->media.pcm.channels * sizeof(*t->media.pcm.channel_map));
 
+	a2dp_opus_transport_init_bitrate(t);
+
 	return 0;
 }
 
@@ -498,6 +1031,7 @@ struct a2dp_sep a2dp_opus_source = {
 	.transport_init = a2dp_opus_transport_init,
 	.transport_start = a2dp_opus_source_transport_start,
 	.caps_helpers = &a2dp_opus_caps_helpers,
+	.libs = a2dp_opus_libs,
 };
 
 static int a2dp_opus_sink_transport_start(struct ba_transport *t) {
@@ -529,4 +1063,180 @@ struct a2dp_sep a2dp_opus_sink = {
 	.transport_init = a2dp_opus_transport_init,
 	.transport_start = a2dp_opus_sink_transport_start,
 	.caps_helpers = &a2dp_opus_caps_helpers,
+	.libs = a2dp_opus_libs,
+};
+
+static int a2dp_opus_pw_configuration_select(
+		const struct a2dp_sep *sep,
+		void *capabilities) {
+
+	a2dp_opus_pw_t *caps = capabilities;
+	const a2dp_opus_pw_t saved = *caps;
+
+	/* Narrow capabilities to values supported by BlueALSA. */
+	a2dp_opus_pw_caps_intersect(caps, &sep->config.capabilities);
+
+	if (caps->music.frame_duration & OPUS_PW_FRAME_DURATION_200)
+		caps->music.frame_duration = OPUS_PW_FRAME_DURATION_200;
+	else if (caps->music.frame_duration & OPUS_PW_FRAME_DURATION_100)
+		caps->music.frame_duration = OPUS_PW_FRAME_DURATION_100;
+	else {
+		error("Opus-PW: No supported frame durations: %#x", saved.music.frame_duration);
+		return errno = ENOTSUP, -1;
+	}
+
+	unsigned int layout = 0;
+	if (a2dp_opus_pw_caps_foreach_channel_mode(caps, A2DP_MAIN,
+				a2dp_bit_mapping_foreach_get_best_channel_mode, &layout) != -1)
+		a2dp_opus_pw_stream_select_layout(&caps->music, layout);
+	else {
+		error("Opus-PW: No supported channel layouts: %u channels, location %#x",
+				saved.music.channels, A2DP_OPUS_PW_GET_LOCATION(saved.music));
+		return errno = ENOTSUP, -1;
+	}
+
+	/* Voice back-channel is not supported. */
+	memset(&caps->voice, 0, sizeof(caps->voice));
+
+	return 0;
+}
+
+static int a2dp_opus_pw_configuration_check(
+		const struct a2dp_sep *sep,
+		const void *configuration) {
+
+	const a2dp_opus_pw_t *conf = configuration;
+	a2dp_opus_pw_t conf_v = *conf;
+
+	/* Validate configuration against BlueALSA capabilities. */
+	a2dp_opus_pw_caps_intersect(&conf_v, &sep->config.capabilities);
+
+	switch (conf_v.music.frame_duration) {
+	case OPUS_PW_FRAME_DURATION_100:
+	case OPUS_PW_FRAME_DURATION_200:
+		break;
+	default:
+		debug("Opus-PW: Invalid frame duration: %#x", conf->music.frame_duration);
+		return A2DP_CHECK_ERR_FRAME_DURATION;
+	}
+
+	ssize_t layout_i;
+	if (A2DP_OPUS_PW_GET_LOCATION(conf_v.music) != A2DP_OPUS_PW_GET_LOCATION(conf->music) ||
+			(layout_i = a2dp_opus_pw_lookup_layout(&conf->music)) == -1) {
+		debug("Opus-PW: Invalid channel layout: %u channels, location %#x",
+				conf->music.channels, A2DP_OPUS_PW_GET_LOCATION(conf->music));
+		return A2DP_CHECK_ERR_CHANNEL_MODE;
+	}
+
+	const struct a2dp_bit_mapping *m = &a2dp_opus_pw_channels[layout_i];
+	unsigned char mapping[8];
+
+	/* Our multistream mapping has to match the remote one. */
+	if (a2dp_opus_pw_get_mapping(m->ch.map, m->ch.channels,
+				mapping) != conf->music.coupled_streams) {
+		debug("Opus-PW: Invalid coupled streams: %u", conf->music.coupled_streams);
+		return A2DP_CHECK_ERR_CHANNEL_MODE;
+	}
+
+	return A2DP_CHECK_OK;
+}
+
+static int a2dp_opus_pw_transport_init(struct ba_transport *t) {
+
+	ssize_t layout_i;
+	if ((layout_i = a2dp_opus_pw_lookup_layout(&t->media.configuration.opus_pw.music)) == -1)
+		return -1;
+
+	t->media.pcm.format = BA_TRANSPORT_PCM_FORMAT_S16_2LE;
+	t->media.pcm.channels = a2dp_opus_pw_channels[layout_i].ch.channels;
+	t->media.pcm.rate = a2dp_opus_pw_rates[0].value;
+
+	memcpy(t->media.pcm.channel_map, a2dp_opus_pw_channels[layout_i].ch.map,
+			t->media.pcm.channels * sizeof(*t->media.pcm.channel_map));
+
+	a2dp_opus_transport_init_bitrate(t);
+
+	return 0;
+}
+
+static int a2dp_opus_pw_source_init(struct a2dp_sep *sep) {
+	if (config.a2dp.force_mono) {
+		sep->config.capabilities.opus_pw.music.channels = 1;
+		sep->config.capabilities.opus_pw.music.coupled_streams = 0;
+		A2DP_OPUS_PW_SET_LOCATION(sep->config.capabilities.opus_pw.music, 0);
+	}
+	return 0;
+}
+
+static int a2dp_opus_pw_source_transport_start(struct ba_transport *t) {
+	return ba_transport_pcm_start(&t->media.pcm, a2dp_opus_enc_thread, "ba-a2dp-opus");
+}
+
+struct a2dp_sep a2dp_opus_pw_source = {
+	.name = "A2DP Source (Opus-PW)",
+	.config = {
+		.type = A2DP_SOURCE,
+		.codec_id = A2DP_CODEC_VENDOR_ID(OPUS_PW_VENDOR_ID, OPUS_PW_CODEC_ID),
+		.caps_size = sizeof(a2dp_opus_pw_t),
+		.capabilities.opus_pw = {
+			.info = A2DP_VENDOR_INFO_INIT(OPUS_PW_VENDOR_ID, OPUS_PW_CODEC_ID),
+			.music = {
+				.channels = 8,
+				.coupled_streams = 3,
+				A2DP_OPUS_PW_INIT_LOCATION(
+					OPUS_PW_LOCATION_FL | OPUS_PW_LOCATION_FR |
+					OPUS_PW_LOCATION_FC | OPUS_PW_LOCATION_LFE |
+					OPUS_PW_LOCATION_BL | OPUS_PW_LOCATION_BR |
+					OPUS_PW_LOCATION_SL | OPUS_PW_LOCATION_SR)
+				.frame_duration =
+					OPUS_PW_FRAME_DURATION_100 |
+					OPUS_PW_FRAME_DURATION_200,
+				/* maximal bitrate in units of 1024 bps */
+				A2DP_OPUS_PW_INIT_BITRATE(1024)
+			},
+		},
+	},
+	.init = a2dp_opus_pw_source_init,
+	.configuration_select = a2dp_opus_pw_configuration_select,
+	.configuration_check = a2dp_opus_pw_configuration_check,
+	.transport_init = a2dp_opus_pw_transport_init,
+	.transport_start = a2dp_opus_pw_source_transport_start,
+	.caps_helpers = &a2dp_opus_pw_caps_helpers,
+	.libs = a2dp_opus_libs,
+};
+
+static int a2dp_opus_pw_sink_transport_start(struct ba_transport *t) {
+	return ba_transport_pcm_start(&t->media.pcm, a2dp_opus_dec_thread, "ba-a2dp-opus");
+}
+
+struct a2dp_sep a2dp_opus_pw_sink = {
+	.name = "A2DP Sink (Opus-PW)",
+	.config = {
+		.type = A2DP_SINK,
+		.codec_id = A2DP_CODEC_VENDOR_ID(OPUS_PW_VENDOR_ID, OPUS_PW_CODEC_ID),
+		.caps_size = sizeof(a2dp_opus_pw_t),
+		.capabilities.opus_pw = {
+			.info = A2DP_VENDOR_INFO_INIT(OPUS_PW_VENDOR_ID, OPUS_PW_CODEC_ID),
+			.music = {
+				.channels = 8,
+				.coupled_streams = 3,
+				A2DP_OPUS_PW_INIT_LOCATION(
+					OPUS_PW_LOCATION_FL | OPUS_PW_LOCATION_FR |
+					OPUS_PW_LOCATION_FC | OPUS_PW_LOCATION_LFE |
+					OPUS_PW_LOCATION_BL | OPUS_PW_LOCATION_BR |
+					OPUS_PW_LOCATION_SL | OPUS_PW_LOCATION_SR)
+				.frame_duration =
+					OPUS_PW_FRAME_DURATION_100 |
+					OPUS_PW_FRAME_DURATION_200,
+				/* maximal bitrate in units of 1024 bps */
+				A2DP_OPUS_PW_INIT_BITRATE(1024)
+			},
+		},
+	},
+	.configuration_select = a2dp_opus_pw_configuration_select,
+	.configuration_check = a2dp_opus_pw_configuration_check,
+	.transport_init = a2dp_opus_pw_transport_init,
+	.transport_start = a2dp_opus_pw_sink_transport_start,
+	.caps_helpers = &a2dp_opus_pw_caps_helpers,
+	.libs = a2dp_opus_libs,
 };
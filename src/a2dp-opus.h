@@ -1,6 +1,6 @@
 /*
  * BlueALSA - a2dp-opus.h
- * Copyright (c) 2016-2024 Arkadiusz Bokowy
+ * Copyright (c) 2016-2025 Arkadiusz Bokowy
  *
  * This file is a part of bluez-alsa.
  *
@@ -20,5 +20,7 @@
 
 extern struct a2dp_sep a2dp_opus_source;
 extern struct a2dp_sep a2dp_opus_sink;
+extern struct a2dp_sep a2dp_opus_pw_source;
+extern struct a2dp_sep a2dp_opus_pw_sink;
 
 #endif
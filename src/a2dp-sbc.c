@@ -19,7 +19,9 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <unistd.h>
 
 #include <glib.h>
@@ -33,6 +35,7 @@
 #include "codec-sbc.h"
 #include "io.h"
 #include "rtp.h"
+#include "trace.h"
 #include "shared/a2dp-codecs.h"
 #include "shared/defs.h"
 #include "shared/ffb.h"
@@ -122,6 +125,25 @@ static struct a2dp_caps_helpers a2dp_sbc_caps_helpers = {
 	.select_sample_rate = a2dp_sbc_caps_select_sample_rate,
 };
 
+/**
+ * Get the number of SBC frames which fit in the RTP packet.
+ *
+ * @param sbc Initialized SBC encoder structure.
+ * @param bitpool The bit-pool for which the frame length is calculated.
+ * @param mtu_payload_len The maximal size of the RTP payload.
+ * @return The number of frames, at least one, but not more than the
+ *   4-bit RTP media header frame counter can contain. */
+size_t a2dp_sbc_get_packet_frames(sbc_t *sbc, uint8_t bitpool,
+		size_t mtu_payload_len) {
+
+	const uint8_t bitpool_ = sbc->bitpool;
+	sbc->bitpool = bitpool;
+	const size_t frame_len = sbc_get_frame_length(sbc);
+	sbc->bitpool = bitpool_;
+
+	return MIN(MAX(mtu_payload_len / frame_len, 1), (1 << 4) - 1);
+}
+
 void *a2dp_sbc_enc_thread(struct ba_transport_pcm *t_pcm) {
 
 	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
@@ -147,26 +169,37 @@ void *a2dp_sbc_enc_thread(struct ba_transport_pcm *t_pcm) {
 	const unsigned int channels = t_pcm->channels;
 	const unsigned int rate = t_pcm->rate;
 
-	/* initialize SBC encoder bit-pool */
-	sbc.bitpool = sbc_a2dp_get_bitpool(configuration, config.sbc_quality);
+	/* Writing MTU should be big enough to contain RTP header, SBC payload
+	 * header and at least one SBC frame. In general, there is no constraint
+	 * for the MTU value, but the speed might suffer significantly. */
+	const size_t rtp_headers_len = RTP_HEADER_LEN + sizeof(rtp_media_header_t);
+	const size_t mtu_write_payload_len = t->mtu_write - rtp_headers_len;
+
+	/* Initialize SBC encoder bit-pool. In the dynamic bit-pool mode, the
+	 * bit-pool selected for given quality is used as the upper limit. */
+	const uint8_t bitpool = sbc_a2dp_get_bitpool(configuration, config.sbc_quality);
+	struct sbc_bitpool_ctrl bitpool_ctrl;
+	sbc_bitpool_ctrl_init(&bitpool_ctrl,
+			config.sbc_dynamic_bitpool ? configuration->min_bitpool : bitpool, bitpool,
+			/* probe higher bit-pool every ~500 ms */
+			rate / 2 / (sbc_frame_samples / channels) /
+			a2dp_sbc_get_packet_frames(&sbc, bitpool, mtu_write_payload_len));
+
 	/* ensure libsbc uses little-endian PCM on all architectures */
 	sbc.endian = SBC_LE;
+	sbc.bitpool = bitpool_ctrl.bitpool;
 
 #if DEBUG
 	sbc_print_internals(&sbc);
 #endif
 
-	/* Writing MTU should be big enough to contain RTP header, SBC payload
-	 * header and at least one SBC frame. In general, there is no constraint
-	 * for the MTU value, but the speed might suffer significantly. */
-	const size_t rtp_headers_len = RTP_HEADER_LEN + sizeof(rtp_media_header_t);
-	const size_t mtu_write_payload_len = t->mtu_write - rtp_headers_len;
-	const size_t sbc_frame_len = sbc_get_frame_length(&sbc);
-
-	size_t ffb_pcm_len = sbc_frame_samples;
-	if (mtu_write_payload_len / sbc_frame_len > 1)
-		/* account for possible SBC frames packing */
-		ffb_pcm_len *= mtu_write_payload_len / sbc_frame_len;
+	size_t sbc_frame_len = sbc_get_frame_length(&sbc);
+	size_t sbc_packet_frames = a2dp_sbc_get_packet_frames(&sbc,
+			bitpool_ctrl.bitpool, mtu_write_payload_len);
+	/* The PCM buffer shall be big enough for the RTP packet with the
+	 * biggest number of SBC frames, i.e. at the lowest bit-pool. */
+	const size_t ffb_pcm_len = sbc_frame_samples * a2dp_sbc_get_packet_frames(&sbc,
+			bitpool_ctrl.min, mtu_write_payload_len);
 
 	if (mtu_write_payload_len < sbc_frame_len)
 		warn("Writing MTU too small for one single SBC frame: %zu < %zu",
@@ -183,6 +216,10 @@ void *a2dp_sbc_enc_thread(struct ba_transport_pcm *t_pcm) {
 	t_pcm->codec_delay_dms = sbc_delay_frames * 10000 / rate;
 	ba_transport_pcm_delay_sync(t_pcm, BA_DBUS_PCM_UPDATE_DELAY);
 
+	/* report effective bit rate of the encoder */
+	t_pcm->bitrate = 8 * sbc_frame_len * rate / (sbc_frame_samples / channels);
+	bluealsa_dbus_pcm_update(t_pcm, BA_DBUS_PCM_UPDATE_BITRATE);
+
 	rtp_header_t *rtp_header;
 	rtp_media_header_t *rtp_media_header;
 
@@ -201,7 +238,7 @@ void *a2dp_sbc_enc_thread(struct ba_transport_pcm *t_pcm) {
 		case -1:
 			if (errno == ESTALE) {
 				sbc_reinit_a2dp(&sbc, 0, configuration, sizeof(*configuration));
-				sbc.bitpool = sbc_a2dp_get_bitpool(configuration, config.sbc_quality);
+				sbc.bitpool = bitpool_ctrl.bitpool;
 				sbc.endian = SBC_LE;
 				continue;
 			}
@@ -212,47 +249,63 @@ void *a2dp_sbc_enc_thread(struct ba_transport_pcm *t_pcm) {
 			continue;
 		}
 
-		/* anchor for RTP payload */
-		bt.tail = rtp_payload;
-
 		const int16_t *input = pcm.data;
 		size_t input_samples = ffb_len_out(&pcm);
-		size_t output_len = ffb_len_in(&bt);
-		size_t pcm_frames = 0;
-		size_t sbc_frames = 0;
-
-		/* Generate as many SBC frames as possible, but less than a 4-bit media
-		 * header frame counter can contain. The size of the output buffer is
-		 * based on the socket MTU, so such transfer should be most efficient. */
-		while (input_samples >= sbc_frame_samples &&
-				output_len >= sbc_frame_len &&
-				/* do not overflow RTP frame counter */
-				sbc_frames < ((1 << 4) - 1)) {
-
-			ssize_t len;
-			ssize_t encoded;
-
-			if ((len = sbc_encode(&sbc, input, input_samples * sizeof(int16_t),
-							bt.tail, output_len, &encoded)) < 0) {
-				error("SBC encoding error: %s", sbc_strerror(len));
-				break;
-			}
 
-			len = len / sizeof(int16_t);
-			input += len;
-			input_samples -= len;
-			ffb_seek(&bt, encoded);
-			output_len -= encoded;
-			pcm_frames += len / channels;
-			sbc_frames++;
+		/* Send only complete RTP packets. The number of SBC frames in every
+		 * packet is planned to fill the writing MTU as much as possible, but
+		 * it has to be less than a 4-bit media header frame counter can
+		 * contain. Such transfer should be most efficient. */
+		while (input_samples >= sbc_packet_frames * sbc_frame_samples) {
 
-		}
+			/* anchor for RTP payload */
+			bt.tail = rtp_payload;
 
-		if (sbc_frames > 0) {
+			size_t output_len = ffb_len_in(&bt);
+			size_t pcm_frames = 0;
+			size_t sbc_frames = 0;
+
+			trace_event(BA_TRACE_EVENT_ENCODE_BEGIN, input_samples, 0);
+
+			while (sbc_frames < sbc_packet_frames &&
+					output_len >= sbc_frame_len) {
+
+				ssize_t len;
+				ssize_t encoded;
+
+				if ((len = sbc_encode(&sbc, input, input_samples * sizeof(int16_t),
+								bt.tail, output_len, &encoded)) < 0) {
+					error("SBC encoding error: %s", sbc_strerror(len));
+					break;
+				}
+
+				len = len / sizeof(int16_t);
+				input += len;
+				input_samples -= len;
+				ffb_seek(&bt, encoded);
+				output_len -= encoded;
+				pcm_frames += len / channels;
+				sbc_frames++;
+
+			}
+
+			trace_event(BA_TRACE_EVENT_ENCODE_END, ffb_blen_out(&bt), sbc_frames);
+
+			if (sbc_frames == 0)
+				break;
 
 			rtp_state_new_frame(&rtp, rtp_header);
 			rtp_media_header->frame_count = sbc_frames;
 
+			/* Try to get the number of bytes queued in the
+			 * socket output buffer. */
+			int queued_bytes = 0;
+			if (config.sbc_dynamic_bitpool &&
+					ioctl(t->bt_fd, TIOCOUTQ, &queued_bytes) != -1)
+				queued_bytes = abs(t->media.bt_fd_coutq_init - queued_bytes);
+
+			errno = 0;
+
 			ssize_t len = ffb_blen_out(&bt);
 			if ((len = io_bt_write(t_pcm, bt.data, len)) <= 0) {
 				if (len == -1)
@@ -272,19 +325,39 @@ void *a2dp_sbc_enc_thread(struct ba_transport_pcm *t_pcm) {
 				io.initiated = true;
 			}
 
+			if (errno == EAGAIN)
+				/* The io_bt_write() call was blocking due to not enough
+				 * space in the BT socket. Assume heavy congestion. */
+				queued_bytes = 2 * SBC_BITPOOL_CTRL_CONGESTION * t->mtu_write;
+
+			if (config.sbc_dynamic_bitpool &&
+					sbc_bitpool_ctrl_update(&bitpool_ctrl, queued_bytes / t->mtu_write)) {
+
+				sbc.bitpool = bitpool_ctrl.bitpool;
+				sbc_frame_len = sbc_get_frame_length(&sbc);
+				sbc_packet_frames = a2dp_sbc_get_packet_frames(&sbc,
+						bitpool_ctrl.bitpool, mtu_write_payload_len);
+
+				t_pcm->bitrate = 8 * sbc_frame_len * rate / (sbc_frame_samples / channels);
+				debug("SBC bit-pool: %u (%u bps, %zu frames per packet)",
+						sbc.bitpool, t_pcm->bitrate, sbc_packet_frames);
+				bluealsa_dbus_pcm_update(t_pcm, BA_DBUS_PCM_UPDATE_BITRATE);
+
+			}
+
 			/* Keep data transfer at a constant bit rate. */
 			asrsync_sync(&io.asrs, pcm_frames);
 			/* move forward RTP timestamp clock */
 			rtp_state_update(&rtp, pcm_frames);
 
-			/* If the input buffer was not consumed (due to codesize limit), we
-			 * have to append new data to the existing one. Since we do not use
-			 * ring buffer, we will simply move unprocessed data to the front
-			 * of our linear buffer. */
-			ffb_shift(&pcm, pcm_frames * channels);
-
 		}
 
+		/* If the input buffer was not consumed (not enough data for the whole
+		 * RTP packet), we have to append new data to the existing one. Since
+		 * we do not use ring buffer, we will simply move unprocessed data to
+		 * the front of our linear buffer. */
+		ffb_shift(&pcm, input - (const int16_t *)pcm.data);
+
 	}
 
 fail:
@@ -374,11 +447,13 @@ void *a2dp_sbc_dec_thread(struct ba_transport_pcm *t_pcm) {
 		while (frames--) {
 
 			size_t decoded;
+			trace_event(BA_TRACE_EVENT_DECODE_BEGIN, rtp_payload_len, 0);
 			if ((len = sbc_decode(&sbc, rtp_payload, rtp_payload_len,
 							pcm.data, ffb_blen_in(&pcm), &decoded)) < 0) {
 				error("SBC decoding error: %s", sbc_strerror(len));
 				break;
 			}
+			trace_event(BA_TRACE_EVENT_DECODE_END, decoded / sizeof(int16_t), 0);
 
 #if DEBUG
 			if (sbc_bitpool != sbc.bitpool) {
@@ -391,7 +466,6 @@ void *a2dp_sbc_dec_thread(struct ba_transport_pcm *t_pcm) {
 			rtp_payload_len -= len;
 
 			const size_t samples = decoded / sizeof(int16_t);
-			io_pcm_scale(t_pcm, pcm.data, samples);
 			if (io_pcm_write(t_pcm, pcm.data, samples) == -1)
 				error("PCM write error: %s", strerror(errno));
 
@@ -16,9 +16,17 @@
 # include <config.h>
 #endif
 
+#include <stddef.h>
+#include <stdint.h>
+
+#include <sbc/sbc.h>
+
 #include "a2dp.h"
 
 extern struct a2dp_sep a2dp_sbc_source;
 extern struct a2dp_sep a2dp_sbc_sink;
 
+size_t a2dp_sbc_get_packet_frames(sbc_t *sbc, uint8_t bitpool,
+		size_t mtu_payload_len);
+
 #endif
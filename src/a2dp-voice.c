@@ -0,0 +1,238 @@
+/*
+ * BlueALSA - a2dp-voice.c
+ * Copyright (c) 2016-2025 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include "a2dp-voice.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <sbc/sbc.h>
+
+#include "ba-transport.h"
+#include "ba-transport-pcm.h"
+#include "bluealsa-dbus.h"
+#include "codec-sbc.h"
+#include "io.h"
+#include "trace.h"
+#include "shared/defs.h"
+#include "shared/ffb.h"
+#include "shared/log.h"
+#include "shared/rt.h"
+
+/**
+ * Maximum number of mSBC frames carried by a single voice packet. */
+#define A2DP_VOICE_MSBC_FRAMES_MAX 3
+
+void *a2dp_voice_msbc_enc_thread(struct ba_transport_pcm *t_pcm) {
+
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	pthread_cleanup_push(PTHREAD_CLEANUP(ba_transport_pcm_thread_cleanup), t_pcm);
+
+	struct ba_transport *t = t_pcm->t;
+	struct io_poll io = { .timeout = -1 };
+
+	sbc_t sbc;
+	if ((errno = -sbc_init_msbc(&sbc, 0)) != 0) {
+		error("Couldn't initialize mSBC voice codec: %s", strerror(errno));
+		goto fail_init;
+	}
+
+	sbc.endian = SBC_LE;
+
+	ffb_t bt = { 0 };
+	ffb_t pcm = { 0 };
+	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &bt);
+	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &pcm);
+	pthread_cleanup_push(PTHREAD_CLEANUP(sbc_finish), &sbc);
+
+	const size_t sbc_frame_len = sbc_get_frame_length(&sbc);
+	const size_t sbc_frame_samples = sbc_get_codesize(&sbc) / sizeof(int16_t);
+	const unsigned int channels = t_pcm->channels;
+
+	if (ffb_init_int16_t(&pcm, sbc_frame_samples * A2DP_VOICE_MSBC_FRAMES_MAX) == -1 ||
+			ffb_init_uint8_t(&bt, t->mtu_write) == -1) {
+		error("Couldn't create data buffers: %s", strerror(ENOMEM));
+		goto fail_ffb;
+	}
+
+	debug_transport_pcm_thread_loop(t_pcm, "START");
+	for (ba_transport_pcm_state_set_running(t_pcm);;) {
+
+		switch (io_poll_and_read_pcm(&io, t_pcm, &pcm)) {
+		case -1:
+			if (errno == ESTALE) {
+				sbc_reinit_msbc(&sbc, 0);
+				sbc.endian = SBC_LE;
+				continue;
+			}
+			error("PCM poll and read error: %s", strerror(errno));
+			/* fall-through */
+		case 0:
+			ba_transport_stop_if_no_clients(t);
+			continue;
+		}
+
+		const int16_t *input = pcm.data;
+		size_t input_len = ffb_len_out(&pcm);
+		size_t output_len = ffb_len_in(&bt);
+		size_t pcm_frames = 0;
+		size_t sbc_frames = 0;
+
+		trace_event(BA_TRACE_EVENT_ENCODE_BEGIN, input_len, 0);
+
+		while (input_len >= sbc_frame_samples &&
+				output_len >= sbc_frame_len &&
+				sbc_frames < A2DP_VOICE_MSBC_FRAMES_MAX) {
+
+			ssize_t len;
+			ssize_t encoded;
+
+			if ((len = sbc_encode(&sbc, input, input_len * sizeof(int16_t),
+							bt.tail, output_len, &encoded)) < 0) {
+				error("mSBC voice encoding error: %s", sbc_strerror(len));
+				break;
+			}
+
+			len = len / sizeof(int16_t);
+			input += len;
+			input_len -= len;
+			ffb_seek(&bt, encoded);
+			output_len -= encoded;
+			pcm_frames += len / channels;
+			sbc_frames += 1;
+
+		}
+
+		trace_event(BA_TRACE_EVENT_ENCODE_END, ffb_blen_out(&bt), sbc_frames);
+
+		if (sbc_frames > 0) {
+
+			ssize_t len = ffb_blen_out(&bt);
+			if ((len = io_bt_write(t_pcm, bt.data, len)) <= 0) {
+				if (len == -1)
+					error("BT write error: %s", strerror(errno));
+				goto fail;
+			}
+
+			if (!io.initiated) {
+				/* Get the delay due to codec processing. */
+				t_pcm->processing_delay_dms = asrsync_get_dms_since_last_sync(&io.asrs);
+				ba_transport_pcm_delay_sync(t_pcm, BA_DBUS_PCM_UPDATE_DELAY);
+				io.initiated = true;
+			}
+
+			ffb_rewind(&bt);
+
+			/* Keep data transfer in sync with the main stream. */
+			io_bc_sync(&io, t_pcm, pcm_frames);
+
+			/* Move unprocessed data to the front of our linear buffer. */
+			ffb_shift(&pcm, pcm_frames * channels);
+
+		}
+
+	}
+
+fail:
+	debug_transport_pcm_thread_loop(t_pcm, "EXIT");
+fail_ffb:
+	pthread_cleanup_pop(1);
+	pthread_cleanup_pop(1);
+	pthread_cleanup_pop(1);
+fail_init:
+	pthread_cleanup_pop(1);
+	return NULL;
+}
+
+__attribute__ ((weak))
+void *a2dp_voice_msbc_dec_thread(struct ba_transport_pcm *t_pcm) {
+
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	pthread_cleanup_push(PTHREAD_CLEANUP(ba_transport_pcm_thread_cleanup), t_pcm);
+
+	struct ba_transport *t = t_pcm->t;
+	struct io_poll io = { .timeout = -1 };
+
+	sbc_t sbc;
+	if ((errno = -sbc_init_msbc(&sbc, 0)) != 0) {
+		error("Couldn't initialize mSBC voice codec: %s", strerror(errno));
+		goto fail_init;
+	}
+
+	sbc.endian = SBC_LE;
+
+	const size_t sbc_frame_len = sbc_get_frame_length(&sbc);
+	const size_t sbc_frame_samples = sbc_get_codesize(&sbc) / sizeof(int16_t);
+
+	ffb_t bt = { 0 };
+	ffb_t pcm = { 0 };
+	pthread_cleanup_push(PTHREAD_CLEANUP(sbc_finish), &sbc);
+	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &bt);
+	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &pcm);
+
+	if (ffb_init_int16_t(&pcm, sbc_frame_samples) == -1 ||
+			ffb_init_uint8_t(&bt, t->mtu_read) == -1) {
+		error("Couldn't create data buffers: %s", strerror(errno));
+		goto fail_ffb;
+	}
+
+	debug_transport_pcm_thread_loop(t_pcm, "START");
+	for (ba_transport_pcm_state_set_running(t_pcm);;) {
+
+		ssize_t len;
+		ffb_rewind(&bt);
+		if ((len = io_poll_and_read_bt(&io, t_pcm, &bt)) <= 0) {
+			if (len == -1)
+				error("BT poll and read error: %s", strerror(errno));
+			goto fail;
+		}
+
+		if (!ba_transport_pcm_is_active(t_pcm))
+			continue;
+
+		uint8_t *input = bt.data;
+		size_t input_len = len;
+
+		while (input_len >= sbc_frame_len) {
+
+			size_t decoded;
+			trace_event(BA_TRACE_EVENT_DECODE_BEGIN, input_len, 0);
+			if ((len = sbc_decode(&sbc, input, input_len,
+							pcm.data, ffb_blen_in(&pcm), &decoded)) < 0) {
+				error("mSBC voice decoding error: %s", sbc_strerror(len));
+				break;
+			}
+			trace_event(BA_TRACE_EVENT_DECODE_END, decoded / sizeof(int16_t), 0);
+
+			input += len;
+			input_len -= len;
+
+			const size_t samples = decoded / sizeof(int16_t);
+			if (io_pcm_write(t_pcm, pcm.data, samples) == -1)
+				error("PCM write error: %s", strerror(errno));
+
+		}
+
+	}
+
+fail:
+	debug_transport_pcm_thread_loop(t_pcm, "EXIT");
+fail_ffb:
+	pthread_cleanup_pop(1);
+	pthread_cleanup_pop(1);
+	pthread_cleanup_pop(1);
+fail_init:
+	pthread_cleanup_pop(1);
+	return NULL;
+}
@@ -0,0 +1,24 @@
+/*
+ * BlueALSA - a2dp-voice.h
+ * Copyright (c) 2016-2025 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#pragma once
+#ifndef BLUEALSA_A2DPVOICE_H_
+#define BLUEALSA_A2DPVOICE_H_
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "ba-transport-pcm.h"
+
+void *a2dp_voice_msbc_enc_thread(struct ba_transport_pcm *t_pcm);
+void *a2dp_voice_msbc_dec_thread(struct ba_transport_pcm *t_pcm);
+
+#endif
@@ -26,6 +26,9 @@
 #if ENABLE_APTX_HD
 # include "a2dp-aptx-hd.h"
 #endif
+#if ENABLE_APTX_LL
+# include "a2dp-aptx-ll.h"
+#endif
 #if ENABLE_FASTSTREAM
 # include "a2dp-faststream.h"
 #endif
@@ -46,6 +49,7 @@
 #endif
 #include "a2dp-sbc.h"
 #include "ba-config.h"
+#include "codec-lib.h"
 #include "shared/a2dp-codecs.h"
 #include "shared/log.h"
 
@@ -205,6 +209,8 @@ bool a2dp_caps_has_main_stream_only(
 
 struct a2dp_sep * const a2dp_seps[] = {
 #if ENABLE_OPUS
+	&a2dp_opus_pw_source,
+	&a2dp_opus_pw_sink,
 	&a2dp_opus_source,
 	&a2dp_opus_sink,
 #endif
@@ -228,6 +234,12 @@ struct a2dp_sep * const a2dp_seps[] = {
 	&a2dp_aptx_hd_sink,
 # endif
 #endif
+#if ENABLE_APTX_LL
+	&a2dp_aptx_ll_source,
+# if HAVE_APTX_DECODE
+	&a2dp_aptx_ll_sink,
+# endif
+#endif
 #if ENABLE_APTX
 	&a2dp_aptx_source,
 # if HAVE_APTX_DECODE
@@ -273,6 +285,13 @@ int a2dp_seps_init(void) {
 			break;
 		}
 
+		/* Do not register SEP with BlueZ if the codec library is not
+		 * available, otherwise every SetConfiguration call would fail. */
+		if (sep->enabled && codec_lib_probe_all(sep->libs) != 0) {
+			warn("Disabling %s: Codec library not available", sep->name);
+			sep->enabled = false;
+		}
+
 		if (sep->init != NULL && sep->enabled)
 			if (sep->init(sep) != 0)
 				return -1;
@@ -23,6 +23,8 @@
 #include <sys/types.h>
 
 #include "ba-transport-pcm.h"
+#include "bluealsa-codec.h"
+#include "codec-lib.h"
 #include "shared/a2dp-codecs.h"
 
 /**
@@ -190,6 +192,13 @@ struct a2dp_sep {
 	/* Codec-specific capabilities helper functions. */
 	const struct a2dp_caps_helpers *caps_helpers;
 
+	/* External codec module which overrides built-in codec. */
+	const struct bluealsa_codec_module *module;
+
+	/* NULL-terminated list of libraries used by the codec, which
+	 * shall be loaded on the first use of this SEP */
+	struct codec_lib * const *libs;
+
 	/* determine whether SEP shall be enabled */
 	bool enabled;
 
@@ -825,6 +825,25 @@ static int bluealsa_fix_hw_params(snd_pcm_ioplug_t *io, snd_pcm_hw_params_t *par
 }
 #endif
 
+static uint16_t get_ba_pcm_format(snd_pcm_format_t format) {
+	switch (format) {
+	case SND_PCM_FORMAT_U8:
+		return 0x0108;
+	case SND_PCM_FORMAT_S16_LE:
+		return 0x8210;
+	case SND_PCM_FORMAT_S24_3LE:
+		return 0x8318;
+	case SND_PCM_FORMAT_S24_LE:
+		return 0x8418;
+	case SND_PCM_FORMAT_S32_LE:
+		return 0x8420;
+	case SND_PCM_FORMAT_FLOAT_LE:
+		return 0xA420;
+	default:
+		return 0;
+	}
+}
+
 static int bluealsa_hw_params(snd_pcm_ioplug_t *io, snd_pcm_hw_params_t *params) {
 	struct bluealsa_pcm *pcm = io->private_data;
 
@@ -899,8 +918,17 @@ static int bluealsa_hw_params(snd_pcm_ioplug_t *io, snd_pcm_hw_params_t *params)
 		area->step = pcm_frame_size * 8;
 	}
 
-	if (!ba_dbus_pcm_open(&pcm->dbus_ctx, pcm->ba_pcm.pcm_path,
-				&pcm->ba_pcm_fd, &pcm->ba_pcm_ctrl_fd, &err)) {
+	/* If the selected format is not the BlueALSA PCM native format, ask
+	 * the server to convert audio samples, so that the ALSA plug layer
+	 * does not need to do an extra conversion on the client side. */
+	const uint16_t format = get_ba_pcm_format(io->format);
+	dbus_bool_t opened = format == pcm->ba_pcm.format ?
+		ba_dbus_pcm_open(&pcm->dbus_ctx, pcm->ba_pcm.pcm_path,
+				&pcm->ba_pcm_fd, &pcm->ba_pcm_ctrl_fd, &err) :
+		ba_dbus_pcm_open_with_format(&pcm->dbus_ctx, pcm->ba_pcm.pcm_path,
+				format, &pcm->ba_pcm_fd, &pcm->ba_pcm_ctrl_fd, &err);
+
+	if (!opened) {
 		debug2("Couldn't open PCM: %s", err.message);
 		ret = -dbus_error_to_errno(&err);
 		dbus_error_free(&err);
@@ -1648,6 +1676,8 @@ static snd_pcm_format_t get_snd_pcm_format(uint16_t format) {
 		return SND_PCM_FORMAT_S24_LE;
 	case 0x8420:
 		return SND_PCM_FORMAT_S32_LE;
+	case 0xA420:
+		return SND_PCM_FORMAT_FLOAT_LE;
 	default:
 		SNDERR("Unknown PCM format: %#x", format);
 		return SND_PCM_FORMAT_UNKNOWN;
@@ -1706,9 +1736,30 @@ static int bluealsa_set_hw_constraint(struct bluealsa_pcm *pcm) {
 					ARRAYSIZE(accesses), accesses)) < 0)
 		return err;
 
-	unsigned int formats[] = { get_snd_pcm_format(pcm->ba_pcm.format) };
+	/* Formats which can be converted by the server. The native format
+	 * of the BlueALSA PCM shall be first on the list. */
+	static const snd_pcm_format_t convertible[] = {
+		SND_PCM_FORMAT_S16_LE,
+		SND_PCM_FORMAT_S24_LE,
+		SND_PCM_FORMAT_S32_LE,
+		SND_PCM_FORMAT_FLOAT_LE,
+	};
+
+	const snd_pcm_format_t format = get_snd_pcm_format(pcm->ba_pcm.format);
+	unsigned int formats[1 + ARRAYSIZE(convertible)] = { format };
+	size_t formats_len = 1;
+
+	bool is_convertible = false;
+	for (size_t i = 0; i < ARRAYSIZE(convertible); i++)
+		if (convertible[i] == format)
+			is_convertible = true;
+
+	for (size_t i = 0; is_convertible && i < ARRAYSIZE(convertible); i++)
+		if (convertible[i] != format)
+			formats[formats_len++] = convertible[i];
+
 	if ((err = snd_pcm_ioplug_set_param_list(io, SND_PCM_IOPLUG_HW_FORMAT,
-					ARRAYSIZE(formats), formats)) < 0)
+					formats_len, formats)) < 0)
 		return err;
 
 	if ((err = snd_pcm_ioplug_set_param_minmax(io, SND_PCM_IOPLUG_HW_PERIODS,
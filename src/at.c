@@ -12,11 +12,11 @@
 #include "at.h"
 
 #include <ctype.h>
+#include <errno.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <strings.h>
 
 #include "shared/defs.h"
 #include "shared/log.h"
@@ -81,104 +81,223 @@ char *at_build(char *buffer, size_t size, enum bt_at_type type,
 }
 
 /**
- * Parse AT message.
+ * Initialize incremental AT message parser.
  *
- * @param str String to parse.
+ * @param parser Address of the parser structure.
  * @param at Address of the AT structure, where the parsed information will
- *   be stored.
- * @return On success this function returns a pointer to the next message
- *   within the input string. If the input string contains only one message,
- *   returned value will point to the end null byte. On error, this function
- *   returns NULL. */
-char *at_parse(const char *str, struct bt_at *at) {
+ *   be stored. The same structure is used until the parser is initialized
+ *   once more, so it shall not be modified by the caller. */
+void at_parser_init(struct at_parser *parser, struct bt_at *at) {
+	parser->state = AT_PARSER_STATE_IDLE;
+	parser->at = at;
+	parser->len = 0;
+}
 
-	char *command = at->command;
-	bool is_command = false;
-	const char *feed;
-	char *tmp;
+/**
+ * Store single character in the AT command buffer.
+ *
+ * One byte is reserved for the null terminator and one byte is reserved for
+ * the unsolicited result code, which is stored with an empty command. */
+static bool at_parser_put(struct at_parser *parser, char c) {
+	if (parser->len >= sizeof(parser->at->command) - 2) {
+		parser->state = AT_PARSER_STATE_DISCARD;
+		return false;
+	}
+	parser->at->command[parser->len++] = c;
+	return true;
+}
 
-	/* locate <CR> character, which indicates end of message */
-	if ((feed = strchr(str, '\r')) == NULL)
-		return NULL;
+/**
+ * Finalize AT message upon receiving the <CR> character. */
+static int at_parser_finish(struct at_parser *parser) {
 
-	/* consume empty message */
-	if (feed == str)
-		return at_parse(feed + 1, at);
+	struct bt_at *at = parser->at;
+	char *command = at->command;
+	ssize_t sep;
 
-	/* check whether we are parsing AT command */
-	if (strncasecmp(str, "AT", 2) == 0) {
-		is_command = true;
-		str += 2;
-	}
-	else {
-		/* response starts with <LF> sequence */
-		if (str[0] != '\n')
-			return NULL;
-		str += 1;
+	switch (parser->state) {
+	case AT_PARSER_STATE_CMD_EQ:
+		at->type = AT_TYPE_CMD_SET;
+		at->value = &command[parser->len];
+		break;
+	case AT_PARSER_STATE_CMD:
+	case AT_PARSER_STATE_CMD_VALUE:
+	case AT_PARSER_STATE_CMD_SKIP:
+		break;
+	case AT_PARSER_STATE_RESP:
+		/* Split response on the first colon character. If there is no colon,
+		 * provide support for GSM standard, which uses equal sign. */
+		if ((sep = parser->colon) == -1)
+			sep = parser->equal;
+		if (sep != -1) {
+			command[sep] = '\0';
+			at->value = &command[sep + 1];
+			for (ssize_t i = 0; i < sep; i++)
+				command[i] = toupper(command[i]);
+		}
+		else {
+			/* unsolicited (with empty command) result code */
+			at->value = memmove(&command[1], command, parser->len);
+			command[0] = '\0';
+			parser->len++;
+		}
+		break;
+	default:
+		errno = EBADMSG;
+		return -1;
 	}
 
-	strncpy(command, str, sizeof(at->command) - 1);
-	at->value = NULL;
+	command[parser->len] = '\0';
 
-	/* check everything twice (we don't want to be hacked) */
-	if ((size_t)(feed - str) < sizeof(at->command))
-		command[feed - str] = '\0';
+	debug("AT message: %s: command=%s value=%s",
+			at_type2str(at->type), at->command, at->value);
+	return 1;
+}
 
-	if (is_command) {
+/**
+ * Feed incremental AT message parser with data.
+ *
+ * This function consumes the data until the end of the first complete
+ * message. The data might be split at arbitrary positions, the parser will
+ * resume parsing with the next call. In case of an invalid message, the
+ * parser discards all data up to the <CR> character, so it will synchronize
+ * with the next message.
+ *
+ * @param parser Address of the initialized parser structure.
+ * @param data Address of the pointer to the data. On return, the pointer
+ *   is moved past the consumed data.
+ * @param len Address of the data length. On return, it is decreased by the
+ *   number of consumed bytes.
+ * @return This function returns 1 if the complete message was parsed, or
+ *   0 if all data was consumed and more data is required. On error, -1 is
+ *   returned and errno is set to EBADMSG. */
+int at_parser_feed(struct at_parser *parser, const char **data, size_t *len) {
+
+	struct bt_at *at = parser->at;
+	const char *ptr = *data;
+	const char *end = ptr + *len;
+	int rv = 0;
+
+	while (rv == 0 && ptr < end) {
+
+		const char c = *ptr++;
+
+		switch (parser->state) {
+		case AT_PARSER_STATE_RESP_LF:
+			/* consume <LF> from the end of the message */
+			parser->state = AT_PARSER_STATE_IDLE;
+			if (c == '\n')
+				continue;
+			/* fall-through */
+		case AT_PARSER_STATE_IDLE:
+			/* consume empty message */
+			if (c == '\r')
+				continue;
+			parser->len = 0;
+			at->value = NULL;
+			if (c == '\n') {
+				/* response starts with <LF> sequence */
+				at->type = AT_TYPE_RESP;
+				parser->state = AT_PARSER_STATE_RESP;
+				parser->colon = -1;
+				parser->equal = -1;
+			}
+			else if (c == 'A' || c == 'a')
+				parser->state = AT_PARSER_STATE_CMD_A;
+			else
+				parser->state = AT_PARSER_STATE_DISCARD;
+			continue;
+		default:
+			break;
+		}
 
-		/* determine command type */
-		if ((tmp = strchr(command, '=')) != NULL) {
-			if (tmp[1] == '?')
-				at->type = AT_TYPE_CMD_TEST;
-			else {
-				at->type = AT_TYPE_CMD_SET;
-				at->value = tmp + 1;
+		if (c == '\r') {
+			rv = at_parser_finish(parser);
+			/* Response shall be terminated with the <CR><LF> sequence. However,
+			 * some devices terminate commands in the same way, so we will consume
+			 * the <LF> regardless of the message type. */
+			parser->state = AT_PARSER_STATE_RESP_LF;
+			if (ptr < end && *ptr == '\n') {
+				parser->state = AT_PARSER_STATE_IDLE;
+				ptr++;
 			}
+			continue;
 		}
-		else if ((tmp = strchr(command, '?')) != NULL)
-			at->type = AT_TYPE_CMD_GET;
-		else
-			at->type = AT_TYPE_CMD;
 
-		if (tmp != NULL)
-			*tmp = '\0';
+		switch (parser->state) {
+		case AT_PARSER_STATE_CMD_A:
+			at->type = AT_TYPE_CMD;
+			parser->state = AT_PARSER_STATE_CMD;
+			if (c != 'T' && c != 't')
+				parser->state = AT_PARSER_STATE_DISCARD;
+			break;
+		case AT_PARSER_STATE_CMD:
+			/* In the BT specification, all AT commands are in uppercase letters.
+			 * However, if someone will not respect this "convention", we will make
+			 * life easier by converting received command to all uppercase. */
+			if (c == '=') {
+				if (at_parser_put(parser, '\0'))
+					parser->state = AT_PARSER_STATE_CMD_EQ;
+			}
+			else if (c == '?') {
+				at->type = AT_TYPE_CMD_GET;
+				parser->state = AT_PARSER_STATE_CMD_SKIP;
+			}
+			else
+				at_parser_put(parser, toupper(c));
+			break;
+		case AT_PARSER_STATE_CMD_EQ:
+			if (c == '?') {
+				at->type = AT_TYPE_CMD_TEST;
+				parser->state = AT_PARSER_STATE_CMD_SKIP;
+				break;
+			}
+			at->type = AT_TYPE_CMD_SET;
+			at->value = &at->command[parser->len];
+			if (at_parser_put(parser, c))
+				parser->state = AT_PARSER_STATE_CMD_VALUE;
+			break;
+		case AT_PARSER_STATE_CMD_VALUE:
+			at_parser_put(parser, c);
+			break;
+		case AT_PARSER_STATE_RESP:
+			if (c == ':' && parser->colon == -1)
+				parser->colon = parser->len;
+			if (c == '=' && parser->equal == -1)
+				parser->equal = parser->len;
+			at_parser_put(parser, c);
+			break;
+		default:
+			break;
+		}
 
 	}
-	else {
 
-		at->type = AT_TYPE_RESP;
-
-		if ((tmp = strchr(command, ':')) == NULL)
-			/* provide support for GSM standard */
-			tmp = strchr(command, '=');
-
-		if (tmp != NULL) {
-			at->value = tmp + 1;
-			*tmp = '\0';
-		}
-		else {
-			/* unsolicited (with empty command) result code */
-			at->value = memmove(command + 1, command, sizeof(at->command) - 1);
-			command[0] = command[sizeof(at->command) - 1] = '\0';
-		}
+	*len -= ptr - *data;
+	*data = ptr;
+	return rv;
+}
 
-		/* consume <LF> from the end of the response */
-		if (feed[1] == '\n')
-			feed++;
+/**
+ * Parse AT message.
+ *
+ * @param str String to parse.
+ * @param at Address of the AT structure, where the parsed information will
+ *   be stored.
+ * @return On success this function returns a pointer to the next message
+ *   within the input string. If the input string contains only one message,
+ *   returned value will point to the end null byte. On error, this function
+ *   returns NULL. */
+char *at_parse(const char *str, struct bt_at *at) {
 
-	}
+	struct at_parser parser;
+	size_t len = strlen(str);
 
-	/* In the BT specification, all AT commands are in uppercase letters.
-	 * However, if someone will not respect this "convention", we will make
-	 * life easier by converting received command to all uppercase. */
-	while (*command != '\0') {
-		*command = toupper(*command);
-		command++;
-	}
+	at_parser_init(&parser, at);
+	if (at_parser_feed(&parser, &str, &len) != 1)
+		return NULL;
 
-	debug("AT message: %s: command=%s value=%s",
-			at_type2str(at->type), at->command, at->value);
-	return (char *)&feed[1];
+	return (char *)str;
 }
 
 /**
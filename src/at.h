@@ -1,6 +1,6 @@
 /*
  * BlueALSA - at.c
- * Copyright (c) 2016-2022 Arkadiusz Bokowy
+ * Copyright (c) 2016-2025 Arkadiusz Bokowy
  * Copyright (c) 2017 Juha Kuikka
  *
  * This file is a part of bluez-alsa.
@@ -16,6 +16,7 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <sys/types.h>
 
 #include "hfp.h"
 
@@ -35,11 +36,43 @@ struct bt_at {
 	char *value;
 };
 
+enum at_parser_state {
+	AT_PARSER_STATE_IDLE,
+	AT_PARSER_STATE_CMD_A,
+	AT_PARSER_STATE_CMD,
+	AT_PARSER_STATE_CMD_EQ,
+	AT_PARSER_STATE_CMD_VALUE,
+	AT_PARSER_STATE_CMD_SKIP,
+	AT_PARSER_STATE_RESP,
+	AT_PARSER_STATE_RESP_LF,
+	AT_PARSER_STATE_DISCARD,
+};
+
+/**
+ * Incremental AT message parser.
+ *
+ * The parser is fed with arbitrary chunks of data and stores parsed message
+ * directly in the associated AT structure, so the memory usage is bounded
+ * by the size of that structure. */
+struct at_parser {
+	enum at_parser_state state;
+	/* AT structure used for storing parsed message */
+	struct bt_at *at;
+	/* number of bytes stored in the command buffer */
+	size_t len;
+	/* offset of the first response separator or -1 */
+	ssize_t colon;
+	ssize_t equal;
+};
+
 const char *at_type2str(enum bt_at_type type);
 
 char *at_build(char *buffer, size_t size, enum bt_at_type type,
 		const char *command, const char *value);
 
+void at_parser_init(struct at_parser *parser, struct bt_at *at);
+int at_parser_feed(struct at_parser *parser, const char **data, size_t *len);
+
 char *at_parse(const char *str, struct bt_at *at);
 int at_parse_set_bia(const char *str, bool state[__HFP_IND_MAX]);
 int at_parse_get_cind(const char *str, enum hfp_ind map[20]);
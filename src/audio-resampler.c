@@ -0,0 +1,356 @@
+/*
+ * BlueALSA - audio-resampler.c
+ * Copyright (c) 2016-2025 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include "audio-resampler.h"
+
+#include <endian.h>
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "shared/defs.h"
+
+/* Number of filter taps per phase when the signal is upsampled. When
+ * the signal is downsampled, the filter is proportionally longer, so
+ * the transition band width relative to the output rate is the same. */
+#define AUDIO_RESAMPLER_TAPS 64
+#define AUDIO_RESAMPLER_TAPS_MAX 512
+/* Upper limit for the number of filter phases. */
+#define AUDIO_RESAMPLER_PHASES_MAX 1024
+
+/* Pass-band edge relative to the lower of the two Nyquist frequencies. */
+#define AUDIO_RESAMPLER_CUTOFF 0.92
+/* Kaiser window shape parameter for about 80 dB stop-band attenuation. */
+#define AUDIO_RESAMPLER_KAISER_BETA 8.0
+
+#define AUDIO_RESAMPLER_RATE_MIN 4000
+#define AUDIO_RESAMPLER_RATE_MAX 384000
+
+static float audio_resampler_f32_4le_load(const float *src) {
+	uint32_t v;
+	float f;
+	memcpy(&v, src, sizeof(v));
+	v = le32toh(v);
+	memcpy(&f, &v, sizeof(f));
+	return f;
+}
+
+static void audio_resampler_f32_4le_store(float *dest, float f) {
+	uint32_t v;
+	memcpy(&v, &f, sizeof(v));
+	v = htole32(v);
+	memcpy(dest, &v, sizeof(v));
+}
+
+static unsigned int gcd(unsigned int a, unsigned int b) {
+	while (b != 0) {
+		const unsigned int tmp = a % b;
+		a = b;
+		b = tmp;
+	}
+	return a;
+}
+
+/**
+ * Modified Bessel function of the first kind of order zero. */
+static double bessel_i0(double x) {
+	double sum = 1.0;
+	double term = 1.0;
+	for (unsigned int k = 1; k < 64; k++) {
+		const double tmp = x / (2 * k);
+		term *= tmp * tmp;
+		sum += term;
+		if (term < sum * 1e-12)
+			break;
+	}
+	return sum;
+}
+
+/**
+ * Get the number of filter taps per phase.
+ *
+ * The number of taps is rounded up to a multiple of 8, so the inner
+ * product loop has no remainder. */
+static unsigned int audio_resampler_get_taps(unsigned int up, unsigned int down) {
+	unsigned int taps = AUDIO_RESAMPLER_TAPS;
+	if (down > up)
+		taps = DIV_ROUND_UP(AUDIO_RESAMPLER_TAPS * down, up);
+	if (taps > AUDIO_RESAMPLER_TAPS_MAX)
+		taps = AUDIO_RESAMPLER_TAPS_MAX;
+	return DIV_ROUND_UP(taps, 8) * 8;
+}
+
+/**
+ * Design the polyphase low-pass filter.
+ *
+ * The prototype filter is a Kaiser-windowed sinc designed for the input
+ * rate multiplied by the number of phases. Coefficients of every phase are
+ * stored in the reversed order and they are normalized to the unity gain,
+ * so there is no DC ripple between phases. */
+static void audio_resampler_design(float *filter,
+		unsigned int up, unsigned int down, unsigned int taps) {
+
+	const size_t length = (size_t)up * taps;
+	const double center = (length - 1) / 2.0;
+	/* cut-off frequency in cycles per sample of the upsampled signal */
+	const double cutoff = AUDIO_RESAMPLER_CUTOFF * 0.5 *
+		(up < down ? (double)up / down : 1.0) / up;
+	const double i0_beta = bessel_i0(AUDIO_RESAMPLER_KAISER_BETA);
+
+	for (size_t p = 0; p < up; p++) {
+
+		float *coefs = &filter[p * taps];
+		double sum = 0.0;
+
+		for (size_t i = 0; i < taps; i++) {
+
+			const size_t n = p + (taps - 1 - i) * up;
+			const double x = 2 * M_PI * cutoff * (n - center);
+			const double sinc = x == 0.0 ? 1.0 : sin(x) / x;
+
+			const double k = 2.0 * n / (length - 1) - 1.0;
+			const double window = bessel_i0(AUDIO_RESAMPLER_KAISER_BETA *
+					sqrt(fmax(0.0, 1.0 - k * k))) / i0_beta;
+
+			sum += coefs[i] = sinc * window;
+
+		}
+
+		for (size_t i = 0; i < taps; i++)
+			coefs[i] /= sum;
+
+	}
+
+}
+
+/**
+ * Check whether sample rate conversion is supported.
+ *
+ * The number of filter phases depends on the ratio of the two sample rates
+ * reduced to the lowest terms, e.g. 160 phases for 44100 Hz to 48000 Hz
+ * conversion. Ratios which would require too many phases are rejected. */
+bool audio_resampler_is_supported(
+		unsigned int rate_in,
+		unsigned int rate_out) {
+
+	if (rate_in < AUDIO_RESAMPLER_RATE_MIN || rate_in > AUDIO_RESAMPLER_RATE_MAX ||
+			rate_out < AUDIO_RESAMPLER_RATE_MIN || rate_out > AUDIO_RESAMPLER_RATE_MAX)
+		return false;
+
+	return rate_out / gcd(rate_in, rate_out) <= AUDIO_RESAMPLER_PHASES_MAX;
+}
+
+/**
+ * Get the delay introduced by the resampler.
+ *
+ * @return The group delay of the resampler filter expressed in 1/10 of
+ *   millisecond. If conversion is not supported, 0 is returned. */
+unsigned int audio_resampler_delay_dms(
+		unsigned int rate_in,
+		unsigned int rate_out) {
+
+	if (!audio_resampler_is_supported(rate_in, rate_out))
+		return 0;
+
+	const unsigned int div = gcd(rate_in, rate_out);
+	const unsigned int taps = audio_resampler_get_taps(rate_out / div, rate_in / div);
+
+	/* Filter center is located half of the filter length
+	 * behind the most recent input frame. */
+	return (taps / 2) * 10000 / rate_in;
+}
+
+/**
+ * Initialize the resampler.
+ *
+ * @param r The resampler structure to initialize.
+ * @param channels The number of interleaved channels.
+ * @param rate_in The input sample rate.
+ * @param rate_out The output sample rate.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int audio_resampler_init(
+		struct audio_resampler *r,
+		unsigned int channels,
+		unsigned int rate_in,
+		unsigned int rate_out) {
+
+	if (channels == 0 || !audio_resampler_is_supported(rate_in, rate_out))
+		return errno = EINVAL, -1;
+
+	const unsigned int div = gcd(rate_in, rate_out);
+	const unsigned int up = rate_out / div;
+	const unsigned int down = rate_in / div;
+	const unsigned int taps = audio_resampler_get_taps(up, down);
+
+	float *filter;
+	if ((filter = malloc(sizeof(*filter) * up * taps)) == NULL)
+		return -1;
+
+	audio_resampler_design(filter, up, down, taps);
+
+	memset(r, 0, sizeof(*r));
+	r->channels = channels;
+	r->rate_in = rate_in;
+	r->rate_out = rate_out;
+	r->up = up;
+	r->down = down;
+	r->taps = taps;
+	r->filter = filter;
+
+	audio_resampler_reset(r);
+	return 0;
+}
+
+/**
+ * Release resources allocated by the resampler. */
+void audio_resampler_free(
+		struct audio_resampler *r) {
+	free(r->filter);
+	free(r->history);
+	memset(r, 0, sizeof(*r));
+}
+
+/**
+ * Reset the resampler history.
+ *
+ * After the reset, the resampler behaves as if it has been fed with
+ * silence, so there is no glitch at the beginning of the new stream. */
+void audio_resampler_reset(
+		struct audio_resampler *r) {
+	if (r->history != NULL)
+		memset(r->history, 0, sizeof(*r->history) * r->channels * r->history_size);
+	r->history_len = r->taps - 1;
+	r->phase = 0;
+}
+
+/**
+ * Get the maximum number of output frames for the given input. */
+size_t audio_resampler_frames_out_max(
+		const struct audio_resampler *r,
+		size_t frames) {
+	/* The history holds less than taps frames between the calls, so at most
+	 * all new frames can be consumed, plus one frame due to the phase. */
+	return DIV_ROUND_UP(frames * r->up, r->down) + 1;
+}
+
+/**
+ * Make sure that per-channel history can hold the given number of frames. */
+static int audio_resampler_history_resize(
+		struct audio_resampler *r,
+		size_t size) {
+
+	const unsigned int channels = r->channels;
+	float *history;
+
+	if ((history = calloc((size_t)channels * size, sizeof(*history))) == NULL)
+		return -1;
+
+	/* If there is no history yet, the newly allocated
+	 * buffer is filled with silence by the calloc(). */
+	if (r->history != NULL)
+		for (size_t c = 0; c < channels; c++)
+			memcpy(&history[c * size], &r->history[c * r->history_size],
+					sizeof(*history) * r->history_len);
+
+	free(r->history);
+	r->history = history;
+	r->history_size = size;
+	return 0;
+}
+
+/**
+ * Calculate the inner product of the filter and the signal.
+ *
+ * There are 8 independent accumulators, so the compiler is free to
+ * vectorize the loop even without relaxed floating-point semantics. */
+static float audio_resampler_dot(
+		const float * restrict coefs,
+		const float * restrict signal,
+		size_t taps) {
+
+	float acc[8] = { 0 };
+	for (size_t i = 0; i < taps; i += 8)
+		for (size_t j = 0; j < 8; j++)
+			acc[j] += coefs[i + j] * signal[i + j];
+
+	return ((acc[0] + acc[1]) + (acc[2] + acc[3])) +
+		((acc[4] + acc[5]) + (acc[6] + acc[7]));
+}
+
+/**
+ * Resample interleaved FLOAT_LE PCM signal.
+ *
+ * @param r The resampler structure.
+ * @param dest Address of the buffer for the resampled signal. The buffer
+ *   shall be big enough to hold the number of frames returned by the
+ *   audio_resampler_frames_out_max() function.
+ * @param src Address of the input signal.
+ * @param frames The number of input frames.
+ * @return On success this function returns the number of frames stored
+ *   in the destination buffer. Otherwise, -1 is returned and errno is set
+ *   to indicate the error. */
+ssize_t audio_resampler_process(
+		struct audio_resampler *r,
+		float *dest,
+		const float *src,
+		size_t frames) {
+
+	const unsigned int channels = r->channels;
+	const unsigned int taps = r->taps;
+
+	if (r->history_len + frames > r->history_size &&
+			audio_resampler_history_resize(r, r->history_len + frames) == -1)
+		return -1;
+
+	const size_t size = r->history_size;
+	const size_t len = r->history_len + frames;
+
+	/* Deinterleave new frames, so every channel
+	 * is processed as a contiguous signal. */
+	for (size_t c = 0; c < channels; c++) {
+		float *history = &r->history[c * size + r->history_len];
+		for (size_t i = 0; i < frames; i++)
+			history[i] = audio_resampler_f32_4le_load(&src[i * channels + c]);
+	}
+
+	unsigned int phase = r->phase;
+	size_t frames_out = 0;
+	size_t pos = 0;
+
+	while (pos + taps <= len) {
+
+		const float *coefs = &r->filter[phase * taps];
+		for (size_t c = 0; c < channels; c++)
+			audio_resampler_f32_4le_store(&dest[frames_out * channels + c],
+					audio_resampler_dot(coefs, &r->history[c * size + pos], taps));
+
+		frames_out++;
+		phase += r->down;
+		pos += phase / r->up;
+		phase %= r->up;
+
+	}
+
+	/* Keep frames which are required by the next output frame. */
+	const size_t keep = pos < len ? len - pos : 0;
+	for (size_t c = 0; c < channels; c++)
+		memmove(&r->history[c * size], &r->history[c * size + pos],
+				sizeof(*r->history) * keep);
+
+	r->history_len = keep;
+	r->phase = phase;
+
+	return frames_out;
+}
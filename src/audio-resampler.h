@@ -0,0 +1,84 @@
+/*
+ * BlueALSA - audio-resampler.h
+ * Copyright (c) 2016-2025 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#pragma once
+#ifndef BLUEALSA_AUDIORESAMPLER_H_
+#define BLUEALSA_AUDIORESAMPLER_H_
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/**
+ * Polyphase FIR sample rate converter.
+ *
+ * The converter operates on interleaved FLOAT_LE samples. The conversion
+ * ratio is fixed and it is given by the ratio of two integer sample rates,
+ * so there is no drift between the input and the output streams. */
+struct audio_resampler {
+
+	unsigned int channels;
+	unsigned int rate_in;
+	unsigned int rate_out;
+
+	/* interpolation (number of phases) and decimation factors */
+	unsigned int up;
+	unsigned int down;
+
+	/* number of filter taps per phase */
+	unsigned int taps;
+	/* filter coefficients, taps for every phase in the reversed order */
+	float *filter;
+
+	/* per-channel input history with space for new frames */
+	float *history;
+	size_t history_size;
+	size_t history_len;
+
+	/* current filter phase */
+	unsigned int phase;
+
+};
+
+int audio_resampler_init(
+		struct audio_resampler *r,
+		unsigned int channels,
+		unsigned int rate_in,
+		unsigned int rate_out);
+
+void audio_resampler_free(
+		struct audio_resampler *r);
+
+void audio_resampler_reset(
+		struct audio_resampler *r);
+
+bool audio_resampler_is_supported(
+		unsigned int rate_in,
+		unsigned int rate_out);
+
+unsigned int audio_resampler_delay_dms(
+		unsigned int rate_in,
+		unsigned int rate_out);
+
+size_t audio_resampler_frames_out_max(
+		const struct audio_resampler *r,
+		size_t frames);
+
+ssize_t audio_resampler_process(
+		struct audio_resampler *r,
+		float *dest,
+		const float *src,
+		size_t frames);
+
+#endif
@@ -12,6 +12,7 @@
 
 #include <endian.h>
 #include <math.h>
+#include <string.h>
 
 /**
  * Convert audio volume change in dB to loudness.
@@ -95,3 +96,128 @@ void audio_scale_s32_4le(int32_t * restrict buffer,
 		for (size_t c = 0; c < channels; c++, i++)
 			buffer[i] = htole32((int32_t)((int32_t)le32toh(buffer[i]) * scale[c]));
 }
+
+/**
+ * Scale S16_2LE PCM signal and store it in the destination buffer.
+ *
+ * @param dest Address of the buffer for scaled PCM signal.
+ * @param src Address of the PCM signal to scale.
+ * @param scale The scaling factor per channel for the PCM signal.
+ * @param channels The number of channels in the buffer.
+ * @param frames The number of PCM frames in the buffer. */
+void audio_scale_copy_s16_2le(int16_t * restrict dest, const int16_t * restrict src,
+		const double * restrict scale, unsigned int channels, size_t frames) {
+	for (size_t i = 0; frames; frames--)
+		for (size_t c = 0; c < channels; c++, i++)
+			dest[i] = htole16((int16_t)((int16_t)le16toh(src[i]) * scale[c]));
+}
+
+/**
+ * Scale S32_4LE PCM signal and store it in the destination buffer. */
+void audio_scale_copy_s32_4le(int32_t * restrict dest, const int32_t * restrict src,
+		const double * restrict scale, unsigned int channels, size_t frames) {
+	for (size_t i = 0; frames; frames--)
+		for (size_t c = 0; c < channels; c++, i++)
+			dest[i] = htole32((int32_t)((int32_t)le32toh(src[i]) * scale[c]));
+}
+
+static float audio_f32_4le_load(const float *src) {
+	uint32_t v;
+	float f;
+	memcpy(&v, src, sizeof(v));
+	v = le32toh(v);
+	memcpy(&f, &v, sizeof(f));
+	return f;
+}
+
+static void audio_f32_4le_store(float *dest, float f) {
+	uint32_t v;
+	memcpy(&v, &f, sizeof(v));
+	v = htole32(v);
+	memcpy(dest, &v, sizeof(v));
+}
+
+/**
+ * Convert S16_2LE PCM signal to S32_4LE.
+ *
+ * @param dest Address of the buffer for converted PCM signal.
+ * @param src Address of the S16_2LE PCM signal.
+ * @param width The number of significant bits in the destination sample,
+ *   e.g. 24 for S24_4LE or 32 for S32_4LE.
+ * @param samples The number of PCM samples to convert. */
+void audio_convert_s16_2le_to_s32_4le(int32_t * restrict dest,
+		const int16_t * restrict src, unsigned int width, size_t samples) {
+	const unsigned int shift = width - 16;
+	for (size_t i = 0; i < samples; i++)
+		dest[i] = htole32((int32_t)((uint32_t)(int16_t)le16toh(src[i]) << shift));
+}
+
+/**
+ * Convert S32_4LE PCM signal to S16_2LE.
+ *
+ * @param width The number of significant bits in the source sample. */
+void audio_convert_s32_4le_to_s16_2le(int16_t * restrict dest,
+		const int32_t * restrict src, unsigned int width, size_t samples) {
+	const unsigned int shift = width - 16;
+	for (size_t i = 0; i < samples; i++)
+		dest[i] = htole16((int16_t)((int32_t)le32toh(src[i]) >> shift));
+}
+
+/**
+ * Convert S32_4LE PCM signal between different sample widths. */
+void audio_convert_s32_4le_to_s32_4le(int32_t * restrict dest, unsigned int dest_width,
+		const int32_t * restrict src, unsigned int src_width, size_t samples) {
+	if (dest_width >= src_width) {
+		const unsigned int shift = dest_width - src_width;
+		for (size_t i = 0; i < samples; i++)
+			dest[i] = htole32((int32_t)((uint32_t)le32toh(src[i]) << shift));
+	}
+	else {
+		const unsigned int shift = src_width - dest_width;
+		for (size_t i = 0; i < samples; i++)
+			dest[i] = htole32((int32_t)le32toh(src[i]) >> shift);
+	}
+}
+
+/**
+ * Convert S16_2LE PCM signal to FLOAT_LE in the range [-1.0, 1.0). */
+void audio_convert_s16_2le_to_f32_4le(float * restrict dest,
+		const int16_t * restrict src, size_t samples) {
+	for (size_t i = 0; i < samples; i++)
+		audio_f32_4le_store(&dest[i], (int16_t)le16toh(src[i]) / 32768.0f);
+}
+
+/**
+ * Convert FLOAT_LE PCM signal to S16_2LE with clipping. */
+void audio_convert_f32_4le_to_s16_2le(int16_t * restrict dest,
+		const float * restrict src, size_t samples) {
+	for (size_t i = 0; i < samples; i++) {
+		const float v = audio_f32_4le_load(&src[i]) * 32768.0f;
+		dest[i] = htole16(v >= 32767.0f ? INT16_MAX : v <= -32768.0f ? INT16_MIN : (int16_t)v);
+	}
+}
+
+/**
+ * Convert S32_4LE PCM signal to FLOAT_LE in the range [-1.0, 1.0).
+ *
+ * @param width The number of significant bits in the source sample. */
+void audio_convert_s32_4le_to_f32_4le(float * restrict dest,
+		const int32_t * restrict src, unsigned int width, size_t samples) {
+	const double scale = 1.0 / (1U << (width - 1));
+	for (size_t i = 0; i < samples; i++)
+		audio_f32_4le_store(&dest[i], (int32_t)le32toh(src[i]) * scale);
+}
+
+/**
+ * Convert FLOAT_LE PCM signal to S32_4LE with clipping.
+ *
+ * @param width The number of significant bits in the destination sample. */
+void audio_convert_f32_4le_to_s32_4le(int32_t * restrict dest,
+		const float * restrict src, unsigned int width, size_t samples) {
+	const double scale = 1U << (width - 1);
+	for (size_t i = 0; i < samples; i++) {
+		const double v = audio_f32_4le_load(&src[i]) * scale;
+		dest[i] = htole32(v >= scale - 1 ? (int32_t)(scale - 1) :
+				v <= -scale ? (int32_t)-scale : (int32_t)v);
+	}
+}
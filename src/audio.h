@@ -40,4 +40,26 @@ void audio_scale_s32_4le(int32_t * restrict buffer, const double * restrict scal
 		unsigned int channels, size_t frames);
 #define audio_scale_s24_4le audio_scale_s32_4le
 
+void audio_scale_copy_s16_2le(int16_t * restrict dest, const int16_t * restrict src,
+		const double * restrict scale, unsigned int channels, size_t frames);
+void audio_scale_copy_s32_4le(int32_t * restrict dest, const int32_t * restrict src,
+		const double * restrict scale, unsigned int channels, size_t frames);
+#define audio_scale_copy_s24_4le audio_scale_copy_s32_4le
+
+void audio_convert_s16_2le_to_s32_4le(int32_t * restrict dest,
+		const int16_t * restrict src, unsigned int width, size_t samples);
+void audio_convert_s32_4le_to_s16_2le(int16_t * restrict dest,
+		const int32_t * restrict src, unsigned int width, size_t samples);
+void audio_convert_s32_4le_to_s32_4le(int32_t * restrict dest, unsigned int dest_width,
+		const int32_t * restrict src, unsigned int src_width, size_t samples);
+
+void audio_convert_s16_2le_to_f32_4le(float * restrict dest,
+		const int16_t * restrict src, size_t samples);
+void audio_convert_f32_4le_to_s16_2le(int16_t * restrict dest,
+		const float * restrict src, size_t samples);
+void audio_convert_s32_4le_to_f32_4le(float * restrict dest,
+		const int32_t * restrict src, unsigned int width, size_t samples);
+void audio_convert_f32_4le_to_s32_4le(int32_t * restrict dest,
+		const float * restrict src, unsigned int width, size_t samples);
+
 #endif
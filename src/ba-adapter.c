@@ -15,6 +15,7 @@
 #endif
 
 #include <errno.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -26,6 +27,7 @@
 #include "ba-device.h"
 #include "hci.h"
 #include "hfp.h"
+#include "rwlock.h"
 #include "utils.h"
 #include "shared/log.h"
 
@@ -60,12 +62,12 @@ struct ba_adapter *ba_adapter_new(int dev_id) {
 	sprintf(a->bluez_dbus_path, "/org/bluez/%s", a->hci.name);
 	g_variant_sanitize_object_path(a->bluez_dbus_path);
 
-	pthread_mutex_init(&a->devices_mutex, NULL);
+	rwlock_init(&a->devices_lock, a->ba_dbus_path);
 	a->devices = g_hash_table_new_full(g_bdaddr_hash, g_bdaddr_equal, NULL, NULL);
 
-	pthread_mutex_lock(&config.adapters_mutex);
+	rwlock_wrlock(&config.adapters_lock);
 	config.adapters[a->hci.dev_id] = a;
-	pthread_mutex_unlock(&config.adapters_mutex);
+	rwlock_wrunlock(&config.adapters_lock);
 
 	return a;
 }
@@ -77,18 +79,18 @@ struct ba_adapter *ba_adapter_lookup(int dev_id) {
 
 	struct ba_adapter *a;
 
-	pthread_mutex_lock(&config.adapters_mutex);
+	rwlock_rdlock(&config.adapters_lock);
 	if ((a = config.adapters[dev_id]) != NULL)
-		a->ref_count++;
-	pthread_mutex_unlock(&config.adapters_mutex);
+		atomic_fetch_add_explicit(&a->ref_count, 1, memory_order_relaxed);
+	rwlock_rdunlock(&config.adapters_lock);
 
 	return a;
 }
 
 struct ba_adapter *ba_adapter_ref(struct ba_adapter *a) {
-	pthread_mutex_lock(&config.adapters_mutex);
-	a->ref_count++;
-	pthread_mutex_unlock(&config.adapters_mutex);
+	/* Caller already holds a reference, so the adapter can not be removed
+	 * from the registry and we do not have to lock it. */
+	atomic_fetch_add_explicit(&a->ref_count, 1, memory_order_relaxed);
 	return a;
 }
 
@@ -108,18 +110,18 @@ void ba_adapter_destroy(struct ba_adapter *a) {
 		GHashTableIter iter;
 		struct ba_device *d;
 
-		pthread_mutex_lock(&a->devices_mutex);
+		rwlock_wrlock(&a->devices_lock);
 
 		g_hash_table_iter_init(&iter, a->devices);
 		if (!g_hash_table_iter_next(&iter, NULL, (gpointer)&d)) {
-			pthread_mutex_unlock(&a->devices_mutex);
+			rwlock_wrunlock(&a->devices_lock);
 			break;
 		}
 
-		d->ref_count++;
+		atomic_fetch_add_explicit(&d->ref_count, 1, memory_order_relaxed);
 		g_hash_table_iter_steal(&iter);
 
-		pthread_mutex_unlock(&a->devices_mutex);
+		rwlock_wrunlock(&a->devices_lock);
 
 		ba_device_destroy(d);
 	}
@@ -132,11 +134,15 @@ void ba_adapter_unref(struct ba_adapter *a) {
 	int ref_count;
 	int err;
 
-	pthread_mutex_lock(&config.adapters_mutex);
-	if ((ref_count = --a->ref_count) == 0)
+	if (rwlock_ref_dec_unless_last(&a->ref_count))
+		return;
+
+	rwlock_wrlock(&config.adapters_lock);
+	if ((ref_count = atomic_fetch_sub_explicit(&a->ref_count, 1,
+					memory_order_acq_rel) - 1) == 0)
 		/* detach adapter from global configuration */
 		config.adapters[a->hci.dev_id] = NULL;
-	pthread_mutex_unlock(&config.adapters_mutex);
+	rwlock_wrunlock(&config.adapters_lock);
 
 	if (ref_count > 0)
 		return;
@@ -153,7 +159,7 @@ void ba_adapter_unref(struct ba_adapter *a) {
 	}
 
 	g_hash_table_unref(a->devices);
-	pthread_mutex_destroy(&a->devices_mutex);
+	rwlock_destroy(&a->devices_lock);
 	free(a);
 }
 
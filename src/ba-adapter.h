@@ -16,6 +16,7 @@
 #endif
 
 #include <pthread.h>
+#include <stdatomic.h>
 
 #include <glib.h>
 
@@ -23,6 +24,8 @@
 #include <bluetooth/hci.h>
 #include <bluetooth/hci_lib.h>
 
+#include "rwlock.h"
+
 /* Data associated with BT adapter. */
 struct ba_adapter {
 
@@ -38,11 +41,11 @@ struct ba_adapter {
 	char bluez_dbus_path[32];
 
 	/* collection of connected devices */
-	pthread_mutex_t devices_mutex;
+	struct rwlock devices_lock;
 	GHashTable *devices;
 
 	/* memory self-management */
-	int ref_count;
+	atomic_int ref_count;
 
 };
 
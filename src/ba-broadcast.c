@@ -0,0 +1,942 @@
+/*
+ * BlueALSA - ba-broadcast.c
+ * Copyright (c) 2016-2024 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include "ba-broadcast.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "a2dp.h"
+#include "ba-transport.h"
+#include "ba-transport-pcm.h"
+#include "bluealsa-dbus.h"
+#include "shared/defs.h"
+#include "shared/log.h"
+#include "shared/rt.h"
+
+/**
+ * Number of RTP packets which can be held in the per-sink delay line. */
+#define BA_BROADCAST_QUEUE_SIZE 64
+
+/**
+ * Total time in milliseconds to wait for a room in the BT socket buffers
+ * when delay lines are drained. The limit applies to the whole drain
+ * operation, not to a single socket. */
+#define BA_BROADCAST_DRAIN_TIMEOUT 100
+
+/**
+ * Time in milliseconds for which the shared encoder is throttled by a sink
+ * which can not keep up. If the sink does not recover within this time, it
+ * is marked as stalled and its packets are dropped until it catches up, so
+ * a single dead speaker will not stall the whole group. */
+#define BA_BROADCAST_STALL_TIMEOUT 50
+
+struct ba_broadcast_packet {
+	/* time point at which the packet shall be sent */
+	struct timespec due;
+	uint8_t *data;
+	size_t size;
+	size_t len;
+};
+
+/**
+ * Single BT socket fed by a broadcast stream. */
+struct ba_broadcast_sink {
+
+	/* PCM associated with the BT socket */
+	struct ba_transport_pcm *pcm;
+	/* duplicated BT socket */
+	int fd;
+
+	/* total playback delay of this sink */
+	unsigned int delay_dms;
+	/* time by which packets are held back */
+	unsigned int hold_dms;
+
+	/* delay line for latency alignment */
+	struct ba_broadcast_packet queue[BA_BROADCAST_QUEUE_SIZE];
+	size_t queue_head;
+	size_t queue_len;
+
+	/* sink did not keep up, so it does not throttle the encoder */
+	bool stalled;
+	/* number of packets dropped since the last report */
+	unsigned int dropped;
+
+};
+
+/**
+ * Single encoder of the broadcast group. */
+struct ba_broadcast_stream {
+
+	/* PCM which runs the encoder */
+	struct ba_transport_pcm *pcm;
+	/* write end of the PCM PIPE feeding the encoder,
+	 * for the leader stream it is always -1 */
+	int fd_tee;
+
+	/* BT sockets which share the encoded data; the first sink is
+	 * always the BT socket of the encoder transport itself */
+	struct ba_broadcast_sink sinks[1 + BA_BROADCAST_MEMBERS_MAX];
+	size_t sinks_len;
+
+};
+
+/**
+ * Create new broadcast group anchored on the given PCM.
+ *
+ * @param pcm A2DP source transport PCM opened by the client.
+ * @return On success, the pointer to the newly allocated broadcast group is
+ *   returned. Otherwise, NULL is returned and errno is set appropriately. */
+struct ba_broadcast *ba_broadcast_new(
+		struct ba_transport_pcm *pcm) {
+
+	struct ba_broadcast *bc;
+
+	if (pcm->t->profile != BA_TRANSPORT_PROFILE_A2DP_SOURCE ||
+			pcm->mode != BA_TRANSPORT_PCM_MODE_SINK)
+		return errno = ENOTSUP, NULL;
+
+	if ((bc = calloc(1, sizeof(*bc))) == NULL)
+		return NULL;
+
+	bc->pcm = pcm;
+	bc->ref_count = 1;
+	pthread_mutex_init(&bc->mutex, NULL);
+
+	return bc;
+}
+
+struct ba_broadcast *ba_broadcast_ref(
+		struct ba_broadcast *bc) {
+	g_atomic_int_inc(&bc->ref_count);
+	return bc;
+}
+
+void ba_broadcast_unref(
+		struct ba_broadcast *bc) {
+
+	if (!g_atomic_int_dec_and_test(&bc->ref_count))
+		return;
+
+	g_assert_cmpuint(bc->streams_len, ==, 0);
+	g_assert_cmpuint(bc->members_len, ==, 0);
+
+	pthread_mutex_destroy(&bc->mutex);
+	free(bc);
+
+}
+
+static void broadcast_sink_free(struct ba_broadcast_sink *sink) {
+	if (sink->fd != -1)
+		close(sink->fd);
+	for (size_t i = 0; i < ARRAYSIZE(sink->queue); i++)
+		free(sink->queue[i].data);
+}
+
+static void broadcast_stream_free(struct ba_broadcast_stream *stream) {
+	atomic_store(&stream->pcm->broadcast_encoder, false);
+	if (stream->fd_tee != -1)
+		close(stream->fd_tee);
+	for (size_t i = 0; i < stream->sinks_len; i++)
+		broadcast_sink_free(&stream->sinks[i]);
+	free(stream);
+}
+
+/**
+ * Check whether PCM can share the encoder of the given stream. */
+static bool broadcast_stream_is_compatible(
+		const struct ba_broadcast_stream *stream,
+		const struct ba_transport_pcm *pcm) {
+
+	const struct ba_transport *t_enc = stream->pcm->t;
+	const struct ba_transport *t = pcm->t;
+
+	if (t->media.sep != t_enc->media.sep)
+		return false;
+	/* Encoder output is bounded by its own write MTU. */
+	if (t->mtu_write < t_enc->mtu_write)
+		return false;
+
+	return memcmp(&t->media.configuration, &t_enc->media.configuration,
+			t->media.sep->config.caps_size) == 0;
+}
+
+static int broadcast_stream_add_sink(
+		struct ba_broadcast_stream *stream,
+		struct ba_transport_pcm *pcm) {
+
+	struct ba_transport *t = pcm->t;
+	struct ba_broadcast_sink *sink = &stream->sinks[stream->sinks_len];
+	int fd;
+
+	pthread_mutex_lock(&t->bt_fd_mtx);
+	fd = t->bt_fd != -1 ? dup(t->bt_fd) : -1;
+	pthread_mutex_unlock(&t->bt_fd_mtx);
+
+	if (fd == -1) {
+		warn("Couldn't duplicate broadcast BT socket: %s", strerror(errno));
+		return -1;
+	}
+
+	memset(sink, 0, sizeof(*sink));
+	sink->pcm = pcm;
+	sink->fd = fd;
+
+	stream->sinks_len++;
+	return 0;
+}
+
+/**
+ * Update per-sink hold times, so all sinks will play in sync.
+ *
+ * The lock on the broadcast group shall be held. */
+static void broadcast_update_delay(struct ba_broadcast *bc) {
+
+	unsigned int delay_max = 0;
+
+	for (size_t i = 0; i < bc->streams_len; i++) {
+		struct ba_broadcast_stream *stream = bc->streams[i];
+		const unsigned int codec_delay_dms =
+			stream->pcm->codec_delay_dms + stream->pcm->processing_delay_dms;
+		for (size_t j = 0; j < stream->sinks_len; j++) {
+			struct ba_broadcast_sink *sink = &stream->sinks[j];
+			sink->delay_dms = codec_delay_dms + sink->pcm->t->media.delay;
+			delay_max = MAX(delay_max, sink->delay_dms);
+		}
+	}
+
+	for (size_t i = 0; i < bc->streams_len; i++) {
+		struct ba_broadcast_stream *stream = bc->streams[i];
+		for (size_t j = 0; j < stream->sinks_len; j++)
+			stream->sinks[j].hold_dms = delay_max - stream->sinks[j].delay_dms;
+	}
+
+	bc->delay_dms = delay_max;
+
+}
+
+/**
+ * Set members of the broadcast group.
+ *
+ * Members can be changed only when the group is not opened by a client.
+ *
+ * @param bc Broadcast group.
+ * @param members Array of A2DP source PCMs to be added to the group.
+ * @param members_len Number of elements in the members array.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int ba_broadcast_set_members(
+		struct ba_broadcast *bc,
+		struct ba_transport_pcm * const *members,
+		size_t members_len) {
+
+	int rv = -1;
+
+	if (members_len > ARRAYSIZE(bc->members))
+		return errno = E2BIG, -1;
+
+	pthread_mutex_lock(&bc->mutex);
+
+	if (bc->streams_len > 0) {
+		errno = EBUSY;
+		goto fail;
+	}
+
+	for (size_t i = 0; i < members_len; i++) {
+
+		struct ba_transport_pcm *pcm = members[i];
+
+		if (pcm == bc->pcm ||
+				pcm->t->profile != BA_TRANSPORT_PROFILE_A2DP_SOURCE ||
+				pcm->mode != BA_TRANSPORT_PCM_MODE_SINK) {
+			errno = EINVAL;
+			goto fail;
+		}
+
+		for (size_t j = 0; j < i; j++)
+			if (members[j] == pcm) {
+				errno = EINVAL;
+				goto fail;
+			}
+
+		pthread_mutex_lock(&pcm->mutex);
+		const bool busy = pcm->broadcast != NULL && pcm->broadcast != bc;
+		pthread_mutex_unlock(&pcm->mutex);
+
+		if (busy) {
+			errno = EBUSY;
+			goto fail;
+		}
+
+	}
+
+	/* release current members */
+	for (size_t i = 0; i < bc->members_len; i++) {
+		struct ba_transport_pcm *pcm = bc->members[i];
+		pthread_mutex_lock(&pcm->mutex);
+		pcm->broadcast = NULL;
+		pthread_mutex_unlock(&pcm->mutex);
+		ba_transport_pcm_unref(pcm);
+	}
+
+	for (size_t i = 0; i < members_len; i++) {
+		struct ba_transport_pcm *pcm = ba_transport_pcm_ref(members[i]);
+		pthread_mutex_lock(&pcm->mutex);
+		pcm->broadcast = bc;
+		pthread_mutex_unlock(&pcm->mutex);
+		bc->members[i] = pcm;
+	}
+
+	bc->members_len = members_len;
+	rv = 0;
+
+fail:
+	pthread_mutex_unlock(&bc->mutex);
+	return rv;
+}
+
+/**
+ * Remove PCM from the broadcast group it belongs to.
+ *
+ * In case when the given PCM is the group leader, the whole group will be
+ * dissolved. This function shall be called when the transport is about to
+ * be destroyed. */
+void ba_broadcast_remove_member(
+		struct ba_transport_pcm *pcm) {
+
+	pthread_mutex_lock(&pcm->mutex);
+	struct ba_broadcast *bc = pcm->broadcast;
+	if (bc != NULL)
+		ba_broadcast_ref(bc);
+	pthread_mutex_unlock(&pcm->mutex);
+
+	if (bc == NULL)
+		return;
+
+	if (bc->pcm == pcm) {
+		ba_broadcast_close(bc);
+		ba_broadcast_set_members(bc, NULL, 0);
+		pthread_mutex_lock(&pcm->mutex);
+		pcm->broadcast = NULL;
+		pthread_mutex_unlock(&pcm->mutex);
+		/* drop the reference owned by the leader */
+		ba_broadcast_unref(bc);
+		goto final;
+	}
+
+	pthread_mutex_lock(&bc->mutex);
+
+	for (size_t i = 0; i < bc->streams_len; i++) {
+		struct ba_broadcast_stream *stream = bc->streams[i];
+
+		if (stream->pcm == pcm) {
+			/* Without the encoder there is nothing to feed remaining sinks
+			 * of this stream with, so the whole stream has to go away. */
+			warn("Removing broadcast stream: %s", ba_transport_debug_name(pcm->t));
+			for (size_t j = 1; j < stream->sinks_len; j++)
+				ba_transport_stop_if_no_clients(stream->sinks[j].pcm->t);
+			broadcast_stream_free(stream);
+			bc->streams[i] = bc->streams[--bc->streams_len];
+			i--;
+			continue;
+		}
+
+		for (size_t j = 1; j < stream->sinks_len; j++)
+			if (stream->sinks[j].pcm == pcm) {
+				broadcast_sink_free(&stream->sinks[j]);
+				stream->sinks[j] = stream->sinks[--stream->sinks_len];
+				break;
+			}
+
+	}
+
+	for (size_t i = 0; i < bc->members_len; i++)
+		if (bc->members[i] == pcm) {
+			bc->members[i] = bc->members[--bc->members_len];
+			pthread_mutex_lock(&pcm->mutex);
+			pcm->broadcast = NULL;
+			pthread_mutex_unlock(&pcm->mutex);
+			ba_transport_pcm_unref(pcm);
+			break;
+		}
+
+	broadcast_update_delay(bc);
+	pthread_mutex_unlock(&bc->mutex);
+
+	bluealsa_dbus_pcm_update(bc->pcm,
+			BA_DBUS_PCM_UPDATE_BROADCAST | BA_DBUS_PCM_UPDATE_DELAY);
+
+final:
+	ba_broadcast_unref(bc);
+}
+
+/**
+ * Start broadcasting to all group members.
+ *
+ * This function shall be called when the leader PCM is being opened, after
+ * its transport has been acquired. Members which can not be acquired are
+ * skipped, so a single unreachable speaker will not block the whole group.
+ *
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int ba_broadcast_open(struct ba_broadcast *bc) {
+
+	struct ba_transport_pcm *members[ARRAYSIZE(bc->members)];
+	size_t members_len;
+
+	pthread_mutex_lock(&bc->mutex);
+	members_len = bc->members_len;
+	for (size_t i = 0; i < members_len; i++)
+		members[i] = ba_transport_pcm_ref(bc->members[i]);
+	pthread_mutex_unlock(&bc->mutex);
+
+	if (members_len == 0)
+		return 0;
+
+	/* Acquire all members prior to taking the group lock, because
+	 * acquisition involves round-trips with BlueZ. */
+	for (size_t i = 0; i < members_len; i++) {
+		struct ba_transport_pcm *pcm = members[i];
+		if (ba_transport_acquire(pcm->t) == -1 ||
+				ba_transport_pcm_state_wait_running(pcm) == -1) {
+			warn("Couldn't acquire broadcast member: %s: %s",
+					ba_transport_debug_name(pcm->t), strerror(errno));
+			ba_transport_pcm_unref(pcm);
+			members[i] = NULL;
+		}
+	}
+
+	ba_broadcast_close(bc);
+
+	pthread_mutex_lock(&bc->mutex);
+
+	struct ba_broadcast_stream *stream;
+	if ((stream = calloc(1, sizeof(*stream))) == NULL)
+		goto fail;
+
+	stream->pcm = bc->pcm;
+	stream->fd_tee = -1;
+	bc->streams[bc->streams_len++] = stream;
+	if (broadcast_stream_add_sink(stream, bc->pcm) == -1)
+		goto fail;
+	atomic_store(&stream->pcm->broadcast_encoder, true);
+
+	for (size_t i = 0; i < members_len; i++) {
+
+		struct ba_transport_pcm *pcm;
+		if ((pcm = members[i]) == NULL)
+			continue;
+
+		bool shared = false;
+		for (size_t j = 0; j < bc->streams_len; j++)
+			if (broadcast_stream_is_compatible(bc->streams[j], pcm)) {
+				if (broadcast_stream_add_sink(bc->streams[j], pcm) == 0)
+					debug("Sharing broadcast encoder: %s -> %s",
+							ba_transport_debug_name(bc->streams[j]->pcm->t),
+							ba_transport_debug_name(pcm->t));
+				shared = true;
+				break;
+			}
+
+		if (shared)
+			continue;
+
+		/* Raw PCM is passed to additional encoders as it is, so the
+		 * stream parameters have to match the leader PCM. */
+		if (pcm->format != bc->pcm->format ||
+				pcm->channels != bc->pcm->channels ||
+				pcm->rate != bc->pcm->rate) {
+			warn("Broadcast member PCM mismatch: %s: %u Hz, %u channels",
+					ba_transport_debug_name(pcm->t), pcm->rate, pcm->channels);
+			continue;
+		}
+
+		int fds[2];
+		if (pipe2(fds, O_CLOEXEC | O_NONBLOCK) == -1) {
+			warn("Couldn't create broadcast PIPE: %s", strerror(errno));
+			continue;
+		}
+
+		pthread_mutex_lock(&pcm->mutex);
+		const bool busy = pcm->fd != -1;
+		if (!busy) {
+			pcm->fd = fds[0];
+			pcm->paused = false;
+		}
+		pthread_mutex_unlock(&pcm->mutex);
+
+		if (busy) {
+			warn("Broadcast member PCM already opened: %s", ba_transport_debug_name(pcm->t));
+			close(fds[0]);
+			close(fds[1]);
+			continue;
+		}
+
+		struct ba_broadcast_stream *s;
+		if ((s = calloc(1, sizeof(*s))) == NULL) {
+			close(fds[1]);
+			continue;
+		}
+
+		s->pcm = pcm;
+		s->fd_tee = fds[1];
+		bc->streams[bc->streams_len++] = s;
+		broadcast_stream_add_sink(s, pcm);
+		atomic_store(&pcm->broadcast_encoder, true);
+
+		ba_transport_pcm_signal_send(pcm, BA_TRANSPORT_PCM_SIGNAL_OPEN);
+
+	}
+
+	broadcast_update_delay(bc);
+	debug("Broadcast group opened: streams: %zu, delay: %u.%u ms",
+			bc->streams_len, bc->delay_dms / 10, bc->delay_dms % 10);
+
+	pthread_mutex_unlock(&bc->mutex);
+
+	for (size_t i = 0; i < members_len; i++)
+		if (members[i] != NULL)
+			ba_transport_pcm_unref(members[i]);
+
+	return 0;
+
+fail:
+	pthread_mutex_unlock(&bc->mutex);
+	for (size_t i = 0; i < members_len; i++)
+		if (members[i] != NULL)
+			ba_transport_pcm_unref(members[i]);
+	ba_broadcast_close(bc);
+	return -1;
+}
+
+/**
+ * Get the number of milliseconds left until the given deadline. */
+static int broadcast_get_timeout(const struct timespec *deadline) {
+	struct timespec now, diff;
+	gettimestamp(&now);
+	if (difftimespec(&now, deadline, &diff) <= 0)
+		return 0;
+	return timespec2ms(&diff);
+}
+
+/**
+ * Get the deadline which is the given number of milliseconds from now. */
+static void broadcast_get_deadline(struct timespec *deadline, unsigned int ms) {
+	const struct timespec timeout = {
+		.tv_sec = ms / 1000,
+		.tv_nsec = (ms % 1000) * 1000000,
+	};
+	gettimestamp(deadline);
+	timespecadd(deadline, &timeout, deadline);
+}
+
+/**
+ * Account packets dropped from the sink delay line. */
+static void broadcast_sink_drop(
+		struct ba_broadcast_sink *sink,
+		size_t packets,
+		const char *reason) {
+	if (sink->dropped == 0)
+		warn("Dropping broadcast packets: %s: %s",
+				ba_transport_debug_name(sink->pcm->t), reason);
+	sink->dropped += packets;
+}
+
+/**
+ * Report packets dropped since the last report, if any. */
+static void broadcast_sink_report_drops(
+		struct ba_broadcast_sink *sink) {
+	if (sink->dropped == 0)
+		return;
+	warn("Dropped broadcast packets: %s: %u",
+			ba_transport_debug_name(sink->pcm->t), sink->dropped);
+	sink->dropped = 0;
+}
+
+/**
+ * Send all packets from the sink delay line regardless of their due time.
+ *
+ * The hold time only aligns the beginning of the stream, so packets are
+ * still played in order by the remote device. Waiting for the socket
+ * buffer ends at the given deadline, which is shared by all drained sinks,
+ * so stalled sinks will not block the caller for longer than that. */
+static void broadcast_sink_drain(
+		struct ba_broadcast_sink *sink,
+		const struct timespec *deadline) {
+
+	while (sink->fd != -1 && sink->queue_len > 0) {
+
+		struct ba_broadcast_packet *packet = &sink->queue[sink->queue_head];
+
+		if (send(sink->fd, packet->data, packet->len, MSG_DONTWAIT | MSG_NOSIGNAL) == -1)
+			switch (errno) {
+			case EINTR:
+				continue;
+			case EAGAIN: {
+				struct pollfd pfd = { sink->fd, POLLOUT, 0 };
+				const int timeout = broadcast_get_timeout(deadline);
+				if (timeout > 0 && poll(&pfd, 1, timeout) > 0)
+					continue;
+				broadcast_sink_drop(sink, sink->queue_len, "Drain timeout");
+				sink->queue_len = 0;
+				goto final;
+			}
+			default:
+				debug("Broadcast BT socket error: %s", strerror(errno));
+				sink->queue_len = 0;
+				goto final;
+			}
+
+		sink->queue_head = (sink->queue_head + 1) % ARRAYSIZE(sink->queue);
+		sink->queue_len--;
+
+	}
+
+final:
+	broadcast_sink_report_drops(sink);
+}
+
+static void broadcast_stream_drain(
+		struct ba_broadcast_stream *stream,
+		const struct timespec *deadline) {
+	for (size_t i = 0; i < stream->sinks_len; i++)
+		broadcast_sink_drain(&stream->sinks[i], deadline);
+}
+
+/**
+ * Stop broadcasting to group members.
+ *
+ * Additional encoders will see the end of the PCM stream and members which
+ * were sharing encoders will be stopped after the keep-alive timeout. */
+void ba_broadcast_close(struct ba_broadcast *bc) {
+
+	/* This function might be called with the leader PCM lock held, so
+	 * the time spent on draining is bounded for the whole group. */
+	struct timespec deadline;
+	broadcast_get_deadline(&deadline, BA_BROADCAST_DRAIN_TIMEOUT);
+
+	pthread_mutex_lock(&bc->mutex);
+
+	for (size_t i = 0; i < bc->streams_len; i++) {
+		struct ba_broadcast_stream *stream = bc->streams[i];
+		/* Do not discard the tail of the stream held back
+		 * in the delay lines of the sinks with lower delay. */
+		broadcast_stream_drain(stream, &deadline);
+		for (size_t j = 1; j < stream->sinks_len; j++)
+			ba_transport_stop_if_no_clients(stream->sinks[j].pcm->t);
+		broadcast_stream_free(stream);
+	}
+
+	bc->streams_len = 0;
+	bc->delay_dms = 0;
+
+	pthread_mutex_unlock(&bc->mutex);
+
+}
+
+static void broadcast_sink_push(
+		struct ba_broadcast_sink *sink,
+		const struct timespec *now,
+		const void *buffer,
+		size_t count) {
+
+	if (sink->queue_len == ARRAYSIZE(sink->queue)) {
+		broadcast_sink_drop(sink, 1, "Delay line overrun");
+		sink->queue_head = (sink->queue_head + 1) % ARRAYSIZE(sink->queue);
+		sink->queue_len--;
+	}
+
+	const size_t tail = (sink->queue_head + sink->queue_len) % ARRAYSIZE(sink->queue);
+	struct ba_broadcast_packet *packet = &sink->queue[tail];
+
+	if (packet->size < count) {
+		uint8_t *data;
+		if ((data = realloc(packet->data, count)) == NULL)
+			return;
+		packet->data = data;
+		packet->size = count;
+	}
+
+	const struct timespec hold = {
+		.tv_sec = sink->hold_dms / 10000,
+		.tv_nsec = (sink->hold_dms % 10000) * 100000,
+	};
+
+	timespecadd(now, &hold, &packet->due);
+	memcpy(packet->data, buffer, packet->len = count);
+	sink->queue_len++;
+
+}
+
+/**
+ * Send all due packets from the sink delay line.
+ *
+ * @return On success this function returns 0. If due packets could not be
+ *   sent because the BT socket buffer is full, 1 is returned. If the BT
+ *   socket has been disconnected, -1 is returned. */
+static int broadcast_sink_flush(
+		struct ba_broadcast_sink *sink,
+		const struct timespec *now) {
+
+	while (sink->queue_len > 0) {
+
+		struct ba_broadcast_packet *packet = &sink->queue[sink->queue_head];
+		struct timespec diff;
+
+		if (difftimespec(now, &packet->due, &diff) > 0)
+			break;
+
+		if (send(sink->fd, packet->data, packet->len, MSG_DONTWAIT | MSG_NOSIGNAL) == -1)
+			switch (errno) {
+			case EINTR:
+				continue;
+			case EAGAIN:
+				/* Packets will be kept in the delay line until there is
+				 * a room in the socket buffer or the delay line overruns. */
+				return 1;
+			default:
+				debug("Broadcast BT socket error: %s", strerror(errno));
+				return -1;
+			}
+
+		sink->queue_head = (sink->queue_head + 1) % ARRAYSIZE(sink->queue);
+		sink->queue_len--;
+
+	}
+
+	/* The sink has caught up with the stream. */
+	if (sink->stalled)
+		debug("Broadcast sink recovered: %s", ba_transport_debug_name(sink->pcm->t));
+	sink->stalled = false;
+	broadcast_sink_report_drops(sink);
+
+	return 0;
+}
+
+/**
+ * Throttle the shared encoder until all sinks have sent their due packets.
+ *
+ * Encoded data is sent to the sinks with non-blocking calls, so the encoder
+ * does not see the backpressure of the BT sockets by itself. Without this
+ * throttling, sinks which are slower than the encoder would silently drop
+ * packets on the delay line overrun. Sinks which do not recover within the
+ * stall timeout stop throttling the encoder, until they catch up.
+ *
+ * The lock on the broadcast group shall be held. */
+static void broadcast_stream_throttle(
+		struct ba_broadcast_stream *stream) {
+
+	struct timespec deadline;
+	broadcast_get_deadline(&deadline, BA_BROADCAST_STALL_TIMEOUT);
+
+	for (;;) {
+
+		struct ba_broadcast_sink *sinks[ARRAYSIZE(stream->sinks)];
+		struct pollfd pfds[ARRAYSIZE(stream->sinks)];
+		size_t len = 0;
+
+		struct timespec now;
+		gettimestamp(&now);
+
+		for (size_t i = 0; i < stream->sinks_len; i++) {
+			struct ba_broadcast_sink *sink = &stream->sinks[i];
+			if (sink->fd == -1 || sink->stalled)
+				continue;
+			if (broadcast_sink_flush(sink, &now) != 1)
+				continue;
+			pfds[len] = (struct pollfd){ sink->fd, POLLOUT, 0 };
+			sinks[len++] = sink;
+		}
+
+		if (len == 0)
+			return;
+
+		const int timeout = broadcast_get_timeout(&deadline);
+		if (timeout == 0 || poll(pfds, len, timeout) == 0) {
+			for (size_t i = 0; i < len; i++) {
+				warn("Broadcast sink stalled: %s", ba_transport_debug_name(sinks[i]->pcm->t));
+				sinks[i]->stalled = true;
+			}
+			return;
+		}
+
+	}
+
+}
+
+/**
+ * Write encoded data to all BT sockets sharing the PCM encoder.
+ *
+ * @return On success, the number of bytes written to the encoder own BT
+ *   socket is returned. If the encoder BT socket was disconnected, zero is
+ *   returned. In case when the PCM is not an active broadcast encoder, -1 is
+ *   returned and errno is set to ENOENT. */
+ssize_t ba_broadcast_bt_write(
+		struct ba_transport_pcm *pcm,
+		const void *buffer,
+		size_t count) {
+
+	/* Do not bother with the PCM lock for the usual case,
+	 * i.e. when the PCM is not a part of the broadcast. */
+	if (!atomic_load_explicit(&pcm->broadcast_encoder, memory_order_acquire))
+		return errno = ENOENT, -1;
+
+	pthread_mutex_lock(&pcm->mutex);
+	struct ba_broadcast *bc = pcm->broadcast;
+	if (bc != NULL)
+		ba_broadcast_ref(bc);
+	pthread_mutex_unlock(&pcm->mutex);
+
+	if (bc == NULL)
+		return errno = ENOENT, -1;
+
+	ssize_t ret = -1;
+	errno = ENOENT;
+
+	pthread_mutex_lock(&bc->mutex);
+
+	struct ba_broadcast_stream *stream = NULL;
+	for (size_t i = 0; i < bc->streams_len; i++)
+		if (bc->streams[i]->pcm == pcm) {
+			stream = bc->streams[i];
+			break;
+		}
+
+	if (stream == NULL)
+		goto final;
+
+	struct timespec now;
+	gettimestamp(&now);
+
+	broadcast_update_delay(bc);
+
+	ret = count;
+	for (size_t i = 0; i < stream->sinks_len; i++) {
+		struct ba_broadcast_sink *sink = &stream->sinks[i];
+		if (sink->fd == -1)
+			continue;
+		broadcast_sink_push(sink, &now, buffer, count);
+		if (broadcast_sink_flush(sink, &now) == -1) {
+			close(sink->fd);
+			sink->fd = -1;
+			/* disconnected encoder socket */
+			if (i == 0)
+				ret = 0;
+		}
+	}
+
+	/* Push the backpressure of slow sinks back to the encoder. */
+	broadcast_stream_throttle(stream);
+
+final:
+	pthread_mutex_unlock(&bc->mutex);
+	ba_broadcast_unref(bc);
+
+	if (ret == 0)
+		ba_transport_pcm_bt_release(pcm);
+
+	return ret;
+}
+
+/**
+ * Send delayed packets of the stream encoded by the given PCM.
+ *
+ * This function shall be called by the PCM IO thread when the PCM drain
+ * has been requested, so the drain will not complete before the audio is
+ * sent to all sinks sharing the encoder. */
+void ba_broadcast_drain(
+		struct ba_transport_pcm *pcm) {
+
+	if (!atomic_load_explicit(&pcm->broadcast_encoder, memory_order_acquire))
+		return;
+
+	pthread_mutex_lock(&pcm->mutex);
+	struct ba_broadcast *bc = pcm->broadcast;
+	if (bc != NULL)
+		ba_broadcast_ref(bc);
+	pthread_mutex_unlock(&pcm->mutex);
+
+	if (bc == NULL)
+		return;
+
+	struct timespec deadline;
+	broadcast_get_deadline(&deadline, BA_BROADCAST_DRAIN_TIMEOUT);
+
+	pthread_mutex_lock(&bc->mutex);
+	for (size_t i = 0; i < bc->streams_len; i++)
+		if (bc->streams[i]->pcm == pcm)
+			broadcast_stream_drain(bc->streams[i], &deadline);
+	pthread_mutex_unlock(&bc->mutex);
+
+	ba_broadcast_unref(bc);
+
+}
+
+/**
+ * Pass PCM data read by the leader to additional group encoders.
+ *
+ * This function shall be called with the leader PCM lock held. */
+void ba_broadcast_pcm_tee(
+		struct ba_transport_pcm *pcm,
+		const void *buffer,
+		size_t len) {
+
+	struct ba_broadcast *bc = pcm->broadcast;
+
+	if (bc == NULL || bc->pcm != pcm)
+		return;
+
+	pthread_mutex_lock(&bc->mutex);
+
+	for (size_t i = 1; i < bc->streams_len; i++) {
+
+		const int fd = bc->streams[i]->fd_tee;
+		int queued = 0;
+		int size;
+
+		/* Writes bigger than PIPE_BUF are not atomic. Check whether the whole
+		 * chunk will fit, so the PCM frame alignment will not be broken. */
+		if ((size = fcntl(fd, F_GETPIPE_SZ)) == -1 ||
+				ioctl(fd, FIONREAD, &queued) == -1 ||
+				(size_t)(size - queued) < len) {
+			debug("Dropping broadcast PCM data: %s", "PCM overrun");
+			continue;
+		}
+
+		if (write(fd, buffer, len) == -1)
+			debug("Broadcast PCM write error: %s", strerror(errno));
+
+	}
+
+	pthread_mutex_unlock(&bc->mutex);
+
+}
+
+/**
+ * Get the playback delay of the broadcast group. */
+unsigned int ba_broadcast_get_delay(
+		struct ba_broadcast *bc) {
+	pthread_mutex_lock(&bc->mutex);
+	unsigned int delay = bc->delay_dms;
+	pthread_mutex_unlock(&bc->mutex);
+	return delay;
+}
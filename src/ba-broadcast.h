@@ -0,0 +1,96 @@
+/*
+ * BlueALSA - ba-broadcast.h
+ * Copyright (c) 2016-2024 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#pragma once
+#ifndef BLUEALSA_BABROADCAST_H_
+#define BLUEALSA_BABROADCAST_H_
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "ba-transport-pcm.h"
+
+/**
+ * Maximum number of A2DP source transports in a broadcast group. */
+#define BA_BROADCAST_MEMBERS_MAX 8
+
+struct ba_broadcast_stream;
+
+/**
+ * Broadcast group.
+ *
+ * The group is anchored on the A2DP source PCM (the leader) which is opened
+ * by the client. Audio read from the leader PCM is fed to all other group
+ * members. Members which use the same codec configuration as one of the
+ * running encoders do not encode audio by themselves - the RTP payload
+ * produced by that encoder is replicated to their BT sockets. */
+struct ba_broadcast {
+
+	/* the PCM opened by the client */
+	struct ba_transport_pcm *pcm;
+
+	/* guard group modifications */
+	pthread_mutex_t mutex;
+
+	/* referenced PCMs of the group members (without the leader) */
+	struct ba_transport_pcm *members[BA_BROADCAST_MEMBERS_MAX];
+	size_t members_len;
+
+	/* encoders running for the open group; the first one
+	 * always belongs to the leader PCM */
+	struct ba_broadcast_stream *streams[1 + BA_BROADCAST_MEMBERS_MAX];
+	size_t streams_len;
+
+	/* Group delay in 1/10 of millisecond. All members are aligned to this
+	 * value, so audio is played in sync by all the speakers. */
+	unsigned int delay_dms;
+
+	/* memory self-management */
+	int ref_count;
+
+};
+
+struct ba_broadcast *ba_broadcast_new(
+		struct ba_transport_pcm *pcm);
+struct ba_broadcast *ba_broadcast_ref(
+		struct ba_broadcast *bc);
+void ba_broadcast_unref(
+		struct ba_broadcast *bc);
+
+int ba_broadcast_set_members(
+		struct ba_broadcast *bc,
+		struct ba_transport_pcm * const *members,
+		size_t members_len);
+void ba_broadcast_remove_member(
+		struct ba_transport_pcm *pcm);
+
+int ba_broadcast_open(struct ba_broadcast *bc);
+void ba_broadcast_close(struct ba_broadcast *bc);
+
+ssize_t ba_broadcast_bt_write(
+		struct ba_transport_pcm *pcm,
+		const void *buffer,
+		size_t count);
+void ba_broadcast_drain(
+		struct ba_transport_pcm *pcm);
+void ba_broadcast_pcm_tee(
+		struct ba_transport_pcm *pcm,
+		const void *buffer,
+		size_t len);
+
+unsigned int ba_broadcast_get_delay(
+		struct ba_broadcast *bc);
+
+#endif
@@ -32,7 +32,7 @@
 /* Initialize global configuration variable. */
 struct ba_config config = {
 
-	.adapters_mutex = PTHREAD_MUTEX_INITIALIZER,
+	.adapters_lock = RWLOCK_INITIALIZER("adapters"),
 
 	.device_seq = 0,
 
@@ -41,6 +41,7 @@ struct ba_config config = {
 	.keep_alive_time = 0,
 
 	.io_thread_rt_priority = 0,
+	.mlock = false,
 
 	.volume_init_level = 0,
 
@@ -77,6 +78,11 @@ struct ba_config config = {
 	.a2dp.force_mono = false,
 	.a2dp.force_44100 = false,
 
+#if ENABLE_MIDI
+	/* Cover the BLE connection interval of most devices. */
+	.midi.latency = 10,
+#endif
+
 	/* Try to use high SBC encoding quality as a default. */
 	.sbc_quality = SBC_QUALITY_HIGH,
 
@@ -113,6 +119,8 @@ struct ba_config config = {
 	/* Set default bitrate to 396.8 kbps. Such value should result in a high
 	 * quality with a guarantee that LC3plus frames will not be fragmented. */
 	.lc3plus_bitrate = 396800,
+	/* Select the packet interval based on the frame duration. */
+	.lc3plus_packet_dms = 0,
 #endif
 
 #if ENABLE_LDAC
@@ -126,6 +134,17 @@ struct ba_config config = {
 	.lhdc_eqmid = LHDCBT_QUALITY_AUTO,
 #endif
 
+#if ENABLE_OPUS
+	/* Transparent quality for music at moderate CPU usage. */
+	.opus_bitrate = 128000,
+	.opus_complexity = 5,
+	/* Some sinks might not handle missing RTP packets gracefully, so do not
+	 * enable discontinuous transmission by default. */
+	.opus_dtx = false,
+	.opus_fec = false,
+	.opus_packet_loss = 5,
+#endif
+
 };
 
 int ba_config_init(void) {
@@ -17,6 +17,7 @@
 #endif
 
 #include <pthread.h>
+#include <sched.h>
 #include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -27,6 +28,10 @@
 #include <gio/gio.h>
 #include <glib.h>
 
+#include "rwlock.h"
+
+struct ba_mix;
+
 struct ba_config {
 
 	/* set of enabled profiles */
@@ -45,7 +50,7 @@ struct ba_config {
 	GDBusConnection *dbus;
 
 	/* adapters indexed by the HCI device ID */
-	pthread_mutex_t adapters_mutex;
+	struct rwlock adapters_lock;
 	struct ba_adapter *adapters[HCI_MAX_DEV];
 
 	/* List of HCI names (or BT addresses) used for adapters filtering
@@ -69,6 +74,24 @@ struct ba_config {
 	/* real-time scheduling priority of transport IO threads */
 	int io_thread_rt_priority;
 
+	/* CPU affinity of BlueALSA threads (empty set means all CPUs) */
+	struct {
+		/* transport IO threads per profile */
+		cpu_set_t a2dp;
+		cpu_set_t sco;
+		/* RFCOMM (HFP/HSP signaling) threads */
+		cpu_set_t rfcomm;
+		/* SCO connection dispatcher threads */
+		cpu_set_t sco_dispatcher;
+		/* BLE-MIDI IO threads */
+		cpu_set_t midi;
+		/* main loop and D-Bus worker threads */
+		cpu_set_t main;
+	} cpu_affinity;
+
+	/* lock all current and future memory pages in RAM */
+	bool mlock;
+
 	/* the initial volume level */
 	int volume_init_level;
 
@@ -121,12 +144,18 @@ struct ba_config {
 		 * to force lower sampling in order to save Bluetooth bandwidth. */
 		bool force_44100;
 
+		/* Aggregated capture PCM for all A2DP sink PCMs. If not NULL, audio
+		 * decoded by all A2DP sink transports is mixed into single stream. */
+		struct ba_mix *mix;
+
 	} a2dp;
 
 #if ENABLE_MIDI
 	struct {
 		/* advertise BLE-MIDI via LE advertisement */
 		bool advertise;
+		/* constant latency (in ms) of the incoming MIDI events */
+		unsigned int latency;
 	} midi;
 #endif
 
@@ -136,6 +165,8 @@ struct ba_config {
 	 * is also known as SBC XQ Dual Channel HD. The "+" version uses bitpool 47
 	 * instead of 38. */
 	uint8_t sbc_quality;
+	/* adapt SBC bit-pool to the BT link congestion */
+	bool sbc_dynamic_bitpool;
 
 #if ENABLE_AAC
 	bool aac_afterburner;
@@ -152,6 +183,10 @@ struct ba_config {
 
 #if ENABLE_LC3PLUS
 	unsigned int lc3plus_bitrate;
+	/* prefer the shortest frame duration */
+	bool lc3plus_low_latency;
+	/* target RTP packet interval in 1/10 of millisecond */
+	unsigned int lc3plus_packet_dms;
 #endif
 
 #if ENABLE_LDAC
@@ -163,6 +198,16 @@ struct ba_config {
 	uint8_t lhdc_eqmid;
 	// TODO: LLAC/V3/V4, bit depth, sample frequency, LLAC bitrate
 #endif
+
+#if ENABLE_OPUS
+	/* encoder bit rate per audio channel */
+	unsigned int opus_bitrate;
+	uint8_t opus_complexity;
+	bool opus_dtx;
+	bool opus_fec;
+	/* minimal expected packet loss percentage used with in-band FEC */
+	uint8_t opus_packet_loss;
+#endif
 };
 
 /* Global BlueALSA configuration. */
@@ -17,6 +17,7 @@
 #include "ba-config.h"
 #include "ba-transport.h"
 #include "hci.h"
+#include "rwlock.h"
 #include "storage.h"
 #include "shared/defs.h"
 #include "shared/log.h"
@@ -44,12 +45,12 @@ struct ba_device *ba_device_new(
 	d->battery.charge = -1;
 	d->battery.health = -1;
 
-	pthread_mutex_init(&d->transports_mutex, NULL);
+	rwlock_init(&d->transports_lock, d->ba_dbus_path);
 	d->transports = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, NULL);
 
-	pthread_mutex_lock(&adapter->devices_mutex);
+	rwlock_wrlock(&adapter->devices_lock);
 	g_hash_table_insert(adapter->devices, &d->addr, d);
-	pthread_mutex_unlock(&adapter->devices_mutex);
+	rwlock_wrunlock(&adapter->devices_lock);
 
 	/* load data from persistent storage */
 	storage_device_load(d);
@@ -63,23 +64,17 @@ struct ba_device *ba_device_lookup(
 
 	struct ba_device *d;
 
-	pthread_mutex_lock(MUTABLE(&adapter->devices_mutex));
+	rwlock_rdlock(MUTABLE(&adapter->devices_lock));
 	if ((d = g_hash_table_lookup(adapter->devices, addr)) != NULL)
-		d->ref_count++;
-	pthread_mutex_unlock(MUTABLE(&adapter->devices_mutex));
+		atomic_fetch_add_explicit(&d->ref_count, 1, memory_order_relaxed);
+	rwlock_rdunlock(MUTABLE(&adapter->devices_lock));
 
 	return d;
 }
 
 struct ba_device *ba_device_ref(
 		struct ba_device *d) {
-
-	struct ba_adapter *a = d->a;
-
-	pthread_mutex_lock(&a->devices_mutex);
-	d->ref_count++;
-	pthread_mutex_unlock(&a->devices_mutex);
-
+	atomic_fetch_add_explicit(&d->ref_count, 1, memory_order_relaxed);
 	return d;
 }
 
@@ -104,18 +99,18 @@ void ba_device_destroy(struct ba_device *d) {
 		GHashTableIter iter;
 		struct ba_transport *t;
 
-		pthread_mutex_lock(&d->transports_mutex);
+		rwlock_wrlock(&d->transports_lock);
 
 		g_hash_table_iter_init(&iter, d->transports);
 		if (!g_hash_table_iter_next(&iter, NULL, (gpointer)&t)) {
-			pthread_mutex_unlock(&d->transports_mutex);
+			rwlock_wrunlock(&d->transports_lock);
 			break;
 		}
 
-		t->ref_count++;
+		atomic_fetch_add_explicit(&t->ref_count, 1, memory_order_relaxed);
 		g_hash_table_iter_steal(&iter);
 
-		pthread_mutex_unlock(&d->transports_mutex);
+		rwlock_wrunlock(&d->transports_lock);
 
 		ba_transport_destroy(t);
 	}
@@ -128,11 +123,15 @@ void ba_device_unref(struct ba_device *d) {
 	int ref_count;
 	struct ba_adapter *a = d->a;
 
-	pthread_mutex_lock(&a->devices_mutex);
-	if ((ref_count = --d->ref_count) == 0)
+	if (rwlock_ref_dec_unless_last(&d->ref_count))
+		return;
+
+	rwlock_wrlock(&a->devices_lock);
+	if ((ref_count = atomic_fetch_sub_explicit(&d->ref_count, 1,
+					memory_order_acq_rel) - 1) == 0)
 		/* detach device from the adapter */
 		g_hash_table_steal(a->devices, &d->addr);
-	pthread_mutex_unlock(&a->devices_mutex);
+	rwlock_wrunlock(&a->devices_lock);
 
 	if (ref_count > 0)
 		return;
@@ -145,7 +144,7 @@ void ba_device_unref(struct ba_device *d) {
 
 	ba_adapter_unref(a);
 	g_hash_table_unref(d->transports);
-	pthread_mutex_destroy(&d->transports_mutex);
+	rwlock_destroy(&d->transports_lock);
 	g_free(d->bluez_dbus_path);
 	g_free(d->ba_battery_dbus_path);
 	g_free(d->ba_dbus_path);
@@ -17,12 +17,14 @@
 #endif
 
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdint.h>
 
 #include <bluetooth/bluetooth.h>
 #include <glib.h>
 
 #include "ba-adapter.h"
+#include "rwlock.h"
 
 struct ba_device {
 
@@ -65,11 +67,11 @@ struct ba_device {
 	const GArray *sep_configs;
 
 	/* hash-map with connected transports */
-	pthread_mutex_t transports_mutex;
+	struct rwlock transports_lock;
 	GHashTable *transports;
 
 	/* memory self-management */
-	int ref_count;
+	atomic_int ref_count;
 
 };
 
@@ -0,0 +1,522 @@
+/*
+ * BlueALSA - ba-mix.c
+ * Copyright (c) 2016-2024 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include "ba-mix.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "ba-config.h"
+#include "ba-transport.h"
+#include "ba-transport-pcm.h"
+#include "bluealsa-dbus.h"
+#include "utils.h"
+#include "shared/defs.h"
+#include "shared/log.h"
+#include "shared/rt.h"
+
+/**
+ * Capacity of the per-source ring buffer in mix periods. */
+#define BA_MIX_BUFFER_PERIODS 20
+
+/**
+ * Number of periods buffered before the source is mixed. It shall be
+ * large enough to absorb the jitter of the incoming BT packets. */
+#define BA_MIX_PRIME_PERIODS 3
+
+/**
+ * Time after which a source without new data is considered idle. */
+#define BA_MIX_IDLE_TIMEOUT_MS 500
+
+/**
+ * Convert gain in 1/100 of decibel to 16.16 fixed-point scale factor. */
+static int32_t ba_mix_gain_to_scale(int gain) {
+	return lround(65536.0 * pow(10, gain / 2000.0));
+}
+
+static bool ba_mix_source_is_idle(
+		const struct ba_mix_source *src,
+		const struct timespec *now) {
+	struct timespec diff;
+	timespecsub(now, &src->ts_write, &diff);
+	return diff.tv_sec * 1000 + diff.tv_nsec / 1000000 > BA_MIX_IDLE_TIMEOUT_MS;
+}
+
+static void ba_mix_source_reset(
+		struct ba_mix_source *src,
+		unsigned int rate,
+		unsigned int mix_rate) {
+	src->rate = rate;
+	src->step = ((uint64_t)rate << 16) / mix_rate;
+	src->pos = 0;
+	memset(src->prev, 0, sizeof(src->prev));
+	src->buffer_head = 0;
+	src->buffer_len = 0;
+	src->primed = false;
+}
+
+static void ba_mix_source_push(
+		struct ba_mix_source *src,
+		size_t size,
+		const int32_t *frame) {
+
+	/* In case of overrun drop the oldest frame, so the
+	 * latency of the source will not grow indefinitely. */
+	if (src->buffer_len == size) {
+		src->buffer_head = (src->buffer_head + 1) % size;
+		src->buffer_len--;
+	}
+
+	int16_t *dest = &src->buffer[((src->buffer_head + src->buffer_len) % size) * BA_MIX_CHANNELS];
+	for (size_t i = 0; i < BA_MIX_CHANNELS; i++)
+		dest[i] = MIN(MAX(frame[i], INT16_MIN), INT16_MAX);
+	src->buffer_len++;
+
+}
+
+/**
+ * Get PCM sample as a 16-bit value. */
+static int32_t ba_mix_pcm_sample(
+		uint16_t format,
+		const void *buffer,
+		size_t i) {
+	switch (BA_TRANSPORT_PCM_FORMAT_BYTES(format)) {
+	case 2:
+		return ((const int16_t *)buffer)[i];
+	case 4:
+		return ((const int32_t *)buffer)[i] >> (BA_TRANSPORT_PCM_FORMAT_WIDTH(format) - 16);
+	default:
+		return 0;
+	}
+}
+
+static void *ba_mix_thread(struct ba_mix *mix) {
+
+	const size_t samples = mix->period * BA_MIX_CHANNELS;
+	int16_t *buffer;
+
+	if ((buffer = malloc(samples * sizeof(*buffer))) == NULL) {
+		error("Couldn't create mix buffer: %s", strerror(errno));
+		return NULL;
+	}
+
+	struct asrsync asrs;
+	asrsync_init(&asrs, mix->rate);
+
+	debug("Starting A2DP sink mix loop: %u Hz", mix->rate);
+	for (;;) {
+
+		pthread_mutex_lock(&mix->mutex);
+		const bool running = mix->running;
+		const bool paused = mix->paused;
+		const int fd = mix->fd;
+		pthread_mutex_unlock(&mix->mutex);
+
+		if (!running)
+			break;
+
+		/* Sources are consumed even if the mix is paused, so after
+		 * resume the client will receive the most recent audio. */
+		ba_mix_process(mix, buffer, mix->period);
+
+		if (!paused && write(fd, buffer, samples * sizeof(*buffer)) == -1) {
+			if (errno == EAGAIN)
+				warn("Dropping PCM frames: %s", "PCM overrun");
+			else if (errno != EPIPE)
+				error("PCM write error: %s", strerror(errno));
+		}
+
+		pthread_mutex_lock(&mix->mutex);
+		const unsigned int delay = mix->delay_dms;
+		const bool report = ABS((int)delay - (int)mix->reported_delay_dms) >= 10;
+		if (report)
+			mix->reported_delay_dms = delay;
+		pthread_mutex_unlock(&mix->mutex);
+
+		if (report)
+			bluealsa_dbus_mix_update(mix, BA_DBUS_PCM_UPDATE_DELAY);
+
+		asrsync_sync(&asrs, mix->period);
+		atomic_store_explicit(&mix->deadline_misses, asrs.misses,
+				memory_order_relaxed);
+
+	}
+
+	debug("Exiting A2DP sink mix loop");
+	free(buffer);
+	return NULL;
+}
+
+/**
+ * Create new A2DP sink mix.
+ *
+ * @param rate Sample rate of the mix PCM.
+ * @param ducking Attenuation of background sources in 1/100 of decibel.
+ * @return On success, the pointer to the newly allocated mix structure is
+ *   returned. Otherwise, NULL is returned and errno is set appropriately. */
+struct ba_mix *ba_mix_new(
+		unsigned int rate,
+		int ducking) {
+
+	struct ba_mix *mix;
+	if ((mix = calloc(1, sizeof(*mix))) == NULL)
+		return NULL;
+
+	mix->rate = rate;
+	/* mix audio in 10 ms chunks */
+	mix->period = rate / 100;
+	mix->ducking = ducking;
+	mix->fd = -1;
+
+	if ((mix->acc = malloc(mix->period * BA_MIX_CHANNELS * sizeof(*mix->acc))) == NULL) {
+		free(mix);
+		return NULL;
+	}
+
+	pthread_mutex_init(&mix->mutex, NULL);
+	pthread_mutex_init(&mix->client_mtx, NULL);
+
+	mix->ba_dbus_path = g_strdup("/org/bluealsa/mix");
+
+	return mix;
+}
+
+void ba_mix_free(
+		struct ba_mix *mix) {
+
+	ba_mix_close(mix);
+
+	for (size_t i = 0; i < mix->sources_len; i++)
+		free(mix->sources[i].buffer);
+
+	pthread_mutex_destroy(&mix->mutex);
+	pthread_mutex_destroy(&mix->client_mtx);
+	g_free(mix->ba_dbus_path);
+	free(mix->acc);
+	free(mix);
+
+}
+
+/**
+ * Start mixing A2DP sink PCMs.
+ *
+ * @param mix The mix structure.
+ * @param fd Write end of the PCM FIFO. On success, the ownership of the
+ *   file descriptor is transferred to the mix.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set appropriately. */
+int ba_mix_open(
+		struct ba_mix *mix,
+		int fd) {
+
+	int rv = -1;
+
+	pthread_mutex_lock(&mix->mutex);
+
+	if (mix->running) {
+		errno = EBUSY;
+		goto final;
+	}
+
+	/* discard everything buffered before the mix was opened */
+	for (size_t i = 0; i < mix->sources_len; i++)
+		ba_mix_source_reset(&mix->sources[i], mix->sources[i].rate, mix->rate);
+
+	mix->fd = fd;
+	mix->paused = false;
+	mix->running = true;
+
+	int ret;
+	if ((ret = pthread_create(&mix->tid, NULL,
+					PTHREAD_FUNC(ba_mix_thread), mix)) != 0) {
+		mix->running = false;
+		mix->fd = -1;
+		errno = ret;
+		goto final;
+	}
+
+	if ((ret = thread_set_cpu_affinity(mix->tid, &config.cpu_affinity.a2dp)) != 0)
+		warn("Couldn't set A2DP sink mix CPU affinity: %s", strerror(ret));
+
+	pthread_setname_np(mix->tid, "ba-a2dp-mix");
+	debug("Opened A2DP sink mix: %d", fd);
+	rv = 0;
+
+final:
+	pthread_mutex_unlock(&mix->mutex);
+	if (rv == 0)
+		bluealsa_dbus_mix_update(mix, BA_DBUS_PCM_UPDATE_RUNNING);
+	return rv;
+}
+
+/**
+ * Stop mixing and close the PCM FIFO. */
+void ba_mix_close(
+		struct ba_mix *mix) {
+
+	pthread_mutex_lock(&mix->mutex);
+
+	const bool running = mix->running;
+	mix->running = false;
+
+	if (mix->controller != NULL) {
+		g_source_destroy(mix->controller);
+		g_source_unref(mix->controller);
+		mix->controller = NULL;
+	}
+
+	pthread_mutex_unlock(&mix->mutex);
+
+	if (!running)
+		return;
+
+	pthread_join(mix->tid, NULL);
+
+	debug("Closing A2DP sink mix: %d", mix->fd);
+	close(mix->fd);
+	mix->fd = -1;
+
+	bluealsa_dbus_mix_update(mix, BA_DBUS_PCM_UPDATE_RUNNING);
+
+}
+
+bool ba_mix_is_open(
+		struct ba_mix *mix) {
+	pthread_mutex_lock(&mix->mutex);
+	const bool running = mix->running;
+	pthread_mutex_unlock(&mix->mutex);
+	return running;
+}
+
+/**
+ * Feed the mix with audio decoded by the A2DP sink PCM.
+ *
+ * Audio is converted to 16-bit stereo and resampled to the sample rate of
+ * the mix, so all sources can be summed up by the mixer thread.
+ *
+ * @return On success, the number of consumed samples is returned (if the
+ *   mix is not open, all samples are discarded). Otherwise, -1 is returned
+ *   and errno is set appropriately. */
+ssize_t ba_mix_pcm_write(
+		struct ba_mix *mix,
+		struct ba_transport_pcm *pcm,
+		const void *buffer,
+		size_t samples) {
+
+	const size_t size = mix->period * BA_MIX_BUFFER_PERIODS;
+	struct ba_mix_source *src = NULL;
+	ssize_t rv = samples;
+
+	pthread_mutex_lock(&mix->mutex);
+
+	if (!mix->running)
+		goto final;
+
+	for (size_t i = 0; i < mix->sources_len; i++)
+		if (mix->sources[i].pcm == pcm) {
+			src = &mix->sources[i];
+			break;
+		}
+
+	if (src == NULL) {
+
+		if (mix->sources_len == ARRAYSIZE(mix->sources)) {
+			rv = -1;
+			errno = ENOSPC;
+			goto final;
+		}
+
+		int16_t *buffer;
+		if ((buffer = malloc(size * BA_MIX_CHANNELS * sizeof(*buffer))) == NULL) {
+			rv = -1;
+			goto final;
+		}
+
+		src = &mix->sources[mix->sources_len++];
+		memset(src, 0, sizeof(*src));
+		src->pcm = pcm;
+		src->buffer = buffer;
+		src->gain = ba_mix_gain_to_scale(pcm->mix_gain);
+		ba_mix_source_reset(src, pcm->rate, mix->rate);
+
+		debug("New A2DP sink mix source: %s", pcm->ba_dbus_path);
+
+	}
+
+	if (src->rate != pcm->rate)
+		ba_mix_source_reset(src, pcm->rate, mix->rate);
+
+	struct timespec now;
+	gettimestamp(&now);
+
+	/* Source which was idle for some time starts new activity period,
+	 * which makes it the foreground source for the ducking policy. */
+	if (ba_mix_source_is_idle(src, &now))
+		src->ts_start = now;
+	src->ts_write = now;
+
+	src->delay_dms = pcm->codec_delay_dms + pcm->processing_delay_dms;
+
+	const unsigned int channels = pcm->channels;
+	const size_t frames = samples / channels;
+
+	for (size_t i = 0; i < frames; i++) {
+
+		int32_t frame[BA_MIX_CHANNELS];
+		for (size_t ch = 0; ch < BA_MIX_CHANNELS; ch++)
+			frame[ch] = ba_mix_pcm_sample(pcm->format, buffer,
+					i * channels + MIN(ch, channels - 1));
+
+		/* Linear interpolation between the previous input frame and the
+		 * current one. The position is expressed in input frame units. */
+		while (src->pos < 0x10000) {
+			int32_t out[BA_MIX_CHANNELS];
+			for (size_t ch = 0; ch < BA_MIX_CHANNELS; ch++)
+				out[ch] = src->prev[ch] +
+					(((int64_t)(frame[ch] - src->prev[ch]) * src->pos) >> 16);
+			ba_mix_source_push(src, size, out);
+			src->pos += src->step;
+		}
+
+		src->pos -= 0x10000;
+		memcpy(src->prev, frame, sizeof(src->prev));
+
+	}
+
+final:
+	pthread_mutex_unlock(&mix->mutex);
+	return rv;
+}
+
+/**
+ * Remove A2DP sink PCM from the mix. */
+void ba_mix_pcm_remove(
+		struct ba_mix *mix,
+		struct ba_transport_pcm *pcm) {
+
+	pthread_mutex_lock(&mix->mutex);
+
+	for (size_t i = 0; i < mix->sources_len; i++)
+		if (mix->sources[i].pcm == pcm) {
+			debug("Removing A2DP sink mix source: %s", pcm->ba_dbus_path);
+			free(mix->sources[i].buffer);
+			mix->sources[i] = mix->sources[--mix->sources_len];
+			break;
+		}
+
+	pthread_mutex_unlock(&mix->mutex);
+
+}
+
+/**
+ * Mix all A2DP sink sources.
+ *
+ * The most recently started source is the foreground one. When there is
+ * more than one source playing, all other sources are attenuated by the
+ * ducking level. On top of that, every source has its own gain.
+ *
+ * @param mix The mix structure.
+ * @param buffer Buffer for mixed 16-bit stereo audio.
+ * @param frames The number of frames to mix. It shall not be greater than
+ *   the mix period. */
+void ba_mix_process(
+		struct ba_mix *mix,
+		int16_t *buffer,
+		size_t frames) {
+
+	const size_t size = mix->period * BA_MIX_BUFFER_PERIODS;
+	int32_t *acc = mix->acc;
+
+	frames = MIN(frames, mix->period);
+	const size_t samples = frames * BA_MIX_CHANNELS;
+
+	pthread_mutex_lock(&mix->mutex);
+
+	memset(acc, 0, samples * sizeof(*acc));
+
+	struct timespec now;
+	gettimestamp(&now);
+
+	const struct ba_mix_source *fg = NULL;
+	for (size_t i = 0; i < mix->sources_len; i++) {
+		const struct ba_mix_source *src = &mix->sources[i];
+		if (ba_mix_source_is_idle(src, &now))
+			continue;
+		struct timespec diff;
+		if (fg == NULL || difftimespec(&fg->ts_start, &src->ts_start, &diff) > 0)
+			fg = src;
+	}
+
+	unsigned int delay_dms = 0;
+	for (size_t i = 0; i < mix->sources_len; i++) {
+		struct ba_mix_source *src = &mix->sources[i];
+
+		if (!src->primed) {
+			if (src->buffer_len < mix->period * BA_MIX_PRIME_PERIODS)
+				continue;
+			src->primed = true;
+		}
+
+		int gain = src->pcm->mix_gain;
+		if (fg != NULL && src != fg)
+			gain -= mix->ducking;
+
+		/* Ramp the gain across the whole chunk in order to avoid
+		 * audible clicks when the ducking kicks in. */
+		const int32_t gain0 = src->gain;
+		const int32_t gain1 = ba_mix_gain_to_scale(gain);
+		const size_t len = MIN(src->buffer_len, frames);
+
+		for (size_t f = 0; f < len; f++) {
+			const int16_t *frame = &src->buffer[((src->buffer_head + f) % size) * BA_MIX_CHANNELS];
+			const int64_t g = gain0 + (int64_t)(gain1 - gain0) * f / frames;
+			for (size_t ch = 0; ch < BA_MIX_CHANNELS; ch++)
+				acc[f * BA_MIX_CHANNELS + ch] += (frame[ch] * g) >> 16;
+		}
+
+		src->gain = gain1;
+		src->buffer_head = (src->buffer_head + len) % size;
+		src->buffer_len -= len;
+
+		/* on underrun wait for the buffer to be filled again */
+		if (len < frames)
+			src->primed = false;
+
+		delay_dms = MAX(delay_dms, src->delay_dms);
+
+	}
+
+	/* Total delay consists of the largest decoder delay, the amount of
+	 * buffered audio (pre-fill) and the resampler delay (one frame). */
+	mix->delay_dms = delay_dms + 10000 * (mix->period * BA_MIX_PRIME_PERIODS + 1) / mix->rate;
+
+	for (size_t i = 0; i < samples; i++)
+		buffer[i] = MIN(MAX(acc[i], INT16_MIN), INT16_MAX);
+
+	pthread_mutex_unlock(&mix->mutex);
+
+}
+
+/**
+ * Get the delay of the mix PCM in 1/10 of millisecond. */
+unsigned int ba_mix_get_delay(
+		struct ba_mix *mix) {
+	pthread_mutex_lock(&mix->mutex);
+	const unsigned int delay = mix->delay_dms;
+	pthread_mutex_unlock(&mix->mutex);
+	return delay;
+}
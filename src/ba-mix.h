@@ -0,0 +1,155 @@
+/*
+ * BlueALSA - ba-mix.h
+ * Copyright (c) 2016-2024 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#pragma once
+#ifndef BLUEALSA_BAMIX_H_
+#define BLUEALSA_BAMIX_H_
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include <glib.h>
+
+#include "ba-transport-pcm.h"
+
+/**
+ * Maximum number of A2DP sink PCMs mixed together. */
+#define BA_MIX_SOURCES_MAX 8
+
+/**
+ * Number of channels of the mix PCM. */
+#define BA_MIX_CHANNELS 2
+
+/**
+ * Single A2DP sink PCM contributing to the mix. */
+struct ba_mix_source {
+
+	/* decoder PCM (not referenced) */
+	struct ba_transport_pcm *pcm;
+
+	/* sample rate of the decoder PCM */
+	unsigned int rate;
+	/* linear resampler step and position in 16.16 fixed-point format */
+	uint32_t step;
+	uint32_t pos;
+	/* the last input frame */
+	int32_t prev[BA_MIX_CHANNELS];
+
+	/* resampled audio ring buffer */
+	int16_t *buffer;
+	size_t buffer_head;
+	size_t buffer_len;
+	/* whether buffer was pre-filled */
+	bool primed;
+
+	/* applied gain in 16.16 fixed-point format */
+	int32_t gain;
+
+	/* delay of the decoder PCM */
+	unsigned int delay_dms;
+
+	/* beginning of the current activity period */
+	struct timespec ts_start;
+	/* time-stamp of the last write */
+	struct timespec ts_write;
+
+};
+
+/**
+ * Aggregated A2DP sink capture PCM. */
+struct ba_mix {
+
+	/* guard mix data updates */
+	pthread_mutex_t mutex;
+
+	/* PCM sample rate of the mix */
+	unsigned int rate;
+	/* number of frames mixed at once */
+	size_t period;
+	/* mixing accumulator for one period */
+	int32_t *acc;
+
+	/* Attenuation of background sources in 1/100 of decibel. When some
+	 * source starts playing, all other sources are ducked. */
+	int ducking;
+
+	struct ba_mix_source sources[BA_MIX_SOURCES_MAX];
+	size_t sources_len;
+
+	/* PCM file descriptor */
+	int fd;
+	/* indicates whether mix is paused */
+	bool paused;
+
+	/* mixer thread */
+	pthread_t tid;
+	bool running;
+	/* the number of deadlines missed by the mixer thread */
+	atomic_uint deadline_misses;
+
+	/* Delay of the mix PCM in 1/10 of millisecond. */
+	unsigned int delay_dms;
+	/* the last delay reported via D-Bus */
+	unsigned int reported_delay_dms;
+
+	/* new PCM client mutex */
+	pthread_mutex_t client_mtx;
+
+	/* source watch for controller socket */
+	GSource *controller;
+
+	/* exported PCM D-Bus API */
+	char *ba_dbus_path;
+	bool ba_dbus_exported;
+
+};
+
+struct ba_mix *ba_mix_new(
+		unsigned int rate,
+		int ducking);
+void ba_mix_free(
+		struct ba_mix *mix);
+
+int ba_mix_open(
+		struct ba_mix *mix,
+		int fd);
+void ba_mix_close(
+		struct ba_mix *mix);
+
+bool ba_mix_is_open(
+		struct ba_mix *mix);
+
+ssize_t ba_mix_pcm_write(
+		struct ba_mix *mix,
+		struct ba_transport_pcm *pcm,
+		const void *buffer,
+		size_t samples);
+void ba_mix_pcm_remove(
+		struct ba_mix *mix,
+		struct ba_transport_pcm *pcm);
+
+void ba_mix_process(
+		struct ba_mix *mix,
+		int16_t *buffer,
+		size_t frames);
+
+unsigned int ba_mix_get_delay(
+		struct ba_mix *mix);
+
+#endif
@@ -1,6 +1,6 @@
 /*
  * BlueALSA - ba-rfcomm.c
- * Copyright (c) 2016-2024 Arkadiusz Bokowy
+ * Copyright (c) 2016-2025 Arkadiusz Bokowy
  *
  * This file is a part of bluez-alsa.
  *
@@ -15,14 +15,16 @@
 #endif
 
 #include <errno.h>
-#include <poll.h>
 #include <pthread.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <glib.h>
@@ -34,42 +36,34 @@
 #include "ba-transport-pcm.h"
 #include "bluealsa-dbus.h"
 #include "bluez.h"
+#include "storage.h"
+#include "utils.h"
 #include "shared/defs.h"
 #include "shared/log.h"
-
-/**
- * Structure used for buffered reading from the RFCOMM. */
-struct at_reader {
-	struct bt_at at;
-	char buffer[256];
-	/* pointer to the next message within the buffer */
-	char *next;
-};
+#include "shared/rt.h"
 
 /**
  * Read AT message.
  *
- * Upon error it is required to set the next pointer of the reader structure
- * to NULL. Otherwise, this function might fail indefinitely.
+ * AT message might be split across several RFCOMM reads, or a single read
+ * might contain several messages. In the latter case, this function shall
+ * be called until the next pointer of the reader structure is NULL.
  *
  * @param fd RFCOMM socket file descriptor.
  * @param reader Pointer to initialized reader structure.
  * @return On success this function returns 0. Otherwise, -1 is returned and
- *   errno is set to indicate the error. */
+ *   errno is set to indicate the error. If the message is not complete yet,
+ *   errno is set to EAGAIN. */
 static int rfcomm_read_at(int fd, struct at_reader *reader) {
 
-	char *buffer = reader->buffer;
-	char *msg = reader->next;
-	char *tmp;
-
 	/* In case of reading more than one message from the RFCOMM, we have to
 	 * parse all of them before we can read from the socket once more. */
-	if (msg == NULL) {
+	if (reader->next == NULL) {
 
 		ssize_t len;
 
 retry:
-		if ((len = read(fd, buffer, sizeof(reader->buffer))) == -1) {
+		if ((len = read(fd, reader->buffer, sizeof(reader->buffer))) == -1) {
 			if (errno == EINTR)
 				goto retry;
 			return -1;
@@ -80,19 +74,21 @@ retry:
 			return -1;
 		}
 
-		buffer[len] = '\0';
-		msg = buffer;
+		reader->next = reader->buffer;
+		reader->next_len = len;
 	}
 
 	/* parse AT message received from the RFCOMM */
-	if ((tmp = at_parse(msg, &reader->at)) == NULL) {
-		reader->next = msg;
-		errno = EBADMSG;
+	int rv = at_parser_feed(&reader->parser, &reader->next, &reader->next_len);
+	if (reader->next_len == 0)
+		reader->next = NULL;
+
+	if (rv == 0) {
+		errno = EAGAIN;
 		return -1;
 	}
 
-	reader->next = tmp[0] != '\0' ? tmp : NULL;
-	return 0;
+	return rv == 1 ? 0 : -1;
 }
 
 /**
@@ -148,6 +144,34 @@ static void rfcomm_finalize_codec_selection(struct ba_rfcomm *r) {
 
 }
 
+/**
+ * Get features supported by the remote device. */
+static uint32_t rfcomm_get_remote_features(const struct ba_rfcomm *r) {
+	if (r->sco->profile & BA_TRANSPORT_PROFILE_HFP_AG)
+		return r->hf_features;
+	return r->ag_features;
+}
+
+/**
+ * Check whether SLC data cached during the last connection matches.
+ *
+ * If the remote device reports the same features as during the last
+ * connection, in which the codec selection succeeded, the codec connection
+ * can be set up right after the SLC establishment, without waiting for the
+ * connection to become idle. */
+static bool rfcomm_slc_cache_match(const struct ba_rfcomm *r) {
+	return r->slc_cache.codec_id != HFP_CODEC_UNDEFINED &&
+		r->slc_cache.features == rfcomm_get_remote_features(r);
+}
+
+/**
+ * Update SLC cache with the codec selection result. */
+static void rfcomm_slc_cache_update(struct ba_rfcomm *r, uint8_t codec_id) {
+	r->slc_cache.features = rfcomm_get_remote_features(r);
+	r->slc_cache.codec_id = codec_id;
+	storage_hfp_slc_update(r->sco, r->slc_cache.features, codec_id);
+}
+
 /**
  * Handle AT command response code. */
 static int rfcomm_handler_resp_ok_cb(struct ba_rfcomm *r, const struct bt_at *at) {
@@ -570,6 +594,7 @@ static int rfcomm_handler_bcs_set_cb(struct ba_rfcomm *r, const struct bt_at *at
 	uint8_t codec_id;
 	if ((codec_id = atoi(at->value)) != r->codec_id) {
 		warn("Codec not acknowledged: %s != %u", at->value, r->codec_id);
+		rfcomm_slc_cache_update(r, HFP_CODEC_UNDEFINED);
 		rv = rfcomm_write_at(fd, AT_TYPE_RESP, NULL, "ERROR");
 		goto final;
 	}
@@ -580,6 +605,7 @@ static int rfcomm_handler_bcs_set_cb(struct ba_rfcomm *r, const struct bt_at *at
 	/* Codec negotiation process is complete. Update transport and
 	 * notify connected clients, that transport has been changed. */
 	ba_transport_set_codec(t_sco, codec_id);
+	rfcomm_slc_cache_update(r, codec_id);
 
 final:
 	rfcomm_finalize_codec_selection(r);
@@ -596,8 +622,11 @@ static int rfcomm_handler_resp_bcs_ok_cb(struct ba_rfcomm *r, const struct bt_at
 	if (!r->handler_resp_ok_success) {
 		warn("Codec selection not finalized: %u", r->codec_id);
 		ba_transport_set_codec(t_sco, HFP_CODEC_UNDEFINED);
+		rfcomm_slc_cache_update(r, HFP_CODEC_UNDEFINED);
 		rfcomm_finalize_codec_selection(r);
 	}
+	else
+		rfcomm_slc_cache_update(r, r->codec_id);
 
 	return 0;
 }
@@ -931,9 +960,25 @@ static const struct ba_rfcomm_handler rfcomm_handler_xapl_set = {
 static const struct ba_rfcomm_handler rfcomm_handler_xapl_resp = {
 	AT_TYPE_RESP, "+XAPL", rfcomm_handler_xapl_resp_cb };
 
+/* Number of slots in the AT handlers hash table. It shall be a power of
+ * two, and it shall be at least two times bigger than the number of all
+ * available handlers, so the open addressing probe sequence is short. */
+#define RFCOMM_HANDLERS_HASH_SIZE 64
+
+static const struct ba_rfcomm_handler *rfcomm_handlers_hash[RFCOMM_HANDLERS_HASH_SIZE];
+static pthread_once_t rfcomm_handlers_hash_once = PTHREAD_ONCE_INIT;
+
 /**
- * Get callback (if available) for given AT message. */
-static ba_rfcomm_callback *rfcomm_get_callback(const struct bt_at *at) {
+ * Calculate FNV-1a hash of the AT message type and command. */
+static unsigned int rfcomm_handler_hash(enum bt_at_type type, const char *command) {
+	uint32_t hash = 2166136261u;
+	hash = (hash ^ (uint8_t)type) * 16777619u;
+	while (*command != '\0')
+		hash = (hash ^ (uint8_t)*command++) * 16777619u;
+	return hash & (RFCOMM_HANDLERS_HASH_SIZE - 1);
+}
+
+static void rfcomm_handlers_hash_init(void) {
 
 	static const struct ba_rfcomm_handler *handlers[] = {
 		&rfcomm_handler_resp_ok,
@@ -959,12 +1004,31 @@ static ba_rfcomm_callback *rfcomm_get_callback(const struct bt_at *at) {
 		&rfcomm_handler_xapl_resp,
 	};
 
+	_Static_assert(ARRAYSIZE(handlers) * 2 <= RFCOMM_HANDLERS_HASH_SIZE,
+			"AT handlers hash table too small");
+
 	for (size_t i = 0; i < ARRAYSIZE(handlers); i++) {
-		if (handlers[i]->type != at->type)
-			continue;
-		if (strcmp(handlers[i]->command, at->command) != 0)
-			continue;
-		return handlers[i]->callback;
+		unsigned int slot = rfcomm_handler_hash(handlers[i]->type, handlers[i]->command);
+		while (rfcomm_handlers_hash[slot] != NULL)
+			slot = (slot + 1) & (RFCOMM_HANDLERS_HASH_SIZE - 1);
+		rfcomm_handlers_hash[slot] = handlers[i];
+	}
+
+}
+
+/**
+ * Get callback (if available) for given AT message. */
+static ba_rfcomm_callback *rfcomm_get_callback(const struct bt_at *at) {
+
+	pthread_once(&rfcomm_handlers_hash_once, rfcomm_handlers_hash_init);
+
+	const struct ba_rfcomm_handler *handler;
+	unsigned int slot = rfcomm_handler_hash(at->type, at->command);
+	while ((handler = rfcomm_handlers_hash[slot]) != NULL) {
+		if (handler->type == at->type &&
+				strcmp(handler->command, at->command) == 0)
+			return handler->callback;
+		slot = (slot + 1) & (RFCOMM_HANDLERS_HASH_SIZE - 1);
 	}
 
 	return NULL;
@@ -1168,11 +1232,96 @@ static int rfcomm_notify_volume_change_spk(struct ba_rfcomm *r, bool force) {
 	return 0;
 }
 
-static void rfcomm_thread_cleanup(struct ba_rfcomm *r) {
+/**
+ * Identifiers of the file descriptors polled by the RFCOMM event loop. */
+enum rfcomm_poll_id {
+	RFCOMM_POLL_SIGNAL,
+	RFCOMM_POLL_RFCOMM,
+	RFCOMM_POLL_HANDLER,
+};
 
-	if (r->fd == -1)
+/**
+ * Encode connection ID and file descriptor identifier as epoll data. */
+#define RFCOMM_POLL_DATA(conn_id, poll_id) ((uint64_t)(conn_id) << 2 | (poll_id))
+
+/**
+ * Single event loop shared by all RFCOMM connections.
+ *
+ * Every RFCOMM connection is a state machine driven by the events from its
+ * sockets and by the SLC stage timeout. Connections are referenced in the
+ * epoll data by an ID, so events of already removed connections can be
+ * safely discarded. The ID 0 is reserved for the event loop control.
+ *
+ * The mutex guards the connections table only. Connections are processed
+ * without holding it, so a stalled RFCOMM link does not block the others.
+ * In order to prevent a connection from being destroyed while the event loop
+ * is processing it, the ID of such connection is stored in the dispatching
+ * field and the destroyer waits for the processing to finish. */
+static struct {
+	/* guard connections table */
+	pthread_mutex_t mutex;
+	/* signaled when the connection processing is done */
+	pthread_cond_t cond;
+	pthread_t thread;
+	int epoll_fd;
+	int event_fd;
+	/* active connections indexed by ID */
+	GHashTable *connections;
+	unsigned int id_next;
+	/* ID of the connection being processed */
+	unsigned int dispatching;
+} rfcomm_engine = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+	.epoll_fd = -1,
+	.event_fd = -1,
+	.id_next = 1,
+};
+
+static bool rfcomm_engine_is_self(void) {
+	return rfcomm_engine.epoll_fd != -1 &&
+		pthread_equal(rfcomm_engine.thread, pthread_self());
+}
+
+static int rfcomm_engine_poll_add(struct ba_rfcomm *r, int fd, enum rfcomm_poll_id id) {
+	struct epoll_event event = { .events = EPOLLIN, .data.u64 = RFCOMM_POLL_DATA(r->id, id) };
+	return epoll_ctl(rfcomm_engine.epoll_fd, EPOLL_CTL_ADD, fd, &event);
+}
+
+static void rfcomm_engine_poll_del(int fd) {
+	epoll_ctl(rfcomm_engine.epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+/**
+ * Close external AT handler connection. */
+static void rfcomm_handler_close(struct ba_rfcomm *r) {
+	if (r->handler_fd_polled != -1)
+		rfcomm_engine_poll_del(r->handler_fd_polled);
+	r->handler_fd_polled = -1;
+	close(r->handler_fd);
+	r->handler_fd = -1;
+}
+
+/**
+ * Close RFCOMM connection and remove it from the event loop.
+ *
+ * This function shall be called with the event loop mutex unlocked. */
+static void rfcomm_connection_close(struct ba_rfcomm *r) {
+
+	if (r->id == 0 || r->fd == -1)
 		return;
 
+	pthread_mutex_lock(&rfcomm_engine.mutex);
+	if (rfcomm_engine.connections != NULL)
+		g_hash_table_remove(rfcomm_engine.connections, GUINT_TO_POINTER(r->id));
+	pthread_mutex_unlock(&rfcomm_engine.mutex);
+
+	rfcomm_engine_poll_del(r->sig_fd[0]);
+	rfcomm_engine_poll_del(r->fd);
+	if (r->handler_fd_polled != -1)
+		rfcomm_engine_poll_del(r->handler_fd_polled);
+	r->handler_fd_polled = -1;
+
 	debug("Closing RFCOMM: %d", r->fd);
 
 	shutdown(r->fd, SHUT_RDWR);
@@ -1204,412 +1353,658 @@ static void rfcomm_thread_cleanup(struct ba_rfcomm *r) {
 
 }
 
-static void *rfcomm_thread(struct ba_rfcomm *r) {
-
-	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-	pthread_cleanup_push(PTHREAD_CLEANUP(rfcomm_thread_cleanup), r);
+/**
+ * Check whether RFCOMM IO error means disconnection. */
+static bool rfcomm_is_disconnected(int err) {
+	switch (err) {
+	case ECONNABORTED:
+	case ECONNRESET:
+	case ENOTCONN:
+	case ETIMEDOUT:
+	case EPIPE:
+		debug("RFCOMM disconnected: %s", strerror(err));
+		return true;
+	default:
+		error("RFCOMM IO error: %s", strerror(err));
+		return false;
+	}
+}
 
-	sigset_t sigset;
-	/* See the ba_transport_pcm_start() function for information
-	 * why we have to mask all signals. */
-	sigfillset(&sigset);
-	pthread_sigmask(SIG_SETMASK, &sigset, NULL);
+/**
+ * Advance the service level connection state machine.
+ *
+ * @param r RFCOMM connection.
+ * @param timeout Address where the timeout (in milliseconds) of the current
+ *   SLC stage will be stored. The -1 value means no timeout.
+ * @return On success this function returns 0. Otherwise, -1 is returned and
+ *   errno is set to indicate the error. */
+static int rfcomm_slc_step(struct ba_rfcomm *r, int *timeout) {
 
 	struct ba_transport * const t_sco = r->sco;
-	struct at_reader reader = { .next = NULL };
-	struct pollfd pfds[] = {
-		{ r->sig_fd[0], POLLIN, 0 },
-		{ r->fd, POLLIN, 0 },
-		{ -1, POLLIN, 0 },
-	};
+	char tmp[256] = "";
 
-	debug("Starting RFCOMM loop: %s", ba_transport_debug_name(t_sco));
-	for (;;) {
-
-		/* During normal operation, RFCOMM should block indefinitely. However,
-		 * in the HFP-HF mode, service level connection has to be initialized
-		 * by ourself. In order to do this reliably, we have to assume, that
-		 * AG might not receive our message and will not send proper response.
-		 * Hence, we will incorporate timeout, after which we will send our
-		 * AT command once more. */
-		int timeout = BA_RFCOMM_TIMEOUT_IDLE;
-
-		ba_rfcomm_callback *callback;
-		char tmp[256] = "";
+	/* During normal operation, RFCOMM should block indefinitely. However,
+	 * in the HFP-HF mode, service level connection has to be initialized
+	 * by ourself. In order to do this reliably, we have to assume, that
+	 * AG might not receive our message and will not send proper response.
+	 * Hence, we will incorporate timeout, after which we will send our
+	 * AT command once more. */
+	*timeout = BA_RFCOMM_TIMEOUT_IDLE;
 
-		if (r->handler != NULL)
-			goto process;
+	if (r->handler != NULL)
+		goto final;
 
-		if (r->state != HFP_SLC_CONNECTED) {
+	if (r->state != HFP_SLC_CONNECTED) {
 
-			/* If some progress has been made in the SLC procedure, reset the
-			 * retries counter. */
-			if (r->state != r->state_prev) {
-				r->state_prev = r->state;
-				r->retries = 0;
-			}
+		/* If some progress has been made in the SLC procedure, reset the
+		 * retries counter. */
+		if (r->state != r->state_prev) {
+			r->state_prev = r->state;
+			r->retries = 0;
+		}
 
-			/* If the maximal number of retries has been reached, terminate the
-			 * connection. Trying indefinitely will only use up our resources. */
-			if (r->retries > BA_RFCOMM_SLC_RETRIES) {
-				error("Couldn't establish connection: Too many retries");
-				errno = ETIMEDOUT;
-				goto ioerror;
-			}
+		/* If the maximal number of retries has been reached, terminate the
+		 * connection. Trying indefinitely will only use up our resources. */
+		if (r->retries > BA_RFCOMM_SLC_RETRIES) {
+			error("Couldn't establish connection: Too many retries");
+			errno = ETIMEDOUT;
+			return -1;
+		}
 
-			if (t_sco->profile & BA_TRANSPORT_PROFILE_MASK_HSP) {
-				/* There is not logic behind the HSP connection,
-				 * simply set status as connected. */
-				rfcomm_set_hfp_state(r, HFP_SLC_CONNECTED);
-				goto setup;
-			}
+		if (t_sco->profile & BA_TRANSPORT_PROFILE_MASK_HSP) {
+			/* There is not logic behind the HSP connection,
+			 * simply set status as connected. */
+			rfcomm_set_hfp_state(r, HFP_SLC_CONNECTED);
+			goto setup;
+		}
 
-			if (t_sco->profile & BA_TRANSPORT_PROFILE_HFP_HF)
-				switch (r->state) {
-				case HFP_DISCONNECTED:
-					sprintf(tmp, "%u", r->hf_features);
-					if (rfcomm_write_at(pfds[1].fd, AT_TYPE_CMD_SET, "+BRSF", tmp) == -1)
-						goto ioerror;
-					r->handler = &rfcomm_handler_brsf_resp;
-					break;
-				case HFP_SLC_BRSF_SET:
-					r->handler = &rfcomm_handler_resp_ok;
-					r->handler_resp_ok_new_state = HFP_SLC_BRSF_SET_OK;
-					break;
-				case HFP_SLC_BRSF_SET_OK:
-					/* Process with codecs advertisement only if both
-					 * sides support the codec negotiation feature. */
-					if (r->ag_features & HFP_AG_FEAT_CODEC &&
-							r->hf_features & HFP_HF_FEAT_CODEC) {
-						if (rfcomm_write_at(pfds[1].fd, AT_TYPE_CMD_SET, "+BAC", r->hf_bac_bcs_string) == -1)
-							goto ioerror;
-						r->handler = &rfcomm_handler_resp_ok;
-						r->handler_resp_ok_new_state = HFP_SLC_BAC_SET_OK;
-						break;
-					}
-					/* fall-through */
-				case HFP_SLC_BAC_SET_OK:
-					if (rfcomm_write_at(pfds[1].fd, AT_TYPE_CMD_TEST, "+CIND", NULL) == -1)
-						goto ioerror;
-					r->handler = &rfcomm_handler_cind_resp_test;
-					break;
-				case HFP_SLC_CIND_TEST:
-					r->handler = &rfcomm_handler_resp_ok;
-					r->handler_resp_ok_new_state = HFP_SLC_CIND_TEST_OK;
-					break;
-				case HFP_SLC_CIND_TEST_OK:
-					if (rfcomm_write_at(pfds[1].fd, AT_TYPE_CMD_GET, "+CIND", NULL) == -1)
-						goto ioerror;
-					r->handler = &rfcomm_handler_cind_resp_get;
-					break;
-				case HFP_SLC_CIND_GET:
-					r->handler = &rfcomm_handler_resp_ok;
-					r->handler_resp_ok_new_state = HFP_SLC_CIND_GET_OK;
-					break;
-				case HFP_SLC_CIND_GET_OK:
-					/* Activate indicator events reporting. The +CMER specification is
-					 * as follows: AT+CMER=[<mode>[,<keyp>[,<disp>[,<ind>[,<bfr>]]]]] */
-					if (rfcomm_write_at(pfds[1].fd, AT_TYPE_CMD_SET, "+CMER", "3,0,0,1,0") == -1)
-						goto ioerror;
+		if (t_sco->profile & BA_TRANSPORT_PROFILE_HFP_HF)
+			switch (r->state) {
+			case HFP_DISCONNECTED:
+				sprintf(tmp, "%u", r->hf_features);
+				if (rfcomm_write_at(r->fd, AT_TYPE_CMD_SET, "+BRSF", tmp) == -1)
+					return -1;
+				r->handler = &rfcomm_handler_brsf_resp;
+				break;
+			case HFP_SLC_BRSF_SET:
+				r->handler = &rfcomm_handler_resp_ok;
+				r->handler_resp_ok_new_state = HFP_SLC_BRSF_SET_OK;
+				break;
+			case HFP_SLC_BRSF_SET_OK:
+				/* Process with codecs advertisement only if both
+				 * sides support the codec negotiation feature. */
+				if (r->ag_features & HFP_AG_FEAT_CODEC &&
+						r->hf_features & HFP_HF_FEAT_CODEC) {
+					if (rfcomm_write_at(r->fd, AT_TYPE_CMD_SET, "+BAC", r->hf_bac_bcs_string) == -1)
+						return -1;
 					r->handler = &rfcomm_handler_resp_ok;
-					r->handler_resp_ok_new_state = HFP_SLC_CMER_SET_OK;
+					r->handler_resp_ok_new_state = HFP_SLC_BAC_SET_OK;
 					break;
-				case HFP_SLC_CMER_SET_OK:
-					rfcomm_set_hfp_state(r, HFP_SLC_CONNECTED);
-					/* fall-through */
-				case HFP_SLC_CONNECTED:
-					/* If codec was selected during the SLC establishment,
-					 * notify BlueALSA D-Bus clients about the change. */
-					if (ba_transport_get_codec(t_sco) != HFP_CODEC_UNDEFINED) {
-						bluealsa_dbus_pcm_update(&t_sco->sco.pcm_spk,
-								BA_DBUS_PCM_UPDATE_RATE | BA_DBUS_PCM_UPDATE_CODEC);
-						bluealsa_dbus_pcm_update(&t_sco->sco.pcm_mic,
-								BA_DBUS_PCM_UPDATE_RATE | BA_DBUS_PCM_UPDATE_CODEC);
-					}
 				}
+				/* fall-through */
+			case HFP_SLC_BAC_SET_OK:
+				if (rfcomm_write_at(r->fd, AT_TYPE_CMD_TEST, "+CIND", NULL) == -1)
+					return -1;
+				r->handler = &rfcomm_handler_cind_resp_test;
+				break;
+			case HFP_SLC_CIND_TEST:
+				r->handler = &rfcomm_handler_resp_ok;
+				r->handler_resp_ok_new_state = HFP_SLC_CIND_TEST_OK;
+				break;
+			case HFP_SLC_CIND_TEST_OK:
+				if (rfcomm_write_at(r->fd, AT_TYPE_CMD_GET, "+CIND", NULL) == -1)
+					return -1;
+				r->handler = &rfcomm_handler_cind_resp_get;
+				break;
+			case HFP_SLC_CIND_GET:
+				r->handler = &rfcomm_handler_resp_ok;
+				r->handler_resp_ok_new_state = HFP_SLC_CIND_GET_OK;
+				break;
+			case HFP_SLC_CIND_GET_OK:
+				/* Activate indicator events reporting. The +CMER specification is
+				 * as follows: AT+CMER=[<mode>[,<keyp>[,<disp>[,<ind>[,<bfr>]]]]] */
+				if (rfcomm_write_at(r->fd, AT_TYPE_CMD_SET, "+CMER", "3,0,0,1,0") == -1)
+					return -1;
+				r->handler = &rfcomm_handler_resp_ok;
+				r->handler_resp_ok_new_state = HFP_SLC_CMER_SET_OK;
+				break;
+			case HFP_SLC_CMER_SET_OK:
+				rfcomm_set_hfp_state(r, HFP_SLC_CONNECTED);
+				/* fall-through */
+			case HFP_SLC_CONNECTED:
+				/* If codec was selected during the SLC establishment,
+				 * notify BlueALSA D-Bus clients about the change. */
+				if (ba_transport_get_codec(t_sco) != HFP_CODEC_UNDEFINED) {
+					bluealsa_dbus_pcm_update(&t_sco->sco.pcm_spk,
+							BA_DBUS_PCM_UPDATE_RATE | BA_DBUS_PCM_UPDATE_CODEC);
+					bluealsa_dbus_pcm_update(&t_sco->sco.pcm_mic,
+							BA_DBUS_PCM_UPDATE_RATE | BA_DBUS_PCM_UPDATE_CODEC);
+				}
+			}
 
-			if (t_sco->profile & BA_TRANSPORT_PROFILE_HFP_AG)
-				switch (r->state) {
-				case HFP_DISCONNECTED:
-				case HFP_SLC_BRSF_SET:
-				case HFP_SLC_BRSF_SET_OK:
-				case HFP_SLC_BAC_SET_OK:
-				case HFP_SLC_CIND_TEST:
-				case HFP_SLC_CIND_TEST_OK:
-				case HFP_SLC_CIND_GET:
-				case HFP_SLC_CIND_GET_OK:
-					break;
-				case HFP_SLC_CMER_SET_OK:
-					rfcomm_set_hfp_state(r, HFP_SLC_CONNECTED);
-					/* fall-through */
-				case HFP_SLC_CONNECTED:
-					/* If codec was selected during the SLC establishment,
-					 * notify BlueALSA D-Bus clients about the change. */
-					if (ba_transport_get_codec(t_sco) != HFP_CODEC_UNDEFINED) {
-						bluealsa_dbus_pcm_update(&t_sco->sco.pcm_spk,
-								BA_DBUS_PCM_UPDATE_RATE | BA_DBUS_PCM_UPDATE_CODEC);
-						bluealsa_dbus_pcm_update(&t_sco->sco.pcm_mic,
-								BA_DBUS_PCM_UPDATE_RATE | BA_DBUS_PCM_UPDATE_CODEC);
-					}
+		if (t_sco->profile & BA_TRANSPORT_PROFILE_HFP_AG)
+			switch (r->state) {
+			case HFP_DISCONNECTED:
+			case HFP_SLC_BRSF_SET:
+			case HFP_SLC_BRSF_SET_OK:
+			case HFP_SLC_BAC_SET_OK:
+			case HFP_SLC_CIND_TEST:
+			case HFP_SLC_CIND_TEST_OK:
+			case HFP_SLC_CIND_GET:
+			case HFP_SLC_CIND_GET_OK:
+				break;
+			case HFP_SLC_CMER_SET_OK:
+				rfcomm_set_hfp_state(r, HFP_SLC_CONNECTED);
+				/* fall-through */
+			case HFP_SLC_CONNECTED:
+				/* If codec was selected during the SLC establishment,
+				 * notify BlueALSA D-Bus clients about the change. */
+				if (ba_transport_get_codec(t_sco) != HFP_CODEC_UNDEFINED) {
+					bluealsa_dbus_pcm_update(&t_sco->sco.pcm_spk,
+							BA_DBUS_PCM_UPDATE_RATE | BA_DBUS_PCM_UPDATE_CODEC);
+					bluealsa_dbus_pcm_update(&t_sco->sco.pcm_mic,
+							BA_DBUS_PCM_UPDATE_RATE | BA_DBUS_PCM_UPDATE_CODEC);
 				}
+			}
 
-		}
-		else if (r->setup != HFP_SETUP_COMPLETE) {
+	}
+	else if (r->setup != HFP_SETUP_COMPLETE) {
 setup:
 
-			if (t_sco->profile & BA_TRANSPORT_PROFILE_HSP_AG)
-				/* We are not making any initialization setup with
-				 * HSP AG. Simply mark setup as completed. */
-				r->setup = HFP_SETUP_COMPLETE;
-
-			/* Notify audio gateway about our initial setup. This setup
-			 * is dedicated for HSP and HFP, because both profiles have
-			 * volume gain control and Apple accessory extension. */
-			if (t_sco->profile & BA_TRANSPORT_PROFILE_MASK_HF)
-				switch (r->setup) {
-				case HFP_SETUP_GAIN_MIC:
-					if (rfcomm_notify_volume_change_mic(r, true) == -1)
-						goto ioerror;
-					r->setup++;
-					break;
-				case HFP_SETUP_GAIN_SPK:
-					if (rfcomm_notify_volume_change_spk(r, true) == -1)
-						goto ioerror;
-					r->setup++;
-					break;
-				case HFP_SETUP_ACCESSORY_XAPL:
-					sprintf(tmp, "%04X-%04X-%04X,%u",
-							config.hfp.xapl_vendor_id, config.hfp.xapl_product_id,
-							config.hfp.xapl_sw_version, config.hfp.xapl_features);
-					if (rfcomm_write_at(r->fd, AT_TYPE_CMD_SET, "+XAPL", tmp) == -1)
-						goto ioerror;
-					r->handler = &rfcomm_handler_xapl_resp;
-					r->setup++;
-					break;
-				case HFP_SETUP_ACCESSORY_BATT:
-					if (rfcomm_notify_battery_level_change(r) == -1)
-						goto ioerror;
-					r->setup++;
-					break;
-				case HFP_SETUP_SELECT_CODEC:
+		if (t_sco->profile & BA_TRANSPORT_PROFILE_HSP_AG)
+			/* We are not making any initialization setup with
+			 * HSP AG. Simply mark setup as completed. */
+			r->setup = HFP_SETUP_COMPLETE;
+
+		/* Notify audio gateway about our initial setup. This setup
+		 * is dedicated for HSP and HFP, because both profiles have
+		 * volume gain control and Apple accessory extension. */
+		if (t_sco->profile & BA_TRANSPORT_PROFILE_MASK_HF)
+			switch (r->setup) {
+			case HFP_SETUP_GAIN_MIC:
+				if (rfcomm_notify_volume_change_mic(r, true) == -1)
+					return -1;
+				r->setup++;
+				break;
+			case HFP_SETUP_GAIN_SPK:
+				if (rfcomm_notify_volume_change_spk(r, true) == -1)
+					return -1;
+				r->setup++;
+				break;
+			case HFP_SETUP_ACCESSORY_XAPL:
+				sprintf(tmp, "%04X-%04X-%04X,%u",
+						config.hfp.xapl_vendor_id, config.hfp.xapl_product_id,
+						config.hfp.xapl_sw_version, config.hfp.xapl_features);
+				if (rfcomm_write_at(r->fd, AT_TYPE_CMD_SET, "+XAPL", tmp) == -1)
+					return -1;
+				r->handler = &rfcomm_handler_xapl_resp;
+				r->setup++;
+				break;
+			case HFP_SETUP_ACCESSORY_BATT:
+				if (rfcomm_notify_battery_level_change(r) == -1)
+					return -1;
+				r->setup++;
+				break;
+			case HFP_SETUP_SELECT_CODEC:
 #if ENABLE_HFP_CODEC_SELECTION
-					if (r->idle) {
-						if (rfcomm_hfp_setup_codec_connection(r) == -1)
-							goto ioerror;
-						r->setup++;
-					}
-#else
+				if (r->idle || rfcomm_slc_cache_match(r)) {
+					if (rfcomm_hfp_setup_codec_connection(r) == -1)
+						return -1;
 					r->setup++;
-#endif
-					/* fall-through */
-				case HFP_SETUP_COMPLETE:
-					debug("Initial connection setup completed");
 				}
-
-			/* If HFP transport codec is already selected (e.g. device
-			 * does not support mSBC) mark setup as completed. */
-			if (t_sco->profile & BA_TRANSPORT_PROFILE_HFP_AG &&
-					ba_transport_get_codec(t_sco) != HFP_CODEC_UNDEFINED)
-				r->setup = HFP_SETUP_COMPLETE;
-
-#if ENABLE_HFP_CODEC_SELECTION
-			/* Select HFP transport codec. Please note, that this setup
-			 * stage will be performed when the connection becomes idle. */
-			if (t_sco->profile & BA_TRANSPORT_PROFILE_HFP_AG &&
-					r->idle) {
-				if (rfcomm_hfp_setup_codec_connection(r) == -1)
-					goto ioerror;
-				r->setup = HFP_SETUP_COMPLETE;
-			}
+#else
+				r->setup++;
 #endif
+				/* fall-through */
+			case HFP_SETUP_COMPLETE:
+				debug("Initial connection setup completed");
+			}
 
-		}
-		else {
-			/* setup is complete, block infinitely */
-			timeout = -1;
-		}
+		/* If HFP transport codec is already selected (e.g. device
+		 * does not support mSBC) mark setup as completed. */
+		if (t_sco->profile & BA_TRANSPORT_PROFILE_HFP_AG &&
+				ba_transport_get_codec(t_sco) != HFP_CODEC_UNDEFINED)
+			r->setup = HFP_SETUP_COMPLETE;
 
-process:
-		if (r->handler != NULL) {
-			timeout = BA_RFCOMM_TIMEOUT_ACK;
-			r->retries++;
+#if ENABLE_HFP_CODEC_SELECTION
+		/* Select HFP transport codec. Please note, that this setup
+		 * stage will be performed when the connection becomes idle,
+		 * unless the SLC data cached during the last connection
+		 * matches the current one. */
+		if (t_sco->profile & BA_TRANSPORT_PROFILE_HFP_AG &&
+				(r->idle || rfcomm_slc_cache_match(r))) {
+			if (rfcomm_hfp_setup_codec_connection(r) == -1)
+				return -1;
+			r->setup = HFP_SETUP_COMPLETE;
 		}
+#endif
 
-		/* skip poll() since we've got unprocessed data */
-		if (reader.next != NULL)
-			goto read;
+	}
+	else {
+		/* setup is complete, block infinitely */
+		*timeout = -1;
+	}
 
-		r->idle = false;
-		pfds[2].fd = r->handler_fd;
+final:
+	if (r->handler != NULL) {
+		*timeout = BA_RFCOMM_TIMEOUT_ACK;
+		r->retries++;
+	}
 
-		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
-		int poll_rv = poll(pfds, ARRAYSIZE(pfds), timeout);
-		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	return 0;
+}
 
-		switch (poll_rv) {
-		case 0:
-			debug("RFCOMM poll timeout");
-			r->idle = true;
-			continue;
-		case -1:
-			if (errno == EINTR)
-				continue;
-			error("RFCOMM poll error: %s", strerror(errno));
-			goto fail;
-		}
+/**
+ * Process signal sent to the RFCOMM connection. */
+static int rfcomm_process_signal(struct ba_rfcomm *r) {
+
+	enum ba_rfcomm_signal sig = rfcomm_recv_signal(r);
+
+	/* Start polling external AT handler, which might have
+	 * been set by the D-Bus API prior to sending a signal. */
+	if (r->handler_fd != -1 && r->handler_fd_polled == -1) {
+		if (rfcomm_engine_poll_add(r, r->handler_fd, RFCOMM_POLL_HANDLER) == -1)
+			error("Couldn't poll AT handler: %s", strerror(errno));
+		else
+			r->handler_fd_polled = r->handler_fd;
+	}
 
-		if (pfds[0].revents & POLLIN) {
-			/* dispatch incoming event */
-			switch (rfcomm_recv_signal(r)) {
+	/* dispatch incoming event */
+	switch (sig) {
 #if ENABLE_HFP_CODEC_SELECTION
-			case BA_RFCOMM_SIGNAL_HFP_SET_CODEC_CVSD:
-				if (!config.hfp.codecs.cvsd || !(
-							r->ag_features & HFP_AG_FEAT_CODEC &&
-							r->hf_features & HFP_HF_FEAT_CODEC))
-					rfcomm_finalize_codec_selection(r);
-				else if (rfcomm_hfp_set_codec(r, HFP_CODEC_CVSD) == -1)
-					goto ioerror;
-				break;
+	case BA_RFCOMM_SIGNAL_HFP_SET_CODEC_CVSD:
+		if (!config.hfp.codecs.cvsd || !(
+					r->ag_features & HFP_AG_FEAT_CODEC &&
+					r->hf_features & HFP_HF_FEAT_CODEC))
+			rfcomm_finalize_codec_selection(r);
+		else if (rfcomm_hfp_set_codec(r, HFP_CODEC_CVSD) == -1)
+			return -1;
+		break;
 # if ENABLE_MSBC
-			case BA_RFCOMM_SIGNAL_HFP_SET_CODEC_MSBC:
-				if (!config.hfp.codecs.msbc || !(
-							r->ag_features & HFP_AG_FEAT_CODEC &&
-							r->ag_features & HFP_AG_FEAT_ESCO &&
-							r->hf_features & HFP_HF_FEAT_CODEC &&
-							r->hf_features & HFP_HF_FEAT_ESCO))
-					rfcomm_finalize_codec_selection(r);
-				else if (rfcomm_hfp_set_codec(r, HFP_CODEC_MSBC) == -1)
-					goto ioerror;
-				break;
+	case BA_RFCOMM_SIGNAL_HFP_SET_CODEC_MSBC:
+		if (!config.hfp.codecs.msbc || !(
+					r->ag_features & HFP_AG_FEAT_CODEC &&
+					r->ag_features & HFP_AG_FEAT_ESCO &&
+					r->hf_features & HFP_HF_FEAT_CODEC &&
+					r->hf_features & HFP_HF_FEAT_ESCO))
+			rfcomm_finalize_codec_selection(r);
+		else if (rfcomm_hfp_set_codec(r, HFP_CODEC_MSBC) == -1)
+			return -1;
+		break;
 # endif
 # if ENABLE_LC3_SWB
-			case BA_RFCOMM_SIGNAL_HFP_SET_CODEC_LC3_SWB:
-				if (!config.hfp.codecs.lc3_swb || !(
-							r->ag_features & HFP_AG_FEAT_CODEC &&
-							r->ag_features & HFP_AG_FEAT_ESCO &&
-							r->hf_features & HFP_HF_FEAT_CODEC &&
-							r->hf_features & HFP_HF_FEAT_ESCO))
-					rfcomm_finalize_codec_selection(r);
-				else if (rfcomm_hfp_set_codec(r, HFP_CODEC_LC3_SWB) == -1)
-					goto ioerror;
-				break;
+	case BA_RFCOMM_SIGNAL_HFP_SET_CODEC_LC3_SWB:
+		if (!config.hfp.codecs.lc3_swb || !(
+					r->ag_features & HFP_AG_FEAT_CODEC &&
+					r->ag_features & HFP_AG_FEAT_ESCO &&
+					r->hf_features & HFP_HF_FEAT_CODEC &&
+					r->hf_features & HFP_HF_FEAT_ESCO))
+			rfcomm_finalize_codec_selection(r);
+		else if (rfcomm_hfp_set_codec(r, HFP_CODEC_LC3_SWB) == -1)
+			return -1;
+		break;
 # endif
 #endif
-			case BA_RFCOMM_SIGNAL_UPDATE_BATTERY:
-				if (rfcomm_notify_battery_level_change(r) == -1)
-					goto ioerror;
-				break;
-			case BA_RFCOMM_SIGNAL_UPDATE_VOLUME:
-				if (rfcomm_notify_volume_change_mic(r, false) == -1)
-					goto ioerror;
-				if (rfcomm_notify_volume_change_spk(r, false) == -1)
-					goto ioerror;
-				break;
-			default:
-				break;
+	case BA_RFCOMM_SIGNAL_UPDATE_BATTERY:
+		if (rfcomm_notify_battery_level_change(r) == -1)
+			return -1;
+		break;
+	case BA_RFCOMM_SIGNAL_UPDATE_VOLUME:
+		if (rfcomm_notify_volume_change_mic(r, false) == -1)
+			return -1;
+		if (rfcomm_notify_volume_change_spk(r, false) == -1)
+			return -1;
+		break;
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+/**
+ * Read and dispatch single AT message from the RFCOMM. */
+static int rfcomm_process_at(struct ba_rfcomm *r) {
+
+	struct at_reader *reader = &r->reader;
+	ba_rfcomm_callback *callback;
+	char tmp[256];
+
+	if (rfcomm_read_at(r->fd, reader) == -1) {
+		if (errno == EAGAIN)
+			return 0;
+		if (errno != EBADMSG)
+			return -1;
+		warn("Invalid AT message");
+		return 0;
+	}
+
+	/* use predefined callback, otherwise get generic one */
+	bool predefined_callback = false;
+	if (r->handler != NULL && r->handler->type == reader->at.type &&
+			strcmp(r->handler->command, reader->at.command) == 0) {
+		callback = r->handler->callback;
+		predefined_callback = true;
+		r->handler = NULL;
+	}
+	else
+		callback = rfcomm_get_callback(&reader->at);
+
+	if (r->handler_fd_polled != -1 && !predefined_callback) {
+		at_build(tmp, sizeof(tmp), reader->at.type,
+				reader->at.command, reader->at.value);
+		if (write(r->handler_fd_polled, tmp, strlen(tmp)) == -1)
+			warn("Couldn't forward AT: %s", strerror(errno));
+	}
+
+	if (callback != NULL) {
+		if (callback(r, &reader->at) == -1)
+			return -1;
+	}
+	else if (r->handler_fd_polled == -1) {
+		warn("Unsupported AT message: %s: command:%s, value:%s",
+				at_type2str(reader->at.type), reader->at.command, reader->at.value);
+		if (reader->at.type != AT_TYPE_RESP)
+			if (rfcomm_write_at(r->fd, AT_TYPE_RESP, NULL, "ERROR") == -1)
+				return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Forward data from the external AT handler to the RFCOMM. */
+static int rfcomm_process_handler(struct ba_rfcomm *r) {
+
+	char tmp[256];
+	ssize_t ret;
+
+	while ((ret = read(r->handler_fd_polled, tmp, sizeof(tmp) - 1)) == -1 &&
+			errno == EINTR)
+		continue;
+
+	if (ret <= 0) {
+		if (ret == -1)
+			error("AT handler IO error: %s", strerror(errno));
+		rfcomm_handler_close(r);
+		return 0;
+	}
+
+	tmp[ret] = '\0';
+	return rfcomm_write_at(r->fd, AT_TYPE_RAW, tmp, NULL);
+}
+
+/**
+ * Run the RFCOMM connection state machine after processing an event.
+ *
+ * @param r RFCOMM connection.
+ * @param rv Result of the event processing. */
+static void rfcomm_connection_run(struct ba_rfcomm *r, int rv) {
+
+	int timeout = BA_RFCOMM_TIMEOUT_IDLE;
+
+	for (;;) {
+
+		if (rv == -1 && rfcomm_is_disconnected(errno)) {
+			rfcomm_connection_close(r);
+			return;
+		}
+
+		if (rfcomm_slc_step(r, &timeout) == -1) {
+			if (rfcomm_is_disconnected(errno)) {
+				rfcomm_connection_close(r);
+				return;
 			}
+			/* retry after the acknowledgment timeout */
+			timeout = BA_RFCOMM_TIMEOUT_ACK;
+			break;
 		}
 
-		if (pfds[1].revents & POLLIN) {
-			/* read data from the RFCOMM */
-
-read:
-			if (rfcomm_read_at(pfds[1].fd, &reader) == -1)
-				switch (errno) {
-				case EBADMSG:
-					warn("Invalid AT message: %s", reader.next);
-					reader.next = NULL;
-					continue;
-				default:
-					goto ioerror;
-				}
+		/* process unparsed data before going back to the event loop */
+		if (r->reader.next == NULL)
+			break;
 
-			/* use predefined callback, otherwise get generic one */
-			bool predefined_callback = false;
-			if (r->handler != NULL && r->handler->type == reader.at.type &&
-					strcmp(r->handler->command, reader.at.command) == 0) {
-				callback = r->handler->callback;
-				predefined_callback = true;
-				r->handler = NULL;
-			}
-			else
-				callback = rfcomm_get_callback(&reader.at);
-
-			if (pfds[2].fd != -1 && !predefined_callback) {
-				at_build(tmp, sizeof(tmp), reader.at.type,
-						reader.at.command, reader.at.value);
-				if (write(pfds[2].fd, tmp, strlen(tmp)) == -1)
-					warn("Couldn't forward AT: %s", strerror(errno));
-			}
+		rv = rfcomm_process_at(r);
 
-			if (callback != NULL) {
-				if (callback(r, &reader.at) == -1)
-					goto ioerror;
-			}
-			else if (pfds[2].fd == -1) {
-				warn("Unsupported AT message: %s: command:%s, value:%s",
-						at_type2str(reader.at.type), reader.at.command, reader.at.value);
-				if (reader.at.type != AT_TYPE_RESP)
-					if (rfcomm_write_at(pfds[1].fd, AT_TYPE_RESP, NULL, "ERROR") == -1)
-						goto ioerror;
-			}
+	}
 
-		}
-		else if (pfds[1].revents & (POLLERR | POLLHUP)) {
+	if (timeout == -1) {
+		r->deadline.tv_sec = 0;
+		r->deadline.tv_nsec = 0;
+		return;
+	}
+
+	const struct timespec ts = {
+		.tv_sec = timeout / 1000,
+		.tv_nsec = (timeout % 1000) * 1000000 };
+	gettimestamp(&r->deadline);
+	timespecadd(&r->deadline, &ts, &r->deadline);
+
+}
+
+static void rfcomm_connection_dispatch(struct ba_rfcomm *r,
+		enum rfcomm_poll_id id, uint32_t events) {
+
+	int rv = 0;
+
+	r->idle = false;
+
+	switch (id) {
+	case RFCOMM_POLL_SIGNAL:
+		rv = rfcomm_process_signal(r);
+		break;
+	case RFCOMM_POLL_RFCOMM:
+		if (events & EPOLLIN)
+			rv = rfcomm_process_at(r);
+		else if (events & (EPOLLERR | EPOLLHUP)) {
 			errno = ECONNRESET;
-			goto ioerror;
+			rv = -1;
 		}
+		break;
+	case RFCOMM_POLL_HANDLER:
+		if (events & EPOLLIN)
+			rv = rfcomm_process_handler(r);
+		else if (events & (EPOLLERR | EPOLLHUP)) {
+			error("AT handler IO error: %s", strerror(ECONNRESET));
+			rfcomm_handler_close(r);
+		}
+		break;
+	}
 
-		if (pfds[2].revents & POLLIN) {
-			/* read data from the external handler */
+	rfcomm_connection_run(r, rv);
 
-			ssize_t ret;
-			while ((ret = read(pfds[2].fd, tmp, sizeof(tmp) - 1)) == -1 &&
-					errno == EINTR)
-				continue;
+}
 
-			if (ret <= 0)
-				goto ioerror_exthandler;
+/**
+ * Look up connection and mark it as being processed.
+ *
+ * @param id Connection ID.
+ * @return On success, this function returns the connection which shall be
+ *   released with the rfcomm_engine_release() function. If the connection
+ *   has been removed in the meantime, NULL is returned. */
+static struct ba_rfcomm *rfcomm_engine_acquire(unsigned int id) {
+	pthread_mutex_lock(&rfcomm_engine.mutex);
+	struct ba_rfcomm *r;
+	if ((r = g_hash_table_lookup(rfcomm_engine.connections, GUINT_TO_POINTER(id))) != NULL)
+		rfcomm_engine.dispatching = id;
+	pthread_mutex_unlock(&rfcomm_engine.mutex);
+	return r;
+}
 
-			tmp[ret] = '\0';
-			if (rfcomm_write_at(pfds[1].fd, AT_TYPE_RAW, tmp, NULL) == -1)
-				goto ioerror;
+/**
+ * Mark the end of the connection processing.
+ *
+ * Note, that the processed connection might have been already freed at
+ * this point, so it must not be accessed in any way. */
+static void rfcomm_engine_release(void) {
+	pthread_mutex_lock(&rfcomm_engine.mutex);
+	rfcomm_engine.dispatching = 0;
+	pthread_cond_broadcast(&rfcomm_engine.cond);
+	pthread_mutex_unlock(&rfcomm_engine.mutex);
+}
 
-		}
-		else if (pfds[2].revents & (POLLERR | POLLHUP)) {
-			errno = ECONNRESET;
-			goto ioerror_exthandler;
+/**
+ * Get the time (in milliseconds) until the nearest SLC stage timeout.
+ *
+ * This function shall be called with the event loop mutex locked. */
+static int rfcomm_engine_get_timeout(void) {
+
+	struct timespec now;
+	gettimestamp(&now);
+
+	int timeout = -1;
+	GHashTableIter iter;
+	struct ba_rfcomm *r;
+
+	g_hash_table_iter_init(&iter, rfcomm_engine.connections);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer)&r)) {
+
+		if (is_timespec_zero(&r->deadline))
+			continue;
+
+		struct timespec diff;
+		int ms = 0;
+		if (difftimespec(&now, &r->deadline, &diff) > 0)
+			ms = diff.tv_sec * 1000 + (diff.tv_nsec + 999999) / 1000000;
+
+		if (timeout == -1 || ms < timeout)
+			timeout = ms;
+
+	}
+
+	return timeout;
+}
+
+/**
+ * Process connections with expired SLC stage timeout. */
+static void rfcomm_engine_process_timeouts(void) {
+
+	struct timespec now;
+	gettimestamp(&now);
+
+	GArray *expired = g_array_new(FALSE, FALSE, sizeof(unsigned int));
+	GHashTableIter iter;
+	struct ba_rfcomm *r;
+
+	pthread_mutex_lock(&rfcomm_engine.mutex);
+	g_hash_table_iter_init(&iter, rfcomm_engine.connections);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer)&r))
+		if (!is_timespec_zero(&r->deadline) &&
+				difftimespec(&now, &r->deadline, &(struct timespec){ 0 }) <= 0)
+			g_array_append_val(expired, r->id);
+	pthread_mutex_unlock(&rfcomm_engine.mutex);
+
+	/* Connections might be removed during the processing,
+	 * so we have to look them up one more time. */
+	for (size_t i = 0; i < expired->len; i++)
+		if ((r = rfcomm_engine_acquire(g_array_index(expired, unsigned int, i))) != NULL) {
+			debug("RFCOMM poll timeout");
+			r->idle = true;
+			rfcomm_connection_run(r, 0);
+			rfcomm_engine_release();
 		}
 
-		continue;
+	g_array_free(expired, TRUE);
 
-ioerror_exthandler:
-		if (errno != 0)
-			error("AT handler IO error: %s", strerror(errno));
-		close(r->handler_fd);
-		r->handler_fd = -1;
-		continue;
+}
 
-ioerror:
-		switch (errno) {
-		case ECONNABORTED:
-		case ECONNRESET:
-		case ENOTCONN:
-		case ETIMEDOUT:
-		case EPIPE:
-			/* exit the thread upon socket disconnection */
-			debug("RFCOMM disconnected: %s", strerror(errno));
-			goto fail;
-		default:
-			error("RFCOMM IO error: %s", strerror(errno));
+static void *rfcomm_engine_thread(void *userdata) {
+	(void)userdata;
+
+	struct epoll_event events[32];
+
+	debug("Starting RFCOMM event loop");
+	for (;;) {
+
+		pthread_mutex_lock(&rfcomm_engine.mutex);
+		const int timeout = rfcomm_engine_get_timeout();
+		pthread_mutex_unlock(&rfcomm_engine.mutex);
+
+		int n;
+		if ((n = epoll_wait(rfcomm_engine.epoll_fd, events, ARRAYSIZE(events), timeout)) == -1) {
+			if (errno == EINTR)
+				continue;
+			error("RFCOMM poll error: %s", strerror(errno));
+			break;
 		}
+
+		for (int i = 0; i < n; i++) {
+			const unsigned int id = events[i].data.u64 >> 2;
+			struct ba_rfcomm *r;
+			if (id == 0) {
+				debug("Exiting RFCOMM event loop");
+				return NULL;
+			}
+			if ((r = rfcomm_engine_acquire(id)) != NULL) {
+				rfcomm_connection_dispatch(r, events[i].data.u64 & 0x3, events[i].events);
+				rfcomm_engine_release();
+			}
+		}
+
+		rfcomm_engine_process_timeouts();
+
 	}
 
-fail:
-	pthread_cleanup_pop(1);
 	return NULL;
 }
 
+/**
+ * Start RFCOMM event loop thread.
+ *
+ * This function shall be called with the event loop mutex locked. */
+static int rfcomm_engine_init(void) {
+
+	if (rfcomm_engine.epoll_fd != -1)
+		return 0;
+
+	struct epoll_event event = { .events = EPOLLIN, .data.u64 = RFCOMM_POLL_DATA(0, 0) };
+	int fd, event_fd = -1;
+	if ((fd = epoll_create1(EPOLL_CLOEXEC)) == -1 ||
+			(event_fd = eventfd(0, EFD_CLOEXEC)) == -1 ||
+			epoll_ctl(fd, EPOLL_CTL_ADD, event_fd, &event) == -1) {
+		const int err = errno;
+		if (event_fd != -1)
+			close(event_fd);
+		if (fd != -1)
+			close(fd);
+		return errno = err, -1;
+	}
+
+	rfcomm_engine.connections = g_hash_table_new(NULL, NULL);
+	rfcomm_engine.epoll_fd = fd;
+	rfcomm_engine.event_fd = event_fd;
+
+	/* See the ba_transport_pcm_start() function for information
+	 * why we have to mask all signals. */
+	sigset_t sigset, oldset;
+	sigfillset(&sigset);
+	pthread_sigmask(SIG_SETMASK, &sigset, &oldset);
+
+	int err;
+	err = pthread_create(&rfcomm_engine.thread, NULL, rfcomm_engine_thread, NULL);
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+
+	if (err != 0) {
+		error("Couldn't create RFCOMM thread: %s", strerror(err));
+		g_hash_table_destroy(rfcomm_engine.connections);
+		rfcomm_engine.connections = NULL;
+		rfcomm_engine.epoll_fd = -1;
+		rfcomm_engine.event_fd = -1;
+		close(event_fd);
+		close(fd);
+		return errno = err, -1;
+	}
+
+	if ((err = thread_set_cpu_affinity(rfcomm_engine.thread, &config.cpu_affinity.rfcomm)) != 0)
+		warn("Couldn't set RFCOMM thread CPU affinity: %s", strerror(err));
+
+	const char *name = "ba-rfcomm";
+	pthread_setname_np(rfcomm_engine.thread, name);
+	debug("Created new RFCOMM thread [%s]", name);
+
+	return 0;
+}
+
 struct ba_rfcomm *ba_rfcomm_new(struct ba_transport *sco, int fd) {
 
 	struct ba_rfcomm *r;
@@ -1622,7 +2017,8 @@ struct ba_rfcomm *ba_rfcomm_new(struct ba_transport *sco, int fd) {
 	r->sig_fd[0] = -1;
 	r->sig_fd[1] = -1;
 	r->handler_fd = -1;
-	r->thread = config.main_thread;
+	r->handler_fd_polled = -1;
+	at_parser_init(&r->reader.parser, &r->reader.at);
 	r->state = HFP_DISCONNECTED;
 	r->state_prev = HFP_DISCONNECTED;
 	r->codec_id = HFP_CODEC_UNDEFINED;
@@ -1683,6 +2079,13 @@ struct ba_rfcomm *ba_rfcomm_new(struct ba_transport *sco, int fd) {
 
 	}
 
+	/* Load SLC data cached during the last connection. */
+	r->slc_cache.codec_id = HFP_CODEC_UNDEFINED;
+	if (sco->profile & BA_TRANSPORT_PROFILE_MASK_HFP &&
+			storage_hfp_slc_load(sco, &r->slc_cache.features, &r->slc_cache.codec_id) == 1)
+		debug("Loaded SLC cache: features=%#x codec=%s", r->slc_cache.features,
+				hfp_codec_id_to_string(r->slc_cache.codec_id));
+
 	/* By default, all indicators are enabled. */
 	memset(&r->hfp_ind_state, 1, sizeof(r->hfp_ind_state));
 
@@ -1697,22 +2100,41 @@ struct ba_rfcomm *ba_rfcomm_new(struct ba_transport *sco, int fd) {
 
 	pthread_cond_init(&r->codec_selection_cond, NULL);
 
-	if ((err = pthread_create(&r->thread, NULL, PTHREAD_FUNC(rfcomm_thread), r)) != 0) {
-		error("Couldn't create RFCOMM thread: %s", strerror(err));
-		r->thread = config.main_thread;
-		goto fail;
+	pthread_mutex_lock(&rfcomm_engine.mutex);
+
+	if (rfcomm_engine_init() == -1)
+		goto fail_engine;
+
+	r->id = rfcomm_engine.id_next++;
+	g_hash_table_insert(rfcomm_engine.connections, GUINT_TO_POINTER(r->id), r);
+
+	if (rfcomm_engine_poll_add(r, r->sig_fd[0], RFCOMM_POLL_SIGNAL) == -1 ||
+			rfcomm_engine_poll_add(r, r->fd, RFCOMM_POLL_RFCOMM) == -1) {
+		err = errno;
+		g_hash_table_remove(rfcomm_engine.connections, GUINT_TO_POINTER(r->id));
+		rfcomm_engine_poll_del(r->sig_fd[0]);
+		r->id = 0;
+		errno = err;
+		goto fail_engine;
 	}
 
-	const char *name = "ba-rfcomm";
-	pthread_setname_np(r->thread, name);
-	debug("Created new RFCOMM thread [%s]: %s",
-			name, ba_transport_debug_name(sco));
+	pthread_mutex_unlock(&rfcomm_engine.mutex);
+
+	/* kick off the service level connection setup */
+	ba_rfcomm_send_signal(r, BA_RFCOMM_SIGNAL_PING);
+
+	debug("Created new RFCOMM connection [%zu bytes]: %s",
+			sizeof(*r), ba_transport_debug_name(sco));
 
 	r->ba_dbus_path = g_strdup_printf("%s/rfcomm", sco->d->ba_dbus_path);
 	bluealsa_dbus_rfcomm_register(r);
 
 	return r;
 
+fail_engine:
+	err = errno;
+	pthread_mutex_unlock(&rfcomm_engine.mutex);
+	errno = err;
 fail:
 	err = errno;
 	ba_rfcomm_destroy(r);
@@ -1722,8 +2144,6 @@ fail:
 
 void ba_rfcomm_destroy(struct ba_rfcomm *r) {
 
-	int err;
-
 	/* Disable link lost quirk, because we don't want
 	 * any interference during the destroy procedure. */
 	r->link_lost_quirk = false;
@@ -1732,20 +2152,22 @@ void ba_rfcomm_destroy(struct ba_rfcomm *r) {
 	 * RFCOMM thread during the destroy procedure. */
 	bluealsa_dbus_rfcomm_unregister(r);
 
-	if (!pthread_equal(r->thread, config.main_thread)) {
-		if (!pthread_equal(r->thread, pthread_self())) {
-			if ((err = pthread_cancel(r->thread)) != 0 && err != ESRCH)
-				warn("Couldn't cancel RFCOMM thread: %s", strerror(err));
-			if ((err = pthread_join(r->thread, NULL)) != 0)
-				warn("Couldn't join RFCOMM thread: %s", strerror(err));
-		}
-		else {
-			/* It seems that the thread is being destroyed by the link lost
-			 * quirk. Detach itself so we will not leak resources. */
-			pthread_detach(r->thread);
-		}
+	/* Remove connection from the event loop. In case when the connection is
+	 * destroyed by the link lost quirk, the connection is being processed by
+	 * the current thread, so we must not wait for the processing to finish. */
+	if (r->id != 0 && !rfcomm_engine_is_self()) {
+		pthread_mutex_lock(&rfcomm_engine.mutex);
+		while (rfcomm_engine.dispatching == r->id)
+			pthread_cond_wait(&rfcomm_engine.cond, &rfcomm_engine.mutex);
+		/* make sure that the connection will not be processed any more */
+		if (rfcomm_engine.connections != NULL)
+			g_hash_table_remove(rfcomm_engine.connections, GUINT_TO_POINTER(r->id));
+		pthread_mutex_unlock(&rfcomm_engine.mutex);
 	}
 
+	r->link_lost_quirk = false;
+	rfcomm_connection_close(r);
+
 	if (r->handler_fd != -1)
 		close(r->handler_fd);
 
@@ -1765,6 +2187,42 @@ void ba_rfcomm_destroy(struct ba_rfcomm *r) {
 	free(r);
 }
 
+/**
+ * Stop RFCOMM event loop thread.
+ *
+ * This function shall be called after all RFCOMM connections have been
+ * destroyed. It is safe to call it even if the event loop was never
+ * started. */
+void ba_rfcomm_engine_stop(void) {
+
+	pthread_mutex_lock(&rfcomm_engine.mutex);
+
+	if (rfcomm_engine.epoll_fd == -1) {
+		pthread_mutex_unlock(&rfcomm_engine.mutex);
+		return;
+	}
+
+	const unsigned int n = g_hash_table_size(rfcomm_engine.connections);
+	if (n > 0)
+		warn("Stopping RFCOMM event loop with active connections: %u", n);
+
+	pthread_mutex_unlock(&rfcomm_engine.mutex);
+
+	/* Notify the event loop thread that it shall terminate. */
+	eventfd_write(rfcomm_engine.event_fd, 1);
+	pthread_join(rfcomm_engine.thread, NULL);
+
+	pthread_mutex_lock(&rfcomm_engine.mutex);
+	g_hash_table_destroy(rfcomm_engine.connections);
+	rfcomm_engine.connections = NULL;
+	close(rfcomm_engine.event_fd);
+	close(rfcomm_engine.epoll_fd);
+	rfcomm_engine.event_fd = -1;
+	rfcomm_engine.epoll_fd = -1;
+	pthread_mutex_unlock(&rfcomm_engine.mutex);
+
+}
+
 int ba_rfcomm_send_signal(struct ba_rfcomm *r, enum ba_rfcomm_signal sig) {
 	return write(r->sig_fd[1], &sig, sizeof(sig));
 }
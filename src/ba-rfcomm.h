@@ -1,6 +1,6 @@
 /*
  * BlueALSA - ba-rfcomm.h
- * Copyright (c) 2016-2024 Arkadiusz Bokowy
+ * Copyright (c) 2016-2025 Arkadiusz Bokowy
  *
  * This file is a part of bluez-alsa.
  *
@@ -20,6 +20,7 @@
 #include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <time.h>
 
 #include "at.h"
 #include "ba-transport.h"
@@ -41,6 +42,17 @@ enum ba_rfcomm_signal {
 	BA_RFCOMM_SIGNAL_UPDATE_VOLUME,
 };
 
+/**
+ * Structure used for buffered reading from the RFCOMM. */
+struct at_reader {
+	struct at_parser parser;
+	struct bt_at at;
+	char buffer[256];
+	/* pointer to the unparsed data within the buffer */
+	const char *next;
+	size_t next_len;
+};
+
 struct ba_rfcomm_hfp_codecs {
 	bool cvsd;
 #if ENABLE_MSBC
@@ -61,9 +73,12 @@ struct ba_rfcomm {
 	/* RFCOMM socket */
 	int fd;
 
-	pthread_t thread;
+	/* ID within the RFCOMM event loop (0 if not registered) */
+	unsigned int id;
+	/* buffered AT message reader */
+	struct at_reader reader;
 
-	/* thread notification PIPE */
+	/* event loop notification PIPE */
 	int sig_fd[2];
 
 	/* service level connection state */
@@ -80,6 +95,11 @@ struct ba_rfcomm {
 
 	/* external RFCOMM handler */
 	int handler_fd;
+	/* external handler registered in the event loop */
+	int handler_fd_polled;
+
+	/* SLC stage timeout (zero if not set) */
+	struct timespec deadline;
 
 	/* determine whether connection is idle */
 	bool idle;
@@ -108,6 +128,14 @@ struct ba_rfcomm {
 	/* requested codec by the AG */
 	uint8_t codec_id;
 
+	/* SLC data cached during the last connection */
+	struct {
+		/* remote features */
+		uint32_t features;
+		/* selected codec or HFP_CODEC_UNDEFINED */
+		uint8_t codec_id;
+	} slc_cache;
+
 	/* received AG indicator values */
 	unsigned char hfp_ind[__HFP_IND_MAX];
 	/* indicator activation state */
@@ -149,6 +177,7 @@ struct ba_rfcomm_handler {
 
 struct ba_rfcomm *ba_rfcomm_new(struct ba_transport *sco, int fd);
 void ba_rfcomm_destroy(struct ba_rfcomm *r);
+void ba_rfcomm_engine_stop(void);
 
 int ba_rfcomm_send_signal(struct ba_rfcomm *r, enum ba_rfcomm_signal sig);
 
@@ -22,14 +22,18 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
 #include <gio/gio.h>
 #include <glib.h>
 
 #include "audio.h"
+#include "audio-resampler.h"
+#include "ba-broadcast.h"
 #include "ba-config.h"
 #include "ba-device.h"
+#include "ba-mix.h"
 #include "ba-rfcomm.h"
 #include "ba-transport.h"
 #include "bluealsa-dbus.h"
@@ -41,6 +45,8 @@
 #if ENABLE_OFONO
 # include "ofono.h"
 #endif
+#include "trace.h"
+#include "utils.h"
 #include "shared/defs.h"
 #include "shared/log.h"
 
@@ -116,6 +122,8 @@ void transport_pcm_free(
 	if (pcm->pipe[1] != -1)
 		close(pcm->pipe[1]);
 
+	free(pcm->client_buffer);
+	free(pcm->resampler_buffer);
 	g_free(pcm->ba_dbus_path);
 
 }
@@ -364,6 +372,13 @@ int ba_transport_pcm_start(
 		ret = 0;
 	}
 
+	const cpu_set_t *cpus = t->profile & BA_TRANSPORT_PROFILE_MASK_A2DP ?
+		&config.cpu_affinity.a2dp : &config.cpu_affinity.sco;
+	if ((ret = thread_set_cpu_affinity(pcm->tid, cpus)) != 0)
+		warn("Couldn't set IO thread CPU affinity: %s", strerror(ret));
+	/* Not a fatal error either, the thread will run on any CPU. */
+	ret = 0;
+
 	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
 
 	pthread_setname_np(pcm->tid, name);
@@ -447,11 +462,27 @@ int ba_transport_pcm_release(struct ba_transport_pcm *pcm) {
 #endif
 
 	if (pcm->fd != -1) {
+		/* The leader of the broadcast group feeds all group members,
+		 * so closing it shall stop the whole group. */
+		if (pcm->broadcast != NULL && pcm->broadcast->pcm == pcm)
+			ba_broadcast_close(pcm->broadcast);
 		debug("Closing PCM: %d", pcm->fd);
 		close(pcm->fd);
 		pcm->fd = -1;
+		pcm->client_format = 0;
+		pcm->client_rate = 0;
 	}
 
+	audio_resampler_free(&pcm->resampler);
+
+	if (pcm->sink_ring != NULL) {
+		munmap(pcm->sink_ring, pcm->sink_ring_size);
+		pcm->sink_ring = NULL;
+		pcm->sink_ring_size = 0;
+		pcm->sink_ring_chunk = 0;
+	}
+	pcm->sink_ring_disabled = false;
+
 	if (pcm->controller != NULL) {
 		g_source_destroy(pcm->controller);
 		g_source_unref(pcm->controller);
@@ -572,8 +603,10 @@ enum ba_transport_pcm_signal ba_transport_pcm_signal_recv(
 			errno == EINTR)
 		continue;
 
-	if (ret == sizeof(signal))
+	if (ret == sizeof(signal)) {
+		trace_event(BA_TRACE_EVENT_SIGNAL, signal, 0);
 		return signal;
+	}
 
 	warn("Couldn't read transport PCM signal: %s", strerror(errno));
 	return -1;
@@ -583,6 +616,10 @@ bool ba_transport_pcm_is_active(const struct ba_transport_pcm *pcm) {
 	pthread_mutex_lock(MUTABLE(&pcm->mutex));
 	bool active = pcm->fd != -1 && !pcm->paused;
 	pthread_mutex_unlock(MUTABLE(&pcm->mutex));
+	/* A2DP sink PCMs shall be decoded when the mix is opened */
+	if (!active && config.a2dp.mix != NULL &&
+			pcm->t->profile == BA_TRANSPORT_PROFILE_A2DP_SINK)
+		active = ba_mix_is_open(config.a2dp.mix);
 	return active;
 }
 
@@ -721,6 +758,14 @@ int ba_transport_pcm_get_hardware_volume(
 	return 0;
 }
 
+/**
+ * Get delay introduced by the client sample rate conversion. */
+static int transport_pcm_get_resampler_delay(const struct ba_transport_pcm *pcm) {
+	if (pcm->client_rate == 0 || pcm->client_rate == pcm->rate)
+		return 0;
+	return audio_resampler_delay_dms(pcm->rate, pcm->client_rate);
+}
+
 /**
  * Get PCM playback/capture cumulative delay. */
 int ba_transport_pcm_delay_get(const struct ba_transport_pcm *pcm) {
@@ -731,6 +776,8 @@ int ba_transport_pcm_delay_get(const struct ba_transport_pcm *pcm) {
 	delay += pcm->codec_delay_dms;
 	delay += pcm->processing_delay_dms;
 
+	delay += transport_pcm_get_resampler_delay(pcm);
+
 	/* Add delay reported by BlueZ but only for A2DP Source profile. In case
 	 * of A2DP Sink, the BlueZ delay value is in fact our client delay. */
 	if (t->profile & BA_TRANSPORT_PROFILE_A2DP_SOURCE)
@@ -740,6 +787,11 @@ int ba_transport_pcm_delay_get(const struct ba_transport_pcm *pcm) {
 	else if (t->profile & BA_TRANSPORT_PROFILE_MASK_AG)
 		delay += 10;
 
+	/* All members of the broadcast group are aligned to the
+	 * delay of the slowest one, so report the group delay. */
+	if (pcm->broadcast != NULL && pcm->broadcast->pcm == pcm)
+		delay = MAX(delay, (int)ba_broadcast_get_delay(pcm->broadcast));
+
 	return delay;
 }
 
@@ -761,6 +813,8 @@ int ba_transport_pcm_delay_sync(struct ba_transport_pcm *pcm, unsigned int updat
 		delay += pcm->processing_delay_dms;
 		delay += pcm->client_delay_dms;
 
+		delay += transport_pcm_get_resampler_delay(pcm);
+
 		if (t->media.delay_reporting &&
 					abs(delay - t->media.delay) >= 100 /* 10ms */) {
 
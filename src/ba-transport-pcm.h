@@ -17,11 +17,14 @@
 #endif
 
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 
 #include <glib.h>
 
+#include "audio-resampler.h"
+
 enum ba_transport_pcm_mode {
 	/* PCM used for capturing audio */
 	BA_TRANSPORT_PCM_MODE_SOURCE,
@@ -41,11 +44,16 @@ enum ba_transport_pcm_state {
 /**
  * Builder for 16-bit PCM stream format identifier. */
 #define BA_TRANSPORT_PCM_FORMAT(sign, width, bytes, endian) \
-	(((sign & 1) << 15) | ((endian & 1) << 14) | ((bytes & 0x3F) << 8) | (width & 0xFF))
+	(((sign & 1) << 15) | ((endian & 1) << 14) | ((bytes & 0x1F) << 8) | (width & 0xFF))
+
+/**
+ * Flag for IEEE 754 floating-point stream format identifier. */
+#define BA_TRANSPORT_PCM_FORMAT_FLOAT_FLAG (1 << 13)
 
 #define BA_TRANSPORT_PCM_FORMAT_SIGN(format)   (((format) >> 15) & 0x1)
 #define BA_TRANSPORT_PCM_FORMAT_WIDTH(format)  ((format) & 0xFF)
-#define BA_TRANSPORT_PCM_FORMAT_BYTES(format)  (((format) >> 8) & 0x3F)
+#define BA_TRANSPORT_PCM_FORMAT_BYTES(format)  (((format) >> 8) & 0x1F)
+#define BA_TRANSPORT_PCM_FORMAT_FLOAT(format)  (((format) >> 13) & 0x1)
 #define BA_TRANSPORT_PCM_FORMAT_ENDIAN(format) (((format) >> 14) & 0x1)
 
 #define BA_TRANSPORT_PCM_FORMAT_U8      BA_TRANSPORT_PCM_FORMAT(0, 8, 1, 0)
@@ -53,6 +61,8 @@ enum ba_transport_pcm_state {
 #define BA_TRANSPORT_PCM_FORMAT_S24_3LE BA_TRANSPORT_PCM_FORMAT(1, 24, 3, 0)
 #define BA_TRANSPORT_PCM_FORMAT_S24_4LE BA_TRANSPORT_PCM_FORMAT(1, 24, 4, 0)
 #define BA_TRANSPORT_PCM_FORMAT_S32_4LE BA_TRANSPORT_PCM_FORMAT(1, 32, 4, 0)
+#define BA_TRANSPORT_PCM_FORMAT_F32_4LE \
+	(BA_TRANSPORT_PCM_FORMAT(1, 32, 4, 0) | BA_TRANSPORT_PCM_FORMAT_FLOAT_FLAG)
 
 enum ba_transport_pcm_channel {
 	BA_TRANSPORT_PCM_CHANNEL_MONO, /* mono */
@@ -86,6 +96,7 @@ enum ba_transport_pcm_signal {
 	BA_TRANSPORT_PCM_SIGNAL_DROP,
 };
 
+struct ba_broadcast;
 struct ba_transport;
 
 struct ba_transport_pcm {
@@ -117,6 +128,31 @@ struct ba_transport_pcm {
 
 	/* 16-bit stream format identifier */
 	uint16_t format;
+	/* Stream format of the PCM FIFO requested by the client. If it differs
+	 * from the transport format, the IO thread converts samples on the fly.
+	 * Value 0 means that the transport format is used. */
+	uint16_t client_format;
+	/* scratch buffer for the client format conversion */
+	void *client_buffer;
+	size_t client_buffer_size;
+	/* Sample rate of the PCM FIFO requested by the client. If it differs
+	 * from the transport rate, the IO thread resamples audio to this rate.
+	 * Value 0 means that the client follows the transport rate. */
+	unsigned int client_rate;
+	/* resampler for the client sample rate */
+	struct audio_resampler resampler;
+	/* scratch buffer for the resampler input and output */
+	float *resampler_buffer;
+	size_t resampler_buffer_size;
+	/* Page-aligned ring buffer for zero-copy writes into the PCM FIFO
+	 * with vmsplice(). The ring is sized for writes up to the chunk size
+	 * and it is released together with the PCM client. */
+	void *sink_ring;
+	size_t sink_ring_size;
+	size_t sink_ring_chunk;
+	size_t sink_ring_head;
+	/* PCM FIFO does not support vmsplice() */
+	bool sink_ring_disabled;
 	/* number of audio channels */
 	unsigned int channels;
 	/* PCM sample rate */
@@ -155,10 +191,30 @@ struct ba_transport_pcm {
 
 	/* actual thread ID */
 	pthread_t tid;
+	/* the number of deadlines missed by the IO thread */
+	atomic_uint deadline_misses;
 
 	/* notification PIPE */
 	int pipe[2];
 
+	/* associated broadcast group */
+	struct ba_broadcast *broadcast;
+	/* set when encoded data is written by the broadcast group, this
+	 * flag is modified with the broadcast group lock held */
+	atomic_bool broadcast_encoder;
+
+	/* Gain applied when this PCM is mixed into the A2DP sink
+	 * mix PCM. The value is expressed in 1/100 of decibel. */
+	int mix_gain;
+
+	/* Encoder bit rate in bits per second. This field is set only by
+	 * codecs which allow changing the bit rate on a per-device basis,
+	 * otherwise it is set to 0. */
+	unsigned int bitrate;
+	/* Bit rate requested via the D-Bus API. The encoder thread takes the
+	 * request and updates the bitrate field once it accepts the value. */
+	atomic_uint bitrate_request;
+
 	/* exported PCM D-Bus API */
 	char *ba_dbus_path;
 	bool ba_dbus_exported;
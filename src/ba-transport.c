@@ -35,6 +35,8 @@
 #include <glib.h>
 
 #include "ba-adapter.h"
+#include "ba-broadcast.h"
+#include "ba-mix.h"
 #include "ba-rfcomm.h"
 #include "ba-transport-pcm.h"
 #include "ba-config.h"
@@ -42,9 +44,11 @@
 #include "bluealsa-dbus.h"
 #include "bluez-iface.h"
 #include "bluez.h"
+#include "codec-lib.h"
 #include "hci.h"
 #include "hfp.h"
 #include "midi.h"
+#include "rwlock.h"
 #include "sco.h"
 #include "storage.h"
 #include "shared/defs.h"
@@ -165,10 +169,82 @@ static void transport_threads_cancel_if_no_clients(struct ba_transport *t) {
 
 }
 
+/**
+ * Replace SCO link with the one accepted by the SCO dispatcher.
+ *
+ * IO threads which use the previous SCO link are stopped and then started
+ * again with the new link. The ba_transport_stop() function can not be used
+ * here, because it waits for the thread manager (i.e. us) to cancel IO
+ * threads. */
+static void transport_sco_link_setup(struct ba_transport *t) {
+
+	pthread_mutex_lock(&t->bt_fd_mtx);
+	const int fd = t->sco.link_fd;
+	const struct timespec accepted_at = t->sco.link_accepted_at;
+	t->sco.link_setup_active = fd != -1;
+	t->sco.link_fd = -1;
+	pthread_mutex_unlock(&t->bt_fd_mtx);
+
+	if (fd == -1)
+		return;
+
+	if (!ba_transport_pcm_state_check_terminated(&t->sco.pcm_spk) ||
+			!ba_transport_pcm_state_check_terminated(&t->sco.pcm_mic)) {
+
+		/* Set the stopping flag, so the IO thread cleanup
+		 * will not schedule another threads cancellation. */
+		pthread_mutex_lock(&t->bt_fd_mtx);
+		t->stopping = true;
+		pthread_mutex_unlock(&t->bt_fd_mtx);
+
+		ba_transport_pcm_state_set_stopping(&t->sco.pcm_spk);
+		ba_transport_pcm_state_set_stopping(&t->sco.pcm_mic);
+		transport_threads_cancel(t);
+
+	}
+
+	pthread_mutex_lock(&t->bt_fd_mtx);
+	t->bt_fd = fd;
+	t->mtu_read = t->mtu_write = hci_sco_get_mtu(fd, t->d->a);
+	pthread_mutex_unlock(&t->bt_fd_mtx);
+
+	ba_transport_pcm_state_set_idle(&t->sco.pcm_spk);
+	ba_transport_pcm_state_set_idle(&t->sco.pcm_mic);
+	ba_transport_start(t);
+
+	pthread_mutex_lock(&t->bt_fd_mtx);
+	t->sco.link_setup_active = false;
+	pthread_mutex_unlock(&t->bt_fd_mtx);
+
+	pthread_cond_broadcast(&t->stopped_cond);
+	sco_setup_done(&accepted_at);
+
+}
+
+/**
+ * Drop pending SCO link and wait for the on-going setup to complete. */
+static void transport_sco_link_setup_cancel(struct ba_transport *t) {
+
+	pthread_mutex_lock(&t->bt_fd_mtx);
+
+	if (t->sco.link_fd != -1) {
+		close(t->sco.link_fd);
+		t->sco.link_fd = -1;
+		sco_setup_done(NULL);
+	}
+
+	while (t->sco.link_setup_active)
+		pthread_cond_wait(&t->stopped_cond, &t->bt_fd_mtx);
+
+	pthread_mutex_unlock(&t->bt_fd_mtx);
+
+}
+
 /**
  * Transport thread manager.
  *
- * This manager handles transport IO threads asynchronous cancellation. */
+ * This manager handles transport IO threads asynchronous cancellation and
+ * the setup of incoming SCO links. */
 static void *transport_thread_manager(struct ba_transport *t) {
 
 	pthread_setname_np(pthread_self(), "ba-th-manager");
@@ -204,6 +280,10 @@ static void *transport_thread_manager(struct ba_transport *t) {
 				debug("PCM clients check keep-alive: %d ms", config.keep_alive_time);
 				timeout = config.keep_alive_time;
 				break;
+			case BA_TRANSPORT_THREAD_MANAGER_SCO_SETUP:
+				transport_sco_link_setup(t);
+				timeout = -1;
+				break;
 			}
 
 		}
@@ -267,9 +347,9 @@ static struct ba_transport *transport_new(
 	if ((t->bluez_dbus_path = strdup(dbus_path)) == NULL)
 		goto fail;
 
-	pthread_mutex_lock(&device->transports_mutex);
+	rwlock_wrlock(&device->transports_lock);
 	g_hash_table_insert(device->transports, t->bluez_dbus_path, t);
-	pthread_mutex_unlock(&device->transports_mutex);
+	rwlock_wrunlock(&device->transports_lock);
 
 	return t;
 
@@ -419,6 +499,13 @@ struct ba_transport *ba_transport_new_a2dp(
 	pthread_cond_init(&t->media.state_changed_cond, NULL);
 	t->media.state = BLUEZ_MEDIA_TRANSPORT_STATE_IDLE;
 
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_mutex_init(&t->media.clock.mutex, NULL);
+	pthread_cond_init(&t->media.clock.cond, &attr);
+	pthread_condattr_destroy(&attr);
+
 	t->media.sep = sep;
 	memcpy(&t->media.configuration, configuration, sep->config.caps_size);
 
@@ -436,6 +523,11 @@ struct ba_transport *ba_transport_new_a2dp(
 	if (err != 0)
 		goto fail;
 
+	/* Load codec libraries on the first use of the SEP. Libraries of codecs
+	 * which are never used are not mapped into the process memory at all. */
+	if (codec_lib_load_all(sep->libs) != 0)
+		goto fail;
+
 	/* do codec-specific initialization */
 	if (sep->transport_init(t) != 0) {
 		errno = EINVAL;
@@ -577,6 +669,8 @@ struct ba_transport *ba_transport_new_sco(
 	t->acquire = transport_acquire_bt_sco;
 	t->release = transport_release_bt_sco;
 
+	t->sco.link_fd = -1;
+
 	err |= transport_pcm_init(&t->sco.pcm_spk,
 			is_ag ? BA_TRANSPORT_PCM_MODE_SINK : BA_TRANSPORT_PCM_MODE_SOURCE,
 			t, true);
@@ -631,17 +725,21 @@ static int transport_release_bt_midi(struct ba_transport *t) {
 
 	midi_transport_alsa_seq_delete(t);
 
+	pthread_mutex_lock(&t->midi.ble_write_mtx);
 	if (t->midi.ble_fd_write != -1) {
 		debug("Releasing BLE-MIDI write link: %d", t->midi.ble_fd_write);
 		close(t->midi.ble_fd_write);
 		t->midi.ble_fd_write = -1;
 	}
+	pthread_mutex_unlock(&t->midi.ble_write_mtx);
 
+	pthread_mutex_lock(&t->midi.ble_notify_mtx);
 	if (t->midi.ble_fd_notify != -1) {
 		debug("Releasing BLE-MIDI notify link: %d", t->midi.ble_fd_notify);
 		close(t->midi.ble_fd_notify);
 		t->midi.ble_fd_notify = -1;
 	}
+	pthread_mutex_unlock(&t->midi.ble_notify_mtx);
 
 	return 0;
 }
@@ -662,6 +760,11 @@ struct ba_transport *ba_transport_new_midi(
 	t->midi.seq_queue = -1;
 	t->midi.ble_fd_write = -1;
 	t->midi.ble_fd_notify = -1;
+	t->midi.epoll_fd = -1;
+	t->midi.event_fd = -1;
+	t->midi.timer_fd = -1;
+	pthread_mutex_init(&t->midi.ble_write_mtx, NULL);
+	pthread_mutex_init(&t->midi.ble_notify_mtx, NULL);
 
 	int err;
 	if ((err = snd_midi_event_new(1024, &t->midi.seq_parser)) < 0) {
@@ -746,23 +849,17 @@ struct ba_transport *ba_transport_lookup(
 
 	struct ba_transport *t;
 
-	pthread_mutex_lock(MUTABLE(&device->transports_mutex));
+	rwlock_rdlock(MUTABLE(&device->transports_lock));
 	if ((t = g_hash_table_lookup(device->transports, dbus_path)) != NULL)
-		t->ref_count++;
-	pthread_mutex_unlock(MUTABLE(&device->transports_mutex));
+		atomic_fetch_add_explicit(&t->ref_count, 1, memory_order_relaxed);
+	rwlock_rdunlock(MUTABLE(&device->transports_lock));
 
 	return t;
 }
 
 struct ba_transport *ba_transport_ref(
 		struct ba_transport *t) {
-
-	struct ba_device *d = t->d;
-
-	pthread_mutex_lock(&d->transports_mutex);
-	t->ref_count++;
-	pthread_mutex_unlock(&d->transports_mutex);
-
+	atomic_fetch_add_explicit(&t->ref_count, 1, memory_order_relaxed);
 	return t;
 }
 
@@ -785,6 +882,9 @@ void ba_transport_destroy(struct ba_transport *t) {
 		if (t->sco.rfcomm != NULL)
 			ba_rfcomm_destroy(t->sco.rfcomm);
 		t->sco.rfcomm = NULL;
+		/* Make sure that the SCO dispatcher will not
+		 * start IO threads behind our back. */
+		transport_sco_link_setup_cancel(t);
 	}
 
 	/* stop transport IO threads */
@@ -807,6 +907,12 @@ void ba_transport_destroy(struct ba_transport *t) {
 
 	ba_transport_pcms_full_unlock(t);
 
+	if (t->profile & BA_TRANSPORT_PROFILE_A2DP_SOURCE)
+		ba_broadcast_remove_member(&t->media.pcm);
+	if (t->profile & BA_TRANSPORT_PROFILE_A2DP_SINK &&
+			config.a2dp.mix != NULL)
+		ba_mix_pcm_remove(config.a2dp.mix, &t->media.pcm);
+
 	ba_transport_unref(t);
 }
 
@@ -815,11 +921,15 @@ void ba_transport_unref(struct ba_transport *t) {
 	int ref_count;
 	struct ba_device *d = t->d;
 
-	pthread_mutex_lock(&d->transports_mutex);
-	if ((ref_count = --t->ref_count) == 0)
+	if (rwlock_ref_dec_unless_last(&t->ref_count))
+		return;
+
+	rwlock_wrlock(&d->transports_lock);
+	if ((ref_count = atomic_fetch_sub_explicit(&t->ref_count, 1,
+					memory_order_acq_rel) - 1) == 0)
 		/* detach transport from the device */
 		g_hash_table_steal(d->transports, t->bluez_dbus_path);
-	pthread_mutex_unlock(&d->transports_mutex);
+	rwlock_wrunlock(&d->transports_lock);
 
 	if (ref_count > 0)
 		return;
@@ -868,10 +978,16 @@ void ba_transport_unref(struct ba_transport *t) {
 		transport_pcm_free(&t->media.pcm);
 		transport_pcm_free(&t->media.pcm_bc);
 		pthread_cond_destroy(&t->media.state_changed_cond);
+		pthread_mutex_destroy(&t->media.clock.mutex);
+		pthread_cond_destroy(&t->media.clock.cond);
 	}
 	else if (t->profile & BA_TRANSPORT_PROFILE_MASK_SCO) {
 		if (t->sco.rfcomm != NULL)
 			ba_rfcomm_destroy(t->sco.rfcomm);
+		if (t->sco.link_fd != -1) {
+			close(t->sco.link_fd);
+			sco_setup_done(NULL);
+		}
 		transport_pcm_free(&t->sco.pcm_spk);
 		transport_pcm_free(&t->sco.pcm_mic);
 #if ENABLE_OFONO
@@ -884,6 +1000,8 @@ void ba_transport_unref(struct ba_transport *t) {
 		if (t->midi.seq_parser != NULL)
 			snd_midi_event_free(t->midi.seq_parser);
 		ble_midi_decode_free(&t->midi.ble_decoder);
+		pthread_mutex_destroy(&t->midi.ble_write_mtx);
+		pthread_mutex_destroy(&t->midi.ble_notify_mtx);
 	}
 #endif
 
@@ -1034,13 +1152,69 @@ void ba_transport_set_codec(
 	if (!changed)
 		return;
 
-	if (t->profile & BA_TRANSPORT_PROFILE_MASK_A2DP)
+	if (t->profile & BA_TRANSPORT_PROFILE_MASK_A2DP) {
+		/* bit rate is set by the codec, if supported */
+		t->media.pcm.bitrate = 0;
+		/* back-channel is declared by the codec, if supported */
+		t->media.pcm_bc.channels = 0;
 		t->media.sep->transport_init(t);
+	}
 	else if (t->profile & BA_TRANSPORT_PROFILE_MASK_SCO)
 		sco_transport_init(t);
 
 }
 
+/**
+ * Declare A2DP back-channel (voice) PCM.
+ *
+ * This function shall be called by the codec-specific transport
+ * initialization callback, if the selected configuration enables
+ * the back-channel stream. The back-channel is always mono.
+ *
+ * @param t Transport structure.
+ * @param format The PCM sample format.
+ * @param rate The PCM sample rate. */
+void ba_transport_media_bc_init(
+		struct ba_transport *t,
+		uint16_t format,
+		unsigned int rate) {
+
+	t->media.pcm_bc.format = format;
+	t->media.pcm_bc.channels = 1;
+	t->media.pcm_bc.rate = rate;
+
+	t->media.pcm_bc.channel_map[0] = BA_TRANSPORT_PCM_CHANNEL_MONO;
+
+}
+
+/**
+ * Start A2DP back-channel IO thread.
+ *
+ * If the back-channel was not declared for the transport, this function
+ * does nothing. Otherwise, the back-channel pacing is synchronized with
+ * the current main stream clock and the IO thread is started.
+ *
+ * @param t Transport structure.
+ * @param th_func The back-channel IO thread function.
+ * @param name The name of the IO thread.
+ * @return On success this function returns 0. Otherwise -1 is returned. */
+int ba_transport_media_bc_start(
+		struct ba_transport *t,
+		ba_transport_pcm_thread_func th_func,
+		const char *name) {
+
+	if (t->media.pcm_bc.channels == 0)
+		return 0;
+
+	pthread_mutex_lock(&t->media.clock.mutex);
+	t->media.clock.bc_base = t->media.clock.frames;
+	t->media.clock.bc_frames = 0;
+	t->media.clock.bc_coupled = false;
+	pthread_mutex_unlock(&t->media.clock.mutex);
+
+	return ba_transport_pcm_start(&t->media.pcm_bc, th_func, name);
+}
+
 /**
  * Start transport IO threads.
  *
@@ -1182,6 +1356,40 @@ int ba_transport_stop_if_no_clients(struct ba_transport *t) {
 	return 0;
 }
 
+/**
+ * Schedule the setup of the incoming SCO link.
+ *
+ * This function takes the ownership of the SCO link file descriptor. The
+ * transport IO threads restart is done by the transport thread manager, so
+ * this function does not block. If there is another link waiting for the
+ * setup, it is replaced with the new one.
+ *
+ * @param t The SCO transport.
+ * @param fd Accepted (and authorized) SCO link file descriptor.
+ * @param accepted_at Time-stamp when the link has been accepted.
+ * @return On success this function returns 0. Otherwise -1 is returned. */
+int ba_transport_sco_link_setup(
+		struct ba_transport *t,
+		int fd,
+		const struct timespec *accepted_at) {
+
+	pthread_mutex_lock(&t->bt_fd_mtx);
+
+	if (t->sco.link_fd != -1) {
+		warn("Dropping superseded SCO link: %d", t->sco.link_fd);
+		close(t->sco.link_fd);
+		sco_setup_done(NULL);
+	}
+
+	t->sco.link_fd = fd;
+	t->sco.link_accepted_at = *accepted_at;
+	sco_setup_queued();
+
+	pthread_mutex_unlock(&t->bt_fd_mtx);
+
+	return transport_thread_manager_send_command(t, BA_TRANSPORT_THREAD_MANAGER_SCO_SETUP);
+}
+
 int ba_transport_acquire(struct ba_transport *t) {
 
 #if ENABLE_MIDI
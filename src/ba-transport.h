@@ -17,6 +17,7 @@
 #endif
 
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -32,10 +33,18 @@
 #include "bluez.h"
 #include "shared/a2dp-codecs.h"
 
+/**
+ * The number of buckets in the MIDI latency histogram. The first bucket
+ * counts events with latency below 125 us, every next bucket covers twice
+ * as long time span and the last one counts events delayed by 32 ms and
+ * more. */
+#define BA_TRANSPORT_MIDI_LATENCY_BUCKETS 10
+
 enum ba_transport_thread_manager_command {
 	BA_TRANSPORT_THREAD_MANAGER_TERMINATE = 0,
 	BA_TRANSPORT_THREAD_MANAGER_CANCEL_THREADS,
 	BA_TRANSPORT_THREAD_MANAGER_CANCEL_IF_NO_CLIENTS,
+	BA_TRANSPORT_THREAD_MANAGER_SCO_SETUP,
 };
 
 enum ba_transport_profile {
@@ -138,6 +147,23 @@ struct ba_transport {
 			/* PCM for back-channel stream */
 			struct ba_transport_pcm pcm_bc;
 
+			/* Main stream clock used for pacing the back-channel stream. The
+			 * main stream decoder advances it by the number of decoded PCM
+			 * frames, so the back-channel encoder can follow the clock of the
+			 * remote device instead of the local one. */
+			struct {
+				pthread_mutex_t mutex;
+				pthread_cond_t cond;
+				/* PCM frames processed by the main stream */
+				uint64_t frames;
+				/* main stream clock reference for the back-channel */
+				uint64_t bc_base;
+				/* PCM frames transferred by the back-channel since reference */
+				uint64_t bc_frames;
+				/* back-channel is paced by the main stream clock */
+				bool bc_coupled;
+			} clock;
+
 			/* Value reported by the ioctl(TIOCOUTQ) when the output buffer is
 			 * empty. Somehow this ioctl call reports "available" buffer space.
 			 * So, in order to get the number of bytes in the queue buffer, we
@@ -173,6 +199,14 @@ struct ba_transport {
 			/* time-stamp when the SCO link has been closed */
 			struct timespec closed_at;
 
+			/* Incoming SCO link accepted by the SCO dispatcher, which waits
+			 * for the setup in the transport thread manager. */
+			int link_fd;
+			/* time-stamp when the pending SCO link has been accepted */
+			struct timespec link_accepted_at;
+			/* SCO link setup is in progress */
+			bool link_setup_active;
+
 		} sco;
 
 #if ENABLE_MIDI
@@ -190,18 +224,37 @@ struct ba_transport {
 
 			/* BLE-MIDI input link */
 			int ble_fd_write;
+			/* guard input link updates */
+			pthread_mutex_t ble_write_mtx;
 			/* BLE-MIDI output (notification) link */
 			int ble_fd_notify;
+			/* guard output link and encoder updates */
+			pthread_mutex_t ble_notify_mtx;
 
 			/* BLE-MIDI parser for the incoming data. */
 			struct ble_midi_dec ble_decoder;
+			/* sender clock recovery for the incoming data */
+			struct ble_midi_clock ble_clock;
 			/* BLE-MIDI parser for the outgoing data. */
 			struct ble_midi_enc ble_encoder;
 
-			/* Watch associated with the BLE-MIDI link. */
-			GSource *watch_ble;
-			/* Watch associated with ALSA sequencer. */
-			GSource *watch_seq;
+			/* MIDI IO thread and its epoll instance */
+			pthread_t thread;
+			int epoll_fd;
+			/* event used to terminate the IO thread */
+			int event_fd;
+			/* timer for flushing BLE-MIDI notifications */
+			int timer_fd;
+			bool ble_flush_pending;
+
+			/* BLE-MIDI to ALSA sequencer latency histogram */
+			atomic_uint latency[BA_TRANSPORT_MIDI_LATENCY_BUCKETS];
+			/* residual jitter of the BLE-MIDI packets in microseconds */
+			atomic_uint jitter;
+
+			/* exported MIDI D-Bus API */
+			char *ba_dbus_path;
+			bool ba_dbus_exported;
 
 		} midi;
 #endif
@@ -213,7 +266,7 @@ struct ba_transport {
 	int (*release)(struct ba_transport *);
 
 	/* memory self-management */
-	int ref_count;
+	atomic_int ref_count;
 
 };
 
@@ -266,11 +319,25 @@ void ba_transport_set_codec(
 		struct ba_transport *t,
 		uint32_t codec_id);
 
+void ba_transport_media_bc_init(
+		struct ba_transport *t,
+		uint16_t format,
+		unsigned int rate);
+int ba_transport_media_bc_start(
+		struct ba_transport *t,
+		ba_transport_pcm_thread_func th_func,
+		const char *name);
+
 int ba_transport_start(struct ba_transport *t);
 int ba_transport_stop(struct ba_transport *t);
 int ba_transport_stop_async(struct ba_transport *t);
 int ba_transport_stop_if_no_clients(struct ba_transport *t);
 
+int ba_transport_sco_link_setup(
+		struct ba_transport *t,
+		int fd,
+		const struct timespec *accepted_at);
+
 int ba_transport_acquire(struct ba_transport *t);
 int ba_transport_release(struct ba_transport *t);
 
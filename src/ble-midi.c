@@ -169,12 +169,13 @@ retry:
 
 		int ts_high_low_diff = ts_high_low - bmd->ts_high_low;
 		if (ts_high_low_diff < 0)
-			ts_high_low_diff += 8191;
+			ts_high_low_diff += 8192;
 
 		struct timespec ts = {
 			.tv_sec = ts_high_low_diff / 1000,
 			.tv_nsec = (ts_high_low_diff % 1000) * 1000000 };
 		timespecadd(&bmd->ts, &ts, &bmd->ts);
+		timespecadd(&bmd->ts_sender, &ts, &bmd->ts_sender);
 
 		/* Check timestamp drift based on the first timestamp byte in the
 		 * BLE-MIDI packet. The packet may contain many MIDI messages which
@@ -345,11 +346,18 @@ fail:
  * Initialize BLE-MIDI encoder. */
 void ble_midi_encode_init(struct ble_midi_enc *bme) {
 	memset(bme, 0, sizeof(*bme));
+	bme->running_status = true;
 }
 
 /**
  * Encode BLE-MIDI packet.
  *
+ * Consecutive MIDI messages are appended to the encoder buffer as long as
+ * they fit within the MTU of the BLE link. If running status is enabled,
+ * the status byte of a channel message is omitted when it is the same as
+ * the status of the previous channel message in the BLE-MIDI packet. Also,
+ * the timestamp byte of such message is omitted if it has not changed.
+ *
  * It is possible that a single MIDI system exclusive message will not fit
  * into the MTU of the BLE link. In such case, this function will return 1
  * and the caller should call this function again with the same MIDI message.
@@ -363,8 +371,10 @@ void ble_midi_encode_init(struct ble_midi_enc *bme) {
 int ble_midi_encode(struct ble_midi_enc *enc, const uint8_t *data, size_t len) {
 
 	const bool is_sys = data[0] == 0xF0;
+	const bool is_channel = data[0] < 0xF0;
 	bool is_sys_continue = false;
 	size_t transfer_len = len;
+	size_t offset = 0;
 
 	/* Check if the MTU is at least 5 bytes (header + timestamp + MIDI message)
 	 * and does not exceed the buffer size of the encoder structure. */
@@ -373,10 +383,24 @@ int ble_midi_encode(struct ble_midi_enc *enc, const uint8_t *data, size_t len) {
 		return errno = EINVAL, -1;
 	}
 
-	/* Check if the message will fit within the MTU. In case of consecutive
-	 * encode calls, this check is off by one, but we can live with that. This
-	 * check does not apply to the system exclusive messages. */
-	if (enc->len + 2 + len > enc->mtu && !is_sys)
+	struct timespec now;
+	gettimestamp(&now);
+	unsigned int ts_high_low = now.tv_sec * 1000 + now.tv_nsec / 1000000;
+	const uint8_t ts_low = 0x80 | (ts_high_low & 0x7F);
+
+	/* In BLE-MIDI, the running status can not span multiple packets. Within
+	 * a single packet, the timestamp byte can be omitted only if the status
+	 * byte is omitted as well, otherwise it would be taken for a timestamp. */
+	const bool running = enc->running_status && enc->len > 0 &&
+		is_channel && data[0] == enc->status;
+	const bool with_ts = !running || ts_low != enc->ts_low;
+
+	if (running)
+		offset = 1;
+
+	/* Check if the message will fit within the MTU. This check does
+	 * not apply to the system exclusive messages. */
+	if (!is_sys && enc->len + (enc->len == 0) + with_ts + len - offset > enc->mtu)
 		return errno = EMSGSIZE, -1;
 
 	/* Check if the message is a system exclusive message
@@ -386,29 +410,38 @@ int ble_midi_encode(struct ble_midi_enc *enc, const uint8_t *data, size_t len) {
 		enc->len = 0;
 	}
 
-	struct timespec now;
-	gettimestamp(&now);
-	unsigned int ts_high_low = now.tv_sec * 1000 + now.tv_nsec / 1000000;
-
 	if (enc->len == 0) {
 		/* Construct the BLE-MIDI header with the most significant
 		* 6 bits of the 13-bits milliseconds timestamp. */
 		enc->buffer[enc->len++] = 0x80 | ((ts_high_low >> 7) & 0x3F);
+		enc->status = 0;
 	}
 
-	if (!is_sys_continue) {
+	if (!is_sys_continue && with_ts) {
 		/* Add the timestamp byte with the least significant 7 bits
 		 * of the timestamp. */
-		enc->buffer[enc->len++] = 0x80 | (ts_high_low & 0x7F);
+		enc->buffer[enc->len++] = ts_low;
+		enc->ts_low = ts_low;
 	}
 
-	if (is_sys)
+	if (is_sys) {
 		/* Calculate the number of bytes that we can transfer. */
 		transfer_len = MIN(len - enc->current_len, enc->mtu - enc->len);
+		offset = enc->current_len;
+	}
+	else
+		transfer_len = len - offset;
 
-	memcpy(&enc->buffer[enc->len], &data[enc->current_len], transfer_len);
+	memcpy(&enc->buffer[enc->len], &data[offset], transfer_len);
 	enc->len += transfer_len;
 
+	/* System common messages cancel the running status, while system
+	 * real-time messages do not affect it. */
+	if (is_channel)
+		enc->status = data[0];
+	else if (data[0] < 0xF8)
+		enc->status = 0;
+
 	if (is_sys) {
 		if ((enc->current_len += transfer_len) != len)
 			return 1;
@@ -424,3 +457,125 @@ int ble_midi_encode_set_mtu(struct ble_midi_enc *bme, size_t mtu) {
 	bme->mtu = MIN(mtu, sizeof(bme->buffer));
 	return 0;
 }
+
+/**
+ * Get time difference in milliseconds. */
+static double ble_midi_clock_diff(const struct timespec *ts, const struct timespec *base) {
+	return (ts->tv_sec - base->tv_sec) * 1000.0 + (ts->tv_nsec - base->tv_nsec) / 1000000.0;
+}
+
+/**
+ * Initialize BLE-MIDI clock recovery.
+ *
+ * @param bmc BLE-MIDI clock recovery structure.
+ * @param latency_ms Constant latency added to the recovered time. It shall
+ *   be large enough to cover the BLE connection interval. */
+void ble_midi_clock_init(struct ble_midi_clock *bmc, unsigned int latency_ms) {
+	memset(bmc, 0, sizeof(*bmc));
+	bmc->latency.tv_sec = latency_ms / 1000;
+	bmc->latency.tv_nsec = (latency_ms % 1000) * 1000000;
+	bmc->skew = 1.0;
+}
+
+/**
+ * Update BLE-MIDI clock recovery with a new packet.
+ *
+ * @param bmc BLE-MIDI clock recovery structure.
+ * @param sender Timestamp of the first MIDI message in the BLE-MIDI packet
+ *   in the sender clock domain.
+ * @param host Reception time of the BLE-MIDI packet. */
+void ble_midi_clock_update(struct ble_midi_clock *bmc,
+		const struct timespec *sender, const struct timespec *host) {
+
+	if (bmc->samples_len > 0) {
+		/* Reset the clock recovery in case of a time discontinuity, e.g. the
+		 * sender was idle for longer than the BLE-MIDI timestamp range. */
+		const double x = ble_midi_clock_diff(sender, &bmc->base_sender);
+		const double y = ble_midi_clock_diff(host, &bmc->base_host);
+		const double residual = y - (bmc->offset + bmc->skew * x);
+		if (residual > 500 || residual < -500) {
+			debug("BLE-MIDI clock recovery reset: %.1f ms", residual);
+			bmc->samples_len = 0;
+		}
+	}
+
+	if (bmc->samples_len == 0) {
+		bmc->base_sender = *sender;
+		bmc->base_host = *host;
+		bmc->samples_idx = 0;
+	}
+
+	bmc->samples_sender[bmc->samples_idx] = ble_midi_clock_diff(sender, &bmc->base_sender);
+	bmc->samples_host[bmc->samples_idx] = ble_midi_clock_diff(host, &bmc->base_host);
+	bmc->samples_idx = (bmc->samples_idx + 1) % BLE_MIDI_CLOCK_WINDOW;
+	if (bmc->samples_len < BLE_MIDI_CLOCK_WINDOW)
+		bmc->samples_len++;
+
+	const size_t n = bmc->samples_len;
+	double mean_x = 0, mean_y = 0;
+	for (size_t i = 0; i < n; i++) {
+		mean_x += bmc->samples_sender[i];
+		mean_y += bmc->samples_host[i];
+	}
+	mean_x /= n;
+	mean_y /= n;
+
+	double sxx = 0, sxy = 0;
+	for (size_t i = 0; i < n; i++) {
+		const double dx = bmc->samples_sender[i] - mean_x;
+		sxx += dx * dx;
+		sxy += dx * (bmc->samples_host[i] - mean_y);
+	}
+
+	/* Use the regression slope only if there is enough data, and if the
+	 * estimated skew between clocks is within a reasonable range. */
+	bmc->skew = 1.0;
+	if (n >= 8 && sxx > 0) {
+		const double skew = sxy / sxx;
+		if (skew > 0.999 && skew < 1.001)
+			bmc->skew = skew;
+	}
+
+	bmc->offset = mean_y - bmc->skew * mean_x;
+
+	double deviation = 0;
+	for (size_t i = 0; i < n; i++) {
+		const double residual = bmc->samples_host[i] -
+			(bmc->offset + bmc->skew * bmc->samples_sender[i]);
+		deviation += residual < 0 ? -residual : residual;
+	}
+
+	bmc->jitter = deviation * 1000 / n;
+
+}
+
+/**
+ * Convert sender time into the host time.
+ *
+ * @param bmc BLE-MIDI clock recovery structure.
+ * @param sender Time in the sender clock domain.
+ * @param host Address where the host time (including the constant latency)
+ *   will be stored. */
+void ble_midi_clock_convert(const struct ble_midi_clock *bmc,
+		const struct timespec *sender, struct timespec *host) {
+
+	if (bmc->samples_len == 0) {
+		timespecadd(sender, &bmc->latency, host);
+		return;
+	}
+
+	const double x = ble_midi_clock_diff(sender, &bmc->base_sender);
+	const double y = bmc->offset + bmc->skew * x;
+
+	const long long y_ns = (y < 0 ? -y : y) * 1000000;
+	struct timespec ts = {
+		.tv_sec = y_ns / 1000000000,
+		.tv_nsec = y_ns % 1000000000 };
+
+	if (y < 0)
+		timespecsub(&bmc->base_host, &ts, host);
+	else
+		timespecadd(&bmc->base_host, &ts, host);
+	timespecadd(host, &bmc->latency, host);
+
+}
@@ -20,10 +20,16 @@
 #include <stdint.h>
 #include <time.h>
 
+/**
+ * The number of BLE-MIDI packets used for the clock recovery. */
+#define BLE_MIDI_CLOCK_WINDOW 64
+
 struct ble_midi_dec {
 
 	/* timestamp */
 	struct timespec ts;
+	/* timestamp in the sender clock domain */
+	struct timespec ts_sender;
 	/* decoded MIDI message */
 	uint8_t *buffer;
 	/* length of the decoded message */
@@ -63,6 +69,10 @@ struct ble_midi_enc {
 	 * calling the ble_midi_encode() function. */
 	size_t mtu;
 
+	/* Use BLE-MIDI running status and omit repeated timestamp bytes for
+	 * consecutive MIDI messages within a single BLE-MIDI packet. */
+	bool running_status;
+
 	/* encoded BLE-MIDI message */
 	uint8_t buffer[512];
 	/* length of the encoded message */
@@ -71,6 +81,40 @@ struct ble_midi_enc {
 	/* current encoding position */
 	size_t current_len;
 
+	/* lastly encoded timestamp-low byte */
+	uint8_t ts_low;
+	/* lastly encoded channel message status byte */
+	uint8_t status;
+
+};
+
+/**
+ * BLE-MIDI sender clock recovery.
+ *
+ * The sender clock is mapped onto the host clock with a linear regression
+ * over the reception time of recent BLE-MIDI packets. */
+struct ble_midi_clock {
+
+	/* constant latency added to the recovered time */
+	struct timespec latency;
+
+	/* time base for the samples */
+	struct timespec base_sender;
+	struct timespec base_host;
+
+	/* sender and host time samples (in ms) relative to the time base */
+	double samples_sender[BLE_MIDI_CLOCK_WINDOW];
+	double samples_host[BLE_MIDI_CLOCK_WINDOW];
+	size_t samples_len;
+	size_t samples_idx;
+
+	/* host = offset + skew * sender */
+	double offset;
+	double skew;
+
+	/* mean absolute deviation of the packet reception time in microseconds */
+	unsigned int jitter;
+
 };
 
 void ble_midi_decode_init(struct ble_midi_dec *bmd);
@@ -81,4 +125,10 @@ void ble_midi_encode_init(struct ble_midi_enc *bme);
 int ble_midi_encode(struct ble_midi_enc *bme, const uint8_t *data, size_t len);
 int ble_midi_encode_set_mtu(struct ble_midi_enc *bme, size_t mtu);
 
+void ble_midi_clock_init(struct ble_midi_clock *bmc, unsigned int latency_ms);
+void ble_midi_clock_update(struct ble_midi_clock *bmc,
+		const struct timespec *sender, const struct timespec *host);
+void ble_midi_clock_convert(const struct ble_midi_clock *bmc,
+		const struct timespec *sender, struct timespec *host);
+
 #endif
@@ -0,0 +1,220 @@
+/*
+ * BlueALSA - bluealsa-codec.h
+ * Copyright (c) 2016-2025 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+/*
+ * Public ABI of BlueALSA A2DP codec modules.
+ *
+ * Codec module is a shared library loaded by the BlueALSA daemon with the
+ * dlopen(3) call. The module shall export a single symbol with the name
+ * BLUEALSA_CODEC_MODULE_SYMBOL of type struct bluealsa_codec_module. Such
+ * module replaces the codec work (encoding and/or decoding) of the built-in
+ * A2DP Stream End-Point with the matching codec ID. The codec configuration
+ * negotiation, RTP packetization, transfer pacing and PCM/BT IO are handled
+ * by the daemon, so the module only deals with audio frames.
+ *
+ * This header file shall not include any BlueALSA internal headers.
+ */
+
+#pragma once
+#ifndef BLUEALSA_BLUEALSACODEC_H_
+#define BLUEALSA_BLUEALSACODEC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * Major version shall be increased on every incompatible ABI change. Minor
+ * version shall be increased when new fields are appended at the end of the
+ * module structure. */
+#define BLUEALSA_CODEC_ABI_VERSION_MAJOR 1
+#define BLUEALSA_CODEC_ABI_VERSION_MINOR 1
+#define BLUEALSA_CODEC_ABI_VERSION \
+	(BLUEALSA_CODEC_ABI_VERSION_MAJOR << 16 | BLUEALSA_CODEC_ABI_VERSION_MINOR)
+
+/**
+ * Name of the symbol exported by the codec module. */
+#define BLUEALSA_CODEC_MODULE_SYMBOL "bluealsa_codec_module"
+
+/**
+ * Codec module processing direction. */
+enum bluealsa_codec_direction {
+	BLUEALSA_CODEC_ENCODER = 1 << 0,
+	BLUEALSA_CODEC_DECODER = 1 << 1,
+};
+
+/**
+ * Encoded frames are prefixed with the 1-byte media payload header with
+ * the number of frames, as it is done for SBC (A2DP v1.4, section 12.4). */
+#define BLUEALSA_CODEC_FLAG_RTP_MEDIA_HEADER (1 << 0)
+
+/**
+ * Maximum number of codec frames which can be packed into a single RTP
+ * packet when the media payload header is used (4-bit frame counter). */
+#define BLUEALSA_CODEC_RTP_FRAMES_MAX 15
+
+/**
+ * Codec parameters passed to the module initialization function. */
+struct bluealsa_codec_params {
+
+	/* extended (32-bit) A2DP codec ID */
+	uint32_t codec_id;
+	/* selected A2DP codec configuration blob */
+	const void *configuration;
+	size_t configuration_size;
+
+	/* number of PCM channels */
+	unsigned int channels;
+	/* PCM sample rate */
+	unsigned int rate;
+	/* Size of a single PCM sample in bytes. PCM samples are always signed
+	 * little-endian integers, e.g. 2 for S16LE and 4 for S24LE or S32LE. */
+	unsigned int sample_size;
+	/* significant bits in a single PCM sample */
+	unsigned int sample_bits;
+
+	/* maximum size of the RTP payload (excluding all headers) */
+	size_t payload_size;
+
+};
+
+/**
+ * Codec information filled by the module initialization function. */
+struct bluealsa_codec_info {
+
+	/* number of PCM samples (not frames) in a single codec frame */
+	size_t block_samples;
+	/* maximum size of a single encoded codec frame or 0 if not known */
+	size_t frame_size;
+
+};
+
+/**
+ * BlueALSA codec module definition. */
+struct bluealsa_codec_module {
+
+	/* shall be set to BLUEALSA_CODEC_ABI_VERSION */
+	uint32_t abi_version;
+	/* shall be set to sizeof(struct bluealsa_codec_module) */
+	size_t size;
+
+	/* human readable module name */
+	const char *name;
+	/* extended (32-bit) A2DP codec ID */
+	uint32_t codec_id;
+	/* bitmask of supported directions */
+	unsigned int directions;
+	/* bitmask of BLUEALSA_CODEC_FLAG_* flags */
+	unsigned int flags;
+	/* RTP clock frequency or 0 if equal to PCM sample rate */
+	unsigned int rtp_clock_rate;
+
+	/**
+	 * Create new codec instance.
+	 *
+	 * @param params Codec parameters.
+	 * @param direction Either encoder or decoder.
+	 * @param info Address where codec information shall be stored.
+	 * @return On success, this function returns codec context which will be
+	 *   passed to all other callbacks. On failure, NULL is returned and the
+	 *   errno is set to indicate the error. */
+	void *(*init)(
+			const struct bluealsa_codec_params *params,
+			enum bluealsa_codec_direction direction,
+			struct bluealsa_codec_info *info);
+
+	/**
+	 * Free codec instance. */
+	void (*free)(
+			void *codec);
+
+	/**
+	 * Encode PCM samples into codec frames.
+	 *
+	 * This function shall encode as many codec frames as possible, but not
+	 * more than the number given in the frames argument and not more than
+	 * fits in the payload buffer. If there are at least as many samples as
+	 * the number of PCM samples in a single codec frame, some samples shall
+	 * be consumed, otherwise the daemon will discard the PCM data.
+	 *
+	 * @param codec Codec context.
+	 * @param pcm PCM samples to encode.
+	 * @param samples Number of available PCM samples.
+	 * @param consumed Address where the number of consumed PCM samples shall
+	 *   be stored. Samples which were not consumed will be passed again.
+	 * @param payload Buffer for encoded data.
+	 * @param size Size of the payload buffer.
+	 * @param frames On input the maximum number of codec frames. On output
+	 *   the number of codec frames stored in the payload buffer.
+	 * @return On success, this function returns the number of bytes stored
+	 *   in the payload buffer, which might be 0 if there was not enough PCM
+	 *   samples. On failure, negative error code is returned. */
+	ssize_t (*encode_batch)(
+			void *codec,
+			const void *pcm,
+			size_t samples,
+			size_t *consumed,
+			void *payload,
+			size_t size,
+			unsigned int *frames);
+
+	/**
+	 * Decode codec frames from a single RTP payload.
+	 *
+	 * @param codec Codec context.
+	 * @param payload RTP payload without the media payload header.
+	 * @param size Size of the RTP payload.
+	 * @param frames Number of codec frames in the payload as given in the
+	 *   media payload header or 1 if header is not used.
+	 * @param pcm Buffer for decoded PCM samples.
+	 * @param samples Size of the PCM buffer in samples.
+	 * @return On success, this function returns the number of decoded PCM
+	 *   samples. On failure, negative error code is returned. */
+	ssize_t (*decode_batch)(
+			void *codec,
+			const void *payload,
+			size_t size,
+			unsigned int frames,
+			void *pcm,
+			size_t samples);
+
+	/**
+	 * Get the codec delay in PCM frames. This callback is optional. */
+	unsigned int (*get_delay)(
+			void *codec);
+
+	/**
+	 * Set the encoder target bit rate in bits per second. This callback is
+	 * optional. It shall return 0 on success or negative error code. */
+	int (*set_bitrate)(
+			void *codec,
+			unsigned int bitrate);
+
+	/**
+	 * Generate PCM samples in place of lost codec frames.
+	 *
+	 * This callback is optional and it is available since the ABI version
+	 * 1.1. It is called by the decoder when RTP packets are missing.
+	 *
+	 * @param codec Codec context.
+	 * @param pcm Buffer for generated PCM samples.
+	 * @param samples Number of missing PCM samples. This value is never
+	 *   greater than the size of the PCM buffer passed to the decode_batch()
+	 *   callback.
+	 * @return On success, this function returns the number of generated PCM
+	 *   samples. On failure, negative error code is returned. */
+	ssize_t (*conceal)(
+			void *codec,
+			void *pcm,
+			size_t samples);
+
+};
+
+#endif
@@ -17,6 +17,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -33,15 +34,21 @@
 #include <glib.h>
 
 #include "a2dp.h"
+#include "audio-resampler.h"
 #include "ba-adapter.h"
+#include "ba-broadcast.h"
 #include "ba-config.h"
 #include "ba-device.h"
+#include "ba-mix.h"
 #include "ba-transport.h"
 #include "ba-transport-pcm.h"
 #include "bluealsa-iface.h"
 #include "bluez.h"
 #include "dbus.h"
 #include "hfp.h"
+#include "rwlock.h"
+#include "sco.h"
+#include "trace.h"
 #include "utils.h"
 #include "shared/a2dp-codecs.h"
 #include "shared/defs.h"
@@ -60,7 +67,7 @@ static GVariant *ba_variant_new_bluealsa_adapters(void) {
 	GVariant *variant;
 	size_t n = 0;
 
-	pthread_mutex_lock(&config.adapters_mutex);
+	rwlock_rdlock(&config.adapters_lock);
 
 	for (size_t i = 0; i < ARRAYSIZE(config.adapters); i++)
 		if (config.adapters[i] != NULL)
@@ -68,7 +75,7 @@ static GVariant *ba_variant_new_bluealsa_adapters(void) {
 
 	variant = g_variant_new_strv(strv, n);
 
-	pthread_mutex_unlock(&config.adapters_mutex);
+	rwlock_rdunlock(&config.adapters_lock);
 
 	return variant;
 }
@@ -284,6 +291,44 @@ static GVariant *ba_variant_new_pcm_delay(const struct ba_transport_pcm *pcm) {
 	return g_variant_new_uint16(ba_transport_pcm_delay_get(pcm));
 }
 
+static GVariant *ba_variant_new_pcm_deadline_misses(const struct ba_transport_pcm *pcm) {
+	return g_variant_new_uint32(atomic_load_explicit(&pcm->deadline_misses,
+				memory_order_relaxed));
+}
+
+static GVariant *ba_variant_new_pcm_broadcast_members(const struct ba_transport_pcm *pcm) {
+
+	const char *paths[BA_BROADCAST_MEMBERS_MAX];
+	size_t n = 0;
+
+	pthread_mutex_lock(MUTABLE(&pcm->mutex));
+	struct ba_broadcast *bc = pcm->broadcast;
+	if (bc != NULL)
+		ba_broadcast_ref(bc);
+	pthread_mutex_unlock(MUTABLE(&pcm->mutex));
+
+	if (bc == NULL)
+		return g_variant_new_objv(paths, 0);
+
+	pthread_mutex_lock(&bc->mutex);
+	if (bc->pcm == pcm)
+		for (size_t i = 0; i < bc->members_len; i++)
+			paths[n++] = bc->members[i]->ba_dbus_path;
+	GVariant *variant = g_variant_new_objv(paths, n);
+	pthread_mutex_unlock(&bc->mutex);
+
+	ba_broadcast_unref(bc);
+	return variant;
+}
+
+static GVariant *ba_variant_new_pcm_mix_gain(const struct ba_transport_pcm *pcm) {
+	return g_variant_new_int16(pcm->mix_gain);
+}
+
+static GVariant *ba_variant_new_pcm_bitrate(const struct ba_transport_pcm *pcm) {
+	return g_variant_new_uint32(pcm->bitrate);
+}
+
 static GVariant *ba_variant_new_pcm_client_delay(const struct ba_transport_pcm *pcm) {
 	return g_variant_new_int16(pcm->client_delay_dms);
 }
@@ -378,6 +423,45 @@ static void ba_variant_populate_remote_sep(GVariantBuilder *props,
 
 }
 
+static GVariant *ba_variant_new_sco_setup_latency(void) {
+	uint32_t histogram[SCO_SETUP_LATENCY_BUCKETS];
+	sco_setup_get_latency(histogram);
+	return g_variant_new_fixed_array(G_VARIANT_TYPE_UINT32,
+			histogram, ARRAYSIZE(histogram), sizeof(*histogram));
+}
+
+static void ba_variant_builder_add_trace(pid_t tid, const char *name,
+		const struct ba_trace_event *events, size_t len, void *userdata) {
+
+	GVariantBuilder *builder = userdata;
+	GVariantBuilder builder_events;
+
+	g_variant_builder_init(&builder_events, G_VARIANT_TYPE("a(tuuu)"));
+	for (size_t i = 0; i < len; i++)
+		g_variant_builder_add(&builder_events, "(tuuu)", (guint64)events[i].timestamp,
+				events[i].type, events[i].arg0, events[i].arg1);
+
+	g_variant_builder_add(builder, "(usa(tuuu))", tid, name, &builder_events);
+
+}
+
+static void bluealsa_manager_get_trace(GDBusMethodInvocation *inv, void *userdata) {
+	(void)userdata;
+
+	GVariantBuilder threads;
+	g_variant_builder_init(&threads, G_VARIANT_TYPE("a(usa(tuuu))"));
+
+	if (trace_dump(ba_variant_builder_add_trace, &threads) == -1) {
+		g_variant_builder_clear(&threads);
+		g_dbus_method_invocation_return_error(inv, G_DBUS_ERROR,
+				G_DBUS_ERROR_NO_MEMORY, "Couldn't dump trace: %s", strerror(errno));
+		return;
+	}
+
+	g_dbus_method_invocation_return_value(inv, g_variant_new("(a(usa(tuuu)))", &threads));
+
+}
+
 static GVariant *bluealsa_manager_get_property(const char *property,
 		GError **error, void *userdata) {
 	(void)error;
@@ -391,17 +475,45 @@ static GVariant *bluealsa_manager_get_property(const char *property,
 		return ba_variant_new_bluealsa_profiles();
 	if (strcmp(property, "Codecs") == 0)
 		return ba_variant_new_bluealsa_codecs();
+	if (strcmp(property, "SCOSetupBacklog") == 0)
+		return g_variant_new_uint32(sco_setup_get_backlog());
+	if (strcmp(property, "SCOSetupLatencyHistogram") == 0)
+		return ba_variant_new_sco_setup_latency();
+	if (strcmp(property, "Tracing") == 0)
+		return g_variant_new_boolean(atomic_load(&trace_enabled));
 
 	g_assert_not_reached();
 	return NULL;
 }
 
+static bool bluealsa_manager_set_property(const char *property, GVariant *value,
+		GError **error, void *userdata) {
+	(void)userdata;
+
+	if (strcmp(property, "Tracing") == 0) {
+		trace_set_enabled(g_variant_get_boolean(value));
+		return true;
+	}
+
+	*error = g_error_new(G_DBUS_ERROR, G_DBUS_ERROR_PROPERTY_READ_ONLY,
+			"Property not writable: %s", property);
+	return false;
+}
+
 /**
  * Register BlueALSA D-Bus manager interfaces. */
 void bluealsa_dbus_register(void) {
 
+	static const GDBusMethodCallDispatcher dispatchers[] = {
+		{ .method = "GetTrace",
+			.handler = bluealsa_manager_get_trace },
+		{ 0 },
+	};
+
 	static const GDBusInterfaceSkeletonVTable vtable = {
+		.dispatchers = dispatchers,
 		.get_property = bluealsa_manager_get_property,
+		.set_property = bluealsa_manager_set_property,
 	};
 
 	debug("Registering BlueALSA D-Bus manager: %s", bluealsa_dbus_manager_path);
@@ -416,6 +528,58 @@ void bluealsa_dbus_register(void) {
 
 }
 
+/**
+ * Lookup A2DP source PCM exported on the given D-Bus path.
+ *
+ * @return On success, the referenced PCM is returned. Otherwise, NULL. */
+static struct ba_transport_pcm *bluealsa_dbus_pcm_lookup_a2dp_source(
+		const char *path) {
+
+	struct ba_transport_pcm *pcm = NULL;
+
+	rwlock_rdlock(&config.adapters_lock);
+
+	for (size_t i = 0; pcm == NULL && i < ARRAYSIZE(config.adapters); i++) {
+
+		struct ba_adapter *a;
+		if ((a = config.adapters[i]) == NULL ||
+				!g_str_has_prefix(path, a->ba_dbus_path))
+			continue;
+
+		GHashTableIter iter_d;
+		struct ba_device *d;
+
+		rwlock_rdlock(&a->devices_lock);
+		g_hash_table_iter_init(&iter_d, a->devices);
+		while (pcm == NULL && g_hash_table_iter_next(&iter_d, NULL, (gpointer)&d)) {
+
+			if (!g_str_has_prefix(path, d->ba_dbus_path))
+				continue;
+
+			GHashTableIter iter_t;
+			struct ba_transport *t;
+
+			rwlock_rdlock(&d->transports_lock);
+			g_hash_table_iter_init(&iter_t, d->transports);
+			while (g_hash_table_iter_next(&iter_t, NULL, (gpointer)&t))
+				if (t->profile == BA_TRANSPORT_PROFILE_A2DP_SOURCE &&
+						strcmp(t->media.pcm.ba_dbus_path, path) == 0) {
+					pcm = &t->media.pcm;
+					atomic_fetch_add_explicit(&t->ref_count, 1, memory_order_relaxed);
+					break;
+				}
+			rwlock_rdunlock(&d->transports_lock);
+
+		}
+		rwlock_rdunlock(&a->devices_lock);
+
+	}
+
+	rwlock_rdunlock(&config.adapters_lock);
+
+	return pcm;
+}
+
 static gboolean bluealsa_pcm_controller(GIOChannel *ch, GIOCondition condition,
 		void *userdata) {
 	(void)condition;
@@ -472,9 +636,15 @@ static gboolean bluealsa_pcm_controller(GIOChannel *ch, GIOCondition condition,
 	return TRUE;
 }
 
-static void bluealsa_pcm_open(GDBusMethodInvocation *inv, void *userdata) {
+/**
+ * Open PCM with the given client stream format and sample rate.
+ *
+ * If the client format or rate differs from the transport PCM format or
+ * rate, the audio is converted by the transport IO thread. If the rate is
+ * 0, the client stream follows the transport PCM rate. */
+static void bluealsa_pcm_open_format(GDBusMethodInvocation *inv,
+		struct ba_transport_pcm *pcm, uint16_t format, unsigned int rate) {
 
-	struct ba_transport_pcm *pcm = userdata;
 	const bool is_sink = pcm->mode == BA_TRANSPORT_PCM_MODE_SINK;
 	const enum ba_transport_profile t_profile = pcm->t->profile;
 	struct ba_transport *t = pcm->t;
@@ -538,12 +708,38 @@ static void bluealsa_pcm_open(GDBusMethodInvocation *inv, void *userdata) {
 			goto fail;
 		}
 
+		pthread_mutex_lock(&pcm->mutex);
+		struct ba_broadcast *bc = pcm->broadcast;
+		if (bc != NULL)
+			ba_broadcast_ref(bc);
+		pthread_mutex_unlock(&pcm->mutex);
+
+		/* Start all other members of the broadcast group which
+		 * will be fed with the audio from this PCM. */
+		if (bc != NULL && bc->pcm == pcm) {
+			const int rv = ba_broadcast_open(bc);
+			ba_broadcast_unref(bc);
+			if (rv == -1) {
+				g_dbus_method_invocation_return_error(inv, G_DBUS_ERROR,
+						G_DBUS_ERROR_IO_ERROR, "Open broadcast: %s", strerror(errno));
+				goto fail;
+			}
+		}
+		else if (bc != NULL)
+			ba_broadcast_unref(bc);
+
 	}
 
 	pthread_mutex_lock(&pcm->mutex);
 
 	/* get correct PIPE endpoint - PIPE is unidirectional */
 	pcm->fd = pcm_fds[is_sink ? 0 : 1];
+	/* format used on the client side of the PIPE */
+	pcm->client_format = format != pcm->format ? format : 0;
+	/* Sample rate used on the client side of the PIPE. Explicitly requested
+	 * rate is stored even if it equals the current transport rate, so the
+	 * client rate stays the same when the transport rate changes. */
+	pcm->client_rate = rate;
 	/* set newly opened PCM as active */
 	pcm->paused = false;
 
@@ -579,6 +775,85 @@ fail:
 			close(pcm_fds[i]);
 }
 
+static void bluealsa_pcm_open(GDBusMethodInvocation *inv, void *userdata) {
+	struct ba_transport_pcm *pcm = userdata;
+	bluealsa_pcm_open_format(inv, pcm, pcm->format, 0);
+}
+
+/**
+ * Check whether the PCM IO can convert from/to the given format. */
+static bool bluealsa_pcm_format_is_convertible(uint16_t format) {
+	switch (format) {
+	case BA_TRANSPORT_PCM_FORMAT_S16_2LE:
+	case BA_TRANSPORT_PCM_FORMAT_S24_4LE:
+	case BA_TRANSPORT_PCM_FORMAT_S32_4LE:
+	case BA_TRANSPORT_PCM_FORMAT_F32_4LE:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static void bluealsa_pcm_open_with_props(GDBusMethodInvocation *inv, void *userdata) {
+
+	GVariant *params = g_dbus_method_invocation_get_parameters(inv);
+	struct ba_transport_pcm *pcm = userdata;
+	uint16_t format = pcm->format;
+	unsigned int rate = 0;
+	GVariantIter *properties;
+	GVariant *value;
+	const char *property;
+
+	g_variant_get(params, "(a{sv})", &properties);
+	while (g_variant_iter_next(properties, "{&sv}", &property, &value)) {
+
+		if (strcmp(property, "Format") == 0 &&
+				g_variant_validate_value(value, G_VARIANT_TYPE_UINT16, property))
+			format = g_variant_get_uint16(value);
+		else if (strcmp(property, "Rate") == 0 &&
+				g_variant_validate_value(value, G_VARIANT_TYPE_UINT32, property))
+			rate = g_variant_get_uint32(value);
+
+		g_variant_unref(value);
+	}
+
+	g_variant_iter_free(properties);
+
+	/* Conversion from/to packed 24-bit and unsigned
+	 * formats is not supported by the PCM IO. */
+	if (format != pcm->format &&
+			!bluealsa_pcm_format_is_convertible(format)) {
+		g_dbus_method_invocation_return_error(inv, G_DBUS_ERROR,
+				G_DBUS_ERROR_INVALID_ARGS, "Unsupported format: %#x", format);
+		return;
+	}
+
+	if (rate != 0 && rate != pcm->rate) {
+		/* Resampling is done only for the decoded audio, i.e. on the
+		 * output of the IO thread which writes to the PCM FIFO. */
+		if (pcm->mode != BA_TRANSPORT_PCM_MODE_SOURCE ||
+				!bluealsa_pcm_format_is_convertible(pcm->format)) {
+			g_dbus_method_invocation_return_error(inv, G_DBUS_ERROR,
+					G_DBUS_ERROR_NOT_SUPPORTED, "Resampling not supported");
+			return;
+		}
+		if (!audio_resampler_is_supported(pcm->rate, rate)) {
+			g_dbus_method_invocation_return_error(inv, G_DBUS_ERROR,
+					G_DBUS_ERROR_INVALID_ARGS, "Unsupported rate: %u", rate);
+			return;
+		}
+	}
+
+	/* Rate can be kept across transport rate changes only
+	 * if the IO thread is able to resample the audio. */
+	if (pcm->mode != BA_TRANSPORT_PCM_MODE_SOURCE ||
+			!bluealsa_pcm_format_is_convertible(pcm->format))
+		rate = 0;
+
+	bluealsa_pcm_open_format(inv, pcm, format, rate);
+
+}
+
 static void bluealsa_pcm_get_codecs(GDBusMethodInvocation *inv, void *userdata) {
 
 	struct ba_transport_pcm *pcm = userdata;
@@ -931,6 +1206,30 @@ static GVariant *bluealsa_pcm_get_property(const char *property,
 	}
 	if (strcmp(property, "Delay") == 0)
 		return ba_variant_new_pcm_delay(pcm);
+	if (strcmp(property, "DeadlineMisses") == 0) {
+		/* Only encoder IO threads are paced by the local clock. Decoders
+		 * are driven by the incoming BT data, so they have no deadlines. */
+		if (pcm->mode != BA_TRANSPORT_PCM_MODE_SINK)
+			goto unavailable;
+		return ba_variant_new_pcm_deadline_misses(pcm);
+	}
+	if (strcmp(property, "BroadcastMembers") == 0) {
+		if (pcm->t->profile != BA_TRANSPORT_PROFILE_A2DP_SOURCE ||
+				pcm->mode != BA_TRANSPORT_PCM_MODE_SINK)
+			goto unavailable;
+		return ba_variant_new_pcm_broadcast_members(pcm);
+	}
+	if (strcmp(property, "MixGain") == 0) {
+		if (config.a2dp.mix == NULL ||
+				pcm->t->profile != BA_TRANSPORT_PROFILE_A2DP_SINK)
+			goto unavailable;
+		return ba_variant_new_pcm_mix_gain(pcm);
+	}
+	if (strcmp(property, "Bitrate") == 0) {
+		if (pcm->bitrate == 0)
+			goto unavailable;
+		return ba_variant_new_pcm_bitrate(pcm);
+	}
 	if (strcmp(property, "ClientDelay") == 0)
 		return ba_variant_new_pcm_client_delay(pcm);
 	if (strcmp(property, "SoftVolume") == 0)
@@ -963,6 +1262,129 @@ static bool bluealsa_pcm_set_property(const char *property, GVariant *value,
 		return TRUE;
 	}
 
+	if (strcmp(property, "BroadcastMembers") == 0) {
+
+		if (t->profile != BA_TRANSPORT_PROFILE_A2DP_SOURCE ||
+				pcm->mode != BA_TRANSPORT_PCM_MODE_SINK) {
+			*error = g_error_new(G_DBUS_ERROR, G_DBUS_ERROR_NOT_SUPPORTED,
+					"Broadcast not supported for this PCM");
+			return false;
+		}
+
+		struct ba_transport_pcm *members[BA_BROADCAST_MEMBERS_MAX];
+		size_t members_len = 0;
+		bool rv = false;
+
+		GVariantIter *paths;
+		const char *path;
+		g_variant_get(value, "ao", &paths);
+		while (g_variant_iter_next(paths, "&o", &path)) {
+			if (members_len == ARRAYSIZE(members)) {
+				*error = g_error_new(G_DBUS_ERROR, G_DBUS_ERROR_LIMITS_EXCEEDED,
+						"Too many broadcast members");
+				goto broadcast_final;
+			}
+			if ((members[members_len] = bluealsa_dbus_pcm_lookup_a2dp_source(path)) == NULL) {
+				*error = g_error_new(G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS,
+						"Invalid A2DP source PCM: %s", path);
+				goto broadcast_final;
+			}
+			members_len++;
+		}
+
+		pthread_mutex_lock(&pcm->mutex);
+		struct ba_broadcast *bc = pcm->broadcast;
+		if (bc == NULL && members_len > 0)
+			bc = pcm->broadcast = ba_broadcast_new(pcm);
+		pthread_mutex_unlock(&pcm->mutex);
+
+		if (bc == NULL && members_len > 0) {
+			*error = g_error_new(G_DBUS_ERROR, G_DBUS_ERROR_FAILED,
+					"Create broadcast group: %s", strerror(errno));
+			goto broadcast_final;
+		}
+
+		if (bc != NULL && bc->pcm != pcm) {
+			*error = g_error_new(G_DBUS_ERROR, G_DBUS_ERROR_FAILED,
+					"PCM is a member of other broadcast group");
+			goto broadcast_final;
+		}
+
+		if (bc != NULL && ba_broadcast_set_members(bc, members, members_len) == -1) {
+			*error = g_error_new(G_DBUS_ERROR, G_DBUS_ERROR_FAILED,
+					"Set broadcast members: %s", strerror(errno));
+			goto broadcast_final;
+		}
+
+		/* dissolve empty broadcast group */
+		if (bc != NULL && members_len == 0) {
+			pthread_mutex_lock(&pcm->mutex);
+			pcm->broadcast = NULL;
+			pthread_mutex_unlock(&pcm->mutex);
+			ba_broadcast_unref(bc);
+		}
+
+		bluealsa_dbus_pcm_update(pcm, BA_DBUS_PCM_UPDATE_BROADCAST);
+		rv = true;
+
+broadcast_final:
+		for (size_t i = 0; i < members_len; i++)
+			ba_transport_pcm_unref(members[i]);
+		g_variant_iter_free(paths);
+		return rv;
+	}
+
+	if (strcmp(property, "MixGain") == 0) {
+
+		if (config.a2dp.mix == NULL ||
+				t->profile != BA_TRANSPORT_PROFILE_A2DP_SINK) {
+			*error = g_error_new(G_DBUS_ERROR, G_DBUS_ERROR_NOT_SUPPORTED,
+					"Mix not supported for this PCM");
+			return false;
+		}
+
+		const int gain = g_variant_get_int16(value);
+		if (gain > 2000) {
+			*error = g_error_new(G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS,
+					"Invalid mix gain: %d > 2000", gain);
+			return false;
+		}
+
+		debug("Setting mix gain: %.2f dB", 0.01 * gain);
+		pcm->mix_gain = gain;
+
+		bluealsa_dbus_pcm_update(pcm, BA_DBUS_PCM_UPDATE_MIX_GAIN);
+		return true;
+	}
+
+	if (strcmp(property, "Bitrate") == 0) {
+
+		/* SBC encoder reports its effective bit rate, which is controlled
+		 * by the dynamic bit-pool algorithm, so it is read-only. */
+		if (pcm->bitrate == 0 ||
+				(t->profile & BA_TRANSPORT_PROFILE_MASK_A2DP &&
+				 ba_transport_get_codec(t) == A2DP_CODEC_SBC)) {
+			*error = g_error_new(G_DBUS_ERROR, G_DBUS_ERROR_NOT_SUPPORTED,
+					"Bitrate change not supported for this PCM");
+			return false;
+		}
+
+		const unsigned int bitrate = g_variant_get_uint32(value);
+		if (bitrate == 0) {
+			*error = g_error_new(G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS,
+					"Invalid bitrate: %u", bitrate);
+			return false;
+		}
+
+		/* The new bit rate will be validated and applied by the encoder
+		 * thread before encoding the next RTP packet. The property change
+		 * is emitted by the encoder only if the bit rate is accepted. */
+		debug("Requesting encoder bitrate: %u", bitrate);
+		atomic_store_explicit(&pcm->bitrate_request, bitrate, memory_order_relaxed);
+
+		return true;
+	}
+
 	if (strcmp(property, "SoftVolume") == 0) {
 
 		const bool soft_volume = g_variant_get_boolean(value);
@@ -1029,6 +1451,8 @@ int bluealsa_dbus_pcm_register(struct ba_transport_pcm *pcm) {
 	static const GDBusMethodCallDispatcher dispatchers[] = {
 		{ .method = "Open",
 			.handler = bluealsa_pcm_open },
+		{ .method = "OpenWithProps",
+			.handler = bluealsa_pcm_open_with_props },
 		{ .method = "GetCodecs",
 			.handler = bluealsa_pcm_get_codecs },
 		{ .method = "SelectCodec",
@@ -1092,6 +1516,12 @@ void bluealsa_dbus_pcm_update(struct ba_transport_pcm *pcm, unsigned int mask) {
 		g_variant_builder_add(&props, "{sv}", "CodecConfiguration", ba_variant_new_pcm_codec_config(pcm));
 	if (mask & BA_DBUS_PCM_UPDATE_DELAY)
 		g_variant_builder_add(&props, "{sv}", "Delay", ba_variant_new_pcm_delay(pcm));
+	if (mask & BA_DBUS_PCM_UPDATE_BROADCAST)
+		g_variant_builder_add(&props, "{sv}", "BroadcastMembers", ba_variant_new_pcm_broadcast_members(pcm));
+	if (mask & BA_DBUS_PCM_UPDATE_MIX_GAIN)
+		g_variant_builder_add(&props, "{sv}", "MixGain", ba_variant_new_pcm_mix_gain(pcm));
+	if (mask & BA_DBUS_PCM_UPDATE_BITRATE)
+		g_variant_builder_add(&props, "{sv}", "Bitrate", ba_variant_new_pcm_bitrate(pcm));
 	if (mask & BA_DBUS_PCM_UPDATE_CLIENT_DELAY)
 		g_variant_builder_add(&props, "{sv}", "ClientDelay", ba_variant_new_pcm_client_delay(pcm));
 	if (mask & BA_DBUS_PCM_UPDATE_SOFT_VOLUME)
@@ -1114,6 +1544,258 @@ void bluealsa_dbus_pcm_unregister(struct ba_transport_pcm *pcm) {
 
 }
 
+static GVariant *ba_variant_new_mix_running(struct ba_mix *mix) {
+	return g_variant_new_boolean(ba_mix_is_open(mix));
+}
+
+static GVariant *ba_variant_new_mix_delay(struct ba_mix *mix) {
+	return g_variant_new_uint16(ba_mix_get_delay(mix));
+}
+
+static GVariant *ba_variant_new_mix_deadline_misses(struct ba_mix *mix) {
+	return g_variant_new_uint32(atomic_load_explicit(&mix->deadline_misses,
+				memory_order_relaxed));
+}
+
+static gboolean bluealsa_mix_controller(GIOChannel *ch, GIOCondition condition,
+		void *userdata) {
+	(void)condition;
+
+	struct ba_mix *mix = userdata;
+	GError *err = NULL;
+	char command[32];
+	size_t len;
+
+	switch (g_io_channel_read_chars(ch, command, sizeof(command), &len, &err)) {
+	case G_IO_STATUS_AGAIN:
+		return TRUE;
+	case G_IO_STATUS_ERROR:
+		error("PCM controller read error: %s", err->message);
+		g_error_free(err);
+		return TRUE;
+	case G_IO_STATUS_NORMAL:
+		if (strncmp(command, BLUEALSA_PCM_CTRL_DRAIN, len) == 0 ||
+				strncmp(command, BLUEALSA_PCM_CTRL_DROP, len) == 0) {
+			g_io_channel_write_chars(ch, "OK", -1, &len, NULL);
+		}
+		else if (strncmp(command, BLUEALSA_PCM_CTRL_PAUSE, len) == 0 ||
+				strncmp(command, BLUEALSA_PCM_CTRL_RESUME, len) == 0) {
+			pthread_mutex_lock(&mix->mutex);
+			mix->paused = strncmp(command, BLUEALSA_PCM_CTRL_PAUSE, len) == 0;
+			pthread_mutex_unlock(&mix->mutex);
+			g_io_channel_write_chars(ch, "OK", -1, &len, NULL);
+		}
+		else {
+			warn("Invalid PCM control command: %*s", (int)len, command);
+			g_io_channel_write_chars(ch, "Invalid", -1, &len, NULL);
+		}
+		g_io_channel_flush(ch, NULL);
+		return TRUE;
+	case G_IO_STATUS_EOF:
+		ba_mix_close(mix);
+		/* remove channel from watch */
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void bluealsa_mix_open(GDBusMethodInvocation *inv, void *userdata) {
+
+	struct ba_mix *mix = userdata;
+	int pcm_fds[4] = { -1, -1, -1, -1 };
+
+	/* Prevent two (or more) clients trying to
+	 * open the mix PCM at the same time. */
+	pthread_mutex_lock(&mix->client_mtx);
+
+	if (ba_mix_is_open(mix)) {
+		g_dbus_method_invocation_return_error(inv, G_DBUS_ERROR,
+				G_DBUS_ERROR_LIMITS_EXCEEDED, "%s", strerror(EBUSY));
+		goto fail;
+	}
+
+	/* create PCM stream PIPE and PCM control socket */
+	if (pipe2(&pcm_fds[0], O_CLOEXEC) == -1 ||
+			socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0, &pcm_fds[2]) == -1) {
+		g_dbus_method_invocation_return_error(inv, G_DBUS_ERROR,
+				G_DBUS_ERROR_FAILED, "Create PIPE: %s", strerror(errno));
+		goto fail;
+	}
+
+	/* set our internal endpoint as non-blocking. */
+	if (fcntl(pcm_fds[1], F_SETFL, O_NONBLOCK) == -1) {
+		g_dbus_method_invocation_return_error(inv, G_DBUS_ERROR,
+				G_DBUS_ERROR_FAILED, "Setup PIPE: %s", strerror(errno));
+		goto fail;
+	}
+
+	if (ba_mix_open(mix, pcm_fds[1]) == -1) {
+		g_dbus_method_invocation_return_error(inv, G_DBUS_ERROR,
+				G_DBUS_ERROR_IO_ERROR, "Open mix: %s", strerror(errno));
+		goto fail;
+	}
+
+	/* the write end is owned by the mix now */
+	pcm_fds[1] = -1;
+
+	GIOChannel *ch = g_io_channel_unix_new(pcm_fds[2]);
+	g_io_channel_set_close_on_unref(ch, TRUE);
+	g_io_channel_set_encoding(ch, NULL, NULL);
+	g_io_channel_set_buffered(ch, FALSE);
+
+	pthread_mutex_lock(&mix->mutex);
+	mix->controller = g_io_create_watch_full(ch, G_PRIORITY_DEFAULT,
+			G_IO_IN, bluealsa_mix_controller, mix, NULL);
+	pthread_mutex_unlock(&mix->mutex);
+	g_io_channel_unref(ch);
+
+	int fds[2] = { pcm_fds[0], pcm_fds[3] };
+	GUnixFDList *fd_list = g_unix_fd_list_new_from_array(fds, 2);
+	g_dbus_method_invocation_return_value_with_unix_fd_list(inv,
+			g_variant_new("(hh)", 0, 1), fd_list);
+	g_object_unref(fd_list);
+
+	pthread_mutex_unlock(&mix->client_mtx);
+	return;
+
+fail:
+	pthread_mutex_unlock(&mix->client_mtx);
+	/* clean up created file descriptors */
+	for (size_t i = 0; i < ARRAYSIZE(pcm_fds); i++)
+		if (pcm_fds[i] != -1)
+			close(pcm_fds[i]);
+}
+
+static void bluealsa_mix_not_supported(GDBusMethodInvocation *inv, void *userdata) {
+	(void)userdata;
+	g_dbus_method_invocation_return_error(inv, G_DBUS_ERROR,
+			G_DBUS_ERROR_NOT_SUPPORTED, "Not supported for mix PCM");
+}
+
+static GVariant *bluealsa_mix_get_property(const char *property,
+		GError **error, void *userdata) {
+
+	struct ba_mix *mix = userdata;
+	static const char *channel_map[] = { "FL", "FR" };
+
+	if (strcmp(property, "Device") == 0)
+		return g_variant_new_object_path("/");
+	if (strcmp(property, "Sequence") == 0)
+		return g_variant_new_uint32(0);
+	if (strcmp(property, "Transport") == 0)
+		return g_variant_new_string(BLUEALSA_TRANSPORT_TYPE_A2DP_SINK);
+	if (strcmp(property, "Mode") == 0)
+		return g_variant_new_string(BLUEALSA_PCM_MODE_SOURCE);
+	if (strcmp(property, "Running") == 0)
+		return ba_variant_new_mix_running(mix);
+	if (strcmp(property, "Format") == 0)
+		return g_variant_new_uint16(BA_TRANSPORT_PCM_FORMAT_S16_2LE);
+	if (strcmp(property, "Channels") == 0)
+		return g_variant_new_byte(BA_MIX_CHANNELS);
+	if (strcmp(property, "ChannelMap") == 0)
+		return g_variant_new_strv(channel_map, ARRAYSIZE(channel_map));
+	if (strcmp(property, "Rate") == 0)
+		return g_variant_new_uint32(mix->rate);
+	if (strcmp(property, "Delay") == 0)
+		return ba_variant_new_mix_delay(mix);
+	if (strcmp(property, "DeadlineMisses") == 0)
+		return ba_variant_new_mix_deadline_misses(mix);
+
+	if (error != NULL)
+		*error = g_error_new(G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS,
+				"No such property '%s'", property);
+	return NULL;
+}
+
+static bool bluealsa_mix_set_property(const char *property, GVariant *value,
+		GError **error, void *userdata) {
+	(void)value;
+	(void)userdata;
+	*error = g_error_new(G_DBUS_ERROR, G_DBUS_ERROR_PROPERTY_READ_ONLY,
+			"Property not supported for mix PCM: %s", property);
+	return false;
+}
+
+/**
+ * Register A2DP sink mix PCM D-Bus interface.
+ *
+ * The mix PCM implements the PCM interface, however, it is not bound to
+ * any particular Bluetooth device. */
+int bluealsa_dbus_mix_register(struct ba_mix *mix) {
+
+	static const GDBusMethodCallDispatcher dispatchers[] = {
+		{ .method = "Open",
+			.handler = bluealsa_mix_open },
+		{ .method = "OpenWithProps",
+			.handler = bluealsa_mix_not_supported },
+		{ .method = "GetCodecs",
+			.handler = bluealsa_mix_not_supported },
+		{ .method = "SelectCodec",
+			.handler = bluealsa_mix_not_supported },
+		{ 0 },
+	};
+
+	static const GDBusInterfaceSkeletonVTable vtable = {
+		.dispatchers = dispatchers,
+		.get_property = bluealsa_mix_get_property,
+		.set_property = bluealsa_mix_set_property,
+	};
+
+	GDBusObjectSkeleton *skeleton = NULL;
+	OrgBluealsaPcm1Skeleton *ifs_pcm = NULL;
+
+	if ((skeleton = g_dbus_object_skeleton_new(mix->ba_dbus_path)) == NULL)
+		goto fail;
+
+	if ((ifs_pcm = org_bluealsa_pcm1_skeleton_new(&vtable, mix, NULL)) == NULL)
+		goto fail;
+
+	g_dbus_interface_skeleton_set_flags(G_DBUS_INTERFACE_SKELETON(ifs_pcm),
+			G_DBUS_INTERFACE_SKELETON_FLAGS_HANDLE_METHOD_INVOCATIONS_IN_THREAD);
+
+	g_dbus_object_skeleton_add_interface(skeleton, G_DBUS_INTERFACE_SKELETON(ifs_pcm));
+	g_dbus_object_manager_server_export(bluealsa_dbus_manager, skeleton);
+	mix->ba_dbus_exported = true;
+
+fail:
+
+	if (skeleton != NULL)
+		g_object_unref(skeleton);
+	if (ifs_pcm != NULL)
+		g_object_unref(ifs_pcm);
+
+	return 0;
+}
+
+void bluealsa_dbus_mix_update(struct ba_mix *mix, unsigned int mask) {
+
+	if (!mix->ba_dbus_exported)
+		return;
+
+	GVariantBuilder props;
+	g_variant_builder_init(&props, G_VARIANT_TYPE("a{sv}"));
+
+	if (mask & BA_DBUS_PCM_UPDATE_RUNNING)
+		g_variant_builder_add(&props, "{sv}", "Running", ba_variant_new_mix_running(mix));
+	if (mask & BA_DBUS_PCM_UPDATE_DELAY)
+		g_variant_builder_add(&props, "{sv}", "Delay", ba_variant_new_mix_delay(mix));
+
+	g_dbus_connection_emit_properties_changed(config.dbus, mix->ba_dbus_path,
+			BLUEALSA_IFACE_PCM, g_variant_builder_end(&props), NULL, NULL);
+
+}
+
+void bluealsa_dbus_mix_unregister(struct ba_mix *mix) {
+
+	if (!mix->ba_dbus_exported)
+		return;
+
+	g_dbus_object_manager_server_unexport(bluealsa_dbus_manager, mix->ba_dbus_path);
+	mix->ba_dbus_exported = false;
+
+}
+
 static GVariant *bluealsa_rfcomm_get_property(const char *property,
 		GError **error, void *userdata) {
 	(void)error;
@@ -1193,3 +1875,70 @@ void bluealsa_dbus_rfcomm_unregister(struct ba_rfcomm *r) {
 	g_dbus_object_manager_server_unexport(bluealsa_dbus_manager, r->ba_dbus_path);
 	r->ba_dbus_exported = false;
 }
+
+#if ENABLE_MIDI
+
+static GVariant *ba_variant_new_midi_latency(const struct ba_transport *t) {
+	uint32_t histogram[BA_TRANSPORT_MIDI_LATENCY_BUCKETS];
+	for (size_t i = 0; i < ARRAYSIZE(histogram); i++)
+		histogram[i] = atomic_load_explicit(&t->midi.latency[i], memory_order_relaxed);
+	return g_variant_new_fixed_array(G_VARIANT_TYPE_UINT32,
+			histogram, ARRAYSIZE(histogram), sizeof(*histogram));
+}
+
+static GVariant *bluealsa_midi_get_property(const char *property,
+		GError **error, void *userdata) {
+	(void)error;
+
+	struct ba_transport *t = userdata;
+
+	if (strcmp(property, "Device") == 0)
+		return ba_variant_new_device_path(t->d);
+	if (strcmp(property, "Transport") == 0)
+		return ba_variant_new_transport_type(t);
+	if (strcmp(property, "LatencyHistogram") == 0)
+		return ba_variant_new_midi_latency(t);
+	if (strcmp(property, "Jitter") == 0)
+		return g_variant_new_uint32(atomic_load_explicit(&t->midi.jitter, memory_order_relaxed));
+
+	g_assert_not_reached();
+	return NULL;
+}
+
+int bluealsa_dbus_midi_register(struct ba_transport *t) {
+
+	static const GDBusInterfaceSkeletonVTable vtable = {
+		.get_property = bluealsa_midi_get_property,
+	};
+
+	GDBusObjectSkeleton *skeleton = NULL;
+	OrgBluealsaMidi1Skeleton *ifs_midi = NULL;
+
+	if ((skeleton = g_dbus_object_skeleton_new(t->midi.ba_dbus_path)) == NULL)
+		goto fail;
+
+	if ((ifs_midi = org_bluealsa_midi1_skeleton_new(&vtable, t, NULL)) == NULL)
+		goto fail;
+
+	g_dbus_object_skeleton_add_interface(skeleton, G_DBUS_INTERFACE_SKELETON(ifs_midi));
+	g_dbus_object_manager_server_export(bluealsa_dbus_manager, skeleton);
+	t->midi.ba_dbus_exported = true;
+
+fail:
+
+	if (skeleton != NULL)
+		g_object_unref(skeleton);
+	if (ifs_midi != NULL)
+		g_object_unref(ifs_midi);
+
+	return 0;
+}
+
+void bluealsa_dbus_midi_unregister(struct ba_transport *t) {
+	if (!t->midi.ba_dbus_exported)
+		return;
+	g_dbus_object_manager_server_unexport(bluealsa_dbus_manager, t->midi.ba_dbus_path);
+	t->midi.ba_dbus_exported = false;
+}
+
+#endif
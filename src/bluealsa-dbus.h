@@ -20,6 +20,8 @@
 
 #include "ba-rfcomm.h"
 #include "ba-device.h"
+#include "ba-mix.h"
+#include "ba-transport.h"
 #include "ba-transport-pcm.h"
 
 #define BA_DBUS_PCM_UPDATE_FORMAT           (1 << 0)
@@ -33,6 +35,9 @@
 #define BA_DBUS_PCM_UPDATE_SOFT_VOLUME      (1 << 8)
 #define BA_DBUS_PCM_UPDATE_VOLUME           (1 << 9)
 #define BA_DBUS_PCM_UPDATE_RUNNING          (1 << 10)
+#define BA_DBUS_PCM_UPDATE_BROADCAST        (1 << 11)
+#define BA_DBUS_PCM_UPDATE_MIX_GAIN         (1 << 12)
+#define BA_DBUS_PCM_UPDATE_BITRATE          (1 << 13)
 
 #define BA_DBUS_RFCOMM_UPDATE_FEATURES (1 << 0)
 #define BA_DBUS_RFCOMM_UPDATE_BATTERY  (1 << 1)
@@ -46,8 +51,17 @@ int bluealsa_dbus_pcm_register(struct ba_transport_pcm *pcm);
 void bluealsa_dbus_pcm_update(struct ba_transport_pcm *pcm, unsigned int mask);
 void bluealsa_dbus_pcm_unregister(struct ba_transport_pcm *pcm);
 
+int bluealsa_dbus_mix_register(struct ba_mix *mix);
+void bluealsa_dbus_mix_update(struct ba_mix *mix, unsigned int mask);
+void bluealsa_dbus_mix_unregister(struct ba_mix *mix);
+
 int bluealsa_dbus_rfcomm_register(struct ba_rfcomm *r);
 void bluealsa_dbus_rfcomm_update(struct ba_rfcomm *r, unsigned int mask);
 void bluealsa_dbus_rfcomm_unregister(struct ba_rfcomm *r);
 
+#if ENABLE_MIDI
+int bluealsa_dbus_midi_register(struct ba_transport *t);
+void bluealsa_dbus_midi_unregister(struct ba_transport *t);
+#endif
+
 #endif
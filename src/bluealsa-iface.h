@@ -22,6 +22,7 @@
 #define BLUEALSA_IFACE_MANAGER BLUEALSA_SERVICE ".Manager1"
 #define BLUEALSA_IFACE_PCM     BLUEALSA_SERVICE ".PCM1"
 #define BLUEALSA_IFACE_RFCOMM  BLUEALSA_SERVICE ".RFCOMM1"
+#define BLUEALSA_IFACE_MIDI    BLUEALSA_SERVICE ".MIDI1"
 
 #define BLUEALSA_TRANSPORT_TYPE_A2DP        "A2DP"
 #define BLUEALSA_TRANSPORT_TYPE_A2DP_SOURCE BLUEALSA_TRANSPORT_TYPE_A2DP "-source"
@@ -67,4 +68,12 @@ OrgBluealsaRfcomm1Skeleton *org_bluealsa_rfcomm1_skeleton_new(
 		const GDBusInterfaceSkeletonVTable *vtable, void *userdata,
 		GDestroyNotify userdata_free_func);
 
+typedef struct {
+	GDBusInterfaceSkeletonEx parent;
+} OrgBluealsaMidi1Skeleton;
+
+OrgBluealsaMidi1Skeleton *org_bluealsa_midi1_skeleton_new(
+		const GDBusInterfaceSkeletonVTable *vtable, void *userdata,
+		GDestroyNotify userdata_free_func);
+
 #endif
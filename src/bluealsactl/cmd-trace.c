@@ -0,0 +1,186 @@
+/*
+ * BlueALSA - bluealsactl/cmd-trace.c
+ * Copyright (c) 2016-2025 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <dbus/dbus.h>
+
+#include "bluealsactl.h"
+#include "shared/dbus-client.h"
+#include "shared/trace.h"
+
+static void usage(const char *command) {
+	printf("Control and dump BlueALSA service IO thread trace.\n\n");
+	bactl_print_usage("%s [OPTION]... [STATE]", command);
+	printf("\nOptions:\n"
+			"  -h, --help\t\tShow this message and exit\n"
+			"  -j, --json\t\tDump trace in the Chrome trace event format\n"
+			"\nPositional arguments:\n"
+			"  STATE\tEnable or disable IO thread tracing\n"
+	);
+}
+
+static void print_trace_text(const struct ba_trace_thread *threads, size_t len) {
+	for (size_t i = 0; i < len; i++) {
+		const struct ba_trace_thread *thread = &threads[i];
+		printf("Thread: %u %s\n", thread->tid, thread->name);
+		for (size_t j = 0; j < thread->events_len; j++) {
+			const struct ba_trace_event *event = &thread->events[j];
+			printf("  %" PRIu64 ".%09" PRIu64 " %-12s %u %u\n",
+					event->timestamp / 1000000000, event->timestamp % 1000000000,
+					ba_trace_event_type_to_string(event->type), event->arg0, event->arg1);
+		}
+	}
+}
+
+/**
+ * Print trace in the Chrome trace event JSON format.
+ *
+ * Encoding and decoding are reported as duration events, all other events
+ * are reported as thread-scoped instant events. Such output can be loaded
+ * into the chrome://tracing or https://ui.perfetto.dev viewers. */
+static void print_trace_json(const struct ba_trace_thread *threads, size_t len) {
+
+	const char *separator = "";
+
+	printf("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+	for (size_t i = 0; i < len; i++) {
+		const struct ba_trace_thread *thread = &threads[i];
+
+		printf("%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,"
+				"\"args\":{\"name\":\"%s\"}}", separator, thread->tid, thread->name);
+		separator = ",";
+
+		for (size_t j = 0; j < thread->events_len; j++) {
+			const struct ba_trace_event *event = &thread->events[j];
+
+			const char *name = ba_trace_event_type_to_string(event->type);
+			const char *phase = "i";
+
+			switch (event->type) {
+			case BA_TRACE_EVENT_ENCODE_BEGIN:
+				name = "encode";
+				phase = "B";
+				break;
+			case BA_TRACE_EVENT_ENCODE_END:
+				name = "encode";
+				phase = "E";
+				break;
+			case BA_TRACE_EVENT_DECODE_BEGIN:
+				name = "decode";
+				phase = "B";
+				break;
+			case BA_TRACE_EVENT_DECODE_END:
+				name = "decode";
+				phase = "E";
+				break;
+			default:
+				break;
+			}
+
+			printf(",\n{\"name\":\"%s\",\"ph\":\"%s\",%s\"pid\":0,\"tid\":%u,"
+					"\"ts\":%" PRIu64 ".%03" PRIu64 ",\"args\":{\"arg0\":%u,\"arg1\":%u}}",
+					name, phase, phase[0] == 'i' ? "\"s\":\"t\"," : "", thread->tid,
+					event->timestamp / 1000, event->timestamp % 1000,
+					event->arg0, event->arg1);
+
+		}
+
+	}
+
+	printf("\n]}\n");
+
+}
+
+static int cmd_trace_func(int argc, char *argv[]) {
+
+	bool json = false;
+
+	int opt;
+	const char *opts = "hqvj";
+	const struct option longopts[] = {
+		{ "help", no_argument, NULL, 'h' },
+		{ "quiet", no_argument, NULL, 'q' },
+		{ "verbose", no_argument, NULL, 'v' },
+		{ "json", no_argument, NULL, 'j' },
+		{ 0 },
+	};
+
+	opterr = 0;
+	while ((opt = getopt_long(argc, argv, opts, longopts, NULL)) != -1) {
+		if (bactl_parse_common_options(opt))
+			continue;
+		switch (opt) {
+		case 'h' /* --help */ :
+			usage(argv[0]);
+			return EXIT_SUCCESS;
+		case 'j' /* --json */ :
+			json = true;
+			break;
+		default:
+			cmd_print_error("Invalid argument '%s'", argv[optind - 1]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (argc - optind > 1) {
+		cmd_print_error("Invalid number of arguments");
+		return EXIT_FAILURE;
+	}
+
+	DBusError err = DBUS_ERROR_INIT;
+
+	if (argc - optind == 1) {
+
+		bool state;
+		const char *value = argv[optind];
+		if (!bactl_parse_value_on_off(value, &state)) {
+			cmd_print_error("Invalid argument: %s", value);
+			return EXIT_FAILURE;
+		}
+
+		if (!ba_dbus_service_trace_set(&config.dbus, state, &err)) {
+			cmd_print_error("Tracing update failed: %s", err.message);
+			dbus_error_free(&err);
+			return EXIT_FAILURE;
+		}
+
+		return EXIT_SUCCESS;
+	}
+
+	struct ba_trace_thread *threads = NULL;
+	size_t threads_len = 0;
+
+	if (!ba_dbus_service_trace_get(&config.dbus, &threads, &threads_len, &err)) {
+		cmd_print_error("Couldn't get trace: %s", err.message);
+		dbus_error_free(&err);
+		return EXIT_FAILURE;
+	}
+
+	if (json)
+		print_trace_json(threads, threads_len);
+	else
+		print_trace_text(threads, threads_len);
+
+	ba_dbus_service_trace_free(threads, threads_len);
+	return EXIT_SUCCESS;
+}
+
+const struct bactl_command cmd_trace = {
+	"trace",
+	"Control and dump IO thread trace",
+	cmd_trace_func,
+};
@@ -91,6 +91,8 @@ static const char *pcm_format_to_string(int pcm_format) {
 		return "S24_LE";
 	case 0x8420:
 		return "S32_LE";
+	case 0xA420:
+		return "FLOAT_LE";
 	default:
 		return "Invalid";
 	}
@@ -353,6 +355,7 @@ extern const struct bactl_command cmd_mute;
 extern const struct bactl_command cmd_open;
 extern const struct bactl_command cmd_softvol;
 extern const struct bactl_command cmd_volume;
+extern const struct bactl_command cmd_trace;
 
 static const struct bactl_command *commands[] = {
 	&cmd_list_services,
@@ -366,6 +369,7 @@ static const struct bactl_command *commands[] = {
 	&cmd_softvol,
 	&cmd_monitor,
 	&cmd_open,
+	&cmd_trace,
 };
 
 static void usage(const char *name) {
@@ -15,12 +15,14 @@
 #endif
 
 #include <errno.h>
+#include <pthread.h>
 #include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
@@ -255,6 +257,16 @@ static void bluez_midi_characteristic_acquire_write(
 
 	debug("New BLE-MIDI write link (MTU: %u): %d", mtu, fds[0]);
 	app->write_acquired = true;
+
+	pthread_mutex_lock(&t->midi.ble_write_mtx);
+
+	/* Release the previous link (if any), otherwise it would leak. */
+	if (t->midi.ble_fd_write != -1) {
+		debug("Releasing stale BLE-MIDI write link: %d", t->midi.ble_fd_write);
+		epoll_ctl(t->midi.epoll_fd, EPOLL_CTL_DEL, t->midi.ble_fd_write, NULL);
+		close(t->midi.ble_fd_write);
+	}
+
 	t->midi.ble_fd_write = fds[0];
 	t->mtu_read = mtu;
 
@@ -262,6 +274,8 @@ static void bluez_midi_characteristic_acquire_write(
 
 	midi_transport_start_watch_ble_midi(t);
 
+	pthread_mutex_unlock(&t->midi.ble_write_mtx);
+
 	GUnixFDList *fd_list = g_unix_fd_list_new_from_array(&fds[1], 1);
 	g_dbus_method_invocation_return_value_with_unix_fd_list(inv,
 			g_variant_new("(hq)", 0, mtu), fd_list);
@@ -287,8 +301,10 @@ static gboolean bluez_midi_characteristic_release_notify(
 	debug("Releasing BLE-MIDI notify link: %d", t->midi.ble_fd_notify);
 
 	app->notify_acquired = false;
+	pthread_mutex_lock(&t->midi.ble_notify_mtx);
 	close(t->midi.ble_fd_notify);
 	t->midi.ble_fd_notify = -1;
+	pthread_mutex_unlock(&t->midi.ble_notify_mtx);
 
 	/* remove channel from watch */
 	return FALSE;
@@ -315,8 +331,10 @@ static void bluez_midi_characteristic_acquire_notify(
 
 	debug("New BLE-MIDI notify link (MTU: %u): %d", mtu, fds[0]);
 	app->notify_acquired = true;
+	pthread_mutex_lock(&t->midi.ble_notify_mtx);
 	t->midi.ble_fd_notify = fds[0];
 	ble_midi_encode_set_mtu(&t->midi.ble_encoder, mtu);
+	pthread_mutex_unlock(&t->midi.ble_notify_mtx);
 	t->mtu_write = mtu;
 
 	/* Setup IO watch for checking HUP condition on the socket. HUP means
@@ -48,6 +48,7 @@
 #include "dbus.h"
 #include "hci.h"
 #include "sco.h"
+#include "storage.h"
 #include "utils.h"
 #include "shared/a2dp-codecs.h"
 #include "shared/bluetooth.h"
@@ -59,6 +60,15 @@
 # define g_memdup2 g_memdup
 #endif
 
+/**
+ * A2DP configuration selected for remote SEP capabilities. */
+struct bluez_a2dp_selection {
+	a2dp_t capabilities;
+	a2dp_t configuration;
+	/* size of the capabilities blob, 0 if not used */
+	size_t size;
+};
+
 /**
  * Data associated with registered D-Bus object. */
 struct bluez_dbus_object_data {
@@ -75,6 +85,12 @@ struct bluez_dbus_object_data {
 	enum ba_transport_profile profile;
 	/* media endpoint SEP */
 	const struct a2dp_sep *sep;
+	/* Recent configuration selections not yet confirmed by BlueZ. The
+	 * SelectConfiguration() call does not tell which device is asking,
+	 * so selections are matched by the configuration which is later set
+	 * with the SetConfiguration() call. */
+	struct bluez_a2dp_selection selections[4];
+	unsigned int selections_next;
 	/* determine whether object is registered in BlueZ */
 	bool registered;
 	/* determine whether object is used */
@@ -428,11 +444,27 @@ static void bluez_endpoint_select_configuration(GDBusMethodInvocation *inv, void
 	g_variant_unref(params);
 
 	hexdump("A2DP peer capabilities blob", &capabilities, size);
-	if (a2dp_select_configuration(sep, &capabilities, size) == -1)
-		goto fail;
+
+	a2dp_t configuration;
+	if (storage_a2dp_configuration_lookup(sep, &capabilities, size, &configuration) &&
+			a2dp_check_configuration(sep, &configuration, size) == A2DP_CHECK_OK)
+		debug("Using cached A2DP configuration: %s", sep->name);
+	else {
+		memcpy(&configuration, &capabilities, sizeof(configuration));
+		if (a2dp_select_configuration(sep, &configuration, size) == -1)
+			goto fail;
+	}
+
+	/* Remember remote capabilities, so the accepted configuration can be
+	 * cached when BlueZ will call the SetConfiguration() method. */
+	struct bluez_a2dp_selection *selection = &dbus_obj->selections[
+		dbus_obj->selections_next++ % ARRAYSIZE(dbus_obj->selections)];
+	memcpy(&selection->capabilities, &capabilities, sizeof(capabilities));
+	memcpy(&selection->configuration, &configuration, sizeof(configuration));
+	selection->size = size;
 
 	GVariant *rv[] = {
-		g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE, &capabilities, size, sizeof(uint8_t)) };
+		g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE, &configuration, size, sizeof(uint8_t)) };
 	g_dbus_method_invocation_return_value(inv, g_variant_new_tuple(rv, 1));
 
 	return;
@@ -585,6 +617,18 @@ static void bluez_endpoint_set_configuration(GDBusMethodInvocation *inv, void *u
 	debug("Delay reporting: %s",
 			delay_reporting ? "supported" : "unsupported");
 
+	/* Cache configuration selected for the remote SEP capabilities. */
+	for (size_t i = 0; i < ARRAYSIZE(dbus_obj->selections); i++) {
+		struct bluez_a2dp_selection *selection = &dbus_obj->selections[i];
+		if (selection->size == sep->config.caps_size &&
+				memcmp(&selection->configuration, &configuration, selection->size) == 0) {
+			storage_a2dp_configuration_update(d, sep, &selection->capabilities,
+					selection->size, &configuration);
+			selection->size = 0;
+			break;
+		}
+	}
+
 	ba_transport_set_media_state(t, state);
 
 	bluez_dbus_object_data_device_set(dbus_obj, d);
@@ -15,11 +15,19 @@
 #endif
 
 #include <errno.h>
+#include <stddef.h>
 #include <stdint.h>
 #if !(WITH_LIBOPENAPTX || WITH_LIBFREEAPTX)
 # include <endian.h>
 # include <stdlib.h>
 #endif
+#if ENABLE_APTX_LL
+# include <math.h>
+# include <stdbool.h>
+# include <time.h>
+#endif
+
+#include <glib.h>
 
 #if WITH_LIBFREEAPTX
 # include <freeaptx.h>
@@ -27,8 +35,113 @@
 # include <openaptx.h>
 #endif
 
+#include "codec-lib.h"
+#if ENABLE_APTX_LL
+# include "shared/a2dp-codecs.h"
+# include "shared/rt.h"
+#endif
 #include "shared/log.h"
 
+#if WITH_LIBOPENAPTX || WITH_LIBFREEAPTX
+
+#ifndef APTX_SONAME
+# if WITH_LIBFREEAPTX
+#  define APTX_SONAME "libfreeaptx.so.0"
+# else
+#  define APTX_SONAME "libopenaptx.so.0"
+# endif
+#endif
+
+#define APTX_SYMBOLS(X) \
+	X(aptx_decode_sync) \
+	X(aptx_encode) \
+	X(aptx_finish) \
+	X(aptx_init)
+
+CODEC_LIB_DEFINE(codec_lib_aptx, "apt-X", APTX_SONAME, APTX_SYMBOLS);
+
+#if ENABLE_CODEC_DLOPEN
+# define aptx_decode_sync CODEC_LIB_SYM(codec_lib_aptx, aptx_decode_sync)
+# define aptx_encode CODEC_LIB_SYM(codec_lib_aptx, aptx_encode)
+# define aptx_finish CODEC_LIB_SYM(codec_lib_aptx, aptx_finish)
+# define aptx_init CODEC_LIB_SYM(codec_lib_aptx, aptx_init)
+#endif
+
+#else
+
+/* The openaptx wrapper for proprietary apt-X libraries
+ * is always linked with the daemon. */
+struct codec_lib codec_lib_aptx = {
+	.name = "apt-X",
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+#endif
+
+/**
+ * The maximum number of apt-X blocks (4 stereo samples) processed by a
+ * single call to the apt-X library. All blocks which fit into the output
+ * buffer (usually a whole MTU) are processed by one call to our encode and
+ * decode functions. The limit only bounds the size of the stack buffer. */
+#define APTX_BATCH_BLOCKS 128
+
+#if WITH_LIBOPENAPTX || WITH_LIBFREEAPTX
+
+/**
+ * Convert S16 samples into packed S24LE samples. */
+static void aptx_pcm_s16_to_s24le(uint8_t * restrict dst,
+		const int16_t * restrict src, size_t samples) {
+	for (size_t i = 0; i < samples; i++) {
+		dst[i * 3 + 0] = 0;
+		dst[i * 3 + 1] = src[i];
+		dst[i * 3 + 2] = src[i] >> 8;
+	}
+}
+
+/**
+ * Convert S32 samples (24-bit in LSB) into packed S24LE samples. */
+static void aptx_pcm_s32_to_s24le(uint8_t * restrict dst,
+		const int32_t * restrict src, size_t samples) {
+	for (size_t i = 0; i < samples; i++) {
+		dst[i * 3 + 0] = src[i];
+		dst[i * 3 + 1] = src[i] >> 8;
+		dst[i * 3 + 2] = src[i] >> 16;
+	}
+}
+
+/**
+ * Convert packed S24LE samples into S16 samples. */
+static void aptx_pcm_s24le_to_s16(int16_t * restrict dst,
+		const uint8_t * restrict src, size_t samples) {
+	for (size_t i = 0; i < samples; i++)
+		dst[i] = src[i * 3 + 1] | (src[i * 3 + 2] << 8);
+}
+
+/**
+ * Convert packed S24LE samples into S32 samples (24-bit in LSB). */
+static void aptx_pcm_s24le_to_s32(int32_t * restrict dst,
+		const uint8_t * restrict src, size_t samples) {
+	for (size_t i = 0; i < samples; i++)
+		dst[i] = (int32_t)(((uint32_t)src[i * 3 + 0] << 8) |
+				((uint32_t)src[i * 3 + 1] << 16) | ((uint32_t)src[i * 3 + 2] << 24)) >> 8;
+}
+
+/**
+ * Get the number of blocks which can be decoded at once.
+ *
+ * The aptx_decode_sync() function might output one extra block, so we
+ * have to reserve space for it in the output buffer. */
+static size_t aptx_decode_blocks(size_t code_blocks, size_t samples) {
+	size_t blocks = MIN(code_blocks, APTX_BATCH_BLOCKS);
+	if (samples >= 2 * 8)
+		blocks = MIN(blocks, samples / 8 - 1);
+	else
+		blocks = 1;
+	return blocks;
+}
+
+#endif
+
 #if ENABLE_APTX
 /**
  * Initialize apt-X encoder handler.
@@ -117,6 +230,9 @@ HANDLE_APTX aptxhddec_init(void) {
 /**
  * Encode stereo PCM.
  *
+ * All complete apt-X blocks which fit into the output buffer are encoded
+ * at once, so the output buffer length is updated accordingly.
+ *
  * @returns On success, this function returns the number of processed input
  *   samples. On error, -1 is returned. */
 ssize_t aptxenc_encode(HANDLE_APTX handle, const int16_t *input, size_t samples,
@@ -125,33 +241,48 @@ ssize_t aptxenc_encode(HANDLE_APTX handle, const int16_t *input, size_t samples,
 	if (samples < 8 || *len < 4)
 		return errno = EINVAL, -1;
 
+	size_t blocks = MIN(samples / 8, *len / 4);
+	uint8_t *code = output;
+
 #if WITH_LIBOPENAPTX || WITH_LIBFREEAPTX
 
-	const uint8_t pcm[3 /* 24bit */ * 8 /* 4 samples * 2 channels */] = {
-		0, input[0], input[0] >> 8, 0, input[1], input[1] >> 8,
-		0, input[2], input[2] >> 8, 0, input[3], input[3] >> 8,
-		0, input[4], input[4] >> 8, 0, input[5], input[5] >> 8,
-		0, input[6], input[6] >> 8, 0, input[7], input[7] >> 8,
-	};
+	uint8_t pcm[3 /* 24bit */ * 8 /* 4 samples * 2 channels */ * APTX_BATCH_BLOCKS];
 
-	size_t rv;
-	if ((rv = aptx_encode(handle, pcm, sizeof(pcm), output, *len, len)) != sizeof(pcm))
-		return -1;
+	while (blocks > 0) {
+
+		const size_t n = MIN(blocks, APTX_BATCH_BLOCKS);
+		aptx_pcm_s16_to_s24le(pcm, input, n * 8);
+
+		size_t written;
+		if (aptx_encode(handle, pcm, n * 3 * 8, code, n * 4, &written) != n * 3 * 8)
+			return -1;
 
-	return rv / 3;
+		input += n * 8;
+		code += written;
+		blocks -= n;
+
+	}
 
 #else
 
-	int32_t pcm_l[4] = { input[0], input[2], input[4], input[6] };
-	int32_t pcm_r[4] = { input[1], input[3], input[5], input[7] };
+	for (; blocks > 0; blocks--) {
 
-	if (aptxbtenc_encodestereo(handle, pcm_l, pcm_r, output) != 0)
-		return -1;
+		int32_t pcm_l[4] = { input[0], input[2], input[4], input[6] };
+		int32_t pcm_r[4] = { input[1], input[3], input[5], input[7] };
+
+		if (aptxbtenc_encodestereo(handle, pcm_l, pcm_r, code) != 0)
+			return -1;
 
-	*len = 4;
-	return 8;
+		input += 8;
+		code += 4;
+
+	}
 
 #endif
+
+	const size_t encoded = code - (uint8_t *)output;
+	*len = encoded;
+	return encoded / 4 * 8;
 }
 #endif
 
@@ -159,6 +290,9 @@ ssize_t aptxenc_encode(HANDLE_APTX handle, const int16_t *input, size_t samples,
 /**
  * Decode stereo PCM.
  *
+ * All complete apt-X blocks for which there is enough space in the output
+ * buffer are decoded at once.
+ *
  * @returns On success, this function returns the number of processed input
  *   bytes. On error, -1 is returned. */
 ssize_t aptxdec_decode(HANDLE_APTX handle, const void *input, size_t len,
@@ -169,38 +303,44 @@ ssize_t aptxdec_decode(HANDLE_APTX handle, const void *input, size_t len,
 
 #if WITH_LIBOPENAPTX || WITH_LIBFREEAPTX
 
-	uint8_t pcm[3 /* 24bit */ * 8 /* 4 samples * 2 channels */ * 2];
+	uint8_t pcm[3 /* 24bit */ * 8 /* 4 samples * 2 channels */ * (APTX_BATCH_BLOCKS + 1)];
+	const size_t blocks = aptx_decode_blocks(len / 4, *samples);
 	size_t written, dropped;
 	int synced;
 
-	if ((len = aptx_decode_sync(handle, input, 4, pcm, sizeof(pcm),
-					&written, &synced, &dropped)) != 4)
+	if ((len = aptx_decode_sync(handle, input, blocks * 4, pcm, sizeof(pcm),
+					&written, &synced, &dropped)) != blocks * 4)
 		return -1;
 
 	if (!synced && dropped > 0)
 		info("Apt-X stream out of sync: Dropped bytes: %zd", dropped);
 
-	for (size_t i = 0; i < written / 3 / 2; i++) {
-		*output++ = pcm[i * 6 + 0 + 1] | (pcm[i * 6 + 0 + 2] << 8);
-		*output++ = pcm[i * 6 + 3 + 1] | (pcm[i * 6 + 3 + 2] << 8);
-	}
-
-	*samples = written / 3;
+	*samples = MIN(written / 3, *samples);
+	aptx_pcm_s24le_to_s16(output, pcm, *samples);
 	return len;
 
 #else
 
-	int32_t pcm_l[4], pcm_r[4];
-	if (aptxbtdec_decodestereo(handle, pcm_l, pcm_r, input) != 0)
-		return -1;
+	const size_t blocks = MIN(len / 4, *samples / 8);
+	const uint8_t *code = input;
+
+	for (size_t i = 0; i < blocks; i++) {
+
+		int32_t pcm_l[4], pcm_r[4];
+		if (aptxbtdec_decodestereo(handle, pcm_l, pcm_r, (void *)code) != 0)
+			return -1;
+
+		for (size_t j = 0; j < 4; j++) {
+			*output++ = pcm_l[j];
+			*output++ = pcm_r[j];
+		}
+
+		code += 4;
 
-	for (size_t i = 0; i < 4; i++) {
-		*output++ = pcm_l[i];
-		*output++ = pcm_r[i];
 	}
 
-	*samples = 8;
-	return 4;
+	*samples = blocks * 8;
+	return blocks * 4;
 
 #endif
 }
@@ -210,6 +350,9 @@ ssize_t aptxdec_decode(HANDLE_APTX handle, const void *input, size_t len,
 /**
  * Encode stereo PCM (HD variant).
  *
+ * All complete apt-X blocks which fit into the output buffer are encoded
+ * at once, so the output buffer length is updated accordingly.
+ *
  * @returns On success, this function returns the number of processed input
  *   samples. On error, -1 is returned. */
 ssize_t aptxhdenc_encode(HANDLE_APTX handle, const int32_t *input, size_t samples,
@@ -218,41 +361,56 @@ ssize_t aptxhdenc_encode(HANDLE_APTX handle, const int32_t *input, size_t sample
 	if (samples < 8 || *len < 6)
 		return errno = EINVAL, -1;
 
+	size_t blocks = MIN(samples / 8, *len / 6);
+	uint8_t *code = output;
+
 #if WITH_LIBOPENAPTX || WITH_LIBFREEAPTX
 
-	const uint8_t pcm[3 /* 24bit */ * 8 /* 4 samples * 2 channels */] = {
-		input[0], input[0] >> 8, input[0] >> 16, input[1], input[1] >> 8, input[1] >> 16,
-		input[2], input[2] >> 8, input[2] >> 16, input[3], input[3] >> 8, input[3] >> 16,
-		input[4], input[4] >> 8, input[4] >> 16, input[5], input[5] >> 8, input[5] >> 16,
-		input[6], input[6] >> 8, input[6] >> 16, input[7], input[7] >> 8, input[7] >> 16,
-	};
+	uint8_t pcm[3 /* 24bit */ * 8 /* 4 samples * 2 channels */ * APTX_BATCH_BLOCKS];
 
-	size_t rv;
-	if ((rv = aptx_encode(handle, pcm, sizeof(pcm), output, *len, len)) != sizeof(pcm))
-		return -1;
+	while (blocks > 0) {
+
+		const size_t n = MIN(blocks, APTX_BATCH_BLOCKS);
+		aptx_pcm_s32_to_s24le(pcm, input, n * 8);
 
-	return rv / 3;
+		size_t written;
+		if (aptx_encode(handle, pcm, n * 3 * 8, code, n * 6, &written) != n * 3 * 8)
+			return -1;
+
+		input += n * 8;
+		code += written;
+		blocks -= n;
+
+	}
 
 #else
 
-	int32_t pcm_l[4] = { input[0], input[2], input[4], input[6] };
-	int32_t pcm_r[4] = { input[1], input[3], input[5], input[7] };
-	uint32_t code[2];
+	for (; blocks > 0; blocks--) {
 
-	if (aptxhdbtenc_encodestereo(handle, pcm_l, pcm_r, code) != 0)
-		return -1;
+		int32_t pcm_l[4] = { input[0], input[2], input[4], input[6] };
+		int32_t pcm_r[4] = { input[1], input[3], input[5], input[7] };
+		uint32_t hd_code[2];
 
-	((uint8_t *)output)[0] = code[0] >> 16;
-	((uint8_t *)output)[1] = code[0] >> 8;
-	((uint8_t *)output)[2] = code[0];
-	((uint8_t *)output)[3] = code[1] >> 16;
-	((uint8_t *)output)[4] = code[1] >> 8;
-	((uint8_t *)output)[5] = code[1];
+		if (aptxhdbtenc_encodestereo(handle, pcm_l, pcm_r, hd_code) != 0)
+			return -1;
 
-	*len = 6;
-	return 8;
+		code[0] = hd_code[0] >> 16;
+		code[1] = hd_code[0] >> 8;
+		code[2] = hd_code[0];
+		code[3] = hd_code[1] >> 16;
+		code[4] = hd_code[1] >> 8;
+		code[5] = hd_code[1];
+
+		input += 8;
+		code += 6;
+
+	}
 
 #endif
+
+	const size_t encoded = code - (uint8_t *)output;
+	*len = encoded;
+	return encoded / 6 * 8;
 }
 #endif
 
@@ -260,6 +418,9 @@ ssize_t aptxhdenc_encode(HANDLE_APTX handle, const int32_t *input, size_t sample
 /**
  * Decode stereo PCM (HD variant).
  *
+ * All complete apt-X blocks for which there is enough space in the output
+ * buffer are decoded at once.
+ *
  * @returns On success, this function returns the number of processed input
  *   bytes. On error, -1 is returned. */
 ssize_t aptxhddec_decode(HANDLE_APTX handle, const void *input, size_t len,
@@ -270,45 +431,48 @@ ssize_t aptxhddec_decode(HANDLE_APTX handle, const void *input, size_t len,
 
 #if WITH_LIBOPENAPTX || WITH_LIBFREEAPTX
 
-	uint8_t pcm[3 /* 24bit */ * 8 /* 4 samples * 2 channels */ * 2];
+	uint8_t pcm[3 /* 24bit */ * 8 /* 4 samples * 2 channels */ * (APTX_BATCH_BLOCKS + 1)];
+	const size_t blocks = aptx_decode_blocks(len / 6, *samples);
 	size_t written, dropped;
 	int synced;
 
-	if ((len = aptx_decode_sync(handle, input, 6, pcm, sizeof(pcm),
-					&written, &synced, &dropped)) != 6)
+	if ((len = aptx_decode_sync(handle, input, blocks * 6, pcm, sizeof(pcm),
+					&written, &synced, &dropped)) != blocks * 6)
 		return -1;
 
 	if (!synced && dropped > 0)
 		info("Apt-X HD stream out of sync: Dropped bytes: %zd", dropped);
 
-	int32_t base;
-	for (size_t i = 0; i < written / 3 / 2; i++) {
-		base = pcm[i * 6 + 0 + 2] & 0x80 ? 0xFF000000 : 0;
-		*output++ = base | pcm[i * 6 + 0 + 0] | (pcm[i * 6 + 0 + 1] << 8) | (pcm[i * 6 + 0 + 2] << 16);
-		base = pcm[i * 6 + 3 + 2] & 0x80 ? 0xFF000000 : 0;
-		*output++ = base | pcm[i * 6 + 3 + 0] | (pcm[i * 6 + 3 + 1] << 8) | (pcm[i * 6 + 3 + 2] << 16);
-	}
-
-	*samples = written / 3;
+	*samples = MIN(written / 3, *samples);
+	aptx_pcm_s24le_to_s32(output, pcm, *samples);
 	return len;
 
 #else
 
-	const uint32_t code[2] = {
-		(((uint8_t *)input)[0] << 16) | (((uint8_t *)input)[1] << 8) | ((uint8_t *)input)[2],
-		(((uint8_t *)input)[3] << 16) | (((uint8_t *)input)[4] << 8) | ((uint8_t *)input)[5] };
-	int32_t pcm_l[4], pcm_r[4];
+	const size_t blocks = MIN(len / 6, *samples / 8);
+	const uint8_t *code = input;
 
-	if (aptxhdbtdec_decodestereo(handle, pcm_l, pcm_r, code) != 0)
-		return -1;
+	for (size_t i = 0; i < blocks; i++) {
+
+		const uint32_t hd_code[2] = {
+			(code[0] << 16) | (code[1] << 8) | code[2],
+			(code[3] << 16) | (code[4] << 8) | code[5] };
+		int32_t pcm_l[4], pcm_r[4];
+
+		if (aptxhdbtdec_decodestereo(handle, pcm_l, pcm_r, hd_code) != 0)
+			return -1;
+
+		for (size_t j = 0; j < 4; j++) {
+			*output++ = pcm_l[j];
+			*output++ = pcm_r[j];
+		}
+
+		code += 6;
 
-	for (size_t i = 0; i < 4; i++) {
-		*output++ = pcm_l[i];
-		*output++ = pcm_r[i];
 	}
 
-	*samples = 8;
-	return 6;
+	*samples = blocks * 8;
+	return blocks * 6;
 
 #endif
 }
@@ -375,3 +539,179 @@ void aptxhddec_destroy(HANDLE_APTX handle) {
 #endif
 }
 #endif
+
+#if ENABLE_APTX_LL
+
+/**
+ * Initialize aptX LL stream rate adaptation.
+ *
+ * @param sra The SRA structure which shall be initialized.
+ * @param rate PCM sample rate.
+ * @param channels Number of PCM channels (1 or 2).
+ * @param configuration The aptX LL A2DP configuration. If the configuration
+ *   has the new capabilities, SRA parameters are taken from it. Otherwise,
+ *   default parameters are used.
+ * @param size Size of the configuration blob. */
+void aptx_ll_sra_init(
+		struct aptx_ll_sra *sra,
+		unsigned int rate,
+		unsigned int channels,
+		const void *configuration,
+		size_t size) {
+
+	const a2dp_aptx_ll_new_t *conf = configuration;
+	unsigned int avg_time = APTX_LL_SRA_AVG_TIME;
+
+	sra->rate = rate;
+	sra->channels = channels;
+	sra->initial_level = APTX_LL_INITIAL_CODEC_LEVEL;
+	sra->target_level = APTX_LL_TARGET_CODEC_LEVEL;
+	sra->max_rate = APTX_LL_SRA_MAX_RATE;
+
+	if (size == sizeof(*conf) && conf->aptx_ll.has_new_caps) {
+		sra->initial_level = A2DP_APTX_LL_GET_INITIAL_CODEC_LEVEL(*conf);
+		sra->target_level = A2DP_APTX_LL_GET_TARGET_CODEC_LEVEL(*conf);
+		sra->max_rate = conf->sra_max_rate;
+		avg_time = conf->sra_avg_time;
+	}
+
+	sra->avg_frames = (avg_time > 0 ? avg_time : 1) * rate;
+	sra->adjustment = 0;
+	aptx_ll_sra_reset(sra);
+
+}
+
+/**
+ * Reset aptX LL SRA synchronization.
+ *
+ * This function shall be called when the stream is interrupted, e.g. when
+ * the source pauses the playback. The rate adjustment is preserved, because
+ * the clock drift between the source and the sink will not change. */
+void aptx_ll_sra_reset(
+		struct aptx_ll_sra *sra) {
+	sra->synced = false;
+	sra->level_sum = 0;
+	sra->level_frames = 0;
+	sra->level_avg_valid = false;
+	sra->position = 1.0;
+}
+
+/**
+ * Resample PCM frames according to the current rate adjustment.
+ *
+ * The resampling is done with the linear interpolation, which is sufficient
+ * for the small (less than 1%) rate adjustments used by the SRA.
+ *
+ * @param sra The SRA structure.
+ * @param input Interleaved input PCM frames.
+ * @param frames Number of input PCM frames.
+ * @param output Buffer for output PCM frames. In order to consume all input
+ *   frames, it shall have room for at least frames * (1 + max_rate / 10000)
+ *   + 1 PCM frames.
+ * @param output_frames Size of the output buffer in PCM frames.
+ * @return This function returns the number of output PCM frames. */
+size_t aptx_ll_sra_process(
+		struct aptx_ll_sra *sra,
+		const int16_t *input,
+		size_t frames,
+		int16_t *output,
+		size_t output_frames) {
+
+	const unsigned int channels = sra->channels;
+	const double step = 1.0 / (1.0 + sra->adjustment);
+	double position = sra->position;
+	size_t n;
+
+	if (frames == 0)
+		return 0;
+
+	/* The position 0 points to the last frame of the previous block,
+	 * the position 1 points to the first frame of the current block. */
+	for (n = 0; n < output_frames; n++) {
+
+		const size_t i = position;
+		if (i >= frames)
+			break;
+
+		const double frac = position - i;
+		for (size_t c = 0; c < channels; c++) {
+			const int s0 = i == 0 ? sra->last[c] : input[(i - 1) * channels + c];
+			const int s1 = input[i * channels + c];
+			output[n * channels + c] = lrint(s0 + (s1 - s0) * frac);
+		}
+
+		position += step;
+
+	}
+
+	sra->position = position > frames ? position - frames : 0;
+	for (size_t c = 0; c < channels; c++)
+		sra->last[c] = input[(frames - 1) * channels + c];
+
+	return n;
+}
+
+/**
+ * Update aptX LL SRA state.
+ *
+ * The codec buffer level is calculated as the number of PCM frames produced
+ * by the sink minus the number of PCM frames which should have been played
+ * according to the local clock. At the end of every averaging period the
+ * rate adjustment is updated, so the clock drift is compensated and the
+ * average level converges to the target level.
+ *
+ * @param sra The SRA structure.
+ * @param now Current time of the local monotonic clock.
+ * @param frames Number of PCM frames produced by the sink. */
+void aptx_ll_sra_update(
+		struct aptx_ll_sra *sra,
+		const struct timespec *now,
+		size_t frames) {
+
+	if (!sra->synced) {
+		sra->ts0 = *now;
+		sra->frames = 0;
+		sra->synced = true;
+	}
+
+	sra->frames += frames;
+
+	struct timespec elapsed;
+	timespecsub(now, &sra->ts0, &elapsed);
+	const double elapsed_frames = elapsed.tv_sec * (double)sra->rate +
+		elapsed.tv_nsec * (double)sra->rate / 1000000000;
+
+	const double level = sra->initial_level + sra->frames - elapsed_frames;
+	if (level < 0) {
+		debug("aptX LL SRA: Codec buffer underrun: %.0f", level);
+		aptx_ll_sra_reset(sra);
+		return;
+	}
+
+	sra->level_sum += level * frames;
+	if ((sra->level_frames += frames) < sra->avg_frames)
+		return;
+
+	const double period = sra->level_frames;
+	const double level_avg = sra->level_sum / period;
+	const double max = sra->max_rate / 10000.0;
+	double adjustment = sra->adjustment;
+
+	/* Compensate the level drift observed in the last averaging period
+	 * and move the level half way towards the target level. */
+	if (sra->level_avg_valid)
+		adjustment -= (level_avg - sra->level_avg) / period;
+	adjustment -= (level_avg - sra->target_level) / period / 2;
+
+	sra->adjustment = fmin(fmax(adjustment, -max), max);
+	sra->level_avg = level_avg;
+	sra->level_avg_valid = true;
+	sra->level_sum = 0;
+	sra->level_frames = 0;
+
+	debug("aptX LL SRA: Level: %.0f, adjustment: %+.0f ppm",
+			level_avg, sra->adjustment * 1000000);
+
+}
+
+#endif
@@ -15,13 +15,22 @@
 # include <config.h>
 #endif
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <sys/types.h>
+#include <time.h>
+
+#include "codec-lib.h"
 
 /**
  * Opaque apt-X encoder/decoder handle. */
 typedef void * HANDLE_APTX;
 
+/**
+ * The apt-X library used by all apt-X codecs. */
+extern struct codec_lib codec_lib_aptx;
+
 #if ENABLE_APTX
 HANDLE_APTX aptxenc_init(void);
 # if HAVE_APTX_DECODE
@@ -68,5 +77,74 @@ void aptxhddec_destroy(HANDLE_APTX handle);
 # endif
 #endif
 
+#if ENABLE_APTX_LL
+
+/**
+ * Stream rate adaptation (SRA) for the aptX Low Latency sink.
+ *
+ * The source transmits audio according to its own clock, which is not
+ * synchronized with the local one. In order to keep the latency at the
+ * constant level, the sink slightly resamples decoded audio, so the level
+ * of the codec buffer (decoded PCM frames which were not played yet
+ * according to the local clock) stays at the target level. */
+struct aptx_ll_sra {
+
+	unsigned int rate;
+	unsigned int channels;
+
+	/* codec buffer levels in PCM frames */
+	unsigned int initial_level;
+	unsigned int target_level;
+	/* maximal rate adjustment in 1/10000 units */
+	unsigned int max_rate;
+	/* level averaging period in PCM frames */
+	unsigned int avg_frames;
+
+	/* local clock reference point */
+	struct timespec ts0;
+	/* PCM frames produced since the reference point */
+	uint64_t frames;
+	bool synced;
+
+	/* level accumulator for the current averaging period */
+	double level_sum;
+	unsigned int level_frames;
+	/* average level in the previous averaging period */
+	double level_avg;
+	bool level_avg_valid;
+
+	/* current rate adjustment (output/input - 1) */
+	double adjustment;
+
+	/* fractional position of the resampler */
+	double position;
+	/* last input frame of the previous block */
+	int16_t last[2];
+
+};
+
+void aptx_ll_sra_init(
+		struct aptx_ll_sra *sra,
+		unsigned int rate,
+		unsigned int channels,
+		const void *configuration,
+		size_t size);
+
+void aptx_ll_sra_reset(
+		struct aptx_ll_sra *sra);
+
+size_t aptx_ll_sra_process(
+		struct aptx_ll_sra *sra,
+		const int16_t *input,
+		size_t frames,
+		int16_t *output,
+		size_t output_frames);
+
+void aptx_ll_sra_update(
+		struct aptx_ll_sra *sra,
+		const struct timespec *now,
+		size_t frames);
+
+#endif
 
 #endif
@@ -19,9 +19,31 @@
 
 #include <lc3.h>
 
+#include "codec-lib.h"
 #include "h2.h"
 #include "shared/log.h"
 
+#ifndef LC3_SONAME
+# define LC3_SONAME "liblc3.so.1"
+#endif
+
+#define LC3_SYMBOLS(X) \
+	X(lc3_decode) \
+	X(lc3_delay_samples) \
+	X(lc3_encode) \
+	X(lc3_setup_decoder) \
+	X(lc3_setup_encoder)
+
+CODEC_LIB_DEFINE(codec_lib_lc3, "LC3", LC3_SONAME, LC3_SYMBOLS);
+
+#if ENABLE_CODEC_DLOPEN
+# define lc3_decode CODEC_LIB_SYM(codec_lib_lc3, lc3_decode)
+# define lc3_delay_samples CODEC_LIB_SYM(codec_lib_lc3, lc3_delay_samples)
+# define lc3_encode CODEC_LIB_SYM(codec_lib_lc3, lc3_encode)
+# define lc3_setup_decoder CODEC_LIB_SYM(codec_lib_lc3, lc3_setup_decoder)
+# define lc3_setup_encoder CODEC_LIB_SYM(codec_lib_lc3, lc3_setup_encoder)
+#endif
+
 /**
  * Initialize LC3-SWB codec structure.
  *
@@ -24,6 +24,7 @@
 
 #include <lc3.h>
 
+#include "codec-lib.h"
 #include "h2.h"
 #include "shared/ffb.h"
 
@@ -72,6 +73,8 @@ struct esco_lc3_swb {
 
 };
 
+extern struct codec_lib codec_lib_lc3;
+
 void lc3_swb_init(struct esco_lc3_swb *lc3_swb);
 
 ssize_t lc3_swb_get_delay(struct esco_lc3_swb *lc3_swb);
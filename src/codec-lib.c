@@ -0,0 +1,317 @@
+/*
+ * BlueALSA - codec-lib.c
+ * Copyright (c) 2016-2025 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include "codec-lib.h"
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#if ENABLE_CODEC_DLOPEN
+# include <dlfcn.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+#endif
+
+#include "shared/log.h"
+#include "shared/rt.h"
+
+#if ENABLE_CODEC_DLOPEN
+/**
+ * Get the resident set size of the current process in kB. */
+static long codec_lib_get_rss_kb(void) {
+
+	FILE *f;
+	if ((f = fopen("/proc/self/statm", "r")) == NULL)
+		return 0;
+
+	long size, resident = 0;
+	if (fscanf(f, "%ld %ld", &size, &resident) != 2)
+		resident = 0;
+
+	fclose(f);
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+/**
+ * Unload codec library and clear resolved symbol addresses. */
+static void codec_lib_close(struct codec_lib *lib, void *handle) {
+	/* Do not leave pointers into the unloaded library. */
+	for (size_t i = 0; lib->symbols[i] != NULL; i++)
+		lib->addrs[i] = NULL;
+	dlclose(handle);
+}
+
+/**
+ * Check whether the shared object exists in the colon-separated list of
+ * directories. Empty entries are skipped. */
+static bool codec_lib_lookup_dirs(const char *dirs, const char *soname) {
+
+	while (dirs != NULL && *dirs != '\0') {
+
+		const char *end;
+		if ((end = strchr(dirs, ':')) == NULL)
+			end = dirs + strlen(dirs);
+
+		char path[PATH_MAX];
+		if (end != dirs &&
+				snprintf(path, sizeof(path), "%.*s/%s", (int)(end - dirs), dirs,
+					soname) < (int)sizeof(path) &&
+				access(path, R_OK) == 0)
+			return true;
+
+		dirs = *end == ':' ? end + 1 : end;
+	}
+
+	return false;
+}
+
+/**
+ * Check whether the shared object is listed in the dynamic linker cache.
+ *
+ * Instead of parsing the cache format, which differs between releases of
+ * the C library, the cache string table is searched for the soname or for
+ * the path with the soname as its last component. */
+static bool codec_lib_lookup_cache(const char *soname) {
+
+	int fd;
+	if ((fd = open("/etc/ld.so.cache", O_RDONLY | O_CLOEXEC)) == -1)
+		return false;
+
+	struct stat st;
+	void *cache = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && st.st_size > 0)
+		cache = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (cache == MAP_FAILED)
+		return false;
+
+	const char *begin = cache;
+	const char *end = begin + st.st_size;
+	/* match the terminating null byte as well */
+	const size_t len = strlen(soname) + 1;
+	bool found = false;
+
+	for (const char *tmp = begin; !found &&
+			(tmp = memmem(tmp, end - tmp, soname, len)) != NULL; tmp += len)
+		found = tmp == begin || tmp[-1] == '\0' || tmp[-1] == '/';
+
+	munmap(cache, st.st_size);
+	return found;
+}
+
+/**
+ * Check whether the shared object can be found by the dynamic linker.
+ *
+ * The lookup follows the dlopen() search order, but the library is not
+ * loaded, so there is no mapping, relocation or constructor cost. */
+static bool codec_lib_lookup(const char *soname) {
+
+	/* name with a slash is a path passed to dlopen() as is */
+	if (strchr(soname, '/') != NULL)
+		return access(soname, R_OK) == 0;
+
+	return codec_lib_lookup_dirs(getenv("LD_LIBRARY_PATH"), soname) ||
+		codec_lib_lookup_cache(soname) ||
+		codec_lib_lookup_dirs("/lib:/usr/lib:/lib64:/usr/lib64:/usr/local/lib", soname);
+}
+
+/**
+ * Open codec library and resolve all its symbols.
+ *
+ * @return On success this function returns the library handle. Otherwise,
+ *   NULL is returned and errno is set to indicate the error. */
+static void *codec_lib_open(struct codec_lib *lib) {
+
+	void *handle;
+	if ((handle = dlopen(lib->soname, RTLD_NOW | RTLD_LOCAL)) == NULL) {
+		error("Couldn't load %s library: %s", lib->name, dlerror());
+		return errno = ENOENT, NULL;
+	}
+
+	for (size_t i = 0; lib->symbols[i] != NULL; i++)
+		if ((lib->addrs[i] = dlsym(handle, lib->symbols[i])) == NULL) {
+			error("Couldn't resolve %s library symbol: %s", lib->name, lib->symbols[i]);
+			codec_lib_close(lib, handle);
+			return errno = ENOEXEC, NULL;
+		}
+
+	return handle;
+}
+#endif
+
+/**
+ * Load external codec library.
+ *
+ * This function is thread-safe and idempotent. The library is loaded and
+ * all its symbols are resolved only once, upon the first call. Loaded
+ * library is never unloaded. If loading fails, the failure is recorded
+ * and subsequent calls fail right away.
+ *
+ * @param lib The codec library structure.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int codec_lib_load(struct codec_lib *lib) {
+#if ENABLE_CODEC_DLOPEN
+
+	/* library linked with the daemon */
+	if (lib->soname == NULL)
+		return 0;
+
+	int rv = 0;
+
+	pthread_mutex_lock(&lib->mutex);
+
+	if (lib->handle != NULL)
+		goto final;
+
+	if (lib->failed) {
+		errno = ENOENT;
+		rv = -1;
+		goto final;
+	}
+
+	struct timespec ts_begin, ts_end, ts_diff;
+	const long rss = codec_lib_get_rss_kb();
+	gettimestamp(&ts_begin);
+
+	void *handle;
+	if ((handle = codec_lib_open(lib)) == NULL) {
+		lib->failed = true;
+		rv = -1;
+		goto final;
+	}
+
+	gettimestamp(&ts_end);
+	timespecsub(&ts_end, &ts_begin, &ts_diff);
+
+	lib->load_time_us = ts_diff.tv_sec * 1000000 + ts_diff.tv_nsec / 1000;
+	lib->load_rss_kb = codec_lib_get_rss_kb() - rss;
+	lib->handle = handle;
+
+	debug("Loaded %s library: %s [%u us, %+ld kB]", lib->name, lib->soname,
+			lib->load_time_us, lib->load_rss_kb);
+
+final:
+	pthread_mutex_unlock(&lib->mutex);
+	return rv;
+
+#else
+	(void)lib;
+	return 0;
+#endif
+}
+
+/**
+ * Load all codec libraries from the NULL-terminated list.
+ *
+ * @param libs The NULL-terminated list of codec libraries. It is
+ *   allowed to pass NULL, in which case this function does nothing.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int codec_lib_load_all(struct codec_lib * const *libs) {
+	if (libs == NULL)
+		return 0;
+	for (size_t i = 0; libs[i] != NULL; i++)
+		if (codec_lib_load(libs[i]) != 0)
+			return -1;
+	return 0;
+}
+
+/**
+ * Check whether the codec library is available.
+ *
+ * The library is looked up in the dynamic linker search path, but it is
+ * not loaded, so it is not mapped into the process memory until the codec
+ * is used. Missing symbols are detected upon the first load. If the library
+ * is not found, it is marked as failed, so the codec which depends on it
+ * can be disabled up front.
+ *
+ * @param lib The codec library structure.
+ * @return If the library can be loaded, this function returns 0. Otherwise,
+ *   -1 is returned and errno is set to indicate the error. */
+int codec_lib_probe(struct codec_lib *lib) {
+#if ENABLE_CODEC_DLOPEN
+
+	/* library linked with the daemon */
+	if (lib->soname == NULL)
+		return 0;
+
+	int rv = 0;
+
+	pthread_mutex_lock(&lib->mutex);
+
+	if (lib->handle == NULL && !lib->failed &&
+			!codec_lib_lookup(lib->soname)) {
+		error("Couldn't find %s library: %s", lib->name, lib->soname);
+		lib->failed = true;
+	}
+
+	if (lib->failed) {
+		errno = ENOENT;
+		rv = -1;
+	}
+
+	pthread_mutex_unlock(&lib->mutex);
+	return rv;
+
+#else
+	(void)lib;
+	return 0;
+#endif
+}
+
+/**
+ * Check whether all codec libraries from the NULL-terminated list
+ * are available.
+ *
+ * @param libs The NULL-terminated list of codec libraries. It is
+ *   allowed to pass NULL, in which case this function does nothing.
+ * @return If all libraries can be loaded, this function returns 0.
+ *   Otherwise, -1 is returned and errno is set to indicate the error. */
+int codec_lib_probe_all(struct codec_lib * const *libs) {
+	if (libs == NULL)
+		return 0;
+	for (size_t i = 0; libs[i] != NULL; i++)
+		if (codec_lib_probe(libs[i]) != 0)
+			return -1;
+	return 0;
+}
+
+/**
+ * Check whether the codec library is loaded.
+ *
+ * If codec libraries are linked with the daemon, this function always
+ * returns true. */
+bool codec_lib_is_loaded(struct codec_lib *lib) {
+#if ENABLE_CODEC_DLOPEN
+	if (lib->soname == NULL)
+		return true;
+	pthread_mutex_lock(&lib->mutex);
+	bool loaded = lib->handle != NULL;
+	pthread_mutex_unlock(&lib->mutex);
+	return loaded;
+#else
+	(void)lib;
+	return true;
+#endif
+}
@@ -0,0 +1,110 @@
+/*
+ * BlueALSA - codec-lib.h
+ * Copyright (c) 2016-2025 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#pragma once
+#ifndef BLUEALSA_CODECLIB_H_
+#define BLUEALSA_CODECLIB_H_
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <pthread.h>
+#include <stdbool.h>
+
+#include "shared/defs.h"
+
+/**
+ * External codec library.
+ *
+ * If BlueALSA is configured with the --enable-codec-dlopen option, codec
+ * libraries are not linked with the daemon. Instead, they are loaded with
+ * the dlopen() on the first use of the codec, so libraries of codecs which
+ * are not used are never mapped into the process memory. Otherwise, the
+ * codec library structure is a placeholder and loading is a no-op. */
+struct codec_lib {
+
+	/* library name used in log messages */
+	const char *name;
+	/* shared object name passed to dlopen(), if NULL
+	 * the library is linked with the daemon */
+	const char *soname;
+
+	/* NULL-terminated list of required symbols */
+	const char * const *symbols;
+	/* resolved symbol addresses in the list order */
+	void **addrs;
+
+	pthread_mutex_t mutex;
+	void *handle;
+	/* loading has failed, so it shall not be retried */
+	bool failed;
+
+	/* time spent on loading the library */
+	unsigned int load_time_us;
+	/* change of the resident set size caused by loading */
+	long load_rss_kb;
+
+};
+
+#if ENABLE_CODEC_DLOPEN
+
+# define CODEC_LIB_SYMBOL_NAME(sym) #sym,
+# define CODEC_LIB_SYMBOL_PTR(sym) __typeof__(sym) *sym;
+
+/**
+ * Define external codec library.
+ *
+ * The SYMBOLS argument shall be an X-macro which applies its argument to
+ * every library function used by the codec. After the definition, calls
+ * to these functions can be redirected to the resolved symbols with the
+ * CODEC_LIB_SYM() macro, e.g.:
+ *
+ *   #define FOO_SYMBOLS(X) X(foo_open) X(foo_close)
+ *   CODEC_LIB_DEFINE(codec_lib_foo, "foo", "libfoo.so.1", FOO_SYMBOLS);
+ *   #define foo_open CODEC_LIB_SYM(codec_lib_foo, foo_open)
+ *   #define foo_close CODEC_LIB_SYM(codec_lib_foo, foo_close) */
+# define CODEC_LIB_DEFINE(id, name_, soname_, SYMBOLS) \
+	static struct { SYMBOLS(CODEC_LIB_SYMBOL_PTR) } id ## _symbols; \
+	static const char * const id ## _symbol_names[] = { \
+		SYMBOLS(CODEC_LIB_SYMBOL_NAME) NULL }; \
+	_Static_assert(sizeof(id ## _symbols) == \
+			(ARRAYSIZE(id ## _symbol_names) - 1) * sizeof(void *), \
+			"Invalid codec library symbols layout"); \
+	struct codec_lib id = { \
+		.name = name_, \
+		.soname = soname_, \
+		.symbols = id ## _symbol_names, \
+		.addrs = (void **)&id ## _symbols, \
+		.mutex = PTHREAD_MUTEX_INITIALIZER, \
+	}
+
+# define CODEC_LIB_SYM(id, sym) (id ## _symbols.sym)
+
+#else
+
+# define CODEC_LIB_DEFINE(id, name_, soname_, SYMBOLS) \
+	struct codec_lib id = { \
+		.name = name_, \
+		.soname = soname_, \
+		.mutex = PTHREAD_MUTEX_INITIALIZER, \
+	}
+
+#endif
+
+int codec_lib_load(struct codec_lib *lib);
+int codec_lib_load_all(struct codec_lib * const *libs);
+
+int codec_lib_probe(struct codec_lib *lib);
+int codec_lib_probe_all(struct codec_lib * const *libs);
+
+bool codec_lib_is_loaded(struct codec_lib *lib);
+
+#endif
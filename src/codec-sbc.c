@@ -109,6 +109,63 @@ uint8_t sbc_a2dp_get_bitpool(const a2dp_sbc_t *conf, unsigned int quality) {
 	return MIN(MAX(conf->min_bitpool, bitpool), conf->max_bitpool);
 }
 
+/**
+ * Initialize SBC dynamic bit-pool controller.
+ *
+ * @param ctrl The bit-pool controller structure.
+ * @param min The lowest bit-pool value which can be selected.
+ * @param max The highest bit-pool value which can be selected. This value
+ *   is also used as the initial bit-pool.
+ * @param probe The number of consecutive packets which have to be sent
+ *   without congestion before probing the next higher bit-pool. */
+void sbc_bitpool_ctrl_init(struct sbc_bitpool_ctrl *ctrl,
+		uint8_t min, uint8_t max, unsigned int probe) {
+	ctrl->min = MIN(min, max);
+	ctrl->max = max;
+	ctrl->bitpool = max;
+	ctrl->probe = MAX(probe, 1);
+	ctrl->clear = 0;
+	ctrl->holdoff = 0;
+}
+
+/**
+ * Update SBC bit-pool based on the BT link congestion.
+ *
+ * If packets accumulate in the BT socket output queue, the bit-pool is
+ * decreased by a quarter of the distance to the lowest bit-pool. Packets
+ * which were queued before the decrease have to be drained before the
+ * next decrease. If the queue stays empty for a configured number of
+ * packets, the bit-pool is increased by one.
+ *
+ * @param ctrl The bit-pool controller structure.
+ * @param queued The number of packets queued in the BT socket.
+ * @return This function returns true if the bit-pool has changed. */
+bool sbc_bitpool_ctrl_update(struct sbc_bitpool_ctrl *ctrl, unsigned int queued) {
+
+	const uint8_t bitpool = ctrl->bitpool;
+
+	if (ctrl->holdoff > 0)
+		ctrl->holdoff--;
+
+	if (queued >= SBC_BITPOOL_CTRL_CONGESTION) {
+		ctrl->clear = 0;
+		if (ctrl->holdoff == 0 && ctrl->bitpool > ctrl->min) {
+			ctrl->bitpool -= MAX((ctrl->bitpool - ctrl->min) / 4, 1);
+			ctrl->holdoff = queued;
+		}
+	}
+	else if (queued == 0) {
+		if (++ctrl->clear >= ctrl->probe) {
+			ctrl->bitpool = MIN(ctrl->bitpool + 1, ctrl->max);
+			ctrl->clear = 0;
+		}
+	}
+	else
+		ctrl->clear = 0;
+
+	return ctrl->bitpool != bitpool;
+}
+
 #if ENABLE_FASTSTREAM
 
 static int sbc_set_a2dp_faststream(sbc_t *sbc,
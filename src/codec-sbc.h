@@ -32,6 +32,28 @@
 
 uint8_t sbc_a2dp_get_bitpool(const a2dp_sbc_t *conf, unsigned int quality);
 
+/* The number of packets queued in the BT socket
+ * which indicates the link congestion. */
+#define SBC_BITPOOL_CTRL_CONGESTION 3
+
+struct sbc_bitpool_ctrl {
+	/* allowed bit-pool range */
+	uint8_t min;
+	uint8_t max;
+	/* currently selected bit-pool */
+	uint8_t bitpool;
+	/* packets without congestion required for probing */
+	unsigned int probe;
+	/* packets sent without congestion */
+	unsigned int clear;
+	/* packets to drain before the next decrease */
+	unsigned int holdoff;
+};
+
+void sbc_bitpool_ctrl_init(struct sbc_bitpool_ctrl *ctrl,
+		uint8_t min, uint8_t max, unsigned int probe);
+bool sbc_bitpool_ctrl_update(struct sbc_bitpool_ctrl *ctrl, unsigned int queued);
+
 #if ENABLE_FASTSTREAM
 int sbc_init_a2dp_faststream(sbc_t *sbc, unsigned long flags,
 		const void *conf, size_t size, bool voice);
@@ -16,13 +16,22 @@
 #include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include <glib.h>
 
 #include "audio.h"
+#include "audio-resampler.h"
+#include "ba-broadcast.h"
 #include "ba-config.h"
+#include "ba-mix.h"
+#include "ba-transport.h"
+#include "trace.h"
 #include "shared/defs.h"
 #include "shared/ffb.h"
 #include "shared/log.h"
@@ -53,6 +62,8 @@ retry:
 			ret = 0;
 	}
 
+	if (ret > 0)
+		trace_event(BA_TRACE_EVENT_BT_READ, ret, 0);
 	if (ret == 0)
 		ba_transport_pcm_bt_release(pcm);
 
@@ -72,6 +83,11 @@ ssize_t io_bt_write(
 	const int fd = pcm->fd_bt;
 	ssize_t ret;
 
+	/* Encoded data might be shared with other members of the broadcast
+	 * group, in such case the broadcast group takes care of writing. */
+	if ((ret = ba_broadcast_bt_write(pcm, buffer, count)) != -1)
+		return ret;
+
 retry:
 	if ((ret = write(fd, buffer, count)) == -1)
 		switch (errno) {
@@ -96,6 +112,8 @@ retry:
 			ret = 0;
 		}
 
+	if (ret > 0)
+		trace_event(BA_TRACE_EVENT_BT_WRITE, ret, 0);
 	if (ret == 0)
 		ba_transport_pcm_bt_release(pcm);
 
@@ -103,20 +121,24 @@ retry:
 }
 
 /**
- * Scale PCM signal according to the volume configuration. */
-void io_pcm_scale(
+ * Get per-channel volume scaling factors for the PCM signal.
+ *
+ * @param pcm Transport PCM.
+ * @param scales Address of the array for scaling factors. The array shall
+ *   have at least as many elements as the PCM volume array.
+ * @return This function returns true if volume scaling is not required,
+ *   i.e. all scaling factors are equal to 1.0. */
+static bool io_pcm_get_volume_scales(
 		struct ba_transport_pcm *pcm,
-		void *buffer,
-		size_t samples) {
+		double *scales) {
 
 	pthread_mutex_lock(&pcm->mutex);
 
 	const unsigned int channels = pcm->channels;
 	const bool pcm_soft_volume = pcm->soft_volume;
 
-	double pcm_volume_ch_scales[ARRAYSIZE(pcm->volume)];
-	for (size_t i = 0; i < ARRAYSIZE(pcm_volume_ch_scales); i++)
-		pcm_volume_ch_scales[i] = pcm->volume[i].scale;
+	for (size_t i = 0; i < ARRAYSIZE(pcm->volume); i++)
+		scales[i] = pcm->volume[i].scale;
 
 	pthread_mutex_unlock(&pcm->mutex);
 
@@ -125,33 +147,274 @@ void io_pcm_scale(
 		 * because hardware muting is an equivalent of gain=0 which with some
 		 * headsets does not entirely silence audio. */
 		for (size_t i = 0; i < channels; i++)
-			if (pcm_volume_ch_scales[i] != 0.0)
-				pcm_volume_ch_scales[i] = 1.0;
+			if (scales[i] != 0.0)
+				scales[i] = 1.0;
 
-	bool identity = true;
 	/* Check whether volume scaling is required. */
 	for (size_t i = 0; i < channels; i++)
-		if (pcm_volume_ch_scales[i] != 1.0) {
-			identity = false;
-			break;
-		}
+		if (scales[i] != 1.0)
+			return false;
 
-	if (identity)
-		/* Nothing to do - volume is set to 100%. */
-		return;
+	return true;
+}
+
+/**
+ * Scale PCM signal in place. */
+static void io_pcm_scale_buffer(
+		uint16_t format,
+		void *buffer,
+		const double *scales,
+		unsigned int channels,
+		size_t samples) {
+	switch (format) {
+	case BA_TRANSPORT_PCM_FORMAT_S16_2LE:
+		audio_scale_s16_2le(buffer, scales, channels, samples / channels);
+		break;
+	case BA_TRANSPORT_PCM_FORMAT_S24_4LE:
+	case BA_TRANSPORT_PCM_FORMAT_S32_4LE:
+		audio_scale_s32_4le(buffer, scales, channels, samples / channels);
+		break;
+	default:
+		g_assert_not_reached();
+	}
+}
 
-	switch (pcm->format) {
+/**
+ * Scale PCM signal and store it in the destination buffer. */
+static void io_pcm_scale_copy(
+		uint16_t format,
+		void *dest,
+		const void *src,
+		const double *scales,
+		unsigned int channels,
+		size_t samples) {
+	switch (format) {
 	case BA_TRANSPORT_PCM_FORMAT_S16_2LE:
-		audio_scale_s16_2le(buffer, pcm_volume_ch_scales, channels, samples / channels);
+		audio_scale_copy_s16_2le(dest, src, scales, channels, samples / channels);
 		break;
 	case BA_TRANSPORT_PCM_FORMAT_S24_4LE:
 	case BA_TRANSPORT_PCM_FORMAT_S32_4LE:
-		audio_scale_s32_4le(buffer, pcm_volume_ch_scales, channels, samples / channels);
+		audio_scale_copy_s32_4le(dest, src, scales, channels, samples / channels);
 		break;
 	default:
 		g_assert_not_reached();
 	}
+}
+
+/**
+ * Scale PCM signal according to the volume configuration. */
+void io_pcm_scale(
+		struct ba_transport_pcm *pcm,
+		void *buffer,
+		size_t samples) {
+
+	double scales[ARRAYSIZE(pcm->volume)];
+	if (io_pcm_get_volume_scales(pcm, scales))
+		/* Nothing to do - volume is set to 100%. */
+		return;
+
+	io_pcm_scale_buffer(pcm->format, buffer, scales, pcm->channels, samples);
+
+}
+
+/**
+ * Get the stream format of the transport PCM FIFO. */
+static uint16_t io_pcm_client_format(const struct ba_transport_pcm *pcm) {
+	return pcm->client_format != 0 ? pcm->client_format : pcm->format;
+}
+
+/**
+ * Make sure that the scratch buffer is big enough. */
+static void *io_pcm_scratch_buffer(void **buffer, size_t *buffer_size, size_t size) {
+	if (*buffer_size < size) {
+		void *tmp;
+		if ((tmp = realloc(*buffer, size)) == NULL)
+			return NULL;
+		*buffer = tmp;
+		*buffer_size = size;
+	}
+	return *buffer;
+}
+
+/**
+ * Get the scratch buffer for the client format conversion. */
+static void *io_pcm_client_buffer(struct ba_transport_pcm *pcm, size_t size) {
+	return io_pcm_scratch_buffer(&pcm->client_buffer, &pcm->client_buffer_size, size);
+}
+
+/**
+ * Get a window in the sink ring for the zero-copy PCM FIFO write.
+ *
+ * Pages spliced into the PCM FIFO with vmsplice() are referenced by the
+ * kernel until the client reads them, so the returned window must not
+ * overlap with data which might be still queued in the FIFO. Since every
+ * FIFO slot holds data from at most one write, it is enough to make the
+ * ring bigger than the number of FIFO slots times the largest write size.
+ *
+ * Note:
+ * If the client enlarges the FIFO after the ring has been created, queued
+ * audio might be overwritten. This does not happen with BlueALSA clients.
+ *
+ * @return On success, this function returns the address of the window. If
+ *   the PCM FIFO is not a pipe or the ring could not be allocated, NULL is
+ *   returned and the caller shall fall back to a regular write. */
+static void *io_pcm_sink_ring_window(struct ba_transport_pcm *pcm, size_t size) {
+
+	if (pcm->sink_ring_disabled)
+		return NULL;
+
+	if (size > pcm->sink_ring_chunk) {
+
+		struct stat st;
+		int pipe_size;
+		if (fstat(pcm->fd, &st) == -1 || !S_ISFIFO(st.st_mode) ||
+				(pipe_size = fcntl(pcm->fd, F_GETPIPE_SZ)) == -1) {
+			pcm->sink_ring_disabled = true;
+			return NULL;
+		}
+
+		const size_t page_size = sysconf(_SC_PAGESIZE);
+		const size_t slots = DIV_ROUND_UP(pipe_size, page_size);
+		/* Account for the new window and the gap left on the ring wrap. */
+		const size_t ring_size = DIV_ROUND_UP((slots + 2) * size, page_size) * page_size;
+
+		void *ring;
+		if ((ring = mmap(NULL, ring_size, PROT_READ | PROT_WRITE,
+						MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) {
+			warn("Couldn't allocate PCM sink ring: %s", strerror(errno));
+			return NULL;
+		}
+
+		/* Pages which are still queued in the FIFO are pinned by
+		 * the kernel, so it is safe to unmap the old ring here. */
+		if (pcm->sink_ring != NULL)
+			munmap(pcm->sink_ring, pcm->sink_ring_size);
+
+		debug("PCM sink ring [%d]: %zu bytes", pcm->fd, ring_size);
+		pcm->sink_ring = ring;
+		pcm->sink_ring_size = ring_size;
+		pcm->sink_ring_chunk = size;
+		pcm->sink_ring_head = 0;
+
+	}
+
+	if (pcm->sink_ring_head + size > pcm->sink_ring_size)
+		pcm->sink_ring_head = 0;
+
+	void *window = (uint8_t *)pcm->sink_ring + pcm->sink_ring_head;
+	pcm->sink_ring_head += size;
+
+	return window;
+}
+
+/**
+ * Convert PCM signal between two stream formats.
+ *
+ * Supported are signed little-endian integer formats with 2 or 4 bytes
+ * per sample and the 32-bit float format. The conversion is done in a
+ * single pass, without any intermediate format. */
+static void io_pcm_convert(
+		void *dest,
+		uint16_t dest_format,
+		const void *src,
+		uint16_t src_format,
+		size_t samples) {
+
+	const unsigned int dest_width = BA_TRANSPORT_PCM_FORMAT_WIDTH(dest_format);
+	const unsigned int src_width = BA_TRANSPORT_PCM_FORMAT_WIDTH(src_format);
+	const bool dest_16 = BA_TRANSPORT_PCM_FORMAT_BYTES(dest_format) == 2;
+	const bool src_16 = BA_TRANSPORT_PCM_FORMAT_BYTES(src_format) == 2;
+
+	if (BA_TRANSPORT_PCM_FORMAT_FLOAT(src_format)) {
+		if (dest_16)
+			audio_convert_f32_4le_to_s16_2le(dest, src, samples);
+		else
+			audio_convert_f32_4le_to_s32_4le(dest, src, dest_width, samples);
+	}
+	else if (BA_TRANSPORT_PCM_FORMAT_FLOAT(dest_format)) {
+		if (src_16)
+			audio_convert_s16_2le_to_f32_4le(dest, src, samples);
+		else
+			audio_convert_s32_4le_to_f32_4le(dest, src, src_width, samples);
+	}
+	else if (src_16) {
+		if (dest_16)
+			memcpy(dest, src, samples * sizeof(int16_t));
+		else
+			audio_convert_s16_2le_to_s32_4le(dest, src, dest_width, samples);
+	}
+	else {
+		if (dest_16)
+			audio_convert_s32_4le_to_s16_2le(dest, src, src_width, samples);
+		else
+			audio_convert_s32_4le_to_s32_4le(dest, dest_width, src, src_width, samples);
+	}
+
+}
+
+/**
+ * Resample PCM signal to the client sample rate.
+ *
+ * The resampler is initialized on the first use and whenever the transport
+ * PCM rate or the number of channels changes (e.g. after the HFP codec has
+ * been switched), so the client stream rate stays the same.
+ *
+ * @param pcm Transport PCM.
+ * @param buffer Address of the signal in the transport PCM format.
+ * @param samples The number of samples in the buffer.
+ * @param samples_out Address where the number of resampled samples will
+ *   be stored. It might be 0 if the resampler needs more input.
+ * @return On success, this function returns the address of the resampled
+ *   FLOAT_LE signal. Otherwise, NULL is returned. */
+static const float *io_pcm_resample(
+		struct ba_transport_pcm *pcm,
+		const void *buffer,
+		size_t samples,
+		size_t *samples_out) {
+
+	struct audio_resampler *r = &pcm->resampler;
+	const unsigned int channels = pcm->channels;
+
+	if (r->channels != channels ||
+			r->rate_in != pcm->rate ||
+			r->rate_out != pcm->client_rate) {
+		audio_resampler_free(r);
+		if (audio_resampler_init(r, channels, pcm->rate, pcm->client_rate) == -1) {
+			error("Couldn't initialize PCM resampler: %s", strerror(errno));
+			return NULL;
+		}
+		debug("PCM resampler [%d]: %u Hz -> %u Hz: taps=%u phases=%u",
+				pcm->fd, r->rate_in, r->rate_out, r->taps, r->up);
+	}
+
+	const size_t frames = samples / channels;
+	const size_t out_samples_max = audio_resampler_frames_out_max(r, frames) * channels;
+	const bool is_float = pcm->format == BA_TRANSPORT_PCM_FORMAT_F32_4LE;
+
+	float *scratch;
+	if ((scratch = io_pcm_scratch_buffer((void **)&pcm->resampler_buffer,
+					&pcm->resampler_buffer_size,
+					((is_float ? 0 : samples) + out_samples_max) * sizeof(float))) == NULL)
+		return NULL;
+
+	const float *src = buffer;
+	float *dest = scratch;
 
+	/* Convert the signal to FLOAT in front of the output. */
+	if (!is_float) {
+		io_pcm_convert(scratch, BA_TRANSPORT_PCM_FORMAT_F32_4LE, buffer, pcm->format, samples);
+		src = scratch;
+		dest = scratch + samples;
+	}
+
+	ssize_t rv;
+	if ((rv = audio_resampler_process(r, dest, src, frames)) == -1) {
+		error("Couldn't resample PCM: %s", strerror(errno));
+		return NULL;
+	}
+
+	*samples_out = rv * channels;
+	return dest;
 }
 
 /**
@@ -164,7 +427,7 @@ ssize_t io_pcm_flush(struct ba_transport_pcm *pcm) {
 	pthread_mutex_lock(&pcm->mutex);
 
 	const int fd = pcm->fd;
-	const size_t sample_size = BA_TRANSPORT_PCM_FORMAT_BYTES(pcm->format);
+	const size_t sample_size = BA_TRANSPORT_PCM_FORMAT_BYTES(io_pcm_client_format(pcm));
 
 	while ((rv = splice(fd, NULL, config.null_fd, NULL, 32 * 1024, SPLICE_F_NONBLOCK)) > 0) {
 		debug("Flushed PCM samples [%d]: %zd", fd, rv / sample_size);
@@ -189,10 +452,20 @@ ssize_t io_pcm_read(
 	pthread_mutex_lock(&pcm->mutex);
 
 	const int fd = pcm->fd;
-	const size_t sample_size = BA_TRANSPORT_PCM_FORMAT_BYTES(pcm->format);
+	const uint16_t client_format = io_pcm_client_format(pcm);
+	const size_t sample_size = BA_TRANSPORT_PCM_FORMAT_BYTES(client_format);
+	void *client_buffer = buffer;
 	ssize_t ret;
 
-	while ((ret = read(fd, buffer, samples * sample_size)) == -1 &&
+	/* Read client samples into the scratch buffer, so they
+	 * can be converted directly into the transport format. */
+	if (client_format != pcm->format &&
+			(client_buffer = io_pcm_client_buffer(pcm, samples * sample_size)) == NULL) {
+		pthread_mutex_unlock(&pcm->mutex);
+		return -1;
+	}
+
+	while ((ret = read(fd, client_buffer, samples * sample_size)) == -1 &&
 			errno == EINTR)
 		continue;
 
@@ -201,33 +474,131 @@ ssize_t io_pcm_read(
 		ba_transport_pcm_release(pcm);
 	}
 
+	if (ret > 0 && client_buffer != buffer) {
+		io_pcm_convert(buffer, pcm->format, client_buffer, client_format, ret / sample_size);
+		ret = ret / sample_size * BA_TRANSPORT_PCM_FORMAT_BYTES(pcm->format);
+	}
+
+	if (ret > 0)
+		ba_broadcast_pcm_tee(pcm, buffer, ret);
+
+	const size_t pcm_sample_size = BA_TRANSPORT_PCM_FORMAT_BYTES(pcm->format);
 	pthread_mutex_unlock(&pcm->mutex);
 
 	if (ret <= 0)
 		return ret;
 
-	samples = ret / sample_size;
+	samples = ret / pcm_sample_size;
+	trace_event(BA_TRACE_EVENT_PCM_READ, samples, 0);
 	io_pcm_scale(pcm, buffer, samples);
 	return samples;
 }
 
 /**
- * Write PCM signal to the transport PCM FIFO. */
+ * Write PCM signal to the transport PCM FIFO.
+ *
+ * The PCM signal is scaled according to the volume configuration and it is
+ * converted to the client format and the client sample rate. If the signal
+ * has to be modified, the result is stored directly in the sink ring and
+ * spliced into the FIFO, so every sample is written only once. Please note,
+ * that the content of the given buffer might be modified by this function. */
 ssize_t io_pcm_write(
 		struct ba_transport_pcm *pcm,
-		const void *buffer,
+		void *buffer,
 		size_t samples) {
 
+	double scales[ARRAYSIZE(pcm->volume)];
+	bool identity = io_pcm_get_volume_scales(pcm, scales);
+
+	/* Feed the A2DP sink mix before writing to the PCM FIFO,
+	 * so the mix will not be affected by slow PCM client. */
+	if (config.a2dp.mix != NULL &&
+			pcm->t->profile == BA_TRANSPORT_PROFILE_A2DP_SINK) {
+		/* the mix shall receive volume-scaled signal */
+		if (!identity) {
+			io_pcm_scale_buffer(pcm->format, buffer, scales, pcm->channels, samples);
+			identity = true;
+		}
+		if (ba_mix_pcm_write(config.a2dp.mix, pcm, buffer, samples) == -1)
+			warn("Couldn't mix PCM: %s", strerror(errno));
+	}
+
 	pthread_mutex_lock(&pcm->mutex);
 
 	const int fd = pcm->fd;
-	const uint8_t *buffer_ = buffer;
-	size_t len = samples * BA_TRANSPORT_PCM_FORMAT_BYTES(pcm->format);
-	ssize_t ret;
+	const uint16_t client_format = io_pcm_client_format(pcm);
+	uint16_t format = pcm->format;
+	const void *src = buffer;
+	size_t src_samples = samples;
+	const uint8_t *buffer_;
+	size_t len;
+	bool splice = false;
+	ssize_t ret = samples;
+
+	/* PCM might be active only because of the A2DP sink mix */
+	if (fd == -1)
+		goto final;
+
+	if (pcm->client_rate != 0 && pcm->client_rate != pcm->rate) {
+
+		/* The resampler works on the FLOAT signal, so scale
+		 * the signal in place before the rate conversion. */
+		if (!identity) {
+			io_pcm_scale_buffer(pcm->format, buffer, scales, pcm->channels, samples);
+			identity = true;
+		}
+
+		if ((src = io_pcm_resample(pcm, buffer, samples, &src_samples)) == NULL) {
+			ret = -1;
+			goto final;
+		}
+
+		format = BA_TRANSPORT_PCM_FORMAT_F32_4LE;
+
+		/* Resampler needs more input frames. */
+		if (src_samples == 0)
+			goto final;
+
+	}
+
+	buffer_ = src;
+	len = src_samples * BA_TRANSPORT_PCM_FORMAT_BYTES(client_format);
+
+	if (!identity || client_format != format) {
+
+		/* There is no fused scale and convert routine, so in such
+		 * case scale the signal in place before the conversion. */
+		if (!identity && client_format != format) {
+			io_pcm_scale_buffer(pcm->format, buffer, scales, pcm->channels, samples);
+			identity = true;
+		}
+
+		void *dest;
+		if ((dest = io_pcm_sink_ring_window(pcm, len)) != NULL)
+			splice = true;
+		else if ((dest = io_pcm_client_buffer(pcm, len)) == NULL) {
+			ret = -1;
+			goto final;
+		}
+
+		if (identity)
+			io_pcm_convert(dest, client_format, src, format, src_samples);
+		else
+			io_pcm_scale_copy(pcm->format, dest, buffer, scales, pcm->channels, samples);
+
+		buffer_ = dest;
+	}
 
 	do {
 
-		if ((ret = write(fd, buffer_, len)) == -1)
+		if (splice) {
+			struct iovec iov = { .iov_base = (void *)buffer_, .iov_len = len };
+			ret = vmsplice(fd, &iov, 1, SPLICE_F_NONBLOCK);
+		}
+		else
+			ret = write(fd, buffer_, len);
+
+		if (ret == -1)
 			switch (errno) {
 			case EINTR:
 				continue;
@@ -258,6 +629,7 @@ ssize_t io_pcm_write(
 
 	/* It is guaranteed, that this function will write data atomically. */
 	ret = samples;
+	trace_event(BA_TRACE_EVENT_PCM_WRITE, src_samples, 0);
 
 final:
 	pthread_mutex_unlock(&pcm->mutex);
@@ -268,6 +640,10 @@ static void io_poll_drain_complete(
 		struct io_poll *io,
 		struct ba_transport_pcm *pcm) {
 
+	/* Encoded audio might be held back by the broadcast group
+	 * in order to align it with other group members. */
+	ba_broadcast_drain(pcm);
+
 	pthread_mutex_lock(&pcm->mutex);
 	pcm->drained = true;
 	pthread_mutex_unlock(&pcm->mutex);
@@ -298,6 +674,7 @@ repoll:
 	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
 	int poll_rv = poll(fds, ARRAYSIZE(fds), io->timeout);
 	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	trace_event(BA_TRACE_EVENT_POLL_WAKE, poll_rv, 0);
 
 	if (poll_rv == -1) {
 		if (errno == EINTR)
@@ -341,6 +718,7 @@ repoll:
 	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
 	int poll_rv = poll(fds, ARRAYSIZE(fds), io->timeout);
 	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	trace_event(BA_TRACE_EVENT_POLL_WAKE, poll_rv, 0);
 
 	/* Poll for reading with optional drain timeout. */
 	switch (poll_rv) {
@@ -425,6 +803,10 @@ repoll:
 	if (io->asrs.frames == 0)
 		asrsync_init(&io->asrs, pcm->rate);
 
+	/* Export the number of deadlines missed by this IO thread. */
+	atomic_store_explicit(&pcm->deadline_misses, io->asrs.misses,
+			memory_order_relaxed);
+
 	/* Mark the IO as tainted, so in case of a drain operation we will
 	 * flush any remaining frames in the encoder buffers to BT. */
 	io->tainted = true;
@@ -432,3 +814,106 @@ repoll:
 	ffb_seek(buffer, samples);
 	return samples;
 }
+
+/**
+ * Advance A2DP main stream clock.
+ *
+ * This function shall be called by the main stream decoder of the codec
+ * which supports the back-channel stream, after decoding PCM frames.
+ *
+ * @param t Transport structure.
+ * @param frames The number of decoded PCM frames. */
+void io_bc_clock_update(
+		struct ba_transport *t,
+		unsigned int frames) {
+
+	if (t->media.pcm_bc.channels == 0)
+		return;
+
+	pthread_mutex_lock(&t->media.clock.mutex);
+	t->media.clock.frames += frames;
+	pthread_mutex_unlock(&t->media.clock.mutex);
+
+	pthread_cond_signal(&t->media.clock.cond);
+
+}
+
+/**
+ * Synchronize A2DP back-channel stream with the main stream clock.
+ *
+ * This function shall be used by the back-channel encoder instead of the
+ * asrsync_sync() function. As long as the main stream clock is running,
+ * the back-channel waits for the main stream to catch up with the number
+ * of transferred PCM frames, so both streams are paced by the clock of the
+ * remote device. When the main stream clock stops (e.g. the main stream is
+ * not decoded), the back-channel falls back to the local clock.
+ *
+ * @param io IO polling structure of the back-channel encoder.
+ * @param pcm Back-channel PCM structure.
+ * @param frames The number of transferred PCM frames. */
+void io_bc_sync(
+		struct io_poll *io,
+		struct ba_transport_pcm *pcm,
+		unsigned int frames) {
+
+	struct ba_transport *t = pcm->t;
+	const unsigned int rate = t->media.pcm.rate;
+	/* maximal lag of the back-channel before re-synchronization */
+	const uint64_t lag_max = rate / 10;
+
+	pthread_mutex_lock(&t->media.clock.mutex);
+
+	if (!t->media.clock.bc_coupled) {
+		if (t->media.clock.frames != t->media.clock.bc_base) {
+			/* Main stream clock has started, so use it from now on. */
+			t->media.clock.bc_base = t->media.clock.frames;
+			t->media.clock.bc_frames = 0;
+			t->media.clock.bc_coupled = true;
+		}
+		pthread_mutex_unlock(&t->media.clock.mutex);
+		asrsync_sync(&io->asrs, frames);
+		return;
+	}
+
+	t->media.clock.bc_frames += frames;
+	uint64_t target = t->media.clock.bc_base +
+		t->media.clock.bc_frames * rate / pcm->rate;
+
+	if (t->media.clock.frames > target + lag_max) {
+		/* The back-channel has not been transferring data for a while
+		 * (e.g. there was no data from the client), so we shall not try
+		 * to catch up with the main stream. */
+		t->media.clock.bc_base = t->media.clock.frames;
+		t->media.clock.bc_frames = 0;
+		target = t->media.clock.frames;
+	}
+
+	/* Do not wait for the main stream longer than twice
+	 * the duration of the transferred PCM frames. */
+	const unsigned int timeout_us = 2000000ULL * frames / pcm->rate;
+	const struct timespec timeout = {
+		.tv_sec = timeout_us / 1000000,
+		.tv_nsec = timeout_us % 1000000 * 1000 };
+
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	timespecadd(&deadline, &timeout, &deadline);
+
+	while (t->media.clock.frames < target)
+		if (pthread_cond_timedwait(&t->media.clock.cond,
+					&t->media.clock.mutex, &deadline) == ETIMEDOUT)
+			break;
+
+	const bool coupled = t->media.clock.frames >= target;
+	if (!coupled) {
+		/* Main stream clock has stopped, fall back to the local clock. */
+		t->media.clock.bc_base = t->media.clock.frames;
+		t->media.clock.bc_coupled = false;
+	}
+
+	pthread_mutex_unlock(&t->media.clock.mutex);
+
+	if (!coupled)
+		asrsync_init(&io->asrs, pcm->rate);
+
+}
@@ -66,7 +66,7 @@ ssize_t io_pcm_read(
 
 ssize_t io_pcm_write(
 		struct ba_transport_pcm *pcm,
-		const void *buffer,
+		void *buffer,
 		size_t samples);
 
 ssize_t io_poll_and_read_bt(
@@ -79,4 +79,13 @@ ssize_t io_poll_and_read_pcm(
 		struct ba_transport_pcm *pcm,
 		ffb_t *buffer);
 
+void io_bc_clock_update(
+		struct ba_transport *t,
+		unsigned int frames);
+
+void io_bc_sync(
+		struct io_poll *io,
+		struct ba_transport_pcm *pcm,
+		unsigned int frames);
+
 #endif
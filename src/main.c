@@ -12,6 +12,7 @@
 # include <config.h>
 #endif
 
+#include <errno.h>
 #include <getopt.h>
 #include <libgen.h>
 #include <sched.h>
@@ -20,7 +21,9 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <strings.h>
+#include <sys/mman.h>
 #include <syslog.h>
 #include <time.h>
 #include <unistd.h>
@@ -39,12 +42,20 @@
 #endif
 
 #include "a2dp.h"
+#if ENABLE_CODEC_MODULES
+# include "a2dp-module.h"
+#endif
 #include "a2dp-sbc.h"
 #include "audio.h"
 #include "ba-config.h"
+#include "ba-mix.h"
+#include "ba-rfcomm.h"
 #include "bluealsa-dbus.h"
 #include "bluealsa-iface.h"
 #include "bluez.h"
+#if ENABLE_LC3_SWB
+# include "codec-lc3-swb.h"
+#endif
 #include "codec-sbc.h"
 #include "hfp.h"
 #if ENABLE_OFONO
@@ -54,6 +65,7 @@
 #if ENABLE_UPOWER
 # include "upower.h"
 #endif
+#include "utils.h"
 #include "shared/a2dp-codecs.h"
 #include "shared/defs.h"
 #include "shared/log.h"
@@ -125,6 +137,8 @@ static void g_bus_name_acquired(GDBusConnection *conn, const char *name, void *u
 	dbus_name_acquired = true;
 
 	bluealsa_dbus_register();
+	if (config.a2dp.mix != NULL)
+		bluealsa_dbus_mix_register(config.a2dp.mix);
 
 	bluez_init();
 #if ENABLE_OFONO
@@ -166,13 +180,21 @@ int main(int argc, char **argv) {
 		{ "profile", required_argument, NULL, 'p' },
 		{ "codec", required_argument, NULL, 'c' },
 		{ "all-codecs", no_argument, NULL, 25 },
+#if ENABLE_CODEC_MODULES
+		{ "codec-modules-dir", required_argument, NULL, 28 },
+#endif
 		{ "initial-volume", required_argument, NULL, 17 },
 		{ "keep-alive", required_argument, NULL, 8 },
 		{ "io-rt-priority", required_argument, NULL, 3 },
+		{ "cpu-affinity", required_argument, NULL, 29 },
+		{ "mlock", no_argument, NULL, 30 },
 		{ "disable-realtek-usb-fix", no_argument, NULL, 21 },
 		{ "a2dp-force-mono", no_argument, NULL, 6 },
 		{ "a2dp-force-audio-cd", no_argument, NULL, 7 },
+		{ "a2dp-sink-mix", no_argument, NULL, 26 },
+		{ "a2dp-sink-mix-ducking", required_argument, NULL, 27 },
 		{ "sbc-quality", required_argument, NULL, 14 },
+		{ "sbc-dynamic-bitpool", no_argument, NULL, 39 },
 #if ENABLE_AAC
 		{ "aac-afterburner", no_argument, NULL, 4 },
 		{ "aac-bitrate", required_argument, NULL, 5 },
@@ -182,6 +204,8 @@ int main(int argc, char **argv) {
 #endif
 #if ENABLE_LC3PLUS
 		{ "lc3plus-bitrate", required_argument, NULL, 20 },
+		{ "lc3plus-low-latency", no_argument, NULL, 37 },
+		{ "lc3plus-packet-interval", required_argument, NULL, 38 },
 #endif
 #if ENABLE_LDAC
 		{ "ldac-abr", no_argument, NULL, 10 },
@@ -191,12 +215,20 @@ int main(int argc, char **argv) {
 		// TODO: LLAC/V3/V4, bit depth, sample frequency, LLAC bitrate
 		{ "lhdc-quality", required_argument, NULL, 24 },
 #endif
+#if ENABLE_OPUS
+		{ "opus-bitrate", required_argument, NULL, 32 },
+		{ "opus-complexity", required_argument, NULL, 33 },
+		{ "opus-dtx", no_argument, NULL, 34 },
+		{ "opus-fec", no_argument, NULL, 35 },
+		{ "opus-packet-loss", required_argument, NULL, 36 },
+#endif
 #if ENABLE_MP3LAME
 		{ "mp3-algorithm", required_argument, NULL, 12 },
 		{ "mp3-vbr-quality", required_argument, NULL, 13 },
 #endif
 #if ENABLE_MIDI
 		{ "midi-advertisement", no_argument, NULL, 22 },
+		{ "midi-latency", required_argument, NULL, 31 },
 #endif
 		{ "xapl-resp-name", required_argument, NULL, 16 },
 		{ 0, 0, 0, 0 },
@@ -216,6 +248,11 @@ int main(int argc, char **argv) {
 	};
 
 	bool syslog = false;
+	bool a2dp_sink_mix = false;
+	int a2dp_sink_mix_ducking = 0;
+#if ENABLE_CODEC_MODULES
+	const char *codec_modules_dir = BLUEALSA_CODEC_MODULES_DIR;
+#endif
 	char dbus_service[32] = BLUEALSA_SERVICE;
 
 	/* Check if syslog forwarding has been enabled. This check has to be
@@ -237,13 +274,21 @@ int main(int argc, char **argv) {
 					"  -p, --profile=NAME\t\tset enabled BT profiles\n"
 					"  -c, --codec=NAME\t\tset enabled BT audio codecs\n"
 					"  --all-codecs\t\t\tenable all available BT audio codecs\n"
+#if ENABLE_CODEC_MODULES
+					"  --codec-modules-dir=DIR\tload A2DP codec modules from DIR\n"
+#endif
 					"  --initial-volume=NUM\t\tinitial volume level [0-100]\n"
 					"  --keep-alive=SEC\t\tkeep Bluetooth transport alive\n"
 					"  --io-rt-priority=NUM\t\treal-time priority for IO threads\n"
+					"  --cpu-affinity=THREAD:CPUS\tset CPU affinity for threads\n"
+					"  --mlock\t\t\tlock memory to prevent swapping\n"
 					"  --disable-realtek-usb-fix\tdisable fix for mSBC on Realtek USB\n"
 					"  --a2dp-force-mono\t\ttry to force monophonic sound\n"
 					"  --a2dp-force-audio-cd\t\ttry to force 44.1 kHz sampling\n"
+					"  --a2dp-sink-mix\t\texport mix of all A2DP sink PCMs\n"
+					"  --a2dp-sink-mix-ducking=DB\tattenuation of background sources\n"
 					"  --sbc-quality=MODE\t\tset SBC encoder quality mode\n"
+					"  --sbc-dynamic-bitpool\t\tadapt SBC bit-pool to link congestion\n"
 #if ENABLE_AAC
 					"  --aac-afterburner\t\tenable FDK AAC afterburner\n"
 					"  --aac-bitrate=BPS\t\tCBR bitrate or max peak for VBR\n"
@@ -253,6 +298,8 @@ int main(int argc, char **argv) {
 #endif
 #if ENABLE_LC3PLUS
 					"  --lc3plus-bitrate=BPS\t\tset LC3plus encoder CBR bitrate\n"
+					"  --lc3plus-low-latency\t\tprefer LC3plus low-latency frames\n"
+					"  --lc3plus-packet-interval=MS\tset LC3plus RTP packet interval\n"
 #endif
 #if ENABLE_LDAC
 					"  --ldac-abr\t\t\tenable LDAC adaptive bit rate\n"
@@ -261,12 +308,20 @@ int main(int argc, char **argv) {
 #if ENABLE_LHDC
 					"  --lhdc-quality=MODE\t\tset LHDC encoder quality mode\n"
 #endif
+#if ENABLE_OPUS
+					"  --opus-bitrate=BPS\t\tset Opus encoder bitrate per channel\n"
+					"  --opus-complexity=NUM\t\tset Opus encoder complexity\n"
+					"  --opus-dtx\t\t\tenable Opus discontinuous transmission\n"
+					"  --opus-fec\t\t\tenable Opus in-band forward error correction\n"
+					"  --opus-packet-loss=PERC\tset minimal expected packet loss\n"
+#endif
 #if ENABLE_MP3LAME
 					"  --mp3-algorithm=TYPE\t\tselect LAME encoder algorithm type\n"
 					"  --mp3-vbr-quality=MODE\tset LAME encoder VBR quality mode\n"
 #endif
 #if ENABLE_MIDI
 					"  --midi-advertisement\t\tenable LE advertisement for BLE-MIDI\n"
+					"  --midi-latency=MSEC\t\tset BLE-MIDI input latency\n"
 #endif
 					"  --xapl-resp-name=NAME\t\tset product name used by XAPL\n"
 					"\nAvailable BT profiles:\n"
@@ -430,6 +485,12 @@ int main(int argc, char **argv) {
 			break;
 		}
 
+#if ENABLE_CODEC_MODULES
+		case 28 /* --codec-modules-dir=DIR */ :
+			codec_modules_dir = optarg;
+			break;
+#endif
+
 		case 17 /* --initial-volume=NUM */ : {
 			unsigned int vol = atoi(optarg);
 			if (vol > 100) {
@@ -455,6 +516,50 @@ int main(int argc, char **argv) {
 			}
 			break;
 
+		case 29 /* --cpu-affinity=THREAD:CPUS */ : {
+
+			static const struct {
+				const char *name;
+				cpu_set_t *ptr;
+			} threads[] = {
+				{ "main", &config.cpu_affinity.main },
+				{ "a2dp", &config.cpu_affinity.a2dp },
+				{ "sco", &config.cpu_affinity.sco },
+				{ "rfcomm", &config.cpu_affinity.rfcomm },
+				{ "sco-dispatcher", &config.cpu_affinity.sco_dispatcher },
+				{ "midi", &config.cpu_affinity.midi },
+			};
+
+			const char *cpus;
+			if ((cpus = strchr(optarg, ':')) == NULL) {
+				error("Invalid CPU affinity {THREAD:CPUS}: %s", optarg);
+				return EXIT_FAILURE;
+			}
+
+			size_t i;
+			const size_t len = cpus - optarg;
+			for (i = 0; i < ARRAYSIZE(threads); i++)
+				if (strlen(threads[i].name) == len &&
+						strncasecmp(optarg, threads[i].name, len) == 0)
+					break;
+
+			if (i == ARRAYSIZE(threads)) {
+				error("Invalid CPU affinity thread {main, a2dp, sco, rfcomm, sco-dispatcher, midi}: %s", optarg);
+				return EXIT_FAILURE;
+			}
+
+			if (cpu_set_parse(cpus + 1, threads[i].ptr) == -1) {
+				error("Invalid CPU affinity list: %s", cpus + 1);
+				return EXIT_FAILURE;
+			}
+
+			break;
+		}
+
+		case 30 /* --mlock */ :
+			config.mlock = true;
+			break;
+
 		case 21 /* --disable-realtek-usb-fix */ :
 			config.disable_realtek_usb_fix = true;
 			break;
@@ -466,6 +571,19 @@ int main(int argc, char **argv) {
 			config.a2dp.force_44100 = true;
 			break;
 
+		case 26 /* --a2dp-sink-mix */ :
+			a2dp_sink_mix = true;
+			break;
+		case 27 /* --a2dp-sink-mix-ducking=DB */ : {
+			const double ducking = atof(optarg);
+			if (ducking < 0 || ducking > 96) {
+				error("Invalid A2DP sink mix ducking [0, 96]: %s", optarg);
+				return EXIT_FAILURE;
+			}
+			a2dp_sink_mix_ducking = ducking * 100;
+			break;
+		}
+
 		case 14 /* --sbc-quality=MODE */ : {
 
 			static const nv_entry_t values[] = {
@@ -487,6 +605,9 @@ int main(int argc, char **argv) {
 			config.sbc_quality = entry->v.ui;
 			break;
 		}
+		case 39 /* --sbc-dynamic-bitpool */ :
+			config.sbc_dynamic_bitpool = true;
+			break;
 
 #if ENABLE_AAC
 		case 4 /* --aac-afterburner */ :
@@ -516,6 +637,18 @@ int main(int argc, char **argv) {
 		case 20 /* --lc3plus-bitrate=BPS */ :
 			config.lc3plus_bitrate = atoi(optarg);
 			break;
+		case 37 /* --lc3plus-low-latency */ :
+			config.lc3plus_low_latency = true;
+			break;
+		case 38 /* --lc3plus-packet-interval=MS */ : {
+			const double interval = atof(optarg);
+			if (interval < 0 || interval > 20) {
+				error("Invalid LC3plus packet interval [0, 20]: %s", optarg);
+				return EXIT_FAILURE;
+			}
+			config.lc3plus_packet_dms = interval * 10;
+			break;
+		}
 #endif
 
 #if ENABLE_LDAC
@@ -571,6 +704,42 @@ int main(int argc, char **argv) {
 		}
 #endif
 
+#if ENABLE_OPUS
+		case 32 /* --opus-bitrate=BPS */ : {
+			const int bitrate = atoi(optarg);
+			if (bitrate < 6000 || bitrate > 256000) {
+				error("Invalid Opus bitrate [6000, 256000]: %s", optarg);
+				return EXIT_FAILURE;
+			}
+			config.opus_bitrate = bitrate;
+			break;
+		}
+		case 33 /* --opus-complexity=NUM */ : {
+			const int complexity = atoi(optarg);
+			if (complexity < 0 || complexity > 10) {
+				error("Invalid Opus complexity [0, 10]: %s", optarg);
+				return EXIT_FAILURE;
+			}
+			config.opus_complexity = complexity;
+			break;
+		}
+		case 34 /* --opus-dtx */ :
+			config.opus_dtx = true;
+			break;
+		case 35 /* --opus-fec */ :
+			config.opus_fec = true;
+			break;
+		case 36 /* --opus-packet-loss=PERC */ : {
+			const int loss = atoi(optarg);
+			if (loss < 0 || loss > 100) {
+				error("Invalid Opus packet loss percentage [0, 100]: %s", optarg);
+				return EXIT_FAILURE;
+			}
+			config.opus_packet_loss = loss;
+			break;
+		}
+#endif
+
 #if ENABLE_MP3LAME
 		case 12 /* --mp3-algorithm=TYPE */ : {
 
@@ -620,6 +789,15 @@ int main(int argc, char **argv) {
 		case 22 /* --midi-advertisement */ :
 			config.midi.advertise = true;
 			break;
+		case 31 /* --midi-latency=MSEC */ : {
+			const int latency = atoi(optarg);
+			if (latency < 0 || latency > 1000) {
+				error("Invalid BLE-MIDI latency [0, 1000]: %s", optarg);
+				return EXIT_FAILURE;
+			}
+			config.midi.latency = latency;
+			break;
+		}
 #endif
 
 		case 16 /* --xapl-resp-name=NAME */ :
@@ -649,6 +827,40 @@ int main(int argc, char **argv) {
 	}
 #endif
 
+	if (CPU_COUNT(&config.cpu_affinity.main) > 0) {
+
+		/* All threads inherit CPU affinity of the thread which creates them.
+		 * Since most of our threads are created by the main thread (or D-Bus
+		 * worker threads), threads without explicit CPU affinity shall use
+		 * the CPU affinity of the process instead of the main one. */
+		cpu_set_t cpus;
+		if (sched_getaffinity(0, sizeof(cpus), &cpus) == 0) {
+			cpu_set_t *sets[] = {
+				&config.cpu_affinity.a2dp,
+				&config.cpu_affinity.sco,
+				&config.cpu_affinity.rfcomm,
+				&config.cpu_affinity.sco_dispatcher,
+				&config.cpu_affinity.midi };
+			for (size_t i = 0; i < ARRAYSIZE(sets); i++)
+				if (CPU_COUNT(sets[i]) == 0)
+					*sets[i] = cpus;
+		}
+
+		/* Set main thread affinity before the D-Bus connection is created,
+		 * so the GDBus worker thread will inherit it. */
+		int ret;
+		if ((ret = thread_set_cpu_affinity(config.main_thread,
+						&config.cpu_affinity.main)) != 0)
+			warn("Couldn't set main thread CPU affinity: %s", strerror(ret));
+
+	}
+
+	/* Lock memory pages, so the IO threads will not be stalled by page
+	 * faults. Locked mappings are populated by the kernel, so IO buffers
+	 * and thread stacks are prefaulted at the allocation time. */
+	if (config.mlock && mlockall(MCL_CURRENT | MCL_FUTURE) == -1)
+		warn("Couldn't lock memory: %s", strerror(errno));
+
 	/* initialize random number generator */
 	srandom(time(NULL));
 
@@ -683,6 +895,26 @@ int main(int argc, char **argv) {
 	if (a2dp_seps_init() == -1)
 		return EXIT_FAILURE;
 
+#if ENABLE_LC3_SWB
+	/* Do not advertise LC3-SWB over HFP if the codec library is not
+	 * available, otherwise the SCO link could not be set up. */
+	if (config.hfp.codecs.lc3_swb && codec_lib_probe(&codec_lib_lc3) != 0) {
+		warn("Disabling LC3-SWB: Codec library not available");
+		config.hfp.codecs.lc3_swb = false;
+	}
+#endif
+
+#if ENABLE_CODEC_MODULES
+	if (a2dp_modules_load(codec_modules_dir) == -1 && errno != ENOENT)
+		warn("Couldn't load codec modules: %s: %s", codec_modules_dir, strerror(errno));
+#endif
+
+	if (a2dp_sink_mix &&
+			(config.a2dp.mix = ba_mix_new(48000, a2dp_sink_mix_ducking)) == NULL) {
+		error("Couldn't create A2DP sink mix: %s", strerror(errno));
+		return EXIT_FAILURE;
+	}
+
 	const char *storage_base_dir = BLUEALSA_STORAGE_DIR;
 #if ENABLE_SYSTEMD
 	const char *systemd_state_dir;
@@ -712,6 +944,16 @@ int main(int argc, char **argv) {
 
 	/* cleanup internal structures */
 	bluez_destroy();
+	ba_rfcomm_engine_stop();
+
+	if (config.a2dp.mix != NULL) {
+		bluealsa_dbus_mix_unregister(config.a2dp.mix);
+		ba_mix_free(config.a2dp.mix);
+	}
+
+#if ENABLE_CODEC_MODULES
+	a2dp_modules_unload();
+#endif
 
 	storage_destroy();
 	g_dbus_connection_close_sync(config.dbus, NULL, NULL);
@@ -12,9 +12,16 @@
 
 #include <errno.h>
 #include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -24,24 +31,80 @@
 #include <glib.h>
 
 #include "ba-adapter.h"
+#include "ba-config.h"
 #include "ba-device.h"
 #include "ba-transport.h"
 #include "ble-midi.h"
+#include "bluealsa-dbus.h"
 #include "utils.h"
+#include "shared/defs.h"
 #include "shared/log.h"
+#include "shared/rt.h"
+
+/**
+ * Identifiers of the file descriptors polled by the MIDI IO thread. */
+enum midi_poll_id {
+	MIDI_POLL_EVENT,
+	MIDI_POLL_ALSA_SEQ,
+	MIDI_POLL_BLE_MIDI,
+	MIDI_POLL_FLUSH,
+};
+
+/**
+ * Interval of flushing partially filled BLE-MIDI packets. BlueZ does not
+ * expose the connection interval of the GATT link, so the minimal BLE
+ * connection interval is used. Notifications sent more often than that
+ * are not transmitted any sooner, they only waste the link capacity. */
+#define MIDI_BLE_FLUSH_INTERVAL_US 7500
+
+/**
+ * Update the MIDI latency histogram with the given event time-stamp. */
+static void midi_latency_update(struct ba_transport *t, const struct timespec *ts) {
+
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	timespecsub(&now, ts, &now);
+
+	if (now.tv_sec < 0)
+		return;
+
+	size_t bucket = 0;
+	unsigned long v = (now.tv_sec * 1000000 + now.tv_nsec / 1000) / 125;
+	for (; v > 0 && bucket < BA_TRANSPORT_MIDI_LATENCY_BUCKETS - 1; v >>= 1)
+		bucket++;
+
+	atomic_fetch_add_explicit(&t->midi.latency[bucket], 1, memory_order_relaxed);
 
-static gboolean midi_watch_read_alsa_seq(G_GNUC_UNUSED GIOChannel *ch,
-		G_GNUC_UNUSED GIOCondition condition, void *userdata) {
+}
+
+/**
+ * Write out encoded BLE-MIDI packet to the notification link. */
+static void midi_ble_write(struct ba_transport *t) {
+	if (write(t->midi.ble_fd_notify, t->midi.ble_encoder.buffer,
+				t->midi.ble_encoder.len) != (ssize_t)t->midi.ble_encoder.len)
+		error("BLE-MIDI link write error: %s", strerror(errno));
+}
+
+/**
+ * Write out encoded BLE-MIDI packet and reset the encoder buffer. */
+static void midi_ble_flush(struct ba_transport *t) {
+	if (t->midi.ble_encoder.len > 0)
+		midi_ble_write(t);
+	t->midi.ble_encoder.len = 0;
+}
+
+static void midi_read_alsa_seq(struct ba_transport *t) {
 
-	struct ba_transport *t = userdata;
 	unsigned char buf[1024];
 	long len;
 	int rv;
 
+	pthread_mutex_lock(&t->midi.ble_notify_mtx);
+
 	if (t->midi.ble_fd_notify == -1) {
 		/* Drop all events if notification is not acquired. */
 		snd_seq_drop_input(t->midi.seq);
-		return TRUE;
+		goto final;
 	}
 
 	snd_seq_event_t *ev;
@@ -54,13 +117,13 @@ static gboolean midi_watch_read_alsa_seq(G_GNUC_UNUSED GIOChannel *ch,
 retry:
 			rv = ble_midi_encode(&t->midi.ble_encoder, buf, len);
 			if (rv == 1 || (rv == -1 && errno == EMSGSIZE)) {
-				/* Write out encoded BLE-MIDI packet to the socket. */
-				if (write(t->midi.ble_fd_notify, t->midi.ble_encoder.buffer,
-							t->midi.ble_encoder.len) != (ssize_t)t->midi.ble_encoder.len)
-					error("BLE-MIDI link write error: %s", strerror(errno));
-				if (rv == -1) {
-					/* Reset encoder state and try again. */
-					t->midi.ble_encoder.len = 0;
+				/* Write out filled BLE-MIDI packet to the socket. In case
+				 * of the system exclusive message continuation, the encoder
+				 * state shall not be modified. */
+				if (rv == 1)
+					midi_ble_write(t);
+				else {
+					midi_ble_flush(t);
 					goto retry;
 				}
 			}
@@ -71,43 +134,108 @@ retry:
 
 	}
 
-	/* Write out encoded BLE-MIDI packet to the socket. */
-	if (write(t->midi.ble_fd_notify, t->midi.ble_encoder.buffer,
-				t->midi.ble_encoder.len) != (ssize_t)t->midi.ble_encoder.len)
-		error("BLE-MIDI link write error: %s", strerror(errno));
+	/* Do not send partially filled BLE-MIDI packet right away. More MIDI
+	 * events might arrive before the next BLE connection event. */
+	if (t->midi.ble_encoder.len > 0 && !t->midi.ble_flush_pending) {
+		const struct itimerspec its = {
+			.it_value.tv_nsec = MIDI_BLE_FLUSH_INTERVAL_US * 1000 };
+		if (timerfd_settime(t->midi.timer_fd, 0, &its, NULL) == -1)
+			midi_ble_flush(t);
+		else
+			t->midi.ble_flush_pending = true;
+	}
+
+final:
+	pthread_mutex_unlock(&t->midi.ble_notify_mtx);
+}
+
+static void midi_flush_ble_midi(struct ba_transport *t) {
+
+	uint64_t expirations;
+	if (read(t->midi.timer_fd, &expirations, sizeof(expirations)) == -1)
+		return;
+
+	pthread_mutex_lock(&t->midi.ble_notify_mtx);
+
+	if (t->midi.ble_fd_notify != -1)
+		midi_ble_flush(t);
 	t->midi.ble_encoder.len = 0;
+	t->midi.ble_flush_pending = false;
 
-	return TRUE;
+	pthread_mutex_unlock(&t->midi.ble_notify_mtx);
 }
 
-static gboolean midi_watch_read_ble_midi(GIOChannel *ch,
-		G_GNUC_UNUSED GIOCondition condition, void *userdata) {
+static void midi_read_ble_midi(struct ba_transport *t) {
 
-	struct ba_transport *t = userdata;
-	GError *err = NULL;
 	uint8_t data[512];
+	char control[CMSG_SPACE(sizeof(struct timespec))];
+	struct iovec iov = { .iov_base = data, .iov_len = sizeof(data) };
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control,
+		.msg_controllen = sizeof(control) };
+	struct timespec ts = { 0 };
 	long encoded;
-	size_t len;
+	ssize_t len;
 	int rv;
 
-	switch (g_io_channel_read_chars(ch, (char *)data, sizeof(data), &len, &err)) {
-	case G_IO_STATUS_AGAIN:
-		return TRUE;
-	case G_IO_STATUS_ERROR:
-		error("BLE-MIDI link read error: %s", err->message);
-		g_error_free(err);
-		return TRUE;
-	case G_IO_STATUS_NORMAL:
-		break;
-	case G_IO_STATUS_EOF:
-		/* remove channel from watch */
-		return FALSE;
+	pthread_mutex_lock(&t->midi.ble_write_mtx);
+
+	/* The link might have been released or replaced by the D-Bus
+	 * thread while this poll event was pending. */
+	if (t->midi.ble_fd_write == -1) {
+		pthread_mutex_unlock(&t->midi.ble_write_mtx);
+		return;
+	}
+
+	if ((len = recvmsg(t->midi.ble_fd_write, &msg, 0)) == -1) {
+		if (errno != EAGAIN && errno != EINTR)
+			error("BLE-MIDI link read error: %s", strerror(errno));
+		pthread_mutex_unlock(&t->midi.ble_write_mtx);
+		return;
+	}
+
+	if (len == 0) {
+		debug("BLE-MIDI link closed: %d", t->midi.ble_fd_write);
+		/* remove link from the poll and release it */
+		epoll_ctl(t->midi.epoll_fd, EPOLL_CTL_DEL, t->midi.ble_fd_write, NULL);
+		close(t->midi.ble_fd_write);
+		t->midi.ble_fd_write = -1;
+		pthread_mutex_unlock(&t->midi.ble_write_mtx);
+		return;
+	}
+
+	pthread_mutex_unlock(&t->midi.ble_write_mtx);
+
+	/* Time-stamp of the packet reception (if enabled). */
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+			cmsg = CMSG_NXTHDR(&msg, cmsg))
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS)
+			memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+
+	/* Get the packet reception time relative to the decoder initialization
+	 * time, which is the time base of the ALSA sequencer queue. */
+	struct timespec arrival;
+	gettimestamp(&arrival);
+	if (!is_timespec_zero(&ts)) {
+		struct timespec now_rt, delay;
+		clock_gettime(CLOCK_REALTIME, &now_rt);
+		timespecsub(&now_rt, &ts, &delay);
+		if (delay.tv_sec >= 0)
+			timespecsub(&arrival, &delay, &arrival);
 	}
+	timespecsub(&arrival, &t->midi.ble_decoder.ts0, &arrival);
 
 	snd_seq_event_t ev = { 0 };
 	snd_seq_ev_set_source(&ev, t->midi.seq_port);
 	snd_seq_ev_set_subs(&ev);
 
+	/* The clock recovery shall be updated only with the timestamp of the
+	 * first MIDI message in the packet, which is not a continuation of the
+	 * system exclusive message from the previous packet. */
+	bool clock_update = len > 1 && data[1] & 0x80;
+
 	for (;;) {
 
 		if ((rv = ble_midi_decode(&t->midi.ble_decoder, data, len)) <= 0) {
@@ -124,9 +252,20 @@ static gboolean midi_watch_read_ble_midi(GIOChannel *ch,
 				continue;
 		}
 
+		if (clock_update) {
+			ble_midi_clock_update(&t->midi.ble_clock, &t->midi.ble_decoder.ts_sender, &arrival);
+			atomic_store_explicit(&t->midi.jitter, t->midi.ble_clock.jitter, memory_order_relaxed);
+			clock_update = false;
+		}
+
+		/* Schedule MIDI event at the recovered sender time plus constant
+		 * latency, so the BLE connection interval does not cause jitter. */
+		struct timespec ts_event;
+		ble_midi_clock_convert(&t->midi.ble_clock, &t->midi.ble_decoder.ts_sender, &ts_event);
+
 		snd_seq_real_time_t rt = {
-			.tv_sec = t->midi.ble_decoder.ts.tv_sec,
-			.tv_nsec = t->midi.ble_decoder.ts.tv_nsec };
+			.tv_sec = ts_event.tv_sec,
+			.tv_nsec = ts_event.tv_nsec };
 		snd_seq_ev_schedule_real(&ev, t->midi.seq_queue, 0, &rt);
 
 		if ((rv = snd_seq_event_output(t->midi.seq, &ev)) < 0)
@@ -137,7 +276,51 @@ static gboolean midi_watch_read_ble_midi(GIOChannel *ch,
 	if ((rv = snd_seq_drain_output(t->midi.seq)) < 0)
 		warn("Couldn't drain MIDI output: %s", snd_strerror(rv));
 
-	return TRUE;
+	if (!is_timespec_zero(&ts))
+		midi_latency_update(t, &ts);
+
+}
+
+/**
+ * MIDI IO thread.
+ *
+ * MIDI events are processed in a dedicated thread, so the MIDI latency does
+ * not depend on the main loop load (e.g. D-Bus traffic). */
+static void *midi_thread(struct ba_transport *t) {
+
+	struct epoll_event events[4];
+	int n;
+
+	debug("Starting MIDI IO loop: %s", ba_transport_debug_name(t));
+	for (;;) {
+
+		if ((n = epoll_wait(t->midi.epoll_fd, events, ARRAYSIZE(events), -1)) == -1) {
+			if (errno == EINTR)
+				continue;
+			error("MIDI IO poll error: %s", strerror(errno));
+			break;
+		}
+
+		for (int i = 0; i < n; i++)
+			switch (events[i].data.u32) {
+			case MIDI_POLL_EVENT:
+				goto exit;
+			case MIDI_POLL_ALSA_SEQ:
+				midi_read_alsa_seq(t);
+				break;
+			case MIDI_POLL_BLE_MIDI:
+				midi_read_ble_midi(t);
+				break;
+			case MIDI_POLL_FLUSH:
+				midi_flush_ble_midi(t);
+				break;
+			}
+
+	}
+
+exit:
+	debug("Exiting MIDI IO loop: %s", ba_transport_debug_name(t));
+	return NULL;
 }
 
 int midi_transport_alsa_seq_create(struct ba_transport *t) {
@@ -255,58 +438,120 @@ int midi_transport_start_watch_alsa_seq(struct ba_transport *t) {
 
 	debug("Starting ALSA sequencer IO watch: %d", pfd.fd);
 
-	GIOChannel *ch = g_io_channel_unix_new(pfd.fd);
-	g_io_channel_set_encoding(ch, NULL, NULL);
-	g_io_channel_set_buffered(ch, FALSE);
-	t->midi.watch_seq = g_io_create_watch_full(ch, G_PRIORITY_HIGH,
-			G_IO_IN, midi_watch_read_alsa_seq, ba_transport_ref(t),
-			(GDestroyNotify)ba_transport_unref);
-	g_io_channel_unref(ch);
-
 	ble_midi_encode_init(&t->midi.ble_encoder);
 
-	return 0;
+	struct epoll_event event = { .events = EPOLLIN, .data.u32 = MIDI_POLL_ALSA_SEQ };
+	return epoll_ctl(t->midi.epoll_fd, EPOLL_CTL_ADD, pfd.fd, &event);
 }
 
 int midi_transport_start_watch_ble_midi(struct ba_transport *t) {
 
 	debug("Starting BLE-MIDI IO watch: %d", t->midi.ble_fd_write);
 
-	GIOChannel *ch = g_io_channel_unix_new(t->midi.ble_fd_write);
-	g_io_channel_set_close_on_unref(ch, TRUE);
-	g_io_channel_set_encoding(ch, NULL, NULL);
-	g_io_channel_set_buffered(ch, FALSE);
-	t->midi.watch_ble = g_io_create_watch_full(ch, G_PRIORITY_HIGH,
-			G_IO_IN, midi_watch_read_ble_midi, ba_transport_ref(t),
-			(GDestroyNotify)ba_transport_unref);
-	g_io_channel_unref(ch);
+	/* Enable reception time-stamps for latency measurement. */
+	const int enable = 1;
+	if (setsockopt(t->midi.ble_fd_write, SOL_SOCKET, SO_TIMESTAMPNS,
+				&enable, sizeof(enable)) == -1)
+		warn("Couldn't enable BLE-MIDI time-stamps: %s", strerror(errno));
 
 	ble_midi_decode_init(&t->midi.ble_decoder);
+	ble_midi_clock_init(&t->midi.ble_clock, config.midi.latency);
+	t->midi.jitter = 0;
 	snd_seq_start_queue(t->midi.seq, t->midi.seq_queue, NULL);
 	snd_seq_drain_output(t->midi.seq);
 
-	return 0;
+	struct epoll_event event = { .events = EPOLLIN, .data.u32 = MIDI_POLL_BLE_MIDI };
+	return epoll_ctl(t->midi.epoll_fd, EPOLL_CTL_ADD, t->midi.ble_fd_write, &event);
 }
 
 int midi_transport_start(struct ba_transport *t) {
+
+	struct epoll_event event = { .events = EPOLLIN, .data.u32 = MIDI_POLL_EVENT };
+	struct epoll_event event_flush = { .events = EPOLLIN, .data.u32 = MIDI_POLL_FLUSH };
+	int ret;
+
+	if ((t->midi.epoll_fd = epoll_create1(EPOLL_CLOEXEC)) == -1 ||
+			(t->midi.event_fd = eventfd(0, EFD_CLOEXEC)) == -1 ||
+			(t->midi.timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK)) == -1 ||
+			epoll_ctl(t->midi.epoll_fd, EPOLL_CTL_ADD, t->midi.event_fd, &event) == -1 ||
+			epoll_ctl(t->midi.epoll_fd, EPOLL_CTL_ADD, t->midi.timer_fd, &event_flush) == -1) {
+		error("Couldn't create MIDI IO poll: %s", strerror(errno));
+		goto fail;
+	}
+
+	t->midi.ble_flush_pending = false;
+
+	for (size_t i = 0; i < ARRAYSIZE(t->midi.latency); i++)
+		t->midi.latency[i] = 0;
+
 	snd_midi_event_init(t->midi.seq_parser);
-	midi_transport_start_watch_alsa_seq(t);
+	if (midi_transport_start_watch_alsa_seq(t) == -1) {
+		error("Couldn't setup ALSA sequencer IO watch: %s", strerror(errno));
+		goto fail;
+	}
+
+	if ((ret = pthread_create(&t->midi.thread, NULL, PTHREAD_FUNC(midi_thread), t)) != 0) {
+		error("Couldn't create MIDI IO thread: %s", strerror(ret));
+		errno = ret;
+		goto fail;
+	}
+
+	/* See the ba_transport_pcm_start() function for information
+	 * why the real-time priority is not a fatal error. */
+	if (config.io_thread_rt_priority != 0) {
+		struct sched_param param = { .sched_priority = config.io_thread_rt_priority };
+		if ((ret = pthread_setschedparam(t->midi.thread, SCHED_FIFO, &param)) != 0)
+			warn("Couldn't set MIDI IO thread RT priority: %s", strerror(ret));
+	}
+
+	if ((ret = thread_set_cpu_affinity(t->midi.thread, &config.cpu_affinity.midi)) != 0)
+		warn("Couldn't set MIDI IO thread CPU affinity: %s", strerror(ret));
+
+	pthread_setname_np(t->midi.thread, "ba-midi");
+	debug("Created new MIDI IO thread [%s]: %s", "ba-midi", ba_transport_debug_name(t));
+
+	t->midi.ba_dbus_path = g_strdup_printf("%s/midi", t->d->ba_dbus_path);
+	bluealsa_dbus_midi_register(t);
+
 	return 0;
+
+fail:
+	if (t->midi.timer_fd != -1)
+		close(t->midi.timer_fd);
+	if (t->midi.event_fd != -1)
+		close(t->midi.event_fd);
+	if (t->midi.epoll_fd != -1)
+		close(t->midi.epoll_fd);
+	t->midi.timer_fd = -1;
+	t->midi.event_fd = -1;
+	t->midi.epoll_fd = -1;
+	return -1;
 }
 
 int midi_transport_stop(struct ba_transport *t) {
 
-	if (t->midi.watch_seq != NULL) {
-		g_source_destroy(t->midi.watch_seq);
-		g_source_unref(t->midi.watch_seq);
-		t->midi.watch_seq = NULL;
-	}
-	if (t->midi.watch_ble != NULL) {
+	if (t->midi.epoll_fd == -1)
+		return 0;
+
+	bluealsa_dbus_midi_unregister(t);
+	g_free(t->midi.ba_dbus_path);
+	t->midi.ba_dbus_path = NULL;
+
+	/* Notify the IO thread that it shall terminate. */
+	eventfd_write(t->midi.event_fd, 1);
+	pthread_join(t->midi.thread, NULL);
+
+	pthread_mutex_lock(&t->midi.ble_write_mtx);
+	if (t->midi.ble_fd_write != -1)
 		snd_seq_stop_queue(t->midi.seq, t->midi.seq_queue, NULL);
-		g_source_destroy(t->midi.watch_ble);
-		g_source_unref(t->midi.watch_ble);
-		t->midi.watch_ble = NULL;
-	}
+	pthread_mutex_unlock(&t->midi.ble_write_mtx);
+
+	close(t->midi.timer_fd);
+	close(t->midi.event_fd);
+	close(t->midi.epoll_fd);
+	t->midi.timer_fd = -1;
+	t->midi.event_fd = -1;
+	t->midi.epoll_fd = -1;
 
 	return 0;
 }
@@ -15,6 +15,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "trace.h"
 #include "shared/defs.h"
 #include "shared/log.h"
 
@@ -109,6 +110,8 @@ void rtp_state_new_frame(
 	hdr->seq_number = htobe16(++rtp->seq_number);
 	hdr->timestamp = htobe32(timestamp);
 
+	trace_event(BA_TRACE_EVENT_RTP, rtp->seq_number, timestamp);
+
 }
 
 /**
@@ -129,6 +132,8 @@ void rtp_state_sync_stream(
 	uint16_t hdr_seq_number = be16toh(hdr->seq_number);
 	uint32_t hdr_timestamp = be32toh(hdr->timestamp);
 
+	trace_event(BA_TRACE_EVENT_RTP, hdr_seq_number, hdr_timestamp);
+
 	if (!rtp->synced) {
 		rtp->seq_number = hdr_seq_number;
 		rtp->ts_offset = hdr_timestamp;
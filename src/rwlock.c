@@ -0,0 +1,105 @@
+/*
+ * BlueALSA - rwlock.c
+ * Copyright (c) 2016-2025 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include "rwlock.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include "shared/log.h"
+#include "shared/rt.h"
+
+void rwlock_init(struct rwlock *l, const char *name) {
+	*l = (struct rwlock)RWLOCK_INITIALIZER(name);
+	pthread_rwlock_init(&l->lock, NULL);
+}
+
+void rwlock_destroy(struct rwlock *l) {
+	debug("Lock stats [%s]: rd=%u wr=%u contended=%u wait-max=%u us hold-max=%u us",
+			l->name,
+			atomic_load_explicit(&l->rd_count, memory_order_relaxed),
+			atomic_load_explicit(&l->wr_count, memory_order_relaxed),
+			atomic_load_explicit(&l->contended, memory_order_relaxed),
+			atomic_load_explicit(&l->wait_max_us, memory_order_relaxed),
+			atomic_load_explicit(&l->hold_max_us, memory_order_relaxed));
+	pthread_rwlock_destroy(&l->lock);
+}
+
+/**
+ * Get the time elapsed since the given time-stamp in microseconds. */
+static unsigned int rwlock_elapsed_us(const struct timespec *ts0) {
+	struct timespec ts;
+	gettimestamp(&ts);
+	timespecsub(&ts, ts0, &ts);
+	return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void rwlock_update_max(atomic_uint *max, unsigned int value) {
+	unsigned int current = atomic_load_explicit(max, memory_order_relaxed);
+	while (value > current && !atomic_compare_exchange_weak_explicit(max,
+				&current, value, memory_order_relaxed, memory_order_relaxed))
+		continue;
+}
+
+/**
+ * Acquire the lock in the shared mode.
+ *
+ * Time is measured only if the lock is not immediately available, so the
+ * uncontended path costs a single try-lock call. */
+void rwlock_rdlock(struct rwlock *l) {
+
+	atomic_fetch_add_explicit(&l->rd_count, 1, memory_order_relaxed);
+	if (pthread_rwlock_tryrdlock(&l->lock) == 0)
+		return;
+
+	struct timespec ts0;
+	gettimestamp(&ts0);
+	pthread_rwlock_rdlock(&l->lock);
+
+	atomic_fetch_add_explicit(&l->contended, 1, memory_order_relaxed);
+	rwlock_update_max(&l->wait_max_us, rwlock_elapsed_us(&ts0));
+
+}
+
+void rwlock_rdunlock(struct rwlock *l) {
+	pthread_rwlock_unlock(&l->lock);
+}
+
+/**
+ * Acquire the lock in the exclusive mode. */
+void rwlock_wrlock(struct rwlock *l) {
+
+	atomic_fetch_add_explicit(&l->wr_count, 1, memory_order_relaxed);
+	if (pthread_rwlock_trywrlock(&l->lock) != 0) {
+
+		struct timespec ts0;
+		gettimestamp(&ts0);
+		pthread_rwlock_wrlock(&l->lock);
+
+		atomic_fetch_add_explicit(&l->contended, 1, memory_order_relaxed);
+		rwlock_update_max(&l->wait_max_us, rwlock_elapsed_us(&ts0));
+
+	}
+
+	gettimestamp(&l->ts_wrlock);
+
+}
+
+void rwlock_wrunlock(struct rwlock *l) {
+
+	unsigned int hold_us = rwlock_elapsed_us(&l->ts_wrlock);
+	pthread_rwlock_unlock(&l->lock);
+
+	rwlock_update_max(&l->hold_max_us, hold_us);
+	if (hold_us > RWLOCK_HOLD_REPORT_THRESHOLD)
+		debug("Long exclusive hold of %s lock: %u us", l->name, hold_us);
+
+}
@@ -0,0 +1,86 @@
+/*
+ * BlueALSA - rwlock.h
+ * Copyright (c) 2016-2025 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#pragma once
+#ifndef BLUEALSA_RWLOCK_H_
+#define BLUEALSA_RWLOCK_H_
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <time.h>
+
+/**
+ * Write lock hold time (in microseconds) above which the lock holder
+ * is reported in the debug log. */
+#define RWLOCK_HOLD_REPORT_THRESHOLD 5000
+
+/**
+ * Read-write lock with contention and hold time instrumentation.
+ *
+ * This lock is used to guard object registries. Lookups take the lock in
+ * the shared mode, so they can run in parallel. Only the registry update
+ * (insertion or removal of an object) requires an exclusive access. */
+struct rwlock {
+
+	pthread_rwlock_t lock;
+	/* name used in the debug log */
+	const char *name;
+
+	/* exclusive lock acquisition time */
+	struct timespec ts_wrlock;
+
+	/* number of shared and exclusive acquisitions */
+	atomic_uint rd_count;
+	atomic_uint wr_count;
+	/* number of acquisitions which had to wait */
+	atomic_uint contended;
+	/* maximum wait time in microseconds */
+	atomic_uint wait_max_us;
+	/* maximum exclusive hold time in microseconds */
+	atomic_uint hold_max_us;
+
+};
+
+#define RWLOCK_INITIALIZER(name_) { \
+		.lock = PTHREAD_RWLOCK_INITIALIZER, .name = (name_) }
+
+void rwlock_init(struct rwlock *l, const char *name);
+void rwlock_destroy(struct rwlock *l);
+
+void rwlock_rdlock(struct rwlock *l);
+void rwlock_rdunlock(struct rwlock *l);
+void rwlock_wrlock(struct rwlock *l);
+void rwlock_wrunlock(struct rwlock *l);
+
+/**
+ * Drop the reference of a registry entry unless it is the last one.
+ *
+ * The last reference shall be dropped with the registry lock held in the
+ * exclusive mode, so the entry can be removed from the registry before any
+ * lookup might find it. All other references can be dropped without any
+ * locking at all.
+ *
+ * @param ref_count Address of the entry reference counter.
+ * @return This function returns true if the reference was dropped. */
+static inline bool rwlock_ref_dec_unless_last(atomic_int *ref_count) {
+	int value = atomic_load_explicit(ref_count, memory_order_relaxed);
+	while (value > 1)
+		if (atomic_compare_exchange_weak_explicit(ref_count, &value, value - 1,
+					memory_order_release, memory_order_relaxed))
+			return true;
+	return false;
+}
+
+#endif
@@ -126,7 +126,6 @@ void *sco_cvsd_dec_thread(struct ba_transport_pcm *t_pcm) {
 		if ((samples = ffb_blen_out(&buffer) / sizeof(int16_t)) <= 0)
 			continue;
 
-		io_pcm_scale(t_pcm, buffer.data, samples);
 		if ((samples = io_pcm_write(t_pcm, buffer.data, samples)) == -1)
 			error("PCM write error: %s", strerror(errno));
 		else if (samples == 0)
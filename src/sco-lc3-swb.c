@@ -26,6 +26,7 @@
 #include "bluealsa-dbus.h"
 #include "codec-lc3-swb.h"
 #include "io.h"
+#include "trace.h"
 #include "shared/defs.h"
 #include "shared/ffb.h"
 #include "shared/log.h"
@@ -40,6 +41,9 @@ void *sco_lc3_swb_enc_thread(struct ba_transport_pcm *t_pcm) {
 	struct io_poll io = { .timeout = -1 };
 	const size_t mtu_write = t->mtu_write;
 
+	if (codec_lib_load(&codec_lib_lc3) != 0)
+		goto exit;
+
 	struct esco_lc3_swb codec;
 	lc3_swb_init(&codec);
 
@@ -66,7 +70,14 @@ void *sco_lc3_swb_enc_thread(struct ba_transport_pcm *t_pcm) {
 		}
 
 		/* encode as much PCM data as possible */
-		while (lc3_swb_encode(&codec) > 0) {
+		while (ffb_len_out(&codec.pcm) >= LC3_SWB_CODESAMPLES) {
+
+			trace_event(BA_TRACE_EVENT_ENCODE_BEGIN, ffb_len_out(&codec.pcm), 0);
+			const ssize_t encoded = lc3_swb_encode(&codec);
+			trace_event(BA_TRACE_EVENT_ENCODE_END, encoded, codec.frames);
+
+			if (encoded <= 0)
+				break;
 
 			uint8_t *data = codec.data.data;
 			size_t data_len = ffb_blen_out(&codec.data);
@@ -118,6 +129,9 @@ void *sco_lc3_swb_dec_thread(struct ba_transport_pcm *t_pcm) {
 	struct ba_transport *t = t_pcm->t;
 	struct io_poll io = { .timeout = -1 };
 
+	if (codec_lib_load(&codec_lib_lc3) != 0)
+		goto exit;
+
 	struct esco_lc3_swb codec;
 	lc3_swb_init(&codec);
 
@@ -136,17 +150,18 @@ void *sco_lc3_swb_dec_thread(struct ba_transport_pcm *t_pcm) {
 		}
 
 		int err;
+		trace_event(BA_TRACE_EVENT_DECODE_BEGIN, ffb_blen_out(&codec.data), 0);
 		/* Process data until there is no more LC3-SWB frames to decode. This loop
 		 * ensures that for MTU values bigger than the LC3-SWB frame size, the input
 		 * buffer will not fill up causing short reads and LC3-SWB frame losses. */
 		while ((err = lc3_swb_decode(&codec)) > 0)
 			continue;
+		trace_event(BA_TRACE_EVENT_DECODE_END, ffb_len_out(&codec.pcm), 0);
 
 		ssize_t samples;
 		if ((samples = ffb_len_out(&codec.pcm)) <= 0)
 			continue;
 
-		io_pcm_scale(t_pcm, codec.pcm.data, samples);
 		if ((samples = io_pcm_write(t_pcm, codec.pcm.data, samples)) == -1)
 			error("FIFO write error: %s", strerror(errno));
 		else if (samples == 0)
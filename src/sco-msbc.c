@@ -22,6 +22,7 @@
 #include "bluealsa-dbus.h"
 #include "codec-msbc.h"
 #include "io.h"
+#include "trace.h"
 #include "shared/defs.h"
 #include "shared/ffb.h"
 #include "shared/log.h"
@@ -69,10 +70,12 @@ void *sco_msbc_enc_thread(struct ba_transport_pcm *t_pcm) {
 		while (ffb_len_out(&msbc.pcm) >= MSBC_CODESAMPLES) {
 
 			int err;
+			trace_event(BA_TRACE_EVENT_ENCODE_BEGIN, ffb_len_out(&msbc.pcm), 0);
 			if ((err = msbc_encode(&msbc)) < 0) {
 				error("mSBC encoding error: %s", msbc_strerror(err));
 				break;
 			}
+			trace_event(BA_TRACE_EVENT_ENCODE_END, ffb_blen_out(&msbc.data), msbc.frames);
 
 			uint8_t *data = msbc.data.data;
 			size_t data_len = ffb_blen_out(&msbc.data);
@@ -149,11 +152,13 @@ void *sco_msbc_dec_thread(struct ba_transport_pcm *t_pcm) {
 		}
 
 		int err;
+		trace_event(BA_TRACE_EVENT_DECODE_BEGIN, ffb_blen_out(&msbc.data), 0);
 		/* Process data until there is no more mSBC frames to decode. This loop
 		 * ensures that for MTU values bigger than the mSBC frame size, the input
 		 * buffer will not fill up causing short reads and mSBC frame losses. */
 		while ((err = msbc_decode(&msbc)) > 0)
 			continue;
+		trace_event(BA_TRACE_EVENT_DECODE_END, ffb_len_out(&msbc.pcm), 0);
 		if (err < 0) {
 			error("mSBC decoding error: %s", msbc_strerror(err));
 			continue;
@@ -163,7 +168,6 @@ void *sco_msbc_dec_thread(struct ba_transport_pcm *t_pcm) {
 		if ((samples = ffb_len_out(&msbc.pcm)) <= 0)
 			continue;
 
-		io_pcm_scale(t_pcm, msbc.pcm.data, samples);
 		if ((samples = io_pcm_write(t_pcm, msbc.pcm.data, samples)) == -1)
 			error("PCM write error: %s", strerror(errno));
 		else if (samples == 0)
@@ -15,12 +15,15 @@
 #endif
 
 #include <errno.h>
+#include <fcntl.h>
 #include <poll.h>
 #include <pthread.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <bluetooth/bluetooth.h>
@@ -40,9 +43,11 @@
 #include "sco-cvsd.h"
 #include "sco-lc3-swb.h"
 #include "sco-msbc.h"
+#include "utils.h"
 #include "shared/bluetooth.h"
 #include "shared/defs.h"
 #include "shared/log.h"
+#include "shared/rt.h"
 
 /**
  * SCO dispatcher internal data. */
@@ -51,6 +56,126 @@ struct sco_data {
 	struct pollfd pfd;
 };
 
+/**
+ * SCO link setup statistics shared by all adapters. */
+static struct {
+	/* number of accepted links waiting for the setup */
+	atomic_uint backlog;
+	atomic_uint latency[SCO_SETUP_LATENCY_BUCKETS];
+} sco_setup_stats;
+
+/**
+ * Account SCO link waiting for the setup. */
+void sco_setup_queued(void) {
+	atomic_fetch_add_explicit(&sco_setup_stats.backlog, 1, memory_order_relaxed);
+}
+
+/**
+ * Update SCO link setup statistics.
+ *
+ * @param accepted_at Time-stamp when the link has been accepted or NULL if
+ *   the link has been dropped without the setup. */
+void sco_setup_done(const struct timespec *accepted_at) {
+
+	if (accepted_at == NULL)
+		goto final;
+
+	struct timespec now;
+	gettimestamp(&now);
+	timespecsub(&now, accepted_at, &now);
+
+	size_t bucket = 0;
+	unsigned long v = now.tv_sec * 1000 + now.tv_nsec / 1000000;
+	for (; v > 0 && bucket < SCO_SETUP_LATENCY_BUCKETS - 1; v >>= 1)
+		bucket++;
+
+	atomic_fetch_add_explicit(&sco_setup_stats.latency[bucket], 1, memory_order_relaxed);
+
+final:
+	atomic_fetch_sub_explicit(&sco_setup_stats.backlog, 1, memory_order_relaxed);
+}
+
+/**
+ * Get the number of accepted SCO links waiting for the setup. */
+unsigned int sco_setup_get_backlog(void) {
+	return atomic_load_explicit(&sco_setup_stats.backlog, memory_order_relaxed);
+}
+
+/**
+ * Get the SCO link setup latency histogram. */
+void sco_setup_get_latency(uint32_t histogram[SCO_SETUP_LATENCY_BUCKETS]) {
+	for (size_t i = 0; i < SCO_SETUP_LATENCY_BUCKETS; i++)
+		histogram[i] = atomic_load_explicit(&sco_setup_stats.latency[i], memory_order_relaxed);
+}
+
+/**
+ * Accept incoming SCO link and hand it over to the transport.
+ *
+ * This function performs only the time critical part of the SCO setup -
+ * the link authorization - so it can be done for every link in the accept
+ * backlog before the eSCO setup timeout. The transport IO threads restart
+ * is done asynchronously by the transport thread manager.
+ *
+ * @return This function returns 0 when a link has been accepted (even if
+ *   it has been rejected afterwards), or -1 if there is no link to accept
+ *   or an error has occurred. */
+static int sco_dispatcher_accept(struct sco_data *data) {
+
+	struct sockaddr_sco addr;
+	socklen_t addrlen = sizeof(addr);
+	struct ba_device *d = NULL;
+	struct ba_transport *t = NULL;
+	struct timespec accepted_at;
+	char addrstr[18];
+	int fd;
+
+	if ((fd = accept(data->pfd.fd, (struct sockaddr *)&addr, &addrlen)) == -1) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+			error("Couldn't accept incoming SCO link: %s", strerror(errno));
+		return -1;
+	}
+
+	gettimestamp(&accepted_at);
+	ba2str(&addr.sco_bdaddr, addrstr);
+	debug("New incoming SCO link: %s: %d", addrstr, fd);
+
+	if ((d = ba_device_lookup(data->a, &addr.sco_bdaddr)) == NULL) {
+		error("Couldn't lookup device: %s", addrstr);
+		goto cleanup;
+	}
+
+	if ((t = ba_transport_lookup(d, d->bluez_dbus_path)) == NULL) {
+		error("Couldn't lookup transport: %s", d->bluez_dbus_path);
+		goto cleanup;
+	}
+
+#if ENABLE_HFP_CODEC_SELECTION
+	const uint32_t codec_id = ba_transport_get_codec(t);
+	struct bt_voice voice = { .setting = BT_VOICE_TRANSPARENT };
+	if ((codec_id == HFP_CODEC_MSBC || codec_id == HFP_CODEC_LC3_SWB) &&
+			setsockopt(fd, SOL_BLUETOOTH, BT_VOICE, &voice, sizeof(voice)) == -1) {
+		error("Couldn't setup transparent voice: %s", strerror(errno));
+		goto cleanup;
+	}
+	if (read(fd, &voice, 1) == -1) {
+		error("Couldn't authorize SCO connection: %s", strerror(errno));
+		goto cleanup;
+	}
+#endif
+
+	ba_transport_sco_link_setup(t, fd, &accepted_at);
+	fd = -1;
+
+cleanup:
+	if (d != NULL)
+		ba_device_unref(d);
+	if (t != NULL)
+		ba_transport_unref(t);
+	if (fd != -1)
+		close(fd);
+	return 0;
+}
+
 static void sco_dispatcher_cleanup(struct sco_data *data) {
 	debug("SCO dispatcher cleanup: %s", data->a->hci.name);
 	if (data->pfd.fd != -1)
@@ -83,6 +208,13 @@ static void *sco_dispatcher_thread(struct ba_adapter *a) {
 	}
 #endif
 
+	int flags;
+	if ((flags = fcntl(data.pfd.fd, F_GETFL)) == -1 ||
+			fcntl(data.pfd.fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+		error("Couldn't set SCO socket non-blocking mode: %s", strerror(errno));
+		goto fail;
+	}
+
 	if (listen(data.pfd.fd, 10) == -1) {
 		error("Couldn't listen on SCO socket: %s", strerror(errno));
 		goto fail;
@@ -102,66 +234,10 @@ static void *sco_dispatcher_thread(struct ba_adapter *a) {
 			goto fail;
 		}
 
-		struct sockaddr_sco addr;
-		socklen_t addrlen = sizeof(addr);
-		struct ba_device *d = NULL;
-		struct ba_transport *t = NULL;
-		char addrstr[18];
-		int fd = -1;
-
-		if ((fd = accept(data.pfd.fd, (struct sockaddr *)&addr, &addrlen)) == -1) {
-			error("Couldn't accept incoming SCO link: %s", strerror(errno));
-			goto cleanup;
-		}
-
-		ba2str(&addr.sco_bdaddr, addrstr);
-		debug("New incoming SCO link: %s: %d", addrstr, fd);
-
-		if ((d = ba_device_lookup(data.a, &addr.sco_bdaddr)) == NULL) {
-			error("Couldn't lookup device: %s", addrstr);
-			goto cleanup;
-		}
-
-		if ((t = ba_transport_lookup(d, d->bluez_dbus_path)) == NULL) {
-			error("Couldn't lookup transport: %s", d->bluez_dbus_path);
-			goto cleanup;
-		}
-
-#if ENABLE_HFP_CODEC_SELECTION
-		const uint32_t codec_id = ba_transport_get_codec(t);
-		struct bt_voice voice = { .setting = BT_VOICE_TRANSPARENT };
-		if ((codec_id == HFP_CODEC_MSBC || codec_id == HFP_CODEC_LC3_SWB) &&
-				setsockopt(fd, SOL_BLUETOOTH, BT_VOICE, &voice, sizeof(voice)) == -1) {
-			error("Couldn't setup transparent voice: %s", strerror(errno));
-			goto cleanup;
-		}
-		if (read(fd, &voice, 1) == -1) {
-			error("Couldn't authorize SCO connection: %s", strerror(errno));
-			goto cleanup;
-		}
-#endif
-
-		ba_transport_stop(t);
-
-		pthread_mutex_lock(&t->bt_fd_mtx);
-
-		t->bt_fd = fd;
-		t->mtu_read = t->mtu_write = hci_sco_get_mtu(fd, a);
-		fd = -1;
-
-		pthread_mutex_unlock(&t->bt_fd_mtx);
-
-		ba_transport_pcm_state_set_idle(&t->sco.pcm_spk);
-		ba_transport_pcm_state_set_idle(&t->sco.pcm_mic);
-		ba_transport_start(t);
-
-cleanup:
-		if (d != NULL)
-			ba_device_unref(d);
-		if (t != NULL)
-			ba_transport_unref(t);
-		if (fd != -1)
-			close(fd);
+		/* Accept all pending links in a batch, so the authorization of
+		 * simultaneous call setups is not delayed by each other. */
+		while (sco_dispatcher_accept(&data) == 0)
+			continue;
 
 	}
 
@@ -217,6 +293,10 @@ int sco_setup_connection_dispatcher(struct ba_adapter *a) {
 		return -1;
 	}
 
+	if ((ret = thread_set_cpu_affinity(a->sco_dispatcher,
+					&config.cpu_affinity.sco_dispatcher)) != 0)
+		warn("Couldn't set SCO dispatcher CPU affinity: %s", strerror(ret));
+
 	pthread_setname_np(a->sco_dispatcher, "ba-sco-dispatch");
 	debug("Created SCO dispatcher [%s]: %s", "ba-sco-dispatch", a->hci.name);
 
@@ -16,11 +16,26 @@
 # include <config.h>
 #endif
 
+#include <stdint.h>
+#include <time.h>
+
 #include "ba-adapter.h"
 #include "ba-transport.h"
 
+/**
+ * The number of buckets in the SCO link setup latency histogram. The first
+ * bucket counts links set up in less than 1 ms, every next bucket covers
+ * twice as long time span and the last one counts links set up in 256 ms
+ * and more. */
+#define SCO_SETUP_LATENCY_BUCKETS 10
+
 int sco_setup_connection_dispatcher(struct ba_adapter *a);
 int sco_transport_init(struct ba_transport *t);
 int sco_transport_start(struct ba_transport *t);
 
+void sco_setup_queued(void);
+void sco_setup_done(const struct timespec *accepted_at);
+unsigned int sco_setup_get_backlog(void);
+void sco_setup_get_latency(uint32_t histogram[SCO_SETUP_LATENCY_BUCKETS]);
+
 #endif
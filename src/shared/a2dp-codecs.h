@@ -760,6 +760,15 @@ typedef struct a2dp_opus {
 #define OPUS_PW_FRAME_DURATION_200      (1 << 3)
 #define OPUS_PW_FRAME_DURATION_400      (1 << 4)
 
+#define OPUS_PW_LOCATION_FL             (1 << 0)
+#define OPUS_PW_LOCATION_FR             (1 << 1)
+#define OPUS_PW_LOCATION_FC             (1 << 2)
+#define OPUS_PW_LOCATION_LFE            (1 << 3)
+#define OPUS_PW_LOCATION_BL             (1 << 4)
+#define OPUS_PW_LOCATION_BR             (1 << 5)
+#define OPUS_PW_LOCATION_SL             (1 << 10)
+#define OPUS_PW_LOCATION_SR             (1 << 11)
+
 typedef struct a2dp_opus_pw_stream {
 	uint8_t channels;
 	uint8_t coupled_streams;
@@ -772,7 +781,7 @@ typedef struct a2dp_opus_pw_stream {
 #define A2DP_OPUS_PW_SET_LOCATION(a, v) ((a).location = htole32(v))
 
 #define A2DP_OPUS_PW_INIT_BITRATE(v) .bitrate = HTOLE16(v),
-#define A2DP_OPUS_PW_GET_BITRATE(a) le32toh((a).bitrate)
+#define A2DP_OPUS_PW_GET_BITRATE(a) le16toh((a).bitrate)
 #define A2DP_OPUS_PW_SET_BITRATE(a, v) ((a).bitrate = htole16(v))
 
 } __attribute__ ((packed)) a2dp_opus_pw_stream_t;
@@ -202,6 +202,75 @@ dbus_bool_t ba_dbus_pcm_open(
 	return rv;
 }
 
+/**
+ * Open BlueALSA PCM stream with the given client stream format. */
+dbus_bool_t ba_dbus_pcm_open_with_format(
+		struct ba_dbus_ctx *ctx,
+		const char *pcm_path,
+		uint16_t format,
+		int *fd_pcm,
+		int *fd_pcm_ctrl,
+		DBusError *error) {
+	return ba_dbus_pcm_open_with_props(ctx, pcm_path, format, 0,
+			fd_pcm, fd_pcm_ctrl, error);
+}
+
+/**
+ * Open BlueALSA PCM stream with the given client stream properties.
+ *
+ * @param format Stream format used on the client side of the PCM stream
+ *   PIPE. If 0, the PCM format is used.
+ * @param rate Sample rate used on the client side of the PCM stream PIPE.
+ *   If 0, the PCM sample rate is used. */
+dbus_bool_t ba_dbus_pcm_open_with_props(
+		struct ba_dbus_ctx *ctx,
+		const char *pcm_path,
+		uint16_t format,
+		unsigned int rate,
+		int *fd_pcm,
+		int *fd_pcm_ctrl,
+		DBusError *error) {
+
+	DBusMessage *msg;
+	if ((msg = dbus_message_new_method_call(ctx->ba_service, pcm_path,
+					BLUEALSA_INTERFACE_PCM, "OpenWithProps")) == NULL) {
+		dbus_set_error_const(error, DBUS_ERROR_NO_MEMORY, NULL);
+		return FALSE;
+	}
+
+	const uint32_t rate_ = rate;
+	DBusMessageIter iter;
+	DBusMessageIter props;
+	dbus_message_iter_init_append(msg, &iter);
+	if (!dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "{sv}", &props) ||
+			(format != 0 &&
+			 !dbus_message_iter_dict_append_basic(&props, "Format", DBUS_TYPE_UINT16, &format)) ||
+			(rate != 0 &&
+			 !dbus_message_iter_dict_append_basic(&props, "Rate", DBUS_TYPE_UINT32, &rate_)) ||
+			!dbus_message_iter_close_container(&iter, &props)) {
+		dbus_set_error_const(error, DBUS_ERROR_NO_MEMORY, NULL);
+		dbus_message_unref(msg);
+		return FALSE;
+	}
+
+	DBusMessage *rep;
+	if ((rep = dbus_connection_send_with_reply_and_block(ctx->conn,
+					msg, DBUS_TIMEOUT_USE_DEFAULT, error)) == NULL) {
+		dbus_message_unref(msg);
+		return FALSE;
+	}
+
+	dbus_bool_t rv;
+	rv = dbus_message_get_args(rep, error,
+			DBUS_TYPE_UNIX_FD, fd_pcm,
+			DBUS_TYPE_UNIX_FD, fd_pcm_ctrl,
+			DBUS_TYPE_INVALID);
+
+	dbus_message_unref(rep);
+	dbus_message_unref(msg);
+	return rv;
+}
+
 const char *ba_dbus_pcm_codec_get_canonical_name(
 		const char *alias) {
 
@@ -179,6 +179,23 @@ dbus_bool_t ba_dbus_pcm_open(
 		int *fd_pcm_ctrl,
 		DBusError *error);
 
+dbus_bool_t ba_dbus_pcm_open_with_format(
+		struct ba_dbus_ctx *ctx,
+		const char *pcm_path,
+		uint16_t format,
+		int *fd_pcm,
+		int *fd_pcm_ctrl,
+		DBusError *error);
+
+dbus_bool_t ba_dbus_pcm_open_with_props(
+		struct ba_dbus_ctx *ctx,
+		const char *pcm_path,
+		uint16_t format,
+		unsigned int rate,
+		int *fd_pcm,
+		int *fd_pcm_ctrl,
+		DBusError *error);
+
 const char *ba_dbus_pcm_codec_get_canonical_name(
 		const char *alias);
 
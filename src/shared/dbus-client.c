@@ -384,6 +384,170 @@ void ba_dbus_service_props_free(
 	}
 }
 
+/**
+ * Enable or disable BlueALSA service IO thread tracing. */
+dbus_bool_t ba_dbus_service_trace_set(
+		struct ba_dbus_ctx *ctx,
+		dbus_bool_t enabled,
+		DBusError *error) {
+
+	static const char *interface = BLUEALSA_INTERFACE_MANAGER;
+	static const char *property = "Tracing";
+	DBusMessage *msg = NULL, *rep = NULL;
+	dbus_bool_t rv = FALSE;
+
+	if ((msg = dbus_message_new_method_call(ctx->ba_service, "/org/bluealsa",
+					DBUS_INTERFACE_PROPERTIES, "Set")) == NULL)
+		goto fail_no_memory;
+
+	DBusMessageIter iter;
+	DBusMessageIter variant;
+
+	dbus_message_iter_init_append(msg, &iter);
+	if (!dbus_message_iter_append_basic(&iter, DBUS_TYPE_STRING, &interface) ||
+			!dbus_message_iter_append_basic(&iter, DBUS_TYPE_STRING, &property) ||
+			!dbus_message_iter_open_container(&iter, DBUS_TYPE_VARIANT,
+				DBUS_TYPE_BOOLEAN_AS_STRING, &variant) ||
+			!dbus_message_iter_append_basic(&variant, DBUS_TYPE_BOOLEAN, &enabled) ||
+			!dbus_message_iter_close_container(&iter, &variant))
+		goto fail_no_memory;
+
+	if ((rep = dbus_connection_send_with_reply_and_block(ctx->conn,
+					msg, DBUS_TIMEOUT_USE_DEFAULT, error)) == NULL)
+		goto fail;
+
+	rv = TRUE;
+	goto fail;
+
+fail_no_memory:
+	dbus_set_error_const(error, DBUS_ERROR_NO_MEMORY, NULL);
+fail:
+	if (rep != NULL)
+		dbus_message_unref(rep);
+	if (msg != NULL)
+		dbus_message_unref(msg);
+	return rv;
+}
+
+/**
+ * Get events recorded by the BlueALSA service IO threads.
+ *
+ * @param ctx D-Bus connection context.
+ * @param threads Address where the array of traced threads will be stored.
+ *   The array shall be freed with the ba_dbus_service_trace_free().
+ * @param length Address where the number of traced threads will be stored.
+ * @param error D-Bus error structure.
+ * @return On success this function returns TRUE. */
+dbus_bool_t ba_dbus_service_trace_get(
+		struct ba_dbus_ctx *ctx,
+		struct ba_trace_thread **threads,
+		size_t *length,
+		DBusError *error) {
+
+	DBusMessage *msg = NULL, *rep = NULL;
+	struct ba_trace_thread *_threads = NULL;
+	size_t _length = 0;
+	dbus_bool_t rv = FALSE;
+
+	if ((msg = dbus_message_new_method_call(ctx->ba_service, "/org/bluealsa",
+					BLUEALSA_INTERFACE_MANAGER, "GetTrace")) == NULL) {
+		dbus_set_error_const(error, DBUS_ERROR_NO_MEMORY, NULL);
+		goto fail;
+	}
+
+	if ((rep = dbus_connection_send_with_reply_and_block(ctx->conn,
+					msg, DBUS_TIMEOUT_USE_DEFAULT, error)) == NULL)
+		goto fail;
+
+	DBusMessageIter iter;
+	if (strcmp(dbus_message_get_signature(rep), "a(usa(tuuu))") != 0 ||
+			!dbus_message_iter_init(rep, &iter)) {
+		dbus_set_error(error, DBUS_ERROR_INVALID_SIGNATURE,
+				"Incorrect signature: %s != a(usa(tuuu))", dbus_message_get_signature(rep));
+		goto fail;
+	}
+
+	DBusMessageIter iter_threads;
+	for (dbus_message_iter_recurse(&iter, &iter_threads);
+			dbus_message_iter_get_arg_type(&iter_threads) != DBUS_TYPE_INVALID;
+			dbus_message_iter_next(&iter_threads)) {
+
+		struct ba_trace_thread *tmp;
+		if ((tmp = realloc(_threads, (_length + 1) * sizeof(*tmp))) == NULL) {
+			dbus_set_error_const(error, DBUS_ERROR_NO_MEMORY, NULL);
+			goto fail;
+		}
+
+		struct ba_trace_thread *thread = &(_threads = tmp)[_length++];
+		memset(thread, 0, sizeof(*thread));
+
+		DBusMessageIter iter_thread;
+		dbus_message_iter_recurse(&iter_threads, &iter_thread);
+
+		dbus_uint32_t tid;
+		dbus_message_iter_get_basic(&iter_thread, &tid);
+		thread->tid = tid;
+		dbus_message_iter_next(&iter_thread);
+
+		const char *name;
+		dbus_message_iter_get_basic(&iter_thread, &name);
+		strncpy(thread->name, name, sizeof(thread->name) - 1);
+		dbus_message_iter_next(&iter_thread);
+
+		DBusMessageIter iter_events;
+		int events_count = dbus_message_iter_get_element_count(&iter_thread);
+		if ((thread->events = malloc(MAX(events_count, 1) * sizeof(*thread->events))) == NULL) {
+			dbus_set_error_const(error, DBUS_ERROR_NO_MEMORY, NULL);
+			goto fail;
+		}
+
+		for (dbus_message_iter_recurse(&iter_thread, &iter_events);
+				dbus_message_iter_get_arg_type(&iter_events) != DBUS_TYPE_INVALID;
+				dbus_message_iter_next(&iter_events)) {
+
+			struct ba_trace_event *event = &thread->events[thread->events_len++];
+			DBusMessageIter iter_event;
+			dbus_uint64_t timestamp;
+
+			dbus_message_iter_recurse(&iter_events, &iter_event);
+			dbus_message_iter_get_basic(&iter_event, &timestamp);
+			dbus_message_iter_next(&iter_event);
+			dbus_message_iter_get_basic(&iter_event, &event->type);
+			dbus_message_iter_next(&iter_event);
+			dbus_message_iter_get_basic(&iter_event, &event->arg0);
+			dbus_message_iter_next(&iter_event);
+			dbus_message_iter_get_basic(&iter_event, &event->arg1);
+			event->timestamp = timestamp;
+
+		}
+
+	}
+
+	*threads = _threads;
+	*length = _length;
+	_threads = NULL;
+	_length = 0;
+	rv = TRUE;
+
+fail:
+	ba_dbus_service_trace_free(_threads, _length);
+	if (rep != NULL)
+		dbus_message_unref(rep);
+	if (msg != NULL)
+		dbus_message_unref(msg);
+	return rv;
+}
+
+/**
+ * Free BlueALSA service IO thread trace. */
+void ba_dbus_service_trace_free(
+		struct ba_trace_thread *threads,
+		size_t length) {
+	for (size_t i = 0; i < length; i++)
+		free(threads[i].events);
+	free(threads);
+}
+
 /**
  * Extract strings from the string array. */
 dbus_bool_t dbus_message_iter_array_get_strings(
@@ -23,6 +23,8 @@
 #include <bluetooth/hci.h>
 #include <dbus/dbus.h>
 
+#include "shared/trace.h"
+
 #ifndef DBUS_INTERFACE_OBJECT_MANAGER
 # define DBUS_INTERFACE_OBJECT_MANAGER "org.freedesktop.DBus.ObjectManager"
 #endif
@@ -111,6 +113,33 @@ dbus_bool_t ba_dbus_service_props_get(
 void ba_dbus_service_props_free(
 		struct ba_service_props *props);
 
+/**
+ * BlueALSA service IO thread trace. */
+struct ba_trace_thread {
+	/* kernel thread ID */
+	unsigned int tid;
+	/* name of the thread */
+	char name[16];
+	/* recorded events, the oldest one first */
+	struct ba_trace_event *events;
+	size_t events_len;
+};
+
+dbus_bool_t ba_dbus_service_trace_set(
+		struct ba_dbus_ctx *ctx,
+		dbus_bool_t enabled,
+		DBusError *error);
+
+dbus_bool_t ba_dbus_service_trace_get(
+		struct ba_dbus_ctx *ctx,
+		struct ba_trace_thread **threads,
+		size_t *length,
+		DBusError *error);
+
+void ba_dbus_service_trace_free(
+		struct ba_trace_thread *threads,
+		size_t length);
+
 dbus_bool_t dbus_message_iter_array_get_strings(
 		DBusMessageIter *iter,
 		DBusError *error,
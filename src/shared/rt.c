@@ -42,6 +42,11 @@ void asrsync_sync(struct asrsync *asrs, unsigned int frames) {
 	struct timespec ts_rate;
 	struct timespec ts;
 
+	/* Count only the transition to the overdue state. Otherwise, a single
+	 * stall (e.g. PCM underrun) would be counted on every subsequent sync,
+	 * because the reference time point is not updated. */
+	const bool missed = asrs->synced || asrs->frames == 0;
+
 	asrs->frames += frames;
 	frames = asrs->frames;
 
@@ -57,6 +62,8 @@ void asrsync_sync(struct asrsync *asrs, unsigned int frames) {
 		nanosleep(&asrs->ts_idle, NULL);
 		asrs->synced = true;
 	}
+	else if (missed)
+		asrs->misses++;
 
 	gettimestamp(&asrs->ts);
 
@@ -67,6 +67,10 @@ struct asrsync {
 	 * outside of the sync function. */
 	struct timespec ts_idle;
 
+	/* The number of missed deadlines, i.e. the number of times when the
+	 * synchronization was not possible after being possible previously. */
+	unsigned int misses;
+
 };
 
 void asrsync_init(struct asrsync *asrs, unsigned int rate);
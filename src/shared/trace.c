@@ -0,0 +1,39 @@
+/*
+ * BlueALSA - trace.c
+ * Copyright (c) 2016-2025 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include "shared/trace.h"
+
+#include <stddef.h>
+
+#include "shared/defs.h"
+
+/**
+ * Get the name of the trace event type.
+ *
+ * @param type Trace event type.
+ * @return Human readable string or "unknown". */
+const char *ba_trace_event_type_to_string(enum ba_trace_event_type type) {
+	static const char *names[] = {
+		[BA_TRACE_EVENT_PCM_READ] = "pcm-read",
+		[BA_TRACE_EVENT_PCM_WRITE] = "pcm-write",
+		[BA_TRACE_EVENT_ENCODE_BEGIN] = "encode-begin",
+		[BA_TRACE_EVENT_ENCODE_END] = "encode-end",
+		[BA_TRACE_EVENT_DECODE_BEGIN] = "decode-begin",
+		[BA_TRACE_EVENT_DECODE_END] = "decode-end",
+		[BA_TRACE_EVENT_BT_READ] = "bt-read",
+		[BA_TRACE_EVENT_BT_WRITE] = "bt-write",
+		[BA_TRACE_EVENT_POLL_WAKE] = "poll-wake",
+		[BA_TRACE_EVENT_SIGNAL] = "signal",
+		[BA_TRACE_EVENT_RTP] = "rtp",
+	};
+	if ((size_t)type < ARRAYSIZE(names) && names[type] != NULL)
+		return names[type];
+	return "unknown";
+}
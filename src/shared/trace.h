@@ -0,0 +1,65 @@
+/*
+ * BlueALSA - trace.h
+ * Copyright (c) 2016-2025 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#pragma once
+#ifndef BLUEALSA_SHARED_TRACE_H_
+#define BLUEALSA_SHARED_TRACE_H_
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdint.h>
+
+/**
+ * Type of the IO thread trace event.
+ *
+ * The numeric values are part of the D-Bus API, so new types shall be
+ * appended at the end of the list. */
+enum ba_trace_event_type {
+	/* PCM samples read from the client, arg0: samples */
+	BA_TRACE_EVENT_PCM_READ = 1,
+	/* PCM samples written to the client, arg0: samples */
+	BA_TRACE_EVENT_PCM_WRITE,
+	/* encoding started, arg0: PCM samples */
+	BA_TRACE_EVENT_ENCODE_BEGIN,
+	/* encoding finished, arg0: encoded bytes, arg1: codec frames */
+	BA_TRACE_EVENT_ENCODE_END,
+	/* decoding started, arg0: encoded bytes */
+	BA_TRACE_EVENT_DECODE_BEGIN,
+	/* decoding finished, arg0: PCM samples */
+	BA_TRACE_EVENT_DECODE_END,
+	/* data read from the BT socket, arg0: bytes */
+	BA_TRACE_EVENT_BT_READ,
+	/* data written to the BT socket, arg0: bytes */
+	BA_TRACE_EVENT_BT_WRITE,
+	/* IO thread woken up from poll(), arg0: number of ready FDs */
+	BA_TRACE_EVENT_POLL_WAKE,
+	/* transport PCM signal received, arg0: signal */
+	BA_TRACE_EVENT_SIGNAL,
+	/* RTP packet generated or received, arg0: sequence, arg1: timestamp */
+	BA_TRACE_EVENT_RTP,
+};
+
+/**
+ * Fixed-size IO thread trace event. */
+struct ba_trace_event {
+	/* monotonic timestamp in nanoseconds */
+	uint64_t timestamp;
+	/* type of the event (enum ba_trace_event_type) */
+	uint32_t type;
+	/* event specific arguments */
+	uint32_t arg0;
+	uint32_t arg1;
+};
+
+const char *ba_trace_event_type_to_string(enum ba_trace_event_type type);
+
+#endif
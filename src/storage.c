@@ -1,6 +1,6 @@
 /*
  * BlueALSA - storage.c
- * Copyright (c) 2016-2024 Arkadiusz Bokowy
+ * Copyright (c) 2016-2025 Arkadiusz Bokowy
  *
  * This file is a part of bluez-alsa.
  *
@@ -11,40 +11,94 @@
 #include "storage.h"
 
 #include <errno.h>
+#include <fcntl.h>
 #include <pthread.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <bluetooth/bluetooth.h>
 
 #include <glib.h>
 
+#include "a2dp.h"
+#include "ba-config.h"
 #include "ba-transport.h"
 #include "hfp.h"
 #include "utils.h"
 #include "shared/a2dp-codecs.h"
 #include "shared/defs.h"
+#include "shared/hex.h"
 #include "shared/log.h"
+#include "shared/rt.h"
+
+#define BA_STORAGE_GROUP_A2DP           "A2DP"
+#define BA_STORAGE_GROUP_HFP_AG         "HFP-AG"
+#define BA_STORAGE_GROUP_HFP_HF         "HFP-HF"
 
 #define BA_STORAGE_KEY_CLIENT_DELAYS    "ClientDelays"
+#define BA_STORAGE_KEY_CODEC            "Codec"
+#define BA_STORAGE_KEY_FEATURES         "Features"
 #define BA_STORAGE_KEY_SOFT_VOLUME      "SoftVolume"
 #define BA_STORAGE_KEY_VOLUME           "Volume"
 #define BA_STORAGE_KEY_MUTE             "Mute"
 
+/* Delay (in milliseconds) between the last storage change and the moment
+ * when all changes are written to the disk. Subsequent changes postpone the
+ * write, but not more than the maximum delay since the first change. */
+#define BA_STORAGE_WRITE_DELAY          500
+#define BA_STORAGE_WRITE_DELAY_MAX      5000
+
 struct storage {
 	/* remote BT device address */
 	bdaddr_t addr;
 	/* associated storage file */
 	GKeyFile *keyfile;
+	/* key file has changes not written to the disk */
+	bool dirty;
+};
+
+/**
+ * Storage file snapshot ready to be written to the disk. */
+struct storage_snapshot {
+	char *path;
+	char *data;
+	size_t size;
 };
 
 static char storage_root_dir[128];
 static pthread_mutex_t storage_mutex = PTHREAD_MUTEX_INITIALIZER;
 static GHashTable *storage_map = NULL;
+/* cache of selected A2DP configurations shared by all devices */
+static GHashTable *storage_a2dp_cache = NULL;
+
+/* Storage write-behind worker. All fields are protected by the global
+ * storage mutex. */
+static struct {
+	pthread_t thread;
+	pthread_cond_t cond;
+	/* signaled when all pending changes were written */
+	pthread_cond_t cond_synced;
+	bool running;
+	bool stop;
+	/* write pending changes without delay */
+	bool flush;
+	/* number of storages with unsaved changes */
+	unsigned int dirty;
+	/* snapshot is being written to the disk */
+	bool writing;
+	/* time of the first and the last unsaved change */
+	struct timespec ts_first;
+	struct timespec ts_last;
+} storage_writer = {
+	.cond_synced = PTHREAD_COND_INITIALIZER,
+};
 
 static struct storage *storage_lookup(const bdaddr_t *addr) {
 	return g_hash_table_lookup(storage_map, addr);
@@ -62,6 +116,7 @@ static struct storage *storage_new(const bdaddr_t *addr) {
 
 	bacpy(&st->addr, addr);
 	st->keyfile = g_key_file_new();
+	st->dirty = false;
 
 	/* Insert a new storage into the map. Please, note that the key is a pointer
 	 * to memory stored in the value structure. This is fine as long as the value
@@ -80,6 +135,413 @@ static void storage_free(struct storage *st) {
 	free(st);
 }
 
+/**
+ * Get the storage key for the given local A2DP SEP. */
+static char *storage_a2dp_sep_key(const struct a2dp_sep *sep) {
+	return g_strdup_printf("%s-%s",
+			sep->config.type == A2DP_SOURCE ? "Source" : "Sink",
+			a2dp_codecs_codec_id_to_string(sep->config.codec_id));
+}
+
+/**
+ * Get the A2DP configuration selection preferences.
+ *
+ * The selected configuration depends not only on the SEP capabilities, but
+ * also on the user preferences, so they have to be a part of the cache key.
+ * Note, that some of these preferences are already reflected in the local
+ * SEP capabilities, but it does not hurt to include them explicitly. */
+static char *storage_a2dp_preferences(void) {
+	GString *str = g_string_new(NULL);
+	g_string_append_printf(str, "mono=%u,44100=%u,sbc=%u",
+			config.a2dp.force_mono, config.a2dp.force_44100, config.sbc_quality);
+#if ENABLE_AAC
+	g_string_append_printf(str, ",aac-vbr=%u", config.aac_prefer_vbr);
+#endif
+#if ENABLE_LC3PLUS
+	g_string_append_printf(str, ",lc3plus-ll=%u", config.lc3plus_low_latency);
+#endif
+	return g_string_free(str, FALSE);
+}
+
+/**
+ * Get the A2DP configuration cache key.
+ *
+ * The key consists of the local SEP key, local SEP capabilities, remote
+ * SEP capabilities and selection preferences. Including local capabilities
+ * and preferences in the key ensures that cached configuration will not be
+ * used if the local SEP setup or the user preferences change. */
+static char *storage_a2dp_cache_key(const char *sep_key,
+		const char *local_caps_hex, const char *remote_caps_hex,
+		const char *preferences) {
+	return g_strdup_printf("%s:%s:%s:%s", sep_key, local_caps_hex,
+			remote_caps_hex, preferences);
+}
+
+/**
+ * Load cached A2DP configurations from the storage key file. */
+static void storage_a2dp_cache_load_keyfile(GKeyFile *keyfile) {
+
+	char **keys;
+	if ((keys = g_key_file_get_keys(keyfile, BA_STORAGE_GROUP_A2DP, NULL, NULL)) == NULL)
+		return;
+
+	for (size_t i = 0; keys[i] != NULL; i++) {
+
+		char **list;
+		size_t length = 0;
+		if ((list = g_key_file_get_string_list(keyfile, BA_STORAGE_GROUP_A2DP,
+						keys[i], &length, NULL)) == NULL)
+			continue;
+
+		/* list: local capabilities, remote capabilities, configuration,
+		 * selection preferences */
+		if (length == 4)
+			g_hash_table_replace(storage_a2dp_cache,
+					storage_a2dp_cache_key(keys[i], list[0], list[1], list[3]),
+					g_strdup(list[2]));
+
+		g_strfreev(list);
+	}
+
+	g_strfreev(keys);
+}
+
+static void storage_snapshot_free(struct storage_snapshot *snapshot) {
+	g_free(snapshot->path);
+	g_free(snapshot->data);
+	free(snapshot);
+}
+
+/**
+ * Take snapshot of all modified storages.
+ *
+ * This function shall be called with the storage mutex locked. */
+static GPtrArray *storage_snapshot_take(void) {
+
+	GPtrArray *snapshots = g_ptr_array_new_with_free_func(
+			(GDestroyNotify)storage_snapshot_free);
+
+	GHashTableIter iter;
+	struct storage *st;
+	g_hash_table_iter_init(&iter, storage_map);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer)&st)) {
+
+		if (!st->dirty)
+			continue;
+
+		struct storage_snapshot *snapshot;
+		if ((snapshot = malloc(sizeof(*snapshot))) == NULL)
+			continue;
+
+		char addrstr[18];
+		ba2str(&st->addr, addrstr);
+		snapshot->path = g_build_filename(storage_root_dir, addrstr, NULL);
+		snapshot->data = g_key_file_to_data(st->keyfile, &snapshot->size, NULL);
+		g_ptr_array_add(snapshots, snapshot);
+
+		st->dirty = false;
+
+	}
+
+	storage_writer.dirty = 0;
+	return snapshots;
+}
+
+/**
+ * Write snapshot data into the temporary file.
+ *
+ * The file is synchronized with the disk, so after the rename the new
+ * content is guaranteed to be complete even if the system crashes. */
+static int storage_snapshot_write_tmp(const struct storage_snapshot *snapshot,
+		const char *tmp) {
+
+	int fd;
+	if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666)) == -1)
+		return -1;
+
+	const char *data = snapshot->data;
+	size_t len = snapshot->size;
+	while (len > 0) {
+		ssize_t ret;
+		if ((ret = write(fd, data, len)) == -1) {
+			if (errno == EINTR)
+				continue;
+			goto fail;
+		}
+		data += ret;
+		len -= ret;
+	}
+
+	if (fsync(fd) == -1)
+		goto fail;
+
+	return close(fd);
+
+fail:
+	close(fd);
+	unlink(tmp);
+	return -1;
+}
+
+/**
+ * Write storage snapshots to the disk.
+ *
+ * Every storage file is replaced atomically with the rename(2) call. All
+ * files are written and synchronized first, and then renamed in a batch
+ * followed by a single synchronization of the storage directory. */
+static void storage_snapshot_write(GPtrArray *snapshots) {
+
+	if (snapshots->len == 0)
+		return;
+
+	char **tmps = g_new0(char *, snapshots->len);
+
+	for (size_t i = 0; i < snapshots->len; i++) {
+		const struct storage_snapshot *snapshot = g_ptr_array_index(snapshots, i);
+		debug("Saving storage: %s", snapshot->path);
+		char *tmp = g_strconcat(snapshot->path, ".tmp", NULL);
+		if (storage_snapshot_write_tmp(snapshot, tmp) == -1) {
+			error("Couldn't save storage: %s: %s", tmp, strerror(errno));
+			g_free(tmp);
+			continue;
+		}
+		tmps[i] = tmp;
+	}
+
+	for (size_t i = 0; i < snapshots->len; i++) {
+		const struct storage_snapshot *snapshot = g_ptr_array_index(snapshots, i);
+		if (tmps[i] == NULL)
+			continue;
+		if (rename(tmps[i], snapshot->path) == -1) {
+			error("Couldn't save storage: %s: %s", snapshot->path, strerror(errno));
+			unlink(tmps[i]);
+		}
+		g_free(tmps[i]);
+	}
+
+	int fd;
+	if ((fd = open(storage_root_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) != -1) {
+		if (fsync(fd) == -1)
+			warn("Couldn't sync storage directory: %s", strerror(errno));
+		close(fd);
+	}
+
+	g_free(tmps);
+
+}
+
+/**
+ * Get the time when pending changes shall be written.
+ *
+ * This function shall be called with the storage mutex locked. */
+static void storage_writer_get_deadline(struct timespec *deadline) {
+
+	const struct timespec delay = {
+		.tv_sec = BA_STORAGE_WRITE_DELAY / 1000,
+		.tv_nsec = BA_STORAGE_WRITE_DELAY % 1000 * 1000000 };
+	const struct timespec delay_max = {
+		.tv_sec = BA_STORAGE_WRITE_DELAY_MAX / 1000,
+		.tv_nsec = BA_STORAGE_WRITE_DELAY_MAX % 1000 * 1000000 };
+
+	struct timespec ts;
+	timespecadd(&storage_writer.ts_last, &delay, deadline);
+	timespecadd(&storage_writer.ts_first, &delay_max, &ts);
+	if (difftimespec(deadline, &ts, &ts) < 0)
+		timespecadd(&storage_writer.ts_first, &delay_max, deadline);
+
+}
+
+static void *storage_writer_thread(void *arg) {
+	(void)arg;
+
+	pthread_mutex_lock(&storage_mutex);
+
+	for (;;) {
+
+		if (storage_writer.dirty == 0) {
+			storage_writer.flush = false;
+			pthread_cond_broadcast(&storage_writer.cond_synced);
+			if (storage_writer.stop)
+				break;
+			pthread_cond_wait(&storage_writer.cond, &storage_mutex);
+			continue;
+		}
+
+		if (!storage_writer.flush && !storage_writer.stop) {
+
+			struct timespec now, deadline;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			storage_writer_get_deadline(&deadline);
+
+			struct timespec ts;
+			if (difftimespec(&now, &deadline, &ts) > 0) {
+				pthread_cond_timedwait(&storage_writer.cond, &storage_mutex, &deadline);
+				continue;
+			}
+
+		}
+
+		GPtrArray *snapshots = storage_snapshot_take();
+		storage_writer.writing = true;
+
+		pthread_mutex_unlock(&storage_mutex);
+		storage_snapshot_write(snapshots);
+		g_ptr_array_unref(snapshots);
+		pthread_mutex_lock(&storage_mutex);
+
+		storage_writer.writing = false;
+
+	}
+
+	pthread_mutex_unlock(&storage_mutex);
+	return NULL;
+}
+
+/**
+ * Start storage write-behind worker.
+ *
+ * This function shall be called with the storage mutex locked. */
+static int storage_writer_start(void) {
+
+	if (storage_writer.running)
+		return 0;
+
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&storage_writer.cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	storage_writer.stop = false;
+	storage_writer.flush = false;
+
+	/* See the ba_transport_pcm_start() function for information
+	 * why we have to mask all signals. */
+	sigset_t sigset, oldset;
+	sigfillset(&sigset);
+	pthread_sigmask(SIG_SETMASK, &sigset, &oldset);
+
+	int err;
+	err = pthread_create(&storage_writer.thread, NULL, storage_writer_thread, NULL);
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+
+	if (err != 0) {
+		error("Couldn't create storage writer thread: %s", strerror(err));
+		pthread_cond_destroy(&storage_writer.cond);
+		return errno = err, -1;
+	}
+
+	pthread_setname_np(storage_writer.thread, "ba-storage");
+	storage_writer.running = true;
+
+	return 0;
+}
+
+/**
+ * Mark storage as modified and schedule write-behind.
+ *
+ * This function shall be called with the storage mutex locked. */
+static void storage_mark_dirty(struct storage *st) {
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	if (storage_writer.dirty == 0)
+		storage_writer.ts_first = now;
+	storage_writer.ts_last = now;
+
+	if (!st->dirty) {
+		st->dirty = true;
+		storage_writer.dirty++;
+	}
+
+	/* In case of worker start failure, changes will be
+	 * written synchronously during storage cleanup. */
+	if (storage_writer_start() == 0)
+		pthread_cond_signal(&storage_writer.cond);
+
+}
+
+/**
+ * Stop storage write-behind worker.
+ *
+ * All pending changes are written to the disk before the worker exits. */
+static void storage_writer_stop(void) {
+
+	pthread_mutex_lock(&storage_mutex);
+
+	if (!storage_writer.running) {
+		pthread_mutex_unlock(&storage_mutex);
+		return;
+	}
+
+	storage_writer.stop = true;
+	pthread_cond_signal(&storage_writer.cond);
+	pthread_mutex_unlock(&storage_mutex);
+
+	pthread_join(storage_writer.thread, NULL);
+	pthread_cond_destroy(&storage_writer.cond);
+	storage_writer.running = false;
+
+}
+
+/**
+ * Preload all storage files.
+ *
+ * Storage files are indexed in memory during initialization, so the device
+ * connection does not need to access the file system. Also, BlueZ does not
+ * tell which device is selecting the A2DP configuration, so the A2DP cache
+ * has to be available before the device is created. */
+static void storage_preload(void) {
+
+	GDir *dir;
+	if ((dir = g_dir_open(storage_root_dir, 0, NULL)) == NULL)
+		return;
+
+	const char *name;
+	while ((name = g_dir_read_name(dir)) != NULL) {
+
+		/* Remove temporary files left by an interrupted write. Such a file
+		 * might be incomplete, so it shall never replace the storage file. */
+		if (g_str_has_suffix(name, ".tmp")) {
+			char *path = g_build_filename(storage_root_dir, name, NULL);
+			debug("Removing stale storage file: %s", path);
+			if (unlink(path) == -1)
+				warn("Couldn't remove stale storage file: %s", strerror(errno));
+			g_free(path);
+			continue;
+		}
+
+		bdaddr_t addr;
+		if (strlen(name) != 17 || str2ba(name, &addr) == -1)
+			continue;
+
+		struct storage *st;
+		if ((st = storage_new(&addr)) == NULL)
+			continue;
+
+		char *path = g_build_filename(storage_root_dir, name, NULL);
+
+		GError *err = NULL;
+		if (g_key_file_load_from_file(st->keyfile, path, G_KEY_FILE_NONE, &err))
+			storage_a2dp_cache_load_keyfile(st->keyfile);
+		else {
+			warn("Couldn't load storage: %s", err->message);
+			g_error_free(err);
+		}
+
+		g_free(path);
+
+	}
+
+	g_dir_close(dir);
+
+	debug("Loaded storage files: %u", g_hash_table_size(storage_map));
+	debug("Loaded A2DP configuration cache entries: %u",
+			g_hash_table_size(storage_a2dp_cache));
+
+}
+
 /**
  * Initialize BlueALSA persistent storage.
  *
@@ -92,63 +554,111 @@ int storage_init(const char *root) {
 	if (mkdir(storage_root_dir, S_IRWXU) == -1 && errno != EEXIST)
 		warn("Couldn't create storage directory: %s", strerror(errno));
 
-	if (storage_map == NULL)
+	pthread_mutex_lock(&storage_mutex);
+
+	if (storage_map == NULL) {
 		storage_map = g_hash_table_new_full(g_bdaddr_hash, g_bdaddr_equal,
 				NULL, (GDestroyNotify)storage_free);
+		storage_a2dp_cache = g_hash_table_new_full(g_str_hash, g_str_equal,
+				g_free, g_free);
+		storage_preload();
+	}
+
+	pthread_mutex_unlock(&storage_mutex);
 
 	return 0;
 }
 
 /**
- * Cleanup resources allocated by the persistent storage. */
+ * Cleanup resources allocated by the persistent storage.
+ *
+ * All pending changes are written to the disk before this function
+ * returns. */
 void storage_destroy(void) {
+
 	if (storage_map == NULL)
 		return;
+
+	storage_writer_stop();
+
+	pthread_mutex_lock(&storage_mutex);
+
+	/* write changes which were not handled by the worker */
+	GPtrArray *snapshots = storage_snapshot_take();
+	storage_snapshot_write(snapshots);
+	g_ptr_array_unref(snapshots);
+
 	g_hash_table_unref(storage_map);
 	storage_map = NULL;
+	g_hash_table_unref(storage_a2dp_cache);
+	storage_a2dp_cache = NULL;
+
+	pthread_mutex_unlock(&storage_mutex);
+
 }
 
 /**
- * Load persistent storage file for the given BT device. */
-int storage_device_load(const struct ba_device *d) {
-
-	char addrstr[18];
-	char path[sizeof(storage_root_dir) + sizeof(addrstr)];
-	ba2str(&d->addr, addrstr);
-	snprintf(path, sizeof(path), "%s/%s", storage_root_dir, addrstr);
-	int rv = -1;
+ * Write all pending changes to the disk.
+ *
+ * This function blocks until all changes made before the call are
+ * synchronized with the disk.
+ *
+ * @return On success this function returns 0. Otherwise -1 is returned. */
+int storage_sync(void) {
 
 	pthread_mutex_lock(&storage_mutex);
 
-	debug("Loading storage: %s", path);
-
-	struct storage *st;
-	if ((st = storage_new(&d->addr)) == NULL)
+	if (storage_map == NULL)
 		goto final;
 
-	GError *err = NULL;
-	if (!g_key_file_load_from_file(st->keyfile, path, G_KEY_FILE_NONE, &err)) {
-		if (err->code != G_FILE_ERROR_NOENT)
-			warn("Couldn't load storage: %s", err->message);
-		g_error_free(err);
+	if (!storage_writer.running) {
+		GPtrArray *snapshots = storage_snapshot_take();
+		storage_snapshot_write(snapshots);
+		g_ptr_array_unref(snapshots);
 		goto final;
 	}
 
-	rv = 0;
+	storage_writer.flush = true;
+	pthread_cond_signal(&storage_writer.cond);
+
+	while (storage_writer.dirty > 0 || storage_writer.writing)
+		pthread_cond_wait(&storage_writer.cond_synced, &storage_mutex);
 
 final:
+	pthread_mutex_unlock(&storage_mutex);
+	return 0;
+}
+
+/**
+ * Load persistent storage for the given BT device.
+ *
+ * Storage files are preloaded during initialization, so this function does
+ * not access the file system.
+ *
+ * @return This function returns 0 if the storage for the given device was
+ *   found. Otherwise, empty storage is created and -1 is returned. */
+int storage_device_load(const struct ba_device *d) {
+
+	int rv = -1;
+
+	pthread_mutex_lock(&storage_mutex);
+
+	if (storage_lookup(&d->addr) != NULL)
+		rv = 0;
+	else if (storage_new(&d->addr) == NULL)
+		warn("Couldn't create storage: %s", strerror(ENOMEM));
+
 	pthread_mutex_unlock(&storage_mutex);
 	return rv;
 }
 
 /**
- * Save persistent storage file for the given BT device. */
+ * Save persistent storage for the given BT device.
+ *
+ * The storage is written to the disk asynchronously by the write-behind
+ * worker without the usual debounce delay. */
 int storage_device_save(const struct ba_device *d) {
 
-	char addrstr[18];
-	char path[sizeof(storage_root_dir) + sizeof(addrstr)];
-	ba2str(&d->addr, addrstr);
-	snprintf(path, sizeof(path), "%s/%s", storage_root_dir, addrstr);
 	int rv = -1;
 
 	pthread_mutex_lock(&storage_mutex);
@@ -157,17 +667,8 @@ int storage_device_save(const struct ba_device *d) {
 	if ((st = storage_lookup(&d->addr)) == NULL)
 		goto final;
 
-	debug("Saving storage: %s", path);
-
-	GError *err = NULL;
-	if (!g_key_file_save_to_file(st->keyfile, path, &err)) {
-		error("Couldn't save storage: %s", err->message);
-		g_error_free(err);
-		goto final;
-	}
-
-	/* remove the storage from the map */
-	g_hash_table_remove(storage_map, &d->addr);
+	storage_writer.flush = true;
+	storage_mark_dirty(st);
 
 	rv = 0;
 
@@ -190,6 +691,7 @@ int storage_device_clear(const struct ba_device *d) {
 
 	g_key_file_free(st->keyfile);
 	st->keyfile = g_key_file_new();
+	storage_mark_dirty(st);
 
 	rv = 0;
 
@@ -416,6 +918,202 @@ int storage_pcm_data_update(const struct ba_transport_pcm *pcm) {
 
 	storage_pcm_data_update_delay(keyfile, group, pcm);
 	storage_pcm_data_update_volume(keyfile, group, pcm);
+	storage_mark_dirty(st);
+
+	rv = 0;
+
+final:
+	pthread_mutex_unlock(&storage_mutex);
+	return rv;
+}
+
+/**
+ * Lookup cached A2DP configuration for given remote SEP capabilities.
+ *
+ * @param sep Local A2DP SEP.
+ * @param capabilities Remote A2DP SEP capabilities.
+ * @param size The size of the capabilities blob.
+ * @param configuration Address where the configuration shall be stored.
+ *   It shall be big enough to hold the capabilities blob size.
+ * @return This function returns 1 or 0 respectively if the configuration
+ *   was found in the cache or not. */
+int storage_a2dp_configuration_lookup(const struct a2dp_sep *sep,
+		const void *capabilities, size_t size, void *configuration) {
+
+	if (size != sep->config.caps_size)
+		return 0;
+
+	char local_caps_hex[sizeof(a2dp_t) * 2 + 1];
+	char remote_caps_hex[sizeof(a2dp_t) * 2 + 1];
+	bin2hex(&sep->config.capabilities, local_caps_hex, sep->config.caps_size);
+	bin2hex(capabilities, remote_caps_hex, size);
+
+	char *sep_key = storage_a2dp_sep_key(sep);
+	char *preferences = storage_a2dp_preferences();
+	char *key = storage_a2dp_cache_key(sep_key, local_caps_hex, remote_caps_hex, preferences);
+	int rv = 0;
+
+	pthread_mutex_lock(&storage_mutex);
+
+	const char *value;
+	if (storage_a2dp_cache != NULL &&
+			(value = g_hash_table_lookup(storage_a2dp_cache, key)) != NULL &&
+			strlen(value) == size * 2 &&
+			hex2bin(value, configuration, size * 2) == (ssize_t)size)
+		rv = 1;
+
+	pthread_mutex_unlock(&storage_mutex);
+
+	g_free(sep_key);
+	g_free(preferences);
+	g_free(key);
+	return rv;
+}
+
+/**
+ * Update A2DP configuration cache with the accepted configuration.
+ *
+ * @param d The device which accepted the configuration.
+ * @param sep Local A2DP SEP.
+ * @param capabilities Remote A2DP SEP capabilities.
+ * @param size The size of the capabilities and configuration blobs.
+ * @param configuration Accepted A2DP configuration.
+ * @return On success this function returns 0. Otherwise -1 is returned. */
+int storage_a2dp_configuration_update(const struct ba_device *d,
+		const struct a2dp_sep *sep, const void *capabilities, size_t size,
+		const void *configuration) {
+
+	if (size != sep->config.caps_size)
+		return -1;
+
+	char local_caps_hex[sizeof(a2dp_t) * 2 + 1];
+	char remote_caps_hex[sizeof(a2dp_t) * 2 + 1];
+	char configuration_hex[sizeof(a2dp_t) * 2 + 1];
+	bin2hex(&sep->config.capabilities, local_caps_hex, sep->config.caps_size);
+	bin2hex(capabilities, remote_caps_hex, size);
+	bin2hex(configuration, configuration_hex, size);
+
+	char *sep_key = storage_a2dp_sep_key(sep);
+	char *preferences = storage_a2dp_preferences();
+	int rv = -1;
+
+	pthread_mutex_lock(&storage_mutex);
+
+	if (storage_a2dp_cache != NULL)
+		g_hash_table_replace(storage_a2dp_cache,
+				storage_a2dp_cache_key(sep_key, local_caps_hex, remote_caps_hex, preferences),
+				g_strdup(configuration_hex));
+
+	struct storage *st;
+	if ((st = storage_lookup(&d->addr)) == NULL)
+		if ((st = storage_new(&d->addr)) == NULL)
+			goto final;
+
+	const char * const list[] = {
+		local_caps_hex, remote_caps_hex, configuration_hex, preferences };
+	g_key_file_set_string_list(st->keyfile, BA_STORAGE_GROUP_A2DP, sep_key,
+			list, ARRAYSIZE(list));
+	storage_mark_dirty(st);
+
+	rv = 0;
+
+final:
+	pthread_mutex_unlock(&storage_mutex);
+	g_free(sep_key);
+	g_free(preferences);
+	return rv;
+}
+
+/**
+ * Get the storage group for the HFP/HSP transport. */
+static const char *storage_hfp_group(const struct ba_transport *t) {
+	if (t->profile & BA_TRANSPORT_PROFILE_HFP_AG)
+		return BA_STORAGE_GROUP_HFP_AG;
+	if (t->profile & BA_TRANSPORT_PROFILE_HFP_HF)
+		return BA_STORAGE_GROUP_HFP_HF;
+	return NULL;
+}
+
+/**
+ * Load SLC data cached during the last HFP connection.
+ *
+ * @param t The HFP transport.
+ * @param features Address where the remote features shall be stored.
+ * @param codec_id Address where the selected codec ID shall be stored.
+ * @return This function returns 1 or 0 respectively if the SLC data was
+ *   found in the storage or not. */
+int storage_hfp_slc_load(const struct ba_transport *t,
+		uint32_t *features, uint8_t *codec_id) {
+
+	const struct ba_device *d = t->d;
+	const char *group;
+	int rv = 0;
+
+	if ((group = storage_hfp_group(t)) == NULL)
+		return 0;
+
+	pthread_mutex_lock(&storage_mutex);
+
+	struct storage *st;
+	if ((st = storage_lookup(&d->addr)) == NULL)
+		goto final;
+
+	GKeyFile *keyfile = st->keyfile;
+	if (!g_key_file_has_key(keyfile, group, BA_STORAGE_KEY_FEATURES, NULL) ||
+			!g_key_file_has_key(keyfile, group, BA_STORAGE_KEY_CODEC, NULL))
+		goto final;
+
+	char *codec;
+	if ((codec = g_key_file_get_string(keyfile, group, BA_STORAGE_KEY_CODEC, NULL)) == NULL)
+		goto final;
+
+	*features = g_key_file_get_uint64(keyfile, group, BA_STORAGE_KEY_FEATURES, NULL);
+	*codec_id = hfp_codec_id_from_string(codec);
+	g_free(codec);
+
+	rv = *codec_id != HFP_CODEC_UNDEFINED;
+
+final:
+	pthread_mutex_unlock(&storage_mutex);
+	return rv;
+}
+
+/**
+ * Update SLC data cached for the next HFP connection.
+ *
+ * @param t The HFP transport.
+ * @param features Remote features.
+ * @param codec_id Selected codec ID or HFP_CODEC_UNDEFINED in order to
+ *   invalidate cached data.
+ * @return On success this function returns 0. Otherwise -1 is returned. */
+int storage_hfp_slc_update(const struct ba_transport *t,
+		uint32_t features, uint8_t codec_id) {
+
+	const struct ba_device *d = t->d;
+	const char *group;
+	int rv = -1;
+
+	if ((group = storage_hfp_group(t)) == NULL)
+		return -1;
+
+	pthread_mutex_lock(&storage_mutex);
+
+	struct storage *st;
+	if ((st = storage_lookup(&d->addr)) == NULL)
+		if ((st = storage_new(&d->addr)) == NULL)
+			goto final;
+
+	GKeyFile *keyfile = st->keyfile;
+
+	if (codec_id == HFP_CODEC_UNDEFINED)
+		g_key_file_remove_group(keyfile, group, NULL);
+	else {
+		g_key_file_set_uint64(keyfile, group, BA_STORAGE_KEY_FEATURES, features);
+		g_key_file_set_string(keyfile, group, BA_STORAGE_KEY_CODEC,
+				hfp_codec_id_to_string(codec_id));
+	}
+
+	storage_mark_dirty(st);
 
 	rv = 0;
 
@@ -1,6 +1,6 @@
 /*
  * BlueALSA - storage.h
- * Copyright (c) 2016-2024 Arkadiusz Bokowy
+ * Copyright (c) 2016-2025 Arkadiusz Bokowy
  *
  * This file is a part of bluez-alsa.
  *
@@ -16,11 +16,17 @@
 # include <config.h>
 #endif
 
+#include <stddef.h>
+#include <stdint.h>
+
+#include "a2dp.h"
 #include "ba-device.h"
+#include "ba-transport.h"
 #include "ba-transport-pcm.h"
 
 int storage_init(const char *root);
 void storage_destroy(void);
+int storage_sync(void);
 
 int storage_device_load(const struct ba_device *d);
 int storage_device_save(const struct ba_device *d);
@@ -29,4 +35,15 @@ int storage_device_clear(const struct ba_device *d);
 int storage_pcm_data_sync(struct ba_transport_pcm *pcm);
 int storage_pcm_data_update(const struct ba_transport_pcm *pcm);
 
+int storage_a2dp_configuration_lookup(const struct a2dp_sep *sep,
+		const void *capabilities, size_t size, void *configuration);
+int storage_a2dp_configuration_update(const struct ba_device *d,
+		const struct a2dp_sep *sep, const void *capabilities, size_t size,
+		const void *configuration);
+
+int storage_hfp_slc_load(const struct ba_transport *t,
+		uint32_t *features, uint8_t *codec_id);
+int storage_hfp_slc_update(const struct ba_transport *t,
+		uint32_t features, uint8_t codec_id);
+
 #endif
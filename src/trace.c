@@ -0,0 +1,211 @@
+/*
+ * BlueALSA - trace.c
+ * Copyright (c) 2016-2025 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include "trace.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "shared/log.h"
+#include "shared/rt.h"
+
+/**
+ * Single-producer trace ring.
+ *
+ * Every thread which records trace events owns its ring, so the recording
+ * does not require any locking. The reader takes a snapshot of the ring and
+ * uses the event counter to discard events which might have been overwritten
+ * while the snapshot was taken. */
+struct trace_ring {
+
+	struct trace_ring *next;
+
+	/* owner thread, valid only if ring is in use */
+	pthread_t thread;
+	/* kernel thread ID of the last owner */
+	pid_t tid;
+	/* name of the last owner thread */
+	char name[16];
+	/* ring is owned by a running thread */
+	bool used;
+
+	/* total number of recorded events */
+	atomic_uint_fast64_t head;
+	struct ba_trace_event events[TRACE_RING_SIZE];
+
+};
+
+atomic_bool trace_enabled = false;
+
+/* list of all allocated rings */
+static pthread_mutex_t trace_rings_mtx = PTHREAD_MUTEX_INITIALIZER;
+static struct trace_ring *trace_rings = NULL;
+
+static pthread_once_t trace_ring_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t trace_ring_key;
+
+static __thread struct trace_ring *trace_ring = NULL;
+
+/**
+ * Release ring owned by the exiting thread. */
+static void trace_ring_release(void *data) {
+	struct trace_ring *ring = data;
+	pthread_mutex_lock(&trace_rings_mtx);
+	/* Store the name of the thread, so it will be available in the dump
+	 * after the thread has exited. */
+	pthread_getname_np(pthread_self(), ring->name, sizeof(ring->name));
+	ring->used = false;
+	pthread_mutex_unlock(&trace_rings_mtx);
+}
+
+static void trace_ring_key_init(void) {
+	pthread_key_create(&trace_ring_key, trace_ring_release);
+}
+
+/**
+ * Get trace ring for the calling thread.
+ *
+ * Rings are never freed. A ring released by an exited thread is reused by
+ * the next thread which starts recording, so the memory usage is bounded by
+ * the maximal number of concurrently traced threads. */
+static struct trace_ring *trace_ring_acquire(void) {
+
+	struct trace_ring *ring;
+
+	pthread_once(&trace_ring_key_once, trace_ring_key_init);
+
+	pthread_mutex_lock(&trace_rings_mtx);
+
+	for (ring = trace_rings; ring != NULL; ring = ring->next)
+		if (!ring->used)
+			break;
+
+	if (ring == NULL) {
+		if ((ring = calloc(1, sizeof(*ring))) == NULL) {
+			pthread_mutex_unlock(&trace_rings_mtx);
+			warn("Couldn't allocate trace ring: %s", strerror(errno));
+			return NULL;
+		}
+		ring->next = trace_rings;
+		trace_rings = ring;
+	}
+
+	ring->thread = pthread_self();
+	ring->tid = syscall(SYS_gettid);
+	ring->name[0] = '\0';
+	ring->used = true;
+	atomic_store_explicit(&ring->head, 0, memory_order_release);
+
+	pthread_mutex_unlock(&trace_rings_mtx);
+
+	pthread_setspecific(trace_ring_key, ring);
+	return trace_ring = ring;
+}
+
+/**
+ * Record trace event in the ring of the calling thread.
+ *
+ * This function shall not be called directly, use trace_event() macro
+ * instead, which checks whether tracing is enabled. */
+void trace_event_record(
+		enum ba_trace_event_type type,
+		uint32_t arg0,
+		uint32_t arg1) {
+
+	struct trace_ring *ring;
+	if ((ring = trace_ring) == NULL &&
+			(ring = trace_ring_acquire()) == NULL)
+		return;
+
+	struct timespec ts;
+	gettimestamp(&ts);
+
+	const uint_fast64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	struct ba_trace_event *event = &ring->events[head & (TRACE_RING_SIZE - 1)];
+
+	event->timestamp = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	event->type = type;
+	event->arg0 = arg0;
+	event->arg1 = arg1;
+
+	/* Publish event to the reader. */
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+}
+
+/**
+ * Enable or disable trace events recording. */
+void trace_set_enabled(bool enabled) {
+	if (atomic_exchange(&trace_enabled, enabled) != enabled)
+		debug("IO thread tracing: %s", enabled ? "enabled" : "disabled");
+}
+
+/**
+ * Dump events recorded in all trace rings.
+ *
+ * The callback function is called once for every ring which contains at
+ * least one event. It is called with the internal lock held, so it shall
+ * not record any trace events.
+ *
+ * @param cb Callback function called for every non-empty ring.
+ * @param userdata Data passed to the callback function.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int trace_dump(
+		trace_dump_cb cb,
+		void *userdata) {
+
+	struct ba_trace_event *events;
+	if ((events = malloc(sizeof(*events) * TRACE_RING_SIZE)) == NULL)
+		return -1;
+
+	pthread_mutex_lock(&trace_rings_mtx);
+
+	for (struct trace_ring *ring = trace_rings; ring != NULL; ring = ring->next) {
+
+		const uint_fast64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+		const uint_fast64_t first = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+		uint_fast64_t tail = first;
+
+		for (uint_fast64_t i = first; i < head; i++)
+			events[i - first] = ring->events[i & (TRACE_RING_SIZE - 1)];
+
+		atomic_thread_fence(memory_order_acquire);
+		/* Events which were overwritten by the owner thread during the copy
+		 * (including the one which might be being written right now) shall
+		 * be discarded. */
+		const uint_fast64_t head_ = atomic_load_explicit(&ring->head, memory_order_relaxed);
+		if (head_ + 1 > tail + TRACE_RING_SIZE)
+			tail = head_ + 1 - TRACE_RING_SIZE;
+		if (tail >= head)
+			continue;
+
+		char name[sizeof(ring->name)];
+		strcpy(name, ring->name);
+		if (ring->used)
+			pthread_getname_np(ring->thread, name, sizeof(name));
+
+		cb(ring->tid, name, events + (tail - first), head - tail, userdata);
+
+	}
+
+	pthread_mutex_unlock(&trace_rings_mtx);
+
+	free(events);
+	return 0;
+}
@@ -0,0 +1,76 @@
+/*
+ * BlueALSA - trace.h
+ * Copyright (c) 2016-2025 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#pragma once
+#ifndef BLUEALSA_TRACE_H_
+#define BLUEALSA_TRACE_H_
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "shared/trace.h"
+
+/**
+ * Number of events kept in the per-thread trace ring. It shall be a power
+ * of two, so the ring index can be calculated with a simple mask. */
+#define TRACE_RING_SIZE 4096
+
+/**
+ * Global tracing switch.
+ *
+ * It is checked inline by the trace_event() macro, so when tracing is
+ * disabled the cost of a trace point is a single relaxed atomic load. */
+extern atomic_bool trace_enabled;
+
+/**
+ * Record IO thread trace event.
+ *
+ * @param type Trace event type (enum ba_trace_event_type).
+ * @param arg0 The first event specific argument.
+ * @param arg1 The second event specific argument. */
+#define trace_event(type, arg0, arg1) do { \
+		if (atomic_load_explicit(&trace_enabled, memory_order_relaxed)) \
+			trace_event_record(type, arg0, arg1); \
+	} while (0)
+
+void trace_event_record(
+		enum ba_trace_event_type type,
+		uint32_t arg0,
+		uint32_t arg1);
+
+void trace_set_enabled(bool enabled);
+
+/**
+ * Callback function for the trace_dump() function.
+ *
+ * @param tid Kernel thread ID of the ring owner.
+ * @param name Name of the ring owner thread.
+ * @param events Recorded events, the oldest one first.
+ * @param len Number of recorded events.
+ * @param userdata Data passed to the trace_dump() function. */
+typedef void (*trace_dump_cb)(
+		pid_t tid,
+		const char *name,
+		const struct ba_trace_event *events,
+		size_t len,
+		void *userdata);
+
+int trace_dump(
+		trace_dump_cb cb,
+		void *userdata);
+
+#endif
@@ -27,6 +27,7 @@
 #include "ba-transport.h"
 #include "ba-config.h"
 #include "dbus.h"
+#include "rwlock.h"
 #include "utils.h"
 #include "shared/log.h"
 
@@ -75,18 +76,18 @@ static void upower_signal_display_device_changed(GDBusConnection *conn, const ch
 		for (size_t i = 0; i < HCI_MAX_DEV; i++) {
 			if ((a = ba_adapter_lookup(i)) == NULL)
 				continue;
-			pthread_mutex_lock(&a->devices_mutex);
+			rwlock_rdlock(&a->devices_lock);
 			g_hash_table_iter_init(&iter_d, a->devices);
 			while (g_hash_table_iter_next(&iter_d, NULL, (gpointer)&d)) {
-				pthread_mutex_lock(&d->transports_mutex);
+				rwlock_rdlock(&d->transports_lock);
 				g_hash_table_iter_init(&iter_t, d->transports);
 				while (g_hash_table_iter_next(&iter_t, NULL, (gpointer)&t))
 					if (t->profile & BA_TRANSPORT_PROFILE_MASK_SCO &&
 							t->sco.rfcomm != NULL)
 						ba_rfcomm_send_signal(t->sco.rfcomm, BA_RFCOMM_SIGNAL_UPDATE_BATTERY);
-				pthread_mutex_unlock(&d->transports_mutex);
+				rwlock_rdunlock(&d->transports_lock);
 			}
-			pthread_mutex_unlock(&a->devices_mutex);
+			rwlock_rdunlock(&a->devices_lock);
 			ba_adapter_unref(a);
 		}
 
@@ -15,6 +15,9 @@
 #endif
 
 #include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -140,6 +143,66 @@ gboolean g_bdaddr_equal(const void *v1, const void *v2) {
 	return bacmp(v1, v2) == 0;
 }
 
+/**
+ * Parse CPU list into the CPU set.
+ *
+ * The CPU list is a comma-separated list of CPU numbers or ranges of CPU
+ * numbers, e.g. "0,2-3". This is the same format as used by taskset(1).
+ *
+ * @param str CPU list string.
+ * @param set Address of the CPU set where parsed CPUs will be stored.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int cpu_set_parse(const char *str, cpu_set_t *set) {
+
+	CPU_ZERO(set);
+
+	do {
+
+		char *endptr;
+		unsigned long first = strtoul(str, &endptr, 10);
+		unsigned long last = first;
+
+		if (endptr == str)
+			goto fail;
+		if (*endptr == '-') {
+			str = endptr + 1;
+			last = strtoul(str, &endptr, 10);
+			if (endptr == str || last < first)
+				goto fail;
+		}
+
+		if (last >= CPU_SETSIZE)
+			goto fail;
+		for (unsigned long cpu = first; cpu <= last; cpu++)
+			CPU_SET(cpu, set);
+
+		if (*endptr != ',' && *endptr != '\0')
+			goto fail;
+		str = endptr + 1;
+
+	} while (str[-1] == ',');
+
+	return 0;
+
+fail:
+	errno = EINVAL;
+	return -1;
+}
+
+/**
+ * Set CPU affinity of the given thread.
+ *
+ * @param thread Thread for which the CPU affinity shall be set.
+ * @param set CPU set. If the set is empty, this function does nothing.
+ * @return On success this function returns 0. Otherwise, the error
+ *   number is returned. */
+int thread_set_cpu_affinity(pthread_t thread, const cpu_set_t *set) {
+	if (CPU_COUNT(set) == 0)
+		return 0;
+	return pthread_setaffinity_np(thread, sizeof(*set), set);
+}
+
 #if ENABLE_MP3LAME
 /**
  * Get maximum possible bitrate for the given bitrate mask.
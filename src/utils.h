@@ -16,6 +16,8 @@
 # include <config.h>
 #endif
 
+#include <pthread.h>
+#include <sched.h>
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -36,6 +38,9 @@ GSource *g_io_create_watch_full(GIOChannel *channel, int priority,
 unsigned int g_bdaddr_hash(const void *v);
 gboolean g_bdaddr_equal(const void *v1, const void *v2);
 
+int cpu_set_parse(const char *str, cpu_set_t *set);
+int thread_set_cpu_affinity(pthread_t thread, const cpu_set_t *set);
+
 #if ENABLE_MP3LAME
 int a2dp_mpeg1_mp3_get_max_bitrate(uint16_t mask);
 const char *lame_encode_strerror(int err);
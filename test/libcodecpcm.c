@@ -0,0 +1,98 @@
+/*
+ * libcodecpcm.c
+ * Copyright (c) 2016-2025 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+/*
+ * Pass-through A2DP codec module used for testing the codec module ABI.
+ * It registers itself for the SBC codec, but instead of encoding audio it
+ * packs raw PCM samples into fixed-size frames.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bluealsa-codec.h"
+#include "shared/a2dp-codecs.h"
+#include "shared/defs.h"
+
+/* number of PCM frames in a single codec frame */
+#define CODEC_PCM_BLOCK_FRAMES 64
+
+struct codec_pcm {
+	size_t block_samples;
+	size_t frame_size;
+};
+
+static void *codec_pcm_init(const struct bluealsa_codec_params *params,
+		enum bluealsa_codec_direction direction, struct bluealsa_codec_info *info) {
+	(void)direction;
+
+	struct codec_pcm *codec;
+	if ((codec = malloc(sizeof(*codec))) == NULL)
+		return NULL;
+
+	codec->block_samples = CODEC_PCM_BLOCK_FRAMES * params->channels;
+	codec->frame_size = codec->block_samples * params->sample_size;
+
+	info->block_samples = codec->block_samples;
+	info->frame_size = codec->frame_size;
+
+	return codec;
+}
+
+static void codec_pcm_free(void *codec) {
+	free(codec);
+}
+
+static ssize_t codec_pcm_encode_batch(void *ctx, const void *pcm, size_t samples,
+		size_t *consumed, void *payload, size_t size, unsigned int *frames) {
+
+	const struct codec_pcm *codec = ctx;
+	size_t n = MIN(*frames, samples / codec->block_samples);
+	n = MIN(n, size / codec->frame_size);
+
+	memcpy(payload, pcm, n * codec->frame_size);
+	*consumed = n * codec->block_samples;
+	*frames = n;
+
+	return n * codec->frame_size;
+}
+
+static ssize_t codec_pcm_decode_batch(void *ctx, const void *payload, size_t size,
+		unsigned int frames, void *pcm, size_t samples) {
+
+	const struct codec_pcm *codec = ctx;
+	if (size < frames * codec->frame_size)
+		return -EBADMSG;
+
+	size_t n = MIN(frames, samples / codec->block_samples);
+	memcpy(pcm, payload, n * codec->frame_size);
+
+	return n * codec->block_samples;
+}
+
+static unsigned int codec_pcm_get_delay(void *ctx) {
+	(void)ctx;
+	return CODEC_PCM_BLOCK_FRAMES;
+}
+
+const struct bluealsa_codec_module bluealsa_codec_module = {
+	.abi_version = BLUEALSA_CODEC_ABI_VERSION,
+	.size = sizeof(struct bluealsa_codec_module),
+	.name = "PCM",
+	.codec_id = A2DP_CODEC_SBC,
+	.directions = BLUEALSA_CODEC_ENCODER | BLUEALSA_CODEC_DECODER,
+	.flags = BLUEALSA_CODEC_FLAG_RTP_MEDIA_HEADER,
+	.init = codec_pcm_init,
+	.free = codec_pcm_free,
+	.encode_batch = codec_pcm_encode_batch,
+	.decode_batch = codec_pcm_decode_batch,
+	.get_delay = codec_pcm_get_delay,
+};
@@ -140,7 +140,6 @@ static void *mock_dec(struct ba_transport_pcm *t_pcm) {
 		const size_t frames = samples / channels;
 		x = snd_pcm_sine_s16_2le(buffer, channels, frames, 146.83 / rate, x);
 
-		io_pcm_scale(t_pcm, buffer, samples);
 		if (io_pcm_write(t_pcm, buffer, samples) == -1)
 			error("PCM write error: %s", strerror(errno));
 
@@ -278,10 +277,12 @@ static struct ba_transport *mock_transport_new_midi(const char *path) {
 
 	int fds[2];
 	socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0, fds);
+	pthread_mutex_lock(&t->midi.ble_notify_mtx);
 	ble_midi_encode_set_mtu(&t->midi.ble_encoder, 23);
 	/* link read and write ends with each other */
 	t->midi.ble_fd_write = fds[1];
 	t->midi.ble_fd_notify = fds[0];
+	pthread_mutex_unlock(&t->midi.ble_notify_mtx);
 
 	midi_transport_start_watch_ble_midi(t);
 
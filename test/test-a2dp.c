@@ -16,7 +16,11 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <check.h>
 #include <glib.h>
@@ -26,13 +30,17 @@
 #include "a2dp-aptx.h"
 #include "a2dp-faststream.h"
 #include "a2dp-sbc.h"
+#include "ba-broadcast.h"
 #include "ba-config.h"
+#include "ba-mix.h"
 #include "ba-transport.h"
 #include "ba-transport-pcm.h"
+#include "codec-lib.h"
 #include "codec-sbc.h"
 #include "shared/a2dp-codecs.h"
 #include "shared/defs.h"
 #include "shared/log.h"
+#include "shared/rt.h"
 
 #include "inc/check.inc"
 
@@ -42,6 +50,11 @@ bool ba_transport_pcm_is_active(const struct ba_transport_pcm *pcm) { (void)pcm;
 int ba_transport_pcm_release(struct ba_transport_pcm *pcm) { (void)pcm; return -1; }
 int ba_transport_stop_if_no_clients(struct ba_transport *t) { (void)t; return -1; }
 int ba_transport_pcm_bt_release(struct ba_transport_pcm *pcm) { (void)pcm; return -1; }
+void ba_transport_media_bc_init(struct ba_transport *t, uint16_t format,
+		unsigned int rate) { (void)t; (void)format; (void)rate; }
+int ba_transport_media_bc_start(struct ba_transport *t,
+		ba_transport_pcm_thread_func th_func, const char *name) {
+	(void)t; (void)th_func; (void)name; return -1; }
 int ba_transport_pcm_start(struct ba_transport_pcm *pcm,
 		ba_transport_pcm_thread_func th_func, const char *name) {
 	(void)pcm; (void)th_func; (void)name; return -1; }
@@ -53,6 +66,16 @@ enum ba_transport_pcm_signal ba_transport_pcm_signal_recv(struct ba_transport_pc
 void ba_transport_pcm_thread_cleanup(struct ba_transport_pcm *pcm) { (void)pcm; }
 int ba_transport_pcm_delay_sync(struct ba_transport_pcm *pcm, unsigned int update_mask) {
 	(void)pcm; (void)update_mask; return -1; }
+ssize_t ba_broadcast_bt_write(struct ba_transport_pcm *pcm, const void *buffer, size_t count) {
+	(void)pcm; (void)buffer; (void)count; return -1; }
+void ba_broadcast_drain(struct ba_transport_pcm *pcm) { (void)pcm; }
+void ba_broadcast_pcm_tee(struct ba_transport_pcm *pcm, const void *buffer, size_t len) {
+	(void)pcm; (void)buffer; (void)len; }
+ssize_t ba_mix_pcm_write(struct ba_mix *mix, struct ba_transport_pcm *pcm,
+		const void *buffer, size_t samples) {
+	(void)mix; (void)pcm; (void)buffer; return samples; }
+void bluealsa_dbus_pcm_update(struct ba_transport_pcm *pcm, unsigned int mask) {
+	(void)pcm; (void)mask; }
 
 CK_START_TEST(test_a2dp_codecs_codec_id_from_string) {
 	ck_assert_uint_eq(a2dp_codecs_codec_id_from_string("SBC"), A2DP_CODEC_SBC);
@@ -246,6 +269,112 @@ CK_START_TEST(test_a2dp_caps) {
 
 } CK_END_TEST
 
+static long test_get_rss_kb(void) {
+	FILE *f;
+	long size, resident = 0;
+	if ((f = fopen("/proc/self/statm", "r")) != NULL) {
+		if (fscanf(f, "%ld %ld", &size, &resident) != 2)
+			resident = 0;
+		fclose(f);
+	}
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+CK_START_TEST(test_a2dp_sep_libs_load) {
+
+	struct a2dp_sep * const * seps = a2dp_seps;
+	for (const struct a2dp_sep *sep = *seps; sep != NULL; sep = *++seps) {
+
+		struct timespec ts_begin, ts_end, ts_diff;
+		const long rss = test_get_rss_kb();
+		gettimestamp(&ts_begin);
+
+		/* Run the same steps as the daemon does at startup. */
+		bool available = codec_lib_probe_all(sep->libs) == 0;
+		if (available && sep->init != NULL)
+			available = sep->init((struct a2dp_sep *)sep) == 0;
+
+		gettimestamp(&ts_end);
+		timespecsub(&ts_end, &ts_begin, &ts_diff);
+
+		/* Report startup cost of every enabled codec. */
+		info("%s: startup: %ld us, %+ld kB RSS%s", sep->name,
+				(long)(ts_diff.tv_sec * 1000000 + ts_diff.tv_nsec / 1000),
+				test_get_rss_kb() - rss, available ? "" : " (not available)");
+
+		if (sep->libs == NULL)
+			continue;
+
+#if ENABLE_CODEC_DLOPEN
+		/* Checking availability shall not load libraries. */
+		for (size_t i = 0; sep->libs[i] != NULL; i++)
+			if (sep->libs[i]->soname != NULL && sep->libs[i]->load_time_us == 0)
+				ck_assert_int_eq(codec_lib_is_loaded(sep->libs[i]), false);
+#endif
+
+		for (size_t i = 0; sep->libs[i] != NULL; i++) {
+			struct codec_lib *lib = sep->libs[i];
+
+			/* Libraries might be shared between SEPs. */
+			if (lib->load_time_us != 0)
+				continue;
+
+#if ENABLE_CODEC_DLOPEN
+			/* Without the SEP being used, its libraries shall not be loaded. */
+			if (lib->soname != NULL)
+				ck_assert_int_eq(codec_lib_is_loaded(lib), false);
+#endif
+
+			if (codec_lib_load(lib) == -1) {
+				warn("Couldn't load %s library: %s", lib->name, strerror(errno));
+				continue;
+			}
+
+			ck_assert_int_eq(codec_lib_is_loaded(lib), true);
+			/* Report the cost of loading the library on the first use. */
+			info("%s: %s library: %u us, %+ld kB RSS", sep->name, lib->name,
+					lib->load_time_us, lib->load_rss_kb);
+
+		}
+
+	}
+
+} CK_END_TEST
+
+#if ENABLE_CODEC_DLOPEN
+/* symbol which is not exported by the C library */
+void test_codec_lib_missing(void);
+# define TEST_CODEC_LIB_SYMBOLS(X) X(abs) X(test_codec_lib_missing)
+CODEC_LIB_DEFINE(codec_lib_test, "Test", "libc.so.6", TEST_CODEC_LIB_SYMBOLS);
+CODEC_LIB_DEFINE(codec_lib_test_missing, "Missing", "libbluealsa-missing.so.0", TEST_CODEC_LIB_SYMBOLS);
+#endif
+
+CK_START_TEST(test_codec_lib_load_failure) {
+#if ENABLE_CODEC_DLOPEN
+
+	/* Library which can not be found shall not be available. */
+	ck_assert_int_eq(codec_lib_probe(&codec_lib_test_missing), -1);
+	ck_assert_int_eq(codec_lib_test_missing.failed, true);
+	ck_assert_int_eq(codec_lib_load(&codec_lib_test_missing), -1);
+
+	/* Existing library shall be found without being loaded. */
+	ck_assert_int_eq(codec_lib_probe(&codec_lib_test), 0);
+	ck_assert_int_eq(codec_lib_is_loaded(&codec_lib_test), false);
+
+	/* Missing symbols are detected on the first load. */
+	ck_assert_int_eq(codec_lib_load(&codec_lib_test), -1);
+	ck_assert_int_eq(codec_lib_test.failed, true);
+	/* Resolved symbols shall not point into the unloaded library. */
+	ck_assert_ptr_eq(CODEC_LIB_SYM(codec_lib_test, abs), NULL);
+
+	/* Failed library shall not be loaded again. */
+	ck_assert_int_eq(codec_lib_load(&codec_lib_test), -1);
+	ck_assert_int_eq(codec_lib_probe(&codec_lib_test), -1);
+	ck_assert_int_eq(codec_lib_is_loaded(&codec_lib_test), false);
+
+#endif
+} CK_END_TEST
+
 CK_START_TEST(test_a2dp_caps_intersect) {
 
 	a2dp_sbc_t caps_sbc = {
@@ -439,6 +568,8 @@ int main(void) {
 	tcase_add_test(tc, test_a2dp_sep_ptr_cmp);
 	tcase_add_test(tc, test_a2dp_sep_lookup);
 	tcase_add_test(tc, test_a2dp_get_vendor_codec_id);
+	tcase_add_test(tc, test_a2dp_sep_libs_load);
+	tcase_add_test(tc, test_codec_lib_load_failure);
 
 	tcase_add_test(tc, test_a2dp_caps);
 	tcase_add_test(tc, test_a2dp_caps_intersect);
@@ -449,6 +580,7 @@ int main(void) {
 	tcase_add_test(tc, test_a2dp_check_strerror);
 	tcase_add_test(tc, test_a2dp_select_configuration);
 
+
 	srunner_run_all(sr, CK_ENV);
 	int nf = srunner_ntests_failed(sr);
 	srunner_free(sr);
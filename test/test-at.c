@@ -1,6 +1,6 @@
 /*
  * test-at.c
- * Copyright (c) 2016-2023 Arkadiusz Bokowy
+ * Copyright (c) 2016-2025 Arkadiusz Bokowy
  *
  * This file is a part of bluez-alsa.
  *
@@ -8,14 +8,21 @@
  *
  */
 
+#include <errno.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/param.h>
+#include <time.h>
 
 #include <check.h>
 
 #include "at.h"
 #include "hfp.h"
+#include "shared/defs.h"
+#include "shared/log.h"
 
 #include "inc/check.inc"
 
@@ -134,6 +141,208 @@ CK_START_TEST(test_at_parse_multiple_cmds) {
 	ck_assert_str_eq(at.value, "OK");
 } CK_END_TEST
 
+/**
+ * Parse all messages from the given data split into chunks of given size.
+ *
+ * @param data Data to parse.
+ * @param len Length of the data.
+ * @param chunk Chunk size or 0 for random chunk sizes.
+ * @param out Buffer for the string representation of parsed messages.
+ * @param size Size of the output buffer.
+ * @return Number of parsed messages. Invalid messages are counted as well. */
+static size_t parse_chunked(const char *data, size_t len, size_t chunk,
+		char *out, size_t size) {
+
+	struct at_parser parser;
+	struct bt_at at;
+	size_t count = 0;
+
+	at_parser_init(&parser, &at);
+	out[0] = '\0';
+
+	while (len > 0) {
+
+		size_t n = chunk != 0 ? chunk : 1 + random() % 16;
+		n = MIN(n, len);
+		len -= n;
+
+		const char *ptr = data;
+		data += n;
+
+		int rv;
+		while (n > 0 && (rv = at_parser_feed(&parser, &ptr, &n)) != 0) {
+			size_t used = strlen(out);
+			if (rv == -1) {
+				ck_assert_int_eq(errno, EBADMSG);
+				snprintf(&out[used], size - used, "[INVALID]");
+			}
+			else
+				snprintf(&out[used], size - used, "[%s|%s|%s]", at_type2str(at.type),
+						at.command, at.value != NULL ? at.value : "(null)");
+			count++;
+		}
+
+	}
+
+	return count;
+}
+
+CK_START_TEST(test_at_parser_split) {
+
+	const char *stream =
+		"AT+BRSF=756\r"
+		"\r\n+BRSF: 1024\r\n\r\nOK\r\n"
+		"AT+CIND=?\r"
+		"at+cind?\r"
+		"\r\nRING\r\n"
+		"AT+BAC=1,2\r";
+	const char *expected =
+		"[SET|+BRSF|756]"
+		"[RESP|+BRSF| 1024]"
+		"[RESP||OK]"
+		"[TEST|+CIND|(null)]"
+		"[GET|+CIND|(null)]"
+		"[RESP||RING]"
+		"[SET|+BAC|1,2]";
+
+	char out[1024];
+	const size_t len = strlen(stream);
+
+	/* whole stream in a single chunk */
+	ck_assert_uint_eq(parse_chunked(stream, len, len, out, sizeof(out)), 7);
+	ck_assert_str_eq(out, expected);
+
+	/* stream split at every possible position */
+	for (size_t chunk = 1; chunk < len; chunk++) {
+		ck_assert_uint_eq(parse_chunked(stream, len, chunk, out, sizeof(out)), 7);
+		ck_assert_str_eq(out, expected);
+	}
+
+} CK_END_TEST
+
+CK_START_TEST(test_at_parser_invalid) {
+
+	struct at_parser parser;
+	struct bt_at at;
+
+	at_parser_init(&parser, &at);
+
+	const char *data = "ABC\rAT+CLCC\r";
+	size_t len = strlen(data);
+
+	/* invalid message shall be discarded up to the <CR> */
+	ck_assert_int_eq(at_parser_feed(&parser, &data, &len), -1);
+	ck_assert_int_eq(errno, EBADMSG);
+	ck_assert_str_eq(data, "AT+CLCC\r");
+
+	/* parser shall be synchronized with the next message */
+	ck_assert_int_eq(at_parser_feed(&parser, &data, &len), 1);
+	ck_assert_int_eq(at.type, AT_TYPE_CMD);
+	ck_assert_str_eq(at.command, "+CLCC");
+	ck_assert_uint_eq(len, 0);
+
+	char buffer[1024];
+	memset(buffer, 'X', sizeof(buffer));
+	memcpy(buffer, "AT+VGS=", 7);
+	strcpy(&buffer[sizeof(buffer) - 16], "\rAT+VGM=5\r");
+	data = buffer;
+	len = strlen(buffer);
+
+	/* too long message shall not overflow the AT structure */
+	ck_assert_int_eq(at_parser_feed(&parser, &data, &len), -1);
+	ck_assert_int_eq(errno, EBADMSG);
+	ck_assert_int_eq(at_parser_feed(&parser, &data, &len), 1);
+	ck_assert_int_eq(at.type, AT_TYPE_CMD_SET);
+	ck_assert_str_eq(at.command, "+VGM");
+	ck_assert_str_eq(at.value, "5");
+
+} CK_END_TEST
+
+CK_START_TEST(test_at_parser_fuzz) {
+
+	static const char *tokens[] = {
+		"AT", "at", "A", "+BRSF", "+cind", "=", "?", "=?", ":", ",", "1",
+		"\"SC\"", "\r", "\n", "\r\n", "OK", "RING", "ERROR", "\0",
+	};
+
+	char stream[512];
+	char out1[8192];
+	char out2[8192];
+
+	srandom(1234);
+
+	for (size_t i = 0; i < 5000; i++) {
+
+		size_t len = 0;
+		while (len < sizeof(stream) - 16) {
+			if (random() % 8 == 0)
+				/* random byte */
+				stream[len++] = random() % 256;
+			else {
+				const char *token = tokens[random() % ARRAYSIZE(tokens)];
+				size_t n = MAX(strlen(token), 1);
+				memcpy(&stream[len], token, n);
+				len += n;
+			}
+		}
+
+		/* Parsing result shall not depend on the way how
+		 * the stream is split into chunks. */
+		size_t n1 = parse_chunked(stream, len, len, out1, sizeof(out1));
+		size_t n2 = parse_chunked(stream, len, 0, out2, sizeof(out2));
+		ck_assert_uint_eq(n1, n2);
+		ck_assert_str_eq(out1, out2);
+
+	}
+
+} CK_END_TEST
+
+CK_START_TEST(test_at_parser_throughput) {
+
+	const char *messages =
+		"AT+BRSF=756\r"
+		"\r\n+CIND: 0,0,1,4,0,4,0\r\n"
+		"\r\nOK\r\n"
+		"AT+VGS=12\r"
+		"\r\n+CIEV: 2,1\r\n";
+
+	const size_t messages_len = strlen(messages);
+	const size_t repeat = 100000;
+
+	char *stream;
+	const size_t len = messages_len * 64;
+	ck_assert_ptr_ne(stream = malloc(len), NULL);
+	for (size_t i = 0; i < 64; i++)
+		memcpy(&stream[i * messages_len], messages, messages_len);
+
+	struct at_parser parser;
+	struct bt_at at;
+	size_t count = 0;
+
+	at_parser_init(&parser, &at);
+
+	struct timespec ts0, ts1;
+	clock_gettime(CLOCK_MONOTONIC, &ts0);
+
+	for (size_t i = 0; i < repeat / 64; i++) {
+		const char *data = stream;
+		size_t n = len;
+		while (n > 0)
+			if (at_parser_feed(&parser, &data, &n) == 1)
+				count++;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &ts1);
+	const double elapsed = (ts1.tv_sec - ts0.tv_sec) + (ts1.tv_nsec - ts0.tv_nsec) * 1e-9;
+
+	ck_assert_uint_eq(count, (repeat / 64) * 64 * 5);
+	debug("AT parser throughput: %.1f MB/s, %.0f messages/s",
+			(repeat / 64) * len / elapsed / 1e6, count / elapsed);
+
+	free(stream);
+
+} CK_END_TEST
+
 CK_START_TEST(test_at_parse_set_bia) {
 
 	const bool state_ok1[__HFP_IND_MAX] = { 0, true, true, true, true, true, true, true };
@@ -244,6 +453,10 @@ int main(void) {
 	tcase_add_test(tc, test_at_parse_resp_unsolicited);
 	tcase_add_test(tc, test_at_parse_case_sensitivity);
 	tcase_add_test(tc, test_at_parse_multiple_cmds);
+	tcase_add_test(tc, test_at_parser_split);
+	tcase_add_test(tc, test_at_parser_invalid);
+	tcase_add_test(tc, test_at_parser_fuzz);
+	tcase_add_test(tc, test_at_parser_throughput);
 	tcase_add_test(tc, test_at_parse_set_bia);
 	tcase_add_test(tc, test_at_parse_get_cind);
 	tcase_add_test(tc, test_at_parse_set_cmer);
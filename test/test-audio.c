@@ -1,6 +1,6 @@
 /*
  * test-audio.c
- * Copyright (c) 2016-2024 Arkadiusz Bokowy
+ * Copyright (c) 2016-2025 Arkadiusz Bokowy
  *
  * This file is a part of bluez-alsa.
  *
@@ -8,12 +8,14 @@
  *
  */
 
+#include <math.h>
 #include <stdint.h>
 #include <string.h>
 
 #include <check.h>
 
 #include "audio.h"
+#include "audio-resampler.h"
 #include "shared/defs.h"
 
 #include "inc/check.inc"
@@ -147,6 +149,184 @@ CK_START_TEST(test_audio_scale_s32_4le) {
 
 } CK_END_TEST
 
+CK_START_TEST(test_audio_scale_copy) {
+
+	const int16_t in_s16[] = { 0x1234, 0x2345, (int16_t)0xBCDE, (int16_t)0xCDEF };
+	const int32_t in_s32[] = { 0x12345678, 0x23456789, 0x00123456, 0x00ABCDEF };
+	const double scale[] = { 0.5, 0.25 };
+
+	/* scaled copy shall be identical to the in-place scaling */
+
+	int16_t tmp_s16[ARRAYSIZE(in_s16)], dest_s16[ARRAYSIZE(in_s16)];
+	memcpy(tmp_s16, in_s16, sizeof(tmp_s16));
+	audio_scale_s16_2le(tmp_s16, scale, 2, ARRAYSIZE(tmp_s16) / 2);
+	audio_scale_copy_s16_2le(dest_s16, in_s16, scale, 2, ARRAYSIZE(in_s16) / 2);
+	ck_assert_mem_eq(dest_s16, tmp_s16, sizeof(tmp_s16));
+
+	int32_t tmp_s32[ARRAYSIZE(in_s32)], dest_s32[ARRAYSIZE(in_s32)];
+	memcpy(tmp_s32, in_s32, sizeof(tmp_s32));
+	audio_scale_s32_4le(tmp_s32, scale, 2, ARRAYSIZE(tmp_s32) / 2);
+	audio_scale_copy_s32_4le(dest_s32, in_s32, scale, 2, ARRAYSIZE(in_s32) / 2);
+	ck_assert_mem_eq(dest_s32, tmp_s32, sizeof(tmp_s32));
+
+} CK_END_TEST
+
+CK_START_TEST(test_audio_convert) {
+
+	const int16_t s16[] = { 0x0000, 0x1234, -0x4000, INT16_MIN };
+	const int32_t s24[] = { 0x000000, 0x123400, -0x400000, -0x800000 };
+	const int32_t s32[] = { 0x00000000, 0x12340000, -0x40000000, INT32_MIN };
+	const float f32[] = { 0.0f, 0x1234 / 32768.0f, -0.5f, -1.0f };
+
+	int16_t tmp_s16[ARRAYSIZE(s16)];
+	int32_t tmp_s32[ARRAYSIZE(s16)];
+	float tmp_f32[ARRAYSIZE(s16)];
+
+	audio_convert_s16_2le_to_s32_4le(tmp_s32, s16, 24, ARRAYSIZE(s16));
+	ck_assert_mem_eq(tmp_s32, s24, sizeof(s24));
+	audio_convert_s32_4le_to_s16_2le(tmp_s16, s24, 24, ARRAYSIZE(s24));
+	ck_assert_mem_eq(tmp_s16, s16, sizeof(s16));
+
+	audio_convert_s32_4le_to_s32_4le(tmp_s32, 32, s24, 24, ARRAYSIZE(s24));
+	ck_assert_mem_eq(tmp_s32, s32, sizeof(s32));
+	audio_convert_s32_4le_to_s32_4le(tmp_s32, 24, s32, 32, ARRAYSIZE(s32));
+	ck_assert_mem_eq(tmp_s32, s24, sizeof(s24));
+
+	audio_convert_s16_2le_to_f32_4le(tmp_f32, s16, ARRAYSIZE(s16));
+	ck_assert_mem_eq(tmp_f32, f32, sizeof(f32));
+	audio_convert_f32_4le_to_s16_2le(tmp_s16, f32, ARRAYSIZE(f32));
+	ck_assert_mem_eq(tmp_s16, s16, sizeof(s16));
+
+	audio_convert_s32_4le_to_f32_4le(tmp_f32, s32, 32, ARRAYSIZE(s32));
+	ck_assert_mem_eq(tmp_f32, f32, sizeof(f32));
+	audio_convert_f32_4le_to_s32_4le(tmp_s32, f32, 24, ARRAYSIZE(f32));
+	ck_assert_mem_eq(tmp_s32, s24, sizeof(s24));
+
+	/* check clipping of out-of-range float samples */
+	const float f32_clip[] = { 1.0f, 2.0f, -2.0f };
+	audio_convert_f32_4le_to_s16_2le(tmp_s16, f32_clip, ARRAYSIZE(f32_clip));
+	ck_assert_int_eq(tmp_s16[0], INT16_MAX);
+	ck_assert_int_eq(tmp_s16[1], INT16_MAX);
+	ck_assert_int_eq(tmp_s16[2], INT16_MIN);
+	audio_convert_f32_4le_to_s32_4le(tmp_s32, f32_clip, 32, ARRAYSIZE(f32_clip));
+	ck_assert_int_eq(tmp_s32[0], INT32_MAX);
+	ck_assert_int_eq(tmp_s32[1], INT32_MAX);
+	ck_assert_int_eq(tmp_s32[2], INT32_MIN);
+
+} CK_END_TEST
+
+static void sine_f32_2le(float *dest, size_t frames, size_t offset,
+		unsigned int freq, unsigned int rate) {
+	for (size_t i = 0; i < frames; i++) {
+		const float v = 0.5 * sin(2 * M_PI * freq * (offset + i) / rate);
+		dest[i * 2] = dest[i * 2 + 1] = v;
+	}
+}
+
+static double rms_f32(const float *src, size_t samples) {
+	double sum = 0;
+	for (size_t i = 0; i < samples; i++)
+		sum += src[i] * src[i];
+	return sqrt(sum / samples);
+}
+
+CK_START_TEST(test_audio_resampler_is_supported) {
+
+	ck_assert_int_eq(audio_resampler_is_supported(44100, 48000), true);
+	ck_assert_int_eq(audio_resampler_is_supported(48000, 44100), true);
+	ck_assert_int_eq(audio_resampler_is_supported(16000, 48000), true);
+	ck_assert_int_eq(audio_resampler_is_supported(48000, 8000), true);
+
+	/* out of the supported rate range */
+	ck_assert_int_eq(audio_resampler_is_supported(0, 48000), false);
+	ck_assert_int_eq(audio_resampler_is_supported(48000, 768000), false);
+	/* too many filter phases */
+	ck_assert_int_eq(audio_resampler_is_supported(44101, 48000), false);
+
+	ck_assert_uint_eq(audio_resampler_delay_dms(48000, 48000 / 2), 13);
+	ck_assert_uint_eq(audio_resampler_delay_dms(44101, 48000), 0);
+
+	struct audio_resampler r;
+	ck_assert_int_eq(audio_resampler_init(&r, 0, 44100, 48000), -1);
+	ck_assert_int_eq(audio_resampler_init(&r, 2, 44101, 48000), -1);
+
+} CK_END_TEST
+
+CK_START_TEST(test_audio_resampler_frames) {
+
+	static const struct {
+		unsigned int rate_in;
+		unsigned int rate_out;
+	} rates[] = {
+		{ 16000, 48000 },
+		{ 44100, 48000 },
+		{ 48000, 44100 },
+		{ 48000, 16000 },
+	};
+
+	float in[441 * 2];
+	float out[1024 * 2];
+
+	memset(in, 0, sizeof(in));
+
+	for (size_t i = 0; i < ARRAYSIZE(rates); i++) {
+
+		struct audio_resampler r;
+		ck_assert_int_eq(audio_resampler_init(&r, 2,
+					rates[i].rate_in, rates[i].rate_out), 0);
+
+		/* process 1 second of audio in chunks of 10 ms */
+		const size_t frames = rates[i].rate_in / 100;
+		size_t frames_out = 0;
+
+		for (size_t n = 0; n < 100; n++) {
+			ck_assert_uint_le(audio_resampler_frames_out_max(&r, frames), ARRAYSIZE(out) / 2);
+			ssize_t rv = audio_resampler_process(&r, out, in, frames);
+			ck_assert_int_ge(rv, 0);
+			frames_out += rv;
+		}
+
+		/* there shall be no drift between input and output */
+		ck_assert_uint_eq(frames_out, rates[i].rate_out);
+
+		audio_resampler_free(&r);
+
+	}
+
+} CK_END_TEST
+
+CK_START_TEST(test_audio_resampler_quality) {
+
+	float in[480 * 2];
+	float out[523 * 2];
+	size_t frames_out;
+
+	struct audio_resampler r;
+
+	/* pass-band signal shall keep its level */
+	ck_assert_int_eq(audio_resampler_init(&r, 2, 44100, 48000), 0);
+	for (size_t n = frames_out = 0; n < 10; n++) {
+		sine_f32_2le(in, 441, n * 441, 1000, 44100);
+		ssize_t rv = audio_resampler_process(&r, out, in, 441);
+		ck_assert_int_ge(rv, 0);
+		frames_out = rv;
+	}
+	ck_assert_double_eq_tol(rms_f32(out, frames_out * 2), 0.5 / sqrt(2), 0.001);
+	audio_resampler_free(&r);
+
+	/* signal above the output Nyquist frequency shall be rejected */
+	ck_assert_int_eq(audio_resampler_init(&r, 2, 48000, 44100), 0);
+	for (size_t n = frames_out = 0; n < 10; n++) {
+		sine_f32_2le(in, 480, n * 480, 23000, 48000);
+		ssize_t rv = audio_resampler_process(&r, out, in, 480);
+		ck_assert_int_ge(rv, 0);
+		frames_out = rv;
+	}
+	ck_assert_double_le(rms_f32(out, frames_out * 2), 0.001);
+	audio_resampler_free(&r);
+
+} CK_END_TEST
+
 int main(void) {
 
 	Suite *s = suite_create(__FILE__);
@@ -159,6 +339,11 @@ int main(void) {
 	tcase_add_test(tc, test_audio_interleave_deinterleave_s32_4le);
 	tcase_add_test(tc, test_audio_scale_s16_2le);
 	tcase_add_test(tc, test_audio_scale_s32_4le);
+	tcase_add_test(tc, test_audio_scale_copy);
+	tcase_add_test(tc, test_audio_convert);
+	tcase_add_test(tc, test_audio_resampler_is_supported);
+	tcase_add_test(tc, test_audio_resampler_frames);
+	tcase_add_test(tc, test_audio_resampler_quality);
 
 	srunner_run_all(sr, CK_ENV);
 	int nf = srunner_ntests_failed(sr);
@@ -21,7 +21,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <bluetooth/bluetooth.h>
 #include <bluetooth/hci.h>
@@ -41,9 +46,12 @@
 #include "hfp.h"
 #include "midi.h"
 #include "ofono.h"
+#include "sco.h"
 #include "storage.h"
 #include "shared/a2dp-codecs.h"
+#include "shared/defs.h"
 #include "shared/log.h"
+#include "shared/rt.h"
 
 #include "inc/check.inc"
 
@@ -64,6 +72,8 @@ void bluealsa_dbus_pcm_update(struct ba_transport_pcm *pcm, unsigned int mask) {
 	debug("%s: %p %#x", __func__, (void *)pcm, mask); (void)pcm; (void)mask; }
 void bluealsa_dbus_pcm_unregister(struct ba_transport_pcm *pcm) {
 	debug("%s: %p", __func__, (void *)pcm); (void)pcm; }
+void bluealsa_dbus_mix_update(struct ba_mix *mix, unsigned int mask) {
+	debug("%s: %p %#x", __func__, (void *)mix, mask); (void)mix; (void)mask; }
 struct ba_rfcomm *ba_rfcomm_new(struct ba_transport *sco, int fd) {
 	debug("%s: %p", __func__, (void *)sco); (void)sco; (void)fd; return NULL; }
 void ba_rfcomm_destroy(struct ba_rfcomm *r) {
@@ -125,6 +135,53 @@ CK_START_TEST(test_ba_device) {
 
 } CK_END_TEST
 
+static void *test_ba_registry_lookup_thread(void *arg) {
+	const bdaddr_t *addr = arg;
+	for (size_t i = 0; i < 10000; i++) {
+		struct ba_adapter *a;
+		struct ba_device *d;
+		ck_assert_ptr_ne(a = ba_adapter_lookup(i % 2), NULL);
+		ck_assert_ptr_ne(d = ba_device_lookup(a, addr), NULL);
+		ba_device_unref(ba_device_ref(d));
+		ba_device_unref(d);
+		ba_adapter_unref(a);
+	}
+	return NULL;
+}
+
+CK_START_TEST(test_ba_registry_concurrency) {
+
+	struct ba_adapter *a[2];
+	struct ba_device *d[2];
+	bdaddr_t addr = {{ 0x12, 0x34, 0x56, 0x78, 0x90, 0xAB }};
+
+	ck_assert_ptr_ne(a[0] = ba_adapter_new(0), NULL);
+	ck_assert_ptr_ne(a[1] = ba_adapter_new(1), NULL);
+	ck_assert_ptr_ne(d[0] = ba_device_new(a[0], &addr), NULL);
+	ck_assert_ptr_ne(d[1] = ba_device_new(a[1], &addr), NULL);
+
+	pthread_t threads[4];
+	for (size_t i = 0; i < ARRAYSIZE(threads); i++)
+		ck_assert_int_eq(pthread_create(&threads[i], NULL,
+					test_ba_registry_lookup_thread, &addr), 0);
+	for (size_t i = 0; i < ARRAYSIZE(threads); i++)
+		ck_assert_int_eq(pthread_join(threads[i], NULL), 0);
+
+	/* all references taken by lookups shall be released */
+	ck_assert_int_eq(a[0]->ref_count, 1 + 1);
+	ck_assert_int_eq(a[1]->ref_count, 1 + 1);
+	ck_assert_int_eq(d[0]->ref_count, 1);
+	ck_assert_int_eq(d[1]->ref_count, 1);
+
+	ba_device_unref(d[0]);
+	ba_device_unref(d[1]);
+	ba_adapter_unref(a[0]);
+	ba_adapter_unref(a[1]);
+	ck_assert_ptr_eq(ba_adapter_lookup(0), NULL);
+	ck_assert_ptr_eq(ba_adapter_lookup(1), NULL);
+
+} CK_END_TEST
+
 CK_START_TEST(test_ba_transport) {
 
 	struct ba_adapter *a;
@@ -294,6 +351,46 @@ CK_START_TEST(test_ba_transport_threads_sync_termination) {
 
 } CK_END_TEST
 
+CK_START_TEST(test_ba_transport_sco_link_setup) {
+
+	struct ba_adapter *a;
+	struct ba_device *d;
+	struct ba_transport *t_sco;
+	bdaddr_t addr = { 0 };
+
+	ck_assert_ptr_ne(a = ba_adapter_new(0), NULL);
+	ck_assert_ptr_ne(d = ba_device_new(a, &addr), NULL);
+	ck_assert_int_eq(storage_device_clear(d), 0);
+
+	t_sco = ba_transport_new_sco(d, BA_TRANSPORT_PROFILE_HSP_AG, "/owner", "/path/sco", -1);
+	ck_assert_ptr_ne(t_sco, NULL);
+
+	int fds[2];
+	ck_assert_int_eq(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds), 0);
+
+	struct timespec ts;
+	gettimestamp(&ts);
+	/* the link shall be set up asynchronously */
+	ck_assert_int_eq(ba_transport_sco_link_setup(t_sco, fds[0], &ts), 0);
+	for (size_t i = 0; sco_setup_get_backlog() > 0 && i < 100; i++)
+		usleep(10000);
+	ck_assert_uint_eq(sco_setup_get_backlog(), 0);
+
+	uint32_t histogram[SCO_SETUP_LATENCY_BUCKETS];
+	sco_setup_get_latency(histogram);
+	uint32_t links = 0;
+	for (size_t i = 0; i < ARRAYSIZE(histogram); i++)
+		links += histogram[i];
+	ck_assert_uint_eq(links, 1);
+
+	ba_transport_destroy(t_sco);
+	ba_adapter_unref(a);
+	ba_device_unref(d);
+	ck_assert_ptr_eq(ba_adapter_lookup(0), NULL);
+	close(fds[1]);
+
+} CK_END_TEST
+
 CK_START_TEST(test_ba_transport_pcm_format) {
 
 	uint16_t format_u8 = BA_TRANSPORT_PCM_FORMAT_U8;
@@ -407,6 +504,11 @@ CK_START_TEST(test_storage) {
 	ck_assert_int_eq(fwrite(storage_data, strlen(storage_data), 1, f), 1);
 	ck_assert_int_eq(fclose(f), 0);
 
+	/* Storage files are indexed during initialization, so
+	 * the storage has to be re-initialized to pick up our file. */
+	storage_destroy();
+	ck_assert_int_eq(storage_init(TEST_BLUEALSA_STORAGE_DIR), 0);
+
 	struct ba_adapter *a;
 	struct ba_device *d;
 	struct ba_transport *t;
@@ -448,6 +550,9 @@ CK_START_TEST(test_storage) {
 	ba_transport_unref(t);
 	ck_assert_ptr_eq(ba_adapter_lookup(0), NULL);
 
+	/* wait for the write-behind worker */
+	ck_assert_int_eq(storage_sync(), 0);
+
 	char buffer[1024] = { 0 };
 	ck_assert_ptr_ne(f = fopen(storage_path, "r"), NULL);
 	ck_assert_int_gt(fread(buffer, 1, sizeof(buffer), f), 0);
@@ -471,6 +576,111 @@ CK_START_TEST(test_storage) {
 
 } CK_END_TEST
 
+CK_START_TEST(test_storage_write_coalesce) {
+
+	struct ba_adapter *a;
+	struct ba_device *d;
+	struct ba_transport *t;
+
+	bdaddr_t addr;
+	str2ba("00:11:22:33:44:66", &addr);
+
+	ck_assert_ptr_ne(a = ba_adapter_new(0), NULL);
+	ck_assert_ptr_ne(d = ba_device_new(a, &addr), NULL);
+
+	struct a2dp_sep sep = {
+		.config = { .type = A2DP_SINK, .codec_id = A2DP_CODEC_SBC },
+		.transport_init = sep_transport_init };
+	a2dp_sbc_t configuration = { .channel_mode = SBC_CHANNEL_MODE_STEREO };
+	ck_assert_ptr_ne(t = ba_transport_new_a2dp(d,
+				BA_TRANSPORT_PROFILE_A2DP_SINK, "/owner", "/path", &sep,
+				&configuration), NULL);
+	t->media.pcm.channels = 2;
+
+	/* start with no pending changes */
+	ck_assert_int_eq(storage_pcm_data_update(&t->media.pcm), 0);
+	ck_assert_int_eq(storage_sync(), 0);
+
+	int fd;
+	ck_assert_int_ne(fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC), -1);
+	ck_assert_int_ne(inotify_add_watch(fd, TEST_BLUEALSA_STORAGE_DIR, IN_MOVED_TO), -1);
+	struct pollfd pfd = { fd, POLLIN, 0 };
+
+	/* Several updates within the write delay shall be coalesced. */
+	for (int i = 0; i < 5; i++) {
+		t->media.pcm.client_delay_dms = 10 * i;
+		ck_assert_int_eq(storage_pcm_data_update(&t->media.pcm), 0);
+		ck_assert_int_eq(poll(&pfd, 1, 50), 0);
+	}
+
+	struct timespec ts_begin, ts_end, ts_diff;
+	gettimestamp(&ts_begin);
+	ck_assert_int_eq(poll(&pfd, 1, 2000), 1);
+	gettimestamp(&ts_end);
+	timespecsub(&ts_end, &ts_begin, &ts_diff);
+
+	/* The write is postponed since the last update. */
+	ck_assert_int_ge(timespec2ms(&ts_diff), 400);
+
+	/* No other write shall follow. */
+	usleep(100000);
+	char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t len;
+	ck_assert_int_gt(len = read(fd, buffer, sizeof(buffer)), 0);
+	size_t writes = 0;
+	for (ssize_t i = 0; i < len; ) {
+		const struct inotify_event *ev = (const struct inotify_event *)&buffer[i];
+		if (ev->len > 0 && strcmp(ev->name, "00:11:22:33:44:66") == 0)
+			writes++;
+		i += sizeof(*ev) + ev->len;
+	}
+	ck_assert_uint_eq(writes, 1);
+
+	close(fd);
+
+	ck_assert_int_eq(storage_device_clear(d), 0);
+
+	ba_adapter_unref(a);
+	ba_device_unref(d);
+	ba_transport_unref(t);
+
+} CK_END_TEST
+
+CK_START_TEST(test_storage_tmp_cleanup) {
+
+	const char *storage_path = TEST_BLUEALSA_STORAGE_DIR "/00:11:22:33:44:77";
+	const char *storage_path_tmp = TEST_BLUEALSA_STORAGE_DIR "/00:11:22:33:44:77.tmp";
+	const char *storage_data =
+		"[/org/bluealsa/hci0/dev_00_11_22_33_44_77/a2dpsnk/source]\n"
+		"ClientDelays=SBC:-200\n";
+
+	FILE *f;
+	ck_assert_ptr_ne(f = fopen(storage_path, "w"), NULL);
+	ck_assert_int_eq(fwrite(storage_data, strlen(storage_data), 1, f), 1);
+	ck_assert_int_eq(fclose(f), 0);
+
+	/* simulate a crash in the middle of writing the temporary file */
+	ck_assert_ptr_ne(f = fopen(storage_path_tmp, "w"), NULL);
+	ck_assert_int_eq(fwrite(storage_data, 20, 1, f), 1);
+	ck_assert_int_eq(fclose(f), 0);
+
+	storage_destroy();
+	ck_assert_int_eq(storage_init(TEST_BLUEALSA_STORAGE_DIR), 0);
+
+	/* The partial file shall be removed, and
+	 * the storage file shall be left intact. */
+	ck_assert_int_eq(access(storage_path_tmp, F_OK), -1);
+
+	char buffer[1024] = { 0 };
+	ck_assert_ptr_ne(f = fopen(storage_path, "r"), NULL);
+	ck_assert_int_gt(fread(buffer, 1, sizeof(buffer), f), 0);
+	ck_assert_int_eq(fclose(f), 0);
+	ck_assert_str_eq(buffer, storage_data);
+
+	unlink(storage_path);
+
+} CK_END_TEST
+
 int main(void) {
 
 	assert(mkdir(TEST_BLUEALSA_STORAGE_DIR, 0755) == 0 || errno == EEXIST);
@@ -492,6 +702,7 @@ int main(void) {
 
 	tcase_add_test(tc, test_ba_adapter);
 	tcase_add_test(tc, test_ba_device);
+	tcase_add_test(tc, test_ba_registry_concurrency);
 	tcase_add_test(tc, test_ba_transport);
 #if ENABLE_MIDI
 	tcase_add_test(tc, test_ba_transport_midi);
@@ -499,10 +710,13 @@ int main(void) {
 	tcase_add_test(tc, test_ba_transport_sco_one_only);
 	tcase_add_test(tc, test_ba_transport_sco_default_codec);
 	tcase_add_test(tc, test_ba_transport_threads_sync_termination);
+	tcase_add_test(tc, test_ba_transport_sco_link_setup);
 	tcase_add_test(tc, test_ba_transport_pcm_format);
 	tcase_add_test(tc, test_ba_transport_pcm_volume);
 	tcase_add_test(tc, test_cascade_free);
 	tcase_add_test(tc, test_storage);
+	tcase_add_test(tc, test_storage_write_coalesce);
+	tcase_add_test(tc, test_storage_tmp_cleanup);
 
 	srunner_run_all(sr, CK_ENV);
 	int nf = srunner_ntests_failed(sr);
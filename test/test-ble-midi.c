@@ -9,12 +9,16 @@
  */
 
 #include <errno.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
+#include <sys/param.h>
 
 #include <check.h>
 
 #include "ble-midi.h"
+#include "shared/defs.h"
+#include "shared/log.h"
 #include "shared/rt.h"
 
 #include "inc/check.inc"
@@ -530,6 +534,213 @@ CK_START_TEST(test_ble_midi_encode_system_exclusive) {
 
 } CK_END_TEST
 
+CK_START_TEST(test_ble_midi_encode_running_status) {
+
+	const uint8_t midi1[] = { 0xB0, 0x07, 0x10 };
+	const uint8_t midi2[] = { 0xB0, 0x07, 0x20 };
+	const uint8_t midi3[] = { 0xF8 };
+	const uint8_t midi4[] = { 0xB0, 0x07, 0x30 };
+	const uint8_t midi5[] = { 0x90, 0x40, 0x7f };
+
+	struct ble_midi_enc bme;
+	ble_midi_encode_init(&bme);
+	ble_midi_encode_set_mtu(&bme, 64);
+
+	ck_assert_int_eq(ble_midi_encode(&bme, midi1, sizeof(midi1)), 0);
+	ck_assert_int_eq(ble_midi_encode(&bme, midi2, sizeof(midi2)), 0);
+	ck_assert_int_eq(ble_midi_encode(&bme, midi3, sizeof(midi3)), 0);
+	ck_assert_int_eq(ble_midi_encode(&bme, midi4, sizeof(midi4)), 0);
+	ck_assert_int_eq(ble_midi_encode(&bme, midi5, sizeof(midi5)), 0);
+
+	/* Status bytes of the second and the fourth message shall be omitted,
+	 * because real-time messages do not cancel the running status. */
+	ck_assert_uint_le(bme.len, 1 + (1 + 3) + (1 + 2) + (1 + 1) + (1 + 2) + (1 + 3));
+	ck_assert_uint_ge(bme.len, 1 + (1 + 3) + 2 + (1 + 1) + 2 + (1 + 3));
+
+	/* Make sure that our decoder understands the packed packet. Note, that
+	 * the decoder passes the MIDI running status to the caller as is. */
+	struct ble_midi_dec bmd = { 0 };
+	const uint8_t *messages[] = { midi1, &midi2[1], midi3, &midi4[1], midi5 };
+	const size_t sizes[] = { sizeof(midi1), sizeof(midi2) - 1, sizeof(midi3),
+		sizeof(midi4) - 1, sizeof(midi5) };
+	for (size_t i = 0; i < ARRAYSIZE(messages); i++) {
+		ck_assert_int_eq(ble_midi_decode(&bmd, bme.buffer, bme.len), 1);
+		ck_assert_uint_eq(bmd.len, sizes[i]);
+		ck_assert_mem_eq(bmd.buffer, messages[i], sizes[i]);
+	}
+	ck_assert_int_eq(ble_midi_decode(&bmd, bme.buffer, bme.len), 0);
+
+	ble_midi_decode_free(&bmd);
+
+} CK_END_TEST
+
+CK_START_TEST(test_ble_midi_encode_running_status_with_common) {
+
+	const uint8_t midi1[] = { 0xB0, 0x07, 0x10 };
+	const uint8_t midi2[] = { 0xF3, 0x05 };
+	const uint8_t midi3[] = { 0xB0, 0x07, 0x20 };
+
+	struct ble_midi_enc bme;
+	ble_midi_encode_init(&bme);
+	ble_midi_encode_set_mtu(&bme, 64);
+
+	ck_assert_int_eq(ble_midi_encode(&bme, midi1, sizeof(midi1)), 0);
+	ck_assert_int_eq(ble_midi_encode(&bme, midi2, sizeof(midi2)), 0);
+	ck_assert_int_eq(ble_midi_encode(&bme, midi3, sizeof(midi3)), 0);
+
+	/* Status byte of the third message shall not be omitted,
+	 * because system common messages cancel the running status. */
+	ck_assert_uint_eq(bme.len, 1 + (1 + 3) + (1 + 2) + (1 + 3));
+	ck_assert_mem_eq(&bme.buffer[bme.len - sizeof(midi3)], midi3, sizeof(midi3));
+
+	struct ble_midi_dec bmd = { 0 };
+	const uint8_t *messages[] = { midi1, midi2, midi3 };
+	const size_t sizes[] = { sizeof(midi1), sizeof(midi2), sizeof(midi3) };
+	for (size_t i = 0; i < ARRAYSIZE(messages); i++) {
+		ck_assert_int_eq(ble_midi_decode(&bmd, bme.buffer, bme.len), 1);
+		ck_assert_uint_eq(bmd.len, sizes[i]);
+		ck_assert_mem_eq(bmd.buffer, messages[i], sizes[i]);
+	}
+	ck_assert_int_eq(ble_midi_decode(&bmd, bme.buffer, bme.len), 0);
+
+	ble_midi_decode_free(&bmd);
+
+} CK_END_TEST
+
+CK_START_TEST(test_ble_midi_encode_running_status_new_packet) {
+
+	const uint8_t midi[] = { 0xB0, 0x07, 0x10 };
+
+	struct ble_midi_enc bme;
+	ble_midi_encode_init(&bme);
+	ble_midi_encode_set_mtu(&bme, 8);
+
+	ck_assert_int_eq(ble_midi_encode(&bme, midi, sizeof(midi)), 0);
+	bme.len = 0;
+
+	/* Running status shall not span multiple BLE-MIDI packets. */
+	ck_assert_int_eq(ble_midi_encode(&bme, midi, sizeof(midi)), 0);
+	ck_assert_uint_eq(bme.len, 1 + 1 + sizeof(midi));
+	ck_assert_mem_eq(&bme.buffer[2], midi, sizeof(midi));
+
+} CK_END_TEST
+
+static size_t ble_midi_encode_bytes(bool running_status, size_t events) {
+
+	struct ble_midi_enc bme;
+	ble_midi_encode_init(&bme);
+	ble_midi_encode_set_mtu(&bme, 128);
+	bme.running_status = running_status;
+
+	size_t bytes = 0;
+	for (size_t i = 0; i < events; i++) {
+		/* Simulate controller sweep with channel pressure interleaved. */
+		const uint8_t cc[] = { 0xB0, 0x4A, i & 0x7F };
+		const uint8_t at[] = { 0xD0, i & 0x7F };
+		const uint8_t *midi = i % 8 == 7 ? at : cc;
+		const size_t len = i % 8 == 7 ? sizeof(at) : sizeof(cc);
+		if (ble_midi_encode(&bme, midi, len) == -1) {
+			ck_assert_uint_eq(errno, EMSGSIZE);
+			bytes += bme.len;
+			bme.len = 0;
+			ck_assert_int_eq(ble_midi_encode(&bme, midi, len), 0);
+		}
+	}
+
+	return bytes + bme.len;
+}
+
+CK_START_TEST(test_ble_midi_encode_packing) {
+
+	const size_t events = 1000;
+	size_t bytes_full = ble_midi_encode_bytes(false, events);
+	size_t bytes_packed = ble_midi_encode_bytes(true, events);
+	debug("BLE-MIDI bytes per event: full: %.2f, packed: %.2f",
+			(double)bytes_full / events, (double)bytes_packed / events);
+
+	/* Without running status every CC message takes 4 bytes (timestamp and
+	 * the full MIDI message). With running status, at most 3 bytes shall be
+	 * used even if the timestamp changes between every message. */
+	ck_assert_uint_ge(bytes_full * 10, events * 38);
+	ck_assert_uint_le(bytes_packed * 10, events * 32);
+
+} CK_END_TEST
+
+CK_START_TEST(test_ble_midi_clock) {
+
+	struct ble_midi_clock bmc;
+	ble_midi_clock_init(&bmc, 10);
+
+	struct timespec sender = { 0 };
+	struct timespec host, ts;
+
+	/* Before any update, the latency shall be added to the sender time. */
+	ble_midi_clock_convert(&bmc, &sender, &ts);
+	ck_assert_uint_eq(timespec2ms(&ts), 10);
+
+	unsigned int seed = 1;
+	const double skew = 1.0 - 100e-6;
+	double diff_min = 1e9, diff_max = -1e9;
+	for (size_t i = 0; i < 2 * BLE_MIDI_CLOCK_WINDOW; i++) {
+
+		/* Sender sends a packet every 100 ms, but the packet reception time
+		 * is delayed by the connection interval batching (up to 15 ms). */
+		const double s_ms = i * 100.0;
+		const double h_ms = 1000.0 + s_ms * skew;
+		seed = seed * 1103515245 + 12345;
+		const double delay_ms = (seed >> 16) % 15000 / 1000.0;
+
+		sender.tv_sec = (long long)(s_ms * 1000000) / 1000000000;
+		sender.tv_nsec = (long long)(s_ms * 1000000) % 1000000000;
+		host.tv_sec = (long long)((h_ms + delay_ms) * 1000000) / 1000000000;
+		host.tv_nsec = (long long)((h_ms + delay_ms) * 1000000) % 1000000000;
+		ble_midi_clock_update(&bmc, &sender, &host);
+
+		if (i < BLE_MIDI_CLOCK_WINDOW)
+			continue;
+
+		/* The recovered time shall follow the sender clock, so the difference
+		 * between the recovered time and the true host time shall be almost
+		 * constant, regardless of the reception delay (up to 15 ms). */
+		ble_midi_clock_convert(&bmc, &sender, &ts);
+		const double diff = ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0 - h_ms;
+		diff_min = MIN(diff_min, diff);
+		diff_max = MAX(diff_max, diff);
+
+	}
+
+	debug("BLE-MIDI clock recovery: jitter: %u us, error: %.2f ms",
+			bmc.jitter, diff_max - diff_min);
+
+	ck_assert_double_lt(diff_max - diff_min, 5);
+	ck_assert_uint_gt(bmc.jitter, 2000);
+	ck_assert_uint_lt(bmc.jitter, 6000);
+
+} CK_END_TEST
+
+CK_START_TEST(test_ble_midi_clock_reset) {
+
+	struct ble_midi_clock bmc;
+	ble_midi_clock_init(&bmc, 0);
+
+	struct timespec sender = { .tv_sec = 1 };
+	struct timespec host = { .tv_sec = 5 };
+	struct timespec ts;
+
+	ble_midi_clock_update(&bmc, &sender, &host);
+	ble_midi_clock_convert(&bmc, &sender, &ts);
+	ck_assert_uint_eq(timespec2ms(&ts), 5000);
+
+	/* Time discontinuity shall reset the clock recovery. */
+	host.tv_sec = 10;
+	sender.tv_sec = 2;
+	ble_midi_clock_update(&bmc, &sender, &host);
+	ck_assert_uint_eq(bmc.samples_len, 1);
+	ble_midi_clock_convert(&bmc, &sender, &ts);
+	ck_assert_uint_eq(timespec2ms(&ts), 10000);
+
+} CK_END_TEST
+
 int main(void) {
 
 	Suite *s = suite_create(__FILE__);
@@ -563,6 +774,13 @@ int main(void) {
 	tcase_add_test(tc, test_ble_midi_encode_multiple);
 	tcase_add_test(tc, test_ble_midi_encode_multiple_too_long);
 	tcase_add_test(tc, test_ble_midi_encode_system_exclusive);
+	tcase_add_test(tc, test_ble_midi_encode_running_status);
+	tcase_add_test(tc, test_ble_midi_encode_running_status_with_common);
+	tcase_add_test(tc, test_ble_midi_encode_running_status_new_packet);
+	tcase_add_test(tc, test_ble_midi_encode_packing);
+
+	tcase_add_test(tc, test_ble_midi_clock);
+	tcase_add_test(tc, test_ble_midi_clock_reset);
 
 	srunner_run_all(sr, CK_ENV);
 	int nf = srunner_ntests_failed(sr);
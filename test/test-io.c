@@ -12,14 +12,17 @@
 # include <config.h>
 # define ENABLE_APTX_IO_TEST    (ENABLE_APTX && HAVE_APTX_DECODE)
 # define ENABLE_APTX_HD_IO_TEST (ENABLE_APTX_HD && HAVE_APTX_HD_DECODE)
+# define ENABLE_APTX_LL_IO_TEST (ENABLE_APTX_LL && HAVE_APTX_DECODE)
 # define ENABLE_LDAC_IO_TEST    (ENABLE_LDAC && HAVE_LDAC_DECODE)
 #endif
 
 #include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <math.h>
 #include <poll.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -28,6 +31,7 @@
 #include <strings.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <bluetooth/bluetooth.h>
@@ -45,6 +49,9 @@
 #endif
 
 #include "a2dp.h"
+#if ENABLE_CODEC_MODULES
+# include "a2dp-module.h"
+#endif
 #if ENABLE_AAC
 # include "a2dp-aac.h"
 #endif
@@ -54,6 +61,12 @@
 #if ENABLE_APTX_HD_IO_TEST
 # include "a2dp-aptx-hd.h"
 #endif
+#if ENABLE_APTX_LL_IO_TEST
+# include "a2dp-aptx-ll.h"
+#endif
+#if ENABLE_MSBC
+# include "a2dp-voice.h"
+#endif
 #if ENABLE_FASTSTREAM
 # include "a2dp-faststream.h"
 #endif
@@ -73,28 +86,34 @@
 # include "a2dp-opus.h"
 #endif
 #include "a2dp-sbc.h"
+#include "audio.h"
 #include "ba-adapter.h"
+#include "ba-broadcast.h"
 #include "ba-config.h"
 #include "ba-device.h"
+#include "ba-mix.h"
 #include "ba-rfcomm.h"
 #include "ba-transport.h"
 #include "ba-transport-pcm.h"
 #include "ble-midi.h"
 #include "bluealsa-dbus.h"
 #include "bluez.h"
+#if ENABLE_APTX_IO_TEST || ENABLE_APTX_HD_IO_TEST
+# include "codec-aptx.h"
+#endif
+#include "codec-sbc.h"
 #include "hfp.h"
 #include "io.h"
 #include "midi.h"
 #if ENABLE_OFONO
 # include "ofono.h"
 #endif
-#if ENABLE_LC3PLUS || ENABLE_LDAC_IO_TEST
-# include "rtp.h"
-#endif
+#include "rtp.h"
 #include "storage.h"
 #include "shared/a2dp-codecs.h"
 #include "shared/defs.h"
 #include "shared/log.h"
+#include "shared/rt.h"
 
 #include "../src/a2dp.c"
 #include "../src/ba-transport.c"
@@ -113,6 +132,8 @@ void *a2dp_aptx_dec_thread(struct ba_transport_pcm *t_pcm);
 void *a2dp_aptx_enc_thread(struct ba_transport_pcm *t_pcm);
 void *a2dp_aptx_hd_dec_thread(struct ba_transport_pcm *t_pcm);
 void *a2dp_aptx_hd_enc_thread(struct ba_transport_pcm *t_pcm);
+void *a2dp_aptx_ll_dec_thread(struct ba_transport_pcm *t_pcm);
+void *a2dp_aptx_ll_enc_thread(struct ba_transport_pcm *t_pcm);
 void *a2dp_fs_dec_thread(struct ba_transport_pcm *t_pcm);
 void *a2dp_fs_enc_thread(struct ba_transport_pcm *t_pcm);
 void *a2dp_lc3plus_dec_thread(struct ba_transport_pcm *t_pcm);
@@ -136,6 +157,8 @@ void bluealsa_dbus_pcm_update(struct ba_transport_pcm *pcm, unsigned int mask) {
 	debug("%s: %p %#x", __func__, (void *)pcm, mask); (void)pcm; (void)mask; }
 void bluealsa_dbus_pcm_unregister(struct ba_transport_pcm *pcm) {
 	debug("%s: %p", __func__, (void *)pcm); (void)pcm; }
+void bluealsa_dbus_mix_update(struct ba_mix *mix, unsigned int mask) {
+	debug("%s: %p %#x", __func__, (void *)mix, mask); (void)mix; (void)mask; }
 struct ba_rfcomm *ba_rfcomm_new(struct ba_transport *sco, int fd) {
 	debug("%s: %p", __func__, (void *)sco); (void)sco; (void)fd; return NULL; }
 void ba_rfcomm_destroy(struct ba_rfcomm *r) {
@@ -199,6 +222,16 @@ static const a2dp_aptx_hd_t config_aptx_hd_44100_stereo = {
 	.aptx.channel_mode = APTX_CHANNEL_MODE_STEREO,
 };
 
+__attribute__ ((unused))
+static const a2dp_aptx_ll_t config_aptx_ll_44100_stereo = {
+	.aptx.info = A2DP_VENDOR_INFO_INIT(APTX_LL_VENDOR_ID, APTX_LL_CODEC_ID),
+	.aptx.sampling_freq = APTX_SAMPLING_FREQ_44100,
+	.aptx.channel_mode = APTX_CHANNEL_MODE_STEREO,
+#if ENABLE_MSBC
+	.bidirect_link = 1,
+#endif
+};
+
 __attribute__ ((unused))
 static const a2dp_faststream_t config_faststream_44100_16000 = {
 	.info = A2DP_VENDOR_INFO_INIT(FASTSTREAM_VENDOR_ID, FASTSTREAM_CODEC_ID),
@@ -215,6 +248,14 @@ static const a2dp_lc3plus_t config_lc3plus_48000_stereo = {
 	A2DP_LC3PLUS_INIT_SAMPLING_FREQ(LC3PLUS_SAMPLING_FREQ_48000)
 };
 
+__attribute__ ((unused))
+static const a2dp_lc3plus_t config_lc3plus_96000_stereo_ll = {
+	.info = A2DP_VENDOR_INFO_INIT(LC3PLUS_VENDOR_ID, LC3PLUS_CODEC_ID),
+	.frame_duration = LC3PLUS_FRAME_DURATION_025,
+	.channel_mode = LC3PLUS_CHANNEL_MODE_STEREO,
+	A2DP_LC3PLUS_INIT_SAMPLING_FREQ(LC3PLUS_SAMPLING_FREQ_96000)
+};
+
 __attribute__ ((unused))
 static const a2dp_ldac_t config_ldac_48000_stereo = {
 	.info = A2DP_VENDOR_INFO_INIT(LDAC_VENDOR_ID, LDAC_CODEC_ID),
@@ -236,6 +277,21 @@ static const a2dp_opus_t config_opus_48000_stereo = {
 	.channel_mode = OPUS_CHANNEL_MODE_STEREO,
 };
 
+__attribute__ ((unused))
+static const a2dp_opus_pw_t config_opus_pw_48000_5_1 = {
+	.info = A2DP_VENDOR_INFO_INIT(OPUS_PW_VENDOR_ID, OPUS_PW_CODEC_ID),
+	.music = {
+		.channels = 6,
+		.coupled_streams = 2,
+		A2DP_OPUS_PW_INIT_LOCATION(
+			OPUS_PW_LOCATION_FL | OPUS_PW_LOCATION_FR |
+			OPUS_PW_LOCATION_FC | OPUS_PW_LOCATION_LFE |
+			OPUS_PW_LOCATION_BL | OPUS_PW_LOCATION_BR)
+		.frame_duration = OPUS_PW_FRAME_DURATION_100,
+		A2DP_OPUS_PW_INIT_BITRATE(400)
+	},
+};
+
 static struct ba_adapter *adapter = NULL;
 static struct ba_device *device1 = NULL;
 static struct ba_device *device2 = NULL;
@@ -245,6 +301,12 @@ static unsigned int aging_duration = 0;
 static bool enable_vbr_mode = false;
 static bool dump_data = false;
 static bool packet_loss = false;
+/* drop every N-th BT packet, if not zero */
+static unsigned int packet_loss_period = 0;
+/* write silence instead of the sine wave */
+static bool pcm_silence = false;
+/* capture buffer for decoded PCM data, if not NULL */
+static GByteArray *pcm_capture = NULL;
 
 /* input BT dump file */
 static struct bt_dump *btdin = NULL;
@@ -439,6 +501,9 @@ static void pcm_write_frames(struct ba_transport_pcm *pcm, size_t frames) {
 			break;
 		}
 
+		if (pcm_silence)
+			memset(buffer, 0, x_bytes);
+
 		ck_assert_int_eq(write(pcm->fd, buffer, x_bytes), x_bytes);
 
 #if HAVE_SNDFILE
@@ -487,6 +552,26 @@ static void bt_data_push(uint8_t *data, size_t len) {
 	bt_data_end = bt_data_end->next;
 }
 
+/**
+ * Get the total size of generated BT data. */
+static size_t bt_data_size(void) {
+	size_t size = 0;
+	for (struct bt_data *data = &bt_data; data != bt_data_end; data = data->next)
+		size += data->len;
+	return size;
+}
+
+/**
+ * Check whether BT packet shall be dropped to simulate packet loss. */
+static bool bt_data_drop_packet(bool first_packet) {
+	static unsigned int counter = 0;
+	if (first_packet)
+		return counter = 0, false;
+	if (packet_loss_period > 0)
+		return ++counter % packet_loss_period == 0;
+	return packet_loss && random() < INT32_MAX / 3;
+}
+
 static void bt_data_write(struct ba_transport *t) {
 
 	struct pollfd fds[] = {{ t->bt_fd, POLLOUT, 0 }};
@@ -498,7 +583,7 @@ static void bt_data_write(struct ba_transport *t) {
 	if (input_bt_file != NULL) {
 
 		while ((len = bt_dump_read(btdin, buffer, sizeof(buffer))) != -1) {
-			if (packet_loss && random() < INT32_MAX / 3 && !first_packet) {
+			if (bt_data_drop_packet(first_packet)) {
 				debug("Simulating packet loss: Dropping BT packet!");
 				continue;
 			}
@@ -517,7 +602,7 @@ static void bt_data_write(struct ba_transport *t) {
 
 		for (; bt_data_head != bt_data_end; bt_data_head = bt_data_head->next) {
 			len = bt_data_head->len;
-			if (packet_loss && random() < INT32_MAX / 3 && !first_packet) {
+			if (bt_data_drop_packet(first_packet)) {
 				debug("Simulating packet loss: Dropping BT packet!");
 				continue;
 			}
@@ -639,6 +724,9 @@ static void *test_io_thread_dump_pcm(struct ba_transport_pcm *t_pcm) {
 		debug("Decoded samples: %zd", samples);
 		decoded_samples_total += samples;
 
+		if (pcm_capture != NULL)
+			g_byte_array_append(pcm_capture, buffer, len);
+
 #if HAVE_SNDFILE
 		if (sf != NULL)
 			sf_write_format(sf, buffer, samples, t_pcm->format);
@@ -796,6 +884,114 @@ CK_START_TEST(test_a2dp_sbc) {
 
 } CK_END_TEST
 
+CK_START_TEST(test_a2dp_sbc_dynamic_bitpool) {
+
+	if (aging_duration || input_bt_file != NULL || input_pcm_file != NULL)
+		return;
+
+	sbc_t sbc;
+	ck_assert_int_eq(sbc_init_a2dp(&sbc, 0, &config_sbc_44100_stereo,
+				sizeof(config_sbc_44100_stereo)), 0);
+	const size_t frame_samples = sbc_get_codesize(&sbc) / sizeof(int16_t) / 2;
+
+	const size_t mtu = 679;
+	const size_t rtp_headers_len = RTP_HEADER_LEN + sizeof(rtp_media_header_t);
+	const uint8_t bitpool_max = sbc_a2dp_get_bitpool(&config_sbc_44100_stereo, SBC_QUALITY_HIGH);
+	const unsigned int rates[] = { 150000, 250000, 1000000 };
+
+	for (size_t i = 0; i < ARRAYSIZE(rates); i++) {
+
+		struct sbc_bitpool_ctrl ctrl;
+		sbc_bitpool_ctrl_init(&ctrl, config_sbc_44100_stereo.min_bitpool, bitpool_max, 40);
+
+		sbc.bitpool = ctrl.max;
+		const unsigned int max_bitrate = 8 * sbc_get_frame_length(&sbc) * 44100 / frame_samples;
+
+		/* Simulate BT link with a constant throughput, which is drained
+		 * in the same pace as the encoder produces RTP packets. */
+		double time = 0, queue = 0, queue_max = 0;
+		size_t sent = 0;
+
+		while (time < 10.0) {
+
+			sbc.bitpool = ctrl.bitpool;
+			const size_t frames = a2dp_sbc_get_packet_frames(&sbc, ctrl.bitpool,
+					mtu - rtp_headers_len);
+			const size_t packet_len = rtp_headers_len + frames * sbc_get_frame_length(&sbc);
+			const double duration = (double)frames * frame_samples / 44100;
+			ck_assert_uint_le(packet_len, mtu);
+
+			sbc_bitpool_ctrl_update(&ctrl, (unsigned int)(queue / mtu));
+
+			queue += packet_len;
+			queue = MAX(queue - duration * rates[i] / 8, 0);
+			time += duration;
+
+			/* skip the initial congestion */
+			if (time > 3.0) {
+				queue_max = MAX(queue_max, queue);
+				sent += packet_len;
+			}
+
+		}
+
+		const unsigned int bitrate = 8 * sent / 7;
+		debug("Link: %u bps: SBC bit-pool: %u: Bitrate: %u bps: Max queue: %.1f",
+				rates[i], ctrl.bitpool, bitrate, queue_max / mtu);
+
+		ck_assert_double_le(queue_max / mtu, 2 * SBC_BITPOOL_CTRL_CONGESTION);
+		ck_assert_uint_ge(bitrate, 7 * MIN(rates[i], max_bitrate) / 10);
+		if (rates[i] > max_bitrate)
+			ck_assert_uint_eq(ctrl.bitpool, ctrl.max);
+
+	}
+
+	const bool sbc_dynamic_bitpool = config.sbc_dynamic_bitpool;
+	const uint8_t sbc_quality = config.sbc_quality;
+	config.sbc_dynamic_bitpool = true;
+	config.sbc_quality = SBC_QUALITY_HIGH;
+
+	struct ba_transport *t1 = test_transport_new_a2dp(device1,
+			BA_TRANSPORT_PROFILE_A2DP_SOURCE, "/path/sbc", &a2dp_sbc_source,
+			&config_sbc_44100_stereo);
+	struct ba_transport *t2 = test_transport_new_a2dp(device2,
+			BA_TRANSPORT_PROFILE_A2DP_SINK, "/path/sbc", &a2dp_sbc_sink,
+			&config_sbc_44100_stereo);
+
+	struct ba_transport_pcm *t1_pcm = &t1->media.pcm;
+	struct ba_transport_pcm *t2_pcm = &t2->media.pcm;
+
+	t1->mtu_read = t1->mtu_write = t2->mtu_read = t2->mtu_write = mtu;
+	test_io(t1_pcm, t2_pcm, a2dp_sbc_enc_thread, test_io_thread_dump_bt, 2 * 1024);
+
+	/* Every RTP packet produced by the encoder shall carry the number
+	 * of SBC frames which fills the MTU for the current bit-pool. */
+	size_t packets = 0;
+	for (struct bt_data *data = &bt_data; data != bt_data_end; data = data->next) {
+		const rtp_media_header_t *rtp_media_header =
+			rtp_a2dp_get_payload((const rtp_header_t *)data->data);
+		/* bit-pool is stored in the third byte of the SBC frame header */
+		const uint8_t bitpool = ((const uint8_t *)(rtp_media_header + 1))[2];
+		ck_assert_uint_ge(bitpool, config_sbc_44100_stereo.min_bitpool);
+		ck_assert_uint_le(bitpool, bitpool_max);
+		ck_assert_uint_eq(rtp_media_header->frame_count,
+				a2dp_sbc_get_packet_frames(&sbc, bitpool, mtu - rtp_headers_len));
+		ck_assert_uint_le(data->len, mtu);
+		packets++;
+	}
+
+	ck_assert_uint_gt(packets, 0);
+
+	config.sbc_dynamic_bitpool = sbc_dynamic_bitpool;
+	config.sbc_quality = sbc_quality;
+
+	ba_transport_destroy(t1);
+	ba_transport_destroy(t2);
+
+	sbc_finish(&sbc);
+
+} CK_END_TEST
+
 CK_START_TEST(test_a2dp_sbc_invalid_config) {
 
 	const a2dp_sbc_t config_sbc_invalid = {
@@ -1029,6 +1225,416 @@ CK_START_TEST(test_a2dp_sbc_pcm_drop) {
 
 } CK_END_TEST
 
+CK_START_TEST(test_a2dp_sbc_broadcast) {
+
+	int16_t pcm_zero[90] = { 0 };
+
+	struct ba_transport *t1 = test_transport_new_a2dp(device1,
+			BA_TRANSPORT_PROFILE_A2DP_SOURCE, "/path/sbc", &a2dp_sbc_source,
+			&config_sbc_44100_stereo);
+	struct ba_transport *t2 = test_transport_new_a2dp(device2,
+			BA_TRANSPORT_PROFILE_A2DP_SOURCE, "/path/sbc", &a2dp_sbc_source,
+			&config_sbc_44100_stereo);
+	struct ba_transport *t1_snk = test_transport_new_a2dp(device2,
+			BA_TRANSPORT_PROFILE_A2DP_SINK, "/path/sbc/1", &a2dp_sbc_sink,
+			&config_sbc_44100_stereo);
+	struct ba_transport *t2_snk = test_transport_new_a2dp(device1,
+			BA_TRANSPORT_PROFILE_A2DP_SINK, "/path/sbc/2", &a2dp_sbc_sink,
+			&config_sbc_44100_stereo);
+
+	int fd_pcm_snk = -1, fd_pcm_src = -1;
+	setup_a2dp_link(t1, t1_snk, 256, &fd_pcm_snk, &fd_pcm_src);
+	close(fd_pcm_src);
+
+	int fd_pcm_snk2 = -1, fd_pcm_src2 = -1;
+	setup_a2dp_link(t2, t2_snk, 256, &fd_pcm_snk2, &fd_pcm_src2);
+	close(fd_pcm_snk2);
+	close(fd_pcm_src2);
+	/* the second source PCM shall be fed by the broadcast group */
+	close(t2->media.pcm.fd);
+	t2->media.pcm.fd = -1;
+
+	struct ba_transport_pcm *pcm1 = &t1->media.pcm;
+	struct ba_transport_pcm *pcm2 = &t2->media.pcm;
+
+	struct ba_broadcast *bc;
+	ck_assert_ptr_nonnull(bc = ba_broadcast_new(pcm1));
+	pcm1->broadcast = bc;
+	/* broadcast group leader can not be its own member */
+	ck_assert_int_eq(ba_broadcast_set_members(bc, &pcm1, 1), -1);
+	ck_assert_int_eq(ba_broadcast_set_members(bc, &pcm2, 1), 0);
+
+	ck_assert_int_eq(ba_transport_pcm_start(pcm1, a2dp_sbc_enc_thread, "sbc"), 0);
+	ck_assert_int_eq(ba_transport_pcm_start(pcm2, a2dp_sbc_enc_thread, "sbc"), 0);
+	ck_assert_int_eq(ba_transport_pcm_state_wait_running(pcm1), 0);
+	ck_assert_int_eq(ba_transport_pcm_state_wait_running(pcm2), 0);
+
+	ck_assert_int_eq(ba_broadcast_open(bc), 0);
+	/* identical configurations shall share single encoder */
+	ck_assert_uint_eq(bc->streams_len, 1);
+	/* members can not be changed while the group is open */
+	ck_assert_int_eq(ba_broadcast_set_members(bc, NULL, 0), -1);
+
+	for (size_t i = 0; i < 20; i++)
+		if (write(fd_pcm_snk, pcm_zero, sizeof(pcm_zero)) <= 0)
+			break;
+	usleep(100000);
+
+	uint8_t bt_buffer1[1024];
+	uint8_t bt_buffer2[1024];
+	ssize_t len1, len2;
+
+	/* both sinks shall receive the very same RTP packets */
+	ck_assert_int_gt(len1 = read(t1_snk->bt_fd, bt_buffer1, sizeof(bt_buffer1)), 0);
+	ck_assert_int_eq(len2 = read(t2_snk->bt_fd, bt_buffer2, sizeof(bt_buffer2)), len1);
+	ck_assert_mem_eq(bt_buffer1, bt_buffer2, len1);
+
+	ba_transport_destroy(t1);
+	ck_assert_ptr_null(pcm2->broadcast);
+	ba_transport_destroy(t2);
+	ba_transport_destroy(t1_snk);
+	ba_transport_destroy(t2_snk);
+	close(fd_pcm_snk);
+
+} CK_END_TEST
+
+CK_START_TEST(test_a2dp_sbc_broadcast_delay) {
+
+	int16_t pcm_zero[90] = { 0 };
+
+	struct ba_transport *t1 = test_transport_new_a2dp(device1,
+			BA_TRANSPORT_PROFILE_A2DP_SOURCE, "/path/sbc", &a2dp_sbc_source,
+			&config_sbc_44100_stereo);
+	struct ba_transport *t2 = test_transport_new_a2dp(device2,
+			BA_TRANSPORT_PROFILE_A2DP_SOURCE, "/path/sbc", &a2dp_sbc_source,
+			&config_sbc_44100_stereo);
+	struct ba_transport *t1_snk = test_transport_new_a2dp(device2,
+			BA_TRANSPORT_PROFILE_A2DP_SINK, "/path/sbc/1", &a2dp_sbc_sink,
+			&config_sbc_44100_stereo);
+	struct ba_transport *t2_snk = test_transport_new_a2dp(device1,
+			BA_TRANSPORT_PROFILE_A2DP_SINK, "/path/sbc/2", &a2dp_sbc_sink,
+			&config_sbc_44100_stereo);
+
+	int fd_pcm_snk = -1, fd_pcm_src = -1;
+	setup_a2dp_link(t1, t1_snk, 256, &fd_pcm_snk, &fd_pcm_src);
+	close(fd_pcm_src);
+
+	int fd_pcm_snk2 = -1, fd_pcm_src2 = -1;
+	setup_a2dp_link(t2, t2_snk, 256, &fd_pcm_snk2, &fd_pcm_src2);
+	close(fd_pcm_snk2);
+	close(fd_pcm_src2);
+	close(t2->media.pcm.fd);
+	t2->media.pcm.fd = -1;
+
+	/* the leader sink is 500 ms faster than the member one */
+	t2->media.delay = 5000;
+
+	struct ba_transport_pcm *pcm1 = &t1->media.pcm;
+	struct ba_transport_pcm *pcm2 = &t2->media.pcm;
+
+	struct ba_broadcast *bc;
+	ck_assert_ptr_nonnull(bc = ba_broadcast_new(pcm1));
+	pcm1->broadcast = bc;
+	ck_assert_int_eq(ba_broadcast_set_members(bc, &pcm2, 1), 0);
+
+	ck_assert_int_eq(ba_transport_pcm_start(pcm1, a2dp_sbc_enc_thread, "sbc"), 0);
+	ck_assert_int_eq(ba_transport_pcm_start(pcm2, a2dp_sbc_enc_thread, "sbc"), 0);
+	ck_assert_int_eq(ba_transport_pcm_state_wait_running(pcm1), 0);
+	ck_assert_int_eq(ba_transport_pcm_state_wait_running(pcm2), 0);
+
+	ck_assert_int_eq(ba_broadcast_open(bc), 0);
+	ck_assert_uint_ge(ba_broadcast_get_delay(bc), 5000);
+
+	for (size_t i = 0; i < 20; i++)
+		if (write(fd_pcm_snk, pcm_zero, sizeof(pcm_zero)) <= 0)
+			break;
+	usleep(100000);
+
+	struct pollfd pfds[] = {
+		{ t1_snk->bt_fd, POLLIN, 0 },
+		{ t2_snk->bt_fd, POLLIN, 0 }};
+
+	/* audio for the leader sink shall be held back */
+	ck_assert_int_eq(poll(pfds, ARRAYSIZE(pfds), 0), 1);
+	ck_assert_int_eq(pfds[0].revents, 0);
+	ck_assert_int_eq(pfds[1].revents, POLLIN);
+
+	/* closing the group shall not discard held back audio */
+	ba_broadcast_close(bc);
+	ck_assert_int_eq(poll(pfds, 1, 0), 1);
+
+	uint8_t bt_buffer1[1024];
+	uint8_t bt_buffer2[1024];
+	ssize_t len1, len2;
+
+	ck_assert_int_gt(len1 = read(t1_snk->bt_fd, bt_buffer1, sizeof(bt_buffer1)), 0);
+	ck_assert_int_eq(len2 = read(t2_snk->bt_fd, bt_buffer2, sizeof(bt_buffer2)), len1);
+	ck_assert_mem_eq(bt_buffer1, bt_buffer2, len1);
+
+	ba_transport_destroy(t1);
+	ba_transport_destroy(t2);
+	ba_transport_destroy(t1_snk);
+	ba_transport_destroy(t2_snk);
+	close(fd_pcm_snk);
+
+} CK_END_TEST
+
+CK_START_TEST(test_a2dp_sbc_broadcast_stalled) {
+
+	int16_t pcm_zero[90] = { 0 };
+
+	struct ba_transport *t1 = test_transport_new_a2dp(device1,
+			BA_TRANSPORT_PROFILE_A2DP_SOURCE, "/path/sbc", &a2dp_sbc_source,
+			&config_sbc_44100_stereo);
+	struct ba_transport *t2 = test_transport_new_a2dp(device2,
+			BA_TRANSPORT_PROFILE_A2DP_SOURCE, "/path/sbc", &a2dp_sbc_source,
+			&config_sbc_44100_stereo);
+	struct ba_transport *t1_snk = test_transport_new_a2dp(device2,
+			BA_TRANSPORT_PROFILE_A2DP_SINK, "/path/sbc/1", &a2dp_sbc_sink,
+			&config_sbc_44100_stereo);
+	struct ba_transport *t2_snk = test_transport_new_a2dp(device1,
+			BA_TRANSPORT_PROFILE_A2DP_SINK, "/path/sbc/2", &a2dp_sbc_sink,
+			&config_sbc_44100_stereo);
+
+	int fd_pcm_snk = -1, fd_pcm_src = -1;
+	setup_a2dp_link(t1, t1_snk, 256, &fd_pcm_snk, &fd_pcm_src);
+	close(fd_pcm_src);
+
+	int fd_pcm_snk2 = -1, fd_pcm_src2 = -1;
+	setup_a2dp_link(t2, t2_snk, 256, &fd_pcm_snk2, &fd_pcm_src2);
+	close(fd_pcm_snk2);
+	close(fd_pcm_src2);
+	close(t2->media.pcm.fd);
+	t2->media.pcm.fd = -1;
+
+	/* the leader sink holds audio back, while the member
+	 * sink (which is never read) stalls right away */
+	t2->media.delay = 20000;
+
+	struct ba_transport_pcm *pcm1 = &t1->media.pcm;
+	struct ba_transport_pcm *pcm2 = &t2->media.pcm;
+
+	struct ba_broadcast *bc;
+	ck_assert_ptr_nonnull(bc = ba_broadcast_new(pcm1));
+	pcm1->broadcast = bc;
+	ck_assert_int_eq(ba_broadcast_set_members(bc, &pcm2, 1), 0);
+
+	ck_assert_int_eq(ba_transport_pcm_start(pcm1, a2dp_sbc_enc_thread, "sbc"), 0);
+	ck_assert_int_eq(ba_transport_pcm_start(pcm2, a2dp_sbc_enc_thread, "sbc"), 0);
+	ck_assert_int_eq(ba_transport_pcm_state_wait_running(pcm1), 0);
+	ck_assert_int_eq(ba_transport_pcm_state_wait_running(pcm2), 0);
+	ck_assert_int_eq(ba_broadcast_open(bc), 0);
+
+	/* 300 ms of audio, which is more than the stalled socket can hold */
+	for (size_t i = 0; i < 147; i++)
+		if (write(fd_pcm_snk, pcm_zero, sizeof(pcm_zero)) <= 0)
+			break;
+	usleep(600000);
+
+	int nread;
+	/* the encoder shall not be blocked by the stalled sink for good */
+	ck_assert_int_eq(ioctl(fd_pcm_snk, FIONREAD, &nread), 0);
+	ck_assert_int_eq(nread, 0);
+
+	/* audio for the leader sink shall be still held back */
+	struct pollfd pfd = { t1_snk->bt_fd, POLLIN, 0 };
+	ck_assert_int_eq(poll(&pfd, 1, 0), 0);
+
+	struct timespec ts_begin, ts_end, ts_diff;
+	gettimestamp(&ts_begin);
+	ba_broadcast_close(bc);
+	gettimestamp(&ts_end);
+	timespecsub(&ts_end, &ts_begin, &ts_diff);
+
+	/* Waiting for stalled sinks is bounded for the whole group. */
+	ck_assert_int_lt(timespec2ms(&ts_diff), 150);
+	ck_assert_int_eq(poll(&pfd, 1, 0), 1);
+
+	ba_transport_destroy(t1);
+	ba_transport_destroy(t2);
+	ba_transport_destroy(t1_snk);
+	ba_transport_destroy(t2_snk);
+	close(fd_pcm_snk);
+
+} CK_END_TEST
+
+CK_START_TEST(test_a2dp_sink_mix) {
+
+	struct ba_transport *t1 = test_transport_new_a2dp(device1,
+			BA_TRANSPORT_PROFILE_A2DP_SINK, "/path/sbc/1", &a2dp_sbc_sink,
+			&config_sbc_44100_stereo);
+	struct ba_transport *t2 = test_transport_new_a2dp(device2,
+			BA_TRANSPORT_PROFILE_A2DP_SINK, "/path/sbc/2", &a2dp_sbc_sink,
+			&config_sbc_44100_stereo);
+
+	struct ba_transport_pcm *pcm1 = &t1->media.pcm;
+	struct ba_transport_pcm *pcm2 = &t2->media.pcm;
+	pcm2->codec_delay_dms = 100;
+
+	struct ba_mix *mix;
+	ck_assert_ptr_nonnull(mix = ba_mix_new(48000, 600));
+	ck_assert_uint_eq(mix->period, 480);
+
+	int16_t pcm_1000[441 * 6 * 2];
+	int16_t pcm_2000[441 * 6 * 2];
+	for (size_t i = 0; i < ARRAYSIZE(pcm_1000); i++) {
+		pcm_1000[i] = 1000;
+		pcm_2000[i] = 2000;
+	}
+
+	int16_t buffer[480 * 2];
+
+	/* audio shall be discarded if the mix is not opened */
+	ck_assert_int_eq(ba_mix_pcm_write(mix, pcm1, pcm_1000, ARRAYSIZE(pcm_1000)), ARRAYSIZE(pcm_1000));
+	ck_assert_uint_eq(mix->sources_len, 0);
+
+	/* simulate opened mix without the mixer thread */
+	mix->running = true;
+
+	ck_assert_int_eq(ba_mix_pcm_write(mix, pcm1, pcm_1000, ARRAYSIZE(pcm_1000)), ARRAYSIZE(pcm_1000));
+	ck_assert_uint_eq(mix->sources_len, 1);
+
+	/* single source shall be resampled and mixed without ducking */
+	ba_mix_process(mix, buffer, 480);
+	ck_assert_int_eq(buffer[0], 0);
+	for (size_t i = 2; i < ARRAYSIZE(buffer); i++)
+		ck_assert_int_eq(buffer[i], 1000);
+
+	/* the second source shall be in the foreground */
+	ck_assert_int_eq(ba_mix_pcm_write(mix, pcm2, pcm_2000, ARRAYSIZE(pcm_2000)), ARRAYSIZE(pcm_2000));
+	ck_assert_uint_eq(mix->sources_len, 2);
+
+	/* the first call ramps the gain of the background source */
+	ba_mix_process(mix, buffer, 480);
+	ba_mix_process(mix, buffer, 480);
+	for (size_t i = 2; i < ARRAYSIZE(buffer); i++)
+		ck_assert_int_le(abs(buffer[i] - (2000 + 501)), 1);
+
+	/* mix delay shall include the largest source delay */
+	ck_assert_uint_eq(ba_mix_get_delay(mix), 100 + 300);
+
+	/* per-source gain shall be applied on top of ducking */
+	pcm1->mix_gain = -600;
+	ba_mix_process(mix, buffer, 480);
+	ba_mix_process(mix, buffer, 480);
+	for (size_t i = 2; i < ARRAYSIZE(buffer); i++)
+		ck_assert_int_le(abs(buffer[i] - (2000 + 251)), 1);
+
+	ba_mix_pcm_remove(mix, pcm1);
+	ck_assert_uint_eq(mix->sources_len, 1);
+	ck_assert_ptr_eq(mix->sources[0].pcm, pcm2);
+
+	mix->running = false;
+	ba_mix_free(mix);
+
+	ba_transport_destroy(t1);
+	ba_transport_destroy(t2);
+
+} CK_END_TEST
+
+CK_START_TEST(test_a2dp_sink_pcm_write_splice) {
+
+	struct ba_transport *t = test_transport_new_a2dp(device1,
+			BA_TRANSPORT_PROFILE_A2DP_SINK, "/path/sbc", &a2dp_sbc_sink,
+			&config_sbc_44100_stereo);
+	struct ba_transport_pcm *pcm = &t->media.pcm;
+
+	int fds[2];
+	ck_assert_int_eq(pipe2(fds, O_NONBLOCK), 0);
+	pcm->fd = fds[1];
+
+	/* attenuate left channel, so the PCM signal has to be scaled */
+	const int level = -600;
+	pcm->soft_volume = true;
+	ba_transport_pcm_volume_set(&pcm->volume[0], &level, NULL, NULL);
+	const double scales[] = { pcm->volume[0].scale, pcm->volume[1].scale };
+
+	int16_t chunk[512 * 2];
+	int16_t expected[ARRAYSIZE(chunk)];
+	int16_t buffer[ARRAYSIZE(chunk)];
+	const size_t chunks = 12;
+
+	/* Write more data than the sink ring can hold, so the ring will wrap
+	 * around. Audio queued in the PCM FIFO shall not be overwritten. */
+	for (size_t round = 0; round < 4; round++) {
+
+		for (size_t n = 0; n < chunks; n++) {
+			for (size_t i = 0; i < ARRAYSIZE(chunk); i++)
+				chunk[i] = round * 1000 + n * 10 + i % 7;
+			ck_assert_int_eq(io_pcm_write(pcm, chunk, ARRAYSIZE(chunk)), ARRAYSIZE(chunk));
+		}
+
+		for (size_t n = 0; n < chunks; n++) {
+			for (size_t i = 0; i < ARRAYSIZE(expected); i++)
+				expected[i] = round * 1000 + n * 10 + i % 7;
+			audio_scale_s16_2le(expected, scales, 2, ARRAYSIZE(expected) / 2);
+			ck_assert_int_eq(read(fds[0], buffer, sizeof(buffer)), sizeof(buffer));
+			ck_assert_mem_eq(buffer, expected, sizeof(expected));
+		}
+
+	}
+
+	/* scaled audio shall be spliced from the sink ring */
+	ck_assert_ptr_nonnull(pcm->sink_ring);
+	ck_assert_uint_gt(pcm->sink_ring_size, chunks * sizeof(chunk));
+
+	pthread_mutex_lock(&pcm->mutex);
+	ba_transport_pcm_release(pcm);
+	pthread_mutex_unlock(&pcm->mutex);
+	ck_assert_ptr_null(pcm->sink_ring);
+
+	close(fds[0]);
+	ba_transport_destroy(t);
+
+} CK_END_TEST
+
+#if ENABLE_CODEC_MODULES
+CK_START_TEST(test_a2dp_codec_module) {
+
+	const struct bluealsa_codec_module *module;
+	ck_assert_ptr_null(a2dp_module_load("/nonexistent/libcodec.so"));
+	ck_assert_ptr_nonnull(module = a2dp_module_load(TEST_CODEC_MODULE));
+	ck_assert_uint_eq(module->abi_version, BLUEALSA_CODEC_ABI_VERSION);
+	ck_assert_uint_eq(module->codec_id, A2DP_CODEC_SBC);
+
+	struct a2dp_sep sep_source = a2dp_sbc_source;
+	struct a2dp_sep sep_sink = a2dp_sbc_sink;
+	ck_assert_int_eq(a2dp_module_attach(&sep_source, module), 0);
+	ck_assert_int_eq(a2dp_module_attach(&sep_sink, module), 0);
+	ck_assert_ptr_eq(sep_source.module, module);
+
+	/* module shall not be attached to SEP with different codec */
+	struct a2dp_sep sep_mpeg = a2dp_sbc_source;
+	sep_mpeg.config.codec_id = A2DP_CODEC_MPEG12;
+	ck_assert_int_eq(a2dp_module_attach(&sep_mpeg, module), -1);
+	ck_assert_int_eq(errno, EINVAL);
+
+	struct ba_transport *t1 = test_transport_new_a2dp(device1,
+			BA_TRANSPORT_PROFILE_A2DP_SOURCE, "/path/sbc", &sep_source,
+			&config_sbc_44100_stereo);
+	struct ba_transport *t2 = test_transport_new_a2dp(device2,
+			BA_TRANSPORT_PROFILE_A2DP_SINK, "/path/sbc", &sep_sink,
+			&config_sbc_44100_stereo);
+
+	struct ba_transport_pcm *t1_pcm = &t1->media.pcm;
+	struct ba_transport_pcm *t2_pcm = &t2->media.pcm;
+
+	/* room for two pass-through frames in a single RTP packet */
+	t1->mtu_read = t1->mtu_write = t2->mtu_read = t2->mtu_write = 13 + 2 * 64 * 2 * 2;
+	test_io(t1_pcm, t2_pcm, a2dp_module_enc_thread, test_io_thread_dump_bt, 2 * 1024);
+	test_io(t1_pcm, t2_pcm, test_io_thread_dump_pcm, a2dp_module_dec_thread, 2 * 1024);
+
+	/* codec delay shall be taken from the module */
+	ck_assert_uint_eq(t1_pcm->codec_delay_dms, 64 * 10000 / 44100);
+
+	ba_transport_destroy(t1);
+	ba_transport_destroy(t2);
+
+	a2dp_modules_unload();
+
+} CK_END_TEST
+#endif
+
 #if ENABLE_MP3LAME
 CK_START_TEST(test_a2dp_mp3) {
 
@@ -1174,6 +1780,204 @@ CK_START_TEST(test_a2dp_aptx) {
 } CK_END_TEST
 #endif
 
+#if ENABLE_APTX_IO_TEST || ENABLE_APTX_HD_IO_TEST
+/**
+ * Get CPU time used by the calling thread in seconds. */
+static double test_cpu_time(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+#endif
+
+#if ENABLE_APTX_IO_TEST
+CK_START_TEST(test_a2dp_aptx_batch) {
+
+	/* 10 seconds of 44.1 kHz stereo audio */
+	const size_t frames = 10 * 44100;
+	const size_t blocks = frames / 4;
+	/* MTU-sized output buffer */
+	const size_t batch_len = 660;
+
+	int16_t *pcm = malloc(frames * 2 * sizeof(*pcm));
+	int16_t *pcm_block = malloc((frames + 4) * 2 * sizeof(*pcm_block));
+	int16_t *pcm_batch = malloc((frames + 4) * 2 * sizeof(*pcm_batch));
+	uint8_t *code_block = malloc(blocks * 4);
+	uint8_t *code_batch = malloc(blocks * 4);
+	snd_pcm_sine_s16_2le(pcm, 2, frames, 1.0 / 128, 0);
+
+	HANDLE_APTX enc_block = aptxenc_init();
+	HANDLE_APTX enc_batch = aptxenc_init();
+	HANDLE_APTX dec_block = aptxdec_init();
+	HANDLE_APTX dec_batch = aptxdec_init();
+	ck_assert_ptr_ne(enc_block, NULL);
+	ck_assert_ptr_ne(enc_batch, NULL);
+	ck_assert_ptr_ne(dec_block, NULL);
+	ck_assert_ptr_ne(dec_batch, NULL);
+
+	/* Encode one apt-X block per call - the reference. */
+	double t0 = test_cpu_time();
+	for (size_t i = 0; i < blocks; i++) {
+		size_t len = 4;
+		ck_assert_int_eq(aptxenc_encode(enc_block, &pcm[i * 8], 8, &code_block[i * 4], &len), 8);
+		ck_assert_uint_eq(len, 4);
+	}
+	const double t_enc_block = test_cpu_time() - t0;
+
+	/* Encode as many blocks as fit into the MTU-sized buffer per call. */
+	t0 = test_cpu_time();
+	for (size_t i = 0, samples = 0; i < blocks * 4; ) {
+		size_t len = MIN(batch_len, blocks * 4 - i);
+		ssize_t rv = aptxenc_encode(enc_batch, &pcm[samples], blocks * 8 - samples, &code_batch[i], &len);
+		ck_assert_int_eq(rv, len / 4 * 8);
+		samples += rv;
+		i += len;
+	}
+	const double t_enc_batch = test_cpu_time() - t0;
+
+	/* Batching calls to the library shall not change its output. */
+	ck_assert_mem_eq(code_block, code_batch, blocks * 4);
+
+	t0 = test_cpu_time();
+	size_t decoded_block = 0;
+	for (size_t i = 0; i < blocks; i++) {
+		size_t samples = (frames + 4) * 2 - decoded_block;
+		ck_assert_int_eq(aptxdec_decode(dec_block, &code_block[i * 4], 4,
+					&pcm_block[decoded_block], &samples), 4);
+		decoded_block += samples;
+	}
+	const double t_dec_block = test_cpu_time() - t0;
+
+	t0 = test_cpu_time();
+	size_t decoded_batch = 0;
+	for (size_t i = 0; i < blocks * 4; ) {
+		size_t samples = (frames + 4) * 2 - decoded_batch;
+		const size_t len = MIN(batch_len, blocks * 4 - i);
+		ssize_t rv = aptxdec_decode(dec_batch, &code_batch[i], len,
+				&pcm_batch[decoded_batch], &samples);
+		ck_assert_int_gt(rv, 0);
+		decoded_batch += samples;
+		i += rv;
+	}
+	const double t_dec_batch = test_cpu_time() - t0;
+
+	/* The decoder might buffer the last block, depending on the input
+	 * chunking, so only the common part of the output is compared. */
+	const size_t decoded = MIN(decoded_batch, decoded_block);
+	ck_assert_uint_le(MAX(decoded_batch, decoded_block) - decoded, 8);
+	ck_assert_mem_eq(pcm_block, pcm_batch, decoded * sizeof(*pcm_block));
+
+	/* Report CPU usage per stream as a percentage of a single core. */
+	info("apt-X encoder CPU per stream: block: %.2f%%, batch: %.2f%%",
+			t_enc_block * 100 / 10, t_enc_batch * 100 / 10);
+	info("apt-X decoder CPU per stream: block: %.2f%%, batch: %.2f%%",
+			t_dec_block * 100 / 10, t_dec_batch * 100 / 10);
+
+	aptxenc_destroy(enc_block);
+	aptxenc_destroy(enc_batch);
+	aptxdec_destroy(dec_block);
+	aptxdec_destroy(dec_batch);
+	free(pcm);
+	free(pcm_block);
+	free(pcm_batch);
+	free(code_block);
+	free(code_batch);
+
+} CK_END_TEST
+#endif
+
+#if ENABLE_APTX_HD_IO_TEST
+CK_START_TEST(test_a2dp_aptx_hd_batch) {
+
+	/* 10 seconds of 48 kHz stereo audio */
+	const size_t frames = 10 * 48000;
+	const size_t blocks = frames / 4;
+	/* MTU-sized output buffer */
+	const size_t batch_len = 660;
+
+	int32_t *pcm = malloc(frames * 2 * sizeof(*pcm));
+	int32_t *pcm_block = malloc((frames + 4) * 2 * sizeof(*pcm_block));
+	int32_t *pcm_batch = malloc((frames + 4) * 2 * sizeof(*pcm_batch));
+	uint8_t *code_block = malloc(blocks * 6);
+	uint8_t *code_batch = malloc(blocks * 6);
+	snd_pcm_sine_s24_4le(pcm, 2, frames, 1.0 / 128, 0);
+
+	HANDLE_APTX enc_block = aptxhdenc_init();
+	HANDLE_APTX enc_batch = aptxhdenc_init();
+	HANDLE_APTX dec_block = aptxhddec_init();
+	HANDLE_APTX dec_batch = aptxhddec_init();
+	ck_assert_ptr_ne(enc_block, NULL);
+	ck_assert_ptr_ne(enc_batch, NULL);
+	ck_assert_ptr_ne(dec_block, NULL);
+	ck_assert_ptr_ne(dec_batch, NULL);
+
+	double t0 = test_cpu_time();
+	for (size_t i = 0; i < blocks; i++) {
+		size_t len = 6;
+		ck_assert_int_eq(aptxhdenc_encode(enc_block, &pcm[i * 8], 8, &code_block[i * 6], &len), 8);
+		ck_assert_uint_eq(len, 6);
+	}
+	const double t_enc_block = test_cpu_time() - t0;
+
+	t0 = test_cpu_time();
+	for (size_t i = 0, samples = 0; i < blocks * 6; ) {
+		size_t len = MIN(batch_len, blocks * 6 - i);
+		ssize_t rv = aptxhdenc_encode(enc_batch, &pcm[samples], blocks * 8 - samples, &code_batch[i], &len);
+		ck_assert_int_eq(rv, len / 6 * 8);
+		samples += rv;
+		i += len;
+	}
+	const double t_enc_batch = test_cpu_time() - t0;
+
+	ck_assert_mem_eq(code_block, code_batch, blocks * 6);
+
+	t0 = test_cpu_time();
+	size_t decoded_block = 0;
+	for (size_t i = 0; i < blocks; i++) {
+		size_t samples = (frames + 4) * 2 - decoded_block;
+		ck_assert_int_eq(aptxhddec_decode(dec_block, &code_block[i * 6], 6,
+					&pcm_block[decoded_block], &samples), 6);
+		decoded_block += samples;
+	}
+	const double t_dec_block = test_cpu_time() - t0;
+
+	t0 = test_cpu_time();
+	size_t decoded_batch = 0;
+	for (size_t i = 0; i < blocks * 6; ) {
+		size_t samples = (frames + 4) * 2 - decoded_batch;
+		const size_t len = MIN(batch_len, blocks * 6 - i);
+		ssize_t rv = aptxhddec_decode(dec_batch, &code_batch[i], len,
+				&pcm_batch[decoded_batch], &samples);
+		ck_assert_int_gt(rv, 0);
+		decoded_batch += samples;
+		i += rv;
+	}
+	const double t_dec_batch = test_cpu_time() - t0;
+
+	/* The decoder might buffer the last block, depending on the input
+	 * chunking, so only the common part of the output is compared. */
+	const size_t decoded = MIN(decoded_batch, decoded_block);
+	ck_assert_uint_le(MAX(decoded_batch, decoded_block) - decoded, 8);
+	ck_assert_mem_eq(pcm_block, pcm_batch, decoded * sizeof(*pcm_block));
+
+	info("apt-X HD encoder CPU per stream: block: %.2f%%, batch: %.2f%%",
+			t_enc_block * 100 / 10, t_enc_batch * 100 / 10);
+	info("apt-X HD decoder CPU per stream: block: %.2f%%, batch: %.2f%%",
+			t_dec_block * 100 / 10, t_dec_batch * 100 / 10);
+
+	aptxhdenc_destroy(enc_block);
+	aptxhdenc_destroy(enc_batch);
+	aptxhddec_destroy(dec_block);
+	aptxhddec_destroy(dec_batch);
+	free(pcm);
+	free(pcm_block);
+	free(pcm_batch);
+	free(code_block);
+	free(code_batch);
+
+} CK_END_TEST
+#endif
+
 #if ENABLE_APTX_HD_IO_TEST
 CK_START_TEST(test_a2dp_aptx_hd) {
 
@@ -1203,6 +2007,186 @@ CK_START_TEST(test_a2dp_aptx_hd) {
 } CK_END_TEST
 #endif
 
+#if ENABLE_APTX_LL_IO_TEST
+CK_START_TEST(test_a2dp_aptx_ll) {
+
+	struct ba_transport *t1 = test_transport_new_a2dp(device1,
+			BA_TRANSPORT_PROFILE_A2DP_SOURCE, "/path/aptxll", &a2dp_aptx_ll_source,
+			&config_aptx_ll_44100_stereo);
+	struct ba_transport *t2 = test_transport_new_a2dp(device2,
+			BA_TRANSPORT_PROFILE_A2DP_SINK, "/path/aptxll", &a2dp_aptx_ll_sink,
+			&config_aptx_ll_44100_stereo);
+
+	struct ba_transport_pcm *t1_pcm = &t1->media.pcm;
+	struct ba_transport_pcm *t2_pcm = &t2->media.pcm;
+
+	if (aging_duration) {
+		t1->mtu_read = t1->mtu_write = t2->mtu_read = t2->mtu_write = 400;
+		test_io(t1_pcm, t2_pcm, a2dp_aptx_ll_enc_thread, a2dp_aptx_ll_dec_thread, 4 * 1024);
+	}
+	else {
+		t1->mtu_read = t1->mtu_write = t2->mtu_read = t2->mtu_write = 400;
+		test_io(t1_pcm, t2_pcm, a2dp_aptx_ll_enc_thread, test_io_thread_dump_bt, 2 * 1024);
+		test_io(t1_pcm, t2_pcm, test_io_thread_dump_pcm, a2dp_aptx_ll_dec_thread, 2 * 1024);
+	};
+
+	ba_transport_destroy(t1);
+	ba_transport_destroy(t2);
+
+} CK_END_TEST
+#endif
+
+#if ENABLE_APTX_LL_IO_TEST && ENABLE_MSBC
+CK_START_TEST(test_a2dp_aptx_ll_voice) {
+
+	struct ba_transport *t1 = test_transport_new_a2dp(device1,
+			BA_TRANSPORT_PROFILE_A2DP_SOURCE, "/path/aptxll", &a2dp_aptx_ll_source,
+			&config_aptx_ll_44100_stereo);
+	struct ba_transport *t2 = test_transport_new_a2dp(device2,
+			BA_TRANSPORT_PROFILE_A2DP_SINK, "/path/aptxll", &a2dp_aptx_ll_sink,
+			&config_aptx_ll_44100_stereo);
+
+	struct ba_transport_pcm *t1_pcm_bc = &t1->media.pcm_bc;
+	struct ba_transport_pcm *t2_pcm_bc = &t2->media.pcm_bc;
+
+	t1->mtu_read = t1->mtu_write = t2->mtu_read = t2->mtu_write = 60 * 3;
+	if (aging_duration)
+		test_io(t2_pcm_bc, t1_pcm_bc, a2dp_voice_msbc_enc_thread, a2dp_voice_msbc_dec_thread, 4 * 1024);
+	else {
+		test_io(t2_pcm_bc, t1_pcm_bc, a2dp_voice_msbc_enc_thread, test_io_thread_dump_bt, 2 * 1024);
+		test_io(t2_pcm_bc, t1_pcm_bc, test_io_thread_dump_pcm, a2dp_voice_msbc_dec_thread, 2 * 1024);
+	}
+
+	ba_transport_destroy(t1);
+	ba_transport_destroy(t2);
+
+} CK_END_TEST
+#endif
+
+#if ENABLE_APTX_LL_IO_TEST
+/**
+ * Simulate aptX LL stream with the source clock running faster or slower
+ * than the local one and return the SRA state after given time. */
+static void test_aptx_ll_sra_simulate(struct aptx_ll_sra *sra,
+		double drift, unsigned int seconds) {
+
+	int16_t input[2 * 176] = { 0 };
+	int16_t output[2 * 180];
+
+	aptx_ll_sra_init(sra, 44100, 2, NULL, 0);
+
+	/* The source sends 4 ms packets according to its own clock. */
+	for (size_t i = 0;; i++) {
+
+		const double t = i * 176.0 / 44100 / (1 + drift);
+		if (t >= seconds)
+			break;
+
+		struct timespec now = { .tv_sec = t };
+		now.tv_nsec = (t - now.tv_sec) * 1000000000;
+
+		size_t frames = aptx_ll_sra_process(sra, input, 176, output, 180);
+		ck_assert_uint_le(frames, 180);
+		aptx_ll_sra_update(sra, &now, frames);
+
+	}
+
+}
+#endif
+
+#if ENABLE_APTX_LL_IO_TEST
+CK_START_TEST(test_a2dp_aptx_ll_sra) {
+
+	struct aptx_ll_sra sra;
+
+	/* Source clock 0.2% faster - the codec buffer level shall converge to
+	 * the target level and the sink shall produce less frames. */
+	test_aptx_ll_sra_simulate(&sra, 0.002, 60);
+	ck_assert(fabs(sra.adjustment - (1 / 1.002 - 1)) < 0.0001);
+	ck_assert(fabs(sra.level_avg - APTX_LL_TARGET_CODEC_LEVEL) < 10);
+
+	/* Source clock 0.2% slower - the sink shall produce more frames. */
+	test_aptx_ll_sra_simulate(&sra, -0.002, 60);
+	ck_assert(fabs(sra.adjustment - (1 / 0.998 - 1)) < 0.0001);
+	ck_assert(fabs(sra.level_avg - APTX_LL_TARGET_CODEC_LEVEL) < 10);
+
+	/* Clock drift out of the SRA range - adjustment shall be clamped. */
+	test_aptx_ll_sra_simulate(&sra, 0.01, 10);
+	ck_assert(fabs(sra.adjustment + APTX_LL_SRA_MAX_RATE / 10000.0) < 1e-9);
+
+} CK_END_TEST
+#endif
+
+#if ENABLE_APTX_LL_IO_TEST
+CK_START_TEST(test_a2dp_aptx_ll_latency) {
+
+	struct ba_transport *t1 = test_transport_new_a2dp(device1,
+			BA_TRANSPORT_PROFILE_A2DP_SOURCE, "/path/aptxll", &a2dp_aptx_ll_source,
+			&config_aptx_ll_44100_stereo);
+	struct ba_transport *t2 = test_transport_new_a2dp(device2,
+			BA_TRANSPORT_PROFILE_A2DP_SINK, "/path/aptxll", &a2dp_aptx_ll_sink,
+			&config_aptx_ll_44100_stereo);
+
+	struct ba_transport_pcm *t1_pcm = &t1->media.pcm;
+	struct ba_transport_pcm *t2_pcm = &t2->media.pcm;
+
+	t1->mtu_read = t1->mtu_write = t2->mtu_read = t2->mtu_write = 672;
+
+	int bt_fds[2];
+	ck_assert_int_eq(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, bt_fds), 0);
+	t1->bt_fd = bt_fds[1];
+	t2->bt_fd = bt_fds[0];
+
+	/* Use separate PCM connections for the source and the sink, so we
+	 * can measure the time between writing and receiving PCM frames. */
+	int pcm_src_fds[2], pcm_snk_fds[2];
+	ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pcm_src_fds), 0);
+	ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pcm_snk_fds), 0);
+	t1_pcm->fd = pcm_src_fds[1];
+	t2_pcm->fd = pcm_snk_fds[1];
+
+	ck_assert_int_eq(ba_transport_pcm_start(t2_pcm, a2dp_aptx_ll_dec_thread, "decode"), 0);
+	ck_assert_int_eq(ba_transport_pcm_start(t1_pcm, a2dp_aptx_ll_enc_thread, "encode"), 0);
+
+	int16_t pcm[2 * 441];
+	snd_pcm_sine_s16_2le(pcm, 2, ARRAYSIZE(pcm) / 2, 1.0 / 128, 0);
+
+	struct timespec ts_write, ts_read, ts_diff;
+	gettimestamp(&ts_write);
+	ck_assert_int_eq(write(pcm_src_fds[0], pcm, sizeof(pcm)), sizeof(pcm));
+
+	struct pollfd pfds[] = {{ pcm_snk_fds[0], POLLIN, 0 }};
+	ck_assert_int_eq(poll(pfds, ARRAYSIZE(pfds), 1000), 1);
+	gettimestamp(&ts_read);
+
+	timespecsub(&ts_read, &ts_write, &ts_diff);
+	const unsigned int latency_us = ts_diff.tv_sec * 1000000 + ts_diff.tv_nsec / 1000;
+	debug("aptX LL end-to-end latency: %u us", latency_us);
+
+	/* The encoder sends packets with at most 4 ms of audio, so the first
+	 * decoded frames shall be available way before the whole 10 ms burst
+	 * has been transferred. Use relaxed limit for the CI environment. */
+	ck_assert_uint_lt(latency_us, 20000);
+
+	pthread_mutex_lock(&t1_pcm->mutex);
+	ba_transport_pcm_release(t1_pcm);
+	pthread_mutex_unlock(&t1_pcm->mutex);
+	ba_transport_stop(t1);
+
+	pthread_mutex_lock(&t2_pcm->mutex);
+	ba_transport_pcm_release(t2_pcm);
+	pthread_mutex_unlock(&t2_pcm->mutex);
+	ba_transport_stop(t2);
+
+	close(pcm_src_fds[0]);
+	close(pcm_snk_fds[0]);
+
+	ba_transport_destroy(t1);
+	ba_transport_destroy(t2);
+
+} CK_END_TEST
+#endif
+
 #if ENABLE_FASTSTREAM
 CK_START_TEST(test_a2dp_faststream_music) {
 
@@ -1261,6 +2245,92 @@ CK_START_TEST(test_a2dp_faststream_voice) {
 } CK_END_TEST
 #endif
 
+#if ENABLE_FASTSTREAM
+CK_START_TEST(test_a2dp_faststream_voice_clock) {
+
+	struct ba_transport *t = test_transport_new_a2dp(device2,
+			BA_TRANSPORT_PROFILE_A2DP_SINK, "/path/faststream", &a2dp_faststream_sink,
+			&config_faststream_44100_16000);
+
+	struct ba_transport_pcm *t_pcm_bc = &t->media.pcm_bc;
+	struct io_poll io = { .timeout = -1 };
+	struct timespec ts_begin, ts_end, ts_diff;
+
+	ck_assert_uint_eq(t->media.pcm.rate, 44100);
+	ck_assert_uint_eq(t_pcm_bc->rate, 16000);
+	asrsync_init(&io.asrs, t_pcm_bc->rate);
+
+	/* Without the main stream the local clock shall be used. */
+	io_bc_sync(&io, t_pcm_bc, 160);
+	ck_assert_int_eq(t->media.clock.bc_coupled, false);
+
+	/* Main stream has started, so couple back-channel with it. */
+	io_bc_clock_update(t, 441);
+	io_bc_sync(&io, t_pcm_bc, 160);
+	ck_assert_int_eq(t->media.clock.bc_coupled, true);
+
+	/* Main stream is ahead of the back-channel - no waiting. */
+	io_bc_clock_update(t, 2 * 441);
+	gettimestamp(&ts_begin);
+	io_bc_sync(&io, t_pcm_bc, 160);
+	gettimestamp(&ts_end);
+	timespecsub(&ts_end, &ts_begin, &ts_diff);
+	ck_assert_int_eq(t->media.clock.bc_coupled, true);
+	ck_assert_int_lt(ts_diff.tv_nsec, 5000000);
+
+	/* Main stream has stopped - fall back to the local clock
+	 * after waiting twice the duration of transferred frames. */
+	gettimestamp(&ts_begin);
+	io_bc_sync(&io, t_pcm_bc, 320);
+	gettimestamp(&ts_end);
+	timespecsub(&ts_end, &ts_begin, &ts_diff);
+	ck_assert_int_eq(t->media.clock.bc_coupled, false);
+	ck_assert_int_ge(ts_diff.tv_nsec, 35000000);
+
+	ba_transport_destroy(t);
+
+} CK_END_TEST
+#endif
+
+#if ENABLE_FASTSTREAM
+CK_START_TEST(test_a2dp_faststream_music_clock) {
+
+	struct ba_transport *t1 = test_transport_new_a2dp(device1,
+			BA_TRANSPORT_PROFILE_A2DP_SOURCE, "/path/faststream", &a2dp_faststream_source,
+			&config_faststream_44100_16000);
+	struct ba_transport *t2 = test_transport_new_a2dp(device2,
+			BA_TRANSPORT_PROFILE_A2DP_SINK, "/path/faststream", &a2dp_faststream_sink,
+			&config_faststream_44100_16000);
+
+	struct ba_transport_pcm *t1_pcm = &t1->media.pcm;
+	struct ba_transport_pcm *t2_pcm = &t2->media.pcm;
+	struct ba_transport_pcm *t2_pcm_bc = &t2->media.pcm_bc;
+	struct io_poll io = { .timeout = -1 };
+
+	ck_assert_uint_eq(t2->media.clock.frames, 0);
+
+	/* Decode the music stream with the real decoder, which shall
+	 * advance the clock used for pacing the voice back-channel. */
+	t1->mtu_read = t1->mtu_write = t2->mtu_read = t2->mtu_write = 72 * 3;
+	test_io(t1_pcm, t2_pcm, a2dp_fs_enc_thread, test_io_thread_dump_bt, 2 * 1024);
+	test_io(t1_pcm, t2_pcm, test_io_thread_dump_pcm, a2dp_fs_dec_thread, 2 * 1024);
+
+	const uint64_t frames = t2->media.clock.frames;
+	ck_assert_uint_gt(frames, 0);
+	ck_assert_uint_le(frames, 2 * 1024);
+
+	/* Voice encoder shall couple with the running music stream clock. */
+	asrsync_init(&io.asrs, t2_pcm_bc->rate);
+	io_bc_sync(&io, t2_pcm_bc, 160);
+	ck_assert_int_eq(t2->media.clock.bc_coupled, true);
+	ck_assert_uint_eq(t2->media.clock.bc_base, frames);
+
+	ba_transport_destroy(t1);
+	ba_transport_destroy(t2);
+
+} CK_END_TEST
+#endif
+
 #if ENABLE_LC3PLUS
 CK_START_TEST(test_a2dp_lc3plus) {
 
@@ -1289,6 +2359,62 @@ CK_START_TEST(test_a2dp_lc3plus) {
 	ba_transport_destroy(t1);
 	ba_transport_destroy(t2);
 
+} CK_END_TEST
+
+CK_START_TEST(test_a2dp_lc3plus_low_latency) {
+
+	if (aging_duration || input_bt_file != NULL || input_pcm_file != NULL)
+		return;
+
+	const bool low_latency = config.lc3plus_low_latency;
+	config.lc3plus_low_latency = true;
+
+	struct ba_transport *t1 = test_transport_new_a2dp(device1,
+			BA_TRANSPORT_PROFILE_A2DP_SOURCE, "/path/lc3plus", &a2dp_lc3plus_source,
+			&config_lc3plus_96000_stereo_ll);
+	struct ba_transport *t2 = test_transport_new_a2dp(device2,
+			BA_TRANSPORT_PROFILE_A2DP_SINK, "/path/lc3plus", &a2dp_lc3plus_sink,
+			&config_lc3plus_96000_stereo_ll);
+
+	struct ba_transport_pcm *t1_pcm = &t1->media.pcm;
+	struct ba_transport_pcm *t2_pcm = &t2->media.pcm;
+	ck_assert_uint_eq(t1_pcm->rate, 96000);
+	ck_assert_uint_eq(t1_pcm->bitrate, config.lc3plus_bitrate);
+	/* sink PCM shall not expose encoder bitrate */
+	ck_assert_uint_eq(t2_pcm->bitrate, 0);
+
+	/* invalid bitrate request shall be rejected by the encoder */
+	atomic_store_explicit(&t1_pcm->bitrate_request, 1, memory_order_relaxed);
+
+	t1->mtu_read = t1->mtu_write = t2->mtu_read = t2->mtu_write =
+		RTP_HEADER_LEN + sizeof(rtp_media_header_t) + 300;
+	test_io(t1_pcm, t2_pcm, a2dp_lc3plus_enc_thread, test_io_thread_dump_bt, 2 * 1024);
+
+	ck_assert_uint_eq(atomic_load_explicit(&t1_pcm->bitrate_request, memory_order_relaxed), 0);
+	ck_assert_uint_eq(t1_pcm->bitrate, config.lc3plus_bitrate);
+
+	/* With the default 5 ms packet interval in the low-latency mode,
+	 * every RTP packet shall carry exactly two 2.5 ms frames. */
+	size_t packets = 0;
+	for (struct bt_data *data = &bt_data; data != bt_data_end; data = data->next) {
+		const rtp_media_header_t *rtp_media_header =
+			rtp_a2dp_get_payload((const rtp_header_t *)data->data);
+		ck_assert_uint_eq(rtp_media_header->fragmented, 0);
+		ck_assert_uint_eq(rtp_media_header->frame_count, 2);
+		packets++;
+	}
+
+	ck_assert_uint_gt(packets, 0);
+	/* codec delay shall include the packetization delay */
+	ck_assert_uint_ge(t1_pcm->codec_delay_dms, 25);
+
+	test_io(t1_pcm, t2_pcm, test_io_thread_dump_pcm, a2dp_lc3plus_dec_thread, 2 * 1024);
+
+	config.lc3plus_low_latency = low_latency;
+
+	ba_transport_destroy(t1);
+	ba_transport_destroy(t2);
+
 } CK_END_TEST
 #endif
 
@@ -1386,6 +2512,197 @@ CK_START_TEST(test_a2dp_opus) {
 } CK_END_TEST
 #endif
 
+#if ENABLE_OPUS
+CK_START_TEST(test_a2dp_opus_pw) {
+
+	struct ba_transport *t1 = test_transport_new_a2dp(device1,
+			BA_TRANSPORT_PROFILE_A2DP_SOURCE, "/path/opus", &a2dp_opus_pw_source,
+			&config_opus_pw_48000_5_1);
+	struct ba_transport *t2 = test_transport_new_a2dp(device2,
+			BA_TRANSPORT_PROFILE_A2DP_SINK, "/path/opus", &a2dp_opus_pw_source,
+			&config_opus_pw_48000_5_1);
+
+	struct ba_transport_pcm *t1_pcm = &t1->media.pcm;
+	struct ba_transport_pcm *t2_pcm = &t2->media.pcm;
+
+	ck_assert_uint_eq(t1_pcm->channels, 6);
+	ck_assert_int_eq(t1_pcm->channel_map[3], BA_TRANSPORT_PCM_CHANNEL_LFE);
+
+	if (aging_duration) {
+		t1->mtu_read = t1->mtu_write = t2->mtu_read = t2->mtu_write = 1024;
+		test_io(t1_pcm, t2_pcm, a2dp_opus_enc_thread, a2dp_opus_dec_thread, 4 * 1024);
+	}
+	else {
+		t1->mtu_read = t1->mtu_write = t2->mtu_read = t2->mtu_write = 1024;
+		test_io(t1_pcm, t2_pcm, a2dp_opus_enc_thread, test_io_thread_dump_bt, 48000);
+		/* One second of 5.1 audio shall fit into the negotiated bitrate. */
+		const size_t bitrate = bt_data_size() * 8;
+		info("Opus-PW 5.1 bitrate: %zu bps", bitrate);
+		ck_assert_uint_le(bitrate, 400 * 1024 * 110 / 100);
+		test_io(t1_pcm, t2_pcm, test_io_thread_dump_pcm, a2dp_opus_dec_thread, 2 * 1024);
+	}
+
+	ba_transport_destroy(t1);
+	ba_transport_destroy(t2);
+
+} CK_END_TEST
+#endif
+
+#if ENABLE_OPUS
+/**
+ * Calculate signal-to-noise ratio of the degraded S16 signal. */
+static double test_snr_s16(const GByteArray *ref, const GByteArray *deg) {
+	const int16_t *a = (const int16_t *)ref->data;
+	const int16_t *b = (const int16_t *)deg->data;
+	const size_t samples = MIN(ref->len, deg->len) / sizeof(int16_t);
+	double signal = 0, noise = 0;
+	for (size_t i = 0; i < samples; i++) {
+		signal += (double)a[i] * a[i];
+		noise += (double)(a[i] - b[i]) * (a[i] - b[i]);
+	}
+	return noise == 0 ? INFINITY : 10 * log10(signal / noise);
+}
+#endif
+
+#if ENABLE_OPUS
+/**
+ * Encode test signal and decode it with and without packet loss. Return
+ * the number of encoded bytes and the SNR of the lossy decoding. */
+static size_t test_a2dp_opus_loss(struct ba_transport *t1, struct ba_transport *t2,
+		double *snr) {
+
+	struct ba_transport_pcm *t1_pcm = &t1->media.pcm;
+	struct ba_transport_pcm *t2_pcm = &t2->media.pcm;
+	const unsigned int packet_loss_period_ = packet_loss_period;
+
+	test_io(t1_pcm, t2_pcm, a2dp_opus_enc_thread, test_io_thread_dump_bt, 24000);
+	const size_t size = bt_data_size();
+
+	GByteArray *ref = g_byte_array_new();
+	GByteArray *deg = g_byte_array_new();
+
+	packet_loss_period = 0;
+	pcm_capture = ref;
+	test_io(t1_pcm, t2_pcm, test_io_thread_dump_pcm, a2dp_opus_dec_thread, 0);
+
+	/* Drop every 5th packet, so every lost frame might be recovered with
+	 * the FEC data carried by the next packet. */
+	packet_loss_period = 5;
+	pcm_capture = deg;
+	test_io(t1_pcm, t2_pcm, test_io_thread_dump_pcm, a2dp_opus_dec_thread, 0);
+
+	pcm_capture = NULL;
+	packet_loss_period = packet_loss_period_;
+
+	/* Loss concealment shall fill all gaps, except the trailing one. */
+	const size_t frame_bytes = 480 * 2 * sizeof(int16_t);
+	ck_assert_uint_ge(deg->len + frame_bytes, ref->len);
+
+	*snr = test_snr_s16(ref, deg);
+
+	g_byte_array_free(ref, TRUE);
+	g_byte_array_free(deg, TRUE);
+	return size;
+}
+#endif
+
+#if ENABLE_OPUS
+CK_START_TEST(test_a2dp_opus_fec_dtx) {
+
+	if (aging_duration || input_bt_file != NULL || input_pcm_file != NULL)
+		return;
+
+	struct ba_transport *t1 = test_transport_new_a2dp(device1,
+			BA_TRANSPORT_PROFILE_A2DP_SOURCE, "/path/opus", &a2dp_opus_source,
+			&config_opus_48000_stereo);
+	struct ba_transport *t2 = test_transport_new_a2dp(device2,
+			BA_TRANSPORT_PROFILE_A2DP_SINK, "/path/opus", &a2dp_opus_source,
+			&config_opus_48000_stereo);
+
+	t1->mtu_read = t1->mtu_write = t2->mtu_read = t2->mtu_write = 600;
+
+	const bool opus_dtx = config.opus_dtx;
+	const bool opus_fec = config.opus_fec;
+	const uint8_t opus_packet_loss = config.opus_packet_loss;
+
+	double snr_plc, snr_fec, snr;
+	config.opus_fec = false;
+	const size_t size_plc = test_a2dp_opus_loss(t1, t2, &snr_plc);
+	config.opus_fec = true;
+	config.opus_packet_loss = 20;
+	const size_t size_fec = test_a2dp_opus_loss(t1, t2, &snr_fec);
+
+	info("Opus 20%% loss with PLC: %zu bytes, SNR: %.1f dB", size_plc, snr_plc);
+	info("Opus 20%% loss with FEC: %zu bytes, SNR: %.1f dB", size_fec, snr_fec);
+	ck_assert_double_gt(snr_fec, snr_plc);
+
+	config.opus_fec = false;
+	pcm_silence = true;
+	const size_t size_silence = test_a2dp_opus_loss(t1, t2, &snr);
+	config.opus_dtx = true;
+	const size_t size_silence_dtx = test_a2dp_opus_loss(t1, t2, &snr);
+	pcm_silence = false;
+
+	info("Opus silence: %zu bytes, with DTX: %zu bytes", size_silence, size_silence_dtx);
+	ck_assert_uint_lt(size_silence_dtx, size_silence);
+
+	config.opus_dtx = opus_dtx;
+	config.opus_fec = opus_fec;
+	config.opus_packet_loss = opus_packet_loss;
+
+	ba_transport_destroy(t1);
+	ba_transport_destroy(t2);
+
+} CK_END_TEST
+#endif
+
+#if ENABLE_OPUS
+CK_START_TEST(test_a2dp_opus_bitrate) {
+
+	if (aging_duration || input_bt_file != NULL || input_pcm_file != NULL)
+		return;
+
+	struct ba_transport *t1 = test_transport_new_a2dp(device1,
+			BA_TRANSPORT_PROFILE_A2DP_SOURCE, "/path/opus", &a2dp_opus_source,
+			&config_opus_48000_stereo);
+	struct ba_transport *t2 = test_transport_new_a2dp(device2,
+			BA_TRANSPORT_PROFILE_A2DP_SINK, "/path/opus", &a2dp_opus_source,
+			&config_opus_48000_stereo);
+
+	struct ba_transport_pcm *t1_pcm = &t1->media.pcm;
+	struct ba_transport_pcm *t2_pcm = &t2->media.pcm;
+	ck_assert_uint_eq(t1_pcm->bitrate, config.opus_bitrate * 2);
+	/* sink PCM shall not expose encoder bitrate */
+	ck_assert_uint_eq(t2_pcm->bitrate, 0);
+
+	t1->mtu_read = t1->mtu_write = t2->mtu_read = t2->mtu_write = 600;
+
+	test_io(t1_pcm, t2_pcm, a2dp_opus_enc_thread, test_io_thread_dump_bt, 24000);
+	const unsigned int bitrate = t1_pcm->bitrate;
+	const size_t size = bt_data_size();
+	/* bitrate shall be limited by the write MTU */
+	ck_assert_uint_le(bitrate, config.opus_bitrate * 2);
+
+	/* out of range bitrate shall be rejected by the encoder */
+	atomic_store_explicit(&t1_pcm->bitrate_request, 1000, memory_order_relaxed);
+	test_io(t1_pcm, t2_pcm, a2dp_opus_enc_thread, test_io_thread_dump_bt, 24000);
+	ck_assert_uint_eq(t1_pcm->bitrate, bitrate);
+
+	/* bitrate shall be changed when the encoder is running */
+	atomic_store_explicit(&t1_pcm->bitrate_request, 32000, memory_order_relaxed);
+	test_io(t1_pcm, t2_pcm, a2dp_opus_enc_thread, test_io_thread_dump_bt, 24000);
+	ck_assert_uint_eq(t1_pcm->bitrate, 32000);
+
+	const size_t size_low = bt_data_size();
+	info("Opus bitrate %u: %zu bytes, bitrate 32000: %zu bytes", bitrate, size, size_low);
+	ck_assert_uint_lt(size_low, size / 2);
+
+	ba_transport_destroy(t1);
+	ba_transport_destroy(t2);
+
+} CK_END_TEST
+#endif
+
 CK_START_TEST(test_sco_cvsd) {
 
 	struct ba_transport *t1 = test_transport_new_sco(device1,
@@ -1469,10 +2786,19 @@ int main(int argc, char *argv[]) {
 #endif
 	} codecs[] = {
 		{ a2dp_codecs_codec_id_to_string(A2DP_CODEC_SBC), test_a2dp_sbc },
+		{ a2dp_codecs_codec_id_to_string(A2DP_CODEC_SBC), test_a2dp_sbc_dynamic_bitpool },
 		{ a2dp_codecs_codec_id_to_string(A2DP_CODEC_SBC), test_a2dp_sbc_invalid_config },
 		{ a2dp_codecs_codec_id_to_string(A2DP_CODEC_SBC), test_a2dp_sbc_pcm_drain },
 		{ a2dp_codecs_codec_id_to_string(A2DP_CODEC_SBC), test_a2dp_sbc_pcm_drain_and_close },
 		{ a2dp_codecs_codec_id_to_string(A2DP_CODEC_SBC), test_a2dp_sbc_pcm_drop },
+		{ a2dp_codecs_codec_id_to_string(A2DP_CODEC_SBC), test_a2dp_sbc_broadcast },
+		{ a2dp_codecs_codec_id_to_string(A2DP_CODEC_SBC), test_a2dp_sbc_broadcast_delay },
+		{ a2dp_codecs_codec_id_to_string(A2DP_CODEC_SBC), test_a2dp_sbc_broadcast_stalled },
+		{ a2dp_codecs_codec_id_to_string(A2DP_CODEC_SBC), test_a2dp_sink_mix },
+		{ a2dp_codecs_codec_id_to_string(A2DP_CODEC_SBC), test_a2dp_sink_pcm_write_splice },
+#if ENABLE_CODEC_MODULES
+		{ a2dp_codecs_codec_id_to_string(A2DP_CODEC_SBC), test_a2dp_codec_module },
+#endif
 #if ENABLE_MP3LAME
 		{ a2dp_codecs_codec_id_to_string(A2DP_CODEC_MPEG12), test_a2dp_mp3 },
 #endif
@@ -1482,25 +2808,43 @@ int main(int argc, char *argv[]) {
 #endif
 #if ENABLE_APTX_IO_TEST
 		{ a2dp_codecs_codec_id_to_string(A2DP_CODEC_VENDOR_ID(APTX_VENDOR_ID, APTX_CODEC_ID)), test_a2dp_aptx },
+		{ a2dp_codecs_codec_id_to_string(A2DP_CODEC_VENDOR_ID(APTX_VENDOR_ID, APTX_CODEC_ID)), test_a2dp_aptx_batch },
 #endif
 #if ENABLE_APTX_HD_IO_TEST
 		{ a2dp_codecs_codec_id_to_string(A2DP_CODEC_VENDOR_ID(APTX_HD_VENDOR_ID, APTX_HD_CODEC_ID)), test_a2dp_aptx_hd },
+		{ a2dp_codecs_codec_id_to_string(A2DP_CODEC_VENDOR_ID(APTX_HD_VENDOR_ID, APTX_HD_CODEC_ID)), test_a2dp_aptx_hd_batch },
+#endif
+#if ENABLE_APTX_LL_IO_TEST
+		{ a2dp_codecs_codec_id_to_string(A2DP_CODEC_VENDOR_ID(APTX_LL_VENDOR_ID, APTX_LL_CODEC_ID)), test_a2dp_aptx_ll },
+# if ENABLE_MSBC
+		{ a2dp_codecs_codec_id_to_string(A2DP_CODEC_VENDOR_ID(APTX_LL_VENDOR_ID, APTX_LL_CODEC_ID)), test_a2dp_aptx_ll_voice },
+# endif
+		{ a2dp_codecs_codec_id_to_string(A2DP_CODEC_VENDOR_ID(APTX_LL_VENDOR_ID, APTX_LL_CODEC_ID)), test_a2dp_aptx_ll_sra },
+		{ a2dp_codecs_codec_id_to_string(A2DP_CODEC_VENDOR_ID(APTX_LL_VENDOR_ID, APTX_LL_CODEC_ID)), test_a2dp_aptx_ll_latency },
 #endif
 #if ENABLE_FASTSTREAM
 		{ a2dp_codecs_codec_id_to_string(A2DP_CODEC_VENDOR_ID(FASTSTREAM_VENDOR_ID, FASTSTREAM_CODEC_ID)), test_a2dp_faststream_music },
 		{ a2dp_codecs_codec_id_to_string(A2DP_CODEC_VENDOR_ID(FASTSTREAM_VENDOR_ID, FASTSTREAM_CODEC_ID)), test_a2dp_faststream_voice },
+		{ a2dp_codecs_codec_id_to_string(A2DP_CODEC_VENDOR_ID(FASTSTREAM_VENDOR_ID, FASTSTREAM_CODEC_ID)), test_a2dp_faststream_voice_clock },
+		{ a2dp_codecs_codec_id_to_string(A2DP_CODEC_VENDOR_ID(FASTSTREAM_VENDOR_ID, FASTSTREAM_CODEC_ID)), test_a2dp_faststream_music_clock },
 #endif
 #if ENABLE_LC3PLUS
 		{ a2dp_codecs_codec_id_to_string(A2DP_CODEC_VENDOR_ID(LC3PLUS_VENDOR_ID, LC3PLUS_CODEC_ID)), test_a2dp_lc3plus },
+		{ a2dp_codecs_codec_id_to_string(A2DP_CODEC_VENDOR_ID(LC3PLUS_VENDOR_ID, LC3PLUS_CODEC_ID)), test_a2dp_lc3plus_low_latency },
 #endif
 #if ENABLE_LDAC_IO_TEST
 		{ a2dp_codecs_codec_id_to_string(A2DP_CODEC_VENDOR_ID(LDAC_VENDOR_ID, LDAC_CODEC_ID)), test_a2dp_ldac },
 #endif
 #if ENABLE_LHDC
 		{ a2dp_codecs_codec_id_to_string(A2DP_CODEC_VENDOR_ID(LHDC_V3_VENDOR_ID, LHDC_V3_CODEC_ID)), test_a2dp_lhdc_v3 },
+# if ENABLE_MSBC
+# endif
 #endif
 #if ENABLE_OPUS
 		{ a2dp_codecs_codec_id_to_string(A2DP_CODEC_VENDOR_ID(OPUS_VENDOR_ID, OPUS_CODEC_ID)), test_a2dp_opus },
+		{ a2dp_codecs_codec_id_to_string(A2DP_CODEC_VENDOR_ID(OPUS_VENDOR_ID, OPUS_CODEC_ID)), test_a2dp_opus_fec_dtx },
+		{ a2dp_codecs_codec_id_to_string(A2DP_CODEC_VENDOR_ID(OPUS_VENDOR_ID, OPUS_CODEC_ID)), test_a2dp_opus_bitrate },
+		{ a2dp_codecs_codec_id_to_string(A2DP_CODEC_VENDOR_ID(OPUS_PW_VENDOR_ID, OPUS_PW_CODEC_ID)), test_a2dp_opus_pw },
 #endif
 		{ hfp_codec_id_to_string(HFP_CODEC_CVSD), test_sco_cvsd },
 #if ENABLE_MSBC
@@ -1562,7 +2906,7 @@ int main(int argc, char *argv[]) {
 			return 1;
 		}
 
-	unsigned int enabled_codecs = 0xFFFFFFFF;
+	uint64_t enabled_codecs = UINT64_MAX;
 
 	if (optind != argc)
 		enabled_codecs = 0;
@@ -1570,7 +2914,7 @@ int main(int argc, char *argv[]) {
 	for (; optind < argc; optind++)
 		for (size_t i = 0; i < ARRAYSIZE(codecs); i++)
 			if (strcasecmp(argv[optind], codecs[i].name) == 0)
-				enabled_codecs |= 1 << i;
+				enabled_codecs |= 1ULL << i;
 
 	if (input_bt_file != NULL) {
 
@@ -1597,7 +2941,7 @@ int main(int argc, char *argv[]) {
 		enabled_codecs = 0;
 		for (size_t i = 0; i < ARRAYSIZE(codecs); i++)
 			if (codec != NULL && strcmp(codec, codecs[i].name) == 0)
-				enabled_codecs |= 1 << i;
+				enabled_codecs |= 1ULL << i;
 
 		/* If we do not have a test case for the codec, dump the data here. */
 		if (enabled_codecs == 0) {
@@ -1628,7 +2972,7 @@ int main(int argc, char *argv[]) {
 		tcase_set_timeout(tc, aging_duration + 3600);
 
 	for (size_t i = 0; i < ARRAYSIZE(codecs); i++)
-		if (enabled_codecs & (1 << i))
+		if (enabled_codecs & (1ULL << i))
 			tcase_add_test(tc, codecs[i].tf);
 
 	srunner_run_all(sr, CK_ENV);
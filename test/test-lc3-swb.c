@@ -17,6 +17,7 @@
 #include <glib.h>
 
 #include "codec-lc3-swb.h"
+#include "codec-lib.h"
 #include "shared/defs.h"
 #include "shared/ffb.h"
 #include "shared/log.h"
@@ -169,6 +170,10 @@ CK_START_TEST(test_lc3_swb_decode_plc) {
 
 } CK_END_TEST
 
+static void tc_setup(void) {
+	ck_assert_int_eq(codec_lib_load(&codec_lib_lc3), 0);
+}
+
 int main(void) {
 
 	Suite *s = suite_create(__FILE__);
@@ -176,6 +181,7 @@ int main(void) {
 	SRunner *sr = srunner_create(s);
 
 	suite_add_tcase(s, tc);
+	tcase_add_checked_fixture(tc, tc_setup, NULL);
 
 	tcase_add_test(tc, test_lc3_swb_init);
 	tcase_add_test(tc, test_lc3_swb_encode_decode);
@@ -1,6 +1,6 @@
 /*
  * test-rfcomm.c
- * Copyright (c) 2016-2024 Arkadiusz Bokowy
+ * Copyright (c) 2016-2025 Arkadiusz Bokowy
  *
  * This file is a part of bluez-alsa.
  *
@@ -15,8 +15,10 @@
 #include <pthread.h>
 #include <signal.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <bluetooth/bluetooth.h>
@@ -36,6 +38,7 @@
 #include "bluez.h"
 #include "hfp.h"
 #include "shared/log.h"
+#include "shared/rt.h"
 
 #include "inc/check.inc"
 
@@ -68,6 +71,19 @@ int storage_device_save(const struct ba_device *d) { (void)d; return 0; }
 int storage_pcm_data_sync(struct ba_transport_pcm *pcm) { (void)pcm; return 0; }
 int storage_pcm_data_update(const struct ba_transport_pcm *pcm) { (void)pcm; return 0; }
 
+static struct {
+	uint32_t features;
+	uint8_t codec_id;
+} hfp_slc_cache;
+
+int storage_hfp_slc_load(const struct ba_transport *t, uint32_t *features, uint8_t *codec_id) {
+	(void)t; *features = hfp_slc_cache.features; *codec_id = hfp_slc_cache.codec_id;
+	return hfp_slc_cache.codec_id != HFP_CODEC_UNDEFINED; }
+int storage_hfp_slc_update(const struct ba_transport *t, uint32_t features, uint8_t codec_id) {
+	debug("%s: %#x %u", __func__, features, codec_id); (void)t;
+	hfp_slc_cache.features = features; hfp_slc_cache.codec_id = codec_id;
+	return 0; }
+
 int bluealsa_dbus_pcm_register(struct ba_transport_pcm *pcm) {
 	debug("%s: %p", __func__, (void *)pcm);
 	pcm->ba_dbus_exported = true;
@@ -81,6 +97,8 @@ void bluealsa_dbus_pcm_update(struct ba_transport_pcm *pcm, unsigned int mask) {
 	pthread_cond_signal(&dbus_update_cond); }
 void bluealsa_dbus_pcm_unregister(struct ba_transport_pcm *pcm) {
 	debug("%s: %p", __func__, (void *)pcm); (void)pcm; }
+void bluealsa_dbus_mix_update(struct ba_mix *mix, unsigned int mask) {
+	debug("%s: %p %#x", __func__, (void *)mix, mask); (void)mix; (void)mask; }
 int bluealsa_dbus_rfcomm_register(struct ba_rfcomm *r) {
 	debug("%s: %p", __func__, (void *)r); (void)r; return 0; }
 void bluealsa_dbus_rfcomm_update(struct ba_rfcomm *r, unsigned int mask) {
@@ -334,6 +352,76 @@ CK_START_TEST(test_rfcomm_hfp_ag) {
 
 } CK_END_TEST
 
+#if ENABLE_HFP_CODEC_SELECTION
+CK_START_TEST(test_rfcomm_hfp_ag_slc_cache) {
+
+	/* codec selection succeeded during the last connection */
+	hfp_slc_cache.features = HFP_HF_FEAT_VOLUME | HFP_HF_FEAT_CODEC | HFP_HF_FEAT_ESCO;
+	hfp_slc_cache.codec_id = HFP_CODEC_CVSD;
+
+	int fds[2];
+	ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+	struct ba_transport *sco = ba_transport_new_sco(device1,
+			BA_TRANSPORT_PROFILE_HFP_AG, ":test", "/sco", fds[0]);
+	const int fd = fds[1];
+
+	ck_assert_rfcomm_send(fd, "AT+BRSF=656\r");
+	ck_assert_rfcomm_recv(fd, "\r\n+BRSF:2784\r\n");
+	ck_assert_rfcomm_recv(fd, "\r\nOK\r\n");
+
+#if ENABLE_MSBC && ENABLE_LC3_SWB
+	ck_assert_rfcomm_send(fd, "AT+BAC=1,2,3\r");
+#elif ENABLE_MSBC
+	ck_assert_rfcomm_send(fd, "AT+BAC=1,2\r");
+#elif ENABLE_LC3_SWB
+	ck_assert_rfcomm_send(fd, "AT+BAC=1,3\r");
+#endif
+	ck_assert_rfcomm_recv(fd, "\r\nOK\r\n");
+
+	ck_assert_rfcomm_send(fd, "AT+CIND=?\r");
+	ck_assert_rfcomm_recv(fd,
+			"\r\n+CIND:(\"service\",(0,1)),(\"call\",(0,1)),(\"callsetup\",(0-3)),"
+			"(\"callheld\",(0-2)),(\"signal\",(0-5)),(\"roam\",(0,1)),(\"battchg\",(0-5))\r\n");
+	ck_assert_rfcomm_recv(fd, "\r\nOK\r\n");
+
+	ck_assert_rfcomm_send(fd, "AT+CIND?\r");
+	ck_assert_rfcomm_recv(fd, "\r\n+CIND:0,0,0,0,0,0,4\r\n");
+	ck_assert_rfcomm_recv(fd, "\r\nOK\r\n");
+
+	struct timespec ts0, ts1, elapsed;
+	gettimestamp(&ts0);
+
+	ck_assert_rfcomm_send(fd, "AT+CMER=3,0,0,1\r");
+	ck_assert_rfcomm_recv(fd, "\r\nOK\r\n");
+
+	/* Codec selection shall be started right after the SLC establishment,
+	 * without waiting for the connection to become idle. */
+# if ENABLE_LC3_SWB
+	ck_assert_rfcomm_recv(fd, "\r\n+BCS:3\r\n");
+	ck_assert_rfcomm_send(fd, "AT+BCS=3\r");
+# elif ENABLE_MSBC
+	ck_assert_rfcomm_recv(fd, "\r\n+BCS:2\r\n");
+	ck_assert_rfcomm_send(fd, "AT+BCS=2\r");
+# endif
+	ck_assert_rfcomm_recv(fd, "\r\nOK\r\n");
+	dbus_update_counters_wait(&dbus_update_counters.codec, 2);
+
+	gettimestamp(&ts1);
+	timespecsub(&ts1, &ts0, &elapsed);
+	const unsigned int elapsed_ms = elapsed.tv_sec * 1000 + elapsed.tv_nsec / 1000000;
+	debug("Audio ready after SLC establishment: %u ms", elapsed_ms);
+	ck_assert_uint_lt(elapsed_ms, BA_RFCOMM_TIMEOUT_IDLE / 2);
+
+	/* cache shall be updated with the selected codec */
+	ck_assert_uint_eq(hfp_slc_cache.features, 656);
+	ck_assert_uint_eq(hfp_slc_cache.codec_id, ba_transport_get_codec(sco));
+
+	ba_transport_destroy(sco);
+	close(fd);
+
+} CK_END_TEST
+#endif
+
 CK_START_TEST(test_rfcomm_hfp_hf) {
 
 	int fds[2];
@@ -463,10 +551,8 @@ CK_START_TEST(test_rfcomm_self_hfp_slc) {
 	/* wait for codec selection (SLC established) signals */
 	dbus_update_counters_wait(&dbus_update_counters.codec, 0 + (2 + 2));
 
-	pthread_mutex_lock(&adapter->devices_mutex);
 	ck_assert_int_eq(device1->ref_count, 1 + 1);
 	ck_assert_int_eq(device2->ref_count, 1 + 1);
-	pthread_mutex_unlock(&adapter->devices_mutex);
 
 	ck_assert_int_eq(ba_transport_get_codec(ag), HFP_CODEC_CVSD);
 	ck_assert_int_eq(ba_transport_get_codec(hf), HFP_CODEC_CVSD);
@@ -481,10 +567,35 @@ CK_START_TEST(test_rfcomm_self_hfp_slc) {
 	debug("Wait for asynchronous free");
 	usleep(100000);
 
-	pthread_mutex_lock(&adapter->devices_mutex);
 	ck_assert_int_eq(device1->ref_count, 1);
 	ck_assert_int_eq(device2->ref_count, 1);
-	pthread_mutex_unlock(&adapter->devices_mutex);
+
+} CK_END_TEST
+
+CK_START_TEST(test_rfcomm_engine_stop) {
+
+	for (size_t i = 0; i < 2; i++) {
+
+		int fds[2];
+		ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+		struct ba_transport *sco = ba_transport_new_sco(device1,
+				BA_TRANSPORT_PROFILE_HSP_AG, ":test", "/sco", fds[0]);
+		const int fd = fds[1];
+
+		/* check that the event loop processes our commands */
+		ck_assert_rfcomm_send(fd, "AT+VGS=13\r");
+		ck_assert_rfcomm_recv(fd, "\r\nOK\r\n");
+
+		ba_transport_destroy(sco);
+		close(fd);
+
+		/* the event loop shall be restarted for a new connection */
+		ba_rfcomm_engine_stop();
+
+	}
+
+	/* stopping not running event loop shall be a no-op */
+	ba_rfcomm_engine_stop();
 
 } CK_END_TEST
 
@@ -503,6 +614,9 @@ void tc_setup(void) {
 
 	memset(&dbus_update_counters, 0, sizeof(dbus_update_counters));
 
+	hfp_slc_cache.features = 0;
+	hfp_slc_cache.codec_id = HFP_CODEC_UNDEFINED;
+
 }
 
 int main(void) {
@@ -527,8 +641,12 @@ int main(void) {
 	tcase_add_test(tc, test_rfcomm_hsp_ag);
 	tcase_add_test(tc, test_rfcomm_hsp_hs);
 	tcase_add_test(tc, test_rfcomm_hfp_ag);
+#if ENABLE_HFP_CODEC_SELECTION
+	tcase_add_test(tc, test_rfcomm_hfp_ag_slc_cache);
+#endif
 	tcase_add_test(tc, test_rfcomm_hfp_hf);
 	tcase_add_test(tc, test_rfcomm_self_hfp_slc);
+	tcase_add_test(tc, test_rfcomm_engine_stop);
 
 	srunner_run_all(sr, CK_ENV);
 	int nf = srunner_ntests_failed(sr);
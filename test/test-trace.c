@@ -0,0 +1,162 @@
+/*
+ * test-trace.c
+ * Copyright (c) 2016-2025 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <check.h>
+
+#include "trace.h"
+#include "shared/trace.h"
+
+#include "inc/check.inc"
+
+struct trace_dump_data {
+	/* dump only ring of the given thread */
+	pid_t tid;
+	const char *name;
+	size_t rings;
+	struct ba_trace_event events[TRACE_RING_SIZE];
+	size_t len;
+};
+
+static void test_trace_dump_cb(pid_t tid, const char *name,
+		const struct ba_trace_event *events, size_t len, void *userdata) {
+	struct trace_dump_data *data = userdata;
+	if (data->tid != 0 && data->tid != tid)
+		return;
+	if (data->name != NULL && strcmp(data->name, name) != 0)
+		return;
+	data->rings++;
+	memcpy(data->events, events, len * sizeof(*events));
+	data->len = len;
+}
+
+static void *trace_thread(void *userdata) {
+	const uint32_t *count = userdata;
+	pthread_setname_np(pthread_self(), "trace-thread");
+	for (uint32_t i = 0; i < *count; i++)
+		trace_event(BA_TRACE_EVENT_BT_WRITE, i, 0);
+	return NULL;
+}
+
+CK_START_TEST(test_trace_disabled) {
+
+	trace_set_enabled(false);
+	trace_event(BA_TRACE_EVENT_PCM_READ, 1, 0);
+
+	struct trace_dump_data data = { .tid = syscall(SYS_gettid) };
+	ck_assert_int_eq(trace_dump(test_trace_dump_cb, &data), 0);
+	ck_assert_uint_eq(data.rings, 0);
+
+} CK_END_TEST
+
+CK_START_TEST(test_trace_record) {
+
+	trace_set_enabled(true);
+	trace_event(BA_TRACE_EVENT_ENCODE_BEGIN, 512, 0);
+	trace_event(BA_TRACE_EVENT_ENCODE_END, 119, 1);
+	trace_event(BA_TRACE_EVENT_RTP, 1, 1024);
+	trace_set_enabled(false);
+	trace_event(BA_TRACE_EVENT_BT_WRITE, 119, 0);
+
+	struct trace_dump_data data = { .tid = syscall(SYS_gettid) };
+	ck_assert_int_eq(trace_dump(test_trace_dump_cb, &data), 0);
+	ck_assert_uint_eq(data.rings, 1);
+
+	ck_assert_uint_eq(data.len, 3);
+	ck_assert_uint_eq(data.events[0].type, BA_TRACE_EVENT_ENCODE_BEGIN);
+	ck_assert_uint_eq(data.events[0].arg0, 512);
+	ck_assert_uint_eq(data.events[1].type, BA_TRACE_EVENT_ENCODE_END);
+	ck_assert_uint_eq(data.events[1].arg1, 1);
+	ck_assert_uint_eq(data.events[2].type, BA_TRACE_EVENT_RTP);
+	ck_assert_uint_eq(data.events[2].arg1, 1024);
+	ck_assert_uint_le(data.events[0].timestamp, data.events[1].timestamp);
+	ck_assert_uint_le(data.events[1].timestamp, data.events[2].timestamp);
+
+	ck_assert_str_eq(ba_trace_event_type_to_string(BA_TRACE_EVENT_RTP), "rtp");
+	ck_assert_str_eq(ba_trace_event_type_to_string(0), "unknown");
+
+} CK_END_TEST
+
+CK_START_TEST(test_trace_ring_overflow) {
+
+	const uint32_t count = TRACE_RING_SIZE + 10;
+
+	trace_set_enabled(true);
+	for (uint32_t i = 0; i < count; i++)
+		trace_event(BA_TRACE_EVENT_PCM_READ, i, 0);
+
+	struct trace_dump_data data = { .tid = syscall(SYS_gettid) };
+	ck_assert_int_eq(trace_dump(test_trace_dump_cb, &data), 0);
+	ck_assert_uint_eq(data.rings, 1);
+
+	/* The oldest events shall be overwritten, but the remaining
+	 * ones shall be reported in the recording order. */
+	ck_assert_uint_ge(data.len, TRACE_RING_SIZE - 1);
+	ck_assert_uint_eq(data.events[data.len - 1].arg0, count - 1);
+	for (size_t i = 1; i < data.len; i++)
+		ck_assert_uint_eq(data.events[i].arg0, data.events[i - 1].arg0 + 1);
+
+} CK_END_TEST
+
+CK_START_TEST(test_trace_ring_reuse) {
+
+	trace_set_enabled(true);
+
+	pthread_t thread;
+	uint32_t count = 5;
+	ck_assert_int_eq(pthread_create(&thread, NULL, trace_thread, &count), 0);
+	ck_assert_int_eq(pthread_join(thread, NULL), 0);
+
+	struct trace_dump_data data = { .name = "trace-thread" };
+	ck_assert_int_eq(trace_dump(test_trace_dump_cb, &data), 0);
+	ck_assert_uint_eq(data.rings, 1);
+	ck_assert_uint_eq(data.len, 5);
+
+	/* Ring released by the exited thread shall be reused. */
+	count = 2;
+	ck_assert_int_eq(pthread_create(&thread, NULL, trace_thread, &count), 0);
+	ck_assert_int_eq(pthread_join(thread, NULL), 0);
+
+	data.rings = 0;
+	ck_assert_int_eq(trace_dump(test_trace_dump_cb, &data), 0);
+	ck_assert_uint_eq(data.rings, 1);
+	ck_assert_uint_eq(data.len, 2);
+
+} CK_END_TEST
+
+int main(void) {
+
+	Suite *s = suite_create(__FILE__);
+	TCase *tc = tcase_create(__FILE__);
+	SRunner *sr = srunner_create(s);
+
+	suite_add_tcase(s, tc);
+
+	tcase_add_test(tc, test_trace_disabled);
+	tcase_add_test(tc, test_trace_record);
+	tcase_add_test(tc, test_trace_ring_overflow);
+	tcase_add_test(tc, test_trace_ring_reuse);
+
+	srunner_run_all(sr, CK_ENV);
+	int nf = srunner_ntests_failed(sr);
+	srunner_free(sr);
+
+	return nf == 0 ? 0 : 1;
+}
@@ -67,6 +67,27 @@ CK_START_TEST(test_g_variant_sanitize_object_path) {
 
 } CK_END_TEST
 
+CK_START_TEST(test_cpu_set_parse) {
+
+	cpu_set_t set;
+
+	ck_assert_int_eq(cpu_set_parse("1", &set), 0);
+	ck_assert_int_eq(CPU_COUNT(&set), 1);
+	ck_assert_int_eq(CPU_ISSET(1, &set), 1);
+
+	ck_assert_int_eq(cpu_set_parse("0,2-4", &set), 0);
+	ck_assert_int_eq(CPU_COUNT(&set), 4);
+	ck_assert_int_eq(CPU_ISSET(1, &set), 0);
+	ck_assert_int_eq(CPU_ISSET(4, &set), 1);
+
+	ck_assert_int_eq(cpu_set_parse("", &set), -1);
+	ck_assert_int_eq(cpu_set_parse("1,", &set), -1);
+	ck_assert_int_eq(cpu_set_parse("3-1", &set), -1);
+	ck_assert_int_eq(cpu_set_parse("0-X", &set), -1);
+	ck_assert_int_eq(errno, EINVAL);
+
+} CK_END_TEST
+
 #if DEBUG
 CK_START_TEST(test_batostr_) {
 
@@ -319,6 +340,7 @@ int main(void) {
 	tcase_add_test(tc, test_g_dbus_bluez_object_path_to_hci_dev_id);
 	tcase_add_test(tc, test_g_dbus_bluez_object_path_to_bdaddr);
 	tcase_add_test(tc, test_g_variant_sanitize_object_path);
+	tcase_add_test(tc, test_cpu_set_parse);
 #if DEBUG
 	tcase_add_test(tc, test_batostr_);
 #endif
@@ -79,6 +79,8 @@ struct io_worker {
 	struct alsa_mixer alsa_mixer;
 	/* if true, playback is active */
 	atomic_bool active;
+	/* if true, the server resamples audio to the fixed rate */
+	atomic_bool rate_fixed;
 	/* human-readable BT address */
 	char addr[18];
 };
@@ -97,6 +99,7 @@ static bdaddr_t *ba_addrs = NULL;
 static size_t ba_addrs_count = 0;
 static unsigned int pcm_buffer_time = 0;
 static unsigned int pcm_period_time = 0;
+static unsigned int pcm_rate = 0;
 #if WITH_LIBSAMPLERATE
 static enum resampler_converter_type resampler_method = RESAMPLER_CONV_NONE;
 #endif
@@ -166,6 +169,8 @@ static snd_pcm_format_t bluealsa_get_snd_pcm_format(const struct ba_pcm *pcm) {
 		return SND_PCM_FORMAT_S24_LE;
 	case 0x8420:
 		return SND_PCM_FORMAT_S32_LE;
+	case 0xA420:
+		return SND_PCM_FORMAT_FLOAT_LE;
 	default:
 		error("Unknown PCM format: %#x", pcm->format);
 		return SND_PCM_FORMAT_UNKNOWN;
@@ -475,9 +480,9 @@ static void io_worker_routine_exit(struct io_worker *w) {
 
 static void *io_worker_routine(struct io_worker *w) {
 
-	const snd_pcm_format_t pcm_format = bluealsa_get_snd_pcm_format(&w->ba_pcm);
-	const ssize_t pcm_format_size = snd_pcm_format_size(pcm_format, 1);
-	const size_t pcm_1s_samples = w->ba_pcm.rate * w->ba_pcm.channels;
+	snd_pcm_format_t pcm_format = bluealsa_get_snd_pcm_format(&w->ba_pcm);
+	/* Sample rate of the audio stream received from the BlueALSA server. */
+	unsigned int rate = w->ba_pcm.rate;
 	/* Buffer for audio frames read from the BlueALSA server. */
 	ffb_t read_buffer = { 0 };
 	/* Buffer from which audio frames are written to the ALSA PCM. If the
@@ -486,14 +491,14 @@ static void *io_worker_routine(struct io_worker *w) {
 	ffb_t *write_buffer = &read_buffer;
 	/* Preferred format for the ALSA PCM. If not using the resampler then this
 	 * is the format of the incoming BlueALSA stream. */
-	snd_pcm_format_t format_1 = pcm_format;
+	snd_pcm_format_t format_1 = SND_PCM_FORMAT_UNKNOWN;
 	/* Alternative format that can be generated internally by the resampler.
 	 * This is only used if the resampler is enabled. */
 	snd_pcm_format_t format_2 = SND_PCM_FORMAT_UNKNOWN;
 
 #if WITH_LIBSAMPLERATE
 	/* The resampler requires the native endian format for the input data. */
-	const snd_pcm_format_t resampler_pcm_format = resampler_native_endian_format(pcm_format);
+	snd_pcm_format_t resampler_pcm_format = SND_PCM_FORMAT_UNKNOWN;
 	struct resampler resampler = { 0 };
 	ffb_t resampled_buffer = { 0 };
 	/* For detecting when the ALSA device has auto-started after reaching its
@@ -515,15 +520,6 @@ static void *io_worker_routine(struct io_worker *w) {
 	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &resampled_buffer);
 #endif
 
-	/* Create a buffer big enough to hold enough PCM data for three periods.
-	 * This will be later be revised if necessary to match the actual ALSA
-	 * start threshold when the ALSA PCM is opened. */
-	const size_t nmemb = ((size_t)pcm_period_time * 3 / 1000) * (pcm_1s_samples / 1000);
-	if (ffb_init(&read_buffer, nmemb, pcm_format_size) == -1) {
-		error("Couldn't create PCM buffer: %s", strerror(errno));
-		goto fail;
-	}
-
 	DBusError err = DBUS_ERROR_INIT;
 
 	/* initialize the PCM soft_volume setting */
@@ -542,14 +538,62 @@ static void *io_worker_routine(struct io_worker *w) {
 	}
 
 	debug("Opening BlueALSA source PCM: %s", w->ba_pcm.pcm_path);
-	if (!ba_dbus_pcm_open(&dbus_ctx, w->ba_pcm.pcm_path,
+
+	uint16_t open_format = 0;
+#if WITH_LIBSAMPLERATE
+	/* The resampler uses FLOAT internally, so ask the server to deliver
+	 * FLOAT samples. In such case the server converts audio in a single
+	 * pass and the resampler does not need an intermediate buffer. */
+	if (resampler_method != RESAMPLER_CONV_NONE &&
+			pcm_format != SND_PCM_FORMAT_FLOAT_LE)
+		open_format = 0xA420;
+#endif
+	/* Ask the server to resample audio to the fixed rate, so the ALSA
+	 * device does not need to be reopened when the BlueALSA PCM rate
+	 * changes, and there is no need for resampling on our side. The rate
+	 * is sent even if it equals the current BlueALSA PCM rate, because
+	 * the server shall keep it when the PCM rate changes later. */
+	const unsigned int open_rate = pcm_rate;
+
+	bool opened = false;
+	if (open_format != 0 || open_rate != 0) {
+		if (ba_dbus_pcm_open_with_props(&dbus_ctx, w->ba_pcm.pcm_path,
+					open_format, open_rate, &w->ba_pcm_fd, &w->ba_pcm_ctrl_fd, &err)) {
+			if (open_format != 0)
+				pcm_format = SND_PCM_FORMAT_FLOAT_LE;
+			if (open_rate != 0)
+				rate = open_rate;
+			w->rate_fixed = open_rate != 0;
+			opened = true;
+		}
+		else {
+			warn("Couldn't open BlueALSA source PCM with properties: %s", err.message);
+			dbus_error_free(&err);
+		}
+	}
+
+	if (!opened && !ba_dbus_pcm_open(&dbus_ctx, w->ba_pcm.pcm_path,
 				&w->ba_pcm_fd, &w->ba_pcm_ctrl_fd, &err)) {
 		error("Couldn't open BlueALSA source PCM: %s", err.message);
 		dbus_error_free(&err);
 		goto fail;
 	}
 
+	const size_t pcm_1s_samples = rate * w->ba_pcm.channels;
+	const ssize_t pcm_format_size = snd_pcm_format_size(pcm_format, 1);
+	format_1 = pcm_format;
+
+	/* Create a buffer big enough to hold enough PCM data for three periods.
+	 * This will be later be revised if necessary to match the actual ALSA
+	 * start threshold when the ALSA PCM is opened. */
+	const size_t nmemb = ((size_t)pcm_period_time * 3 / 1000) * (pcm_1s_samples / 1000);
+	if (ffb_init(&read_buffer, nmemb, pcm_format_size) == -1) {
+		error("Couldn't create PCM buffer: %s", strerror(errno));
+		goto fail;
+	}
+
 #if WITH_LIBSAMPLERATE
+	resampler_pcm_format = resampler_native_endian_format(pcm_format);
 	if (resampler_method != RESAMPLER_CONV_NONE) {
 		if (!resampler_is_input_format_supported(pcm_format))
 			warn("Resampler not enabled: Unsupported input format: %s",
@@ -582,7 +626,7 @@ static void *io_worker_routine(struct io_worker *w) {
 	size_t pcm_open_retries = 0;
 
 	struct delay_report dr;
-	delay_report_init(&dr, &dbus_ctx, &w->ba_pcm);
+	delay_report_init(&dr, &dbus_ctx, &w->ba_pcm, rate);
 
 	size_t pause_retry_pcm_samples = pcm_1s_samples;
 	size_t pause_retries = 0;
@@ -740,11 +784,11 @@ static void *io_worker_routine(struct io_worker *w) {
 			debug("Opening ALSA playback PCM: name=%s channels=%u rate%s=%u",
 					pcm_device, w->ba_pcm.channels,
 					pcm_flags & SND_PCM_NO_AUTO_RESAMPLE ? "~" : "",
-					w->ba_pcm.rate);
+					rate);
 
 			char *tmp = NULL;
 			int res = alsa_pcm_open(&w->alsa_pcm, pcm_device, format_1, format_2,
-						w->ba_pcm.channels, w->ba_pcm.rate, pcm_buffer_time,
+						w->ba_pcm.channels, rate, pcm_buffer_time,
 						pcm_period_time, pcm_flags, &tmp);
 			switch (res) {
 			case 0:
@@ -758,7 +802,7 @@ static void *io_worker_routine(struct io_worker *w) {
 				if (use_resampler && w->alsa_pcm.format == SND_PCM_FORMAT_UNKNOWN) {
 					free(tmp);
 					if (alsa_pcm_open(&w->alsa_pcm, pcm_device, format_1,
-								format_2, w->ba_pcm.channels, w->ba_pcm.rate,
+								format_2, w->ba_pcm.channels, rate,
 								pcm_buffer_time, pcm_period_time,
 								pcm_flags & ~SND_PCM_NO_AUTO_FORMAT, &tmp) == 0) {
 						break;
@@ -793,7 +837,7 @@ static void *io_worker_routine(struct io_worker *w) {
 								resampler_method,
 								w->ba_pcm.channels,
 								resampler_pcm_format,
-								w->ba_pcm.rate,
+								rate,
 								w->alsa_pcm.format,
 								w->alsa_pcm.rate,
 								w->alsa_pcm.start_threshold,
@@ -804,14 +848,14 @@ static void *io_worker_routine(struct io_worker *w) {
 
 #if DEBUG
 				if (verbose >= 4)
-					debug("PCM sample rate conversion: %u Hz -> %#.2f Hz", w->ba_pcm.rate,
-							w->ba_pcm.rate * resampler_current_rate_ratio(&resampler));
+					debug("PCM sample rate conversion: %u Hz -> %#.2f Hz", rate,
+							rate * resampler_current_rate_ratio(&resampler));
 #endif
 
 				/* The resampler output buffer is sized to accommodate the
 				 * result of resampling a full read_buffer, plus a little extra
 				 * to allow for positive adaptive resampling adjustment. */
-				size_t buffer_size = read_buffer.nmemb * w->alsa_pcm.rate / w->ba_pcm.rate;
+				size_t buffer_size = read_buffer.nmemb * w->alsa_pcm.rate / rate;
 				buffer_size = (buffer_size * 110) / 100;
 				ffb_init(&resampled_buffer, buffer_size, snd_pcm_format_size(w->alsa_pcm.format, 1));
 				write_buffer = &resampled_buffer;
@@ -854,7 +898,7 @@ static void *io_worker_routine(struct io_worker *w) {
 						"  ALSA mixer volume mapping: %s",
 						w->addr,
 						snd_pcm_format_name(pcm_format),
-						w->ba_pcm.rate,
+						rate,
 						w->ba_pcm.channels,
 						w->alsa_pcm.buffer_time, alsa_pcm_frames_to_bytes(&w->alsa_pcm, w->alsa_pcm.buffer_frames),
 						w->alsa_pcm.period_time, alsa_pcm_frames_to_bytes(&w->alsa_pcm, w->alsa_pcm.period_frames),
@@ -945,8 +989,8 @@ static void *io_worker_routine(struct io_worker *w) {
 			}
 
 			if (verbose >= 4 && rate_changed)
-				debug("PCM sample rate conversion: %u Hz -> %#.2f Hz", w->ba_pcm.rate,
-						w->ba_pcm.rate * resampler_current_rate_ratio(&resampler));
+				debug("PCM sample rate conversion: %u Hz -> %#.2f Hz", rate,
+						rate * resampler_current_rate_ratio(&resampler));
 		}
 #endif
 
@@ -984,13 +1028,14 @@ fail:
 }
 
 static bool pcm_hw_params_equal(
-		const struct ba_pcm *ba_pcm_1,
-		const struct ba_pcm *ba_pcm_2) {
-	if (ba_pcm_1->format != ba_pcm_2->format)
+		const struct io_worker *w,
+		const struct ba_pcm *ba_pcm) {
+	if (w->ba_pcm.format != ba_pcm->format)
 		return false;
-	if (ba_pcm_1->channels != ba_pcm_2->channels)
+	if (w->ba_pcm.channels != ba_pcm->channels)
 		return false;
-	if (ba_pcm_1->rate != ba_pcm_2->rate)
+	/* With the fixed rate, audio is resampled by the server. */
+	if (!w->rate_fixed && w->ba_pcm.rate != ba_pcm->rate)
 		return false;
 	return true;
 }
@@ -1026,7 +1071,7 @@ static struct io_worker *supervise_io_worker_start(const struct ba_pcm *ba_pcm)
 			/* If the codec has changed after the device connected, then the
 			 * audio format may have changed. If it has, the worker thread
 			 * needs to be restarted. Otherwise, update the running state. */
-			if (!pcm_hw_params_equal(&workers[i]->ba_pcm, ba_pcm)) {
+			if (!pcm_hw_params_equal(workers[i], ba_pcm)) {
 				io_worker_stop(workers[i]);
 				worker = workers[i];
 				worker_slot = i;
@@ -1072,6 +1117,7 @@ static struct io_worker *supervise_io_worker_start(const struct ba_pcm *ba_pcm)
 	alsa_pcm_init(&worker->alsa_pcm);
 	alsa_mixer_init(&worker->alsa_mixer, io_worker_mixer_event_callback, worker);
 	worker->active = !force_single_playback;
+	worker->rate_fixed = false;
 
 	debug("Starting IO worker %s", worker->addr);
 	if ((errno = pthread_create(&worker->thread, NULL,
@@ -1228,6 +1274,7 @@ int main(int argc, char *argv[]) {
 		{ "pcm", required_argument, NULL, 'D' },
 		{ "pcm-buffer-time", required_argument, NULL, 3 },
 		{ "pcm-period-time", required_argument, NULL, 4 },
+		{ "pcm-rate", required_argument, NULL, 11 },
 		{ "volume", required_argument, NULL, '8' },
 		{ "mixer-device", required_argument, NULL, 'M' },
 		{ "mixer-control", required_argument, NULL, 6 },
@@ -1268,6 +1315,7 @@ int main(int argc, char *argv[]) {
 					"  -D, --pcm=NAME\t\tplayback PCM device to use\n"
 					"  --pcm-buffer-time=INT\t\tplayback PCM buffer time\n"
 					"  --pcm-period-time=INT\t\tplayback PCM period time\n"
+					"  --pcm-rate=INT\t\tplayback PCM fixed sample rate\n"
 					"  --volume=TYPE\t\t\tvolume control type [auto|mixer|none|software]\n"
 					"  -M, --mixer-device=NAME\tmixer device to use\n"
 					"  --mixer-control=NAME\t\tmixer control name\n"
@@ -1358,6 +1406,9 @@ int main(int argc, char *argv[]) {
 		case 4 /* --pcm-period-time=INT */ :
 			pcm_period_time = atoi(optarg);
 			break;
+		case 11 /* --pcm-rate=INT */ :
+			pcm_rate = atoi(optarg);
+			break;
 
 		case '8' /* --volume */ : {
 
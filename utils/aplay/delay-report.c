@@ -29,10 +29,12 @@
 void delay_report_init(
 		struct delay_report *dr,
 		struct ba_dbus_ctx *dbus_ctx,
-		struct ba_pcm *ba_pcm) {
+		struct ba_pcm *ba_pcm,
+		unsigned int rate) {
 	memset(dr, 0, sizeof(*dr));
 	dr->dbus_ctx = dbus_ctx;
 	dr->ba_pcm = ba_pcm;
+	dr->rate = rate;
 }
 
 void delay_report_reset(
@@ -66,7 +68,7 @@ bool delay_report_update(
 		delay_frames_avg /= num_values;
 	dr->avg_value = delay_frames_avg;
 
-	const int client_delay = delay_frames_avg * 10000 / dr->ba_pcm->rate;
+	const int client_delay = delay_frames_avg * 10000 / dr->rate;
 	if (difftimespec(&ts_now, &ts_delay, &ts_delay) >= 0 ||
 			abs(client_delay - dr->ba_pcm->client_delay) < 100 /* 10ms */)
 		return true;
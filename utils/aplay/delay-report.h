@@ -30,6 +30,8 @@ struct delay_report {
 	struct ba_dbus_ctx *dbus_ctx;
 
 	struct ba_pcm *ba_pcm;
+	/* sample rate of the PCM stream */
+	unsigned int rate;
 
 	/* The time-stamp for delay update rate limiting. */
 	struct timespec update_ts;
@@ -44,7 +46,8 @@ struct delay_report {
 void delay_report_init(
 		struct delay_report *dr,
 		struct ba_dbus_ctx *dbus_ctx,
-		struct ba_pcm *ba_pcm);
+		struct ba_pcm *ba_pcm,
+		unsigned int rate);
 
 void delay_report_reset(
 		struct delay_report *dr);
@@ -65,7 +65,8 @@ static const struct timespec ts_stabilize = {
 bool resampler_is_input_format_supported(snd_pcm_format_t format) {
 	return format == SND_PCM_FORMAT_S16_LE ||
 		format == SND_PCM_FORMAT_S32_LE ||
-		format == SND_PCM_FORMAT_S24_LE;
+		format == SND_PCM_FORMAT_S24_LE ||
+		format == SND_PCM_FORMAT_FLOAT_LE;
 }
 
 /**
@@ -415,6 +416,11 @@ void resampler_convert_to_native_endian_format(
 		for (size_t n = 0; n < len; n++)
 			le32toh(data[n]);
 	} break;
+	case SND_PCM_FORMAT_FLOAT_LE: {
+		uint32_t *data = buffer;
+		for (size_t n = 0; n < len; n++)
+			data[n] = le32toh(data[n]);
+	} break;
 	default:
 		return;
 	}
@@ -450,6 +456,8 @@ snd_pcm_format_t resampler_native_endian_format(snd_pcm_format_t format) {
 		return SND_PCM_FORMAT_S32;
 	case SND_PCM_FORMAT_S32_LE:
 		return SND_PCM_FORMAT_S32;
+	case SND_PCM_FORMAT_FLOAT_LE:
+		return SND_PCM_FORMAT_FLOAT;
 	default:
 		return format;
 	}